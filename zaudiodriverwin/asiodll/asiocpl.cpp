@@ -98,7 +98,8 @@ Init
 	IN		ULONG		NumberOfBitDepths, 
 	IN		ULONG		PreferredBitDepthIndex, 
 	IN		BOOL		PerApplicationPreferences,
-	IN		CHAR *		DeviceName
+	IN		CHAR *		DeviceName,
+	IN		CAsioLoadMeter *	LoadMeter
 )
 {
     _DbgPrintF(DEBUGLVL_VERBOSE,("[CAsioControlPanel::Init]"));
@@ -139,6 +140,9 @@ Init
 	// Device name
 	strcpy(m_DeviceName, DeviceName);
 
+	// DSP load, if the driver meters it
+	m_LoadMeter = LoadMeter;
+
 	return ASE_OK;
 }
 
@@ -203,6 +207,7 @@ DialogProc
 		{
 			HANDLE_MSG(Dlg, WM_INITDIALOG,   CAsioControlPanel::m_ActiveCpl->_OnInitDialog);
 			HANDLE_MSG(Dlg, WM_COMMAND,      CAsioControlPanel::m_ActiveCpl->_OnCommand);
+			HANDLE_MSG(Dlg, WM_TIMER,        CAsioControlPanel::m_ActiveCpl->_OnTimer);
 		}
 
 		return FALSE;
@@ -303,6 +308,11 @@ _OnInitDialog
 
 	SendMessage(CheckBox, BM_SETCHECK, m_PerApplicationPreferences ? BST_CHECKED : BST_UNCHECKED, 0);
 
+	// DSP load, refreshed while the dialog is up.
+	_UpdateLoad(Dlg);
+
+	SetTimer(Dlg, ASIO_CPL_LOAD_TIMER_ID, ASIO_CPL_LOAD_TIMER_PERIOD, NULL);
+
 	return TRUE;
 }
 
@@ -357,4 +367,67 @@ _OnCommand
 	}
 }
 
+/*****************************************************************************
+ * CAsioControlPanel::_OnTimer()
+ *****************************************************************************
+ * Process the WM_TIMER message which is sent when the refresh timer of the
+ * DSP load expires. The timer goes away with the dialog.
+ */
+VOID
+CAsioControlPanel::
+_OnTimer
+(
+    IN      HWND    Dlg,
+    IN      UINT    Id
+)
+{
+	if (Id == ASIO_CPL_LOAD_TIMER_ID)
+	{
+		_UpdateLoad(Dlg);
+	}
+}
+
+/*****************************************************************************
+ * CAsioControlPanel::_UpdateLoad()
+ *****************************************************************************
+ * Show the DSP load since the engine started: the time of a buffer switch
+ * relative to the period, on average and at the worst, the switches that
+ * took longer than a period, and how much of it is the host's callback.
+ */
+VOID
+CAsioControlPanel::
+_UpdateLoad
+(
+    IN      HWND    Dlg
+)
+{
+	TCHAR Format[256], Text[256], Detail[256];
+
+	ASIO_LOAD_STATISTICS Statistics;
+
+	if (m_LoadMeter && m_LoadMeter->GetStatistics(&Statistics) && Statistics.NumberOfSwitches && Statistics.Period)
+	{
+		ULONG Average = ULONG((Statistics.Switch.Total / Statistics.NumberOfSwitches) * 100 / Statistics.Period);
+
+		ULONG Peak = ULONG((ULONGLONG(Statistics.Switch.Maximum) * 100) / Statistics.Period);
+
+		LoadString(hDllInstance, IDS_DSPLOAD, Format, sizeof(Format)/sizeof(TCHAR));
+		sprintf(Text, Format, Average, Peak, Statistics.DeadlineMisses);
+
+		PASIO_LOAD_TIME Host = &Statistics.Stages[ASIO_LOAD_STAGE_HOST];
+
+		LoadString(hDllInstance, IDS_DSPLOADDETAIL, Format, sizeof(Format)/sizeof(TCHAR));
+		sprintf(Detail, Format, Host->Minimum / 1000, ULONG(Host->Total / Statistics.NumberOfSwitches) / 1000, Host->Maximum / 1000, Statistics.Period / 1000);
+	}
+	else
+	{
+		LoadString(hDllInstance, IDS_DSPLOADIDLE, Text, sizeof(Text)/sizeof(TCHAR));
+
+		Detail[0] = 0;
+	}
+
+	SetDlgItemText(Dlg, IDC_DSPLOAD, Text);
+	SetDlgItemText(Dlg, IDC_DSPLOADDETAIL, Detail);
+}
+
 
@@ -32,10 +32,14 @@
 #define _ASIO_CONTROL_PANEL_H_
 
 #include "asiodll.h"
+#include "loadmeter.h"
 
 /*****************************************************************************
  * Defines
  */
+/*! @brief Refresh timer of the DSP load, and its period in ms. */
+#define ASIO_CPL_LOAD_TIMER_ID		1
+#define ASIO_CPL_LOAD_TIMER_PERIOD	500
 
 /*****************************************************************************
  * Classes
@@ -58,6 +62,7 @@ private:
 	ULONG			m_PreferredBitDepthIndex;
 	BOOL			m_PerApplicationPreferences;
 	CHAR			m_DeviceName[MAX_PATH];
+	CAsioLoadMeter *	m_LoadMeter;
 
 	static CAsioControlPanel *	m_ActiveCpl;
 
@@ -79,6 +84,17 @@ private:
 		IN      UINT    NotificationCode
 	);
 
+	VOID _OnTimer
+	(
+		IN      HWND    Dlg,
+		IN      UINT    Id
+	);
+
+	VOID _UpdateLoad
+	(
+		IN      HWND    Dlg
+	);
+
 public:
 	CAsioControlPanel();
 	~CAsioControlPanel();
@@ -96,7 +112,8 @@ public:
 		IN		ULONG		NumberOfBitDepths, 
 		IN		ULONG		PreferredBitDepthIndex, 
 		IN		BOOL		PerApplicationPreferences,
-		IN		CHAR *		DeviceName
+		IN		CHAR *		DeviceName,
+		IN		CAsioLoadMeter *	LoadMeter
 	);
 
 	ASIOError Run
@@ -140,6 +140,20 @@ CAsioDriver::
 			CloseHandle(m_AsioControlEvent[i]);
 	}
 
+	if (m_CompletionPort)
+		CloseHandle(m_CompletionPort);
+
+	if (m_SharedRingEvent)
+		CloseHandle(m_SharedRingEvent);
+
+	m_LoadMeter.Attach(NULL);
+
+	if (m_LoadSectionView)
+		UnmapViewOfFile(m_LoadSectionView);
+
+	if (m_LoadSection)
+		CloseHandle(m_LoadSection);
+
 	if(m_WatchDogEvent[0])
 		CloseHandle(m_WatchDogEvent[0]);
 
@@ -414,6 +428,26 @@ Init
 		m_XuClockSourceNodeId = _FindXuNode(m_XuPropSetClockSource);
 		m_XuDirectMonitorNodeId = _FindXuNode(m_XuPropSetDirectMonitor);
 		m_XuDriverResyncNodeId = _FindXuNode(m_XuPropSetDriverResync);
+
+		// Name the load meter after the device, so monitors can find it.
+		// Another instance on the device keeps it, this one meters privately.
+		CHAR SectionName[64]; sprintf(SectionName, ASIO_LOAD_SECTION_NAME, vid, pid);
+
+		m_LoadSection = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(ASIO_LOAD_SECTION), SectionName);
+
+		if (m_LoadSection && (GetLastError() == ERROR_ALREADY_EXISTS))
+		{
+			CloseHandle(m_LoadSection);
+
+			m_LoadSection = NULL;
+		}
+
+		if (m_LoadSection)
+		{
+			m_LoadSectionView = MapViewOfFile(m_LoadSection, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(ASIO_LOAD_SECTION));
+		}
+
+		m_LoadMeter.Attach(m_LoadSectionView);
 	}
 
 	if (SUCCEEDED(hr))
@@ -424,6 +458,17 @@ Init
 			m_AsioControlEvent[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
 		}
 
+		// Initialize the completion port of the main thread...
+		m_CompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+
+		if (!m_CompletionPort)
+		{
+			hr = E_OUTOFMEMORY;
+		}
+
+		// Initialize the shared ring event...
+		m_SharedRingEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
 		// Initialize the watchdog events...
 		m_WatchDogEvent[0] = CreateEvent(NULL, FALSE, FALSE, NULL);
 		m_WatchDogEvent[1] = CreateWaitableTimer(NULL, FALSE, NULL);
@@ -628,6 +673,14 @@ Init
 	{
 		_GetAppHacks();
 
+		m_FloatOption = _GetFloatOption();
+
+		m_EarlyOutputOption = _GetEarlyOutputOption();
+
+		m_AdaptiveTransferDepthOption = _GetAdaptiveTransferDepthOption();
+
+		m_OutputReadyCalled = FALSE;
+
 		m_StateTransitionEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 
 		m_DriverState = DRIVER_STATE_INITIALIZED;
@@ -724,7 +777,7 @@ Start
 		{
 			m_DriverState = DRIVER_STATE_RUNNING;
 
-			SetEvent(m_AsioControlEvent[ASIO_CONTROL_EVENT_START]);
+			_SignalControlEvent(ASIO_CONTROL_EVENT_START);
 
 			WaitForSingleObject(m_StateTransitionEvent, INFINITE);
 		}
@@ -762,7 +815,7 @@ Stop
 	{
 		if (m_DriverState == DRIVER_STATE_RUNNING)
 		{
-			SetEvent(m_AsioControlEvent[ASIO_CONTROL_EVENT_STOP]);
+			_SignalControlEvent(ASIO_CONTROL_EVENT_STOP);
 
 			WaitForSingleObject(m_StateTransitionEvent, INFINITE);
 		}
@@ -914,12 +967,15 @@ GetLatencies
 
 	if (ASE_OK == asioError)
 	{
+		// The packets queued ahead of the host's output, as a start queues them.
+		CAsioSchedule Schedule; Schedule.Initialize(NUMBER_OF_DATA_PACKETS, m_NumberOfOutputBuffers, _IsEarlyOutput());
+
 		if (m_DriverState == DRIVER_STATE_PREPARED)
 		{
 			// Include the audio buffer size of the ASIOCreateBuffers() call.
 			InputLatency = LONG(m_BufferSizeInSamples + TIME_100NS_SAMPLES(m_SelectedDataRangeAsio[1]->Latency.Time, m_SamplingFrequency));
 								
-			OutputLatency = LONG((m_BufferSizeInSamples * (m_NumberOfOutputBuffers - 1)) + TIME_100NS_SAMPLES(m_SelectedDataRangeAsio[0]->Latency.Time, m_SamplingFrequency));
+			OutputLatency = LONG(Schedule.GetOutputLatency(m_BufferSizeInSamples) + TIME_100NS_SAMPLES(m_SelectedDataRangeAsio[0]->Latency.Time, m_SamplingFrequency));
 		}
 		else
 		{
@@ -927,7 +983,7 @@ GetLatencies
 			// should assume preferred buffer size.
 			InputLatency = LONG(TIME_100NS_SAMPLES(m_PreferredBufferSize, m_SamplingFrequency) + TIME_100NS_SAMPLES(m_SelectedDataRangeAsio[1]->Latency.Time, m_SamplingFrequency));
 								
-			OutputLatency = LONG((TIME_100NS_SAMPLES(m_PreferredBufferSize, m_SamplingFrequency) * (m_NumberOfOutputBuffers - 1)) + TIME_100NS_SAMPLES(m_SelectedDataRangeAsio[0]->Latency.Time, m_SamplingFrequency));
+			OutputLatency = LONG(Schedule.GetOutputLatency(ULONG(TIME_100NS_SAMPLES(m_PreferredBufferSize, m_SamplingFrequency))) + TIME_100NS_SAMPLES(m_SelectedDataRangeAsio[0]->Latency.Time, m_SamplingFrequency));
 		}
 	}
 
@@ -1219,7 +1275,7 @@ SetSampleRate
 
 				// Send a reset request because we need to shut down and restart the
 				// buffers.
-				SetEvent(m_AsioControlEvent[ASIO_CONTROL_EVENT_RESET]);
+				_SignalControlEvent(ASIO_CONTROL_EVENT_RESET);
 			}
 		}
 	}
@@ -1504,7 +1560,8 @@ GetChannelInfo
 				Info->isActive = (ChannelDescriptor->InUse && ChannelDescriptor->PinDescriptor->Active);
 				Info->channelGroup = ChannelDescriptor->PinDescriptor->KsAudioPin->GetPinId();
 				//FIXME: This should be check against the actual type, ie the wFormatTag first.
-				Info->type = (m_SampleSize == 16) ? ASIOSTInt16LSB : 
+				Info->type = (m_FloatOption != ASIO_FLOAT_OPTION_NONE) ? ASIOSTFloat32LSB :
+							(m_SampleSize == 16) ? ASIOSTInt16LSB : 
 							#ifdef USE_24_BIT_PADDED
 							(m_SampleSize == 24) ? ASIOSTInt32LSB : 
  							#else
@@ -1592,13 +1649,30 @@ CreateBuffers
 
 	ASIOError asioError = GetChannels(&NumInputChannels, &NumOutputChannels);
 
-	if (ASE_OK == asioError)
+	if ((ASE_OK == asioError) && m_AdaptiveTransferDepthOption)
 	{
 		// Inform the underlying kernel driver about the ASIO buffer size. 
 		// The number of FIFO buffers needed is one less than the buffer size (in ms), but a minimum of 2 is required for proper operation.
 		//ULONG NumberOfFifoBuffers = (((BufferSize * 1000 + m_SamplingFrequency - 1)/ m_SamplingFrequency) * (m_NumberOfOutputBuffers - 1)) - 1; NumberOfFifoBuffers = (NumberOfFifoBuffers >= 2) ? NumberOfFifoBuffers : 2;
 
 		//m_AudioRenderFilter->SetPropertySimple(KSPROPSETID_DeviceControl, KSPROPERTY_DEVICECONTROL_PIN_OUTPUT_CFIFO_BUFFERS, &NumberOfFifoBuffers, sizeof(NumberOfFifoBuffers));
+
+		// Keep about one ASIO buffer worth of IRPs in flight on the USB pipes, and let 
+		// the driver deepen it if the completions start running late.
+		PIN_TRANSFER_DEPTH TransferDepth; ZeroMemory(&TransferDepth, sizeof(TransferDepth));
+
+		TransferDepth.Adaptive = TRUE;
+		TransferDepth.LatencyInMs = (BufferSize * 1000 + m_SamplingFrequency - 1) / m_SamplingFrequency;
+
+		if (m_AudioRenderFilter)
+		{
+			m_AudioRenderFilter->SetPropertySimple(KSPROPSETID_DeviceControl, KSPROPERTY_DEVICECONTROL_PIN_OUTPUT_TRANSFER_DEPTH, &TransferDepth, sizeof(TransferDepth));
+		}
+
+		if (m_AudioCaptureFilter)
+		{
+			m_AudioCaptureFilter->SetPropertySimple(KSPROPSETID_DeviceControl, KSPROPERTY_DEVICECONTROL_PIN_INPUT_TRANSFER_DEPTH, &TransferDepth, sizeof(TransferDepth));
+		}
 	}
 
 	if (ASE_OK == asioError)
@@ -1645,6 +1719,11 @@ CreateBuffers
 		m_AsioCallbacks = *Callbacks;
 	}
 
+	if (ASE_OK == asioError)
+	{
+		asioError = _MapSharedRings();
+	}
+
 	if (ASE_OK == asioError)
 	{
 		asioError = _AllocateIoThreads();
@@ -1701,6 +1780,11 @@ DisposeBuffers
 		asioError = _DisposeIoThreads();
 	}
 
+	if (ASE_OK == asioError)
+	{
+		asioError = _UnmapSharedRings();
+	}
+
 	if (ASE_OK == asioError)
 	{
 		if (NumInputChannels)
@@ -1794,7 +1878,7 @@ ControlPanel
 			}
 		}
 
-		if (ASE_OK == AsioControlPanel->Init(m_WndMain, &m_SupportedBufferSizes[m_MinimumBufferSizeArrayOffset], SIZEOF_ARRAY(m_SupportedBufferSizes)-m_MinimumBufferSizeArrayOffset, BufferSizeIndex, BitDepths, NumberOfBitDepths, BitDepthIndex, m_PerApplicationPreferences, m_FriendlyName))
+		if (ASE_OK == AsioControlPanel->Init(m_WndMain, &m_SupportedBufferSizes[m_MinimumBufferSizeArrayOffset], SIZEOF_ARRAY(m_SupportedBufferSizes)-m_MinimumBufferSizeArrayOffset, BufferSizeIndex, BitDepths, NumberOfBitDepths, BitDepthIndex, m_PerApplicationPreferences, m_FriendlyName, &m_LoadMeter))
 		{
 			DOUBLE BufferSize = FLOAT(m_PreferredBufferSize) / 10000;
 
@@ -1838,7 +1922,7 @@ ControlPanel
 			{
 				// Send a reset request because we need to shut down and restart the
 				// buffers.
-				SetEvent(m_AsioControlEvent[ASIO_CONTROL_EVENT_RESET]);
+				_SignalControlEvent(ASIO_CONTROL_EVENT_RESET);
 			}
 		}
 
@@ -2131,16 +2215,32 @@ OutputReady
 {
     //_DbgPrintF(DEBUGLVL_VERBOSE,("[CAsioDriver::OutputReady] - 0x%x", m_DriverState));
 
+	// The host uses it, so the output can be queued as soon as it is ready
+	// (from the next start on).
+	m_OutputReadyCalled = TRUE;
+
 	if (m_DriverState == DRIVER_STATE_RUNNING)
 	{
-		//FIXME: Make changes to support asynchronous OutputReady...
-		ULONG PacketIndex = ULONG((m_CurrentSamplePosition / m_BufferSizeInSamples) + m_NumberOfOutputBuffers) % NUMBER_OF_DATA_PACKETS;
-
 		ULONG BufferIndex = ULONG(m_CurrentSamplePosition / m_BufferSizeInSamples) % 2;
 
-		//dbgprintf("OutputReady[%d]: %d\n", BufferIndex, timeGetTime());
+		if (m_SharedRingMode)
+		{
+			_SyncWriteSharedRings(m_PreparedDataRangeAsio[0], BufferIndex);
+		}
+		else if (m_OutputSchedule.IsEarlyOutput())
+		{
+			// Fill and queue the packet of the switch now.
+			_SyncSendOutput(m_PreparedDataRangeAsio);
+		}
+		else
+		{
+			//FIXME: Make changes to support asynchronous OutputReady...
+			ULONG PacketIndex = m_OutputSchedule.GetPacketIndex(m_CurrentSamplePosition / m_BufferSizeInSamples);
+
+			//dbgprintf("OutputReady[%d]: %d\n", BufferIndex, timeGetTime());
 
-		_SyncWritePinData(m_PreparedDataRangeAsio[0], PacketIndex, BufferIndex);
+			_SyncWritePinData(m_PreparedDataRangeAsio[0], PacketIndex, BufferIndex);
+		}
 	}
 
 	return ASE_OK;
@@ -2710,6 +2810,8 @@ _BuildFilterDataRanges
 					PinDescriptor->Active = FALSE;
 					PinDescriptor->NumberOfActiveChannels = 0;
 					PinDescriptor->BufferSizeInSamples = 0;
+					PinDescriptor->CopyRoutine = NULL;
+					PinDescriptor->ScratchBuffer = NULL;
 
 					for (ULONG iPacket=0; iPacket<NUMBER_OF_DATA_PACKETS; iPacket++)
 					{
@@ -2853,6 +2955,11 @@ _AllocateBuffers
 					ULONG SampleSize = m_SampleSize;
 					#endif // USE_24_BIT_PADDED
 
+					if (m_FloatOption != ASIO_FLOAT_OPTION_NONE)
+					{
+						SampleSize = 32;
+					}
+
 					ChannelDescriptor->Buffer[0] = LocalAlloc(LPTR, BufferSizeInSamples * SampleSize / 8);
 					ChannelDescriptor->Buffer[1] = LocalAlloc(LPTR, BufferSizeInSamples * SampleSize / 8);
 					ChannelDescriptor->BufferSizeInSamples = BufferSizeInSamples;
@@ -2940,6 +3047,65 @@ _AllocateBuffers
 							break;
 						}
 					}
+
+					// Gather the buffers of the channels on this pin, so that the 
+					// copy routine moves all of them in one pass. The channels not 
+					// in use share a scratch buffer, which stays zeroed on output.
+					if (PinDescriptor->Active)
+					{
+						#ifdef USE_24_BIT_PADDED
+						BOOL Padded = (m_SampleSize == 24);
+						#else
+						BOOL Padded = FALSE;
+						#endif // USE_24_BIT_PADDED
+
+						ULONG SampleSize = (Padded || (m_FloatOption != ASIO_FLOAT_OPTION_NONE)) ? 32 : m_SampleSize;
+
+						PinDescriptor->ScratchBuffer = LocalAlloc(LPTR, BufferSizeInSamples * SampleSize / 8);
+
+						if (PinDescriptor->ScratchBuffer)
+						{
+							BOOL ChannelsInUse = FALSE;
+
+							for (ULONG iChannel = 0; iChannel < MAXIMUM_NUMBER_OF_CHANNEL_DESCRIPTORS; iChannel++)
+							{
+								PinDescriptor->ChannelBuffers[0][iChannel] = PinDescriptor->ScratchBuffer;
+								PinDescriptor->ChannelBuffers[1][iChannel] = PinDescriptor->ScratchBuffer;
+							}
+
+							for (ULONG iChannel = 0; iChannel < DataRangeAsio->ChannelDescriptorCount; iChannel++)
+							{
+								PASIO_CHANNEL_DESCRIPTOR ChannelDescriptor = &DataRangeAsio->ChannelDescriptors[iChannel];
+
+								if ((ChannelDescriptor->PinDescriptor == PinDescriptor) && (ChannelDescriptor->InUse) && 
+									(ChannelDescriptor->Buffer[0]) && (ChannelDescriptor->Buffer[1]) &&
+									(ChannelDescriptor->ChannelIndex < PinDescriptor->NumberOfActiveChannels))
+								{
+									PinDescriptor->ChannelBuffers[0][ChannelDescriptor->ChannelIndex] = ChannelDescriptor->Buffer[0];
+									PinDescriptor->ChannelBuffers[1][ChannelDescriptor->ChannelIndex] = ChannelDescriptor->Buffer[1];
+
+									ChannelsInUse = TRUE;
+								}
+							}
+
+							if (ChannelsInUse)
+							{
+								if (m_FloatOption != ASIO_FLOAT_OPTION_NONE)
+								{
+									// Convert from/to float in the same pass.
+									PinDescriptor->CopyRoutine = FindAsioFloatCopyRoutine(Input ? ASIO_COPY_DEINTERLEAVE : ASIO_COPY_INTERLEAVE, m_SampleSize, (m_FloatOption == ASIO_FLOAT_OPTION_DITHER));
+								}
+								else
+								{
+									PinDescriptor->CopyRoutine = FindAsioCopyRoutine(Input ? ASIO_COPY_DEINTERLEAVE : ASIO_COPY_INTERLEAVE, m_SampleSize, Padded);
+								}
+							}
+						}
+						else
+						{
+							asioError = ASE_NoMemory;
+						}
+					}
 				}
 			}
 		}
@@ -2988,6 +3154,15 @@ _DisposeBuffers
 					}
 				}
 
+				if (PinDescriptor->ScratchBuffer)
+				{
+					LocalFree(PinDescriptor->ScratchBuffer);
+
+					PinDescriptor->ScratchBuffer = NULL;
+				}
+
+				PinDescriptor->CopyRoutine = NULL;
+
 				PinDescriptor->NumberOfActiveChannels = 0;
 				PinDescriptor->BufferSizeInSamples = 0;
 
@@ -3039,11 +3214,55 @@ _AllocateIoThreads
 {
 	ASIOError asioError = ASE_OK;
 
-	m_IoThreadHandle[0] = CreateThread(NULL, 0, MainThreadRoutine, this, CREATE_SUSPENDED, NULL);
+	// Drop the completions left over from the pins of the last run.
+	ULONG NumberOfBytes; ULONG_PTR CompletionKey; LPOVERLAPPED Overlapped;
+
+	while (GetQueuedCompletionStatus(m_CompletionPort, &NumberOfBytes, &CompletionKey, &Overlapped, 0) || Overlapped)
+	{
+		// Nothing to do...
+	}
+
+	// The packet completions of the active pins are queued to the main thread
+	// through the completion port, along with the control events.
+	for (ULONG i=0; (i<2) && (ASE_OK == asioError); i++)
+	{
+		PFILTER_DATARANGE_ASIO DataRangeAsio = m_PreparedDataRangeAsio[i];
+
+		for (ULONG iPin = 0; iPin < DataRangeAsio->PinDescriptorCount; iPin++)
+		{
+			PASIO_PIN_DESCRIPTOR PinDescriptor = &DataRangeAsio->PinDescriptors[iPin];
+
+			if (PinDescriptor->Active)
+			{
+				if (!CreateIoCompletionPort(PinDescriptor->KsAudioPin->GetHandle(), m_CompletionPort, ASIO_COMPLETION_KEY_PIN(i, iPin), 0))
+				{
+					_DbgPrintF(DEBUGLVL_TERSE,("[CAsioDriver::_AllocateIoThreads] - Failed to associate pin: %d", GetLastError()));
+
+					asioError = ASE_HWMalfunction;
+					break;
+				}
+			}
+		}
+	}
+
+	if (ASE_OK == asioError)
+	{
+		// Pick up any control event that was signaled while there was no main 
+		// thread.
+		for (ULONG i=0; i<ASIO_CONTROL_EVENT_COUNT; i++)
+		{
+			PostQueuedCompletionStatus(m_CompletionPort, 0, i, NULL);
+		}
+	}
 
-	if (!m_IoThreadHandle[0])
+	if (ASE_OK == asioError)
 	{
-		asioError = ASE_NoMemory;
+		m_IoThreadHandle[0] = CreateThread(NULL, 0, MainThreadRoutine, this, CREATE_SUSPENDED, NULL);
+
+		if (!m_IoThreadHandle[0])
+		{
+			asioError = ASE_NoMemory;
+		}
 	}
 
 	if (ASE_OK == asioError)
@@ -3115,7 +3334,7 @@ _DisposeIoThreads
 			}
 			else
 			{
-				SetEvent(m_AsioControlEvent[ASIO_CONTROL_EVENT_ABORT]);
+				_SignalControlEvent(ASIO_CONTROL_EVENT_ABORT);
 			}
 
 			// Wait for the thread to exit...
@@ -3138,6 +3357,154 @@ _DisposeIoThreads
 	return ASE_OK;
 }
 
+/*****************************************************************************
+ * CAsioDriver::_MapSharedRings()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Map a ring on each of the active pins, so that the data goes through 
+ * shared memory instead of a read/write IOCTL per packet.
+ * @details
+ * The rings are only used if all the active pins have one. Otherwise the
+ * driver falls back to the packets.
+ */
+ASIOError
+CAsioDriver::
+_MapSharedRings
+(	void
+)
+{
+	m_SharedRingMode = FALSE;
+
+	if (!_GetSharedRingOption())
+	{
+		return ASE_OK;
+	}
+
+	BOOL Mapped = TRUE;
+
+	for (ULONG i=0; (i<2) && Mapped; i++)
+	{
+		PFILTER_DATARANGE_ASIO DataRangeAsio = m_PreparedDataRangeAsio[i];
+
+		for (ULONG iPin = 0; (iPin < DataRangeAsio->PinDescriptorCount) && Mapped; iPin++)
+		{
+			PASIO_PIN_DESCRIPTOR PinDescriptor = &DataRangeAsio->PinDescriptors[iPin];
+
+			if (PinDescriptor->Active)
+			{
+				// A period per buffer switch, as many as there are packets.
+				SHARED_RING_PARAMETERS Parameters;
+
+				Parameters.PeriodSize = PinDescriptor->NumberOfActiveChannels * PinDescriptor->BufferSizeInSamples * m_SampleSize / 8;
+				Parameters.BufferSize = NUMBER_OF_DATA_PACKETS * Parameters.PeriodSize;
+				Parameters.NotificationEvent = ULONGLONG(ULONG_PTR(m_SharedRingEvent));
+
+				SHARED_RING_MAPPING Mapping; ZeroMemory(&Mapping, sizeof(Mapping));
+
+				HRESULT hr = PinDescriptor->KsAudioPin->GetPropertySimple(KSPROPSETID_SharedRing, KSPROPERTY_SHAREDRING_MAP, &Mapping, sizeof(Mapping), &Parameters, sizeof(Parameters));
+
+				if (SUCCEEDED(hr))
+				{
+					if ((Mapping.Size == SHARED_RING_CONTROL_SIZE + Parameters.BufferSize) && (ULONGLONG(ULONG_PTR(Mapping.Address)) == Mapping.Address))
+					{
+						SharedRingAttach(&PinDescriptor->SharedRing, PVOID(ULONG_PTR(Mapping.Address)), Parameters.BufferSize, Parameters.PeriodSize);
+					}
+					else
+					{
+						// Not something this process can use.
+						ULONG Unmap = 0;
+
+						PinDescriptor->KsAudioPin->SetPropertySimple(KSPROPSETID_SharedRing, KSPROPERTY_SHAREDRING_UNMAP, &Unmap, sizeof(Unmap));
+
+						Mapped = FALSE;
+					}
+				}
+				else
+				{
+					Mapped = FALSE;
+				}
+			}
+		}
+	}
+
+	if (Mapped)
+	{
+		m_SharedRingMode = TRUE;
+	}
+	else
+	{
+		_UnmapSharedRings();
+	}
+
+	_DbgPrintF(DEBUGLVL_VERBOSE,("[CAsioDriver::_MapSharedRings] - SharedRingMode: %d", m_SharedRingMode));
+
+	return ASE_OK;
+}
+
+/*****************************************************************************
+ * CAsioDriver::_UnmapSharedRings()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Unmap the rings of the pins. The pins must be stopped.
+ */
+ASIOError
+CAsioDriver::
+_UnmapSharedRings
+(	void
+)
+{
+	for (ULONG i=0; i<2; i++)
+	{
+		PFILTER_DATARANGE_ASIO DataRangeAsio = m_PreparedDataRangeAsio[i];
+
+		if (DataRangeAsio)
+		{
+			for (ULONG iPin = 0; iPin < DataRangeAsio->PinDescriptorCount; iPin++)
+			{
+				PASIO_PIN_DESCRIPTOR PinDescriptor = &DataRangeAsio->PinDescriptors[iPin];
+
+				if (PinDescriptor->SharedRing.Control)
+				{
+					ULONG Unmap = 0;
+
+					PinDescriptor->KsAudioPin->SetPropertySimple(KSPROPSETID_SharedRing, KSPROPERTY_SHAREDRING_UNMAP, &Unmap, sizeof(Unmap));
+
+					ZeroMemory(&PinDescriptor->SharedRing, sizeof(SHARED_RING));
+				}
+			}
+		}
+	}
+
+	m_SharedRingMode = FALSE;
+
+	return ASE_OK;
+}
+
+/*****************************************************************************
+ * CAsioDriver::_SignalControlEvent()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Signal a control event to the main thread.
+ * @details
+ * The event latches the request; the completion packet wakes up the main
+ * thread, which consumes the event. Requests made while there is no main 
+ * thread are picked up when the next one starts.
+ */
+VOID
+CAsioDriver::
+_SignalControlEvent
+(
+	IN		ULONG	ControlEvent
+)
+{
+	SetEvent(m_AsioControlEvent[ControlEvent]);
+
+	PostQueuedCompletionStatus(m_CompletionPort, 0, ControlEvent, NULL);
+}
+
 /*****************************************************************************
  * CAsioDriver::_DetermineDriverCapabilities()
  *****************************************************************************
@@ -3321,7 +3688,7 @@ _NodeThreadHandler
 
 							// Send a reset request because we need to shut down and restart the
 							// buffers.
-							SetEvent(m_AsioControlEvent[ASIO_CONTROL_EVENT_RESET]);
+							_SignalControlEvent(ASIO_CONTROL_EVENT_RESET);
 						}
 					}
 				}
@@ -3353,7 +3720,7 @@ _NodeThreadHandler
 					{
 						// Send a reset request because we need to shut down and restart the
 						// buffers.
-						SetEvent(m_AsioControlEvent[ASIO_CONTROL_EVENT_RESET]);
+						_SignalControlEvent(ASIO_CONTROL_EVENT_RESET);
 					}
 				}
 			}
@@ -3409,38 +3776,25 @@ _MainThreadHandler
 		}
 	}
 
-	HANDLE EventPool[ASIO_CONTROL_EVENT_COUNT + (2 * MAXIMUM_NUMBER_OF_PIN_DESCRIPTORS * NUMBER_OF_DATA_PACKETS)];
+	// Buffer switch state machine.
+	CAsioEngine Engine;
+
+	Engine.Initialize(DataRangeAsio[0]->ActivePinMask, DataRangeAsio[1]->ActivePinMask, ActiveSignalMask);
 
-	ULONG NumberOfEvents = 0;
+	// Filters the wake up jitter out of the buffer switch time stamps.
+	CAsioClock Clock;
+
+	// With the shared rings, the pins signal the ring event rather than 
+	// completing packets.
+	HANDLE EventPool[ASIO_CONTROL_EVENT_COUNT+1];
 
-	// ASIO control events...
 	for (ULONG i=0; i<ASIO_CONTROL_EVENT_COUNT; i++)
 	{
-		EventPool[NumberOfEvents] = m_AsioControlEvent[i]; NumberOfEvents++;
+		EventPool[i] = m_AsioControlEvent[i];
 	}
 
-	// Output pin events...
-	for (ULONG k=0; k<MAXIMUM_NUMBER_OF_PIN_DESCRIPTORS; k++)
-	{
-		PDATA_PACKET Packet = DataRangeAsio[0]->PinDescriptors[k].Packets;
-
-		for (ULONG iPacket=0; iPacket<NUMBER_OF_DATA_PACKETS; iPacket++)
-		{
-			ResetEvent(Packet[iPacket].Signal.hEvent); EventPool[NumberOfEvents] = Packet[iPacket].Signal.hEvent; NumberOfEvents++;
-		}
-	}
-	
-	// Input pin events...
-	for (ULONG k=0; k<MAXIMUM_NUMBER_OF_PIN_DESCRIPTORS; k++)
-	{
-		PDATA_PACKET Packet = DataRangeAsio[1]->PinDescriptors[k].Packets;
+	EventPool[ASIO_CONTROL_EVENT_COUNT] = m_SharedRingEvent;
 
-		for (ULONG iPacket=0; iPacket<NUMBER_OF_DATA_PACKETS; iPacket++)
-		{
-			ResetEvent(Packet[iPacket].Signal.hEvent); EventPool[NumberOfEvents] = Packet[iPacket].Signal.hEvent; NumberOfEvents++;
-		}
-	}
-	
 	BOOL Abort = FALSE;
 
 	KSSTATE State = KSSTATE_STOP;
@@ -3448,32 +3802,66 @@ _MainThreadHandler
 	// WatchDog time out
 	LARGE_INTEGER TimeOut; TimeOut.QuadPart=-10000*2000; // 2000ms
 
-	// Global signal mask.
-	ULONG SignalMask[2]; SignalMask[0] = SignalMask[1] = 0;
-
-	// Signal pin masks.
-	ULONG SignalPinMask[2][2]; SignalPinMask[0][0] = SignalPinMask[0][1] = SignalPinMask[1][0] = SignalPinMask[1][1] = 0;
+	// Time the host gets to call ASIOOutputReady() after a switch, a buffer.
+	DWORD OutputTimeOut = INFINITE;
 
 	while (!Abort)
 	{
-        // Wait on control events and "packet complete" events.
-        DWORD Wait = WaitForMultipleObjects(NumberOfEvents, EventPool, FALSE, INFINITE);
+		ULONG NumberOfBytes = 0; ULONG_PTR CompletionKey = 0; LPOVERLAPPED Overlapped = NULL;
 
-		if ((Wait == WAIT_FAILED) || (Wait == WAIT_TIMEOUT))
+		if (m_SharedRingMode)
 		{
-			// Something bad happened...
-			_DbgPrintF(DEBUGLVL_BLAB,("[CAsioDriver::_MainThreadHandler] - Bad things happened: %d", Wait));
-            break;
+			// Wait on control events and the ring event. The wait consumes the
+			// control event.
+			DWORD Wait = WaitForMultipleObjects(SIZEOF_ARRAY(EventPool), EventPool, FALSE, INFINITE);
+
+			if ((Wait - WAIT_OBJECT_0) >= SIZEOF_ARRAY(EventPool))
+			{
+				// Something bad happened...
+				_DbgPrintF(DEBUGLVL_BLAB,("[CAsioDriver::_MainThreadHandler] - Bad things happened: %d", Wait));
+				break;
+			}
+
+			CompletionKey = ((Wait - WAIT_OBJECT_0) < ASIO_CONTROL_EVENT_COUNT) ? (Wait - WAIT_OBJECT_0) : ASIO_COMPLETION_KEY_RING;
 		}
+		else
+		{
+			// Wait on control events and "packet complete" events. They come in 
+			// the order they were signaled.
+			DWORD Wait = ((State == KSSTATE_RUN) && m_OutputSchedule.IsOutputPending()) ? OutputTimeOut : INFINITE;
 
-        ULONG EventSignaled = Wait - WAIT_OBJECT_0;
+			BOOL Success = GetQueuedCompletionStatus(m_CompletionPort, &NumberOfBytes, &CompletionKey, &Overlapped, Wait);
+
+			if (!Success && !Overlapped && (GetLastError() == WAIT_TIMEOUT))
+			{
+				// The host missed ASIOOutputReady(). Send what it left in the 
+				// buffer, or the pins run dry when one packet is queued ahead.
+				_SyncSendOutput(DataRangeAsio);
+
+				continue;
+			}
+
+			if (!Success && !Overlapped)
+			{
+				// Something bad happened...
+				_DbgPrintF(DEBUGLVL_BLAB,("[CAsioDriver::_MainThreadHandler] - Bad things happened: %d", GetLastError()));
+				break;
+			}
+		}
 
-		//_DbgPrintF(DEBUGLVL_BLAB,("[CAsioDriver::_MainThreadHandler] - Event signaled: %d", EventSignaled));
+		//_DbgPrintF(DEBUGLVL_BLAB,("[CAsioDriver::_MainThreadHandler] - Completion key: %d", CompletionKey));
 
-		if (EventSignaled < ASIO_CONTROL_EVENT_COUNT)
+		if (CompletionKey < ASIO_CONTROL_EVENT_COUNT)
 		{
 			// Control events...
-			ULONG ControlEvent = EventSignaled;
+			ULONG ControlEvent = ULONG(CompletionKey);
+
+			// The event holds the request, which an earlier wake up may have
+			// already taken care of.
+			if (!m_SharedRingMode && (WaitForSingleObject(m_AsioControlEvent[ControlEvent], 0) != WAIT_OBJECT_0))
+			{
+				continue;
+			}
 
 			switch (ControlEvent)
 			{
@@ -3494,11 +3882,6 @@ _MainThreadHandler
 
 					if (State == KSSTATE_STOP)
 					{			
-						// Reset the signal mask.
-						SignalMask[0] = SignalMask[1] = 0;
-
-						SignalPinMask[0][0] = SignalPinMask[0][1] = SignalPinMask[1][0] = SignalPinMask[1][1] = 0;
-
 						// Prepare the pin...
 						_SyncModifyPinState(DataRangeAsio, KSSTATE_ACQUIRE);
 
@@ -3511,21 +3894,52 @@ _MainThreadHandler
 						// Take a snapshot of the sample position and time stamp.
 						m_RunningSamplePosition = 0;
 
+						_AnchorTimeStamp();
+
 						_SnapshotTimeStamp(&m_RunningTimeStamp);
 
-						// Zero initialize the first N buffers...
-						for (ULONG i=0; i<m_NumberOfOutputBuffers; i++)
+						Clock.Initialize(m_SamplingFrequency);
+
+						m_RunningTimeStamp = Clock.Update(m_RunningSamplePosition, m_RunningTimeStamp);
+
+						m_LoadMeter.Start(m_SamplingFrequency, m_BufferSizeInSamples, m_TimeStampFrequency);
+
+						if (m_SharedRingMode)
 						{
-							_SyncZeroPinBuffer(DataRangeAsio, i);
+							// The pins emptied the rings in KSSTATE_ACQUIRE. Put
+							// the first N buffers of silence in the output rings.
+							_SyncRewindSharedRings(DataRangeAsio);
+
+							InterlockedExchange(&m_SharedRingOutputPending, FALSE);
 
-							_SyncQueuePinBuffer(0x3, DataRangeAsio, i);
+							for (ULONG i=0; i<m_NumberOfOutputBuffers; i++)
+							{
+								_SyncZeroSharedRings(DataRangeAsio[0]);
+							}
 						}
+						else
+						{
+							m_OutputSchedule.Initialize(NUMBER_OF_DATA_PACKETS, m_NumberOfOutputBuffers, _IsEarlyOutput());
+
+							OutputTimeOut = (m_BufferSizeInSamples * 1000 + m_SamplingFrequency - 1) / m_SamplingFrequency;
 
-						// Wait a bit for the buffers being queued.
-						Sleep(10);
+							// Zero initialize the first N buffers (N - 1 with early output)...
+							for (ULONG i=0; i<m_OutputSchedule.GetLead(); i++)
+							{
+								_SyncZeroPinBuffer(DataRangeAsio, i);
+
+								_SyncQueuePinBuffer(0x3, DataRangeAsio, i);
+							}
+
+							// Wait a bit for the buffers being queued.
+							Sleep(10);
+						}
 
 						State = KSSTATE_RUN;
 
+						// Reset the signal masks.
+						Engine.Start();
+
 						// Gentlemen, start your engine...
 						_SyncModifyPinState(DataRangeAsio, KSSTATE_RUN);
 
@@ -3546,6 +3960,8 @@ _MainThreadHandler
 
 					if (State == KSSTATE_RUN)
 					{
+						Engine.Stop();
+
 						_SyncModifyPinState(DataRangeAsio, KSSTATE_PAUSE);
 
 						State = KSSTATE_PAUSE;
@@ -3589,117 +4005,154 @@ _MainThreadHandler
 				break;
 			}
 		}
-		else
+		else if (CompletionKey == ASIO_COMPLETION_KEY_RING)
 		{
+			// Shared ring events...
 			if (State == KSSTATE_RUN)
 			{
 				SetWaitableTimer(m_WatchDogEvent[ASIO_WATCHDOG_EVENT_TIMER_EXPIRED], &TimeOut, 0, NULL, NULL, FALSE);
-			}
 
-			// Pin events...
-			ULONG PinEvent = EventSignaled - ASIO_CONTROL_EVENT_COUNT;
+				// Each buffer switch takes a period out of the input rings and
+				// puts one in the output rings.
+				while (_IsSharedRingReady(DataRangeAsio, ActiveSignalMask))
+				{
+					if (m_BufferSwitchCount) 
+					{
+						m_RunningSamplePosition += m_BufferSizeInSamples;
+					}
 
-			if (PinEvent < (MAXIMUM_NUMBER_OF_PIN_DESCRIPTORS * NUMBER_OF_DATA_PACKETS))
-			{
-				// Output pin events...
-				// Data submission block.  The event signaled corresponds to one of
-				// our data packets.  The device is finished with this packet, so we
-				// can fill with data and submit to the pin.
-				ULONG PacketNumber = PinEvent;
+					ULONG BufferIndex = ULONG(m_RunningSamplePosition / m_BufferSizeInSamples) % 2;
 
-				ULONG BufferIndex = PacketNumber%2;
+					m_LoadMeter.Begin(_ReadLoadCounter());
 
-				SignalPinMask[0][BufferIndex] |= (1<<(PacketNumber/NUMBER_OF_DATA_PACKETS));
+					_SyncReadSharedRings(DataRangeAsio[1], BufferIndex);
 
-				//dbgprintf("[OUT][%d]: %d\n", BufferIndex, timeGetTime());
+					m_LoadMeter.Mark(ASIO_LOAD_STAGE_INPUT, _ReadLoadCounter());
 
-				if  ((SignalPinMask[0][BufferIndex] & DataRangeAsio[0]->ActivePinMask) == DataRangeAsio[0]->ActivePinMask)
-				{
-					if (State == KSSTATE_RUN)
-					{
-						//dbgprintf("Signal[0][0]: %d\n", timeGetTime());
+					_SnapshotTimeStamp(&m_RunningTimeStamp);
 
-						SignalMask[BufferIndex] |= 0x1;
+					m_RunningTimeStamp = Clock.Update(m_RunningSamplePosition, m_RunningTimeStamp);
 
-						if ((SignalMask[BufferIndex] & ActiveSignalMask) == ActiveSignalMask)
-						{
-							if (m_BufferSwitchCount) 
-							{
-								m_RunningSamplePosition += m_BufferSizeInSamples;
-							}
+					InterlockedExchange(&m_SharedRingOutputPending, TRUE);
 
-							_SnapshotTimeStamp(&m_RunningTimeStamp);
+					m_LoadMeter.Begin(_ReadLoadCounter());
 
-							_SyncQueuePinBuffer(0x1, DataRangeAsio, (ULONG)((m_RunningSamplePosition/m_BufferSizeInSamples)+m_NumberOfOutputBuffers)%NUMBER_OF_DATA_PACKETS);
+					_SwitchBuffer(BufferIndex);
 
-							_SwitchBuffer(BufferIndex);
+					m_LoadMeter.Mark(ASIO_LOAD_STAGE_HOST, _ReadLoadCounter());
 
-							_SyncQueuePinBuffer(0x2, DataRangeAsio, (ULONG)((m_RunningSamplePosition/m_BufferSizeInSamples)+m_NumberOfOutputBuffers)%NUMBER_OF_DATA_PACKETS);
+					// Send the output, unless ASIOOutputReady() already did.
+					_SyncWriteSharedRings(DataRangeAsio[0], BufferIndex);
 
-							SignalMask[BufferIndex] = 0;
-						}
-					}
+					m_LoadMeter.Mark(ASIO_LOAD_STAGE_OUTPUT, _ReadLoadCounter());
 
-					// Clear the pin event mask.
-					SignalPinMask[0][BufferIndex] = 0;
+					m_LoadMeter.Record(ULONG(m_BufferSwitchCount - 1));
 				}
 			}
-			else
+		}
+		else
+		{
+			// Pin events...
+			// A packet that failed (cancelled) is done with all the same.
+			ULONG PinKey = ULONG(CompletionKey) - ASIO_CONTROL_EVENT_COUNT;
+
+			ULONG Direction = PinKey / MAXIMUM_NUMBER_OF_PIN_DESCRIPTORS;
+
+			ULONG PinIndex = PinKey % MAXIMUM_NUMBER_OF_PIN_DESCRIPTORS;
+
+			PDATA_PACKET Packet = CONTAINING_RECORD(Overlapped, DATA_PACKET, Signal);
+
+			ULONG PacketIndex = ULONG(Packet - DataRangeAsio[Direction]->PinDescriptors[PinIndex].Packets);
+
+			if ((Direction > ASIO_ENGINE_INPUT) || (PacketIndex >= NUMBER_OF_DATA_PACKETS))
 			{
-				// Input pin events...
-				// Data submission block.  The event signaled corresponds to one of
-				// our data packets.  The device is finished with this packet, so we
-				// can copy to the buffer to the channel buffer.
-				ULONG PacketNumber = PinEvent - (MAXIMUM_NUMBER_OF_PIN_DESCRIPTORS * NUMBER_OF_DATA_PACKETS);
+				continue;
+			}
 
-				ULONG BufferIndex = PacketNumber%2;
+			if (State == KSSTATE_RUN)
+			{
+				SetWaitableTimer(m_WatchDogEvent[ASIO_WATCHDOG_EVENT_TIMER_EXPIRED], &TimeOut, 0, NULL, NULL, FALSE);
+			}
+
+			//dbgprintf("[%s][%d]: %d\n", Direction ? "IN" : "OUT", PacketIndex%2, timeGetTime());
 
-				//dbgprintf(" [IN][%d]: %d\n", BufferIndex, timeGetTime());
+			// The output pins are done with the packet, so it can be filled and 
+			// submitted again. The input pins are done with the packet, so it can 
+			// be copied to the channel buffers.
+			ULONG BufferIndex;
 
-				SignalPinMask[1][BufferIndex] |= (1<<(PacketNumber/NUMBER_OF_DATA_PACKETS));
+			ULONG Actions = Engine.PacketComplete(Direction, PinIndex, PacketIndex, &BufferIndex);
 
-				if  ((SignalPinMask[1][BufferIndex] & DataRangeAsio[1]->ActivePinMask) == DataRangeAsio[1]->ActivePinMask)
+			if (Actions & ASIO_ENGINE_ACTION_READ_INPUT)
+			{
+				if (m_BufferSwitchCount >= m_OutputSchedule.GetLead()) 
 				{
-					if (State == KSSTATE_RUN)
-					{
-						//dbgprintf("Signal[1][0]: %d\n", timeGetTime());
+					ULONG ReadPacketIndex = (ULONG)((m_RunningSamplePosition/m_BufferSizeInSamples)+1)%NUMBER_OF_DATA_PACKETS;
 
-						if (m_BufferSwitchCount >= m_NumberOfOutputBuffers) 
-						{
-							ULONG PacketIndex = (ULONG)((m_RunningSamplePosition/m_BufferSizeInSamples)+1)%NUMBER_OF_DATA_PACKETS;
+					m_LoadMeter.Begin(_ReadLoadCounter());
 
-							_SyncReadPinData(DataRangeAsio[1], PacketIndex, PacketIndex%2);
-						}
-						else
-						{
-							// Do not read the data for the first N buffer switches since they are suppose to be zeros.
-							//_SyncReadPinData(DataRangeAsio[1], ULONG(m_BufferSwitchCount), ULONG(m_BufferSwitchCount)%2);
-						}
+					_SyncReadPinData(DataRangeAsio[1], ReadPacketIndex, ReadPacketIndex%2);
 
-						SignalMask[BufferIndex] |= 0x2;
+					// Goes with the next switch.
+					m_LoadMeter.Mark(ASIO_LOAD_STAGE_INPUT, _ReadLoadCounter());
+				}
+				else
+				{
+					// Do not read the data for the first N buffer switches since they are suppose to be zeros.
+				}
+			}
 
-						if ((SignalMask[BufferIndex] & ActiveSignalMask) == ActiveSignalMask)
-						{
-							if (m_BufferSwitchCount) 
-							{
-								m_RunningSamplePosition += m_BufferSizeInSamples;
-							}
+			if (Actions & ASIO_ENGINE_ACTION_SWITCH)
+			{
+				if (m_BufferSwitchCount) 
+				{
+					m_RunningSamplePosition += m_BufferSizeInSamples;
+				}
 
-							_SnapshotTimeStamp(&m_RunningTimeStamp);
+				_SnapshotTimeStamp(&m_RunningTimeStamp);
 
-							_SyncQueuePinBuffer(0x1, DataRangeAsio, (ULONG)((m_RunningSamplePosition/m_BufferSizeInSamples)+m_NumberOfOutputBuffers)%NUMBER_OF_DATA_PACKETS);
+				m_RunningTimeStamp = Clock.Update(m_RunningSamplePosition, m_RunningTimeStamp);
 
-							_SwitchBuffer(BufferIndex);
+				ULONG QueuePacketIndex = m_OutputSchedule.GetPacketIndex(m_RunningSamplePosition/m_BufferSizeInSamples);
 
-							_SyncQueuePinBuffer(0x2, DataRangeAsio, (ULONG)((m_RunningSamplePosition/m_BufferSizeInSamples)+m_NumberOfOutputBuffers)%NUMBER_OF_DATA_PACKETS);
+				m_LoadMeter.Begin(_ReadLoadCounter());
 
-							SignalMask[BufferIndex] = 0;
-						}
+				_SyncQueuePinBuffer(0x1, DataRangeAsio, QueuePacketIndex);
+
+				m_LoadMeter.Mark(ASIO_LOAD_STAGE_QUEUE, _ReadLoadCounter());
+
+				// The host missed ASIOOutputReady() of the last switch, send what 
+				// it left in the buffer before the buffer is handed out again.
+				_SyncSendOutput(DataRangeAsio);
+
+				m_OutputSchedule.Switch(QueuePacketIndex, BufferIndex);
+
+				m_LoadMeter.Mark(ASIO_LOAD_STAGE_OUTPUT, _ReadLoadCounter());
+
+				_SwitchBuffer(BufferIndex);
+
+				m_LoadMeter.Mark(ASIO_LOAD_STAGE_HOST, _ReadLoadCounter());
+
+				if (!m_OutputSchedule.IsEarlyOutput())
+				{
+					// ASIOOutputReady() fills the packet, possibly after it is 
+					// queued. Hosts that do not call it are done with the buffer 
+					// when the switch returns.
+					ULONG PacketIndex, OutputBufferIndex;
+
+					if (m_OutputSchedule.TakeOutput(&PacketIndex, &OutputBufferIndex) && !m_OutputReadyCalled)
+					{
+						_SyncWritePinData(DataRangeAsio[0], PacketIndex, OutputBufferIndex);
 					}
 
-					// Clear the event mask.
-					SignalPinMask[1][BufferIndex] = 0;
+					m_LoadMeter.Mark(ASIO_LOAD_STAGE_OUTPUT, _ReadLoadCounter());
+
+					_SyncQueuePinBuffer(0x2, DataRangeAsio, QueuePacketIndex);
+
+					m_LoadMeter.Mark(ASIO_LOAD_STAGE_QUEUE, _ReadLoadCounter());
 				}
+
+				m_LoadMeter.Record(ULONG(m_BufferSwitchCount - 1));
 			}
 		}
 	}
@@ -3766,7 +4219,7 @@ _WatchDogThreadHandler
 		{
 			// The watch dog timer times out. Probably means the driver is unresponsive,
 			// so reset it for good measure...
-			SetEvent(m_AsioControlEvent[ASIO_CONTROL_EVENT_RESET]);
+			_SignalControlEvent(ASIO_CONTROL_EVENT_RESET);
 
 			Abort = TRUE;
 		}
@@ -3845,58 +4298,27 @@ _SyncWritePinData
 {
 	//_DbgPrintF(DEBUGLVL_BLAB,("[CAsioDriver::_SyncWritePinData] - PacketIndex: 0x%x, BufferIndex: 0x%x", PacketIndex, BufferIndex));
 
-	for (ULONG i=0; i<DataRangeAsio->ChannelDescriptorCount; i++)
+	for (ULONG iPin = 0; iPin < DataRangeAsio->PinDescriptorCount; iPin++)
 	{
-		PASIO_CHANNEL_DESCRIPTOR ChannelDescriptor = &DataRangeAsio->ChannelDescriptors[i];
+		PASIO_PIN_DESCRIPTOR PinDescriptor = &DataRangeAsio->PinDescriptors[iPin];
 
-		PASIO_PIN_DESCRIPTOR PinDescriptor = ChannelDescriptor->PinDescriptor;
-
-		if (PinDescriptor->Active)
+		if ((PinDescriptor->Active) && (PinDescriptor->CopyRoutine))
 		{
 			PDATA_PACKET Packet = &PinDescriptor->Packets[PacketIndex];
 
-			// Copy data from channel to pin.
+			// Copy data from all channels to pin.
 			if (Packet->Header.FrameExtent)
 			{
-				PUCHAR Source = PUCHAR(ChannelDescriptor->Buffer[BufferIndex]);
-
-				if (Source)
-				{
-					ULONG SampleSize = m_SampleSize / 8; // in bytes
-
-					ULONG ChannelOffset = ChannelDescriptor->ChannelIndex * SampleSize;
-				
-					PUCHAR Destination = PUCHAR(Packet->Header.Data) + ChannelOffset;
-
-					ULONG FrameSize = PinDescriptor->NumberOfActiveChannels * SampleSize;
-
-					ULONG NumSamplesToCopy = Packet->Header.FrameExtent / FrameSize;
-
-					#ifdef USE_24_BIT_PADDED
-					if (m_SampleSize == 24)
-					{
-						for (ULONG j=0; j<NumSamplesToCopy; j++)
-						{
-							CopyMemory(Destination, Source+1, 3/*SampleSize*/);
-							
-							Destination += FrameSize;
+				ULONG FrameSize = PinDescriptor->NumberOfActiveChannels * m_SampleSize / 8;
 
-							Source += 4;
-						}
-					}
-					else
-					#endif // USE_24_BIT_PADDED
-					{
-						for (ULONG j=0; j<NumSamplesToCopy; j++)
-						{
-							CopyMemory(Destination, Source, SampleSize);
-							
-							Destination += FrameSize;
+				ULONG NumFramesToCopy = Packet->Header.FrameExtent / FrameSize;
 
-							Source += SampleSize;
-						}
-					}
+				if (NumFramesToCopy > PinDescriptor->BufferSizeInSamples)
+				{
+					NumFramesToCopy = PinDescriptor->BufferSizeInSamples;
 				}
+
+				PinDescriptor->CopyRoutine(PUCHAR(Packet->Header.Data), PinDescriptor->ChannelBuffers[BufferIndex], PinDescriptor->NumberOfActiveChannels, NumFramesToCopy);
 			}
 		}
 	}
@@ -3919,60 +4341,27 @@ _SyncReadPinData
 {
 	//_DbgPrintF(DEBUGLVL_BLAB,("[CAsioDriver::_SyncReadPinData] - PacketIndex: 0x%x, BufferIndex: 0x%x", PacketIndex, BufferIndex));
 
-	for (ULONG i=0; i<DataRangeAsio->ChannelDescriptorCount; i++)
+	for (ULONG iPin = 0; iPin < DataRangeAsio->PinDescriptorCount; iPin++)
 	{
-		PASIO_CHANNEL_DESCRIPTOR ChannelDescriptor = &DataRangeAsio->ChannelDescriptors[i];
-
-		PASIO_PIN_DESCRIPTOR PinDescriptor = ChannelDescriptor->PinDescriptor;
+		PASIO_PIN_DESCRIPTOR PinDescriptor = &DataRangeAsio->PinDescriptors[iPin];
 
-		if (PinDescriptor->Active)
+		if ((PinDescriptor->Active) && (PinDescriptor->CopyRoutine))
 		{
 			PDATA_PACKET Packet = &PinDescriptor->Packets[PacketIndex];
 
-			// Copy data from pin to channel.
+			// Copy data from pin to all channels.
 			if (Packet->Header.DataUsed)
 			{
-				PUCHAR Destination = PUCHAR(ChannelDescriptor->Buffer[BufferIndex]);
-				
-				if (Destination)
-				{
-					ULONG SampleSize = m_SampleSize / 8; // in bytes
-
-					ULONG ChannelOffset = ChannelDescriptor->ChannelIndex * SampleSize;
-
-					PUCHAR Source = PUCHAR(Packet->Header.Data) + ChannelOffset;
-
-					ULONG FrameSize = PinDescriptor->NumberOfActiveChannels * SampleSize;
-
-					ULONG NumSamplesToCopy = Packet->Header.DataUsed / FrameSize;
-
-					#ifdef USE_24_BIT_PADDED
-					if (m_SampleSize == 24)
-					{
-						for (ULONG j=0; j<NumSamplesToCopy; j++)
-						{
-							*Destination = 0;
+				ULONG FrameSize = PinDescriptor->NumberOfActiveChannels * m_SampleSize / 8;
 
-							CopyMemory(Destination+1, Source, 3/*SampleSize*/);
-							
-							Destination += 4;
+				ULONG NumFramesToCopy = Packet->Header.DataUsed / FrameSize;
 
-							Source += FrameSize;
-						}
-					}
-					else
-					#endif // USE_24_BIT_PADDED
-					{
-						for (ULONG j=0; j<NumSamplesToCopy; j++)
-						{
-							CopyMemory(Destination, Source, SampleSize);
-							
-							Destination += SampleSize;
-
-							Source += FrameSize;
-						}
-					}
+				if (NumFramesToCopy > PinDescriptor->BufferSizeInSamples)
+				{
+					NumFramesToCopy = PinDescriptor->BufferSizeInSamples;
 				}
+
+				PinDescriptor->CopyRoutine(PUCHAR(Packet->Header.Data), PinDescriptor->ChannelBuffers[BufferIndex], PinDescriptor->NumberOfActiveChannels, NumFramesToCopy);
 			}
 		}
 	}
@@ -4057,6 +4446,249 @@ _SyncQueuePinBuffer
 	}
 }
 
+/*****************************************************************************
+ * CAsioDriver::_SyncSendOutput()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * With early output, fill the packet of the last buffer switch from the 
+ * host's buffer and queue it, unless that was done already. Called by 
+ * ASIOOutputReady(), and by the main thread when the host misses it.
+ */
+VOID 
+CAsioDriver::
+_SyncSendOutput
+(
+	IN		PFILTER_DATARANGE_ASIO *	DataRangeAsio
+)
+{
+	ULONG PacketIndex, BufferIndex;
+
+	if (m_OutputSchedule.IsEarlyOutput() && m_OutputSchedule.TakeOutput(&PacketIndex, &BufferIndex))
+	{
+		_SyncWritePinData(DataRangeAsio[0], PacketIndex, BufferIndex);
+
+		_SyncQueuePinBuffer(0x2, DataRangeAsio, PacketIndex);
+	}
+}
+
+/*****************************************************************************
+ * CAsioDriver::_IsSharedRingReady()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Return TRUE if the rings of the synchronizing directions are ready for a
+ * buffer switch: the output rings have room for a period without going over
+ * N buffers of latency, and the input rings hold a period.
+ */
+BOOL 
+CAsioDriver::
+_IsSharedRingReady
+(
+	IN		PFILTER_DATARANGE_ASIO *	DataRangeAsio,
+	IN		ULONG						ActiveSignalMask
+)
+{
+	if (!ActiveSignalMask)
+	{
+		return FALSE;
+	}
+
+	for (ULONG i=0; i<2; i++)
+	{
+		if (ActiveSignalMask & (1<<i))
+		{
+			for (ULONG iPin = 0; iPin < DataRangeAsio[i]->PinDescriptorCount; iPin++)
+			{
+				PASIO_PIN_DESCRIPTOR PinDescriptor = &DataRangeAsio[i]->PinDescriptors[iPin];
+
+				if ((PinDescriptor->Active) && (PinDescriptor->SharedRing.Control))
+				{
+					PSHARED_RING Ring = &PinDescriptor->SharedRing;
+
+					if (i == 0)
+					{
+						ULONG Writable = SharedRingGetWritable(Ring);
+
+						if ((Writable < Ring->PeriodSize) || ((Ring->BufferSize - Writable + Ring->PeriodSize) > (m_NumberOfOutputBuffers * Ring->PeriodSize)))
+						{
+							return FALSE;
+						}
+					}
+					else
+					{
+						if (SharedRingGetReadable(Ring) < Ring->PeriodSize)
+						{
+							return FALSE;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+/*****************************************************************************
+ * CAsioDriver::_SyncRewindSharedRings()
+ *****************************************************************************
+ *//*!
+ * @brief
+ */
+VOID 
+CAsioDriver::
+_SyncRewindSharedRings
+(
+	IN		PFILTER_DATARANGE_ASIO *	DataRangeAsio
+)
+{
+	for (ULONG i=0; i<2; i++)
+	{
+		for (ULONG iPin = 0; iPin < DataRangeAsio[i]->PinDescriptorCount; iPin++)
+		{
+			PASIO_PIN_DESCRIPTOR PinDescriptor = &DataRangeAsio[i]->PinDescriptors[iPin];
+
+			if ((PinDescriptor->Active) && (PinDescriptor->SharedRing.Control))
+			{
+				SharedRingRewind(&PinDescriptor->SharedRing);
+			}
+		}
+	}
+}
+
+/*****************************************************************************
+ * CAsioDriver::_SyncZeroSharedRings()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Write a period of silence in the output rings.
+ */
+VOID 
+CAsioDriver::
+_SyncZeroSharedRings
+(
+	IN		PFILTER_DATARANGE_ASIO	DataRangeAsio
+)
+{
+	for (ULONG iPin = 0; iPin < DataRangeAsio->PinDescriptorCount; iPin++)
+	{
+		PASIO_PIN_DESCRIPTOR PinDescriptor = &DataRangeAsio->PinDescriptors[iPin];
+
+		if ((PinDescriptor->Active) && (PinDescriptor->SharedRing.Control))
+		{
+			PSHARED_RING Ring = &PinDescriptor->SharedRing;
+
+			PUCHAR Data;
+
+			if (SharedRingGetWriteRegion(Ring, &Data) >= Ring->PeriodSize)
+			{
+				ZeroMemory(Data, Ring->PeriodSize);
+
+				SharedRingAdvanceWrite(Ring, Ring->PeriodSize);
+			}
+		}
+	}
+}
+
+/*****************************************************************************
+ * CAsioDriver::_SyncWriteSharedRings()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Write a period from the channel buffers in the output rings. This is done 
+ * once per buffer switch, by ASIOOutputReady() or right after the switch.
+ */
+VOID 
+CAsioDriver::
+_SyncWriteSharedRings
+(
+	IN		PFILTER_DATARANGE_ASIO	DataRangeAsio,
+	IN		ULONG					BufferIndex
+)
+{
+	if (!InterlockedExchange(&m_SharedRingOutputPending, FALSE))
+	{
+		return;
+	}
+
+	for (ULONG iPin = 0; iPin < DataRangeAsio->PinDescriptorCount; iPin++)
+	{
+		PASIO_PIN_DESCRIPTOR PinDescriptor = &DataRangeAsio->PinDescriptors[iPin];
+
+		if ((PinDescriptor->Active) && (PinDescriptor->SharedRing.Control))
+		{
+			PSHARED_RING Ring = &PinDescriptor->SharedRing;
+
+			PUCHAR Data;
+
+			if (SharedRingGetWriteRegion(Ring, &Data) >= Ring->PeriodSize)
+			{
+				// Copy data from all channels straight into the ring.
+				if (PinDescriptor->CopyRoutine)
+				{
+					PinDescriptor->CopyRoutine(Data, PinDescriptor->ChannelBuffers[BufferIndex], PinDescriptor->NumberOfActiveChannels, PinDescriptor->BufferSizeInSamples);
+				}
+				else
+				{
+					ZeroMemory(Data, Ring->PeriodSize);
+				}
+
+				SharedRingAdvanceWrite(Ring, Ring->PeriodSize);
+			}
+			else
+			{
+				// The pin is not taking the data as fast as it comes.
+				SharedRingOverrun(Ring);
+			}
+		}
+	}
+}
+
+/*****************************************************************************
+ * CAsioDriver::_SyncReadSharedRings()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Read a period from the input rings into the channel buffers.
+ */
+VOID 
+CAsioDriver::
+_SyncReadSharedRings
+(
+	IN		PFILTER_DATARANGE_ASIO	DataRangeAsio,
+	IN		ULONG					BufferIndex
+)
+{
+	for (ULONG iPin = 0; iPin < DataRangeAsio->PinDescriptorCount; iPin++)
+	{
+		PASIO_PIN_DESCRIPTOR PinDescriptor = &DataRangeAsio->PinDescriptors[iPin];
+
+		if ((PinDescriptor->Active) && (PinDescriptor->SharedRing.Control))
+		{
+			PSHARED_RING Ring = &PinDescriptor->SharedRing;
+
+			PUCHAR Data;
+
+			if (SharedRingGetReadRegion(Ring, &Data) >= Ring->PeriodSize)
+			{
+				// Copy data from the ring straight into all channels.
+				if (PinDescriptor->CopyRoutine)
+				{
+					PinDescriptor->CopyRoutine(Data, PinDescriptor->ChannelBuffers[BufferIndex], PinDescriptor->NumberOfActiveChannels, PinDescriptor->BufferSizeInSamples);
+				}
+
+				SharedRingAdvanceRead(Ring, Ring->PeriodSize);
+			}
+			else
+			{
+				// The host gets what was left in the channel buffers.
+				SharedRingUnderrun(Ring);
+			}
+		}
+	}
+}
+
 /*****************************************************************************
  * CAsioDriver::_SwitchBuffer()
  *****************************************************************************
@@ -4182,11 +4814,47 @@ _SampleRateDidChange
 	}
 }
 
+/*****************************************************************************
+ * CAsioDriver::_AnchorTimeStamp()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Line the performance counter up with timeGetTime(), which is the time base
+ * of the ASIO system time. Done at each start, so the two clocks do not 
+ * drift apart over a session.
+ */
+VOID 
+CAsioDriver::
+_AnchorTimeStamp
+(	void
+)
+{
+	LARGE_INTEGER Frequency; 
+	
+	if (QueryPerformanceFrequency(&Frequency) && Frequency.QuadPart)
+	{
+		LARGE_INTEGER Counter; QueryPerformanceCounter(&Counter);
+
+		LONGLONG TimeStamp = timeGetTime(); TimeStamp *= 1000000; // ns
+
+		m_TimeStampFrequency = Frequency.QuadPart;
+
+		m_TimeStampOffset = TimeStamp - ((Counter.QuadPart / m_TimeStampFrequency) * 1000000000 + ((Counter.QuadPart % m_TimeStampFrequency) * 1000000000) / m_TimeStampFrequency);
+	}
+	else
+	{
+		m_TimeStampFrequency = 0;
+	}
+}
+
 /*****************************************************************************
  * CAsioDriver::_SnapshotTimeStamp()
  *****************************************************************************
  *//*!
  * @brief
+ * Read the system time, in ns. The performance counter resolves it well 
+ * below the millisecond of timeGetTime(), so the clock loop sees the wake up
+ * jitter of the main thread rather than the granularity of the timer.
  */
 VOID 
 CAsioDriver::
@@ -4195,7 +4863,18 @@ _SnapshotTimeStamp
 	OUT		ULONGLONG *	OutTimeStamp
 )
 {
-	LONGLONG TimeStamp = timeGetTime(); TimeStamp *= 1000000; // ns
+	LONGLONG TimeStamp;
+
+	if (m_TimeStampFrequency)
+	{
+		LARGE_INTEGER Counter; QueryPerformanceCounter(&Counter);
+
+		TimeStamp = m_TimeStampOffset + (Counter.QuadPart / m_TimeStampFrequency) * 1000000000 + ((Counter.QuadPart % m_TimeStampFrequency) * 1000000000) / m_TimeStampFrequency; // ns
+	}
+	else
+	{
+		TimeStamp = timeGetTime(); TimeStamp *= 1000000; // ns
+	}
 
 	if (OutTimeStamp)
 	{
@@ -4203,6 +4882,30 @@ _SnapshotTimeStamp
 	}
 }
 
+/*****************************************************************************
+ * CAsioDriver::_ReadLoadCounter()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Read the performance counter for the load meter. The meter is off when
+ * there is no performance counter (m_TimeStampFrequency is 0).
+ */
+LONGLONG 
+CAsioDriver::
+_ReadLoadCounter
+(	void
+)
+{
+	LARGE_INTEGER Counter; 
+	
+	if (!m_TimeStampFrequency || !QueryPerformanceCounter(&Counter))
+	{
+		return 0;
+	}
+
+	return Counter.QuadPart;
+}
+
 #define EMU_PUBLIC_KEY "Software\\E-MU"
 /*****************************************************************************
  * CAsioDriver::_SaveDriverSettingsToRegistry()
@@ -4430,6 +5133,132 @@ _GetSyncOption
 	return SyncOption;
 }
 
+/*****************************************************************************
+ * CAsioDriver::_GetSharedRingOption()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Return whether the data goes through rings shared with the pins (1, the 
+ * default) or through read/write packets (0).
+ */
+ULONG 
+CAsioDriver::
+_GetSharedRingOption
+(	void
+)
+{
+	CHAR Section[64]; sprintf(Section, "%s.Audio.Options", m_ProductIdentifier);
+
+	CHAR SystemWindowsDirectory[MAX_PATH]; GetSystemWindowsDirectory(SystemWindowsDirectory, MAX_PATH);
+
+	CHAR PathFileName[MAX_PATH]; sprintf(PathFileName, "%s\\emasio.dat", SystemWindowsDirectory);
+
+	// Default to 1.
+	ULONG SharedRingOption = GetPrivateProfileInt(Section, "SharedRing", 1, PathFileName);
+
+	return SharedRingOption;
+}
+
+/*****************************************************************************
+ * CAsioDriver::_GetFloatOption()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Return the type of the ASIO samples: float (1, the default), float with
+ * TPDF dither on output (2), or integer samples the size of the pin 
+ * samples (0).
+ */
+ULONG 
+CAsioDriver::
+_GetFloatOption
+(	void
+)
+{
+	CHAR Section[64]; sprintf(Section, "%s.Audio.Options", m_ProductIdentifier);
+
+	CHAR SystemWindowsDirectory[MAX_PATH]; GetSystemWindowsDirectory(SystemWindowsDirectory, MAX_PATH);
+
+	CHAR PathFileName[MAX_PATH]; sprintf(PathFileName, "%s\\emasio.dat", SystemWindowsDirectory);
+
+	// Default to 1.
+	ULONG FloatOption = GetPrivateProfileInt(Section, "Float", ASIO_FLOAT_OPTION_FLOAT, PathFileName);
+
+	if (FloatOption > ASIO_FLOAT_OPTION_DITHER)
+	{
+		FloatOption = ASIO_FLOAT_OPTION_FLOAT;
+	}
+
+	return FloatOption;
+}
+
+/*****************************************************************************
+ * CAsioDriver::_GetEarlyOutputOption()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Return TRUE if ASIOOutputReady() is to queue the output (1), for one
+ * buffer less of output latency, or FALSE to queue it when the buffer 
+ * switch returns (0, the default).
+ */
+BOOL 
+CAsioDriver::
+_GetEarlyOutputOption
+(	void
+)
+{
+	CHAR Section[64]; sprintf(Section, "%s.Audio.Options", m_ProductIdentifier);
+
+	CHAR SystemWindowsDirectory[MAX_PATH]; GetSystemWindowsDirectory(SystemWindowsDirectory, MAX_PATH);
+
+	CHAR PathFileName[MAX_PATH]; sprintf(PathFileName, "%s\\emasio.dat", SystemWindowsDirectory);
+
+	// Default to 0.
+	return (GetPrivateProfileInt(Section, "EarlyOutput", 0, PathFileName) != 0);
+}
+
+/*****************************************************************************
+ * CAsioDriver::_IsEarlyOutput()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Return TRUE if the packets of the next start are to be queued by 
+ * ASIOOutputReady(): the option is on, the host calls it, and the data goes
+ * through packets rather than shared rings.
+ */
+BOOL 
+CAsioDriver::
+_IsEarlyOutput
+(	void
+)
+{
+	return (m_EarlyOutputOption && m_OutputReadyCalled && !m_SharedRingMode);
+}
+
+/*****************************************************************************
+ * CAsioDriver::_GetAdaptiveTransferDepthOption()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Return TRUE if the USB pipes are to keep about one buffer worth of IRPs
+ * in flight, deepened by the driver as the completions run late (1), or
+ * FALSE to leave the driver's fixed depth alone (0, the default).
+ */
+BOOL 
+CAsioDriver::
+_GetAdaptiveTransferDepthOption
+(	void
+)
+{
+	CHAR Section[64]; sprintf(Section, "%s.Audio.Options", m_ProductIdentifier);
+
+	CHAR SystemWindowsDirectory[MAX_PATH]; GetSystemWindowsDirectory(SystemWindowsDirectory, MAX_PATH);
+
+	CHAR PathFileName[MAX_PATH]; sprintf(PathFileName, "%s\\emasio.dat", SystemWindowsDirectory);
+
+	// Default to 0.
+	return (GetPrivateProfileInt(Section, "AdaptiveTransferDepth", 0, PathFileName) != 0);
+}
+
 /*****************************************************************************
  * CAsioDriver::_GetAppHacks()
  *****************************************************************************
@@ -33,6 +33,11 @@
 
 #include "asiodll.h"
 #include "xu.h"
+#include "interleave.h"
+#include "engine.h"
+#include "clock.h"
+#include "schedule.h"
+#include "loadmeter.h"
 
 /*****************************************************************************
  * Defines
@@ -78,16 +83,22 @@ typedef struct
 
 #define NUMBER_OF_DATA_PACKETS	8
 
+#define MAXIMUM_NUMBER_OF_CHANNEL_DESCRIPTORS	64
+
 typedef struct
 {
-	BOOL			Usable;
-	BOOL			InUse;
-	BOOL			Active;
-	CKsAudioPin *	KsAudioPin;
-	ULONG			MaximumChannels;
-	ULONG			NumberOfActiveChannels;
-	ULONG			BufferSizeInSamples;
-	DATA_PACKET		Packets[NUMBER_OF_DATA_PACKETS];
+	BOOL				Usable;
+	BOOL				InUse;
+	BOOL				Active;
+	CKsAudioPin *		KsAudioPin;
+	ULONG				MaximumChannels;
+	ULONG				NumberOfActiveChannels;
+	ULONG				BufferSizeInSamples;
+	DATA_PACKET			Packets[NUMBER_OF_DATA_PACKETS];
+	ASIO_COPY_ROUTINE	CopyRoutine;	// NULL if none of the channels are in use.
+	PVOID				ScratchBuffer;	// Buffer of the channels not in use.
+	PVOID				ChannelBuffers[2][MAXIMUM_NUMBER_OF_CHANNEL_DESCRIPTORS];
+	SHARED_RING			SharedRing;		// Control is NULL if the pin has no mapped ring.
 } ASIO_PIN_DESCRIPTOR, *PASIO_PIN_DESCRIPTOR;
 
 typedef struct
@@ -100,7 +111,20 @@ typedef struct
 	PVOID					Buffer[2];
 } ASIO_CHANNEL_DESCRIPTOR, *PASIO_CHANNEL_DESCRIPTOR;
 
-#define MAXIMUM_NUMBER_OF_PIN_DESCRIPTORS	((MAXIMUM_WAIT_OBJECTS-ASIO_CONTROL_EVENT_COUNT)/NUMBER_OF_DATA_PACKETS/2)
+// The packet completions come through an I/O completion port, so this is no 
+// longer bound by MAXIMUM_WAIT_OBJECTS. Pins are tracked in ULONG masks.
+#define MAXIMUM_NUMBER_OF_PIN_DESCRIPTORS	8
+
+// Completion keys: the control events, then the output and input pins.
+#define ASIO_COMPLETION_KEY_PIN(Direction, PinIndex)	(ASIO_CONTROL_EVENT_COUNT + (Direction) * MAXIMUM_NUMBER_OF_PIN_DESCRIPTORS + (PinIndex))
+
+// Wake up key of the shared rings, after the pins.
+#define ASIO_COMPLETION_KEY_RING	ASIO_COMPLETION_KEY_PIN(2, 0)
+
+// Type of the ASIO samples ("Float" in emasio.dat).
+#define ASIO_FLOAT_OPTION_NONE		0	// Integer, the size of the pin samples.
+#define ASIO_FLOAT_OPTION_FLOAT		1	// ASIOSTFloat32LSB.
+#define ASIO_FLOAT_OPTION_DITHER	2	// ASIOSTFloat32LSB, TPDF dithered to the pin samples on output.
 
 typedef struct
 {
@@ -112,7 +136,7 @@ typedef struct
 	ULONG					ActivePinMask;
 	KSTIME					Latency;
 	ULONG					ChannelDescriptorCount;
-	ASIO_CHANNEL_DESCRIPTOR	ChannelDescriptors[64];
+	ASIO_CHANNEL_DESCRIPTOR	ChannelDescriptors[MAXIMUM_NUMBER_OF_CHANNEL_DESCRIPTORS];
 } FILTER_DATARANGE_ASIO, *PFILTER_DATARANGE_ASIO;
 
 typedef struct
@@ -182,6 +206,8 @@ private:
 	ULONG					m_SampleSize;
 	ULONG					m_SamplingFrequency;
 
+	ULONG					m_FloatOption;	// ASIO_FLOAT_OPTION_XXX: type of the ASIO samples.
+
 	ULONG					m_PreferredSampleSize; 
 
 	ULONGLONG				m_PreferredBufferSize; // in 100ns unit
@@ -209,6 +235,21 @@ private:
 
 	HANDLE					m_IoThreadHandle[2];
 
+	HANDLE					m_CompletionPort;
+
+	BOOL					m_SharedRingMode;		// TRUE if the data of all the active pins goes through mapped rings.
+	HANDLE					m_SharedRingEvent;		// Set by the pins when they cross a period of their ring.
+	LONG					m_SharedRingOutputPending;	// TRUE until the output period of the current buffer switch is written.
+
+	BOOL					m_EarlyOutputOption;	// "EarlyOutput" in emasio.dat.
+	BOOL					m_AdaptiveTransferDepthOption;	// "AdaptiveTransferDepth" in emasio.dat.
+	BOOL					m_OutputReadyCalled;	// TRUE once the host has called ASIOOutputReady().
+	CAsioSchedule			m_OutputSchedule;		// Output packets of the running engine.
+
+	HANDLE					m_LoadSection;			// Named section of the load meter, for monitors.
+	PVOID					m_LoadSectionView;
+	CAsioLoadMeter			m_LoadMeter;			// Times of the buffer switches.
+
 	HANDLE					m_AsioNodeEvent[ASIO_NODE_EVENT_COUNT];
 	KSEVENTDATA				m_AsioNodeEventData[ASIO_NODE_EVENT_COUNT];
 
@@ -224,6 +265,9 @@ private:
 
 	ULONGLONG				m_BufferSwitchCount;
 
+	LONGLONG				m_TimeStampFrequency;	// Performance counter frequency, 0 until anchored.
+	LONGLONG				m_TimeStampOffset;		// timeGetTime() - performance counter, in ns.
+
 	ASIO_DRIVER_CAPABILITIES	m_DriverCapabilities;	// What the driver can do...
 	ASIO_HOST_CAPABILITIES		m_HostCapabilities;		// What the host supports...
 
@@ -297,6 +341,19 @@ private:
 	(	void	
 	);
 
+	ASIOError _MapSharedRings
+	(	void	
+	);
+
+	ASIOError _UnmapSharedRings
+	(	void	
+	);
+
+	VOID _SignalControlEvent
+	(
+		IN		ULONG	ControlEvent
+	);
+
 	ASIOError _DetermineDriverCapabilities
 	(	void	
 	);
@@ -350,6 +407,39 @@ private:
 		IN		ULONG						PacketIndex
 	);
 
+	VOID _SyncSendOutput
+	(
+		IN		PFILTER_DATARANGE_ASIO *	DataRangeAsio
+	);
+
+	BOOL _IsSharedRingReady
+	(
+		IN		PFILTER_DATARANGE_ASIO *	DataRangeAsio,
+		IN		ULONG						ActiveSignalMask
+	);
+
+	VOID _SyncRewindSharedRings
+	(
+		IN		PFILTER_DATARANGE_ASIO *	DataRangeAsio
+	);
+
+	VOID _SyncZeroSharedRings
+	(
+		IN		PFILTER_DATARANGE_ASIO	DataRangeAsio
+	);
+
+	VOID _SyncWriteSharedRings
+	(
+		IN		PFILTER_DATARANGE_ASIO	DataRangeAsio,
+		IN		ULONG					BufferIndex
+	);
+
+	VOID _SyncReadSharedRings
+	(
+		IN		PFILTER_DATARANGE_ASIO	DataRangeAsio,
+		IN		ULONG					BufferIndex
+	);
+
 	VOID _SwitchBuffer
 	(
 		IN		ULONG	BufferIndex
@@ -368,11 +458,19 @@ private:
 		IN		ASIOSampleRate	SampleRate
 	);
 
+	VOID _AnchorTimeStamp
+	(	void
+	);
+
 	VOID _SnapshotTimeStamp
 	(
 		OUT		ULONGLONG *	OutTimeStamp
 	);
 
+	LONGLONG _ReadLoadCounter
+	(	void
+	);
+
 	VOID _SaveDriverSettingsToRegistry
 	(	void
 	);
@@ -390,6 +488,26 @@ private:
 	(	void
 	);
 
+	ULONG _GetSharedRingOption
+	(	void
+	);
+
+	ULONG _GetFloatOption
+	(	void
+	);
+
+	BOOL _GetEarlyOutputOption
+	(	void
+	);
+
+	BOOL _IsEarlyOutput
+	(	void
+	);
+
+	BOOL _GetAdaptiveTransferDepthOption
+	(	void
+	);
+
 	VOID _GetAppHacks
 	(	void
 	);
@@ -0,0 +1,231 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       clock.cpp
+ * @brief      Sample clock estimator of the ASIO engine.
+ *//*
+ *****************************************************************************
+ */
+#include "clock.h"
+
+#include <math.h>
+
+/*****************************************************************************
+ * CAsioClock::CAsioClock()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Constructor.
+ */
+CAsioClock::
+CAsioClock
+(	void
+)
+{
+	m_Relocks = 0;
+
+	Initialize(48000);
+}
+
+/*****************************************************************************
+ * CAsioClock::Initialize()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Set the nominal sample rate and restart the loop.
+ * @param
+ * SampleRate Nominal sample rate, in Hz.
+ * @return
+ * None.
+ */
+VOID
+CAsioClock::
+Initialize
+(
+	IN		ULONG	SampleRate
+)
+{
+	m_NominalPeriod = 1000000000.0 / (SampleRate ? SampleRate : 48000);
+
+	Reset();
+}
+
+/*****************************************************************************
+ * CAsioClock::Reset()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Restart the loop. The next update is taken as is.
+ */
+VOID
+CAsioClock::
+Reset
+(	void
+)
+{
+	m_Locked = FALSE;
+
+	m_BaseTime = 0;
+
+	m_SamplePosition = 0;
+
+	m_Time = 0;
+
+	m_Period = m_NominalPeriod;
+
+	m_Error = 0;
+}
+
+/*****************************************************************************
+ * CAsioClock::Update()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Feed the raw time a sample position was seen at.
+ * @param
+ * SamplePosition Sample position, which only goes forward between resets.
+ * @param
+ * RawTime Time the position was seen at, in ns.
+ * @return
+ * The filtered time of the position, in ns.
+ */
+ULONGLONG
+CAsioClock::
+Update
+(
+	IN		ULONGLONG	SamplePosition,
+	IN		ULONGLONG	RawTime
+)
+{
+	if (m_Locked && (SamplePosition > m_SamplePosition))
+	{
+		DOUBLE Samples = DOUBLE(SamplePosition - m_SamplePosition);
+
+		DOUBLE Interval = Samples * m_Period;
+
+		DOUBLE Predicted = m_Time + Interval;
+
+		m_Error = DOUBLE(LONGLONG(RawTime - m_BaseTime)) - Predicted;
+
+		if ((fabs(m_Error) <= Interval) || (fabs(m_Error) <= ASIO_CLOCK_RELOCK_TIME))
+		{
+			DOUBLE Bandwidth = (m_Time < ASIO_CLOCK_ACQUIRE_TIME) ? ASIO_CLOCK_ACQUIRE_BANDWIDTH : ASIO_CLOCK_TRACK_BANDWIDTH;
+
+			// Keep the loop stable for long intervals.
+			DOUBLE w = 2.0 * 3.14159265358979 * Bandwidth * Interval / 1000000000.0;
+
+			if (w > 0.5)
+			{
+				w = 0.5;
+			}
+
+			m_Time = Predicted + 1.41421356237310 * w * m_Error;
+
+			m_Period += w * w * m_Error / Samples;
+
+			m_SamplePosition = SamplePosition;
+
+			return GetTime();
+		}
+
+		m_Relocks++;
+	}
+
+	// Start over from the raw time, at the nominal rate.
+	m_Locked = TRUE;
+
+	m_BaseTime = RawTime;
+
+	m_SamplePosition = SamplePosition;
+
+	m_Time = 0;
+
+	m_Period = m_NominalPeriod;
+
+	m_Error = 0;
+
+	return RawTime;
+}
+
+/*****************************************************************************
+ * CAsioClock::GetTime()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Filtered time of the last update, in ns.
+ */
+ULONGLONG
+CAsioClock::
+GetTime
+(	void
+)
+{
+	return m_BaseTime + LONGLONG(floor(m_Time + 0.5));
+}
+
+/*****************************************************************************
+ * CAsioClock::GetSampleRate()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Measured sample rate, in Hz, against the clock of the raw times.
+ */
+DOUBLE
+CAsioClock::
+GetSampleRate
+(	void
+)
+{
+	return 1000000000.0 / m_Period;
+}
+
+/*****************************************************************************
+ * CAsioClock::GetError()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Prediction error of the last update, in ns.
+ */
+DOUBLE
+CAsioClock::
+GetError
+(	void
+)
+{
+	return m_Error;
+}
+
+/*****************************************************************************
+ * CAsioClock::GetRelocks()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Number of times the loop restarted on a large error.
+ */
+ULONG
+CAsioClock::
+GetRelocks
+(	void
+)
+{
+	return m_Relocks;
+}
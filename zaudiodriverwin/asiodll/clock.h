@@ -0,0 +1,126 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       clock.h
+ * @brief      Sample clock estimator of the ASIO engine.
+ * @details
+ * CAsioClock turns the raw times at which the buffer switches are seen into
+ * a smooth time line for the sample positions. The raw times carry the
+ * wake up latency of the main thread; a second order delay locked loop
+ * filters it out, and tracks the drift between the device's sample clock
+ * and the system clock. The estimator does no I/O and reads no clock, so it
+ * can be fed recorded or synthetic traces.
+ *//*
+ *****************************************************************************
+ */
+#ifndef _ASIO_CLOCK_H_
+#define _ASIO_CLOCK_H_
+
+#include <windows.h>
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Loop bandwidth while locking, in Hz. */
+#define ASIO_CLOCK_ACQUIRE_BANDWIDTH	4.0
+
+/*! @brief Loop bandwidth once locked, in Hz. */
+#define ASIO_CLOCK_TRACK_BANDWIDTH		0.25
+
+/*! @brief Time spent at the acquire bandwidth, in ns. */
+#define ASIO_CLOCK_ACQUIRE_TIME			1000000000.0
+
+/*! @brief Errors larger than this (and than the update interval) restart the loop, in ns. */
+#define ASIO_CLOCK_RELOCK_TIME			20000000.0
+
+/*****************************************************************************
+ * Classes
+ */
+/*****************************************************************************
+ *//*! @class CAsioClock
+ *****************************************************************************
+ * @brief
+ * Delay locked loop between the sample positions and the system time.
+ * @details
+ * Each update gives the sample position of a buffer switch and the raw time
+ * it was seen at. The loop predicts the time of the position from the last
+ * filtered time and the filtered sample period, and moves both by a part of
+ * the prediction error:
+ *
+ *     Error = RawTime - (Time + Samples * Period)
+ *     Time += Samples * Period + b * Error
+ *     Period += c * Error / Samples
+ *
+ * with w = 2 * pi * Bandwidth * Interval, b = sqrt(2) * w and c = w * w,
+ * which is critically damped. The loop starts wide so that it locks within
+ * a second, then narrows. An error larger than both the update interval and
+ * ASIO_CLOCK_RELOCK_TIME (a stall, a lost switch) restarts it from the raw
+ * time.
+ */
+class CAsioClock
+{
+private:
+	DOUBLE		m_NominalPeriod;	/*!< @brief Sample period at the nominal rate, in ns. */
+	BOOL		m_Locked;			/*!< @brief TRUE once the loop has a time to start from. */
+	ULONGLONG	m_BaseTime;			/*!< @brief Raw time the loop started at, in ns. */
+	ULONGLONG	m_SamplePosition;	/*!< @brief Sample position of the last update. */
+	DOUBLE		m_Time;				/*!< @brief Filtered time of the last update, in ns after m_BaseTime. */
+	DOUBLE		m_Period;			/*!< @brief Filtered sample period, in ns. */
+	DOUBLE		m_Error;			/*!< @brief Prediction error of the last update, in ns. */
+	ULONG		m_Relocks;			/*!< @brief Number of times the loop restarted. */
+
+public:
+    /*************************************************************************
+     * Constructor.
+     */
+	CAsioClock();
+
+    /*************************************************************************
+     * CAsioClock methods
+     */
+	VOID Initialize
+	(
+		IN		ULONG	SampleRate
+	);
+	VOID Reset
+	(	void
+	);
+	ULONGLONG Update
+	(
+		IN		ULONGLONG	SamplePosition,
+		IN		ULONGLONG	RawTime
+	);
+	ULONGLONG GetTime
+	(	void
+	);
+	DOUBLE GetSampleRate
+	(	void
+	);
+	DOUBLE GetError
+	(	void
+	);
+	ULONG GetRelocks
+	(	void
+	);
+};
+
+#endif // _ASIO_CLOCK_H_
@@ -0,0 +1,228 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       engine.cpp
+ * @brief      Buffer switch state machine of the ASIO engine.
+ *//*
+ *****************************************************************************
+ */
+#include "engine.h"
+
+/*****************************************************************************
+ * CAsioEngine::CAsioEngine()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Constructor.
+ */
+CAsioEngine::
+CAsioEngine
+(	void
+)
+{
+	Initialize(0, 0, 0);
+}
+
+/*****************************************************************************
+ * CAsioEngine::Initialize()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Set the pins and directions that take part in the buffer switches.
+ * @param
+ * OutputPinMask Bit i is set if output pin i is active.
+ * @param
+ * InputPinMask Bit i is set if input pin i is active.
+ * @param
+ * ActiveSignalMask 0x1 if the switches wait on the output pins, 0x2 if they
+ * wait on the input pins.
+ * @return
+ * None.
+ */
+VOID
+CAsioEngine::
+Initialize
+(
+	IN		ULONG	OutputPinMask,
+	IN		ULONG	InputPinMask,
+	IN		ULONG	ActiveSignalMask
+)
+{
+	m_ActivePinMask[ASIO_ENGINE_OUTPUT] = OutputPinMask;
+	m_ActivePinMask[ASIO_ENGINE_INPUT] = InputPinMask;
+
+	m_ActiveSignalMask = ActiveSignalMask;
+
+	m_Running = FALSE;
+
+	m_SignalMask[0] = m_SignalMask[1] = 0;
+
+	m_SignalPinMask[0][0] = m_SignalPinMask[0][1] = m_SignalPinMask[1][0] = m_SignalPinMask[1][1] = 0;
+}
+
+/*****************************************************************************
+ * CAsioEngine::Start()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Reset the masks and start switching buffers.
+ */
+VOID
+CAsioEngine::
+Start
+(	void
+)
+{
+	m_SignalMask[0] = m_SignalMask[1] = 0;
+
+	m_SignalPinMask[0][0] = m_SignalPinMask[0][1] = m_SignalPinMask[1][0] = m_SignalPinMask[1][1] = 0;
+
+	m_Running = TRUE;
+}
+
+/*****************************************************************************
+ * CAsioEngine::Stop()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Stop switching buffers.
+ */
+VOID
+CAsioEngine::
+Stop
+(	void
+)
+{
+	m_Running = FALSE;
+}
+
+/*****************************************************************************
+ * CAsioEngine::IsRunning()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * TRUE if the buffers are being switched.
+ */
+BOOL
+CAsioEngine::
+IsRunning
+(	void
+)
+{
+	return m_Running;
+}
+
+/*****************************************************************************
+ * CAsioEngine::PacketComplete()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * A pin is done with a packet.
+ * @param
+ * Direction ASIO_ENGINE_OUTPUT or ASIO_ENGINE_INPUT.
+ * @param
+ * PinIndex Index of the pin.
+ * @param
+ * PacketIndex Index of the packet on the pin.
+ * @param
+ * OutBufferIndex Half of the ASIO buffer the packet belongs to.
+ * @return
+ * The ASIO_ENGINE_ACTION_XXX to take, in the order listed.
+ */
+ULONG
+CAsioEngine::
+PacketComplete
+(
+	IN		ULONG	Direction,
+	IN		ULONG	PinIndex,
+	IN		ULONG	PacketIndex,
+	OUT		ULONG *	OutBufferIndex
+)
+{
+	ULONG Actions = 0;
+
+	ULONG BufferIndex = PacketIndex % 2;
+
+	m_SignalPinMask[Direction][BufferIndex] |= (1<<PinIndex);
+
+	if ((m_SignalPinMask[Direction][BufferIndex] & m_ActivePinMask[Direction]) == m_ActivePinMask[Direction])
+	{
+		if (m_Running)
+		{
+			if (Direction == ASIO_ENGINE_INPUT)
+			{
+				Actions |= ASIO_ENGINE_ACTION_READ_INPUT;
+			}
+
+			m_SignalMask[BufferIndex] |= (1<<Direction);
+
+			if ((m_SignalMask[BufferIndex] & m_ActiveSignalMask) == m_ActiveSignalMask)
+			{
+				Actions |= ASIO_ENGINE_ACTION_SWITCH;
+
+				m_SignalMask[BufferIndex] = 0;
+			}
+		}
+
+		// Clear the pin event mask.
+		m_SignalPinMask[Direction][BufferIndex] = 0;
+	}
+
+	*OutBufferIndex = BufferIndex;
+
+	return Actions;
+}
+
+/*****************************************************************************
+ * CAsioEngine::GetSignalMask()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Directions done with a half of the buffer since the last switch.
+ */
+ULONG
+CAsioEngine::
+GetSignalMask
+(
+	IN		ULONG	BufferIndex
+)
+{
+	return m_SignalMask[BufferIndex];
+}
+
+/*****************************************************************************
+ * CAsioEngine::GetSignalPinMask()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Pins of a direction done with a half of the buffer.
+ */
+ULONG
+CAsioEngine::
+GetSignalPinMask
+(
+	IN		ULONG	Direction,
+	IN		ULONG	BufferIndex
+)
+{
+	return m_SignalPinMask[Direction][BufferIndex];
+}
@@ -0,0 +1,117 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       engine.h
+ * @brief      Buffer switch state machine of the ASIO engine.
+ * @details
+ * CAsioEngine decides, from the packet completions of the output and input
+ * pins, when the input data can be read and when the host's buffers are
+ * switched. It does no I/O and does not wait on anything, so the order of
+ * the completions is up to the caller (CAsioDriver::_MainThreadHandler()
+ * takes them from an I/O completion port, in the order they complete).
+ *//*
+ *****************************************************************************
+ */
+#ifndef _ASIO_ENGINE_H_
+#define _ASIO_ENGINE_H_
+
+#include <windows.h>
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Pin directions. */
+#define ASIO_ENGINE_OUTPUT				0
+#define ASIO_ENGINE_INPUT				1
+
+/*! @brief Actions returned by CAsioEngine::PacketComplete(). */
+#define ASIO_ENGINE_ACTION_READ_INPUT	0x00000001	/*!< @brief All input pins are done with the buffer, read it. */
+#define ASIO_ENGINE_ACTION_SWITCH		0x00000002	/*!< @brief Both directions are done with the buffer, switch. */
+
+/*****************************************************************************
+ * Classes
+ */
+/*****************************************************************************
+ *//*! @class CAsioEngine
+ *****************************************************************************
+ * @brief
+ * Buffer switch state machine.
+ * @details
+ * For each of the two halves of the ASIO double buffer, a bit per pin
+ * (SignalPinMask) tracks which pins of a direction have completed a packet
+ * of that half. Once all the active pins of a direction have, the direction
+ * is set in SignalMask, and once all the active directions are set the
+ * buffers are switched. Packet completions while not running only clear
+ * the masks.
+ */
+class CAsioEngine
+{
+private:
+	ULONG	m_ActivePinMask[2];		/*!< @brief Active pins of each direction. */
+	ULONG	m_ActiveSignalMask;		/*!< @brief Directions that must be done before a switch. */
+	BOOL	m_Running;				/*!< @brief TRUE if the pins are running. */
+	ULONG	m_SignalMask[2];		/*!< @brief Directions done with each half of the buffer. */
+	ULONG	m_SignalPinMask[2][2];	/*!< @brief Pins done with each half of the buffer, per direction. */
+
+public:
+    /*************************************************************************
+     * Constructor.
+     */
+	CAsioEngine();
+
+    /*************************************************************************
+     * CAsioEngine methods
+     */
+	VOID Initialize
+	(
+		IN		ULONG	OutputPinMask,
+		IN		ULONG	InputPinMask,
+		IN		ULONG	ActiveSignalMask
+	);
+	VOID Start
+	(	void
+	);
+	VOID Stop
+	(	void
+	);
+	BOOL IsRunning
+	(	void
+	);
+	ULONG PacketComplete
+	(
+		IN		ULONG	Direction,
+		IN		ULONG	PinIndex,
+		IN		ULONG	PacketIndex,
+		OUT		ULONG *	OutBufferIndex
+	);
+	ULONG GetSignalMask
+	(
+		IN		ULONG	BufferIndex
+	);
+	ULONG GetSignalPinMask
+	(
+		IN		ULONG	Direction,
+		IN		ULONG	BufferIndex
+	);
+};
+
+#endif // _ASIO_ENGINE_H_
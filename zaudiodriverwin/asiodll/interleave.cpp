@@ -0,0 +1,1719 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       interleave.cpp
+ * @brief      Copy routines between the ASIO channel buffers and the
+ *             interleaved pin buffers.
+ * @details
+ * The scalar routines are the reference. When the CPU has them, the SSE2
+ * (16/32-bit) and SSSE3 (24-bit) routines move groups of 4 channels by
+ * 4 or 8 frames with register transposes (and pairs of channels on 24-bit
+ * output), and fall back to the scalar loops for the remaining channels
+ * and frames. All produce bit-identical
+ * output.
+ *
+ * The float routines convert the ASIO samples to and from the pin samples
+ * in the same pass, 4 channels by 4 frames at a time with SSE2 (SSSE3 for
+ * 24-bit pins). They too are bit-identical to their scalar versions, except
+ * for the dither noise, which comes from different generators.
+ *//*
+ *****************************************************************************
+ */
+#include "interleave.h"
+
+#include <intrin.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <math.h>
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief CPU features used to select the copy routines. */
+#define COPY_FEATURE_SSE2	0x00000001
+#define COPY_FEATURE_SSSE3	0x00000002
+
+/*! @brief Full scale of the pin samples, as floats. */
+#define FLOAT_SCALE_16		32768.0f
+#define FLOAT_SCALE_24		8388608.0f
+#define FLOAT_SCALE_32		2147483648.0f
+
+/*! @brief Largest pin samples, as floats (2^31-1 is not a float, the float below 2^31 is). */
+#define FLOAT_LIMIT_16		32767.0f
+#define FLOAT_LIMIT_24		8388607.0f
+#define FLOAT_LIMIT_32		2147483520.0f
+
+/*****************************************************************************
+ * Globals
+ */
+/*! 
+ * @brief Dither noise generators: one per SSE2 lane of each of the 4 channels
+ * converted together, so that they do not wait on each other, and one for the
+ * scalar loops. The copies are done on the main thread of the driver; a race
+ * would only repeat some noise.
+ */
+static ULONG DitherState[17] = 
+{ 
+	0x2545F491, 0x9E3779B9, 0x7F4A7C15, 0x6C8E9CF5, 0x1B873593, 0xCC9E2D51, 0x85EBCA6B, 0xC2B2AE35,
+	0x27D4EB2F, 0x165667B1, 0xD3A2646C, 0xFD7046C5, 0xB55A4F09, 0x68E31DA4, 0x5BD1E995, 0x3C6EF372,
+	0xA54FF53A
+};
+
+/*****************************************************************************
+ * Scalar routines
+ *****************************************************************************
+ * One channel at a time, Stride bytes apart in the pin buffer.
+ */
+static __forceinline
+VOID
+Scatter16
+(
+	IN		PUCHAR	Dst,
+	IN		ULONG	Stride,
+	IN		PSHORT	Src,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG i=0; i<NumberOfFrames; i++, Dst+=Stride)
+	{
+		*PSHORT(Dst) = Src[i];
+	}
+}
+
+static __forceinline
+VOID
+Gather16
+(
+	IN		PSHORT	Dst,
+	IN		PUCHAR	Src,
+	IN		ULONG	Stride,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG i=0; i<NumberOfFrames; i++, Src+=Stride)
+	{
+		Dst[i] = *PSHORT(Src);
+	}
+}
+
+static __forceinline
+VOID
+Scatter24
+(
+	IN		PUCHAR	Dst,
+	IN		ULONG	Stride,
+	IN		PUCHAR	Src,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG i=0; i<NumberOfFrames; i++, Dst+=Stride, Src+=3)
+	{
+		*PUSHORT(Dst) = *PUSHORT(Src); Dst[2] = Src[2];
+	}
+}
+
+static __forceinline
+VOID
+Gather24
+(
+	IN		PUCHAR	Dst,
+	IN		PUCHAR	Src,
+	IN		ULONG	Stride,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG i=0; i<NumberOfFrames; i++, Src+=Stride, Dst+=3)
+	{
+		*PUSHORT(Dst) = *PUSHORT(Src); Dst[2] = Src[2];
+	}
+}
+
+static __forceinline
+VOID
+Scatter32
+(
+	IN		PUCHAR	Dst,
+	IN		ULONG	Stride,
+	IN		PLONG	Src,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG i=0; i<NumberOfFrames; i++, Dst+=Stride)
+	{
+		*PLONG(Dst) = Src[i];
+	}
+}
+
+static __forceinline
+VOID
+Gather32
+(
+	IN		PLONG	Dst,
+	IN		PUCHAR	Src,
+	IN		ULONG	Stride,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG i=0; i<NumberOfFrames; i++, Src+=Stride)
+	{
+		Dst[i] = *PLONG(Src);
+	}
+}
+
+// Padded: the ASIO sample is 32-bit with the 24-bit sample in its upper
+// 3 bytes, the pin sample is packed 24-bit.
+static __forceinline
+VOID
+ScatterPadded
+(
+	IN		PUCHAR	Dst,
+	IN		ULONG	Stride,
+	IN		PLONG	Src,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG i=0; i<NumberOfFrames; i++, Dst+=Stride)
+	{
+		ULONG Sample = ULONG(Src[i]);
+
+		*PUSHORT(Dst) = USHORT(Sample >> 8); Dst[2] = UCHAR(Sample >> 24);
+	}
+}
+
+static __forceinline
+VOID
+GatherPadded
+(
+	IN		PLONG	Dst,
+	IN		PUCHAR	Src,
+	IN		ULONG	Stride,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG i=0; i<NumberOfFrames; i++, Src+=Stride)
+	{
+		Dst[i] = LONG((ULONG(*PUSHORT(Src)) << 8) | (ULONG(Src[2]) << 24));
+	}
+}
+
+/*****************************************************************************
+ * Interleave16() ... DeinterleavePadded()
+ *****************************************************************************
+ * @brief
+ * Scalar copy routines.
+ */
+static
+VOID
+Interleave16
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG c=0; c<NumberOfChannels; c++)
+	{
+		Scatter16(Frames + c*2, NumberOfChannels*2, PSHORT(Channels[c]), NumberOfFrames);
+	}
+}
+
+static
+VOID
+Deinterleave16
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG c=0; c<NumberOfChannels; c++)
+	{
+		Gather16(PSHORT(Channels[c]), Frames + c*2, NumberOfChannels*2, NumberOfFrames);
+	}
+}
+
+static
+VOID
+Interleave24
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG c=0; c<NumberOfChannels; c++)
+	{
+		Scatter24(Frames + c*3, NumberOfChannels*3, PUCHAR(Channels[c]), NumberOfFrames);
+	}
+}
+
+static
+VOID
+Deinterleave24
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG c=0; c<NumberOfChannels; c++)
+	{
+		Gather24(PUCHAR(Channels[c]), Frames + c*3, NumberOfChannels*3, NumberOfFrames);
+	}
+}
+
+static
+VOID
+Interleave32
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG c=0; c<NumberOfChannels; c++)
+	{
+		Scatter32(Frames + c*4, NumberOfChannels*4, PLONG(Channels[c]), NumberOfFrames);
+	}
+}
+
+static
+VOID
+Deinterleave32
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG c=0; c<NumberOfChannels; c++)
+	{
+		Gather32(PLONG(Channels[c]), Frames + c*4, NumberOfChannels*4, NumberOfFrames);
+	}
+}
+
+static
+VOID
+InterleavePadded
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG c=0; c<NumberOfChannels; c++)
+	{
+		ScatterPadded(Frames + c*3, NumberOfChannels*3, PLONG(Channels[c]), NumberOfFrames);
+	}
+}
+
+static
+VOID
+DeinterleavePadded
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	for (ULONG c=0; c<NumberOfChannels; c++)
+	{
+		GatherPadded(PLONG(Channels[c]), Frames + c*3, NumberOfChannels*3, NumberOfFrames);
+	}
+}
+
+/*****************************************************************************
+ * Float conversions
+ *****************************************************************************
+ * The float ASIO samples are full scale at +/-1.0. They are scaled to the
+ * pin sample, dithered if asked to, clipped (a NaN to negative full scale),
+ * and rounded to nearest even as cvtps2dq does in the default rounding
+ * mode. The 24-bit pin samples are read in the upper 3 bytes of a LONG, so
+ * they share the scale of the 32-bit ones.
+ */
+static __forceinline
+ULONG
+NextDither
+(
+	IN OUT	ULONG &	State
+)
+{
+	State ^= State << 13; State ^= State >> 17; State ^= State << 5;
+
+	return State;
+}
+
+// Triangular noise of +/-1 LSB, the difference of the two halves of a step.
+static __forceinline
+FLOAT
+DitherNoise
+(
+	IN OUT	ULONG &	State
+)
+{
+	ULONG Random = NextDither(State);
+
+	return FLOAT(LONG(Random >> 16) - LONG(Random & 0xFFFF)) * (1.0f / 65536.0f);
+}
+
+static __forceinline
+LONG
+FloatToFixed
+(
+	IN		FLOAT	Sample,
+	IN		FLOAT	Scale,
+	IN		FLOAT	Limit,
+	IN		FLOAT	Noise
+)
+{
+	FLOAT Value = Sample * Scale + Noise;
+
+	if (!(Value >= -Scale)) Value = -Scale;
+	if (Value > Limit) Value = Limit;
+
+	FLOAT Floor = FLOAT(floor(Value));
+
+	FLOAT Fraction = Value - Floor;
+
+	LONG Fixed = LONG(Floor);
+
+	if ((Fraction > 0.5f) || ((Fraction == 0.5f) && (Fixed & 1)))
+	{
+		Fixed++;
+	}
+
+	return Fixed;
+}
+
+// SampleSize is in bytes on the pin.
+static __forceinline
+VOID
+ScatterFloat
+(
+	IN		PUCHAR	Dst,
+	IN		ULONG	Stride,
+	IN		PFLOAT	Src,
+	IN		ULONG	NumberOfFrames,
+	IN		ULONG	SampleSize,
+	IN		BOOL	Dither,
+	IN OUT	ULONG &	State
+)
+{
+	FLOAT Scale = (SampleSize == 2) ? FLOAT_SCALE_16 : (SampleSize == 3) ? FLOAT_SCALE_24 : FLOAT_SCALE_32;
+	FLOAT Limit = (SampleSize == 2) ? FLOAT_LIMIT_16 : (SampleSize == 3) ? FLOAT_LIMIT_24 : FLOAT_LIMIT_32;
+
+	for (ULONG i=0; i<NumberOfFrames; i++, Dst+=Stride)
+	{
+		LONG Fixed = FloatToFixed(Src[i], Scale, Limit, Dither ? DitherNoise(State) : 0.0f);
+
+		switch (SampleSize)
+		{
+			case 2: *PSHORT(Dst) = SHORT(Fixed); break;
+			case 3: *PUSHORT(Dst) = USHORT(Fixed); Dst[2] = UCHAR(Fixed >> 16); break;
+			case 4: *PLONG(Dst) = Fixed; break;
+		}
+	}
+}
+
+static __forceinline
+VOID
+GatherFloat
+(
+	IN		PFLOAT	Dst,
+	IN		PUCHAR	Src,
+	IN		ULONG	Stride,
+	IN		ULONG	NumberOfFrames,
+	IN		ULONG	SampleSize
+)
+{
+	FLOAT Scale = (SampleSize == 2) ? (1.0f / FLOAT_SCALE_16) : (1.0f / FLOAT_SCALE_32);
+
+	for (ULONG i=0; i<NumberOfFrames; i++, Src+=Stride)
+	{
+		LONG Fixed;
+
+		switch (SampleSize)
+		{
+			case 2: Fixed = *PSHORT(Src); break;
+			case 3: Fixed = LONG((ULONG(*PUSHORT(Src)) << 8) | (ULONG(Src[2]) << 24)); break;
+			default: Fixed = *PLONG(Src); break;
+		}
+
+		Dst[i] = FLOAT(Fixed) * Scale;
+	}
+}
+
+/*****************************************************************************
+ * InterleaveFloat16() ... DeinterleaveFloat32()
+ *****************************************************************************
+ * @brief
+ * Scalar copy routines for float ASIO samples.
+ */
+static __forceinline
+VOID
+InterleaveFloatCommon
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames,
+	IN		ULONG	SampleSize,
+	IN		BOOL	Dither
+)
+{
+	ULONG State = DitherState[16];
+
+	for (ULONG c=0; c<NumberOfChannels; c++)
+	{
+		ScatterFloat(Frames + c*SampleSize, NumberOfChannels*SampleSize, PFLOAT(Channels[c]), NumberOfFrames, SampleSize, Dither, State);
+	}
+
+	DitherState[16] = State;
+}
+
+static __forceinline
+VOID
+DeinterleaveFloatCommon
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames,
+	IN		ULONG	SampleSize
+)
+{
+	for (ULONG c=0; c<NumberOfChannels; c++)
+	{
+		GatherFloat(PFLOAT(Channels[c]), Frames + c*SampleSize, NumberOfChannels*SampleSize, NumberOfFrames, SampleSize);
+	}
+}
+
+static
+VOID
+InterleaveFloat16
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	InterleaveFloatCommon(Frames, Channels, NumberOfChannels, NumberOfFrames, 2, FALSE);
+}
+
+static
+VOID
+InterleaveFloat16Dither
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	InterleaveFloatCommon(Frames, Channels, NumberOfChannels, NumberOfFrames, 2, TRUE);
+}
+
+static
+VOID
+DeinterleaveFloat16
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	DeinterleaveFloatCommon(Frames, Channels, NumberOfChannels, NumberOfFrames, 2);
+}
+
+static
+VOID
+InterleaveFloat24
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	InterleaveFloatCommon(Frames, Channels, NumberOfChannels, NumberOfFrames, 3, FALSE);
+}
+
+static
+VOID
+InterleaveFloat24Dither
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	InterleaveFloatCommon(Frames, Channels, NumberOfChannels, NumberOfFrames, 3, TRUE);
+}
+
+static
+VOID
+DeinterleaveFloat24
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	DeinterleaveFloatCommon(Frames, Channels, NumberOfChannels, NumberOfFrames, 3);
+}
+
+static
+VOID
+InterleaveFloat32
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	InterleaveFloatCommon(Frames, Channels, NumberOfChannels, NumberOfFrames, 4, FALSE);
+}
+
+static
+VOID
+DeinterleaveFloat32
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	DeinterleaveFloatCommon(Frames, Channels, NumberOfChannels, NumberOfFrames, 4);
+}
+
+/*****************************************************************************
+ * GetCopyFeatures()
+ *****************************************************************************
+ * @brief
+ * Query the CPU for the instruction sets usable by the copy routines.
+ */
+static
+ULONG
+GetCopyFeatures
+(	void
+)
+{
+	int CpuInfo[4];
+
+	__cpuid(CpuInfo, 1);
+
+	ULONG Features = 0;
+
+	if (CpuInfo[3] & (1<<26)) Features |= COPY_FEATURE_SSE2;
+	if (CpuInfo[2] & (1<<9))  Features |= COPY_FEATURE_SSSE3;
+
+	return Features;
+}
+
+/*****************************************************************************
+ * Transpose4x4()
+ *****************************************************************************
+ * @brief
+ * Transpose the 4x4 matrix of 32-bit elements in X0..X3.
+ */
+static __forceinline
+VOID
+Transpose4x4
+(
+	IN OUT	__m128i &	X0,
+	IN OUT	__m128i &	X1,
+	IN OUT	__m128i &	X2,
+	IN OUT	__m128i &	X3
+)
+{
+	__m128i T0 = _mm_unpacklo_epi32(X0, X1);
+	__m128i T1 = _mm_unpacklo_epi32(X2, X3);
+	__m128i T2 = _mm_unpackhi_epi32(X0, X1);
+	__m128i T3 = _mm_unpackhi_epi32(X2, X3);
+
+	X0 = _mm_unpacklo_epi64(T0, T1);
+	X1 = _mm_unpackhi_epi64(T0, T1);
+	X2 = _mm_unpacklo_epi64(T2, T3);
+	X3 = _mm_unpackhi_epi64(T2, T3);
+}
+
+/*****************************************************************************
+ * Load12()/Store12()/Store6()
+ *****************************************************************************
+ * @brief
+ * Move 12 (or 6) bytes without touching the ones that follow, which may belong to
+ * other channels or be past the end of the buffer.
+ */
+static __forceinline
+__m128i
+Load12
+(
+	IN		PUCHAR	Src
+)
+{
+	return _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i*)Src), _mm_cvtsi32_si128(*(int*)(Src+8)));
+}
+
+static __forceinline
+VOID
+Store12
+(
+	IN		PUCHAR	Dst,
+	IN		__m128i	X
+)
+{
+	_mm_storel_epi64((__m128i*)Dst, X);
+
+	*(int*)(Dst+8) = _mm_cvtsi128_si32(_mm_srli_si128(X, 8));
+}
+
+static __forceinline
+VOID
+Store6
+(
+	IN		PUCHAR	Dst,
+	IN		__m128i	X
+)
+{
+	*(int*)Dst = _mm_cvtsi128_si32(X);
+
+	*(short*)(Dst+4) = short(_mm_extract_epi16(X, 2));
+}
+
+/*****************************************************************************
+ * Interleave16_Sse2()
+ *****************************************************************************
+ * @brief
+ * SSE2 version of Interleave16().
+ */
+static
+VOID
+Interleave16_Sse2
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	ULONG Stride = NumberOfChannels*2;
+
+	ULONG c = 0;
+
+	for (; c+4<=NumberOfChannels; c+=4)
+	{
+		PSHORT S0 = PSHORT(Channels[c+0]), S1 = PSHORT(Channels[c+1]), S2 = PSHORT(Channels[c+2]), S3 = PSHORT(Channels[c+3]);
+
+		PUCHAR Dst = Frames + c*2;
+
+		ULONG f = 0;
+
+		for (; f+8<=NumberOfFrames; f+=8)
+		{
+			__m128i X0 = _mm_loadu_si128((__m128i*)(S0+f));
+			__m128i X1 = _mm_loadu_si128((__m128i*)(S1+f));
+			__m128i X2 = _mm_loadu_si128((__m128i*)(S2+f));
+			__m128i X3 = _mm_loadu_si128((__m128i*)(S3+f));
+
+			// Pairs of channels, then 2 frames of 4 channels per register.
+			__m128i A0 = _mm_unpacklo_epi16(X0, X1), A1 = _mm_unpackhi_epi16(X0, X1);
+			__m128i B0 = _mm_unpacklo_epi16(X2, X3), B1 = _mm_unpackhi_epi16(X2, X3);
+
+			__m128i R0 = _mm_unpacklo_epi32(A0, B0), R1 = _mm_unpackhi_epi32(A0, B0);
+			__m128i R2 = _mm_unpacklo_epi32(A1, B1), R3 = _mm_unpackhi_epi32(A1, B1);
+
+			PUCHAR D = Dst + f*Stride;
+
+			_mm_storel_epi64((__m128i*)(D+0*Stride), R0); _mm_storel_epi64((__m128i*)(D+1*Stride), _mm_srli_si128(R0, 8));
+			_mm_storel_epi64((__m128i*)(D+2*Stride), R1); _mm_storel_epi64((__m128i*)(D+3*Stride), _mm_srli_si128(R1, 8));
+			_mm_storel_epi64((__m128i*)(D+4*Stride), R2); _mm_storel_epi64((__m128i*)(D+5*Stride), _mm_srli_si128(R2, 8));
+			_mm_storel_epi64((__m128i*)(D+6*Stride), R3); _mm_storel_epi64((__m128i*)(D+7*Stride), _mm_srli_si128(R3, 8));
+		}
+
+		for (ULONG k=0; k<4; k++)
+		{
+			Scatter16(Dst + f*Stride + k*2, Stride, PSHORT(Channels[c+k])+f, NumberOfFrames-f);
+		}
+	}
+
+	for (; c<NumberOfChannels; c++)
+	{
+		Scatter16(Frames + c*2, Stride, PSHORT(Channels[c]), NumberOfFrames);
+	}
+}
+
+/*****************************************************************************
+ * Deinterleave16_Sse2()
+ *****************************************************************************
+ * @brief
+ * SSE2 version of Deinterleave16().
+ */
+static
+VOID
+Deinterleave16_Sse2
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	ULONG Stride = NumberOfChannels*2;
+
+	ULONG c = 0;
+
+	for (; c+4<=NumberOfChannels; c+=4)
+	{
+		PSHORT S0 = PSHORT(Channels[c+0]), S1 = PSHORT(Channels[c+1]), S2 = PSHORT(Channels[c+2]), S3 = PSHORT(Channels[c+3]);
+
+		PUCHAR Src = Frames + c*2;
+
+		ULONG f = 0;
+
+		for (; f+8<=NumberOfFrames; f+=8)
+		{
+			PUCHAR S = Src + f*Stride;
+
+			// 2 frames of 4 channels per register.
+			__m128i R0 = _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i*)(S+0*Stride)), _mm_loadl_epi64((__m128i*)(S+1*Stride)));
+			__m128i R1 = _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i*)(S+2*Stride)), _mm_loadl_epi64((__m128i*)(S+3*Stride)));
+			__m128i R2 = _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i*)(S+4*Stride)), _mm_loadl_epi64((__m128i*)(S+5*Stride)));
+			__m128i R3 = _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i*)(S+6*Stride)), _mm_loadl_epi64((__m128i*)(S+7*Stride)));
+
+			// Frames 0,2 and 1,3 side by side, then 4 frames of 2 channels.
+			__m128i T0 = _mm_unpacklo_epi16(R0, R1), T1 = _mm_unpackhi_epi16(R0, R1);
+			__m128i T2 = _mm_unpacklo_epi16(R2, R3), T3 = _mm_unpackhi_epi16(R2, R3);
+
+			__m128i U0 = _mm_unpacklo_epi16(T0, T1), U1 = _mm_unpackhi_epi16(T0, T1);
+			__m128i U2 = _mm_unpacklo_epi16(T2, T3), U3 = _mm_unpackhi_epi16(T2, T3);
+
+			_mm_storeu_si128((__m128i*)(S0+f), _mm_unpacklo_epi64(U0, U2));
+			_mm_storeu_si128((__m128i*)(S1+f), _mm_unpackhi_epi64(U0, U2));
+			_mm_storeu_si128((__m128i*)(S2+f), _mm_unpacklo_epi64(U1, U3));
+			_mm_storeu_si128((__m128i*)(S3+f), _mm_unpackhi_epi64(U1, U3));
+		}
+
+		for (ULONG k=0; k<4; k++)
+		{
+			Gather16(PSHORT(Channels[c+k])+f, Src + f*Stride + k*2, Stride, NumberOfFrames-f);
+		}
+	}
+
+	for (; c<NumberOfChannels; c++)
+	{
+		Gather16(PSHORT(Channels[c]), Frames + c*2, Stride, NumberOfFrames);
+	}
+}
+
+/*****************************************************************************
+ * Interleave32_Sse2()
+ *****************************************************************************
+ * @brief
+ * SSE2 version of Interleave32().
+ */
+static
+VOID
+Interleave32_Sse2
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	ULONG Stride = NumberOfChannels*4;
+
+	ULONG c = 0;
+
+	for (; c+4<=NumberOfChannels; c+=4)
+	{
+		PLONG S0 = PLONG(Channels[c+0]), S1 = PLONG(Channels[c+1]), S2 = PLONG(Channels[c+2]), S3 = PLONG(Channels[c+3]);
+
+		PUCHAR Dst = Frames + c*4;
+
+		ULONG f = 0;
+
+		for (; f+4<=NumberOfFrames; f+=4)
+		{
+			__m128i X0 = _mm_loadu_si128((__m128i*)(S0+f));
+			__m128i X1 = _mm_loadu_si128((__m128i*)(S1+f));
+			__m128i X2 = _mm_loadu_si128((__m128i*)(S2+f));
+			__m128i X3 = _mm_loadu_si128((__m128i*)(S3+f));
+
+			Transpose4x4(X0, X1, X2, X3);
+
+			PUCHAR D = Dst + f*Stride;
+
+			_mm_storeu_si128((__m128i*)(D+0*Stride), X0);
+			_mm_storeu_si128((__m128i*)(D+1*Stride), X1);
+			_mm_storeu_si128((__m128i*)(D+2*Stride), X2);
+			_mm_storeu_si128((__m128i*)(D+3*Stride), X3);
+		}
+
+		for (ULONG k=0; k<4; k++)
+		{
+			Scatter32(Dst + f*Stride + k*4, Stride, PLONG(Channels[c+k])+f, NumberOfFrames-f);
+		}
+	}
+
+	for (; c<NumberOfChannels; c++)
+	{
+		Scatter32(Frames + c*4, Stride, PLONG(Channels[c]), NumberOfFrames);
+	}
+}
+
+/*****************************************************************************
+ * Deinterleave32_Sse2()
+ *****************************************************************************
+ * @brief
+ * SSE2 version of Deinterleave32().
+ */
+static
+VOID
+Deinterleave32_Sse2
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	ULONG Stride = NumberOfChannels*4;
+
+	ULONG c = 0;
+
+	for (; c+4<=NumberOfChannels; c+=4)
+	{
+		PLONG S0 = PLONG(Channels[c+0]), S1 = PLONG(Channels[c+1]), S2 = PLONG(Channels[c+2]), S3 = PLONG(Channels[c+3]);
+
+		PUCHAR Src = Frames + c*4;
+
+		ULONG f = 0;
+
+		for (; f+4<=NumberOfFrames; f+=4)
+		{
+			PUCHAR S = Src + f*Stride;
+
+			__m128i X0 = _mm_loadu_si128((__m128i*)(S+0*Stride));
+			__m128i X1 = _mm_loadu_si128((__m128i*)(S+1*Stride));
+			__m128i X2 = _mm_loadu_si128((__m128i*)(S+2*Stride));
+			__m128i X3 = _mm_loadu_si128((__m128i*)(S+3*Stride));
+
+			Transpose4x4(X0, X1, X2, X3);
+
+			_mm_storeu_si128((__m128i*)(S0+f), X0);
+			_mm_storeu_si128((__m128i*)(S1+f), X1);
+			_mm_storeu_si128((__m128i*)(S2+f), X2);
+			_mm_storeu_si128((__m128i*)(S3+f), X3);
+		}
+
+		for (ULONG k=0; k<4; k++)
+		{
+			Gather32(PLONG(Channels[c+k])+f, Src + f*Stride + k*4, Stride, NumberOfFrames-f);
+		}
+	}
+
+	for (; c<NumberOfChannels; c++)
+	{
+		Gather32(PLONG(Channels[c]), Frames + c*4, Stride, NumberOfFrames);
+	}
+}
+
+/*****************************************************************************
+ * Interleave24Common_Ssse3()
+ *****************************************************************************
+ * @brief
+ * SSSE3 version of Interleave24() (Padded = FALSE) and InterleavePadded()
+ * (Padded = TRUE).
+ * @details
+ * The 24-bit samples are widened to 32-bit lanes, transposed, and packed
+ * back to 24-bit.
+ */
+static __forceinline
+VOID
+Interleave24Common_Ssse3
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames,
+	IN		BOOL	Padded
+)
+{
+	const __m128i Widen = _mm_setr_epi8(-1,0,1,2, -1,3,4,5, -1,6,7,8, -1,9,10,11);
+	const __m128i Pack = _mm_setr_epi8(1,2,3, 5,6,7, 9,10,11, 13,14,15, -1,-1,-1,-1);
+
+	ULONG ChannelSize = Padded ? 4 : 3;
+
+	ULONG Stride = NumberOfChannels*3;
+
+	ULONG c = 0;
+
+	for (; c+4<=NumberOfChannels; c+=4)
+	{
+		PUCHAR S0 = PUCHAR(Channels[c+0]), S1 = PUCHAR(Channels[c+1]), S2 = PUCHAR(Channels[c+2]), S3 = PUCHAR(Channels[c+3]);
+
+		PUCHAR Dst = Frames + c*3;
+
+		ULONG f = 0;
+
+		for (; f+4<=NumberOfFrames; f+=4)
+		{
+			__m128i X0, X1, X2, X3;
+
+			if (Padded)
+			{
+				X0 = _mm_loadu_si128((__m128i*)(S0+f*4));
+				X1 = _mm_loadu_si128((__m128i*)(S1+f*4));
+				X2 = _mm_loadu_si128((__m128i*)(S2+f*4));
+				X3 = _mm_loadu_si128((__m128i*)(S3+f*4));
+			}
+			else
+			{
+				X0 = _mm_shuffle_epi8(Load12(S0+f*3), Widen);
+				X1 = _mm_shuffle_epi8(Load12(S1+f*3), Widen);
+				X2 = _mm_shuffle_epi8(Load12(S2+f*3), Widen);
+				X3 = _mm_shuffle_epi8(Load12(S3+f*3), Widen);
+			}
+
+			Transpose4x4(X0, X1, X2, X3);
+
+			PUCHAR D = Dst + f*Stride;
+
+			Store12(D+0*Stride, _mm_shuffle_epi8(X0, Pack));
+			Store12(D+1*Stride, _mm_shuffle_epi8(X1, Pack));
+			Store12(D+2*Stride, _mm_shuffle_epi8(X2, Pack));
+			Store12(D+3*Stride, _mm_shuffle_epi8(X3, Pack));
+		}
+
+		for (ULONG k=0; k<4; k++)
+		{
+			PUCHAR Src = PUCHAR(Channels[c+k]) + f*ChannelSize;
+
+			if (Padded)
+			{
+				ScatterPadded(Dst + f*Stride + k*3, Stride, PLONG(Src), NumberOfFrames-f);
+			}
+			else
+			{
+				Scatter24(Dst + f*Stride + k*3, Stride, Src, NumberOfFrames-f);
+			}
+		}
+	}
+
+	// A pair of channels is 6 bytes of each frame, which is common enough 
+	// (stereo pins) to be worth its own loop.
+	for (; c+2<=NumberOfChannels; c+=2)
+	{
+		PUCHAR S0 = PUCHAR(Channels[c+0]), S1 = PUCHAR(Channels[c+1]);
+
+		PUCHAR Dst = Frames + c*3;
+
+		ULONG f = 0;
+
+		for (; f+4<=NumberOfFrames; f+=4)
+		{
+			__m128i X0, X1;
+
+			if (Padded)
+			{
+				X0 = _mm_loadu_si128((__m128i*)(S0+f*4));
+				X1 = _mm_loadu_si128((__m128i*)(S1+f*4));
+			}
+			else
+			{
+				X0 = _mm_shuffle_epi8(Load12(S0+f*3), Widen);
+				X1 = _mm_shuffle_epi8(Load12(S1+f*3), Widen);
+			}
+
+			// 2 frames of 2 channels per register.
+			__m128i P0 = _mm_shuffle_epi8(_mm_unpacklo_epi32(X0, X1), Pack);
+			__m128i P1 = _mm_shuffle_epi8(_mm_unpackhi_epi32(X0, X1), Pack);
+
+			PUCHAR D = Dst + f*Stride;
+
+			Store6(D+0*Stride, P0); Store6(D+1*Stride, _mm_srli_si128(P0, 6));
+			Store6(D+2*Stride, P1); Store6(D+3*Stride, _mm_srli_si128(P1, 6));
+		}
+
+		for (ULONG k=0; k<2; k++)
+		{
+			PUCHAR Src = PUCHAR(Channels[c+k]) + f*ChannelSize;
+
+			if (Padded)
+			{
+				ScatterPadded(Dst + f*Stride + k*3, Stride, PLONG(Src), NumberOfFrames-f);
+			}
+			else
+			{
+				Scatter24(Dst + f*Stride + k*3, Stride, Src, NumberOfFrames-f);
+			}
+		}
+	}
+
+	for (; c<NumberOfChannels; c++)
+	{
+		if (Padded)
+		{
+			ScatterPadded(Frames + c*3, Stride, PLONG(Channels[c]), NumberOfFrames);
+		}
+		else
+		{
+			Scatter24(Frames + c*3, Stride, PUCHAR(Channels[c]), NumberOfFrames);
+		}
+	}
+}
+
+/*****************************************************************************
+ * Deinterleave24Common_Ssse3()
+ *****************************************************************************
+ * @brief
+ * SSSE3 version of Deinterleave24() (Padded = FALSE) and
+ * DeinterleavePadded() (Padded = TRUE).
+ */
+static __forceinline
+VOID
+Deinterleave24Common_Ssse3
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames,
+	IN		BOOL	Padded
+)
+{
+	const __m128i Widen = _mm_setr_epi8(-1,0,1,2, -1,3,4,5, -1,6,7,8, -1,9,10,11);
+	const __m128i Pack = _mm_setr_epi8(1,2,3, 5,6,7, 9,10,11, 13,14,15, -1,-1,-1,-1);
+
+	ULONG ChannelSize = Padded ? 4 : 3;
+
+	ULONG Stride = NumberOfChannels*3;
+
+	ULONG c = 0;
+
+	for (; c+4<=NumberOfChannels; c+=4)
+	{
+		PUCHAR S0 = PUCHAR(Channels[c+0]), S1 = PUCHAR(Channels[c+1]), S2 = PUCHAR(Channels[c+2]), S3 = PUCHAR(Channels[c+3]);
+
+		PUCHAR Src = Frames + c*3;
+
+		ULONG f = 0;
+
+		for (; f+4<=NumberOfFrames; f+=4)
+		{
+			PUCHAR S = Src + f*Stride;
+
+			__m128i X0 = _mm_shuffle_epi8(Load12(S+0*Stride), Widen);
+			__m128i X1 = _mm_shuffle_epi8(Load12(S+1*Stride), Widen);
+			__m128i X2 = _mm_shuffle_epi8(Load12(S+2*Stride), Widen);
+			__m128i X3 = _mm_shuffle_epi8(Load12(S+3*Stride), Widen);
+
+			Transpose4x4(X0, X1, X2, X3);
+
+			if (Padded)
+			{
+				_mm_storeu_si128((__m128i*)(S0+f*4), X0);
+				_mm_storeu_si128((__m128i*)(S1+f*4), X1);
+				_mm_storeu_si128((__m128i*)(S2+f*4), X2);
+				_mm_storeu_si128((__m128i*)(S3+f*4), X3);
+			}
+			else
+			{
+				Store12(S0+f*3, _mm_shuffle_epi8(X0, Pack));
+				Store12(S1+f*3, _mm_shuffle_epi8(X1, Pack));
+				Store12(S2+f*3, _mm_shuffle_epi8(X2, Pack));
+				Store12(S3+f*3, _mm_shuffle_epi8(X3, Pack));
+			}
+		}
+
+		for (ULONG k=0; k<4; k++)
+		{
+			PUCHAR Dst = PUCHAR(Channels[c+k]) + f*ChannelSize;
+
+			if (Padded)
+			{
+				GatherPadded(PLONG(Dst), Src + f*Stride + k*3, Stride, NumberOfFrames-f);
+			}
+			else
+			{
+				Gather24(Dst, Src + f*Stride + k*3, Stride, NumberOfFrames-f);
+			}
+		}
+	}
+
+	for (; c<NumberOfChannels; c++)
+	{
+		if (Padded)
+		{
+			GatherPadded(PLONG(Channels[c]), Frames + c*3, Stride, NumberOfFrames);
+		}
+		else
+		{
+			Gather24(PUCHAR(Channels[c]), Frames + c*3, Stride, NumberOfFrames);
+		}
+	}
+}
+
+static
+VOID
+Interleave24_Ssse3
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	Interleave24Common_Ssse3(Frames, Channels, NumberOfChannels, NumberOfFrames, FALSE);
+}
+
+static
+VOID
+InterleavePadded_Ssse3
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	Interleave24Common_Ssse3(Frames, Channels, NumberOfChannels, NumberOfFrames, TRUE);
+}
+
+static
+VOID
+Deinterleave24_Ssse3
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	Deinterleave24Common_Ssse3(Frames, Channels, NumberOfChannels, NumberOfFrames, FALSE);
+}
+
+static
+VOID
+DeinterleavePadded_Ssse3
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	Deinterleave24Common_Ssse3(Frames, Channels, NumberOfChannels, NumberOfFrames, TRUE);
+}
+
+/*****************************************************************************
+ * FloatToFixed_Sse2()
+ *****************************************************************************
+ * @brief
+ * SSE2 version of FloatToFixed() for 4 samples, with the dither noise of
+ * 4 generators in State.
+ */
+static __forceinline
+__m128i
+FloatToFixed_Sse2
+(
+	IN		__m128		X,
+	IN		__m128		Scale,
+	IN		__m128		Limit,
+	IN		BOOL		Dither,
+	IN OUT	__m128i &	State
+)
+{
+	X = _mm_mul_ps(X, Scale);
+
+	if (Dither)
+	{
+		State = _mm_xor_si128(State, _mm_slli_epi32(State, 13));
+		State = _mm_xor_si128(State, _mm_srli_epi32(State, 17));
+		State = _mm_xor_si128(State, _mm_slli_epi32(State, 5));
+
+		__m128i Noise = _mm_sub_epi32(_mm_srli_epi32(State, 16), _mm_and_si128(State, _mm_set1_epi32(0xFFFF)));
+
+		X = _mm_add_ps(X, _mm_mul_ps(_mm_cvtepi32_ps(Noise), _mm_set1_ps(1.0f / 65536.0f)));
+	}
+
+	// maxps returns its second operand for a NaN.
+	X = _mm_min_ps(_mm_max_ps(X, _mm_sub_ps(_mm_setzero_ps(), Scale)), Limit);
+
+	return _mm_cvtps_epi32(X);
+}
+
+/*****************************************************************************
+ * InterleaveFloatCommon_Sse2()
+ *****************************************************************************
+ * @brief
+ * SSE2 version of InterleaveFloatCommon(); SSSE3 for 24-bit pins.
+ * @details
+ * 4 channels by 4 frames are converted, transposed, and narrowed to the
+ * pin sample.
+ */
+static __forceinline
+VOID
+InterleaveFloatCommon_Sse2
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames,
+	IN		ULONG	SampleSize,
+	IN		BOOL	Dither
+)
+{
+	const __m128i Pack = _mm_setr_epi8(0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1);
+
+	const __m128 Scale = _mm_set1_ps((SampleSize == 2) ? FLOAT_SCALE_16 : (SampleSize == 3) ? FLOAT_SCALE_24 : FLOAT_SCALE_32);
+	const __m128 Limit = _mm_set1_ps((SampleSize == 2) ? FLOAT_LIMIT_16 : (SampleSize == 3) ? FLOAT_LIMIT_24 : FLOAT_LIMIT_32);
+
+	__m128i State0 = _mm_loadu_si128((__m128i*)(DitherState+0));
+	__m128i State1 = _mm_loadu_si128((__m128i*)(DitherState+4));
+	__m128i State2 = _mm_loadu_si128((__m128i*)(DitherState+8));
+	__m128i State3 = _mm_loadu_si128((__m128i*)(DitherState+12));
+
+	ULONG ScalarState = DitherState[16];
+
+	ULONG Stride = NumberOfChannels*SampleSize;
+
+	ULONG c = 0;
+
+	for (; c+4<=NumberOfChannels; c+=4)
+	{
+		PFLOAT S0 = PFLOAT(Channels[c+0]), S1 = PFLOAT(Channels[c+1]), S2 = PFLOAT(Channels[c+2]), S3 = PFLOAT(Channels[c+3]);
+
+		PUCHAR Dst = Frames + c*SampleSize;
+
+		ULONG f = 0;
+
+		for (; f+4<=NumberOfFrames; f+=4)
+		{
+			__m128i X0 = FloatToFixed_Sse2(_mm_loadu_ps(S0+f), Scale, Limit, Dither, State0);
+			__m128i X1 = FloatToFixed_Sse2(_mm_loadu_ps(S1+f), Scale, Limit, Dither, State1);
+			__m128i X2 = FloatToFixed_Sse2(_mm_loadu_ps(S2+f), Scale, Limit, Dither, State2);
+			__m128i X3 = FloatToFixed_Sse2(_mm_loadu_ps(S3+f), Scale, Limit, Dither, State3);
+
+			Transpose4x4(X0, X1, X2, X3);
+
+			PUCHAR D = Dst + f*Stride;
+
+			if (SampleSize == 2)
+			{
+				// 2 frames of 4 channels per register.
+				__m128i P0 = _mm_packs_epi32(X0, X1), P1 = _mm_packs_epi32(X2, X3);
+
+				_mm_storel_epi64((__m128i*)(D+0*Stride), P0); _mm_storel_epi64((__m128i*)(D+1*Stride), _mm_srli_si128(P0, 8));
+				_mm_storel_epi64((__m128i*)(D+2*Stride), P1); _mm_storel_epi64((__m128i*)(D+3*Stride), _mm_srli_si128(P1, 8));
+			}
+			else if (SampleSize == 3)
+			{
+				Store12(D+0*Stride, _mm_shuffle_epi8(X0, Pack));
+				Store12(D+1*Stride, _mm_shuffle_epi8(X1, Pack));
+				Store12(D+2*Stride, _mm_shuffle_epi8(X2, Pack));
+				Store12(D+3*Stride, _mm_shuffle_epi8(X3, Pack));
+			}
+			else
+			{
+				_mm_storeu_si128((__m128i*)(D+0*Stride), X0);
+				_mm_storeu_si128((__m128i*)(D+1*Stride), X1);
+				_mm_storeu_si128((__m128i*)(D+2*Stride), X2);
+				_mm_storeu_si128((__m128i*)(D+3*Stride), X3);
+			}
+		}
+
+		for (ULONG k=0; k<4; k++)
+		{
+			ScatterFloat(Dst + f*Stride + k*SampleSize, Stride, PFLOAT(Channels[c+k])+f, NumberOfFrames-f, SampleSize, Dither, ScalarState);
+		}
+	}
+
+	for (; c<NumberOfChannels; c++)
+	{
+		ScatterFloat(Frames + c*SampleSize, Stride, PFLOAT(Channels[c]), NumberOfFrames, SampleSize, Dither, ScalarState);
+	}
+
+	_mm_storeu_si128((__m128i*)(DitherState+0), State0);
+	_mm_storeu_si128((__m128i*)(DitherState+4), State1);
+	_mm_storeu_si128((__m128i*)(DitherState+8), State2);
+	_mm_storeu_si128((__m128i*)(DitherState+12), State3);
+
+	DitherState[16] = ScalarState;
+}
+
+/*****************************************************************************
+ * DeinterleaveFloatCommon_Sse2()
+ *****************************************************************************
+ * @brief
+ * SSE2 version of DeinterleaveFloatCommon(); SSSE3 for 24-bit pins.
+ * @details
+ * 4 frames by 4 channels are widened to 32-bit lanes, transposed, and
+ * converted.
+ */
+static __forceinline
+VOID
+DeinterleaveFloatCommon_Sse2
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames,
+	IN		ULONG	SampleSize
+)
+{
+	const __m128i Widen = _mm_setr_epi8(-1,0,1,2, -1,3,4,5, -1,6,7,8, -1,9,10,11);
+
+	const __m128 Scale = _mm_set1_ps((SampleSize == 2) ? (1.0f / FLOAT_SCALE_16) : (1.0f / FLOAT_SCALE_32));
+
+	ULONG Stride = NumberOfChannels*SampleSize;
+
+	ULONG c = 0;
+
+	for (; c+4<=NumberOfChannels; c+=4)
+	{
+		PFLOAT S0 = PFLOAT(Channels[c+0]), S1 = PFLOAT(Channels[c+1]), S2 = PFLOAT(Channels[c+2]), S3 = PFLOAT(Channels[c+3]);
+
+		PUCHAR Src = Frames + c*SampleSize;
+
+		ULONG f = 0;
+
+		for (; f+4<=NumberOfFrames; f+=4)
+		{
+			PUCHAR S = Src + f*Stride;
+
+			__m128i X0, X1, X2, X3;
+
+			if (SampleSize == 2)
+			{
+				// Sign extend each sample into the upper half of its own lane.
+				__m128i R0 = _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i*)(S+0*Stride)), _mm_loadl_epi64((__m128i*)(S+1*Stride)));
+				__m128i R1 = _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i*)(S+2*Stride)), _mm_loadl_epi64((__m128i*)(S+3*Stride)));
+
+				X0 = _mm_srai_epi32(_mm_unpacklo_epi16(R0, R0), 16);
+				X1 = _mm_srai_epi32(_mm_unpackhi_epi16(R0, R0), 16);
+				X2 = _mm_srai_epi32(_mm_unpacklo_epi16(R1, R1), 16);
+				X3 = _mm_srai_epi32(_mm_unpackhi_epi16(R1, R1), 16);
+			}
+			else if (SampleSize == 3)
+			{
+				X0 = _mm_shuffle_epi8(Load12(S+0*Stride), Widen);
+				X1 = _mm_shuffle_epi8(Load12(S+1*Stride), Widen);
+				X2 = _mm_shuffle_epi8(Load12(S+2*Stride), Widen);
+				X3 = _mm_shuffle_epi8(Load12(S+3*Stride), Widen);
+			}
+			else
+			{
+				X0 = _mm_loadu_si128((__m128i*)(S+0*Stride));
+				X1 = _mm_loadu_si128((__m128i*)(S+1*Stride));
+				X2 = _mm_loadu_si128((__m128i*)(S+2*Stride));
+				X3 = _mm_loadu_si128((__m128i*)(S+3*Stride));
+			}
+
+			Transpose4x4(X0, X1, X2, X3);
+
+			_mm_storeu_ps(S0+f, _mm_mul_ps(_mm_cvtepi32_ps(X0), Scale));
+			_mm_storeu_ps(S1+f, _mm_mul_ps(_mm_cvtepi32_ps(X1), Scale));
+			_mm_storeu_ps(S2+f, _mm_mul_ps(_mm_cvtepi32_ps(X2), Scale));
+			_mm_storeu_ps(S3+f, _mm_mul_ps(_mm_cvtepi32_ps(X3), Scale));
+		}
+
+		for (ULONG k=0; k<4; k++)
+		{
+			GatherFloat(PFLOAT(Channels[c+k])+f, Src + f*Stride + k*SampleSize, Stride, NumberOfFrames-f, SampleSize);
+		}
+	}
+
+	for (; c<NumberOfChannels; c++)
+	{
+		GatherFloat(PFLOAT(Channels[c]), Frames + c*SampleSize, Stride, NumberOfFrames, SampleSize);
+	}
+}
+
+static
+VOID
+InterleaveFloat16_Sse2
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	InterleaveFloatCommon_Sse2(Frames, Channels, NumberOfChannels, NumberOfFrames, 2, FALSE);
+}
+
+static
+VOID
+InterleaveFloat16Dither_Sse2
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	InterleaveFloatCommon_Sse2(Frames, Channels, NumberOfChannels, NumberOfFrames, 2, TRUE);
+}
+
+static
+VOID
+DeinterleaveFloat16_Sse2
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	DeinterleaveFloatCommon_Sse2(Frames, Channels, NumberOfChannels, NumberOfFrames, 2);
+}
+
+static
+VOID
+InterleaveFloat24_Ssse3
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	InterleaveFloatCommon_Sse2(Frames, Channels, NumberOfChannels, NumberOfFrames, 3, FALSE);
+}
+
+static
+VOID
+InterleaveFloat24Dither_Ssse3
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	InterleaveFloatCommon_Sse2(Frames, Channels, NumberOfChannels, NumberOfFrames, 3, TRUE);
+}
+
+static
+VOID
+DeinterleaveFloat24_Ssse3
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	DeinterleaveFloatCommon_Sse2(Frames, Channels, NumberOfChannels, NumberOfFrames, 3);
+}
+
+static
+VOID
+InterleaveFloat32_Sse2
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	InterleaveFloatCommon_Sse2(Frames, Channels, NumberOfChannels, NumberOfFrames, 4, FALSE);
+}
+
+static
+VOID
+DeinterleaveFloat32_Sse2
+(
+	IN		PUCHAR	Frames,
+	IN		PVOID *	Channels,
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+)
+{
+	DeinterleaveFloatCommon_Sse2(Frames, Channels, NumberOfChannels, NumberOfFrames, 4);
+}
+
+/*****************************************************************************
+ * FindAsioCopyRoutine()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Find the fastest copy routine this CPU supports.
+ * @param
+ * Direction ASIO_COPY_INTERLEAVE or ASIO_COPY_DEINTERLEAVE.
+ * @param
+ * SampleSize Bits per sample on the pin: 16, 24 or 32.
+ * @param
+ * Padded TRUE if the ASIO buffers hold the 24-bit samples in 32 bits.
+ * @return
+ * Returns the routine, or NULL if the format is not supported.
+ */
+ASIO_COPY_ROUTINE
+FindAsioCopyRoutine
+(
+	IN		ULONG	Direction,
+	IN		ULONG	SampleSize,
+	IN		BOOL	Padded
+)
+{
+	ULONG Features = GetCopyFeatures();
+
+	BOOL Interleave = (Direction == ASIO_COPY_INTERLEAVE);
+
+	ASIO_COPY_ROUTINE CopyRoutine = NULL;
+
+	switch (SampleSize)
+	{
+		case 16:
+			if (Features & COPY_FEATURE_SSE2)
+			{
+				CopyRoutine = Interleave ? Interleave16_Sse2 : Deinterleave16_Sse2;
+			}
+			else
+			{
+				CopyRoutine = Interleave ? Interleave16 : Deinterleave16;
+			}
+			break;
+
+		case 24:
+			if (Features & COPY_FEATURE_SSSE3)
+			{
+				if (Padded)
+				{
+					CopyRoutine = Interleave ? InterleavePadded_Ssse3 : DeinterleavePadded_Ssse3;
+				}
+				else
+				{
+					CopyRoutine = Interleave ? Interleave24_Ssse3 : Deinterleave24_Ssse3;
+				}
+			}
+			else
+			{
+				if (Padded)
+				{
+					CopyRoutine = Interleave ? InterleavePadded : DeinterleavePadded;
+				}
+				else
+				{
+					CopyRoutine = Interleave ? Interleave24 : Deinterleave24;
+				}
+			}
+			break;
+
+		case 32:
+			if (Features & COPY_FEATURE_SSE2)
+			{
+				CopyRoutine = Interleave ? Interleave32_Sse2 : Deinterleave32_Sse2;
+			}
+			else
+			{
+				CopyRoutine = Interleave ? Interleave32 : Deinterleave32;
+			}
+			break;
+	}
+
+	return CopyRoutine;
+}
+
+/*****************************************************************************
+ * FindAsioFloatCopyRoutine()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Find the fastest copy routine this CPU supports for float ASIO samples.
+ * @param
+ * Direction ASIO_COPY_INTERLEAVE or ASIO_COPY_DEINTERLEAVE.
+ * @param
+ * SampleSize Bits per sample on the pin: 16, 24 or 32.
+ * @param
+ * Dither TRUE to add triangular noise of +/-1 LSB before rounding 16 and 
+ * 24-bit pin samples (interleave only).
+ * @return
+ * Returns the routine, or NULL if the format is not supported.
+ */
+ASIO_COPY_ROUTINE
+FindAsioFloatCopyRoutine
+(
+	IN		ULONG	Direction,
+	IN		ULONG	SampleSize,
+	IN		BOOL	Dither
+)
+{
+	ULONG Features = GetCopyFeatures();
+
+	BOOL Interleave = (Direction == ASIO_COPY_INTERLEAVE);
+
+	ASIO_COPY_ROUTINE CopyRoutine = NULL;
+
+	switch (SampleSize)
+	{
+		case 16:
+			if (Features & COPY_FEATURE_SSE2)
+			{
+				CopyRoutine = Interleave ? (Dither ? InterleaveFloat16Dither_Sse2 : InterleaveFloat16_Sse2) : DeinterleaveFloat16_Sse2;
+			}
+			else
+			{
+				CopyRoutine = Interleave ? (Dither ? InterleaveFloat16Dither : InterleaveFloat16) : DeinterleaveFloat16;
+			}
+			break;
+
+		case 24:
+			if (Features & COPY_FEATURE_SSSE3)
+			{
+				CopyRoutine = Interleave ? (Dither ? InterleaveFloat24Dither_Ssse3 : InterleaveFloat24_Ssse3) : DeinterleaveFloat24_Ssse3;
+			}
+			else
+			{
+				CopyRoutine = Interleave ? (Dither ? InterleaveFloat24Dither : InterleaveFloat24) : DeinterleaveFloat24;
+			}
+			break;
+
+		case 32:
+			if (Features & COPY_FEATURE_SSE2)
+			{
+				CopyRoutine = Interleave ? InterleaveFloat32_Sse2 : DeinterleaveFloat32_Sse2;
+			}
+			else
+			{
+				CopyRoutine = Interleave ? InterleaveFloat32 : DeinterleaveFloat32;
+			}
+			break;
+	}
+
+	return CopyRoutine;
+}
@@ -0,0 +1,77 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       interleave.h
+ * @brief      Copy routines between the ASIO channel buffers and the
+ *             interleaved pin buffers.
+ * @details
+ * A routine moves all the channels of a pin in one pass. Channels[i] is the
+ * ASIO buffer of the i-th channel of the pin; every channel of the pin must
+ * have one, so unused channels point at a scratch buffer (zeroed for
+ * playback).
+ *
+ * The float routines take ASIOSTFloat32LSB channel buffers, full scale at
+ * +/-1.0, and convert them to and from the integer pin samples.
+ *//*
+ *****************************************************************************
+ */
+#ifndef _ASIO_INTERLEAVE_H_
+#define _ASIO_INTERLEAVE_H_
+
+#include <windows.h>
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Copy direction. */
+#define ASIO_COPY_INTERLEAVE	0	/*!< @brief ASIO channel buffers to pin buffer (playback). */
+#define ASIO_COPY_DEINTERLEAVE	1	/*!< @brief Pin buffer to ASIO channel buffers (recording). */
+
+/*! @brief Copy routine. */
+typedef VOID (*ASIO_COPY_ROUTINE)
+(
+	IN		PUCHAR	Frames,				// interleaved pin buffer
+	IN		PVOID *	Channels,			// one buffer per channel of the pin
+	IN		ULONG	NumberOfChannels,
+	IN		ULONG	NumberOfFrames
+);
+
+/*****************************************************************************
+ * Functions
+ */
+ASIO_COPY_ROUTINE
+FindAsioCopyRoutine
+(
+	IN		ULONG	Direction,
+	IN		ULONG	SampleSize,			// bits per sample on the pin
+	IN		BOOL	Padded				// 24-bit pin samples in 32-bit ASIO samples
+);
+
+ASIO_COPY_ROUTINE
+FindAsioFloatCopyRoutine
+(
+	IN		ULONG	Direction,
+	IN		ULONG	SampleSize,			// bits per sample on the pin
+	IN		BOOL	Dither				// TPDF dither on 16/24-bit output
+);
+
+#endif // _ASIO_INTERLEAVE_H_
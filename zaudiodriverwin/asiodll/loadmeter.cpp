@@ -0,0 +1,457 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       loadmeter.cpp
+ * @brief      DSP load meter of the ASIO engine.
+ *//*
+ *****************************************************************************
+ */
+#include "loadmeter.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Tries of a reader to get a consistent copy of the statistics. */
+#define ASIO_LOAD_READ_RETRIES		64
+
+/*****************************************************************************
+ * CAsioLoadMeter::CAsioLoadMeter()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Constructor.
+ */
+CAsioLoadMeter::
+CAsioLoadMeter
+(	void
+)
+{
+	Attach(NULL);
+}
+
+/*****************************************************************************
+ * CAsioLoadMeter::Attach()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Writer: use a section, and reset it. Nothing is recorded until the next
+ * Start().
+ * @param
+ * Section A sizeof(ASIO_LOAD_SECTION) section, or NULL for a private one.
+ * @return
+ * None.
+ */
+VOID
+CAsioLoadMeter::
+Attach
+(
+	IN		PVOID	Section
+)
+{
+	m_Section = Section ? PASIO_LOAD_SECTION(Section) : &m_LocalSection;
+
+	ZeroMemory(m_Section, sizeof(ASIO_LOAD_SECTION));
+
+	m_Section->Version = ASIO_LOAD_VERSION;
+
+	m_Section->Size = sizeof(ASIO_LOAD_SECTION);
+
+	m_Frequency = 0;
+
+	m_LastCounter = 0;
+
+	ZeroMemory(m_Ticks, sizeof(m_Ticks));
+}
+
+/*****************************************************************************
+ * CAsioLoadMeter::Start()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Writer: clear the statistics for a new run of the engine. The ring goes
+ * on, so readers keep their place; the switch indices start again.
+ * @param
+ * SampleRate Sample rate, in Hz.
+ * @param
+ * BufferSize Buffer size, in samples.
+ * @param
+ * Frequency Performance counter frequency; 0 if there is no performance
+ * counter, which leaves the meter off.
+ * @return
+ * None.
+ */
+VOID
+CAsioLoadMeter::
+Start
+(
+	IN		ULONG		SampleRate,
+	IN		ULONG		BufferSize,
+	IN		LONGLONG	Frequency
+)
+{
+	PASIO_LOAD_STATISTICS Statistics = &m_Section->Statistics;
+
+	Statistics->Sequence++;
+
+	MemoryBarrier();
+
+	Statistics->SampleRate = SampleRate;
+	Statistics->BufferSize = BufferSize;
+	Statistics->Period = SampleRate ? ULONG((ULONGLONG(BufferSize) * 1000000000) / SampleRate) : 0;
+	Statistics->NumberOfSwitches = 0;
+	Statistics->DeadlineMisses = 0;
+
+	for (ULONG i=0; i<ASIO_LOAD_STAGE_COUNT; i++)
+	{
+		ZeroMemory(&Statistics->Stages[i], sizeof(ASIO_LOAD_TIME));
+	}
+
+	ZeroMemory(&Statistics->Switch, sizeof(ASIO_LOAD_TIME));
+
+	MemoryBarrier();
+
+	Statistics->Sequence++;
+
+	m_Frequency = Frequency;
+
+	m_LastCounter = 0;
+
+	ZeroMemory(m_Ticks, sizeof(m_Ticks));
+}
+
+/*****************************************************************************
+ * CAsioLoadMeter::Begin()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Writer: start timing a stage.
+ * @param
+ * Counter Performance counter now.
+ * @return
+ * None.
+ */
+VOID
+CAsioLoadMeter::
+Begin
+(
+	IN		LONGLONG	Counter
+)
+{
+	m_LastCounter = Counter;
+}
+
+/*****************************************************************************
+ * CAsioLoadMeter::Mark()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Writer: end a stage, and start timing the next one.
+ * @param
+ * Stage Stage that ends, ASIO_LOAD_STAGE_XXX.
+ * @param
+ * Counter Performance counter now.
+ * @return
+ * None.
+ */
+VOID
+CAsioLoadMeter::
+Mark
+(
+	IN		ULONG		Stage,
+	IN		LONGLONG	Counter
+)
+{
+	if ((Stage < ASIO_LOAD_STAGE_COUNT) && (Counter > m_LastCounter))
+	{
+		m_Ticks[Stage] += Counter - m_LastCounter;
+	}
+
+	m_LastCounter = Counter;
+}
+
+/*****************************************************************************
+ * CAsioLoadMeter::Record()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Writer: close a switch. Its stage times go in the ring and the
+ * statistics, and the next switch starts from zero.
+ * @param
+ * SwitchIndex Index of the switch.
+ * @return
+ * None.
+ */
+VOID
+CAsioLoadMeter::
+Record
+(
+	IN		ULONG	SwitchIndex
+)
+{
+	if (m_Frequency)
+	{
+		PASIO_LOAD_STATISTICS Statistics = &m_Section->Statistics;
+
+		ULONG WriteIndex = m_Section->WriteIndex;
+
+		PASIO_LOAD_RECORD Record = &m_Section->Records[WriteIndex % ASIO_LOAD_RECORD_COUNT];
+
+		Record->SwitchIndex = SwitchIndex;
+
+		LONGLONG SwitchTicks = 0;
+
+		for (ULONG i=0; i<ASIO_LOAD_STAGE_COUNT; i++)
+		{
+			Record->Times[i] = _ToNanoseconds(m_Ticks[i]);
+
+			SwitchTicks += m_Ticks[i];
+		}
+
+		ULONG SwitchTime = _ToNanoseconds(SwitchTicks);
+
+		// The record is complete before the readers see it.
+		MemoryBarrier();
+
+		m_Section->WriteIndex = WriteIndex + 1;
+
+		Statistics->Sequence++;
+
+		MemoryBarrier();
+
+		for (ULONG i=0; i<ASIO_LOAD_STAGE_COUNT; i++)
+		{
+			_UpdateTime(&Statistics->Stages[i], Record->Times[i]);
+		}
+
+		_UpdateTime(&Statistics->Switch, SwitchTime);
+
+		if (SwitchTime > Statistics->Period)
+		{
+			Statistics->DeadlineMisses++;
+		}
+
+		Statistics->NumberOfSwitches++;
+
+		MemoryBarrier();
+
+		Statistics->Sequence++;
+	}
+
+	ZeroMemory(m_Ticks, sizeof(m_Ticks));
+}
+
+/*****************************************************************************
+ * CAsioLoadMeter::Open()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Reader: use a section that a writer attached to.
+ * @param
+ * Section A sizeof(ASIO_LOAD_SECTION) section.
+ * @return
+ * FALSE if the section has a different layout.
+ */
+BOOL
+CAsioLoadMeter::
+Open
+(
+	IN		PVOID	Section
+)
+{
+	PASIO_LOAD_SECTION LoadSection = PASIO_LOAD_SECTION(Section);
+
+	if (!LoadSection || (LoadSection->Version != ASIO_LOAD_VERSION) || (LoadSection->Size != sizeof(ASIO_LOAD_SECTION)))
+	{
+		return FALSE;
+	}
+
+	m_Section = LoadSection;
+
+	return TRUE;
+}
+
+/*****************************************************************************
+ * CAsioLoadMeter::GetStatistics()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Reader: copy the statistics.
+ * @param
+ * OutStatistics Copy of the statistics.
+ * @return
+ * FALSE if the writer kept changing them; *OutStatistics is then not
+ * consistent.
+ */
+BOOL
+CAsioLoadMeter::
+GetStatistics
+(
+	OUT		PASIO_LOAD_STATISTICS	OutStatistics
+)
+{
+	PASIO_LOAD_STATISTICS Statistics = &m_Section->Statistics;
+
+	for (ULONG i=0; i<ASIO_LOAD_READ_RETRIES; i++)
+	{
+		ULONG Sequence = Statistics->Sequence;
+
+		MemoryBarrier();
+
+		CopyMemory(OutStatistics, (PVOID)Statistics, sizeof(ASIO_LOAD_STATISTICS));
+
+		MemoryBarrier();
+
+		if (!(Sequence & 1) && (Statistics->Sequence == Sequence))
+		{
+			return TRUE;
+		}
+
+		Sleep(0);
+	}
+
+	return FALSE;
+}
+
+/*****************************************************************************
+ * CAsioLoadMeter::GetRecords()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Reader: copy the records from *InOutIndex on.
+ * @details
+ * Records the writer went past are skipped: the first record copied is not
+ * necessarily the one at *InOutIndex.
+ * @param
+ * InOutIndex Index of the first record wanted; the index after the last one
+ * copied on return.
+ * @param
+ * OutRecords Copies of the records.
+ * @param
+ * MaximumCount Room in OutRecords.
+ * @return
+ * Number of records copied.
+ */
+ULONG
+CAsioLoadMeter::
+GetRecords
+(
+	IN OUT	ULONG *				InOutIndex,
+	OUT		PASIO_LOAD_RECORD	OutRecords,
+	IN		ULONG				MaximumCount
+)
+{
+	ULONG WriteIndex = m_Section->WriteIndex;
+
+	// The records are read after the index that covers them.
+	MemoryBarrier();
+
+	ULONG Index = *InOutIndex;
+
+	if ((WriteIndex - Index) > ASIO_LOAD_RECORD_COUNT)
+	{
+		// Gone, or from a run before a restart.
+		Index = WriteIndex - ASIO_LOAD_RECORD_COUNT;
+	}
+
+	ULONG Count = WriteIndex - Index;
+
+	if (Count > MaximumCount)
+	{
+		Count = MaximumCount;
+	}
+
+	for (ULONG i=0; i<Count; i++)
+	{
+		CopyMemory(&OutRecords[i], (PVOID)&m_Section->Records[(Index + i) % ASIO_LOAD_RECORD_COUNT], sizeof(ASIO_LOAD_RECORD));
+	}
+
+	MemoryBarrier();
+
+	// The writer may be on the record at the new write index, which takes
+	// the slot of the one a ring earlier.
+	ULONG FirstValid = m_Section->WriteIndex + 1 - ASIO_LOAD_RECORD_COUNT;
+
+	ULONG Skip = 0;
+
+	if (LONG(FirstValid - Index) > 0)
+	{
+		Skip = FirstValid - Index;
+
+		if (Skip > Count)
+		{
+			Skip = Count;
+		}
+
+		MoveMemory(OutRecords, &OutRecords[Skip], (Count - Skip) * sizeof(ASIO_LOAD_RECORD));
+	}
+
+	*InOutIndex = Index + Count;
+
+	return Count - Skip;
+}
+
+/*****************************************************************************
+ * CAsioLoadMeter::_ToNanoseconds()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Convert performance counter ticks to ns, saturating.
+ */
+ULONG
+CAsioLoadMeter::
+_ToNanoseconds
+(
+	IN		LONGLONG	Ticks
+)
+{
+	ULONGLONG Nanoseconds = (Ticks / m_Frequency) * 1000000000 + ((Ticks % m_Frequency) * 1000000000) / m_Frequency;
+
+	return (Nanoseconds > 0xFFFFFFFF) ? 0xFFFFFFFF : ULONG(Nanoseconds);
+}
+
+/*****************************************************************************
+ * CAsioLoadMeter::_UpdateTime()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Add the time of the switch being recorded to a statistic.
+ */
+VOID
+CAsioLoadMeter::
+_UpdateTime
+(
+	IN		PASIO_LOAD_TIME	Time,
+	IN		ULONG			Value
+)
+{
+	if (!m_Section->Statistics.NumberOfSwitches || (Value < Time->Minimum))
+	{
+		Time->Minimum = Value;
+	}
+
+	if (Value > Time->Maximum)
+	{
+		Time->Maximum = Value;
+	}
+
+	Time->Total += Value;
+}
@@ -0,0 +1,221 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       loadmeter.h
+ * @brief      DSP load meter of the ASIO engine.
+ * @details
+ * The main thread times each buffer switch in stages, and CAsioLoadMeter
+ * keeps the times in an ASIO_LOAD_SECTION: statistics since the start, and
+ * a ring of the last ASIO_LOAD_RECORD_COUNT switches. The driver maps the
+ * section by name (ASIO_LOAD_SECTION_NAME), so a monitor can open it with
+ * OpenFileMapping() and read it with a CAsioLoadMeter of its own.
+ *
+ * The main thread is the only writer. The readers never block it: they
+ * retry the statistics while the sequence number is odd or moves, and drop
+ * the records the writer went past while they were copied. The meter does
+ * no timing itself, so it can be exercised off the device (tools/loadbench).
+ *//*
+ *****************************************************************************
+ */
+#ifndef _ASIO_LOAD_METER_H_
+#define _ASIO_LOAD_METER_H_
+
+#include <windows.h>
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Name of the section, formatted with the VID and PID of the device. */
+#define ASIO_LOAD_SECTION_NAME		"EmuAsioLoad_VID_%04X&PID_%04X"
+
+/*! @brief Layout version of the section. */
+#define ASIO_LOAD_VERSION			1
+
+/*! @brief Switches kept in the ring, a power of 2. */
+#define ASIO_LOAD_RECORD_COUNT		256
+
+/*! @brief Stages of a buffer switch. */
+typedef enum
+{
+	ASIO_LOAD_STAGE_INPUT = 0,		/*!< @brief Copy of the input to the channel buffers. */
+	ASIO_LOAD_STAGE_HOST,			/*!< @brief bufferSwitch() callback of the host. */
+	ASIO_LOAD_STAGE_OUTPUT,			/*!< @brief Copy of the channel buffers to the output. */
+	ASIO_LOAD_STAGE_QUEUE,			/*!< @brief Submission of the packets to the pins. */
+	ASIO_LOAD_STAGE_COUNT
+} ASIO_LOAD_STAGE;
+
+/*****************************************************************************
+ * Structures
+ */
+/*****************************************************************************
+ *//*! @struct ASIO_LOAD_TIME
+ *****************************************************************************
+ * @brief
+ * Statistics of a time, in ns.
+ */
+typedef struct
+{
+	ULONG		Minimum;
+	ULONG		Maximum;
+	ULONGLONG	Total;			/*!< @brief Sum over all the switches. */
+} ASIO_LOAD_TIME, *PASIO_LOAD_TIME;
+
+/*****************************************************************************
+ *//*! @struct ASIO_LOAD_STATISTICS
+ *****************************************************************************
+ * @brief
+ * Statistics since the engine started.
+ */
+typedef struct
+{
+	volatile ULONG	Sequence;			/*!< @brief Odd while the writer updates the statistics. */
+	ULONG			SampleRate;
+	ULONG			BufferSize;			/*!< @brief In samples. */
+	ULONG			Period;				/*!< @brief Duration of a buffer, in ns. */
+	ULONG			NumberOfSwitches;
+	ULONG			DeadlineMisses;		/*!< @brief Switches that took longer than a period. */
+	ASIO_LOAD_TIME	Stages[ASIO_LOAD_STAGE_COUNT];
+	ASIO_LOAD_TIME	Switch;				/*!< @brief All the stages of a switch. */
+} ASIO_LOAD_STATISTICS, *PASIO_LOAD_STATISTICS;
+
+/*****************************************************************************
+ *//*! @struct ASIO_LOAD_RECORD
+ *****************************************************************************
+ * @brief
+ * Times of a switch, in ns.
+ */
+typedef struct
+{
+	ULONG		SwitchIndex;
+	ULONG		Times[ASIO_LOAD_STAGE_COUNT];
+} ASIO_LOAD_RECORD, *PASIO_LOAD_RECORD;
+
+/*****************************************************************************
+ *//*! @struct ASIO_LOAD_SECTION
+ *****************************************************************************
+ * @brief
+ * Layout of the section.
+ */
+typedef struct
+{
+	ULONG					Version;		/*!< @brief ASIO_LOAD_VERSION. */
+	ULONG					Size;			/*!< @brief sizeof(ASIO_LOAD_SECTION). */
+	ASIO_LOAD_STATISTICS	Statistics;
+	volatile ULONG			WriteIndex;		/*!< @brief Index of the next record, in the sequence of switches. */
+	ULONG					Reserved;
+	ASIO_LOAD_RECORD		Records[ASIO_LOAD_RECORD_COUNT];
+} ASIO_LOAD_SECTION, *PASIO_LOAD_SECTION;
+
+/*****************************************************************************
+ * Classes
+ */
+/*****************************************************************************
+ *//*! @class CAsioLoadMeter
+ *****************************************************************************
+ * @brief
+ * DSP load meter.
+ * @details
+ * The writer attaches the meter to the section, which resets it; a reader
+ * opens it, which checks its layout.
+ *
+ * The writer marks the end of each stage with a performance counter value,
+ * Begin() first; the time since the previous mark goes to the stage. A
+ * stage can be marked more than once in a switch. Record() then closes the
+ * switch.
+ *
+ * A switch misses its deadline when its stages take longer than a period:
+ * the engine cannot keep up with the device, however many buffers are
+ * queued ahead. The time the device waits on the engine is not measured;
+ * an ASIOOutputReady() within the callback counts as host time.
+ */
+class CAsioLoadMeter
+{
+private:
+	PASIO_LOAD_SECTION	m_Section;			/*!< @brief Attached section, or m_LocalSection. */
+	ASIO_LOAD_SECTION	m_LocalSection;		/*!< @brief Section of a meter without a shared one. */
+	LONGLONG			m_Frequency;		/*!< @brief Performance counter frequency, 0 to not record. */
+	LONGLONG			m_LastCounter;		/*!< @brief Counter at the last mark. */
+	LONGLONG			m_Ticks[ASIO_LOAD_STAGE_COUNT];	/*!< @brief Counts of the switch so far. */
+
+	ULONG _ToNanoseconds
+	(
+		IN		LONGLONG	Ticks
+	);
+	VOID _UpdateTime
+	(
+		IN		PASIO_LOAD_TIME	Time,
+		IN		ULONG			Value
+	);
+
+public:
+    /*************************************************************************
+     * Constructor.
+     */
+	CAsioLoadMeter();
+
+    /*************************************************************************
+     * CAsioLoadMeter writer methods
+     */
+	VOID Attach
+	(
+		IN		PVOID	Section
+	);
+	VOID Start
+	(
+		IN		ULONG		SampleRate,
+		IN		ULONG		BufferSize,
+		IN		LONGLONG	Frequency
+	);
+	VOID Begin
+	(
+		IN		LONGLONG	Counter
+	);
+	VOID Mark
+	(
+		IN		ULONG		Stage,
+		IN		LONGLONG	Counter
+	);
+	VOID Record
+	(
+		IN		ULONG	SwitchIndex
+	);
+
+    /*************************************************************************
+     * CAsioLoadMeter reader methods
+     */
+	BOOL Open
+	(
+		IN		PVOID	Section
+	);
+	BOOL GetStatistics
+	(
+		OUT		PASIO_LOAD_STATISTICS	OutStatistics
+	);
+	ULONG GetRecords
+	(
+		IN OUT	ULONG *				InOutIndex,
+		OUT		PASIO_LOAD_RECORD	OutRecords,
+		IN		ULONG				MaximumCount
+	);
+};
+
+#endif // _ASIO_LOAD_METER_H_
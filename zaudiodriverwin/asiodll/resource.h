@@ -29,6 +29,9 @@
 #define IDS_BUFFERSIZE                  5
 #define IDS_BITDEPTH                    6
 #define IDS_PERAPPLICATIONPREFERENCES   7
+#define IDS_DSPLOAD                     8
+#define IDS_DSPLOADIDLE                 9
+#define IDS_DSPLOADDETAIL               10
 #define IDB_ASIO                        101
 #define IDB_ASIO_CREATIVE               101
 #define IDD_DIALOGASIOWARNING           109
@@ -61,6 +64,8 @@
 #define IDC_BITDEPTH                    1024
 #define IDC_CHECK1                      1025
 #define IDC_PERAPPLICATIONPREFERENCES   1025
+#define IDC_DSPLOAD                     1026
+#define IDC_DSPLOADDETAIL               1027
 
 // Next default values for new objects
 // 
@@ -68,7 +73,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        122
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1026
+#define _APS_NEXT_CONTROL_VALUE         1028
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
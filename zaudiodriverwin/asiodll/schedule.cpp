@@ -0,0 +1,227 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       schedule.cpp
+ * @brief      Output packet schedule of the ASIO engine.
+ *//*
+ *****************************************************************************
+ */
+#include "schedule.h"
+
+/*****************************************************************************
+ * CAsioSchedule::CAsioSchedule()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Constructor.
+ */
+CAsioSchedule::
+CAsioSchedule
+(	void
+)
+{
+	Initialize(8, 2, FALSE);
+}
+
+/*****************************************************************************
+ * CAsioSchedule::Initialize()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Set up the schedule, with nothing pending.
+ * @param
+ * NumberOfPackets Packets each pin cycles through.
+ * @param
+ * NumberOfOutputBuffers Output buffers queued ahead without early output
+ * (at least 2).
+ * @param
+ * EarlyOutput TRUE if ASIOOutputReady() queues the output.
+ * @return
+ * None.
+ */
+VOID
+CAsioSchedule::
+Initialize
+(
+	IN		ULONG	NumberOfPackets,
+	IN		ULONG	NumberOfOutputBuffers,
+	IN		BOOL	EarlyOutput
+)
+{
+	m_NumberOfPackets = NumberOfPackets;
+
+	m_EarlyOutput = EarlyOutput;
+
+	m_Lead = EarlyOutput ? NumberOfOutputBuffers - 1 : NumberOfOutputBuffers;
+
+	if (m_Lead < 1)
+	{
+		m_Lead = 1;
+	}
+
+	if (m_Lead > m_NumberOfPackets)
+	{
+		m_Lead = m_NumberOfPackets;
+	}
+
+	m_Pending = 0;
+}
+
+/*****************************************************************************
+ * CAsioSchedule::GetLead()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Number of packets to queue at start, and from the completed packet to the
+ * one the host fills.
+ */
+ULONG
+CAsioSchedule::
+GetLead
+(	void
+)
+{
+	return m_Lead;
+}
+
+/*****************************************************************************
+ * CAsioSchedule::IsEarlyOutput()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * TRUE if ASIOOutputReady() queues the output.
+ */
+BOOL
+CAsioSchedule::
+IsEarlyOutput
+(	void
+)
+{
+	return m_EarlyOutput;
+}
+
+/*****************************************************************************
+ * CAsioSchedule::GetOutputLatency()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Samples from a buffer switch to the start of its output on the pin, that
+ * is without the device latency.
+ */
+ULONG
+CAsioSchedule::
+GetOutputLatency
+(
+	IN		ULONG	BufferSize
+)
+{
+	return BufferSize * (m_Lead - 1);
+}
+
+/*****************************************************************************
+ * CAsioSchedule::GetPacketIndex()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Packet that takes the data of a switch (the input to read into it, and
+ * the output of the host).
+ * @param
+ * SwitchIndex Sample position of the switch, in buffers.
+ */
+ULONG
+CAsioSchedule::
+GetPacketIndex
+(
+	IN		ULONGLONG	SwitchIndex
+)
+{
+	return ULONG((SwitchIndex + m_Lead) % m_NumberOfPackets);
+}
+
+/*****************************************************************************
+ * CAsioSchedule::Switch()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Note, before the host is called, that the output of the switch is to go
+ * from buffer BufferIndex into packet PacketIndex. The output of an earlier
+ * switch that was not taken is dropped, so the caller takes it first.
+ */
+VOID
+CAsioSchedule::
+Switch
+(
+	IN		ULONG	PacketIndex,
+	IN		ULONG	BufferIndex
+)
+{
+	InterlockedExchange(&m_Pending, ASIO_SCHEDULE_PENDING | ((BufferIndex & 1) << 8) | (PacketIndex & 0xFF));
+}
+
+/*****************************************************************************
+ * CAsioSchedule::IsOutputPending()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * TRUE if the output of the last switch was not taken yet.
+ */
+BOOL
+CAsioSchedule::
+IsOutputPending
+(	void
+)
+{
+	return (m_Pending != 0);
+}
+
+/*****************************************************************************
+ * CAsioSchedule::TakeOutput()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Take the output of the last switch. Only one caller gets it, so it is
+ * sent once whether ASIOOutputReady() or the main thread gets there first.
+ * @return
+ * TRUE with the packet and buffer indices, FALSE if there is nothing to
+ * take.
+ */
+BOOL
+CAsioSchedule::
+TakeOutput
+(
+	OUT		ULONG *	OutPacketIndex,
+	OUT		ULONG *	OutBufferIndex
+)
+{
+	LONG Pending = InterlockedExchange(&m_Pending, 0);
+
+	if (!Pending)
+	{
+		return FALSE;
+	}
+
+	*OutPacketIndex = ULONG(Pending & 0xFF);
+
+	*OutBufferIndex = ULONG(Pending >> 8) & 1;
+
+	return TRUE;
+}
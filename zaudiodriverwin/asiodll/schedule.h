@@ -0,0 +1,123 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       schedule.h
+ * @brief      Output packet schedule of the ASIO engine.
+ * @details
+ * CAsioSchedule decides which packet the host's output of a buffer switch
+ * goes into, how many packets are queued ahead of it, and who submits it:
+ * the main thread once the switch returns, or ASIOOutputReady() as soon as
+ * the host is done. It does no I/O, so the schedule can be modelled off the
+ * device (tools/outputmodel).
+ *//*
+ *****************************************************************************
+ */
+#ifndef _ASIO_SCHEDULE_H_
+#define _ASIO_SCHEDULE_H_
+
+#include <windows.h>
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Set in a pending output, next to its buffer and packet indices. */
+#define ASIO_SCHEDULE_PENDING	0x00010000
+
+/*****************************************************************************
+ * Classes
+ */
+/*****************************************************************************
+ *//*! @class CAsioSchedule
+ *****************************************************************************
+ * @brief
+ * Output packet schedule.
+ * @details
+ * The switch of buffer k comes when packet k completes. The host's output
+ * of that switch goes into packet k + Lead, behind the Lead - 1 packets
+ * still queued, so it plays (Lead - 1) buffers after the switch, plus the
+ * device latency.
+ *
+ * Without early output, the packet is queued when the switch returns, and
+ * ASIOOutputReady() only fills it (possibly after it was queued). Lead is
+ * the N buffers of emasio.dat.
+ *
+ * With early output, the packet is filled and queued by ASIOOutputReady()
+ * itself, so the device never takes a packet the host is still writing,
+ * and one buffer less is queued ahead: Lead is N - 1. With N = 2 no packet
+ * is queued while the host works, so it has to be done within what the
+ * pin's FIFO holds beyond the device latency. If the host misses an
+ * ASIOOutputReady(), the caller sends what is in the buffer at the next
+ * switch, or after a buffer of waiting, whichever comes first.
+ */
+class CAsioSchedule
+{
+private:
+	ULONG			m_NumberOfPackets;	/*!< @brief Packets each pin cycles through. */
+	ULONG			m_Lead;				/*!< @brief Packets from the completed one to the one the host fills. */
+	BOOL			m_EarlyOutput;		/*!< @brief TRUE if ASIOOutputReady() queues the output. */
+	volatile LONG	m_Pending;			/*!< @brief Output not yet handed over, or 0. */
+
+public:
+    /*************************************************************************
+     * Constructor.
+     */
+	CAsioSchedule();
+
+    /*************************************************************************
+     * CAsioSchedule methods
+     */
+	VOID Initialize
+	(
+		IN		ULONG	NumberOfPackets,
+		IN		ULONG	NumberOfOutputBuffers,
+		IN		BOOL	EarlyOutput
+	);
+	ULONG GetLead
+	(	void
+	);
+	BOOL IsEarlyOutput
+	(	void
+	);
+	ULONG GetOutputLatency
+	(
+		IN		ULONG	BufferSize
+	);
+	ULONG GetPacketIndex
+	(
+		IN		ULONGLONG	SwitchIndex
+	);
+	VOID Switch
+	(
+		IN		ULONG	PacketIndex,
+		IN		ULONG	BufferIndex
+	);
+	BOOL IsOutputPending
+	(	void
+	);
+	BOOL TakeOutput
+	(
+		OUT		ULONG *	OutPacketIndex,
+		OUT		ULONG *	OutBufferIndex
+	);
+};
+
+#endif // _ASIO_SCHEDULE_H_
@@ -142,11 +142,15 @@ SOURCE=..\..\driver\usbaud10\core\AudioFifo.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\driver\usbaud10\core\AudioRing.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\driver\usbaud10\core\Convert.h
 # End Source File
 # Begin Source File
 
-SOURCE=..\..\driver\usbaud10\core\DataProcessingConstants.h
+SOURCE=..\..\driver\usbaud10\core\DbgTrace.cpp
 # End Source File
 # Begin Source File
 
@@ -166,6 +170,30 @@ SOURCE=..\..\driver\usbaud10\core\Entity.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\driver\usbaud10\core\Feedback.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\driver\usbaud10\core\FifoSlab.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\driver\usbaud10\core\FifoSlab.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\driver\usbaud10\core\Gain.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\driver\usbaud10\core\Histogram.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\driver\usbaud10\core\ImplicitFeedback.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\driver\usbaud10\core\Jack.cpp
 # End Source File
 # Begin Source File
@@ -109,6 +109,8 @@ public:
     _item * Pop()                        { if (m_Tail) {_item * Item = m_Tail; Remove(Item); return Item;}
                                            return NULL; }
 
+    void RemoveAllItems()                { while (m_Tail) {Remove(m_Tail);} }
+
     _item * First()                      { return m_Tail; }
     _item * Last()                       { return m_Head; }
 
@@ -0,0 +1,240 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       dbgtrace.h
+ * @brief      Binary event trace.
+ * @details
+ * Each CPU has its own ring of fixed-size records (event id, timestamp and
+ * four integer arguments). Recording an event takes one interlocked
+ * increment on the ring of the current CPU and a few stores, so it can be
+ * left in the isochronous completion path. Nothing is formatted in the
+ * driver: the rings are drained through KSPROPERTY_DEVICECONTROL_TRACE and
+ * decoded off-line by tools/tracedec.
+ *
+ * Define DBG_TRACE_FORMAT_ONLY before including this file to only get the
+ * dump format (the decoder does that).
+ *//*
+ *****************************************************************************
+ */
+#ifndef _DBG_TRACE_H_
+#define _DBG_TRACE_H_
+
+/*****************************************************************************
+ * Events
+ *****************************************************************************
+ * X(Id, Name, Arguments) - Arguments is the printf format of the four
+ * arguments, used by the decoder.
+ */
+#define DBG_TRACE_EVENTS(X) \
+	X(DBG_TRACE_DATA_COMPLETE,		"data-complete",	"ep=%02x frame=%u status=%08x bytes=%u") \
+	X(DBG_TRACE_DATA_SUBMIT,		"data-submit",		"ep=%02x pending=%u bytes=%u fifo=%u") \
+	X(DBG_TRACE_SYNCH_COMPLETE,		"synch-complete",	"ep=%02x frame=%u status=%08x bytes=%u") \
+	X(DBG_TRACE_SYNCH_SUBMIT,		"synch-submit",		"ep=%02x pending=%u") \
+	X(DBG_TRACE_FEEDBACK,			"feedback",			"ep=%02x raw=%08x filtered=%08x accepted=%u") \
+	X(DBG_TRACE_TRANSFER_DEPTH,		"transfer-depth",	"ep=%02x depth=%u late=%u") \
+	X(DBG_TRACE_RESYNC,				"resync",			"ep=%02x start=%u frame=%u") \
+	X(DBG_TRACE_PIN_STATE,			"pin-state",		"capture=%u state=%u") \
+	X(DBG_TRACE_PIN_PROCESS,		"pin-process",		"capture=%u bytes=%u remaining=%u")
+
+#define DBG_TRACE_ENUM(Id, Name, Arguments)	Id,
+
+/*! @brief Event identifiers. */
+enum
+{
+	DBG_TRACE_NONE = 0,
+	DBG_TRACE_EVENTS(DBG_TRACE_ENUM)
+	DBG_TRACE_MAX_EVENT
+};
+
+#undef DBG_TRACE_ENUM
+
+/*****************************************************************************
+ * Dump format
+ *****************************************************************************
+ * KSPROPERTY_DEVICECONTROL_TRACE returns a DBG_TRACE_HEADER followed by
+ * NumberOfRecords DBG_TRACE_RECORDs. A dump file is any number of these
+ * back to back. The records of one CPU are in order, but the records of
+ * different CPUs are not: sort them by Timestamp.
+ */
+/*! @brief Header signature, "DTRC". */
+#define DBG_TRACE_SIGNATURE		0x43525444
+#define DBG_TRACE_VERSION		1
+
+typedef struct
+{
+	ULONG		Signature;			/*!< @brief DBG_TRACE_SIGNATURE. */
+	ULONG		Version;			/*!< @brief DBG_TRACE_VERSION. */
+	ULONG		HeaderSize;			/*!< @brief sizeof(DBG_TRACE_HEADER). */
+	ULONG		RecordSize;			/*!< @brief sizeof(DBG_TRACE_RECORD). */
+	ULONG		NumberOfRecords;	/*!< @brief Number of records following the header. */
+	ULONG		LostRecords;		/*!< @brief Number of records overwritten before they were drained. */
+	ULONGLONG	TimestampStart;		/*!< @brief Timestamp when the trace was started. */
+	ULONGLONG	CounterStart;		/*!< @brief Performance counter when the trace was started. */
+	ULONGLONG	TimestampNow;		/*!< @brief Timestamp when the records were drained. */
+	ULONGLONG	CounterNow;			/*!< @brief Performance counter when the records were drained. */
+	ULONGLONG	CounterFrequency;	/*!< @brief Performance counter frequency. */
+} DBG_TRACE_HEADER, *PDBG_TRACE_HEADER;
+
+typedef struct
+{
+	ULONGLONG	Timestamp;			/*!< @brief Time stamp counter, see DBG_TRACE_HEADER for the rate. */
+	ULONG		Sequence;			/*!< @brief Position in the ring of the CPU + 1, or 0 while it is written. */
+	USHORT		Event;				/*!< @brief DBG_TRACE_XXX event. */
+	UCHAR		Cpu;				/*!< @brief Processor that recorded the event. */
+	UCHAR		Reserved;
+	ULONG		Argument[4];		/*!< @brief Event arguments. */
+} DBG_TRACE_RECORD, *PDBG_TRACE_RECORD;
+
+#ifndef DBG_TRACE_FORMAT_ONLY
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Largest ring, in records per CPU. */
+#define DBG_TRACE_MAX_RECORDS_PER_CPU	65536
+
+#if defined(_M_AMD64) || (defined(_M_IX86) && (_MSC_VER >= 1400))
+extern "C" unsigned __int64 __rdtsc(void);
+#pragma intrinsic(__rdtsc)
+/*! @brief Use the time stamp counter where the compiler has it; it is much cheaper than the performance counter. */
+#define DbgTraceTimestamp()		ULONGLONG(__rdtsc())
+#else
+#define DbgTraceTimestamp()		ULONGLONG(KeQueryPerformanceCounter(NULL).QuadPart)
+#endif
+
+extern "C" void _ReadWriteBarrier(void);
+#pragma intrinsic(_ReadWriteBarrier)
+
+/*!
+ * @brief
+ * Ring of one CPU. WriteIndex and ReadIndex count records since the start
+ * and wrap around; the slot is the index modulo the size of the ring.
+ */
+typedef struct
+{
+	volatile LONG		WriteIndex;		/*!< @brief Number of records reserved. */
+	ULONG				ReadIndex;		/*!< @brief Number of records drained or lost. Only used by the drain. */
+	PDBG_TRACE_RECORD	Record;			/*!< @brief Records. */
+} DBG_TRACE_RING, *PDBG_TRACE_RING;
+
+/*!
+ * @brief
+ * Trace buffer, shared by all the devices handled by the driver.
+ */
+typedef struct
+{
+	ULONG				NumberOfCpus;		/*!< @brief Number of rings. */
+	ULONG				RecordMask;			/*!< @brief Records per ring - 1. */
+	LONG				References;			/*!< @brief Number of DbgTraceStart() calls not yet matched by DbgTraceStop(). */
+	FAST_MUTEX			DrainLock;			/*!< @brief Serializes DbgTraceDrain(). */
+	ULONGLONG			TimestampStart;		/*!< @brief Timestamp when the trace was started. */
+	ULONGLONG			CounterStart;		/*!< @brief Performance counter when the trace was started. */
+	ULONGLONG			CounterFrequency;	/*!< @brief Performance counter frequency. */
+	DBG_TRACE_RING		Ring[1];			/*!< @brief One ring per CPU. */
+} DBG_TRACE_BUFFER, *PDBG_TRACE_BUFFER;
+
+/*! @brief The trace buffer, or NULL if tracing is off. */
+extern PDBG_TRACE_BUFFER DbgTraceBuffer;
+
+/*****************************************************************************
+ * Functions
+ */
+NTSTATUS
+DbgTraceStart
+(
+	IN		ULONG	RecordsPerCpu
+);
+
+VOID
+DbgTraceStop
+(	void
+);
+
+NTSTATUS
+DbgTraceDrain
+(
+	OUT		PVOID	Buffer,
+	IN		ULONG	BufferSize,
+	OUT		PULONG	OutBufferSize
+);
+
+/*****************************************************************************
+ * DbgTrace()
+ *****************************************************************************
+ * @brief
+ * Record an event. Callable at any IRQL. Does nothing if tracing is off.
+ * @details
+ * The record is reserved with an interlocked increment, so a DPC that
+ * interrupts a thread halfway through a record on the same CPU just gets
+ * the next slot. The sequence number is written last; the drain uses it to
+ * skip records that are still being written or were overwritten while it
+ * copied them.
+ */
+static __forceinline
+VOID
+DbgTrace
+(
+	IN		USHORT	Event,
+	IN		ULONG	Argument0,
+	IN		ULONG	Argument1 = 0,
+	IN		ULONG	Argument2 = 0,
+	IN		ULONG	Argument3 = 0
+)
+{
+	PDBG_TRACE_BUFFER Buffer = DbgTraceBuffer;
+
+	if (Buffer)
+	{
+		ULONG Cpu = KeGetCurrentProcessorNumber();
+
+		if (Cpu < Buffer->NumberOfCpus)
+		{
+			PDBG_TRACE_RING Ring = &Buffer->Ring[Cpu];
+
+			ULONG Index = ULONG(InterlockedIncrement(&Ring->WriteIndex)) - 1;
+
+			PDBG_TRACE_RECORD Record = &Ring->Record[Index & Buffer->RecordMask];
+
+			Record->Sequence = 0;
+
+			_ReadWriteBarrier();
+
+			Record->Timestamp = DbgTraceTimestamp();
+			Record->Event = Event;
+			Record->Cpu = UCHAR(Cpu);
+			Record->Argument[0] = Argument0;
+			Record->Argument[1] = Argument1;
+			Record->Argument[2] = Argument2;
+			Record->Argument[3] = Argument3;
+
+			// Stores are not reordered with other stores on x86/x64, so this
+			// only needs to keep the compiler from moving them.
+			_ReadWriteBarrier();
+
+			*((volatile ULONG *)&Record->Sequence) = Index + 1;
+		}
+	}
+}
+
+#endif // DBG_TRACE_FORMAT_ONLY
+
+#endif // _DBG_TRACE_H_
@@ -547,6 +547,13 @@ CKsAdapter::
         m_UsbDevice->Release();
         m_UsbDevice = NULL;
     }
+
+	// Only now that the pipes are gone, see DbgTraceStop().
+	if (m_TraceStarted)
+	{
+		DbgTraceStop();
+		m_TraceStarted = FALSE;
+	}
 }
 
 /*****************************************************************************
@@ -739,6 +746,12 @@ StartDevice
 			m_UsbDevice->Release();
 			m_UsbDevice = NULL;
 		}
+
+		if (m_TraceStarted)
+		{
+			DbgTraceStop();
+			m_TraceStarted = FALSE;
+		}
 	}
 
     return ntStatus;
@@ -860,6 +873,13 @@ StopDevice
         m_UsbDevice = NULL;
     }
 
+	// Only now that the pipes are gone, see DbgTraceStop().
+	if (m_TraceStarted)
+	{
+		DbgTraceStop();
+		m_TraceStarted = FALSE;
+	}
+
 	m_PnpState = PNP_STATE_STOPPED;
 }
 
@@ -1139,6 +1159,31 @@ InitializeAudio
         ntStatus = STATUS_INSUFFICIENT_RESOURCES;
     }
 
+	if (NT_SUCCESS(ntStatus))
+	{
+		// Optionally pace the playback with the packets received on the record pipe.
+		ULONG ImplicitFeedback = 0;
+
+		if (NT_SUCCESS(RegistryReadFromDriverSubKey(L"Settings", L"ImplicitFeedback", &ImplicitFeedback, sizeof(ULONG), NULL, NULL)))
+		{
+			m_AudioDevice->SetImplicitFeedback(ImplicitFeedback ? TRUE : FALSE);
+		}
+	}
+
+	if (NT_SUCCESS(ntStatus))
+	{
+		// Optionally record the isochronous transfers in the binary trace.
+		ULONG TraceRecordsPerCpu = 0;
+
+		if (NT_SUCCESS(RegistryReadFromDriverSubKey(L"Settings", L"TraceRecordsPerCpu", &TraceRecordsPerCpu, sizeof(ULONG), NULL, NULL)))
+		{
+			if (TraceRecordsPerCpu)
+			{
+				m_TraceStarted = NT_SUCCESS(DbgTraceStart(TraceRecordsPerCpu));
+			}
+		}
+	}
+
 	if (!NT_SUCCESS(ntStatus))
 	{
         // Clean up our mess...
@@ -93,6 +93,7 @@ private:
 	LONG				m_DeviceUsageCount;	/*!< @brief Device usage count. */
 
 	BOOL				m_ShutdownNotification;	/*!< @brief Whether shutdown notification is registered. */
+	BOOL				m_TraceStarted;			/*!< @brief Whether DbgTraceStart() was called. */
 
 	NTSTATUS StartDevice
 	(
@@ -33,7 +33,6 @@
 #include "Audio.h"
 
 #include "ExtProp.h"
-#include "DataProcessingConstants.h"
 
 #define STR_MODULENAME "Audio: "
 
@@ -76,6 +75,15 @@
 //     the client first, then followed by data kept in the temporary buffer.
 #define MICROSOFT_USB_OHCI_BUG_WORKAROUND
 
+// Playback data is converted and scaled as it is written to the client FIFO,
+// so the FIFO already holds what goes on the wire. With this defined, the
+// output IRPs transfer straight out of the FIFO ring buffer instead of
+// copying it into the FIFO work item's buffer first. The frames stay mapped
+// (the producer can't overwrite them) until the IRP is returned to the free
+// list. An IRP whose frames wrap around the end of the ring buffer falls back
+// to the copy.
+#define AUDIO_DIRECT_FIFO_TRANSFER
+
 
 /*****************************************************************************
  * Referenced forward
@@ -620,8 +628,6 @@ Init
 
 	m_AudioDevice = AudioDevice;
 
-	m_ReadPosition = 0;  m_WritePosition = 1;
-
 	m_CallbackData = CallbackData;
     m_CallbackRoutine = CallbackRoutine;
 
@@ -648,6 +654,8 @@ Init
         m_requireSoftMaster = m_AudioDevice->IsSoftwareMasterVolMute();
     }
 
+	_UpdateGains(FALSE);
+
 	return AUDIOERR_SUCCESS;
 }
 
@@ -858,7 +866,7 @@ SetInterfaceParameter
 
 		PUSB_AUDIO_COMMON_FORMAT_TYPE_DESCRIPTOR FormatTypeDescriptor_ = Interface->GetFormatTypeDescriptor(AlternateSetting);
 
-		if ((FormatTypeDescriptor_->bFormatType == USB_AUDIO_FORMAT_TYPE_I) || (FormatTypeDescriptor_->bFormatType == USB_AUDIO_FORMAT_TYPE_III))
+		if (FormatTypeDescriptor_ && ((FormatTypeDescriptor_->bFormatType == USB_AUDIO_FORMAT_TYPE_I) || (FormatTypeDescriptor_->bFormatType == USB_AUDIO_FORMAT_TYPE_III)))
 		{
 			// The format type descriptor is the same for TYPE_I and TYPE_III.
 			PUSB_AUDIO_TYPE_I_FORMAT_DESCRIPTOR FormatTypeDescriptor = PUSB_AUDIO_TYPE_I_FORMAT_DESCRIPTOR(FormatTypeDescriptor_);
@@ -867,7 +875,8 @@ SetInterfaceParameter
 		}
 		else
 		{
-			// Type II format. No bit resolution specified.
+			// Type II format, or the zero-bandwidth setting, which has no
+			// format type descriptor. No bit resolution specified.
 			m_BitResolution = 0;
 		}
 
@@ -1083,35 +1092,17 @@ Reset
 {
 	Lock();
 
-	m_ReadPosition = 0;
-    m_WritePosition = 1;
+	// Regions still mapped by queued IRPs are forgotten, see CAudioRing::Reset().
+	m_Ring.Reset();
 
 	Unlock();
 }
 
 /*
- * Important note: If you look at how m_ReadPosition and m_WritePosition are
- * handled, you'll notice that the ring buffer never gets completely full
- * (there always is one byte left open).
- *
- * To see this, consider the following case:
- *
- *
- *    0    1    2    3    4
- * +----+----+----+----+----+
- * |    |    |    |    |    |
- * +----+----+----+----+----+
- *
- * In the beginning, with nothing in the buffer, m_ReadPosition = 0,
- * m_WritePosition = 1. In this case, the ring buffer is 5 frames in size
- * (BUFFER_SIZE == 4). If we call AddFrames() four times, m_WritePosition
- * will be equal to 0 , while m_ReadPosition == 0.  At this point,
- * m_WritePosition == m_ReadPosition, so we consider the ring buffer to be
- * full.  Note, however, that we never wrote a frame to buffer[0], since
- * m_WritePosition started out being initialized to 1.
- *
- * This scheme is a little weird, but it has the advantage of making it
- * really easy to determine when the buffer is full or empty.
+ * The FIFO is a single-producer/single-consumer ring buffer, m_Ring (see
+ * AudioRing.h). On output, the producer is WriteBuffer() and the consumer is
+ * the data pipe (FlushBuffer() serializes its callers with the client lock).
+ * On input, it is the other way around.
  */
 
 /*****************************************************************************
@@ -1119,6 +1110,8 @@ Reset
  *****************************************************************************
  * @brief
  * Adds data in buffer to the FIFO.
+ * @details
+ * Must only be called by the producer. It doesn't need the client lock.
  * @param
  * Buffer Pointer to the buffer that contains the data for the client.
  * @param
@@ -1135,96 +1128,34 @@ AddFramesToFifo
 	IN		BOOL	BitConversion
 )
 {
-	ULONG FramesWritten = 0;
-
-	if (NumberOfFrames)
-	{
-		if (m_WritePosition < m_ReadPosition)
-		{
-			ULONG FramesAvailable = m_ReadPosition - m_WritePosition;
-
-			ULONG FramesToWrite = (NumberOfFrames > FramesAvailable) ? FramesAvailable : NumberOfFrames;
-
-			if (BitConversion)
-			{
-				m_ConversionRoutine(m_FifoBuffer + m_WritePosition * m_FifoFrameSize, Buffer, FramesToWrite * m_FormatChannels);
-			}
-			else
-			{
-				RtlCopyMemory(m_FifoBuffer + m_WritePosition * m_FifoFrameSize, Buffer, FramesToWrite * m_FifoFrameSize);
-			}
-            VolumeMuteAdjustment(m_FifoBuffer + m_WritePosition * m_FifoFrameSize, FramesToWrite);
-
-			m_WritePosition += FramesToWrite;
-
-			m_WritePosition %= (m_FifoBufferSize+1);
+	ULONGLONG WriteCount;
 
-			FramesWritten += FramesToWrite;
-		}
-		else if (m_WritePosition > m_ReadPosition)
-		{
-			ULONG FramesAvailable = m_FifoBufferSize - m_WritePosition + 1;
-
-			if (NumberOfFrames > FramesAvailable)
-			{
-				ULONG FramesToWrite0 = FramesAvailable;
-
-				if (BitConversion)
-				{
-					m_ConversionRoutine(m_FifoBuffer + m_WritePosition * m_FifoFrameSize, Buffer, FramesToWrite0 * m_FormatChannels);
-				}
-				else
-				{
-					RtlCopyMemory(m_FifoBuffer + m_WritePosition * m_FifoFrameSize, Buffer, FramesToWrite0 * m_FifoFrameSize);
-				}
-                VolumeMuteAdjustment(m_FifoBuffer + m_WritePosition * m_FifoFrameSize, FramesToWrite0);
+	ULONG FramesAvailable = m_Ring.BeginWrite(&WriteCount);
 
-				ULONG FramesLeftToWrite = NumberOfFrames - FramesToWrite0;
+	ULONG FramesToWrite = (NumberOfFrames > FramesAvailable) ? FramesAvailable : NumberOfFrames;
 
-				ULONG FramesToWrite1 = (FramesLeftToWrite > m_ReadPosition) ? m_ReadPosition : FramesLeftToWrite;
+	ULONG FrameSize = BitConversion ? m_ClientFrameSize : m_FifoFrameSize;
 
-				if (FramesToWrite1) 
-				{
-					if (BitConversion)
-					{
-						m_ConversionRoutine(m_FifoBuffer, Buffer + FramesToWrite0 * m_ClientFrameSize, FramesToWrite1 * m_FormatChannels);
-					}
-					else
-					{
-						RtlCopyMemory(m_FifoBuffer, Buffer + FramesToWrite0 * m_FifoFrameSize, FramesToWrite1 * m_FifoFrameSize);
-					}
-                    VolumeMuteAdjustment(m_FifoBuffer, FramesToWrite1);
-				}
+	ULONG FramesWritten = 0;
 
-				m_WritePosition = FramesToWrite1;
+	// At most two passes: up to the end of the ring buffer storage, then from
+	// its start.
+	while (FramesWritten < FramesToWrite)
+	{
+		ULONG Position = m_Ring.Position(WriteCount);
 
-				FramesWritten += (FramesToWrite0 + FramesToWrite1);
-			}
-			else
-			{
-				ULONG FramesToWrite = NumberOfFrames;
+		ULONG Frames = m_Ring.Contiguous(WriteCount, FramesToWrite - FramesWritten);
 
-				if (BitConversion)
-				{
-					m_ConversionRoutine(m_FifoBuffer + m_WritePosition * m_FifoFrameSize, Buffer, FramesToWrite * m_FormatChannels);
-				}
-				else
-				{
-					RtlCopyMemory(m_FifoBuffer + m_WritePosition * m_FifoFrameSize, Buffer, FramesToWrite * m_FifoFrameSize);
-				}
-                VolumeMuteAdjustment(m_FifoBuffer + m_WritePosition * m_FifoFrameSize, FramesToWrite);
+		_CopyToFifo(m_FifoBuffer + Position * m_FifoFrameSize, Buffer + FramesWritten * FrameSize, Frames, BitConversion);
 
-				m_WritePosition += FramesToWrite;
+		WriteCount += Frames;
 
-				m_WritePosition %= (m_FifoBufferSize+1);
+		FramesWritten += Frames;
+	}
 
-				FramesWritten += FramesToWrite;
-			}
-		}
-		else
-		{
-			/* Buffer is completely FULL */
-		}
+	if (FramesWritten)
+	{
+		m_Ring.EndWrite(WriteCount);
 	}
 
 	return FramesWritten;
@@ -1236,9 +1167,12 @@ AddFramesToFifo
  * @brief
  * Removes data in the FIFO to a buffer.
  * @details
- * This routine does not block if no data is available.
+ * This routine does not block if no data is available. Must only be called
+ * by the consumer. It doesn't need the client lock, unless the consumer also
+ * maps frames (see MapFramesInFifo()).
  * @param
- * Buffer Buffer address of the incoming stream.
+ * Buffer Buffer address of the incoming stream. If NULL, the frames are
+ * discarded.
  * @param
  * NumberOfFrames Length in frames of the buffer pointed to by Buffer.
  * @return
@@ -1253,104 +1187,110 @@ RemoveFramesFromFifo
 	IN		BOOL	BitConversion
 )
 {
-	ULONG FramesRead = 0;
+	ULONGLONG ReadCount;
+
+	ULONG FramesQueued = m_Ring.BeginRead(&ReadCount);
+
+	ULONG FramesToRead = (NumberOfFrames > FramesQueued) ? FramesQueued : NumberOfFrames;
+
+	ULONG FrameSize = BitConversion ? m_ClientFrameSize : m_FifoFrameSize;
 
-    ULONG NewReadPosition = (m_ReadPosition + 1) % (m_FifoBufferSize+1);
+	ULONG FramesRead = 0;
 
-	if (m_WritePosition > NewReadPosition)
+	// At most two passes: up to the end of the ring buffer storage, then from
+	// its start.
+	while (FramesRead < FramesToRead)
 	{
-		ULONG FramesAvailable = m_WritePosition - NewReadPosition;
+		ULONG Position = m_Ring.Position(ReadCount);
 
-		ULONG FramesToRead = (NumberOfFrames > FramesAvailable) ? FramesAvailable : NumberOfFrames;
+		ULONG Frames = m_Ring.Contiguous(ReadCount, FramesToRead - FramesRead);
 
 		if (Buffer)
 		{
 			if (BitConversion)
 			{
-				m_ConversionRoutine(Buffer, m_FifoBuffer + NewReadPosition * m_FifoFrameSize, FramesToRead * m_FormatChannels);
+				m_ConversionRoutine(Buffer + FramesRead * FrameSize, m_FifoBuffer + Position * m_FifoFrameSize, Frames * m_FormatChannels);
 			}
 			else
 			{
-				RtlCopyMemory(Buffer, m_FifoBuffer + NewReadPosition * m_FifoFrameSize, FramesToRead * m_FifoFrameSize);
+				RtlCopyMemory(Buffer + FramesRead * FrameSize, m_FifoBuffer + Position * m_FifoFrameSize, Frames * m_FifoFrameSize);
 			}
 		}
 
-		m_ReadPosition = NewReadPosition + FramesToRead - 1;
+		ReadCount += Frames;
 
-		FramesRead += FramesToRead;
+		FramesRead += Frames;
 	}
-	else if (m_WritePosition < NewReadPosition)
-	{
-		ULONG FramesAvailable = m_FifoBufferSize - NewReadPosition + 1;
-
-		if (NumberOfFrames > FramesAvailable)
-		{
-			ULONG FramesToRead0 = FramesAvailable;
-
-			if (Buffer)
-			{
-				if (BitConversion)
-				{
-					m_ConversionRoutine(Buffer, m_FifoBuffer + NewReadPosition * m_FifoFrameSize, FramesToRead0 * m_FormatChannels);
-				}
-				else
-				{
-					RtlCopyMemory(Buffer, m_FifoBuffer + NewReadPosition * m_FifoFrameSize, FramesToRead0 * m_FifoFrameSize);
-				}
-			}
-
-			m_ReadPosition = NewReadPosition + FramesToRead0 - 1;
-
-			ULONG FramesLeftToRead = NumberOfFrames - FramesToRead0;
-
-			ULONG FramesToRead1 = (FramesLeftToRead > m_WritePosition) ? m_WritePosition : FramesLeftToRead;
-
-			if (FramesToRead1) 
-			{
-				if (Buffer)
-				{
-					if (BitConversion)
-					{
-						m_ConversionRoutine(Buffer + FramesToRead0 * m_ClientFrameSize, m_FifoBuffer, FramesToRead1 * m_FormatChannels);
-					}
-					else
-					{
-						RtlCopyMemory(Buffer + FramesToRead0 * m_FifoFrameSize, m_FifoBuffer, FramesToRead1 * m_FifoFrameSize);
-					}
-				}
 
-				m_ReadPosition = FramesToRead1 - 1;
-			}
-
-			FramesRead += (FramesToRead0 + FramesToRead1);
-		}
-		else
-		{
-			ULONG FramesToRead = NumberOfFrames;
+	if (FramesRead)
+	{
+		// Mapped regions hold the release point back; see UnmapFramesInFifo().
+		m_Ring.EndRead(ReadCount);
+	}
 
-			if (Buffer)
-			{
-				if (BitConversion)
-				{
-					m_ConversionRoutine(Buffer, m_FifoBuffer + NewReadPosition * m_FifoFrameSize, FramesToRead * m_FormatChannels);
-				}
-				else
-				{
-					RtlCopyMemory(Buffer, m_FifoBuffer + NewReadPosition * m_FifoFrameSize, FramesToRead * m_FifoFrameSize);
-				}
-			}
+    return FramesRead;
+}
 
-			m_ReadPosition = NewReadPosition + FramesToRead - 1;
+/*****************************************************************************
+ * CAudioClient::MapFramesInFifo()
+ *****************************************************************************
+ * @brief
+ * Consumes frames from the FIFO without copying them.
+ * @details
+ * The frames stay in the ring buffer, and the producer can't overwrite them,
+ * until UnmapFramesInFifo() is called. Fails if fewer frames are queued, if
+ * they wrap around the end of the ring buffer storage, or if too many
+ * regions are mapped already; the caller should then fall back to
+ * RemoveFramesFromFifo(). Must only be called by the consumer, with the
+ * client lock held.
+ * @param
+ * NumberOfFrames Number of audio frames to map.
+ * @param
+ * OutMapping Receives the region to pass to UnmapFramesInFifo().
+ * @return
+ * Returns a pointer to the frames in the ring buffer, or NULL.
+ */
+PUCHAR
+CAudioClient::
+MapFramesInFifo
+(
+	IN		ULONG				NumberOfFrames,
+	OUT		PAUDIO_FIFO_MAPPING	OutMapping
+)
+{
+	ULONG Position;
 
-			FramesRead += FramesToRead;
-		}
-	}
-	else
+	if (!m_Ring.Map(NumberOfFrames, OutMapping, &Position))
 	{
-        /* Buffer is EMPTY */
+		return NULL;
 	}
 
-    return FramesRead;
+	return m_FifoBuffer + Position * m_FifoFrameSize;
+}
+
+/*****************************************************************************
+ * CAudioClient::UnmapFramesInFifo()
+ *****************************************************************************
+ * @brief
+ * Releases frames mapped by MapFramesInFifo() back to the producer.
+ * @details
+ * Regions can be unmapped in any order; the producer gets the space back up
+ * to the oldest region still mapped. Regions mapped before the FIFO was
+ * reset are ignored. Must only be called by the consumer, with the client
+ * lock held.
+ * @param
+ * Mapping The region returned by MapFramesInFifo().
+ * @return
+ * <None>
+ */
+VOID
+CAudioClient::
+UnmapFramesInFifo
+(
+	IN		PAUDIO_FIFO_MAPPING	Mapping
+)
+{
+	m_Ring.Unmap(Mapping);
 }
 
 /*****************************************************************************
@@ -1358,6 +1298,8 @@ RemoveFramesFromFifo
  *****************************************************************************
  * @brief
  * Get number of frames queued in the FIFO.
+ * @details
+ * Wait-free; can be called from either side.
  * @param
  * <None>
  * @return
@@ -1369,14 +1311,7 @@ GetNumQueuedFrames
 (	void
 )
 {
-    if (m_WritePosition > m_ReadPosition)
-	{
-        return m_WritePosition - m_ReadPosition - 1;
-	}
-    else
-	{
-        return (m_FifoBufferSize+1) - m_ReadPosition + m_WritePosition - 1;
-	}
+	return m_Ring.GetNumQueuedFrames();
 }
 
 /*****************************************************************************
@@ -1384,6 +1319,9 @@ GetNumQueuedFrames
  *****************************************************************************
  * @brief
  * Get number of frames available in the FIFO.
+ * @details
+ * Wait-free; can be called from either side. Frames that are mapped by the
+ * consumer are neither queued nor available.
  * @param
  * <None>
  * @return
@@ -1395,7 +1333,7 @@ GetNumAvailableFrames
 (	void
 )
 {
-	return m_FifoBufferSize - GetNumQueuedFrames();
+	return m_Ring.GetNumAvailableFrames();
 }
 
 /*****************************************************************************
@@ -1414,7 +1352,7 @@ IsFull
 (	void
 )
 {
-    return (GetNumQueuedFrames() == m_FifoBufferSize);
+    return (GetNumAvailableFrames() == 0);
 }
 
 /*****************************************************************************
@@ -1437,6 +1375,7 @@ IsEmpty
 }
 
 #include "Convert.h"
+#include "Gain.h"
 
 #pragma code_seg("PAGE")
 
@@ -1493,7 +1432,16 @@ SetupBuffer
 	
 	ULONG FifoFrameSize = FormatChannels * (BitResolution / 8);
 
-	PUCHAR FifoBuffer = PUCHAR(ExAllocatePoolWithTag(NonPagedPool, (FifoBufferSizeInFrames + 1) * FifoFrameSize, 'mdW'));
+	// The ring buffer storage is rounded up to a power of two so that the
+	// positions can be masked out of the frame counters.
+	ULONG FifoBufferStorageInFrames = 1;
+
+	while (FifoBufferStorageInFrames < FifoBufferSizeInFrames)
+	{
+		FifoBufferStorageInFrames <<= 1;
+	}
+
+	PUCHAR FifoBuffer = PUCHAR(ExAllocatePoolWithTag(NonPagedPool, FifoBufferStorageInFrames * FifoFrameSize, 'mdW'));
 
 	if (FifoBuffer)
 	{
@@ -1504,7 +1452,7 @@ SetupBuffer
 
 		m_FifoBuffer = FifoBuffer;
 
-		m_FifoBufferSize = FifoBufferSizeInFrames;
+		m_Ring.Init(FifoBufferSizeInFrames, FifoBufferStorageInFrames);
 
 		m_FifoFrameSize = FifoFrameSize;
 
@@ -1548,12 +1496,9 @@ WriteBuffer
 	IN		ULONG	BufferLength
 )
 {
-	Lock();
-
+	// No need for the client lock, the FIFO is lock-free.
 	ULONG BytesWritten = AddFramesToFifo(Buffer, BufferLength / m_ClientFrameSize, m_BitConversion) * m_ClientFrameSize;
 
-	Unlock();
-
 	if (BytesWritten)
 	{
 		// Increment the total number of bytes queued.
@@ -1620,12 +1565,9 @@ ReadBuffer
 	IN		ULONG	BufferLength
 )
 {
-	Lock();
-
+	// No need for the client lock, the FIFO is lock-free.
 	ULONG BytesRead = RemoveFramesFromFifo(Buffer, BufferLength / m_ClientFrameSize, m_BitConversion) * m_ClientFrameSize;
 
-	Unlock();
-
     return BytesRead;
 }
 
@@ -1677,6 +1619,8 @@ Start
 	if (AUDIO_SUCCESS(audioStatus))
 	{
 		m_IsActive = TRUE;
+
+		_UpdateImplicitFeedback();
 	}
 
 	return audioStatus;
@@ -1703,6 +1647,8 @@ Pause
 
 	m_IsActive = FALSE;
 
+	_UpdateImplicitFeedback();
+
 	AUDIOSTATUS audioStatus = m_DataPipe ? m_DataPipe->Pause() : AUDIOERR_SUCCESS;
 
 	if (AUDIO_SUCCESS(audioStatus))
@@ -1738,6 +1684,8 @@ Stop
 
 	m_IsActive = FALSE;
 
+	_UpdateImplicitFeedback();
+
 	AUDIOSTATUS audioStatus = m_DataPipe ? m_DataPipe->Stop() : AUDIOERR_SUCCESS;
 
 	if (AUDIO_SUCCESS(audioStatus))
@@ -1825,6 +1773,114 @@ SetPosition
 	return m_DataPipe ? m_DataPipe->SetPosition(TransferPosition) : AUDIOERR_SUCCESS;
 }
 
+/*****************************************************************************
+ * CAudioClient::SetTransferDepth()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Set the number of IRPs the data pipe keeps in flight.
+ * @details
+ * See CAudioDataPipe::SetTransferDepth().
+ */
+AUDIOSTATUS 
+CAudioClient::
+SetTransferDepth
+(
+	IN		BOOL	Adaptive,
+	IN		ULONG	LatencyInMs
+)
+{
+	return m_DataPipe ? m_DataPipe->SetTransferDepth(Adaptive, LatencyInMs) : AUDIOERR_BAD_REQUEST;
+}
+
+/*****************************************************************************
+ * CAudioClient::GetTransferDepth()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Get the number of IRPs the data pipe keeps in flight.
+ */
+AUDIOSTATUS 
+CAudioClient::
+GetTransferDepth
+(
+	OUT		PAUDIO_TRANSFER_DEPTH	OutTransferDepth
+)
+{
+	return m_DataPipe ? m_DataPipe->GetTransferDepth(OutTransferDepth) : AUDIOERR_BAD_REQUEST;
+}
+
+/*****************************************************************************
+ * CAudioClient::GetClockRatio()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Get the ratio of the device clock to the nominal sample rate.
+ * @details
+ * See CAudioDataPipe::GetClockRatio().
+ */
+AUDIOSTATUS 
+CAudioClient::
+GetClockRatio
+(
+	OUT		PULONG	OutClockRatio
+)
+{
+	return m_DataPipe ? m_DataPipe->GetClockRatio(OutClockRatio) : AUDIOERR_BAD_REQUEST;
+}
+
+/*****************************************************************************
+ * CAudioClient::_UpdateImplicitFeedback()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Pair the running input and output data pipes of the device if it is in
+ * implicit feedback mode.
+ * @details
+ * Called whenever a client starts or stops. The first running input pipe
+ * paces the first running output pipe. An input pipe that stops is unpaired.
+ */
+VOID
+CAudioClient::
+_UpdateImplicitFeedback
+(	void
+)
+{
+	if (!m_AudioDevice->m_ImplicitFeedback) return;
+
+	if ((m_Direction == AUDIO_INPUT) && !m_IsActive && m_DataPipe)
+	{
+		m_DataPipe->SetImplicitFeedbackPipe(NULL);
+	}
+
+	CAudioDataPipe * InputPipe = NULL;
+	CAudioDataPipe * OutputPipe = NULL;
+
+	m_AudioDevice->m_ClientList.Lock();
+
+	for (CAudioClient * Client = m_AudioDevice->m_ClientList.First(); Client; Client = m_AudioDevice->m_ClientList.Next(Client))
+	{
+		if (Client->m_IsActive && Client->m_DataPipe)
+		{
+			if (Client->m_Direction == AUDIO_INPUT)
+			{
+				if (!InputPipe) InputPipe = Client->m_DataPipe;
+			}
+			else
+			{
+				if (!OutputPipe) OutputPipe = Client->m_DataPipe;
+			}
+		}
+	}
+
+	m_AudioDevice->m_ClientList.Unlock();
+
+	if (InputPipe)
+	{
+		InputPipe->SetImplicitFeedbackPipe(OutputPipe);
+	}
+}
+
 /*****************************************************************************
  * CAudioClient::QueryControlSupport()
  *****************************************************************************
@@ -1930,246 +1986,177 @@ Service
 	}
 }
 
-void
+/*****************************************************************************
+ * CAudioClient::_UpdateGains()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Recompute the per-channel gains from the device master volume/mute.
+ * @param
+ * Ramp TRUE to ramp from the running gains to the new ones, FALSE to apply
+ * the new gains immediately.
+ */
+VOID
 CAudioClient::
-VolumeMuteAdjustment
+_UpdateGains
 (
-	IN  PUCHAR	pBuffer, 
-	IN	ULONG	SamplesPerChannel
-)    
+	IN		BOOL	Ramp
+)
 {
-	//edit yuanfen 
-	//Not apply volume control to AC3 passthrough
-//	if(m_requireSoftMaster)
-    if(m_requireSoftMaster && m_Priority!= AUDIO_PRIORITY_HIGH)
-    {
-        BOOL volumeAdjust = FALSE;
-        LONG masterVolume[AUDIO_CLIENT_MAX_CHANNEL];
-
-        // Update cache values
-        for(ULONG chCount = 0; chCount < m_FormatChannels; chCount++)
-        {
-            m_AudioDevice->GetMasterVolume(chCount, &masterVolume[chCount]);
+	m_MasterVolumeSerial = m_AudioDevice->m_MasterVolumeSerial;
 
-            // Check if we need volume adjustment
-            if(masterVolume[chCount] != MASTERVOL_0_DB)
-            {
-                volumeAdjust = TRUE;
-            }
-        }
-        BOOL masterMute = FALSE;
-        
-        m_AudioDevice->GetMasterMute(&masterMute);
+	BOOL MasterMute = FALSE;
 
-        if(masterMute)
-        {
-            // Muted
-			//edit yuanfen
-			//Remove distortion when mute
-//			RtlZeroMemory(pBuffer, SamplesPerChannel * m_FormatChannels * m_SampleSize / 8);
-            RtlZeroMemory(pBuffer, SamplesPerChannel * m_FormatChannels * m_BitResolution / 8);
-        }
-        else
-        {
-            // Only need to care about volume if not muted
-            if(volumeAdjust)
-            {
-                KFLOATING_SAVE floatingSave;
+	m_AudioDevice->GetMasterMute(&MasterMute);
 
-                NTSTATUS ntStatus = KeSaveFloatingPointState(&floatingSave);
-                if(NT_SUCCESS(ntStatus))
-                {
-                    ULONG totalSamples = m_FormatChannels * SamplesPerChannel;
-                    float* pFloatBuf = static_cast<float*>(ExAllocatePoolWithTag(NonPagedPool, sizeof(float)*totalSamples, 'mdW'));
+	m_GainUnity = TRUE; m_GainZero = TRUE;
 
-                    if(pFloatBuf)
-                    {
-                        // Convert samples to float for volume adjustment
-					    //edit yuanfen
-						//Remove distortion when adjusting volume
-//                        ntStatus = ConvertIntData2Float(pBuffer, reinterpret_cast<BYTE*>(pFloatBuf), totalSamples, m_SampleSize);
-						ntStatus = ConvertIntData2Float(pBuffer, reinterpret_cast<BYTE*>(pFloatBuf), totalSamples, m_BitResolution);
-
-                        if(NT_SUCCESS(ntStatus))
-                        {
-                            float volumeAmp[AUDIO_CLIENT_MAX_CHANNEL];
-
-                            // Convert the volume from dB to amplitude
-                            for(ULONG chCount = 0; chCount < m_FormatChannels; chCount++)
-                            {
-                                if(masterVolume[chCount] == m_MasterVolumeMin[chCount])
-                                {
-                                    // Minimum. Set to 0.
-                                    volumeAmp[chCount] = 0.0f;
-                                }
-                                else
-                                {
-                                    volumeAmp[chCount] = dB2Amp(masterVolume[chCount]);
-							
-                                }
-                            }
-                            
-                            // The actual volume adjustment
-                            for(ULONG sampleCount = 0; sampleCount < totalSamples; sampleCount = sampleCount + m_FormatChannels)
-                            {
-                                for(ULONG chCount = 0; chCount < m_FormatChannels; chCount++)
-                                {
-                                    pFloatBuf[sampleCount + chCount] = pFloatBuf[sampleCount + chCount] * volumeAmp[chCount];
-                                }
-                            }
-
-                            // Convert the adjusted data and put back into original buffer
-                            if(NT_SUCCESS(ntStatus))
-                            {
-								//edit yuanfen
-								//Remove distortion when adjusting volume
-//                                ntStatus = ConvertFloatData2Int(reinterpret_cast<BYTE*>(pFloatBuf), pBuffer, totalSamples, m_SampleSize);
-								ntStatus = ConvertFloatData2Int(reinterpret_cast<BYTE*>(pFloatBuf), pBuffer, totalSamples, m_BitResolution);
-                            }
+	for (ULONG ch=0; ch<AUDIO_CLIENT_MAX_CHANNEL; ch++)
+	{
+		LONG MasterVolume = MASTERVOL_0_DB;
 
-						
-                         
-                        }
+		m_AudioDevice->GetMasterVolume(LONG(ch), &MasterVolume);
 
-                        ExFreePool(pFloatBuf);
-                    }
-                }
-                KeRestoreFloatingPointState(&floatingSave);
-            }
-        }
-    }
+		if (MasterMute || (MasterVolume <= m_MasterVolumeMin[ch]))
+		{
+			// Minimum. Set to 0.
+			m_GainTarget[ch] = 0;
+		}
+		else
+		{
+			m_GainTarget[ch] = DecibelToGain(MasterVolume);
+		}
+
+		if (m_GainTarget[ch] != AUDIO_GAIN_UNITY) m_GainUnity = FALSE;
+
+		if (m_GainTarget[ch] != 0) m_GainZero = FALSE;
+	}
+
+	if (Ramp)
+	{
+		for (ULONG ch=0; ch<AUDIO_CLIENT_MAX_CHANNEL; ch++)
+		{
+			m_GainStep[ch] = (m_GainTarget[ch] - m_Gain[ch]) / AUDIO_GAIN_RAMP_FRAMES;
+		}
+
+		m_GainRampFrames = AUDIO_GAIN_RAMP_FRAMES;
+	}
+	else
+	{
+		for (ULONG ch=0; ch<AUDIO_CLIENT_MAX_CHANNEL; ch++)
+		{
+			m_Gain[ch] = m_GainTarget[ch];
+		}
 
-    return;
+		m_GainRampFrames = 0;
+	}
 }
 
-NTSTATUS
+/*****************************************************************************
+ * CAudioClient::_CopyToFifo()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Copy a contiguous block of frames into the FIFO, converting the samples
+ * and applying the software master volume/mute as required.
+ * @details
+ * When a gain has to be applied, the conversion, gain and mute are done in
+ * a single pass by a ConvertGain() instance specialized for the sample
+ * depths and channel count. The per-channel gains are cached and only
+ * recomputed when the device master volume/mute changes, in which case the
+ * running gains are ramped to the new ones over AUDIO_GAIN_RAMP_FRAMES to
+ * avoid zipper noise.
+ * @param
+ * FifoBuffer Pointer to the destination frames in the FIFO.
+ * @param
+ * Buffer Pointer to the source frames.
+ * @param
+ * NumberOfFrames Number of frames to copy.
+ * @param
+ * BitConversion TRUE if Buffer is in the client format, FALSE if it is
+ * already in the FIFO format.
+ * @return
+ * None.
+ */
+VOID
 CAudioClient::
-ConvertIntData2Float
+_CopyToFifo
 (
-    IN  BYTE*   pBufferInteger,
-    IN  BYTE*   pBufferFloat,
-    IN  ULONG   numTotalSamples,
-    IN  ULONG   bitsPerSample
+	IN		PUCHAR	FifoBuffer,
+	IN		PUCHAR	Buffer,
+	IN		ULONG	NumberOfFrames,
+	IN		BOOL	BitConversion
 )
 {
-    NTSTATUS ntStatus = STATUS_INVALID_PARAMETER;
-    if(pBufferInteger && pBufferFloat && numTotalSamples && bitsPerSample)
-    {
-        if(bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32)
-        {
-            switch(bitsPerSample)
-            {
-                case 16:
-                {
-                    //DbgPrint("ConvertIntData2Float - 16\n");
-                    SHORT* pSrc = reinterpret_cast<SHORT*>(pBufferInteger);
-                    float* pDst = reinterpret_cast<float*>(pBufferFloat);
+	//edit yuanfen 
+	//Not apply volume control to AC3 passthrough
+	BOOL SoftMaster = m_requireSoftMaster && (m_Priority != AUDIO_PRIORITY_HIGH);
 
-                    for(ULONG idx = 0; idx < numTotalSamples; idx++)
-                    {
-                        pDst[idx] = (float)pSrc[idx];//Int16ToFloat16(pSrc[idx]);
-                    }
-                    ntStatus = STATUS_SUCCESS;
-                    break;
-                }
-                case 24:
-                case 32:              //NOTE:  32 bits have been converted to 24bit prior to this !!
-                {
-                    //DbgPrint("ConvertIntData2Float - 24\n");
-                    // Headroom was reduce to optimized the conversion
-                    LBYTE lByte;
+	if (SoftMaster)
+	{
+		if (m_MasterVolumeSerial != m_AudioDevice->m_MasterVolumeSerial)
+		{
+			_UpdateGains(TRUE);
+		}
 
-                    BYTE* pSrc = pBufferInteger;
-                    float* pDst = reinterpret_cast<float*>(pBufferFloat);
+		AUDIO_CONVERT_GAIN_ROUTINE ConvertGainRoutine = FindConvertGainRoutine(BitConversion ? m_SampleSize : m_BitResolution, m_BitResolution, m_FormatChannels);
 
-                    for(ULONG idx = 0; idx < numTotalSamples; idx++)
-                    {
-                        lByte.byteValue[0] = 0;
-                        lByte.byteValue[1] = *pSrc; pSrc++;
-                        lByte.byteValue[2] = *pSrc; pSrc++;
-                        lByte.byteValue[3] = *pSrc; pSrc++;
-                        pDst[idx] = (float)lByte.lValue;//Int24ToFloat16(lByte.lValue);
+		if (!ConvertGainRoutine)
+		{
+			// Sample format that the gain stage doesn't handle.
+			SoftMaster = FALSE;
+		}
+		else
+		{
+			if (m_GainRampFrames)
+			{
+				ULONG RampFrames = (NumberOfFrames > m_GainRampFrames) ? m_GainRampFrames : NumberOfFrames;
 
-                    }
-                    ntStatus = STATUS_SUCCESS;
-                    break;
-                }
+				ConvertGainRoutine(FifoBuffer, Buffer, RampFrames, m_FormatChannels, m_Gain, m_GainStep);
 
-                default:
-                {
-                    ntStatus = STATUS_INVALID_PARAMETER;
-                    break;
-                }
-            }
-        }
-    }
-    return ntStatus;
-}
+				m_GainRampFrames -= RampFrames;
 
-///////////////////////////////////////////////////////////////////////////////
-// Protected Methods
-///////////////////////////////////////////////////////////////////////////////
-NTSTATUS
-CAudioClient::
-ConvertFloatData2Int
-(
-    IN  BYTE*   pBufferFloat,
-    IN  BYTE*   pBufferInteger,
-    IN  ULONG   numTotalSamples,
-    IN  ULONG   bitsPerSample
-)
-{
-    NTSTATUS ntStatus = STATUS_INVALID_PARAMETER;
-    if(pBufferInteger && pBufferFloat && numTotalSamples && bitsPerSample)
-    {
-        if(bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32)
-        {
-            switch(bitsPerSample)
-            {
-                case 16:
-                {
-                    //DbgPrint("ConvertFloatData2Int - 16\n");
-                    float* pSrc = reinterpret_cast<float*>(pBufferFloat);
-                    SHORT* pDst = reinterpret_cast<SHORT*>(pBufferInteger);
+				if (m_GainRampFrames == 0)
+				{
+					// Land exactly on the target, regardless of the step rounding.
+					RtlCopyMemory(m_Gain, m_GainTarget, sizeof(m_Gain));
+				}
 
-                    for(ULONG idx = 0; idx < numTotalSamples; idx++)
-                    {
-                        //pDst[idx] = (short)pSrc[idx];// Float16ToInt16(pSrc[idx]);
-						pDst[idx] = (short)(__int64)pSrc[idx];// Float16ToInt16(pSrc[idx]);
-                    }
-                    ntStatus = STATUS_SUCCESS;
-                    break;
-                }
-                case 24:
-                case 32:             //NOTE: 32 bit has been converted to 24 bit prior to this
-                {
-                    //DbgPrint("ConvertFloatData2Int - 24\n");
-                    LBYTE lByte;
+				FifoBuffer += RampFrames * m_FifoFrameSize;
 
-                    float* pSrc = reinterpret_cast<float*>(pBufferFloat);
-                    BYTE* pDst = pBufferInteger;
-                    for(ULONG idx = 0; idx < numTotalSamples; idx++)
-                    {
-						//lByte.lValue = (long)pSrc[idx];//Float16ToInt24(pSrc[idx]);
-                        lByte.lValue = (long)(__int64)pSrc[idx];//Float16ToInt24(pSrc[idx]);
-                        *pDst = lByte.byteValue[1]; pDst++;
-                        *pDst = lByte.byteValue[2]; pDst++;
-                        *pDst = lByte.byteValue[3]; pDst++;
-	                }
-                    ntStatus = STATUS_SUCCESS;
-                    break;
-                }
+				Buffer += RampFrames * (BitConversion ? m_ClientFrameSize : m_FifoFrameSize);
 
-            default:
-                {
-                    ntStatus = STATUS_INVALID_PARAMETER;
-                    break;
-                }
-            }
-        }
-    }
+				NumberOfFrames -= RampFrames;
+			}
 
-    return ntStatus;
+			if (NumberOfFrames && !m_GainUnity)
+			{
+				if (m_GainZero)
+				{
+					// Muted
+					RtlZeroMemory(FifoBuffer, NumberOfFrames * m_FifoFrameSize);
+				}
+				else
+				{
+					ConvertGainRoutine(FifoBuffer, Buffer, NumberOfFrames, m_FormatChannels, m_Gain, NULL);
+				}
+
+				NumberOfFrames = 0;
+			}
+		}
+	}
+
+	if (NumberOfFrames)
+	{
+		if (BitConversion)
+		{
+			m_ConversionRoutine(FifoBuffer, Buffer, NumberOfFrames * m_FormatChannels);
+		}
+		else
+		{
+			RtlCopyMemory(FifoBuffer, Buffer, NumberOfFrames * m_FifoFrameSize);
+		}
+	}
 }
 
 #pragma code_seg("PAGE")
@@ -2235,6 +2222,14 @@ Init
 
 	m_PendingIrps = 0;
 
+	LARGE_INTEGER PerformanceFrequency; KeQueryPerformanceCounter(&PerformanceFrequency);
+
+	m_PerformanceFrequency = PerformanceFrequency.QuadPart;
+
+	m_LastCompletionTime = 0;
+
+	ResetHistograms();
+
 	KeInitializeEvent(&m_NoPendingIrpEvent, NotificationEvent, FALSE);
 
 	PUSB_AUDIO_ENDPOINT_DESCRIPTOR EndpointDescriptor = NULL;
@@ -2779,6 +2774,17 @@ Start
 	{
 		m_PipeState = AUDIO_SYNCH_PIPE_STATE_RUN;
 
+		// Don't count the time the pipe was stopped.
+		m_LastCompletionTime = 0;
+
+		for (ULONG i=0; i<MAX_SYNCH_IRP; i++)
+		{
+			if (m_FifoWorkItem[i])
+			{
+				m_FifoWorkItem[i]->CompletionTime = 0;
+			}
+		}
+
 		if (SynchronizeStart)
 		{
 			m_StartFrameNumber = StartFrameNumber;
@@ -3070,6 +3076,171 @@ ProcessFifoWorkItem
 	return ntStatus;
 }
 
+/*****************************************************************************
+ * PacketStatusClass()
+ *****************************************************************************
+ * @brief
+ * Get the AUDIO_PACKET_STATUS_XXX class of an isochronous packet status.
+ */
+static
+ULONG
+PacketStatusClass
+(
+	IN		USBD_STATUS	usbdStatus
+)
+{
+	if (USBD_SUCCESS(usbdStatus))
+	{
+		return AUDIO_PACKET_STATUS_SUCCESS;
+	}
+
+	switch (usbdStatus)
+	{
+		case USBD_STATUS_NOT_ACCESSED:
+		case USBD_STATUS_ISO_NOT_ACCESSED_BY_HW:
+		case USBD_STATUS_ISO_NA_LATE_USBPORT:
+		case USBD_STATUS_ISO_NOT_ACCESSED_LATE:
+			return AUDIO_PACKET_STATUS_NOT_ACCESSED;
+
+		case USBD_STATUS_DATA_OVERRUN:
+		case USBD_STATUS_DATA_UNDERRUN:
+		case USBD_STATUS_BUFFER_OVERRUN:
+		case USBD_STATUS_BUFFER_UNDERRUN:
+		case USBD_STATUS_BABBLE_DETECTED:
+			return AUDIO_PACKET_STATUS_OVERRUN;
+
+		case USBD_STATUS_CRC:
+		case USBD_STATUS_BTSTUFF:
+		case USBD_STATUS_DATA_TOGGLE_MISMATCH:
+		case USBD_STATUS_DEV_NOT_RESPONDING:
+		case USBD_STATUS_PID_CHECK_FAILURE:
+		case USBD_STATUS_UNEXPECTED_PID:
+		case USBD_STATUS_XACT_ERROR:
+			return AUDIO_PACKET_STATUS_BUS_ERROR;
+
+		default:
+			return AUDIO_PACKET_STATUS_OTHER;
+	}
+}
+
+/*****************************************************************************
+ * CAudioSynchPipe::RecordCompletion()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Record the completion of an IRP in the transfer histograms, and stamp it
+ * so that the time to its resubmission can be measured.
+ */
+VOID
+CAudioSynchPipe::
+RecordCompletion
+(
+	IN		NTSTATUS				ntStatus,
+	IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
+)
+{
+	LONGLONG CompletionTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	if (m_LastCompletionTime)
+	{
+		HistogramRecord(&m_Statistics.CompletionInterval, HistogramElapsedTime(m_LastCompletionTime, CompletionTime, m_PerformanceFrequency));
+	}
+
+	m_LastCompletionTime = CompletionTime;
+
+	FifoWorkItem->CompletionTime = CompletionTime;
+
+	DbgTrace(DBG_TRACE_SYNCH_COMPLETE, m_PipeInformation.EndpointAddress, FifoWorkItem->Urb->UrbIsochronousTransfer.StartFrame, ULONG(ntStatus), FifoWorkItem->Urb->UrbIsochronousTransfer.TransferBufferLength);
+
+	for (ULONG i = 0; i < FifoWorkItem->Urb->UrbIsochronousTransfer.NumberOfPackets; i++)
+	{
+		if (NT_SUCCESS(ntStatus))
+		{
+			HistogramAdd(&m_Statistics.PacketStatus, PacketStatusClass(FifoWorkItem->Urb->UrbIsochronousTransfer.IsoPacket[i].Status));
+		}
+		else
+		{
+			HistogramAdd(&m_Statistics.PacketStatus, AUDIO_PACKET_STATUS_IRP_FAILED);
+		}
+	}
+}
+
+/*****************************************************************************
+ * CAudioSynchPipe::RecordSubmission()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Record the submission of an IRP.
+ */
+VOID
+CAudioSynchPipe::
+RecordSubmission
+(
+	IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
+)
+{
+	if (FifoWorkItem->CompletionTime)
+	{
+		HistogramRecord(&m_Statistics.ResubmitLatency, HistogramElapsedTime(FifoWorkItem->CompletionTime, KeQueryPerformanceCounter(NULL).QuadPart, m_PerformanceFrequency));
+
+		FifoWorkItem->CompletionTime = 0;
+	}
+
+	DbgTrace(DBG_TRACE_SYNCH_SUBMIT, m_PipeInformation.EndpointAddress, ULONG(m_PendingIrps));
+}
+
+/*****************************************************************************
+ * CAudioSynchPipe::GetHistograms()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Take a snapshot of the transfer histograms.
+ */
+AUDIOSTATUS
+CAudioSynchPipe::
+GetHistograms
+(
+	OUT		PAUDIO_PIPE_HISTOGRAMS	OutHistograms
+)
+{
+	if (!OutHistograms)
+	{
+		return AUDIOERR_BAD_PARAM;
+	}
+
+	OutHistograms->InterfaceNumber = m_InterfaceNumber;
+	OutHistograms->AlternateSetting = m_AlternateSetting;
+	OutHistograms->EndpointAddress = m_PipeInformation.EndpointAddress;
+
+	HistogramRead(&m_Statistics.CompletionInterval, OutHistograms->CompletionInterval);
+	HistogramRead(&m_Statistics.ResubmitLatency, OutHistograms->ResubmitLatency);
+	HistogramRead(&m_Statistics.FifoFill, OutHistograms->FifoFill);
+	HistogramRead(&m_Statistics.PacketStatus, OutHistograms->PacketStatus);
+
+	return AUDIOERR_SUCCESS;
+}
+
+/*****************************************************************************
+ * CAudioSynchPipe::ResetHistograms()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Clear the transfer histograms.
+ */
+AUDIOSTATUS
+CAudioSynchPipe::
+ResetHistograms
+(	void
+)
+{
+	HistogramReset(&m_Statistics.CompletionInterval);
+	HistogramReset(&m_Statistics.ResubmitLatency);
+	HistogramReset(&m_Statistics.FifoFill);
+	HistogramReset(&m_Statistics.PacketStatus);
+
+	return AUDIOERR_SUCCESS;
+}
+
 /*****************************************************************************
  * CAudioSynchPipe::Service()
  *****************************************************************************
@@ -3128,6 +3299,8 @@ Service
 	}
 	else
 	{
+		RecordCompletion(ntStatus, FifoWorkItem);
+
 		if (FifoWorkItem->Read)
 		{
 			for (ULONG i = 0; i < FifoWorkItem->Urb->UrbIsochronousTransfer.NumberOfPackets; i++) 
@@ -3165,6 +3338,8 @@ Service
 
 			InitializeFifoWorkItemUrb(FifoWorkItem);
 
+			RecordSubmission(FifoWorkItem);
+
 			NTSTATUS ntStatus = m_UsbDevice->RecycleIrp(FifoWorkItem->Urb, FifoWorkItem->Irp, IoCompletionRoutine, (PVOID)FifoWorkItem);
 		}
 		else
@@ -3237,6 +3412,8 @@ CAudioDataPipe::
 
 	FreeResources();
 
+	m_FifoSlab.Free();
+
 	if (m_UsbDevice)
 	{
 		m_UsbDevice->Release();
@@ -3282,6 +3459,34 @@ Init
 
 	m_PendingIrps = 0;
 
+	m_TotalBytesCopied = 0;
+
+	m_TotalBytesMapped = 0;
+
+	m_NumberOfFifoWorkItems = 0;
+
+	m_AdaptiveTransferDepth = FALSE;
+
+	m_TransferLatency = 0;
+
+	m_LateCompletions = m_DepthIncreases = m_DepthDecreases = 0;
+
+	m_NextStartFrameValid = FALSE;
+
+	RateEstimatorInit(&m_RateEstimator, 0);
+
+	m_ImplicitFeedbackPipe = NULL;
+
+	m_ImplicitFeedbackQueue.Init();
+
+	LARGE_INTEGER PerformanceFrequency; KeQueryPerformanceCounter(&PerformanceFrequency);
+
+	m_PerformanceFrequency = PerformanceFrequency.QuadPart;
+
+	m_LastCompletionTime = 0;
+
+	ResetHistograms();
+
 	KeInitializeEvent(&m_NoPendingIrpEvent, NotificationEvent, FALSE);
 
 	PUSB_AUDIO_ENDPOINT_DESCRIPTOR EndpointDescriptor = NULL;
@@ -3305,7 +3510,16 @@ Init
 	
 	m_Attributes = CsAsEndpointDescriptor->bmAttributes;
 
-	m_NumberOfPacketsPerMs = (m_IsDeviceHighSpeed) ? (8 / (1 << (m_PipeInformation.Interval - 1))) : m_PipeInformation.Interval;
+	// A high speed endpoint takes a packet every 2^(bInterval-1) micro-frames.
+	// Intervals of a frame or more come down to a packet per frame.
+	if (m_IsDeviceHighSpeed && (m_PipeInformation.Interval >= 1) && (m_PipeInformation.Interval <= 4))
+	{
+		m_NumberOfPacketsPerMs = 8 >> (m_PipeInformation.Interval - 1);
+	}
+	else
+	{
+		m_NumberOfPacketsPerMs = 1;
+	}
 
 	RestoreParameterBlock();
 
@@ -3512,15 +3726,24 @@ SetTransferParameters
 	// Number of bytes per sample.
 	m_SampleFrameSize = FormatChannels * (SampleSize / 8);
 
-	// The average number of sample frames per ms.
-	m_FfPerPacketInterval.Whole = SampleRate / 1000 / m_NumberOfPacketsPerMs;
+	// The average number of sample frames per packet interval (a micro-frame
+	// on high speed devices), in 1/(1000 << 16) of a frame. The division is
+	// exact for 1, 2, 4 and 8 packets per ms, so the packets add up to the
+	// sample rate whatever it is (44.1 kHz at 8 packets per ms is 5.5125 
+	// frames per packet).
+	ULONGLONG FfPerPacketInterval = (ULONGLONG(SampleRate) << 16) / m_NumberOfPacketsPerMs;
+
+	m_FfPerPacketInterval.Whole = ULONG(FfPerPacketInterval / (1000 << 16));
 
 	// Ff.Fraction = 65536 * SampleFraction * 1000
-	m_FfPerPacketInterval.Fraction = ((SampleRate - ((SampleRate / 1000 ) * 1000)) / m_NumberOfPacketsPerMs) << 16;
+	m_FfPerPacketInterval.Fraction = ULONG(FfPerPacketInterval % (1000 << 16));
 
 	// Running sample frames fraction.
 	m_RunningFfFraction = 0;
 
+	// Filter the feedback around the nominal rate.
+	RateEstimatorInit(&m_RateEstimator, (LONGLONG(m_FfPerPacketInterval.Whole) * AUDIO_FF_UNIT) + m_FfPerPacketInterval.Fraction);
+
 	// Adjust the number of fifo buffers.
 	if (NumberOfFifoBuffers)
 	{
@@ -3546,9 +3769,17 @@ GetTransferSizeInFrames
 	IN		BOOL	UpdateRunningFfFraction
 )
 {
+	ULONG TransferSizeInFrames;
+
+	// Send what the paired input pipe received, packet for packet.
+	if (m_ImplicitFeedbackQueue.Get(NumberOfTransfers, UpdateRunningFfFraction, &TransferSizeInFrames))
+	{
+		return TransferSizeInFrames;
+	}
+
 	ULONG RunningFfFraction = m_RunningFfFraction + (m_FfPerPacketInterval.Fraction * NumberOfTransfers);
 
-	ULONG TransferSizeInFrames = (m_FfPerPacketInterval.Whole * NumberOfTransfers) + (RunningFfFraction / (1000 << 16));
+	TransferSizeInFrames = (m_FfPerPacketInterval.Whole * NumberOfTransfers) + (RunningFfFraction / (1000 << 16));
 
 	if (UpdateRunningFfFraction)
 	{
@@ -3572,30 +3803,157 @@ OnSampleRateSynchronization
 	IN		ULONG	FfFraction
 )
 {
-	if ((FfWhole != m_FfPerPacketInterval.Whole) || (FfFraction != m_FfPerPacketInterval.Fraction))
+	if ((FfWhole * m_SampleFrameSize) > m_PipeInformation.MaximumPacketSize)
 	{
-		//DbgPrint("%d.%03d ", FfWhole, FfFraction);
-		//DbgPrint("%d.%04d ", FfWhole, (10*FfFraction)>>16);
-		//DbgPrint("Old sample rate: %d.%04d\n", m_FfPerPacketInterval.Whole, (10*m_FfPerPacketInterval.Fraction)>>16);
-		//DbgPrint("New sample rate: %d.%04d\n", FfWhole, (10*FfFraction)>>16);
-
-		if ((FfWhole * m_SampleFrameSize) > m_PipeInformation.MaximumPacketSize)
-		{
-			//DbgPrint("---Bad sync packet--- ignoring it...\n");
-			return;
-		}
+		//DbgPrint("---Bad sync packet--- ignoring it...\n");
+		m_RateEstimator.Rejected++;
+		return;
 	}
 
-	// The number of sample frames per packet interval.
-	m_FfPerPacketInterval.Whole = FfWhole;
+	LONGLONG Measured = (LONGLONG(FfWhole) * AUDIO_FF_UNIT) + FfFraction;
 
-	m_FfPerPacketInterval.Fraction = FfFraction;
-}
+	BOOL Accepted = RateEstimatorUpdate(&m_RateEstimator, Measured);
 
-/*****************************************************************************
- * CAudioDataPipe::SetCallbackClient()
- *****************************************************************************
- * @ingroup AUDIO_GROUP
+	// Rates in the trace are in 16.16 frames per packet interval.
+	DbgTrace(DBG_TRACE_FEEDBACK, m_PipeInformation.EndpointAddress, ULONG(Measured / 1000), ULONG(RateEstimatorRate(&m_RateEstimator) / 1000), Accepted);
+
+	if (Accepted)
+	{
+		LONGLONG Rate = RateEstimatorRate(&m_RateEstimator);
+
+		//DbgPrint("%d.%04d -> %d.%04d\n", FfWhole, (10*FfFraction)>>16, ULONG(Rate / AUDIO_FF_UNIT), ULONG(10 * (Rate % AUDIO_FF_UNIT)) >> 16);
+
+		// The number of sample frames per packet interval.
+		m_FfPerPacketInterval.Whole = ULONG(Rate / AUDIO_FF_UNIT);
+
+		m_FfPerPacketInterval.Fraction = ULONG(Rate % AUDIO_FF_UNIT);
+	}
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::GetClockRatio()
+ *****************************************************************************
+ * @ingroup AUDIO_GROUP
+ * @brief
+ * Get the ratio of the device clock to the nominal sample rate, as estimated
+ * from the feedback endpoint.
+ * @param
+ * OutClockRatio Pointer to a location to which the method outputs the ratio
+ * in Q2.30 fixed-point. It is 1.0 if the pipe has no feedback.
+ */
+AUDIOSTATUS
+CAudioDataPipe::
+GetClockRatio
+(
+	OUT		PULONG	OutClockRatio
+)
+{
+	if (OutClockRatio)
+	{
+		*OutClockRatio = RateEstimatorRatio(&m_RateEstimator);
+	}
+
+	return AUDIOERR_SUCCESS;
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::SetImplicitFeedbackPipe()
+ *****************************************************************************
+ * @ingroup AUDIO_GROUP
+ * @brief
+ * Pace an output pipe with the packets received on this input pipe.
+ * @details
+ * The output pipe sizes each packet from the next packet received here, so
+ * both directions move the same number of frames. The pipes are only paired
+ * if they run at the same rate and number of packets per ms. When an output
+ * pipe is paired again, the sizes still queued from its previous pairing are
+ * dropped.
+ * @param
+ * OutputPipe The output pipe, or NULL to stop pacing it.
+ * @return
+ * Returns AUDIOERR_SUCCESS if successful, AUDIOERR_BAD_PARAM if the pipes
+ * cannot be paired.
+ */
+AUDIOSTATUS
+CAudioDataPipe::
+SetImplicitFeedbackPipe
+(
+	IN		CAudioDataPipe *	OutputPipe
+)
+{
+	if (OutputPipe)
+	{
+		if ((m_Direction != AUDIO_INPUT) || (OutputPipe->m_Direction != AUDIO_OUTPUT) ||
+			(OutputPipe->m_SampleRate != m_SampleRate) || (OutputPipe->m_NumberOfPacketsPerMs != m_NumberOfPacketsPerMs))
+		{
+			m_ImplicitFeedbackPipe = NULL;
+
+			return AUDIOERR_BAD_PARAM;
+		}
+
+		if (OutputPipe != m_ImplicitFeedbackPipe)
+		{
+			// GetTransferSizeInFrames() skips what was queued until now.
+			OutputPipe->m_ImplicitFeedbackQueue.Restart();
+		}
+	}
+
+	m_ImplicitFeedbackPipe = OutputPipe;
+
+	return AUDIOERR_SUCCESS;
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::OnImplicitFeedback()
+ *****************************************************************************
+ * @ingroup AUDIO_GROUP
+ * @brief
+ * Queue the sizes of the packets received by the paired input pipe.
+ * @details
+ * Called by the input pipe on completion. A packet that failed is queued at
+ * the nominal size so that the packets stay in step. If FlushBuffer() runs
+ * out of sizes, it falls back to the nominal rate for that packet, which
+ * adds one packet of lead; this settles after a few packets.
+ * @param
+ * FifoWorkItem The completed input work item.
+ * @param
+ * SampleFrameSize Size of a sample frame on the input pipe.
+ */
+VOID
+CAudioDataPipe::
+OnImplicitFeedback
+(
+	IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem,
+	IN		ULONG					SampleFrameSize
+)
+{
+	ULONG WriteIndex = m_ImplicitFeedbackQueue.BeginPut();
+
+	for (ULONG i = 0; i < FifoWorkItem->Urb->UrbIsochronousTransfer.NumberOfPackets; i++) 
+	{
+		ULONG NumberOfFrames = m_FfPerPacketInterval.Whole;
+
+		if (USBD_SUCCESS(FifoWorkItem->Urb->UrbIsochronousTransfer.IsoPacket[i].Status))
+		{
+			NumberOfFrames = FifoWorkItem->Urb->UrbIsochronousTransfer.IsoPacket[i].Length / SampleFrameSize;
+		}
+
+		if (!m_ImplicitFeedbackQueue.Put(WriteIndex, NumberOfFrames))
+		{
+			// Nobody is consuming them.
+			break;
+		}
+
+		WriteIndex++;
+	}
+
+	m_ImplicitFeedbackQueue.EndPut(WriteIndex);
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::SetCallbackClient()
+ *****************************************************************************
+ * @ingroup AUDIO_GROUP
  * @brief
  */
 AUDIOSTATUS
@@ -3635,15 +3993,26 @@ AcquireResources
 
     KeInitializeEvent(&m_NoPendingIrpEvent, NotificationEvent, FALSE);
 
+	ULONG NumberOfFifoWorkItems;
+
 	if (m_Direction == AUDIO_OUTPUT)
 	{
-		audioStatus = PrepareFifoWorkItems((NumberOfIrps >= MAX_AUDIO_OUTPUT_IRP) ? MAX_AUDIO_OUTPUT_IRP : NumberOfIrps, FALSE, FALSE);
+		NumberOfFifoWorkItems = (NumberOfIrps >= MAX_AUDIO_OUTPUT_IRP) ? MAX_AUDIO_OUTPUT_IRP : NumberOfIrps;
+
+		audioStatus = PrepareFifoWorkItems(NumberOfFifoWorkItems, FALSE, FALSE);
 	}
 	else
 	{
-		audioStatus = PrepareFifoWorkItems((NumberOfIrps >= MAX_AUDIO_INPUT_IRP) ? MAX_AUDIO_INPUT_IRP : NumberOfIrps, TRUE, FALSE);
+		NumberOfFifoWorkItems = (NumberOfIrps >= MAX_AUDIO_INPUT_IRP) ? MAX_AUDIO_INPUT_IRP : NumberOfIrps;
+
+		audioStatus = PrepareFifoWorkItems(NumberOfFifoWorkItems, TRUE, FALSE);
 	}
 
+	m_NumberOfFifoWorkItems = AUDIO_SUCCESS(audioStatus) ? NumberOfFifoWorkItems : 0;
+
+	// Fit the transfer depth to the new number of IRPs.
+	SetTransferDepth(m_AdaptiveTransferDepth, m_TransferLatency);
+
 	KeReleaseMutex(&m_PipeStateLock, FALSE);
 
 	return audioStatus;
@@ -3673,17 +4042,27 @@ FreeResources
 
 	KeWaitForMutexObject(&m_PipeStateLock, Executive, KernelMode, FALSE, NULL);
 
+	// The work items belong to the slab, which keeps them for the next
+	// PrepareFifoWorkItems(). Items queued on a pipe that was never started
+	// are idle too.
 	m_FreeFifoWorkItemList.Lock();
+	m_FreeFifoWorkItemList.RemoveAllItems();
+	m_FreeFifoWorkItemList.Unlock();
 
-	for (PAUDIO_FIFO_WORK_ITEM FifoWorkItem = m_FreeFifoWorkItemList.Pop(); FifoWorkItem; FifoWorkItem = m_FreeFifoWorkItemList.Pop())
-	{
-		FifoWorkItem->Destruct();
-	}
+	m_QueuedFifoWorkItemList.Lock();
+	m_QueuedFifoWorkItemList.RemoveAllItems();
+	m_QueuedFifoWorkItemList.Unlock();
 
-	m_FreeFifoWorkItemList.Unlock();
+	m_UnmapFifoWorkItemList.Lock();
+	m_UnmapFifoWorkItemList.RemoveAllItems();
+	m_UnmapFifoWorkItemList.Unlock();
 
 	RtlZeroMemory(m_FifoWorkItem, sizeof(m_FifoWorkItem));
 
+	m_NumberOfFifoWorkItems = 0;
+
+	m_TransferDepth = m_MinimumTransferDepth = 0;
+
 	KeReleaseMutex(&m_PipeStateLock, FALSE);
 
 	return audioStatus;
@@ -3707,8 +4086,15 @@ FlushBuffer
 
 	if (m_Direction == AUDIO_OUTPUT)
 	{
+		// FlushBuffer() is called both from WriteBuffer() and from the
+		// completion routine. The client lock makes sure only one of them
+		// consumes from the FIFO at a time. The producer doesn't take it.
 		m_Client->Lock();
 
+		// Give the frames of the work items released since the last flush
+		// back to the producer; see ReleaseFifoWorkItem().
+		UnmapFifoWorkItems();
+
 		if (m_SynchronizeStart)
 		{
 			ULONG FrameNumber = m_UsbDevice->GetSyncFrameNumber();
@@ -3724,6 +4110,8 @@ FlushBuffer
 
 					if (!m_ResyncRequested)
 					{
+						DbgTrace(DBG_TRACE_RESYNC, m_PipeInformation.EndpointAddress, m_StartFrameNumber, FrameNumber);
+
 						m_Client->RequestDriverResync();
 
 						m_ResyncRequested = TRUE;
@@ -3755,6 +4143,8 @@ FlushBuffer
 					// starving, ie not enough data to feed the playback stream.
 					if ((m_AutoResyncCount >= 50) && (Delta < (AUDIO_CLIENT_INPUT_BUFFERSIZE-5)))
 					{
+						DbgTrace(DBG_TRACE_RESYNC, m_PipeInformation.EndpointAddress, m_StartFrameNumber, FrameNumber);
+
 						m_Client->RequestDriverResync();
 					}
 				}
@@ -3769,7 +4159,8 @@ FlushBuffer
 		{
 			m_FreeFifoWorkItemList.Lock();
 
-			PAUDIO_FIFO_WORK_ITEM FifoWorkItem = m_FreeFifoWorkItemList.Pop();
+			// Keep no more than m_TransferDepth IRPs queued or in flight.
+			PAUDIO_FIFO_WORK_ITEM FifoWorkItem = ((m_NumberOfFifoWorkItems - m_FreeFifoWorkItemList.Count()) < m_TransferDepth) ? m_FreeFifoWorkItemList.Pop() : NULL;
 
 			m_FreeFifoWorkItemList.Unlock();
 
@@ -3779,6 +4170,10 @@ FlushBuffer
 
 				FifoWorkItem->BytesInFifoBuffer = 0;
 
+				// Lay out the packets first, then take the frames out of the
+				// FIFO in one go.
+				ULONG FramesQueued = m_Client->GetNumQueuedFrames();
+
 				for (ULONG i = 0; i < FifoWorkItem->Urb->UrbIsochronousTransfer.NumberOfPackets; i++) 
 				{
 					// Calculate the packet size.
@@ -3799,7 +4194,11 @@ FlushBuffer
 					// Setup the FIFO work item.
 					FifoWorkItem->Urb->UrbIsochronousTransfer.IsoPacket[i].Offset = (i) ? (FifoWorkItem->Urb->UrbIsochronousTransfer.IsoPacket[i-1].Offset + FifoWorkItem->Urb->UrbIsochronousTransfer.IsoPacket[i-1].Length) : 0;
 
-					FifoWorkItem->Urb->UrbIsochronousTransfer.IsoPacket[i].Length = m_Client->RemoveFramesFromFifo(FifoWorkItem->FifoBuffer + FifoWorkItem->Urb->UrbIsochronousTransfer.IsoPacket[i].Offset, PacketSize / m_SampleFrameSize) * m_SampleFrameSize;
+					ULONG FramesInPacket = (PacketSize / m_SampleFrameSize > FramesQueued) ? FramesQueued : PacketSize / m_SampleFrameSize;
+
+					FramesQueued -= FramesInPacket;
+
+					FifoWorkItem->Urb->UrbIsochronousTransfer.IsoPacket[i].Length = FramesInPacket * m_SampleFrameSize;
 
 					m_PacketDeficitInBytes += (FifoWorkItem->Urb->UrbIsochronousTransfer.IsoPacket[i].Length - PacketSize);
 
@@ -3813,10 +4212,33 @@ FlushBuffer
 
 				FifoWorkItem->Urb->UrbIsochronousTransfer.TransferBufferLength = FifoWorkItem->BytesInFifoBuffer;
 
+				ULONG NumberOfFrames = FifoWorkItem->BytesInFifoBuffer / m_SampleFrameSize;
+
+				#ifdef AUDIO_DIRECT_FIFO_TRANSFER
+				PUCHAR TransferBuffer = m_Client->MapFramesInFifo(NumberOfFrames, &FifoWorkItem->FifoMapping);
+
+				if (TransferBuffer)
+				{
+					FifoWorkItem->Urb->UrbIsochronousTransfer.TransferBuffer = TransferBuffer;
+
+					FifoWorkItem->FifoMapped = TRUE;
+
+					m_TotalBytesMapped += FifoWorkItem->BytesInFifoBuffer;
+				}
+				else
+				#endif // AUDIO_DIRECT_FIFO_TRANSFER
+				{
+					m_Client->RemoveFramesFromFifo(FifoWorkItem->FifoBuffer, NumberOfFrames);
+
+					m_TotalBytesCopied += FifoWorkItem->BytesInFifoBuffer;
+				}
+
 				if (m_PipeState == AUDIO_DATA_PIPE_STATE_RUN)
 				{
 					KeInitializeEvent(&m_NoPendingIrpEvent, NotificationEvent, FALSE);
 
+					RecordSubmission(FifoWorkItem, m_Client->GetNumQueuedFrames());
+
 					InterlockedIncrement(&m_PendingIrps);
 
 					m_PendingFifoWorkItemList.Lock();	
@@ -3829,6 +4251,8 @@ FlushBuffer
 				}
 				else
 				{
+					FifoWorkItem->CompletionTime = 0;
+
 					m_QueuedFifoWorkItemList.Lock();	
 
 					m_QueuedFifoWorkItemList.Put(FifoWorkItem);
@@ -4123,8 +4547,12 @@ PrepareFullSpeedFifoWorkItems
 
     //_DbgPrintF(DEBUGLVL_BLAB,("[CAudioDataPipe::PrepareFullSpeedFifoWorkItems] - StageSize: %d, NumFifoWorkItems: %d", StageSize, NumFifoWorkItems));
 	
-	// Allocate the sub requests.
-	for (ULONG i = 0; i < NumFifoWorkItems; i++)
+	// The slab is sized for the most IRPs the pipe ever uses, so it is only
+	// allocated the first time through.
+	ntStatus = m_FifoSlab.Allocate(m_UsbDevice, MAX_AUDIO_IRP, NumberOfPackets, StageSize);
+
+	// Set up the sub requests.
+	for (ULONG i = 0; (i < NumFifoWorkItems) && NT_SUCCESS(ntStatus); i++)
 	{
 		// The following outer scope variables are updated during each
 		// iteration of the loop:  virtualAddress, TotalLength, stageSize
@@ -4132,14 +4560,13 @@ PrepareFullSpeedFifoWorkItems
 		// For every stage of transfer we need to do the following
 		// tasks:
 		//
-		// 1. Allocate a FIFO work item.
-		// 2. Allocate a sub request IRP.
-		// 3. Allocate a sub request URB.
-		// 4. Initialize the above allocations.
+		// 1. Get a FIFO work item from the slab.
+		// 2. Set up the sub request URB.
+		// 3. Set up the transfer buffer.
 		//
 
-		// 1. Allocate a FIFO work item.
-		PAUDIO_FIFO_WORK_ITEM FifoWorkItem = new(NonPagedPool) AUDIO_FIFO_WORK_ITEM();
+		// 1. Get a FIFO work item, with its IRP and URB, from the slab.
+		PAUDIO_FIFO_WORK_ITEM FifoWorkItem = m_FifoSlab.GetItem(i);
 
 		if (FifoWorkItem == NULL)
 		{
@@ -4155,34 +4582,16 @@ PrepareFullSpeedFifoWorkItems
 			FifoWorkItem->Context = this;
 			FifoWorkItem->Read = Read;
 			FifoWorkItem->Tag = NULL;
+			FifoWorkItem->FifoMapped = FALSE;
 
-			// 2. Allocate a sub request irp
-			ntStatus = m_UsbDevice->CreateIrp(&FifoWorkItem->Irp);
-		}
-
-		if (NT_SUCCESS(ntStatus))
-		{
-			// 3. Allocate a sub request URB.
+			// 2. Set up the sub request URB.
 
 			//_DbgPrintF(DEBUGLVL_BLAB,("[CAudioDataPipe::PrepareFullSpeedFifoWorkItems] - NumberOfPackets: %d for IRP/URB pair %d.", NumberOfPackets, i));
 
 			FifoWorkItem->NumberOfPackets = NumberOfPackets;
 			FifoWorkItem->PacketSize = PacketSize;
 
-			ULONG UrbSize = GET_ISO_URB_SIZE(NumberOfPackets);
-
-			FifoWorkItem->Urb = (PURB)ExAllocatePoolWithTag(NonPagedPool, UrbSize, 'mdW');
-
-			if (FifoWorkItem->Urb == NULL)
-			{
-				ntStatus = STATUS_INSUFFICIENT_RESOURCES;
-			}
-		}
-
-		if (NT_SUCCESS(ntStatus))
-		{
-			// 4. The buffer.
-			FifoWorkItem->FifoBuffer = PUCHAR(ExAllocatePoolWithTag(NonPagedPool, StageSize, 'mdW'));
+			// 3. The buffer.
 			FifoWorkItem->FifoBufferSize = StageSize;
 			FifoWorkItem->BytesInFifoBuffer = 0;
 			FifoWorkItem->TransferSize = 0;
@@ -4198,10 +4607,8 @@ PrepareFullSpeedFifoWorkItems
 
 	if (!NT_SUCCESS(ntStatus))
 	{
-		for (PAUDIO_FIFO_WORK_ITEM FifoWorkItem = m_FreeFifoWorkItemList.Pop(); FifoWorkItem; FifoWorkItem = m_FreeFifoWorkItemList.Pop())
-		{
-			FifoWorkItem->Destruct();
-		}
+		// The work items stay in the slab.
+		m_FreeFifoWorkItemList.RemoveAllItems();
 	}
 
 	return ntStatus;
@@ -4214,12 +4621,16 @@ PrepareFullSpeedFifoWorkItems
  * @brief
  * Prepare FIFO work item to perform high speed isochronous transfer.
  * @details
- * This routine splits up a main isoch transfer request into one or
- * more sub requests as necessary.  Each isoch irp/urb pair can span at
- * most 1024 packets.
- * 1. It creates a SUB_REQUEST_CONTEXT for each IRP/URB pair and
- *    attaches it to the main request irp.
- * 2. It intializes all of the sub request IRP/URB pairs.
+ * Each IRP/URB pair carries one frame: a packet per micro-frame at the
+ * endpoint's interval (m_NumberOfPacketsPerMs). The output packets are
+ * sized a micro-frame at a time (GetTransferSizeInFrames(1) in Service()),
+ * so the samples go out on the micro-frame they are due, and a period of
+ * any size ends on the same micro-frame as a sample clock would have it,
+ * to within one packet interval.
+ * The USB stack only takes high speed isochronous URBs of a whole number
+ * of frames (a multiple of the packets per frame), so a frame is also the
+ * shortest IRP: the completions come once per ms, and an ASIO buffer
+ * shorter than that completes with the others of the same frame.
  */
 NTSTATUS
 CAudioDataPipe::
@@ -4230,7 +4641,6 @@ PrepareHighSpeedFifoWorkItems
 	IN		BOOL	TransferAsap
 )
 {
-	//TODO: //FIXME: Implement this and verify that this works correctly...
 	NTSTATUS ntStatus = STATUS_SUCCESS;
 
     _DbgPrintF(DEBUGLVL_BLAB,("[CAudioDataPipe::PrepareHighSpeedFifoWorkItems]"));
@@ -4240,24 +4650,25 @@ PrepareHighSpeedFifoWorkItems
 	
 	//_DbgPrintF(DEBUGLVL_BLAB,("[CAudioDataPipe::PrepareHighSpeedFifoWorkItems] - PacketSize: %d, Interval: %d", m_PipeInformation.MaximumPacketSize, m_PipeInformation.Interval));
 
+	// One frame of micro-frame packets.
 	ULONG NumberOfPackets = m_NumberOfPacketsPerMs;
 
+	ASSERT((NumberOfPackets == 1) || (NumberOfPackets == 2) || (NumberOfPackets == 4) || (NumberOfPackets == 8));
+
 	//_DbgPrintF(DEBUGLVL_BLAB,("[CAudioDataPipe::PrepareHighSpeedFifoWorkItems] - TotalLength: %d, PacketSize: %d", TotalLength, PacketSize));
 	
-    // There is an inherent limit on the number of packets that can be
-    // passed down the stack with each irp/urb pair (255)
-    //
-    // If the number of required packets is > 255, we shall create
-    // "(required-packets / NotificationInterval) [+ 1]" number of irp/urb pairs.
-    //
     // Each irp/urb pair transfer is also called a stage transfer.
     //
 	ULONG StageSize = PacketSize * NumberOfPackets;
 
     //_DbgPrintF(DEBUGLVL_BLAB,("[CAudioDataPipe::PrepareHighSpeedFifoWorkItems] - StageSize: %d, NumFifoWorkItems: %d", StageSize, NumFifoWorkItems));
 	
-	// Allocate the sub requests.
-	for (ULONG i = 0; i < NumFifoWorkItems; i++)
+	// The slab is sized for the most IRPs the pipe ever uses, so it is only
+	// allocated the first time through.
+	ntStatus = m_FifoSlab.Allocate(m_UsbDevice, MAX_AUDIO_IRP, NumberOfPackets, StageSize);
+
+	// Set up the sub requests.
+	for (ULONG i = 0; (i < NumFifoWorkItems) && NT_SUCCESS(ntStatus); i++)
 	{
 		// The following outer scope variables are updated during each
 		// iteration of the loop:  virtualAddress, TotalLength, stageSize
@@ -4265,14 +4676,13 @@ PrepareHighSpeedFifoWorkItems
 		// For every stage of transfer we need to do the following
 		// tasks:
 		//
-		// 1. Allocate a FIFO work item.
-		// 2. Allocate a sub request IRP.
-		// 3. Allocate a sub request URB.
-		// 4. Initialize the above allocations.
+		// 1. Get a FIFO work item from the slab.
+		// 2. Set up the sub request URB.
+		// 3. Set up the transfer buffer.
 		//
 
-		// 1. Allocate a FIFO work item.
-		PAUDIO_FIFO_WORK_ITEM FifoWorkItem = new(NonPagedPool) AUDIO_FIFO_WORK_ITEM();
+		// 1. Get a FIFO work item, with its IRP and URB, from the slab.
+		PAUDIO_FIFO_WORK_ITEM FifoWorkItem = m_FifoSlab.GetItem(i);
 
 		if (FifoWorkItem == NULL)
 		{
@@ -4288,34 +4698,16 @@ PrepareHighSpeedFifoWorkItems
 			FifoWorkItem->Context = this;
 			FifoWorkItem->Read = Read;
 			FifoWorkItem->Tag = NULL;
+			FifoWorkItem->FifoMapped = FALSE;
 
-			// 2. Allocate a sub request irp
-			ntStatus = m_UsbDevice->CreateIrp(&FifoWorkItem->Irp);
-		}
-
-		if (NT_SUCCESS(ntStatus))
-		{
-			// 3. Allocate a sub request URB.
+			// 2. Set up the sub request URB.
 
 			//_DbgPrintF(DEBUGLVL_BLAB,("[CAudioDataPipe::PrepareHighSpeedFifoWorkItems] - NumberOfPackets: %d for IRP/URB pair %d.", NumberOfPackets, i));
 
 			FifoWorkItem->NumberOfPackets = NumberOfPackets;
 			FifoWorkItem->PacketSize = PacketSize;
 
-			ULONG UrbSize = GET_ISO_URB_SIZE(NumberOfPackets);
-
-			FifoWorkItem->Urb = (PURB)ExAllocatePoolWithTag(NonPagedPool, UrbSize, 'mdW');
-
-			if (FifoWorkItem->Urb == NULL)
-			{
-				ntStatus = STATUS_INSUFFICIENT_RESOURCES;
-			}
-		}
-
-		if (NT_SUCCESS(ntStatus))
-		{
-			// 4. The buffer.
-			FifoWorkItem->FifoBuffer = PUCHAR(ExAllocatePoolWithTag(NonPagedPool, StageSize, 'mdW'));
+			// 3. The buffer.
 			FifoWorkItem->FifoBufferSize = StageSize;
 			FifoWorkItem->BytesInFifoBuffer = 0;
 			FifoWorkItem->TransferSize = 0;
@@ -4331,10 +4723,8 @@ PrepareHighSpeedFifoWorkItems
 
 	if (!NT_SUCCESS(ntStatus))
 	{
-		for (PAUDIO_FIFO_WORK_ITEM FifoWorkItem = m_FreeFifoWorkItemList.Pop(); FifoWorkItem; FifoWorkItem = m_FreeFifoWorkItemList.Pop())
-		{
-			FifoWorkItem->Destruct();
-		}
+		// The work items stay in the slab.
+		m_FreeFifoWorkItemList.RemoveAllItems();
 	}
 
 	return ntStatus;
@@ -4374,6 +4764,17 @@ Start
 	{
 		m_PipeState = AUDIO_DATA_PIPE_STATE_RUN;
 
+		// Don't count the time the pipe was stopped or paused.
+		m_LastCompletionTime = 0;
+
+		for (ULONG i=0; i<MAX_AUDIO_IRP; i++)
+		{
+			if (m_FifoWorkItem[i])
+			{
+				m_FifoWorkItem[i]->CompletionTime = 0;
+			}
+		}
+
 		if (SynchronizeStart)
 		{
 			m_StartFrameNumber = StartFrameNumber;
@@ -4417,8 +4818,14 @@ Start
 
 			m_QueuedFifoWorkItemList.Lock();	
 
-			for (PAUDIO_FIFO_WORK_ITEM FifoWorkItem = m_FreeFifoWorkItemList.Pop(); FifoWorkItem; FifoWorkItem = m_FreeFifoWorkItemList.Pop())
+			// Only m_TransferDepth IRPs are started; the rest stay on the
+			// free list until the depth is increased.
+			for (ULONG i = 0; i < m_TransferDepth; i++)
 			{
+				PAUDIO_FIFO_WORK_ITEM FifoWorkItem = m_FreeFifoWorkItemList.Pop();
+
+				if (!FifoWorkItem) break;
+
 				InitializeFifoWorkItemUrb(FifoWorkItem);
 
 				if (NumberOfPacketsToSkip)
@@ -4559,26 +4966,49 @@ Stop
 	{
 		m_PipeState = AUDIO_DATA_PIPE_STATE_STOP;
 
-		m_FreeFifoWorkItemList.Lock();
+		// One at a time, as ReleaseFifoWorkItem() takes the other list locks.
+		for (;;)
+		{
+			m_QueuedFifoWorkItemList.Lock();	
 
-		m_QueuedFifoWorkItemList.Lock();	
+			PAUDIO_FIFO_WORK_ITEM FifoWorkItem = m_QueuedFifoWorkItemList.Pop();
 
-		for (PAUDIO_FIFO_WORK_ITEM FifoWorkItem = m_QueuedFifoWorkItemList.Pop(); FifoWorkItem; FifoWorkItem = m_QueuedFifoWorkItemList.Pop())
-		{
-			m_FreeFifoWorkItemList.Put(FifoWorkItem);
+			m_QueuedFifoWorkItemList.Unlock();	
+
+			if (!FifoWorkItem) break;
+
+			ReleaseFifoWorkItem(FifoWorkItem);
 		}
+	}
 
-		m_QueuedFifoWorkItemList.Unlock();	
+	// No IRP is pending any more, so the mapped work items can all go back
+	// to the free list.
+	if (m_Client)
+	{
+		m_Client->Lock();
 
-		m_FreeFifoWorkItemList.Unlock();
+		UnmapFifoWorkItems();
+
+		m_Client->Unlock();
+	}
+	else
+	{
+		UnmapFifoWorkItems();
 	}
 
 	m_TotalBytesTransfered = 0;
 
+	m_TotalBytesCopied = 0;
+
+	m_TotalBytesMapped = 0;
+
 	m_RunningFfFraction = 0;
 
 	m_PacketDeficitInBytes = 0;
 
+	// Drop the packet sizes received while stopped.
+	m_ImplicitFeedbackQueue.Flush();
+
 	KeReleaseMutex(&m_PipeStateLock, FALSE);
 
 	return audioStatus;
@@ -4602,6 +5032,10 @@ StartTransfer
 
 	m_PendingIrps = 0;
 
+	// The first completion starts the frame sequence AdjustTransferDepth()
+	// checks.
+	m_NextStartFrameValid = FALSE;
+
 	KeInitializeEvent(&m_NoPendingIrpEvent, NotificationEvent, FALSE);
 
 	m_QueuedFifoWorkItemList.Lock();
@@ -4691,6 +5125,81 @@ CancelTransfer
 	_DbgPrintF(DEBUGLVL_VERBOSE,("[CAudioDataPipe::CancelTransfer] - Done"));
 }
 
+/*****************************************************************************
+ * CAudioDataPipe::ReleaseFifoWorkItem()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Return a FIFO work item to the free list.
+ * @details
+ * If the work item transferred straight out of the client FIFO, its frames
+ * must be given back to the producer, which needs the client lock. This is
+ * called from the completion routine, and the IRP may have been failed
+ * synchronously from within FlushBuffer(), which holds that lock, so the
+ * work item is put on the unmap list instead; the next FlushBuffer() or
+ * Stop() frees it. Must not be called with any of the work item list locks
+ * held.
+ */
+VOID
+CAudioDataPipe::
+ReleaseFifoWorkItem
+(
+	IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
+)
+{
+	if (FifoWorkItem->FifoMapped)
+	{
+		m_UnmapFifoWorkItemList.Lock();
+		m_UnmapFifoWorkItemList.Put(FifoWorkItem);
+		m_UnmapFifoWorkItemList.Unlock();
+	}
+	else
+	{
+		m_FreeFifoWorkItemList.Lock();
+		m_FreeFifoWorkItemList.Put(FifoWorkItem);
+		m_FreeFifoWorkItemList.Unlock();
+	}
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::UnmapFifoWorkItems()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Unmap the work items on the unmap list and return them to the free list.
+ * @details
+ * Must be called with the client lock held, if there is a client, and none
+ * of the work item list locks.
+ */
+VOID
+CAudioDataPipe::
+UnmapFifoWorkItems
+(	void
+)
+{
+	for (;;)
+	{
+		m_UnmapFifoWorkItemList.Lock();
+
+		PAUDIO_FIFO_WORK_ITEM FifoWorkItem = m_UnmapFifoWorkItemList.Pop();
+
+		m_UnmapFifoWorkItemList.Unlock();
+
+		if (!FifoWorkItem) break;
+
+		if (m_Client)
+		{
+			m_Client->UnmapFramesInFifo(&FifoWorkItem->FifoMapping);
+		}
+
+		FifoWorkItem->FifoMapped = FALSE;
+
+		m_FreeFifoWorkItemList.Lock();
+		m_FreeFifoWorkItemList.Put(FifoWorkItem);
+		m_FreeFifoWorkItemList.Unlock();
+	}
+}
+
 /*****************************************************************************
  * CAudioDataPipe::GetPosition()
  *****************************************************************************
@@ -4706,28 +5215,229 @@ GetPosition
 {
 	if (OutTransferPosition)
 	{
-		*OutTransferPosition = m_TotalBytesTransfered;
+		*OutTransferPosition = m_TotalBytesTransfered;
+	}
+
+	return AUDIOERR_SUCCESS;
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::SetPosition()
+ *****************************************************************************
+ *//*!
+ * @brief
+ */
+AUDIOSTATUS 
+CAudioDataPipe::
+SetPosition
+(
+	IN		ULONGLONG 	TransferPosition
+)
+{
+	m_TotalBytesTransfered = TransferPosition;
+
+	return AUDIOERR_SUCCESS;
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::GetCopyStatistics()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Get the number of bytes copied from the client FIFO into the IRP buffers,
+ * and the number of bytes transferred straight out of it, since the pipe
+ * was last stopped.
+ */
+AUDIOSTATUS 
+CAudioDataPipe::
+GetCopyStatistics
+(
+	OUT		ULONGLONG *	OutBytesCopied,
+	OUT		ULONGLONG *	OutBytesMapped
+)
+{
+	if (OutBytesCopied)
+	{
+		*OutBytesCopied = m_TotalBytesCopied;
+	}
+
+	if (OutBytesMapped)
+	{
+		*OutBytesMapped = m_TotalBytesMapped;
+	}
+
+	return AUDIOERR_SUCCESS;
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::SetTransferDepth()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Set the number of IRPs the pipe keeps in flight.
+ * @details
+ * Each IRP carries 1 ms of audio, so the depth is the requested latency in
+ * ms, within AUDIO_TRANSFER_DEPTH_MINIMUM and the number of IRPs allocated.
+ * A latency of 0 uses all of them. If Adaptive is TRUE, the depth is then
+ * raised on late completions and lowered back towards the requested one
+ * after AUDIO_TRANSFER_DEPTH_CLEAN_RUN on-time completions. It takes effect
+ * as IRPs complete, so it can be changed while the pipe is running.
+ * @param
+ * Adaptive TRUE to follow the completion jitter.
+ * @param
+ * LatencyInMs Requested latency in ms.
+ * @return
+ * Returns AUDIOERR_SUCCESS.
+ */
+AUDIOSTATUS 
+CAudioDataPipe::
+SetTransferDepth
+(
+	IN		BOOL	Adaptive,
+	IN		ULONG	LatencyInMs
+)
+{
+	ULONG Depth = m_NumberOfFifoWorkItems;
+
+	if (LatencyInMs)
+	{
+		Depth = (LatencyInMs > AUDIO_TRANSFER_DEPTH_MINIMUM) ? LatencyInMs : AUDIO_TRANSFER_DEPTH_MINIMUM;
+
+		if (Depth > m_NumberOfFifoWorkItems)
+		{
+			Depth = m_NumberOfFifoWorkItems;
+		}
+	}
+
+	m_AdaptiveTransferDepth = Adaptive;
+
+	m_TransferLatency = LatencyInMs;
+
+	m_MinimumTransferDepth = Depth;
+
+	m_TransferDepth = Depth;
+
+	m_CleanCompletions = 0;
+
+	return AUDIOERR_SUCCESS;
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::GetTransferDepth()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Get the number of IRPs the pipe keeps in flight, and how it got there.
+ */
+AUDIOSTATUS 
+CAudioDataPipe::
+GetTransferDepth
+(
+	OUT		PAUDIO_TRANSFER_DEPTH	OutTransferDepth
+)
+{
+	if (OutTransferDepth)
+	{
+		OutTransferDepth->Adaptive = m_AdaptiveTransferDepth;
+		OutTransferDepth->LatencyInMs = m_TransferLatency;
+		OutTransferDepth->Depth = m_TransferDepth;
+		OutTransferDepth->MinimumDepth = m_MinimumTransferDepth;
+		OutTransferDepth->MaximumDepth = m_NumberOfFifoWorkItems;
+		OutTransferDepth->PacketsPerIrp = m_NumberOfPacketsPerMs;
+		OutTransferDepth->LateCompletions = m_LateCompletions;
+		OutTransferDepth->DepthIncreases = m_DepthIncreases;
+		OutTransferDepth->DepthDecreases = m_DepthDecreases;
+	}
+
+	return AUDIOERR_SUCCESS;
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::AdjustTransferDepth()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Adjust the transfer depth from a completed IRP.
+ * @details
+ * A completion is late if any of its packets failed, or if it doesn't start
+ * on the frame right after the last completed IRP, i.e. the IRPs behind it
+ * ran out and the host controller left frames empty. This runs at
+ * DISPATCH_LEVEL, so it only looks at the completed URB and never asks the
+ * bus for the current frame number, which may block.
+ */
+VOID
+CAudioDataPipe::
+AdjustTransferDepth
+(
+	IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
+)
+{
+	ULONG TransferDepth = m_TransferDepth;
+
+	BOOL Late = !NT_SUCCESS(FifoWorkItem->Irp->IoStatus.Status);
+
+	for (ULONG i = 0; (i < FifoWorkItem->Urb->UrbIsochronousTransfer.NumberOfPackets) && !Late; i++)
+	{
+		if (!USBD_SUCCESS(FifoWorkItem->Urb->UrbIsochronousTransfer.IsoPacket[i].Status))
+		{
+			Late = TRUE;
+		}
+	}
+
+	ULONG StartFrame = FifoWorkItem->Urb->UrbIsochronousTransfer.StartFrame;
+
+	if (!Late && m_NextStartFrameValid)
+	{
+		if (LONG(StartFrame - m_NextStartFrame) > 0)
+		{
+			Late = TRUE;
+		}
+	}
+
+	// The frame numbers of a failed URB can't be trusted, so wait for the next
+	// good one to pick up the sequence again.
+	if (NT_SUCCESS(FifoWorkItem->Irp->IoStatus.Status))
+	{
+		ULONG NumberOfFrames = FifoWorkItem->Urb->UrbIsochronousTransfer.NumberOfPackets / m_NumberOfPacketsPerMs;
+
+		m_NextStartFrame = StartFrame + ((NumberOfFrames) ? NumberOfFrames : 1);
+
+		m_NextStartFrameValid = TRUE;
+	}
+	else
+	{
+		m_NextStartFrameValid = FALSE;
 	}
 
-	return AUDIOERR_SUCCESS;
-}
+	if (Late)
+	{
+		m_LateCompletions++;
 
-/*****************************************************************************
- * CAudioDataPipe::SetPosition()
- *****************************************************************************
- *//*!
- * @brief
- */
-AUDIOSTATUS 
-CAudioDataPipe::
-SetPosition
-(
-	IN		ULONGLONG 	TransferPosition
-)
-{
-	m_TotalBytesTransfered = TransferPosition;
+		m_CleanCompletions = 0;
 
-	return AUDIOERR_SUCCESS;
+		if (m_TransferDepth < m_NumberOfFifoWorkItems)
+		{
+			m_TransferDepth++;
+
+			m_DepthIncreases++;
+		}
+	}
+	else if (++m_CleanCompletions >= AUDIO_TRANSFER_DEPTH_CLEAN_RUN)
+	{
+		m_CleanCompletions = 0;
+
+		if (m_TransferDepth > m_MinimumTransferDepth)
+		{
+			m_TransferDepth--;
+
+			m_DepthDecreases++;
+		}
+	}
+
+	if (m_TransferDepth != TransferDepth)
+	{
+		DbgTrace(DBG_TRACE_TRANSFER_DEPTH, m_PipeInformation.EndpointAddress, m_TransferDepth, Late);
+	}
 }
 
 /*****************************************************************************
@@ -5316,6 +6026,128 @@ ProcessFifoWorkItem
 	return ntStatus;
 }
 
+/*****************************************************************************
+ * CAudioDataPipe::RecordCompletion()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Record the completion of an IRP in the transfer histograms, and stamp it
+ * so that the time to its resubmission can be measured.
+ */
+VOID
+CAudioDataPipe::
+RecordCompletion
+(
+	IN		NTSTATUS				ntStatus,
+	IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
+)
+{
+	LONGLONG CompletionTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	if (m_LastCompletionTime)
+	{
+		HistogramRecord(&m_Statistics.CompletionInterval, HistogramElapsedTime(m_LastCompletionTime, CompletionTime, m_PerformanceFrequency));
+	}
+
+	m_LastCompletionTime = CompletionTime;
+
+	FifoWorkItem->CompletionTime = CompletionTime;
+
+	DbgTrace(DBG_TRACE_DATA_COMPLETE, m_PipeInformation.EndpointAddress, FifoWorkItem->Urb->UrbIsochronousTransfer.StartFrame, ULONG(ntStatus), FifoWorkItem->Urb->UrbIsochronousTransfer.TransferBufferLength);
+
+	for (ULONG i = 0; i < FifoWorkItem->Urb->UrbIsochronousTransfer.NumberOfPackets; i++)
+	{
+		if (NT_SUCCESS(ntStatus))
+		{
+			HistogramAdd(&m_Statistics.PacketStatus, PacketStatusClass(FifoWorkItem->Urb->UrbIsochronousTransfer.IsoPacket[i].Status));
+		}
+		else
+		{
+			HistogramAdd(&m_Statistics.PacketStatus, AUDIO_PACKET_STATUS_IRP_FAILED);
+		}
+	}
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::RecordSubmission()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Record the submission of an IRP, and the number of frames in the client
+ * FIFO at the time.
+ */
+VOID
+CAudioDataPipe::
+RecordSubmission
+(
+	IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem,
+	IN		ULONG					FramesInFifo
+)
+{
+	if (FifoWorkItem->CompletionTime)
+	{
+		HistogramRecord(&m_Statistics.ResubmitLatency, HistogramElapsedTime(FifoWorkItem->CompletionTime, KeQueryPerformanceCounter(NULL).QuadPart, m_PerformanceFrequency));
+
+		FifoWorkItem->CompletionTime = 0;
+	}
+
+	HistogramRecord(&m_Statistics.FifoFill, FramesInFifo);
+
+	DbgTrace(DBG_TRACE_DATA_SUBMIT, m_PipeInformation.EndpointAddress, ULONG(m_PendingIrps), FifoWorkItem->Urb->UrbIsochronousTransfer.TransferBufferLength, FramesInFifo);
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::GetHistograms()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Take a snapshot of the transfer histograms.
+ */
+AUDIOSTATUS
+CAudioDataPipe::
+GetHistograms
+(
+	OUT		PAUDIO_PIPE_HISTOGRAMS	OutHistograms
+)
+{
+	if (!OutHistograms)
+	{
+		return AUDIOERR_BAD_PARAM;
+	}
+
+	OutHistograms->InterfaceNumber = m_InterfaceNumber;
+	OutHistograms->AlternateSetting = m_AlternateSetting;
+	OutHistograms->EndpointAddress = m_PipeInformation.EndpointAddress;
+
+	HistogramRead(&m_Statistics.CompletionInterval, OutHistograms->CompletionInterval);
+	HistogramRead(&m_Statistics.ResubmitLatency, OutHistograms->ResubmitLatency);
+	HistogramRead(&m_Statistics.FifoFill, OutHistograms->FifoFill);
+	HistogramRead(&m_Statistics.PacketStatus, OutHistograms->PacketStatus);
+
+	return AUDIOERR_SUCCESS;
+}
+
+/*****************************************************************************
+ * CAudioDataPipe::ResetHistograms()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Clear the transfer histograms.
+ */
+AUDIOSTATUS
+CAudioDataPipe::
+ResetHistograms
+(	void
+)
+{
+	HistogramReset(&m_Statistics.CompletionInterval);
+	HistogramReset(&m_Statistics.ResubmitLatency);
+	HistogramReset(&m_Statistics.FifoFill);
+	HistogramReset(&m_Statistics.PacketStatus);
+
+	return AUDIOERR_SUCCESS;
+}
+
 /*****************************************************************************
  * CAudioDataPipe::Service()
  *****************************************************************************
@@ -5347,9 +6179,7 @@ Service
 		{
 			if (FifoWorkItem->Read)
 			{
-				m_FreeFifoWorkItemList.Lock();
-				m_FreeFifoWorkItemList.Put(FifoWorkItem);
-				m_FreeFifoWorkItemList.Unlock();
+				ReleaseFifoWorkItem(FifoWorkItem);
 			}
 			else
 			{
@@ -5360,9 +6190,7 @@ Service
 		}
 		else
 		{
-			m_FreeFifoWorkItemList.Lock();
-			m_FreeFifoWorkItemList.Put(FifoWorkItem);
-			m_FreeFifoWorkItemList.Unlock();
+			ReleaseFifoWorkItem(FifoWorkItem);
 		}
 
 		// This is the last irp to complete with this erroneous value. 
@@ -5381,9 +6209,7 @@ Service
 
 		if (FifoWorkItem->Read)
 		{
-			m_FreeFifoWorkItemList.Lock();
-			m_FreeFifoWorkItemList.Put(FifoWorkItem);
-			m_FreeFifoWorkItemList.Unlock();
+			ReleaseFifoWorkItem(FifoWorkItem);
 		}
 		else
 		{
@@ -5406,9 +6232,7 @@ Service
 		m_PendingFifoWorkItemList.Remove(FifoWorkItem);
 		m_PendingFifoWorkItemList.Unlock();
 
-		m_FreeFifoWorkItemList.Lock();
-		m_FreeFifoWorkItemList.Put(FifoWorkItem);
-		m_FreeFifoWorkItemList.Unlock();
+		ReleaseFifoWorkItem(FifoWorkItem);
 
 		// This is the last irp to complete with this erroneous value. 
 		// Signal an event.
@@ -5419,10 +6243,24 @@ Service
 	}
 	else
 	{
+		RecordCompletion(ntStatus, FifoWorkItem);
+
+		if (m_AdaptiveTransferDepth)
+		{
+			AdjustTransferDepth(FifoWorkItem);
+		}
+
 		if (FifoWorkItem->Read)
 		{
 			if (NT_SUCCESS(ntStatus))
 			{
+				CAudioDataPipe * ImplicitFeedbackPipe = m_ImplicitFeedbackPipe;
+
+				if (ImplicitFeedbackPipe)
+				{
+					ImplicitFeedbackPipe->OnImplicitFeedback(FifoWorkItem, m_SampleFrameSize);
+				}
+
 				if (m_IsDeviceHighSpeed)
 				{
 					m_Client->Lock();
@@ -5546,9 +6384,53 @@ Service
 				}
 			}
 
-			InitializeFifoWorkItemUrb(FifoWorkItem);
+			if (ULONG(m_PendingIrps) > m_TransferDepth)
+			{
+				// The depth was reduced. Park this IRP on the free list.
+				m_PendingFifoWorkItemList.Lock();
+				m_PendingFifoWorkItemList.Remove(FifoWorkItem);
+				m_PendingFifoWorkItemList.Unlock();
 
-			NTSTATUS ntStatus = m_UsbDevice->RecycleIrp(FifoWorkItem->Urb, FifoWorkItem->Irp, IoCompletionRoutine, (PVOID)FifoWorkItem);
+				FifoWorkItem->CompletionTime = 0;
+
+				ReleaseFifoWorkItem(FifoWorkItem);
+
+				InterlockedDecrement(&m_PendingIrps);
+			}
+			else
+			{
+				InitializeFifoWorkItemUrb(FifoWorkItem);
+
+				RecordSubmission(FifoWorkItem, m_Client->GetNumQueuedFrames());
+
+				NTSTATUS ntStatus = m_UsbDevice->RecycleIrp(FifoWorkItem->Urb, FifoWorkItem->Irp, IoCompletionRoutine, (PVOID)FifoWorkItem);
+
+				if (ULONG(m_PendingIrps) < m_TransferDepth)
+				{
+					// The depth was increased. Start a parked IRP right behind
+					// this one.
+					m_FreeFifoWorkItemList.Lock();
+
+					PAUDIO_FIFO_WORK_ITEM ParkedFifoWorkItem = m_FreeFifoWorkItemList.Pop();
+
+					m_FreeFifoWorkItemList.Unlock();
+
+					if (ParkedFifoWorkItem)
+					{
+						InitializeFifoWorkItemUrb(ParkedFifoWorkItem);
+
+						RecordSubmission(ParkedFifoWorkItem, m_Client->GetNumQueuedFrames());
+
+						InterlockedIncrement(&m_PendingIrps);
+
+						m_PendingFifoWorkItemList.Lock();	
+						m_PendingFifoWorkItemList.Put(ParkedFifoWorkItem);
+						m_PendingFifoWorkItemList.Unlock();	
+
+						m_UsbDevice->RecycleIrp(ParkedFifoWorkItem->Urb, ParkedFifoWorkItem->Irp, IoCompletionRoutine, (PVOID)ParkedFifoWorkItem);
+					}
+				}
+			}
 		}
 		else
 		{
@@ -5565,9 +6447,7 @@ Service
 				}
 			}
 
-			m_FreeFifoWorkItemList.Lock();
-			m_FreeFifoWorkItemList.Put(FifoWorkItem);
-			m_FreeFifoWorkItemList.Unlock();
+			ReleaseFifoWorkItem(FifoWorkItem);
 
 			if (InterlockedDecrement(&m_PendingIrps) == 0) 
 			{
@@ -7208,6 +8088,9 @@ Init
     }
 
     m_MasterMute        = FALSE;
+    m_MasterVolumeSerial = 0;
+
+	m_ImplicitFeedback = FALSE;
     m_requireSoftMaster = FALSE;    // default assume software master vol/mute is not required
     m_NoOfSoftNode      = 0;        // default no software node
 
@@ -7910,6 +8793,145 @@ Close
     return audioStatus;
 }
 
+/*****************************************************************************
+ * CAudioDevice::SetImplicitFeedback()
+ *****************************************************************************
+ * @ingroup AUDIO_GROUP
+ * @brief
+ * Enable or disable the implicit feedback mode.
+ * @details
+ * In implicit feedback mode, the playback data pipe sends as many frames per
+ * packet as the record data pipe received, so playback and record stay
+ * locked to the device clock without resync. It takes effect the next time
+ * a client starts or stops.
+ * @param
+ * Enable TRUE to enable the implicit feedback mode.
+ * @return
+ * Returns AUDIOERR_SUCCESS.
+ */
+AUDIOSTATUS
+CAudioDevice::
+SetImplicitFeedback
+(
+	IN		BOOL	Enable
+)
+{
+    PAGED_CODE();
+
+	m_ImplicitFeedback = Enable;
+
+	return AUDIOERR_SUCCESS;
+}
+
+/*****************************************************************************
+ * CAudioDevice::GetPipeHistograms()
+ *****************************************************************************
+ * @ingroup AUDIO_GROUP
+ * @brief
+ * Get the transfer histograms of a pipe.
+ * @details
+ * The pipes are recreated, and their histograms cleared, whenever an
+ * alternate setting is selected.
+ * @param
+ * InterfaceNumber The interface the pipe belongs to.
+ * SynchPipe TRUE for the synch pipe of the interface, FALSE for its data pipe.
+ * OutHistograms Pointer to the memory to receive the histograms.
+ * @return
+ * Returns AUDIOERR_SUCCESS if successful, or AUDIOERR_BAD_PARAM if the
+ * interface has no such pipe.
+ */
+AUDIOSTATUS
+CAudioDevice::
+GetPipeHistograms
+(
+	IN		UCHAR					InterfaceNumber,
+	IN		BOOL					SynchPipe,
+	OUT		PAUDIO_PIPE_HISTOGRAMS	OutHistograms
+)
+{
+    PAGED_CODE();
+
+	AUDIOSTATUS audioStatus = AUDIOERR_BAD_PARAM;
+
+	CAudioInterface * Interface = FindInterface(InterfaceNumber);
+
+	if (Interface)
+	{
+		if (SynchPipe)
+		{
+			CAudioSynchPipe * Pipe = Interface->FindSynchPipe();
+
+			if (Pipe)
+			{
+				audioStatus = Pipe->GetHistograms(OutHistograms);
+			}
+		}
+		else
+		{
+			CAudioDataPipe * Pipe = Interface->FindDataPipe();
+
+			if (Pipe)
+			{
+				audioStatus = Pipe->GetHistograms(OutHistograms);
+			}
+		}
+	}
+
+	return audioStatus;
+}
+
+/*****************************************************************************
+ * CAudioDevice::ResetPipeHistograms()
+ *****************************************************************************
+ * @ingroup AUDIO_GROUP
+ * @brief
+ * Clear the transfer histograms of a pipe.
+ * @param
+ * InterfaceNumber The interface the pipe belongs to.
+ * SynchPipe TRUE for the synch pipe of the interface, FALSE for its data pipe.
+ * @return
+ * Returns AUDIOERR_SUCCESS if successful, or AUDIOERR_BAD_PARAM if the
+ * interface has no such pipe.
+ */
+AUDIOSTATUS
+CAudioDevice::
+ResetPipeHistograms
+(
+	IN		UCHAR	InterfaceNumber,
+	IN		BOOL	SynchPipe
+)
+{
+    PAGED_CODE();
+
+	AUDIOSTATUS audioStatus = AUDIOERR_BAD_PARAM;
+
+	CAudioInterface * Interface = FindInterface(InterfaceNumber);
+
+	if (Interface)
+	{
+		if (SynchPipe)
+		{
+			CAudioSynchPipe * Pipe = Interface->FindSynchPipe();
+
+			if (Pipe)
+			{
+				audioStatus = Pipe->ResetHistograms();
+			}
+		}
+		else
+		{
+			CAudioDataPipe * Pipe = Interface->FindDataPipe();
+
+			if (Pipe)
+			{
+				audioStatus = Pipe->ResetHistograms();
+			}
+		}
+	}
+
+	return audioStatus;
+}
+
 
 /*****************************************************************************
  * CAudioDevice::GetMasterVolumeRange()
@@ -8061,6 +9083,9 @@ SetMasterVolume
 #endif
             }
         }
+
+        InterlockedIncrement(&m_MasterVolumeSerial);
+
         ntStatus = STATUS_SUCCESS;
     }
     DbgPrint("SetMasterVolume return ntStatus=%x channel=%x\n",ntStatus,channel);
@@ -8110,6 +9135,9 @@ SetMasterMute(
 )
 {
     m_MasterMute = mute;
+
+    InterlockedIncrement(&m_MasterVolumeSerial);
+
     return STATUS_SUCCESS;
 }
 
@@ -42,6 +42,10 @@
 #include "Terminal.h"
 
 #include "AudioFifo.h"
+#include "FifoSlab.h"
+#include "Feedback.h"
+#include "Histogram.h"
+#include "ImplicitFeedback.h"
 
 
 /*!
@@ -280,6 +284,70 @@ typedef CAudioInterruptPipe * PAUDIO_INTERRUPT_PIPE;
 #define MASTERVOL_0_DB                  0           // 0 dB
 #define MASTERVOL_1_DB                  65536
 #define MASTERVOL_STEP_SIZE_DB          32768       // 0.5 dB
+
+/*! @brief Smallest number of IRPs kept in flight on a data pipe. Each IRP carries 1 ms. */
+#define AUDIO_TRANSFER_DEPTH_MINIMUM	2
+/*! @brief Number of consecutive on-time completions before an adaptive data pipe drops one IRP. */
+#define AUDIO_TRANSFER_DEPTH_CLEAN_RUN	5000
+
+/*****************************************************************************
+ * AUDIO_TRANSFER_DEPTH
+ *****************************************************************************
+ * @brief
+ * Number of IRPs a data pipe keeps in flight, and how it got there.
+ */
+typedef struct
+{
+	BOOL	Adaptive;			/*!< @brief TRUE if the depth follows the completion jitter. */
+	ULONG	LatencyInMs;		/*!< @brief Requested latency in ms, or 0 for the maximum depth. */
+	ULONG	Depth;				/*!< @brief Current number of IRPs in flight. */
+	ULONG	MinimumDepth;		/*!< @brief Depth the pipe won't shrink below. */
+	ULONG	MaximumDepth;		/*!< @brief Number of IRPs allocated. */
+	ULONG	PacketsPerIrp;		/*!< @brief Number of isochronous packets in each IRP. */
+	ULONG	LateCompletions;	/*!< @brief Number of completions with packet errors or too little slack. */
+	ULONG	DepthIncreases;		/*!< @brief Number of times the depth was increased. */
+	ULONG	DepthDecreases;		/*!< @brief Number of times the depth was decreased. */
+} AUDIO_TRANSFER_DEPTH, *PAUDIO_TRANSFER_DEPTH;
+
+/*! @brief Packet status classes, the buckets of AUDIO_PIPE_STATISTICS::PacketStatus. */
+#define AUDIO_PACKET_STATUS_SUCCESS			0	/*!< @brief The packet was transferred. */
+#define AUDIO_PACKET_STATUS_NOT_ACCESSED	1	/*!< @brief The packet was scheduled too late for the host controller. */
+#define AUDIO_PACKET_STATUS_OVERRUN			2	/*!< @brief Data or buffer overrun/underrun, or babble. */
+#define AUDIO_PACKET_STATUS_BUS_ERROR		3	/*!< @brief CRC, bit stuffing or transaction error, or no response. */
+#define AUDIO_PACKET_STATUS_IRP_FAILED		4	/*!< @brief The whole IRP failed. */
+#define AUDIO_PACKET_STATUS_OTHER			5	/*!< @brief Any other error. */
+
+/*****************************************************************************
+ * AUDIO_PIPE_STATISTICS
+ *****************************************************************************
+ * @brief
+ * Transfer histograms of an isochronous pipe. Times are in microseconds.
+ */
+typedef struct
+{
+	AUDIO_HISTOGRAM	CompletionInterval;	/*!< @brief Time between two consecutive IRP completions. */
+	AUDIO_HISTOGRAM	ResubmitLatency;	/*!< @brief Time from the completion of an IRP to its resubmission. */
+	AUDIO_HISTOGRAM	FifoFill;			/*!< @brief Number of frames in the client FIFO when an IRP is submitted. */
+	AUDIO_HISTOGRAM	PacketStatus;		/*!< @brief Number of packets completed in each AUDIO_PACKET_STATUS_XXX class. */
+} AUDIO_PIPE_STATISTICS, *PAUDIO_PIPE_STATISTICS;
+
+/*****************************************************************************
+ * AUDIO_PIPE_HISTOGRAMS
+ *****************************************************************************
+ * @brief
+ * Snapshot of the transfer histograms of an isochronous pipe.
+ */
+typedef struct
+{
+	UCHAR	InterfaceNumber;								/*!< @brief Interface the pipe belongs to. */
+	UCHAR	AlternateSetting;								/*!< @brief Alternate setting the pipe belongs to. */
+	UCHAR	EndpointAddress;								/*!< @brief Endpoint address of the pipe. */
+	ULONG	CompletionInterval[AUDIO_HISTOGRAM_BUCKETS];	/*!< @brief See AUDIO_PIPE_STATISTICS. */
+	ULONG	ResubmitLatency[AUDIO_HISTOGRAM_BUCKETS];		/*!< @brief See AUDIO_PIPE_STATISTICS. */
+	ULONG	FifoFill[AUDIO_HISTOGRAM_BUCKETS];				/*!< @brief See AUDIO_PIPE_STATISTICS. */
+	ULONG	PacketStatus[AUDIO_HISTOGRAM_BUCKETS];			/*!< @brief See AUDIO_PIPE_STATISTICS. */
+} AUDIO_PIPE_HISTOGRAMS, *PAUDIO_PIPE_HISTOGRAMS;
+
 /*****************************************************************************
  *//*! @class CAudioClient
  *****************************************************************************
@@ -318,14 +386,9 @@ private:
 	KSPIN_LOCK				m_Lock;				/*!< @brief Lock to synchronize access to the client. */
 	KIRQL					m_LockIrql;			/*!< @brief Lock IRQL. */
 
-	ULONG					m_ReadPosition;		/*!< @brief Currrent read position in the ring buffer. */
-    ULONG					m_WritePosition;	/*!< @brief Current write position in the ring buffer. */
+	CAudioRing				m_Ring;				/*!< @brief Frame counters of the ring buffer. */
 
-    PUCHAR					m_FifoBuffer;		/*!< @brief Pointer to the ring buffer. Allocate one additional
-												 * byte to account for an eccentricity in the ring buffer
-												 * code which leads to one byte always being empty. */
-
-	ULONG					m_FifoBufferSize;	/*!< @brief Size of the ring buffer in frames. */
+    PUCHAR					m_FifoBuffer;		/*!< @brief Pointer to the ring buffer. */
 
 	ULONG					m_FifoFrameSize;	/*!< @brief Size of each audio frame in the ring buffer. */
 
@@ -349,6 +412,14 @@ private:
     LONG                    m_MasterVolumeStep[AUDIO_CLIENT_MAX_CHANNEL];   /*!< @brief The step size of the master volume in dB */
     LONG                    m_MasterVolumeMin[AUDIO_CLIENT_MAX_CHANNEL];    /*!< @brief The minimum master volume in dB */
     LONG                    m_MasterVolumeMax[AUDIO_CLIENT_MAX_CHANNEL];    /*!< @brief The maximum master volume in dB */
+
+	LONG					m_MasterVolumeSerial;	/*!< @brief Master volume/mute serial number the gains were computed from. */
+	BOOL					m_GainUnity;			/*!< @brief TRUE if all the target gains are unity. */
+	BOOL					m_GainZero;				/*!< @brief TRUE if all the target gains are zero. */
+	ULONG					m_GainRampFrames;		/*!< @brief Number of frames left in the current gain ramp. */
+	LONG					m_Gain[AUDIO_CLIENT_MAX_CHANNEL];		/*!< @brief The running per-channel gain (Q2.30). */
+	LONG					m_GainTarget[AUDIO_CLIENT_MAX_CHANNEL];	/*!< @brief The per-channel gain being ramped to (Q2.30). */
+	LONG					m_GainStep[AUDIO_CLIENT_MAX_CHANNEL];	/*!< @brief The per-frame gain increment during a ramp. */
 	/*************************************************************************
      * CAudioClient private methods
      *
@@ -366,6 +437,23 @@ private:
 		IN		ULONG	ClockRate
 	);
 
+	VOID _UpdateGains
+	(
+		IN		BOOL	Ramp
+	);
+
+	VOID _UpdateImplicitFeedback
+	(	void
+	);
+
+	VOID _CopyToFifo
+	(
+		IN		PUCHAR	FifoBuffer,
+		IN		PUCHAR	Buffer,
+		IN		ULONG	NumberOfFrames,
+		IN		BOOL	BitConversion
+	);
+
 public:
     /*************************************************************************
      * Constructor/destructor.
@@ -438,6 +526,17 @@ public:
 		IN		BOOL	BitConversion = FALSE
 	);
 
+	PUCHAR MapFramesInFifo
+	(
+		IN		ULONG				NumberOfFrames,
+		OUT		PAUDIO_FIFO_MAPPING	OutMapping
+	);
+
+	VOID UnmapFramesInFifo
+	(
+		IN		PAUDIO_FIFO_MAPPING	Mapping
+	);
+
 	ULONG GetNumQueuedFrames
 	(	void
 	);
@@ -507,6 +606,22 @@ public:
 		IN		ULONGLONG 	QueuePosition
 	);
 
+	AUDIOSTATUS SetTransferDepth
+	(
+		IN		BOOL	Adaptive,
+		IN		ULONG	LatencyInMs
+	);
+
+	AUDIOSTATUS GetTransferDepth
+	(
+		OUT		PAUDIO_TRANSFER_DEPTH	OutTransferDepth
+	);
+
+	AUDIOSTATUS GetClockRatio
+	(
+		OUT		PULONG	OutClockRatio
+	);
+
 	AUDIOSTATUS QueryControlSupport
 	(
 		IN		UCHAR	ControlSelector
@@ -540,30 +655,6 @@ public:
 		IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
 	);
 
-    void
-    VolumeMuteAdjustment
-    (
-	    IN  PUCHAR	pBuffer, 
-	    IN	ULONG	SamplesPerChannel
-    ); 
-
-    NTSTATUS
-    ConvertIntData2Float
-    (
-        IN  BYTE*   pBufferInteger,
-        IN  BYTE*   pBufferFloat,
-        IN  ULONG   numTotalSamples,
-        IN  ULONG   bitsPerSample
-    );
-
-    NTSTATUS
-    ConvertFloatData2Int
-    (
-        IN  BYTE*   pBufferFloat,
-        IN  BYTE*   pBufferInteger,
-        IN  ULONG   numTotalSamples,
-        IN  ULONG   bitsPerSample
-    );
     /*************************************************************************
      * Friends
      */
@@ -627,6 +718,10 @@ private:
 	LONG						m_PendingIrps;
 	KEVENT						m_NoPendingIrpEvent;
 
+	AUDIO_PIPE_STATISTICS		m_Statistics;				/*!< @brief Transfer histograms. */
+	LONGLONG					m_PerformanceFrequency;		/*!< @brief Performance counter frequency. */
+	LONGLONG					m_LastCompletionTime;		/*!< @brief Performance counter at the last completion, or 0. */
+
 	/*************************************************************************
      * CAudioSynchPipe private methods
      *
@@ -663,6 +758,17 @@ private:
 	(	void
 	);
 
+	VOID RecordCompletion
+	(
+		IN		NTSTATUS				ntStatus,
+		IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
+	);
+
+	VOID RecordSubmission
+	(
+		IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
+	);
+
 public:
     /*************************************************************************
      * The following two macros are from STDUNK.H.  DECLARE_STD_UNKNOWN()
@@ -729,6 +835,15 @@ public:
 	(	void
 	);
 
+	AUDIOSTATUS GetHistograms
+	(
+		OUT		PAUDIO_PIPE_HISTOGRAMS	OutHistograms
+	);
+
+	AUDIOSTATUS ResetHistograms
+	(	void
+	);
+
 	VOID Service
 	(
 		IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
@@ -825,12 +940,17 @@ private:
 
 	ULONGLONG					m_TotalBytesTransfered;
 
+	ULONGLONG					m_TotalBytesCopied;		/*!< @brief Total number of bytes copied from the client FIFO into the IRP buffers. */
+	ULONGLONG					m_TotalBytesMapped;		/*!< @brief Total number of bytes transferred straight out of the client FIFO. */
+
 	CAudioClient *				m_Client;
 
+	CAudioFifoSlab				m_FifoSlab;					/*!< @brief Holds the FIFO work items, kept across format changes. */
 	AUDIO_FIFO_WORK_ITEM *     	m_FifoWorkItem[MAX_AUDIO_IRP];
     CList<AUDIO_FIFO_WORK_ITEM>	m_FreeFifoWorkItemList;
     CList<AUDIO_FIFO_WORK_ITEM>	m_QueuedFifoWorkItemList;
     CList<AUDIO_FIFO_WORK_ITEM>	m_PendingFifoWorkItemList;
+    CList<AUDIO_FIFO_WORK_ITEM>	m_UnmapFifoWorkItemList;	/*!< @brief Mapped work items waiting for the client lock; see ReleaseFifoWorkItem(). */
 
 	LONG						m_PendingIrps;
 	KEVENT						m_NoPendingIrpEvent;
@@ -843,10 +963,31 @@ private:
 		ULONG	Whole;  
 	}							m_FfPerPacketInterval;
 
+	AUDIO_RATE_ESTIMATOR		m_RateEstimator;			/*!< @brief Filters the feedback into m_FfPerPacketInterval. */
+
 	ULONG						m_RunningFfFraction;
 
 	ULONG						m_PacketDeficitInBytes;
 
+	ULONG						m_NumberOfFifoWorkItems;	/*!< @brief Number of FIFO work items allocated. */
+	BOOL						m_AdaptiveTransferDepth;	/*!< @brief TRUE if the depth follows the completion jitter. */
+	ULONG						m_TransferLatency;			/*!< @brief Requested latency in ms, or 0 for the maximum depth. */
+	ULONG						m_TransferDepth;			/*!< @brief Number of IRPs to keep in flight. */
+	ULONG						m_MinimumTransferDepth;		/*!< @brief Depth the pipe won't shrink below. */
+	ULONG						m_CleanCompletions;			/*!< @brief Number of on-time completions since the last late one. */
+	ULONG						m_LateCompletions;			/*!< @brief Number of late completions. */
+	ULONG						m_NextStartFrame;			/*!< @brief Frame right after the last completed IRP. */
+	BOOL						m_NextStartFrameValid;		/*!< @brief TRUE if m_NextStartFrame is known. */
+	ULONG						m_DepthIncreases;			/*!< @brief Number of times the depth was increased. */
+	ULONG						m_DepthDecreases;			/*!< @brief Number of times the depth was decreased. */
+
+	CAudioDataPipe *			m_ImplicitFeedbackPipe;		/*!< @brief Output pipe paced by the packets this input pipe receives. */
+	CImplicitFeedbackQueue		m_ImplicitFeedbackQueue;	/*!< @brief Sizes in frames of the packets received by the paired input pipe. */
+
+	AUDIO_PIPE_STATISTICS		m_Statistics;				/*!< @brief Transfer histograms. */
+	LONGLONG					m_PerformanceFrequency;		/*!< @brief Performance counter frequency. */
+	LONGLONG					m_LastCompletionTime;		/*!< @brief Performance counter at the last completion, or 0. */
+
 	// These are to workaround Microsoft's USB OHCI bug.
 	PVOID						m_LastRecordBuffer;
 	ULONG						m_LastRecordBufferSize;
@@ -908,6 +1049,32 @@ private:
 	(	void
 	);
 
+	VOID ReleaseFifoWorkItem
+	(
+		IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
+	);
+
+	VOID UnmapFifoWorkItems
+	(	void
+	);
+
+	VOID AdjustTransferDepth
+	(
+		IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
+	);
+
+	VOID RecordCompletion
+	(
+		IN		NTSTATUS				ntStatus,
+		IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
+	);
+
+	VOID RecordSubmission
+	(
+		IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem,
+		IN		ULONG					FramesInFifo
+	);
+
 public:
     /*************************************************************************
      * Constructor/destructor.
@@ -974,6 +1141,17 @@ public:
 		IN		ULONG	FfFraction
 	);
 
+	AUDIOSTATUS SetImplicitFeedbackPipe
+	(
+		IN		CAudioDataPipe *	OutputPipe
+	);
+
+	VOID OnImplicitFeedback
+	(
+		IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem,
+		IN		ULONG					SampleFrameSize
+	);
+
 	AUDIOSTATUS SetCallbackClient
 	(
 		IN		CAudioClient *	Client
@@ -1016,6 +1194,37 @@ public:
 		IN		ULONGLONG 	TransferPosition
 	);
 
+	AUDIOSTATUS GetCopyStatistics
+	(
+		OUT		ULONGLONG *	OutBytesCopied,
+		OUT		ULONGLONG *	OutBytesMapped
+	);
+
+	AUDIOSTATUS SetTransferDepth
+	(
+		IN		BOOL	Adaptive,
+		IN		ULONG	LatencyInMs
+	);
+
+	AUDIOSTATUS GetTransferDepth
+	(
+		OUT		PAUDIO_TRANSFER_DEPTH	OutTransferDepth
+	);
+
+	AUDIOSTATUS GetClockRatio
+	(
+		OUT		PULONG	OutClockRatio
+	);
+
+	AUDIOSTATUS GetHistograms
+	(
+		OUT		PAUDIO_PIPE_HISTOGRAMS	OutHistograms
+	);
+
+	AUDIOSTATUS ResetHistograms
+	(	void
+	);
+
 	NTSTATUS SetRequest
 	(
 		IN		UCHAR	RequestCode,
@@ -1356,8 +1565,11 @@ private:
     LONG                    m_MasterVolumeMax[AUDIO_CLIENT_MAX_CHANNEL];    /*!< @brief The maximum master volume in dB */
     LONG                    m_MasterVolume[AUDIO_CLIENT_MAX_CHANNEL];       /*!< @brief The running master volume in dB */
     BOOL                    m_MasterMute;                                   /*!< @brief The running master mute */
+    LONG                    m_MasterVolumeSerial;                           /*!< @brief Incremented whenever the master volume/mute changes */
 	LONG					m_NumOfClientChannel; /*!< @brief The actual number of chnnels for software master volume control */
 
+	BOOL					m_ImplicitFeedback;	/*!< @brief TRUE if playback is paced by the packets received on the record pipe. */
+
 	/*************************************************************************
      * CAudioDevice private methods
      *
@@ -1473,6 +1685,24 @@ public:
 		IN		PAUDIO_CLIENT	Client
 	);
 
+	AUDIOSTATUS SetImplicitFeedback
+	(
+		IN		BOOL	Enable
+	);
+
+	AUDIOSTATUS GetPipeHistograms
+	(
+		IN		UCHAR					InterfaceNumber,
+		IN		BOOL					SynchPipe,
+		OUT		PAUDIO_PIPE_HISTOGRAMS	OutHistograms
+	);
+
+	AUDIOSTATUS ResetPipeHistograms
+	(
+		IN		UCHAR	InterfaceNumber,
+		IN		BOOL	SynchPipe
+	);
+
     NTSTATUS
     GetMasterVolumeRange(
         IN  LONG    channel,
@@ -31,6 +31,8 @@
 #ifndef _AUDIO_FIFO_H_
 #define _AUDIO_FIFO_H_
 
+#include "AudioRing.h"
+
 /*****************************************************************************
  * Defines
  */
@@ -163,12 +165,15 @@ public:
 	ULONG		Flags;
 	PVOID		Tag;
 	ULONG		SkipPackets;
+	BOOL		FifoMapped;		// TRUE if the transfer buffer is mapped from the client FIFO.
+	AUDIO_FIFO_MAPPING	FifoMapping;	// Returned by CAudioClient::MapFramesInFifo().
 
     // statistics.
     ULONG		TimesRecycled;
     ULONG		TotalPacketsProcessed;
     ULONG		TotalBytesProcessed;
     ULONG		ErrorPacketCount;
+	LONGLONG	CompletionTime;	// Performance counter when the IRP completed, or 0.
 
     /*************************************************************************
      * Friends
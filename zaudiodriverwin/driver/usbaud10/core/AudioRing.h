@@ -0,0 +1,326 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd. 
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public 
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file	   AudioRing.h
+ * @brief	   This file defines the frame counters of the lock-free ring
+ *			   buffer that each audio client queues its data in.
+ *//*
+ *****************************************************************************
+ */
+#ifndef __AUDIO_RING_H__
+#define __AUDIO_RING_H__
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Maximum number of ring buffer regions mapped at the same time (one per output IRP). */
+#define AUDIO_CLIENT_MAX_FIFO_MAPPINGS	8
+
+/*****************************************************************************
+ * AUDIO_FIFO_MAPPING
+ *****************************************************************************
+ * @brief
+ * Region of a client FIFO mapped by CAudioRing::Map().
+ */
+typedef struct
+{
+	ULONGLONG	MapCount;		/*!< @brief Start count of the region. */
+	ULONG		Generation;		/*!< @brief Generation of the FIFO it was mapped from, see CAudioRing::Reset(). */
+} AUDIO_FIFO_MAPPING, *PAUDIO_FIFO_MAPPING;
+
+/*****************************************************************************
+ * LoadFrameCount()
+ *****************************************************************************
+ * @brief
+ * Read a FIFO frame counter with acquire semantics.
+ */
+static __forceinline
+ULONGLONG
+LoadFrameCount
+(
+	IN		volatile ULONGLONG *	Count
+)
+{
+#if defined(_WIN64)
+	// Aligned 64-bit reads are atomic, and volatile reads have acquire
+	// semantics.
+	return *Count;
+#else
+	// Use cmpxchg8b to get an atomic 64-bit read.
+	return ULONGLONG(InterlockedCompareExchange64((volatile LONGLONG*)Count, 0, 0));
+#endif // defined(_WIN64)
+}
+
+/*****************************************************************************
+ * StoreFrameCount()
+ *****************************************************************************
+ * @brief
+ * Publish a FIFO frame counter with release semantics.
+ */
+static __forceinline
+VOID
+StoreFrameCount
+(
+	IN		volatile ULONGLONG *	Count,
+	IN		ULONGLONG				Value
+)
+{
+#if defined(_WIN64)
+	// Aligned 64-bit writes are atomic, and volatile writes have release
+	// semantics.
+	*Count = Value;
+#else
+	// Only the owner writes the counter, so this succeeds the first time.
+	LONGLONG Comparand = LONGLONG(*Count);
+
+	InterlockedCompareExchange64((volatile LONGLONG*)Count, LONGLONG(Value), Comparand);
+#endif // defined(_WIN64)
+}
+
+/*****************************************************************************
+ * Classes
+ */
+/*****************************************************************************
+ *//*! @class CAudioRing
+ *****************************************************************************
+ * @ingroup AUDIO_GROUP
+ * @brief
+ * Frame counters of a single producer, single consumer ring buffer.
+ * @details
+ * m_WriteCount and m_ReadCount are free-running frame counters. Only the
+ * producer writes m_WriteCount and only the consumer writes m_ReadCount, so
+ * neither side needs a lock: the number of queued frames is simply
+ * m_WriteCount - m_ReadCount, and a counter's low bits masked with m_Mask
+ * give its position in the ring buffer storage, whose size is a power of
+ * two. A counter is published with release semantics after the frames it
+ * covers have been copied, and read with acquire semantics by the other
+ * side.
+ *
+ * The consumer has a second counter, m_ConsumeCount, which is how far it has
+ * read. On output, the data pipe can map frames out of the ring buffer and
+ * hand them to the USB stack instead of copying them (Map()). Those frames
+ * are consumed but must not be overwritten until the IRP completes, so
+ * m_ReadCount, which is what the producer sees, stays at the start of the
+ * oldest mapped region until it is unmapped. Without mappings, the two
+ * counters are equal.
+ *
+ * The ring only keeps the counters; the caller owns the storage and copies
+ * the frames in and out at the positions it is given.
+ */
+class CAudioRing
+{
+private:
+	volatile ULONGLONG	m_ReadCount;		/*!< @brief Total number of frames released back to the producer. Only
+											 * the consumer updates it. */
+	volatile ULONGLONG	m_ConsumeCount;		/*!< @brief Total number of frames read or mapped from the ring buffer.
+											 * Only the consumer updates it. */
+	volatile ULONGLONG	m_WriteCount;		/*!< @brief Total number of frames written to the ring buffer. Only
+											 * the producer updates it. */
+	ULONG				m_Size;				/*!< @brief Capacity of the ring buffer in frames. */
+	ULONG				m_Mask;				/*!< @brief Size of the ring buffer storage in frames (a power of two) minus one. */
+	ULONG				m_NumberOfMappings;	/*!< @brief Number of regions of the ring buffer currently mapped. */
+	ULONGLONG			m_Mapping[AUDIO_CLIENT_MAX_FIFO_MAPPINGS];	/*!< @brief Start count of each mapped region. */
+	ULONG				m_Generation;		/*!< @brief Bumped whenever the counters restart, so that regions
+											 * mapped before are not mistaken for new ones. */
+
+public:
+    /*************************************************************************
+     * Constructor.
+     */
+	CAudioRing(void)
+	{
+		m_ReadCount = m_ConsumeCount = m_WriteCount = 0;
+		m_Size = 0;
+		m_Mask = 0;
+		m_NumberOfMappings = 0;
+		m_Generation = 0;
+	}
+
+	/*! @brief Set the capacity, and the storage size (a power of two, at least Size), in frames. The ring is empty. */
+	void Init(ULONG Size, ULONG StorageSize)
+	{
+		m_Size = Size;
+		m_Mask = StorageSize - 1;
+
+		Reset();
+	}
+
+	/*! @brief Empty the ring. Regions still mapped are forgotten, and ignored when they are unmapped. */
+	void Reset(void)
+	{
+		m_ReadCount = m_ConsumeCount = m_WriteCount = 0;
+
+		// As the counters start again from 0, the map counts of the old
+		// regions could match new ones, so they are told apart by the
+		// generation.
+		m_NumberOfMappings = 0;
+
+		m_Generation++;
+	}
+
+	/*! @brief Capacity in frames. */
+	ULONG Size(void)
+	{
+		return m_Size;
+	}
+
+	/*! @brief Position of a count in the storage, in frames. */
+	ULONG Position(ULONGLONG Count)
+	{
+		return ULONG(Count) & m_Mask;
+	}
+
+	/*! @brief How many of Frames from Count on are stored contiguously, before the end of the storage. */
+	ULONG Contiguous(ULONGLONG Count, ULONG Frames)
+	{
+		ULONG Limit = m_Mask + 1 - Position(Count);
+
+		return (Frames > Limit) ? Limit : Frames;
+	}
+
+	/*! @brief Producer: get the write count to copy to, and the number of frames free after it. */
+	ULONG BeginWrite(ULONGLONG * OutWriteCount)
+	{
+		ULONGLONG WriteCount = m_WriteCount;
+
+		*OutWriteCount = WriteCount;
+
+		return m_Size - ULONG(WriteCount - LoadFrameCount(&m_ReadCount));
+	}
+
+	/*! @brief Producer: publish the frames copied up to WriteCount. */
+	void EndWrite(ULONGLONG WriteCount)
+	{
+		StoreFrameCount(&m_WriteCount, WriteCount);
+	}
+
+	/*! @brief Consumer: get the count to read from, and the number of frames queued after it. */
+	ULONG BeginRead(ULONGLONG * OutReadCount)
+	{
+		ULONGLONG ReadCount = m_ConsumeCount;
+
+		*OutReadCount = ReadCount;
+
+		return ULONG(LoadFrameCount(&m_WriteCount) - ReadCount);
+	}
+
+	/*! @brief Consumer: give the frames read up to ReadCount back, unless mapped regions hold them (see Unmap()). */
+	void EndRead(ULONGLONG ReadCount)
+	{
+		StoreFrameCount(&m_ConsumeCount, ReadCount);
+
+		if (!m_NumberOfMappings)
+		{
+			StoreFrameCount(&m_ReadCount, ReadCount);
+		}
+	}
+
+	/*!
+	 * @brief
+	 * Consumer: consume NumberOfFrames without giving them back until they are
+	 * unmapped. Fails if fewer frames are queued, if they wrap around the end
+	 * of the storage, or if too many regions are mapped already.
+	 */
+	BOOL Map(ULONG NumberOfFrames, PAUDIO_FIFO_MAPPING OutMapping, ULONG * OutPosition)
+	{
+		ULONGLONG ConsumeCount;
+
+		ULONG FramesQueued = BeginRead(&ConsumeCount);
+
+		if ((NumberOfFrames == 0) || (NumberOfFrames > FramesQueued) ||
+			(Contiguous(ConsumeCount, NumberOfFrames) < NumberOfFrames) ||
+			(m_NumberOfMappings >= AUDIO_CLIENT_MAX_FIFO_MAPPINGS))
+		{
+			return FALSE;
+		}
+
+		m_Mapping[m_NumberOfMappings++] = ConsumeCount;
+
+		StoreFrameCount(&m_ConsumeCount, ConsumeCount + NumberOfFrames);
+
+		OutMapping->MapCount = ConsumeCount;
+		OutMapping->Generation = m_Generation;
+
+		*OutPosition = Position(ConsumeCount);
+
+		return TRUE;
+	}
+
+	/*!
+	 * @brief
+	 * Consumer: release a region returned by Map(). Regions can be unmapped in
+	 * any order; the producer gets the space back up to the oldest region
+	 * still mapped.
+	 */
+	void Unmap(PAUDIO_FIFO_MAPPING Mapping)
+	{
+		if (Mapping->Generation != m_Generation)
+		{
+			return;
+		}
+
+		for (ULONG i=0; i<m_NumberOfMappings; i++)
+		{
+			if (m_Mapping[i] == Mapping->MapCount)
+			{
+				m_Mapping[i] = m_Mapping[--m_NumberOfMappings];
+				break;
+			}
+		}
+
+		ULONGLONG ReadCount = m_ConsumeCount;
+
+		for (ULONG i=0; i<m_NumberOfMappings; i++)
+		{
+			if (m_Mapping[i] < ReadCount)
+			{
+				ReadCount = m_Mapping[i];
+			}
+		}
+
+		StoreFrameCount(&m_ReadCount, ReadCount);
+	}
+
+	/*! @brief Number of frames queued. Wait-free; either side may call it. */
+	ULONG GetNumQueuedFrames(void)
+	{
+		// Read the consumer's counter first so that the difference can't go
+		// negative. It can transiently exceed the capacity, so clamp it.
+		ULONGLONG ConsumeCount = LoadFrameCount(&m_ConsumeCount);
+
+		ULONG FramesQueued = ULONG(LoadFrameCount(&m_WriteCount) - ConsumeCount);
+
+		return (FramesQueued > m_Size) ? m_Size : FramesQueued;
+	}
+
+	/*! @brief Number of frames free. Wait-free; either side may call it. Mapped frames are neither queued nor free. */
+	ULONG GetNumAvailableFrames(void)
+	{
+		ULONGLONG ReadCount = LoadFrameCount(&m_ReadCount);
+
+		ULONG FramesInUse = ULONG(LoadFrameCount(&m_WriteCount) - ReadCount);
+
+		return (FramesInUse > m_Size) ? 0 : (m_Size - FramesInUse);
+	}
+};
+
+#endif // __AUDIO_RING_H__
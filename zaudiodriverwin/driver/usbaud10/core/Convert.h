@@ -33,8 +33,9 @@
 #ifndef __CONVERT_H__
 #define __CONVERT_H__
 
-// TODO: Optimize these routines... Unrolling the loop will probably be 
-// good enough...
+// The scalar routines below are the reference implementation. On x64 they
+// are replaced at FindConversionRoutine() time by the SSE2/SSSE3 versions
+// further down, which produce bit-identical output.
 
 /*****************************************************************************
  * Copy32_16()
@@ -174,6 +175,359 @@ Copy16_32
 	}
 }
 
+#if defined(_AMD64_)
+
+#include <intrin.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+// SSE can be used freely in kernel mode on x64 (the XMM state is preserved
+// across interrupts/DPCs). On x86 it would require KeSaveFloatingPointState
+// around every call, so the x86 build sticks with the scalar routines.
+
+/*! @brief CPU features used to select the conversion routines. */
+#define CONVERSION_FEATURE_SSE2		0x00000001
+#define CONVERSION_FEATURE_SSSE3	0x00000002
+
+/*****************************************************************************
+ * GetConversionFeatures()
+ *****************************************************************************
+ * @brief
+ * Query the CPU for the instruction sets usable by the conversion routines.
+ */
+static
+ULONG
+GetConversionFeatures
+(	void
+)
+{
+	int CpuInfo[4];
+
+	__cpuid(CpuInfo, 1);
+
+	ULONG Features = 0;
+
+	if (CpuInfo[3] & (1<<26)) Features |= CONVERSION_FEATURE_SSE2;
+	if (CpuInfo[2] & (1<<9))  Features |= CONVERSION_FEATURE_SSSE3;
+
+	return Features;
+}
+
+/*****************************************************************************
+ * Pack32_24()
+ *****************************************************************************
+ * @brief
+ * Store the upper 3 bytes of each of the 16 32-bit samples in X0..X3 as 48
+ * bytes of packed 24-bit samples.
+ */
+static __forceinline
+VOID
+Pack32_24
+(
+	IN		PUCHAR	Dst,
+	IN		__m128i	X0,
+	IN		__m128i	X1,
+	IN		__m128i	X2,
+	IN		__m128i	X3
+)
+{
+	const __m128i Shuffle = _mm_setr_epi8(1,2,3, 5,6,7, 9,10,11, 13,14,15, -1,-1,-1,-1);
+
+	X0 = _mm_shuffle_epi8(X0, Shuffle);
+	X1 = _mm_shuffle_epi8(X1, Shuffle);
+	X2 = _mm_shuffle_epi8(X2, Shuffle);
+	X3 = _mm_shuffle_epi8(X3, Shuffle);
+
+	_mm_storeu_si128((__m128i*)(Dst+ 0), _mm_or_si128(X0, _mm_slli_si128(X1, 12)));
+	_mm_storeu_si128((__m128i*)(Dst+16), _mm_or_si128(_mm_srli_si128(X1, 4), _mm_slli_si128(X2, 8)));
+	_mm_storeu_si128((__m128i*)(Dst+32), _mm_or_si128(_mm_srli_si128(X2, 8), _mm_slli_si128(X3, 4)));
+}
+
+/*****************************************************************************
+ * Unpack24()
+ *****************************************************************************
+ * @brief
+ * Load 48 bytes of packed 24-bit samples so that X0..X3 each hold 4 samples
+ * in their low 12 bytes.
+ */
+static __forceinline
+VOID
+Unpack24
+(
+	IN		PUCHAR		Src,
+	OUT		__m128i *	X0,
+	OUT		__m128i *	X1,
+	OUT		__m128i *	X2,
+	OUT		__m128i *	X3
+)
+{
+	__m128i V0 = _mm_loadu_si128((__m128i*)(Src+ 0));
+	__m128i V1 = _mm_loadu_si128((__m128i*)(Src+16));
+	__m128i V2 = _mm_loadu_si128((__m128i*)(Src+32));
+
+	*X0 = V0;
+	*X1 = _mm_alignr_epi8(V1, V0, 12);
+	*X2 = _mm_alignr_epi8(V2, V1, 8);
+	*X3 = _mm_srli_si128(V2, 4);
+}
+
+/*****************************************************************************
+ * Copy32_16_Sse2()
+ *****************************************************************************
+ * @brief
+ * SSE2 version of Copy32_16().
+ */
+static 
+VOID 
+Copy32_16_Sse2
+(
+	IN		PSHORT	Dst, 
+	IN		PLONG	Src, 
+	IN		ULONG	NumberOfSamples
+)
+{
+	ULONG i = 0;
+
+	for (; i+8<=NumberOfSamples; i+=8)
+	{
+		__m128i X0 = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(Src+i+0)), 16);
+		__m128i X1 = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(Src+i+4)), 16);
+
+		_mm_storeu_si128((__m128i*)(Dst+i), _mm_packs_epi32(X0, X1));
+	}
+
+	Copy32_16(Dst+i, Src+i, NumberOfSamples-i);
+}
+
+/*****************************************************************************
+ * Copy32_24_Ssse3()
+ *****************************************************************************
+ * @brief
+ * SSSE3 version of Copy32_24().
+ */
+static 
+VOID 
+Copy32_24_Ssse3
+(
+	IN		PUCHAR	Dst, 
+	IN		PLONG	Src, 
+	IN		ULONG	NumberOfSamples
+)
+{
+	ULONG i = 0;
+
+	for (; i+16<=NumberOfSamples; i+=16)
+	{
+		Pack32_24
+		(
+			Dst,
+			_mm_loadu_si128((__m128i*)(Src+i+ 0)),
+			_mm_loadu_si128((__m128i*)(Src+i+ 4)),
+			_mm_loadu_si128((__m128i*)(Src+i+ 8)),
+			_mm_loadu_si128((__m128i*)(Src+i+12))
+		);
+
+		Dst+=48;
+	}
+
+	Copy32_24(Dst, Src+i, NumberOfSamples-i);
+}
+
+/*****************************************************************************
+ * Copy24_16_Ssse3()
+ *****************************************************************************
+ * @brief
+ * SSSE3 version of Copy24_16().
+ */
+static 
+VOID 
+Copy24_16_Ssse3
+(
+	IN		PSHORT	Dst, 
+	IN		PUCHAR	Src, 
+	IN		ULONG	NumberOfSamples
+)
+{
+	const __m128i Shuffle = _mm_setr_epi8(1,2, 4,5, 7,8, 10,11, -1,-1,-1,-1,-1,-1,-1,-1);
+
+	ULONG i = 0;
+
+	for (; i+16<=NumberOfSamples; i+=16)
+	{
+		__m128i X0, X1, X2, X3;
+
+		Unpack24(Src, &X0, &X1, &X2, &X3);
+
+		_mm_storeu_si128((__m128i*)(Dst+i+0), _mm_unpacklo_epi64(_mm_shuffle_epi8(X0, Shuffle), _mm_shuffle_epi8(X1, Shuffle)));
+		_mm_storeu_si128((__m128i*)(Dst+i+8), _mm_unpacklo_epi64(_mm_shuffle_epi8(X2, Shuffle), _mm_shuffle_epi8(X3, Shuffle)));
+
+		Src+=48;
+	}
+
+	Copy24_16(Dst+i, Src, NumberOfSamples-i);
+}
+
+/*****************************************************************************
+ * Copy24_32_Ssse3()
+ *****************************************************************************
+ * @brief
+ * SSSE3 version of Copy24_32().
+ */
+static 
+VOID 
+Copy24_32_Ssse3
+(
+	IN		PLONG	Dst, 
+	IN		PUCHAR	Src, 
+	IN		ULONG	NumberOfSamples
+)
+{
+	const __m128i Shuffle = _mm_setr_epi8(-1,0,1,2, -1,3,4,5, -1,6,7,8, -1,9,10,11);
+
+	ULONG i = 0;
+
+	for (; i+16<=NumberOfSamples; i+=16)
+	{
+		__m128i X0, X1, X2, X3;
+
+		Unpack24(Src, &X0, &X1, &X2, &X3);
+
+		_mm_storeu_si128((__m128i*)(Dst+i+ 0), _mm_shuffle_epi8(X0, Shuffle));
+		_mm_storeu_si128((__m128i*)(Dst+i+ 4), _mm_shuffle_epi8(X1, Shuffle));
+		_mm_storeu_si128((__m128i*)(Dst+i+ 8), _mm_shuffle_epi8(X2, Shuffle));
+		_mm_storeu_si128((__m128i*)(Dst+i+12), _mm_shuffle_epi8(X3, Shuffle));
+
+		Src+=48;
+	}
+
+	Copy24_32(Dst+i, Src, NumberOfSamples-i);
+}
+
+/*****************************************************************************
+ * Copy16_24_Ssse3()
+ *****************************************************************************
+ * @brief
+ * SSSE3 version of Copy16_24().
+ */
+static 
+VOID 
+Copy16_24_Ssse3
+(
+	IN		PUCHAR	Dst, 
+	IN		PSHORT	Src, 
+	IN		ULONG	NumberOfSamples
+)
+{
+	const __m128i Zero = _mm_setzero_si128();
+
+	ULONG i = 0;
+
+	for (; i+16<=NumberOfSamples; i+=16)
+	{
+		__m128i V0 = _mm_loadu_si128((__m128i*)(Src+i+0));
+		__m128i V1 = _mm_loadu_si128((__m128i*)(Src+i+8));
+
+		// Widen to 32-bit (sample<<16), then keep the upper 3 bytes.
+		Pack32_24
+		(
+			Dst,
+			_mm_unpacklo_epi16(Zero, V0),
+			_mm_unpackhi_epi16(Zero, V0),
+			_mm_unpacklo_epi16(Zero, V1),
+			_mm_unpackhi_epi16(Zero, V1)
+		);
+
+		Dst+=48;
+	}
+
+	Copy16_24(Dst, Src+i, NumberOfSamples-i);
+}
+
+/*****************************************************************************
+ * Copy16_32_Sse2()
+ *****************************************************************************
+ * @brief
+ * SSE2 version of Copy16_32().
+ */
+static 
+VOID 
+Copy16_32_Sse2
+(
+	IN		PLONG	Dst, 
+	IN		PSHORT	Src, 
+	IN		ULONG	NumberOfSamples
+)
+{
+	const __m128i Zero = _mm_setzero_si128();
+
+	ULONG i = 0;
+
+	for (; i+8<=NumberOfSamples; i+=8)
+	{
+		__m128i V = _mm_loadu_si128((__m128i*)(Src+i));
+
+		_mm_storeu_si128((__m128i*)(Dst+i+0), _mm_unpacklo_epi16(Zero, V));
+		_mm_storeu_si128((__m128i*)(Dst+i+4), _mm_unpackhi_epi16(Zero, V));
+	}
+
+	Copy16_32(Dst+i, Src+i, NumberOfSamples-i);
+}
+
+/*****************************************************************************
+ * FindSimdConversionRoutine()
+ *****************************************************************************
+ * @brief
+ * Find a SIMD conversion routine supported by this CPU, if any.
+ */
+static
+AUDIO_CONVERSION_ROUTINE
+FindSimdConversionRoutine
+(
+	IN		ULONG	FromBitPerSample,
+	IN		ULONG	ToBitPerSample
+)
+{
+	ULONG Features = GetConversionFeatures();
+
+	AUDIO_CONVERSION_ROUTINE ConversionRoutine = NULL;
+
+	if (Features & CONVERSION_FEATURE_SSE2)
+	{
+		if ((FromBitPerSample == 32) && (ToBitPerSample == 16))
+		{
+			ConversionRoutine = (AUDIO_CONVERSION_ROUTINE)Copy32_16_Sse2;
+		}
+		else if ((FromBitPerSample == 16) && (ToBitPerSample == 32))
+		{
+			ConversionRoutine = (AUDIO_CONVERSION_ROUTINE)Copy16_32_Sse2;
+		}
+	}
+
+	if (Features & CONVERSION_FEATURE_SSSE3)
+	{
+		if ((FromBitPerSample == 32) && (ToBitPerSample == 24))
+		{
+			ConversionRoutine = (AUDIO_CONVERSION_ROUTINE)Copy32_24_Ssse3;
+		}
+		else if ((FromBitPerSample == 24) && (ToBitPerSample == 16))
+		{
+			ConversionRoutine = (AUDIO_CONVERSION_ROUTINE)Copy24_16_Ssse3;
+		}
+		else if ((FromBitPerSample == 24) && (ToBitPerSample == 32))
+		{
+			ConversionRoutine = (AUDIO_CONVERSION_ROUTINE)Copy24_32_Ssse3;
+		}
+		else if ((FromBitPerSample == 16) && (ToBitPerSample == 24))
+		{
+			ConversionRoutine = (AUDIO_CONVERSION_ROUTINE)Copy16_24_Ssse3;
+		}
+	}
+
+	return ConversionRoutine;
+}
+
+#endif // defined(_AMD64_)
+
 /*****************************************************************************
  * FindConversionRoutine()
  *****************************************************************************
@@ -192,6 +546,15 @@ FindConversionRoutine
 
 	AUDIO_CONVERSION_ROUTINE ConversionRoutine = NULL;
 
+#if defined(_AMD64_)
+	ConversionRoutine = FindSimdConversionRoutine(FromBitPerSample, ToBitPerSample);
+
+	if (ConversionRoutine)
+	{
+		return ConversionRoutine;
+	}
+#endif // defined(_AMD64_)
+
 	switch (ToBitPerSample)
 	{
 		case 16:
@@ -0,0 +1,388 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       DbgTrace.cpp
+ * @brief      Binary event trace buffer management. See dbgtrace.h.
+ *//*
+ *****************************************************************************
+ */
+#include "Common.h"
+
+/*! @brief Debug module name. */
+#define STR_MODULENAME "DbgTrace: "
+
+/*****************************************************************************
+ * Globals
+ */
+/*! @brief The trace buffer, or NULL if tracing is off. */
+PDBG_TRACE_BUFFER DbgTraceBuffer = NULL;
+
+/*! @brief Serializes DbgTraceStart() and DbgTraceStop(). */
+static LONG DbgTraceStartLock = 0;
+
+#pragma code_seg("PAGE")
+
+/*****************************************************************************
+ * AcquireStartLock()
+ *****************************************************************************
+ * @brief
+ * Acquire the start lock. This can't be a mutex as there is nowhere to
+ * initialize it before the first device starts.
+ */
+static
+VOID
+AcquireStartLock
+(	void
+)
+{
+	PAGED_CODE();
+
+	while (InterlockedCompareExchange(&DbgTraceStartLock, 1, 0))
+	{
+		LARGE_INTEGER DueTime;
+		DueTime.QuadPart = -10000; // 1ms
+		KeDelayExecutionThread(KernelMode, FALSE, &DueTime);
+	}
+}
+
+/*****************************************************************************
+ * ReleaseStartLock()
+ *****************************************************************************
+ * @brief
+ * Release the start lock.
+ */
+static
+VOID
+ReleaseStartLock
+(	void
+)
+{
+	PAGED_CODE();
+
+	InterlockedExchange(&DbgTraceStartLock, 0);
+}
+
+/*****************************************************************************
+ * FreeTraceBuffer()
+ *****************************************************************************
+ * @brief
+ * Free a trace buffer and its rings.
+ */
+static
+VOID
+FreeTraceBuffer
+(
+	IN		PDBG_TRACE_BUFFER	Buffer
+)
+{
+	PAGED_CODE();
+
+	for (ULONG i=0; i<Buffer->NumberOfCpus; i++)
+	{
+		if (Buffer->Ring[i].Record)
+		{
+			ExFreePool(Buffer->Ring[i].Record);
+		}
+	}
+
+	ExFreePool(Buffer);
+}
+
+/*****************************************************************************
+ * DbgTraceStart()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Turn the trace on.
+ * @details
+ * The first call allocates the rings; later calls only add a reference, and
+ * keep the size of the rings. Each call must be matched by DbgTraceStop().
+ * @param
+ * RecordsPerCpu Size of each ring, rounded up to a power of 2.
+ * @return
+ * Returns STATUS_SUCCESS if successful. Otherwise, returns an appropriate
+ * error code.
+ */
+NTSTATUS
+DbgTraceStart
+(
+	IN		ULONG	RecordsPerCpu
+)
+{
+	PAGED_CODE();
+
+	if (!RecordsPerCpu)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	NTSTATUS ntStatus = STATUS_SUCCESS;
+
+	AcquireStartLock();
+
+	if (DbgTraceBuffer)
+	{
+		InterlockedIncrement(&DbgTraceBuffer->References);
+	}
+	else
+	{
+		ULONG RecordsPerRing = 64;
+
+		while ((RecordsPerRing < RecordsPerCpu) && (RecordsPerRing < DBG_TRACE_MAX_RECORDS_PER_CPU))
+		{
+			RecordsPerRing <<= 1;
+		}
+
+		// Processor numbers go up to the highest active processor.
+		ULONG NumberOfCpus = 0;
+
+		for (KAFFINITY ActiveProcessors = KeQueryActiveProcessors(); ActiveProcessors; ActiveProcessors >>= 1)
+		{
+			NumberOfCpus++;
+		}
+
+		ULONG BufferSize = sizeof(DBG_TRACE_BUFFER) + (NumberOfCpus - 1) * sizeof(DBG_TRACE_RING);
+
+		PDBG_TRACE_BUFFER Buffer = PDBG_TRACE_BUFFER(ExAllocatePoolWithTag(NonPagedPool, BufferSize, 'mdW'));
+
+		if (Buffer)
+		{
+			RtlZeroMemory(Buffer, BufferSize);
+
+			Buffer->NumberOfCpus = NumberOfCpus;
+			Buffer->RecordMask = RecordsPerRing - 1;
+			Buffer->References = 1;
+
+			ExInitializeFastMutex(&Buffer->DrainLock);
+
+			for (ULONG i=0; i<NumberOfCpus; i++)
+			{
+				Buffer->Ring[i].Record = PDBG_TRACE_RECORD(ExAllocatePoolWithTag(NonPagedPool, RecordsPerRing * sizeof(DBG_TRACE_RECORD), 'mdW'));
+
+				if (!Buffer->Ring[i].Record)
+				{
+					ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+					break;
+				}
+
+				RtlZeroMemory(Buffer->Ring[i].Record, RecordsPerRing * sizeof(DBG_TRACE_RECORD));
+			}
+
+			if (NT_SUCCESS(ntStatus))
+			{
+				LARGE_INTEGER CounterFrequency;
+
+				Buffer->CounterStart = ULONGLONG(KeQueryPerformanceCounter(&CounterFrequency).QuadPart);
+				Buffer->TimestampStart = DbgTraceTimestamp();
+				Buffer->CounterFrequency = ULONGLONG(CounterFrequency.QuadPart);
+
+				DbgTraceBuffer = Buffer;
+
+				_DbgPrintF(DEBUGLVL_TERSE,("[DbgTraceStart] - %d CPUs, %d records per CPU", NumberOfCpus, RecordsPerRing));
+			}
+			else
+			{
+				FreeTraceBuffer(Buffer);
+			}
+		}
+		else
+		{
+			ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+		}
+	}
+
+	ReleaseStartLock();
+
+	return ntStatus;
+}
+
+/*****************************************************************************
+ * DbgTraceStop()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Release a reference on the trace, and free the rings with the last one.
+ * @details
+ * The rings are freed without waiting for DbgTrace() callers, so the last
+ * reference must only be dropped once the pipes of all the devices are
+ * gone.
+ */
+VOID
+DbgTraceStop
+(	void
+)
+{
+	PAGED_CODE();
+
+	AcquireStartLock();
+
+	PDBG_TRACE_BUFFER Buffer = DbgTraceBuffer;
+
+	if (Buffer)
+	{
+		if (InterlockedDecrement(&Buffer->References) == 0)
+		{
+			DbgTraceBuffer = NULL;
+
+			FreeTraceBuffer(Buffer);
+		}
+	}
+
+	ReleaseStartLock();
+}
+
+/*****************************************************************************
+ * DbgTraceDrain()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Move the recorded events out of the rings.
+ * @details
+ * Fills the buffer with a DBG_TRACE_HEADER followed by as many records as
+ * fit. Records that are still being written are left for the next call.
+ * @param
+ * Buffer Buffer to receive the records.
+ * @param
+ * BufferSize Size of the buffer in bytes.
+ * @param
+ * OutBufferSize Number of bytes written to the buffer, or the size of the
+ * header if the buffer is too small.
+ * @return
+ * Returns STATUS_SUCCESS if successful, STATUS_INVALID_DEVICE_STATE if the
+ * trace is off, or STATUS_BUFFER_TOO_SMALL.
+ */
+NTSTATUS
+DbgTraceDrain
+(
+	OUT		PVOID	Buffer,
+	IN		ULONG	BufferSize,
+	OUT		PULONG	OutBufferSize
+)
+{
+	PAGED_CODE();
+
+	*OutBufferSize = 0;
+
+	PDBG_TRACE_BUFFER Trace = DbgTraceBuffer;
+
+	if (!Trace)
+	{
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	if (BufferSize < sizeof(DBG_TRACE_HEADER))
+	{
+		*OutBufferSize = sizeof(DBG_TRACE_HEADER);
+
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	PDBG_TRACE_HEADER Header = PDBG_TRACE_HEADER(Buffer);
+
+	PDBG_TRACE_RECORD Records = PDBG_TRACE_RECORD(Header+1);
+
+	ULONG MaximumRecords = (BufferSize - sizeof(DBG_TRACE_HEADER)) / sizeof(DBG_TRACE_RECORD);
+
+	ULONG NumberOfRecords = 0;
+
+	ULONG LostRecords = 0;
+
+	ExAcquireFastMutex(&Trace->DrainLock);
+
+	for (ULONG i=0; (i<Trace->NumberOfCpus) && (NumberOfRecords<MaximumRecords); i++)
+	{
+		PDBG_TRACE_RING Ring = &Trace->Ring[i];
+
+		ULONG WriteIndex = ULONG(Ring->WriteIndex);
+
+		ULONG ReadIndex = Ring->ReadIndex;
+
+		if ((WriteIndex - ReadIndex) > (Trace->RecordMask + 1))
+		{
+			// The writers have lapped the drain.
+			LostRecords += (WriteIndex - ReadIndex) - (Trace->RecordMask + 1);
+
+			ReadIndex = WriteIndex - (Trace->RecordMask + 1);
+		}
+
+		while ((ReadIndex != WriteIndex) && (NumberOfRecords < MaximumRecords))
+		{
+			PDBG_TRACE_RECORD Record = &Ring->Record[ReadIndex & Trace->RecordMask];
+
+			ULONG Sequence = *((volatile ULONG *)&Record->Sequence);
+
+			if (Sequence == 0)
+			{
+				// Still being written.
+				break;
+			}
+
+			if (Sequence == (ReadIndex + 1))
+			{
+				_ReadWriteBarrier();
+
+				RtlCopyMemory(&Records[NumberOfRecords], Record, sizeof(DBG_TRACE_RECORD));
+
+				_ReadWriteBarrier();
+
+				if (*((volatile ULONG *)&Record->Sequence) == Sequence)
+				{
+					NumberOfRecords++;
+				}
+				else
+				{
+					// Overwritten while it was copied.
+					LostRecords++;
+				}
+			}
+			else
+			{
+				// Overwritten since WriteIndex was read.
+				LostRecords++;
+			}
+
+			ReadIndex++;
+		}
+
+		Ring->ReadIndex = ReadIndex;
+	}
+
+	ExReleaseFastMutex(&Trace->DrainLock);
+
+	Header->Signature = DBG_TRACE_SIGNATURE;
+	Header->Version = DBG_TRACE_VERSION;
+	Header->HeaderSize = sizeof(DBG_TRACE_HEADER);
+	Header->RecordSize = sizeof(DBG_TRACE_RECORD);
+	Header->NumberOfRecords = NumberOfRecords;
+	Header->LostRecords = LostRecords;
+	Header->TimestampStart = Trace->TimestampStart;
+	Header->CounterStart = Trace->CounterStart;
+	Header->CounterNow = ULONGLONG(KeQueryPerformanceCounter(NULL).QuadPart);
+	Header->TimestampNow = DbgTraceTimestamp();
+	Header->CounterFrequency = Trace->CounterFrequency;
+
+	*OutBufferSize = sizeof(DBG_TRACE_HEADER) + NumberOfRecords * sizeof(DBG_TRACE_RECORD);
+
+	return STATUS_SUCCESS;
+}
+
+#pragma code_seg()
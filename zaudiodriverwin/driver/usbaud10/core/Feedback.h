@@ -0,0 +1,179 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file	   Feedback.h
+ * @brief	   This file defines the rate estimator that filters the values
+ *			   received on the isochronous feedback (synch) endpoint.
+ *//*
+ *****************************************************************************
+ */
+#ifndef __FEEDBACK_H__
+#define __FEEDBACK_H__
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Rates are in 1/AUDIO_FF_UNIT sample frames per packet, the unit of m_FfPerPacketInterval. */
+#define AUDIO_FF_UNIT							(LONGLONG(1000)<<16)
+
+/*! @brief Extra fraction bits kept in the filter state. */
+#define AUDIO_RATE_ESTIMATOR_SHIFT				8
+
+/*! @brief Loop gains of the alpha-beta filter, as shifts (alpha = 1/16, beta = 1/512, about critically damped). */
+#define AUDIO_RATE_ESTIMATOR_ALPHA_SHIFT		4
+#define AUDIO_RATE_ESTIMATOR_BETA_SHIFT			9
+
+/*! @brief Values further than nominal/16 from the prediction are outliers. */
+#define AUDIO_RATE_ESTIMATOR_TOLERANCE_SHIFT	4
+
+/*! @brief After this many outliers in a row, the rate is assumed to have really changed. */
+#define AUDIO_RATE_ESTIMATOR_MAX_OUTLIERS		8
+
+/*! @brief Clock ratios are unsigned Q2.30 fixed-point values. */
+#define AUDIO_CLOCK_RATIO_SHIFT					30
+
+/*!
+ * @brief
+ * Feedback rate estimator state.
+ */
+typedef struct
+{
+	LONGLONG	Nominal;		/*!< @brief Nominal rate. */
+	LONGLONG	Estimate;		/*!< @brief Filtered rate, << AUDIO_RATE_ESTIMATOR_SHIFT. */
+	LONGLONG	Drift;			/*!< @brief Change of the rate per update, << AUDIO_RATE_ESTIMATOR_SHIFT. */
+	ULONG		Outliers;		/*!< @brief Number of consecutive outliers. */
+	ULONG		Rejected;		/*!< @brief Total number of outliers. */
+} AUDIO_RATE_ESTIMATOR, *PAUDIO_RATE_ESTIMATOR;
+
+/*****************************************************************************
+ * RateEstimatorInit()
+ *****************************************************************************
+ * @brief
+ * Start the estimator at the nominal rate.
+ */
+static __inline
+VOID
+RateEstimatorInit
+(
+	IN		PAUDIO_RATE_ESTIMATOR	Estimator,
+	IN		LONGLONG				Nominal
+)
+{
+	Estimator->Nominal = Nominal;
+	Estimator->Estimate = Nominal << AUDIO_RATE_ESTIMATOR_SHIFT;
+	Estimator->Drift = 0;
+	Estimator->Outliers = 0;
+	Estimator->Rejected = 0;
+}
+
+/*****************************************************************************
+ * RateEstimatorUpdate()
+ *****************************************************************************
+ * @brief
+ * Feed a raw feedback value into the estimator.
+ * @details
+ * This is a second-order (alpha-beta) loop: the estimate follows the
+ * feedback with a low-pass response, and the drift term removes the lag
+ * when the device clock drifts. A value too far from the prediction is
+ * dropped, unless AUDIO_RATE_ESTIMATOR_MAX_OUTLIERS arrive in a row, in which
+ * case the estimator locks on to the new rate.
+ * Returns FALSE if the value was dropped.
+ */
+static __inline
+BOOL
+RateEstimatorUpdate
+(
+	IN		PAUDIO_RATE_ESTIMATOR	Estimator,
+	IN		LONGLONG				Rate
+)
+{
+	LONGLONG Predicted = Estimator->Estimate + Estimator->Drift;
+
+	LONGLONG Error = (Rate << AUDIO_RATE_ESTIMATOR_SHIFT) - Predicted;
+
+	LONGLONG Tolerance = (Estimator->Nominal << AUDIO_RATE_ESTIMATOR_SHIFT) >> AUDIO_RATE_ESTIMATOR_TOLERANCE_SHIFT;
+
+	if ((Error > Tolerance) || (Error < -Tolerance))
+	{
+		Estimator->Rejected++;
+
+		if (++Estimator->Outliers < AUDIO_RATE_ESTIMATOR_MAX_OUTLIERS)
+		{
+			return FALSE;
+		}
+
+		Estimator->Estimate = Rate << AUDIO_RATE_ESTIMATOR_SHIFT;
+		Estimator->Drift = 0;
+		Estimator->Outliers = 0;
+
+		return TRUE;
+	}
+
+	Estimator->Outliers = 0;
+
+	Estimator->Estimate = Predicted + (Error >> AUDIO_RATE_ESTIMATOR_ALPHA_SHIFT);
+
+	Estimator->Drift += Error >> AUDIO_RATE_ESTIMATOR_BETA_SHIFT;
+
+	return TRUE;
+}
+
+/*****************************************************************************
+ * RateEstimatorRate()
+ *****************************************************************************
+ * @brief
+ * Get the filtered rate, rounded to the nearest 1/AUDIO_FF_UNIT.
+ */
+static __inline
+LONGLONG
+RateEstimatorRate
+(
+	IN		PAUDIO_RATE_ESTIMATOR	Estimator
+)
+{
+	return (Estimator->Estimate + (LONGLONG(1)<<(AUDIO_RATE_ESTIMATOR_SHIFT-1))) >> AUDIO_RATE_ESTIMATOR_SHIFT;
+}
+
+/*****************************************************************************
+ * RateEstimatorRatio()
+ *****************************************************************************
+ * @brief
+ * Get the ratio of the device clock to the nominal sample rate, in Q2.30.
+ */
+static __inline
+ULONG
+RateEstimatorRatio
+(
+	IN		PAUDIO_RATE_ESTIMATOR	Estimator
+)
+{
+	if (Estimator->Nominal <= 0)
+	{
+		return ULONG(1)<<AUDIO_CLOCK_RATIO_SHIFT;
+	}
+
+	LONGLONG Ratio = (RateEstimatorRate(Estimator) << AUDIO_CLOCK_RATIO_SHIFT) / Estimator->Nominal;
+
+	return (Ratio > LONGLONG(MAXULONG)) ? MAXULONG : ULONG(Ratio);
+}
+
+#endif // __FEEDBACK_H__
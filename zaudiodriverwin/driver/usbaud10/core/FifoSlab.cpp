@@ -0,0 +1,232 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       FifoSlab.cpp
+ * @brief      FIFO work item slab implementation.
+ *//*
+ *****************************************************************************
+ */
+#include "Audio.h"
+
+#define STR_MODULENAME "FifoSlab: "
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Round up to the slab alignment. */
+#define SLAB_ALIGN(x)	(((x) + AUDIO_FIFO_SLAB_ALIGNMENT - 1) & ~(AUDIO_FIFO_SLAB_ALIGNMENT - 1))
+
+#pragma code_seg("PAGE")
+
+/*****************************************************************************
+ * CAudioFifoSlab::Allocate()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Make sure the slab holds at least the given number of items of the given
+ * size.
+ * @details
+ * Does nothing if the slab is already large enough. Otherwise the old slab
+ * is freed, so none of its items may be in use.
+ * @param
+ * UsbDevice USB device to allocate the IRPs for.
+ * @param
+ * NumberOfItems Number of work items.
+ * @param
+ * MaximumNumberOfPackets Number of packets each URB must have room for.
+ * @param
+ * MaximumBufferSize Size of each transfer buffer.
+ * @return
+ * Returns STATUS_SUCCESS if successful. Otherwise, returns an appropriate
+ * error code.
+ */
+NTSTATUS
+CAudioFifoSlab::
+Allocate
+(
+	IN		PUSB_DEVICE	UsbDevice,
+	IN		ULONG		NumberOfItems,
+	IN		ULONG		MaximumNumberOfPackets,
+	IN		ULONG		MaximumBufferSize
+)
+{
+	PAGED_CODE();
+
+	if ((m_NumberOfItems >= NumberOfItems) &&
+		(m_MaximumNumberOfPackets >= MaximumNumberOfPackets) &&
+		(m_MaximumBufferSize >= MaximumBufferSize))
+	{
+		return STATUS_SUCCESS;
+	}
+
+	_DbgPrintF(DEBUGLVL_VERBOSE,("[CAudioFifoSlab::Allocate] - NumberOfItems: %d, MaximumNumberOfPackets: %d, MaximumBufferSize: %d", NumberOfItems, MaximumNumberOfPackets, MaximumBufferSize));
+
+	Free();
+
+	m_UrbOffset = SLAB_ALIGN(sizeof(AUDIO_FIFO_WORK_ITEM));
+	m_BufferOffset = m_UrbOffset + SLAB_ALIGN(GET_ISO_URB_SIZE(MaximumNumberOfPackets));
+	m_Stride = m_BufferOffset + SLAB_ALIGN(MaximumBufferSize);
+
+	// The pool only aligns small blocks to 8 or 16 bytes.
+	m_Memory = ExAllocatePoolWithTag(NonPagedPool, NumberOfItems * m_Stride + AUDIO_FIFO_SLAB_ALIGNMENT - 1, 'mdW');
+
+	if (!m_Memory)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	m_Base = PUCHAR(SLAB_ALIGN(ULONG_PTR(m_Memory)));
+
+	// AUDIO_FIFO_WORK_ITEM's constructor only clears the list links, so the
+	// zeroed items are ready to be used.
+	RtlZeroMemory(m_Base, NumberOfItems * m_Stride);
+
+	NTSTATUS ntStatus = STATUS_SUCCESS;
+
+	for (ULONG i = 0; i < NumberOfItems; i++)
+	{
+		PAUDIO_FIFO_WORK_ITEM FifoWorkItem = PAUDIO_FIFO_WORK_ITEM(m_Base + i * m_Stride);
+
+		FifoWorkItem->Urb = PURB(m_Base + i * m_Stride + m_UrbOffset);
+		FifoWorkItem->FifoBuffer = m_Base + i * m_Stride + m_BufferOffset;
+
+		ntStatus = UsbDevice->CreateIrp(&FifoWorkItem->Irp);
+
+		// Count the item now so that Free() releases its IRP.
+		m_NumberOfItems = i + 1;
+
+		if (!NT_SUCCESS(ntStatus))
+		{
+			break;
+		}
+	}
+
+	if (NT_SUCCESS(ntStatus))
+	{
+		m_MaximumNumberOfPackets = MaximumNumberOfPackets;
+		m_MaximumBufferSize = MaximumBufferSize;
+	}
+	else
+	{
+		Free();
+	}
+
+	return ntStatus;
+}
+
+/*****************************************************************************
+ * CAudioFifoSlab::Free()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Free the slab and the IRPs of its items.
+ */
+VOID
+CAudioFifoSlab::
+Free
+(	void
+)
+{
+	PAGED_CODE();
+
+	if (m_Memory)
+	{
+		for (ULONG i = 0; i < m_NumberOfItems; i++)
+		{
+			PAUDIO_FIFO_WORK_ITEM FifoWorkItem = PAUDIO_FIFO_WORK_ITEM(m_Base + i * m_Stride);
+
+			if (FifoWorkItem->Irp)
+			{
+				IoFreeIrp(FifoWorkItem->Irp);
+			}
+		}
+
+		ExFreePool(m_Memory);
+
+		m_Memory = NULL;
+	}
+
+	m_Base = NULL;
+	m_NumberOfItems = 0;
+	m_MaximumNumberOfPackets = 0;
+	m_MaximumBufferSize = 0;
+}
+
+/*****************************************************************************
+ * CAudioFifoSlab::GetNumberOfItems()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Get the number of items in the slab.
+ */
+ULONG
+CAudioFifoSlab::
+GetNumberOfItems
+(	void
+)
+{
+	PAGED_CODE();
+
+	return m_NumberOfItems;
+}
+
+/*****************************************************************************
+ * CAudioFifoSlab::GetItem()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Get a work item, cleared except for its IRP, URB and transfer buffer.
+ * @details
+ * The item must not be on any list.
+ * @param
+ * Index Index of the item.
+ * @return
+ * Returns the item, or NULL if the index is out of range.
+ */
+PAUDIO_FIFO_WORK_ITEM
+CAudioFifoSlab::
+GetItem
+(
+	IN		ULONG	Index
+)
+{
+	PAGED_CODE();
+
+	if (Index >= m_NumberOfItems)
+	{
+		return NULL;
+	}
+
+	PAUDIO_FIFO_WORK_ITEM FifoWorkItem = PAUDIO_FIFO_WORK_ITEM(m_Base + Index * m_Stride);
+
+	PIRP Irp = FifoWorkItem->Irp;
+
+	RtlZeroMemory(FifoWorkItem, sizeof(AUDIO_FIFO_WORK_ITEM));
+
+	FifoWorkItem->Irp = Irp;
+	FifoWorkItem->Urb = PURB(m_Base + Index * m_Stride + m_UrbOffset);
+	FifoWorkItem->FifoBuffer = m_Base + Index * m_Stride + m_BufferOffset;
+
+	return FifoWorkItem;
+}
+
+#pragma code_seg()
@@ -0,0 +1,106 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file	   FifoSlab.h
+ * @brief	   This file defines the slab that holds the FIFO work items of an
+ *			   isochronous data pipe, with their URBs, transfer buffers and
+ *			   IRPs.
+ *//*
+ *****************************************************************************
+ */
+#ifndef __FIFO_SLAB_H__
+#define __FIFO_SLAB_H__
+
+#include "AudioFifo.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Alignment of the work items, URBs and transfer buffers in the slab. */
+#define AUDIO_FIFO_SLAB_ALIGNMENT		64
+
+/*****************************************************************************
+ * Classes
+ */
+/*****************************************************************************
+ *//*! @class CAudioFifoSlab
+ *****************************************************************************
+ * @ingroup AUDIO_GROUP
+ * @brief
+ * FIFO work item slab.
+ * @details
+ * The work items, URBs and transfer buffers are carved out of a single
+ * non-paged block, each on its own cache line, and the IRPs are allocated
+ * along with it. The slab is kept until it is freed or found too small, so
+ * the pipe doesn't go back to the pool each time the stream is started or
+ * its format is changed.
+ *
+ * The items belong to the slab: they must never be destructed, and they
+ * are all invalid once the slab is freed or reallocated.
+ */
+class CAudioFifoSlab
+{
+private:
+	PVOID			m_Memory;					/*!< @brief Block as returned by the pool. */
+	PUCHAR			m_Base;						/*!< @brief Aligned start of the block. */
+	ULONG			m_Stride;					/*!< @brief Bytes from one item to the next. */
+	ULONG			m_UrbOffset;				/*!< @brief Offset of the URB from the item. */
+	ULONG			m_BufferOffset;				/*!< @brief Offset of the transfer buffer from the item. */
+	ULONG			m_NumberOfItems;			/*!< @brief Number of items in the slab. */
+	ULONG			m_MaximumNumberOfPackets;	/*!< @brief Number of packets each URB has room for. */
+	ULONG			m_MaximumBufferSize;		/*!< @brief Size of each transfer buffer. */
+
+public:
+    /*************************************************************************
+     * Constructor/destructor.
+     */
+	/*! @brief Constructor. */
+	CAudioFifoSlab() { m_Memory = NULL; m_Base = NULL; m_NumberOfItems = 0; m_MaximumNumberOfPackets = 0; m_MaximumBufferSize = 0; }
+	/*! @brief Destructor. */
+	~CAudioFifoSlab() { Free(); }
+
+    /*************************************************************************
+     * CAudioFifoSlab methods
+     */
+	NTSTATUS Allocate
+	(
+		IN		PUSB_DEVICE	UsbDevice,
+		IN		ULONG		NumberOfItems,
+		IN		ULONG		MaximumNumberOfPackets,
+		IN		ULONG		MaximumBufferSize
+	);
+
+	VOID Free
+	(	void
+	);
+
+	ULONG GetNumberOfItems
+	(	void
+	);
+
+	PAUDIO_FIFO_WORK_ITEM GetItem
+	(
+		IN		ULONG	Index
+	);
+};
+
+#endif // __FIFO_SLAB_H__
@@ -0,0 +1,296 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file	   Gain.h
+ * @brief	   This file defines the fixed-point gain routines used to apply
+ *			   the software master volume/mute to the samples in the FIFO.
+ *//*
+ *****************************************************************************
+ */
+#ifndef __GAIN_H__
+#define __GAIN_H__
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Gains are unsigned Q2.30 fixed-point values. */
+#define AUDIO_GAIN_SHIFT		30
+#define AUDIO_GAIN_UNITY		(LONG(1)<<AUDIO_GAIN_SHIFT)
+#define AUDIO_GAIN_ROUNDING		(LONGLONG(1)<<(AUDIO_GAIN_SHIFT-1))
+
+/*! @brief Number of frames over which a gain change is ramped. */
+#define AUDIO_GAIN_RAMP_FRAMES	256
+
+/*! @brief The gain table has one entry every 0.5 dB (volume is in 1/65536 dB). */
+#define AUDIO_GAIN_TABLE_SHIFT	15
+#define AUDIO_GAIN_TABLE_SIZE	193
+
+/*****************************************************************************
+ * Gain table
+ *****************************************************************************
+ * @brief
+ * 10^(-n/40) in Q2.30 for n = 0..192, i.e. 0 dB down to -96 dB in 0.5 dB steps.
+ */
+static const LONG GainTable[AUDIO_GAIN_TABLE_SIZE] =
+{
+	1073741824, 1013677647, 956973408, 903441154, 852903448, 805192776, 760150998, 717628817,
+	677485290, 639587356, 603809400, 570032831, 538145694, 508042296, 479622855, 452793173,
+	427464319, 403552340, 380977976, 359666402, 339546978, 320553018, 302621563, 285693178,
+	269711752, 254624313, 240380852, 226934158, 214239660, 202255281, 190941298, 180260209,
+	170176611, 160657080, 151670064, 143185773, 135176087, 127614455, 120475814, 113736503,
+	107374182, 101367765, 95697341, 90344115, 85290345, 80519278, 76015100, 71762882,
+	67748529, 63958736, 60380940, 57003283, 53814569, 50804230, 47962285, 45279317,
+	42746432, 40355234, 38097798, 35966640, 33954698, 32055302, 30262156, 28569318,
+	26971175, 25462431, 24038085, 22693416, 21423966, 20225528, 19094130, 18026021,
+	17017661, 16065708, 15167006, 14318577, 13517609, 12761445, 12047581, 11373650,
+	10737418, 10136776, 9569734, 9034412, 8529034, 8051928, 7601510, 7176288,
+	6774853, 6395874, 6038094, 5700328, 5381457, 5080423, 4796229, 4527932,
+	4274643, 4035523, 3809780, 3596664, 3395470, 3205530, 3026216, 2856932,
+	2697118, 2546243, 2403809, 2269342, 2142397, 2022553, 1909413, 1802602,
+	1701766, 1606571, 1516701, 1431858, 1351761, 1276145, 1204758, 1137365,
+	1073742, 1013678, 956973, 903441, 852903, 805193, 760151, 717629,
+	677485, 639587, 603809, 570033, 538146, 508042, 479623, 452793,
+	427464, 403552, 380978, 359666, 339547, 320553, 302622, 285693,
+	269712, 254624, 240381, 226934, 214240, 202255, 190941, 180260,
+	170177, 160657, 151670, 143186, 135176, 127614, 120476, 113737,
+	107374, 101368, 95697, 90344, 85290, 80519, 76015, 71763,
+	67749, 63959, 60381, 57003, 53815, 50804, 47962, 45279,
+	42746, 40355, 38098, 35967, 33955, 32055, 30262, 28569,
+	26971, 25462, 24038, 22693, 21424, 20226, 19094, 18026,
+	17018
+};
+
+/*****************************************************************************
+ * DecibelToGain()
+ *****************************************************************************
+ * @brief
+ * Convert a volume in 1/65536 dB to a Q2.30 linear gain. Positive volumes
+ * are clamped to unity; values between table entries are interpolated.
+ */
+static
+LONG
+DecibelToGain
+(
+	IN		LONG	Decibel
+)
+{
+	if (Decibel >= 0)
+	{
+		return AUDIO_GAIN_UNITY;
+	}
+
+	ULONG Attenuation = ULONG(-Decibel);
+
+	ULONG Index = Attenuation >> AUDIO_GAIN_TABLE_SHIFT;
+
+	if (Index >= (AUDIO_GAIN_TABLE_SIZE-1))
+	{
+		return GainTable[AUDIO_GAIN_TABLE_SIZE-1];
+	}
+
+	LONG Fraction = LONG(Attenuation & ((1<<AUDIO_GAIN_TABLE_SHIFT)-1));
+
+	LONG Delta = GainTable[Index] - GainTable[Index+1];
+
+	return GainTable[Index] - LONG((LONGLONG(Delta) * Fraction) >> AUDIO_GAIN_TABLE_SHIFT);
+}
+
+/*****************************************************************************
+ * ScaleSample()
+ *****************************************************************************
+ * @brief
+ * Scale a sample by a Q2.30 gain, rounding to nearest.
+ */
+static __forceinline
+LONG
+ScaleSample
+(
+	IN		LONG	Sample,
+	IN		LONG	Gain
+)
+{
+	return LONG((LONGLONG(Sample) * Gain + AUDIO_GAIN_ROUNDING) >> AUDIO_GAIN_SHIFT);
+}
+
+/*****************************************************************************
+ * ReadSample()
+ *****************************************************************************
+ * @brief
+ * Read a 16, 24 (packed) or 32-bit sample as a left-justified 32-bit value.
+ */
+template <ULONG Bits>
+static __forceinline
+LONG
+ReadSample
+(
+	IN		PUCHAR	Src
+)
+{
+	switch (Bits)
+	{
+		case 16:
+			return LONG(*PSHORT(Src))<<16;
+
+		case 24:
+			return (LONG(Src[2])<<24) | (LONG(Src[1])<<16) | (LONG(Src[0])<<8);
+
+		default:
+			return *PLONG(Src);
+	}
+}
+
+/*****************************************************************************
+ * WriteSample()
+ *****************************************************************************
+ * @brief
+ * Write a right-justified 16, 24 (packed) or 32-bit sample.
+ */
+template <ULONG Bits>
+static __forceinline
+VOID
+WriteSample
+(
+	IN		PUCHAR	Dst,
+	IN		LONG	Sample
+)
+{
+	switch (Bits)
+	{
+		case 16:
+			*PSHORT(Dst) = SHORT(Sample);
+			break;
+
+		case 24:
+			Dst[0] = UCHAR(Sample);
+			Dst[1] = UCHAR(Sample>>8);
+			Dst[2] = UCHAR(Sample>>16);
+			break;
+
+		default:
+			*PLONG(Dst) = Sample;
+			break;
+	}
+}
+
+/*****************************************************************************
+ * ConvertGain()
+ *****************************************************************************
+ * @brief
+ * Convert SrcBits samples to DstBits samples and apply per-channel gains in
+ * a single pass. If GainStep is not NULL, each gain is advanced by its step
+ * before every frame. Channels is the channel count, or 0 to use
+ * NumberOfChannels. Src and Dst may be the same buffer if SrcBits equals
+ * DstBits.
+ * @details
+ * The sample is truncated to DstBits before the gain is applied, which
+ * gives the same result as the Copy*_* conversion followed by the gain.
+ */
+template <ULONG SrcBits, ULONG DstBits, ULONG Channels>
+static
+VOID
+ConvertGain
+(
+	IN		PUCHAR	Dst,
+	IN		PUCHAR	Src,
+	IN		ULONG	NumberOfFrames,
+	IN		ULONG	NumberOfChannels,
+	IN OUT	PLONG	Gain,
+	IN		PLONG	GainStep
+)
+{
+	if (Channels) NumberOfChannels = Channels;
+
+	for (ULONG i=0; i<NumberOfFrames; i++)
+	{
+		for (ULONG ch=0; ch<NumberOfChannels; ch++)
+		{
+			if (GainStep) Gain[ch] += GainStep[ch];
+
+			LONG Sample = ReadSample<SrcBits>(Src) >> (32-DstBits);
+
+			WriteSample<DstBits>(Dst, ScaleSample(Sample, Gain[ch]));
+
+			Src += SrcBits/8;
+			Dst += DstBits/8;
+		}
+	}
+}
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Signature of the ConvertGain() instances. */
+typedef VOID (*AUDIO_CONVERT_GAIN_ROUTINE)(PUCHAR Dst, PUCHAR Src, ULONG NumberOfFrames, ULONG NumberOfChannels, PLONG Gain, PLONG GainStep);
+
+/*! @brief ConvertGain() instances for the generic, 2, 4 and 16 channel cases. */
+#define CONVERT_GAIN_ROUTINES(SrcBits, DstBits) \
+	{ ConvertGain<SrcBits,DstBits,0>, ConvertGain<SrcBits,DstBits,2>, ConvertGain<SrcBits,DstBits,4>, ConvertGain<SrcBits,DstBits,16> }
+
+/*****************************************************************************
+ * ConvertGainRoutines
+ *****************************************************************************
+ * @brief
+ * ConvertGain() instances indexed by source depth, destination depth (16, 24,
+ * 32) and channel count.
+ */
+static const AUDIO_CONVERT_GAIN_ROUTINE ConvertGainRoutines[3][3][4] =
+{
+	{ CONVERT_GAIN_ROUTINES(16,16), CONVERT_GAIN_ROUTINES(16,24), CONVERT_GAIN_ROUTINES(16,32) },
+	{ CONVERT_GAIN_ROUTINES(24,16), CONVERT_GAIN_ROUTINES(24,24), CONVERT_GAIN_ROUTINES(24,32) },
+	{ CONVERT_GAIN_ROUTINES(32,16), CONVERT_GAIN_ROUTINES(32,24), CONVERT_GAIN_ROUTINES(32,32) }
+};
+
+/*****************************************************************************
+ * FindConvertGainRoutine()
+ *****************************************************************************
+ * @brief
+ * Find the ConvertGain() instance for the given depths and channel count.
+ * Returns NULL if either depth is not 16, 24 or 32 bits.
+ */
+static
+AUDIO_CONVERT_GAIN_ROUTINE
+FindConvertGainRoutine
+(
+	IN		ULONG	FromBitPerSample,
+	IN		ULONG	ToBitPerSample,
+	IN		ULONG	NumberOfChannels
+)
+{
+	if (((FromBitPerSample != 16) && (FromBitPerSample != 24) && (FromBitPerSample != 32)) ||
+		((ToBitPerSample != 16) && (ToBitPerSample != 24) && (ToBitPerSample != 32)))
+	{
+		return NULL;
+	}
+
+	ULONG ChannelIndex = 0;
+
+	switch (NumberOfChannels)
+	{
+		case 2:  ChannelIndex = 1; break;
+		case 4:  ChannelIndex = 2; break;
+		case 16: ChannelIndex = 3; break;
+	}
+
+	return ConvertGainRoutines[FromBitPerSample/8-2][ToBitPerSample/8-2][ChannelIndex];
+}
+
+#endif // __GAIN_H__
@@ -0,0 +1,181 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file	   Histogram.h
+ * @brief	   This file defines the lock-free log2 histograms used to keep
+ *			   the transfer statistics of the isochronous pipes.
+ *//*
+ *****************************************************************************
+ */
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Number of buckets. Bucket 0 counts 0, bucket n counts [2^(n-1), 2^n), the last bucket counts everything above. */
+#define AUDIO_HISTOGRAM_BUCKETS		32
+
+/*!
+ * @brief
+ * Histogram. The buckets are only ever changed with interlocked operations,
+ * so it can be updated from several completion routines at once and read
+ * at any time without a lock.
+ */
+typedef struct
+{
+	volatile LONG	Count[AUDIO_HISTOGRAM_BUCKETS];	/*!< @brief Number of samples in each bucket. */
+} AUDIO_HISTOGRAM, *PAUDIO_HISTOGRAM;
+
+/*****************************************************************************
+ * HistogramBucket()
+ *****************************************************************************
+ * @brief
+ * Get the log2 bucket of a value.
+ */
+static __inline
+ULONG
+HistogramBucket
+(
+	IN		ULONG	Value
+)
+{
+	if (!Value)
+	{
+		return 0;
+	}
+
+	ULONG Bucket = 1;
+
+	if (Value & 0xFFFF0000) { Bucket += 16; Value >>= 16; }
+	if (Value & 0x0000FF00) { Bucket += 8; Value >>= 8; }
+	if (Value & 0x000000F0) { Bucket += 4; Value >>= 4; }
+	if (Value & 0x0000000C) { Bucket += 2; Value >>= 2; }
+	if (Value & 0x00000002) { Bucket += 1; }
+
+	return (Bucket < AUDIO_HISTOGRAM_BUCKETS) ? Bucket : AUDIO_HISTOGRAM_BUCKETS-1;
+}
+
+/*****************************************************************************
+ * HistogramAdd()
+ *****************************************************************************
+ * @brief
+ * Count one sample in the given bucket.
+ */
+static __inline
+VOID
+HistogramAdd
+(
+	IN		PAUDIO_HISTOGRAM	Histogram,
+	IN		ULONG				Bucket
+)
+{
+	if (Bucket < AUDIO_HISTOGRAM_BUCKETS)
+	{
+		InterlockedIncrement((PLONG)&Histogram->Count[Bucket]);
+	}
+}
+
+/*****************************************************************************
+ * HistogramRecord()
+ *****************************************************************************
+ * @brief
+ * Count one sample in the log2 bucket of its value.
+ */
+static __inline
+VOID
+HistogramRecord
+(
+	IN		PAUDIO_HISTOGRAM	Histogram,
+	IN		ULONG				Value
+)
+{
+	HistogramAdd(Histogram, HistogramBucket(Value));
+}
+
+/*****************************************************************************
+ * HistogramReset()
+ *****************************************************************************
+ * @brief
+ * Clear all the buckets.
+ */
+static __inline
+VOID
+HistogramReset
+(
+	IN		PAUDIO_HISTOGRAM	Histogram
+)
+{
+	for (ULONG i=0; i<AUDIO_HISTOGRAM_BUCKETS; i++)
+	{
+		InterlockedExchange((PLONG)&Histogram->Count[i], 0);
+	}
+}
+
+/*****************************************************************************
+ * HistogramRead()
+ *****************************************************************************
+ * @brief
+ * Copy the buckets out. Each bucket is read atomically, but samples counted
+ * while the copy is in progress may or may not be included.
+ */
+static __inline
+VOID
+HistogramRead
+(
+	IN		PAUDIO_HISTOGRAM	Histogram,
+	OUT		PULONG				Counts
+)
+{
+	for (ULONG i=0; i<AUDIO_HISTOGRAM_BUCKETS; i++)
+	{
+		Counts[i] = ULONG(Histogram->Count[i]);
+	}
+}
+
+/*****************************************************************************
+ * HistogramElapsedTime()
+ *****************************************************************************
+ * @brief
+ * Convert the difference between two performance counter values to
+ * microseconds.
+ */
+static __inline
+ULONG
+HistogramElapsedTime
+(
+	IN		LONGLONG	Start,
+	IN		LONGLONG	End,
+	IN		LONGLONG	Frequency
+)
+{
+	if ((End <= Start) || (Frequency <= 0))
+	{
+		return 0;
+	}
+
+	LONGLONG Elapsed = ((End - Start) * 1000000) / Frequency;
+
+	return (Elapsed > LONGLONG(MAXULONG)) ? MAXULONG : ULONG(Elapsed);
+}
+
+#endif // __HISTOGRAM_H__
@@ -0,0 +1,162 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd. 
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public 
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file	   ImplicitFeedback.h
+ * @brief	   This file defines the queue of packet sizes that an input data
+ *			   pipe hands to the output data pipe it paces.
+ *//*
+ *****************************************************************************
+ */
+#ifndef __IMPLICIT_FEEDBACK_H__
+#define __IMPLICIT_FEEDBACK_H__
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Number of packet sizes an output data pipe can queue from its implicit feedback pipe. Must be a power of 2. */
+#define AUDIO_IMPLICIT_FEEDBACK_QUEUE_SIZE	128
+
+/*****************************************************************************
+ * Classes
+ */
+/*****************************************************************************
+ *//*! @class CImplicitFeedbackQueue
+ *****************************************************************************
+ * @ingroup AUDIO_GROUP
+ * @brief
+ * Sizes in frames of the packets received by an input data pipe, in the
+ * order they were received.
+ * @details
+ * The input pipe adds the sizes on completion, and the output pipe it is
+ * paired with takes them to size its own packets. m_WriteIndex and
+ * m_ReadIndex are free-running, and only the input and the output pipe
+ * respectively write them, so neither needs a lock. m_StartIndex is where
+ * the sizes of the current pairing start; the ones before it were received
+ * for an earlier pairing and are skipped.
+ */
+class CImplicitFeedbackQueue
+{
+private:
+	ULONG			m_Queue[AUDIO_IMPLICIT_FEEDBACK_QUEUE_SIZE];	/*!< @brief Packet sizes, in frames. */
+	volatile ULONG	m_WriteIndex;	/*!< @brief Only written by the input pipe. */
+	volatile ULONG	m_ReadIndex;	/*!< @brief Only written by the output pipe. */
+	volatile ULONG	m_StartIndex;	/*!< @brief First size queued since the pipes were last paired.
+									 * Only written when they are paired. */
+
+public:
+	/*! @brief Empty the queue. */
+	void Init(void)
+	{
+		m_WriteIndex = m_ReadIndex = m_StartIndex = 0;
+	}
+
+	/*! @brief Pairing: skip the sizes queued until now. */
+	void Restart(void)
+	{
+		m_StartIndex = m_WriteIndex;
+
+		KeMemoryBarrier();
+	}
+
+	/*! @brief Output pipe: drop the sizes queued until now, e.g. while it was stopped. */
+	void Flush(void)
+	{
+		m_ReadIndex = m_WriteIndex;
+	}
+
+	/*! @brief Input pipe: get the index to queue the next size at. */
+	ULONG BeginPut(void)
+	{
+		return m_WriteIndex;
+	}
+
+	/*! @brief Input pipe: queue a size at WriteIndex. Fails if the queue is full, i.e. nobody is taking them. */
+	BOOL Put(ULONG WriteIndex, ULONG NumberOfFrames)
+	{
+		if ((WriteIndex - m_ReadIndex) >= AUDIO_IMPLICIT_FEEDBACK_QUEUE_SIZE)
+		{
+			return FALSE;
+		}
+
+		m_Queue[WriteIndex & (AUDIO_IMPLICIT_FEEDBACK_QUEUE_SIZE - 1)] = NumberOfFrames;
+
+		return TRUE;
+	}
+
+	/*! @brief Input pipe: publish the sizes queued up to WriteIndex. */
+	void EndPut(ULONG WriteIndex)
+	{
+		KeMemoryBarrier();
+
+		m_WriteIndex = WriteIndex;
+	}
+
+	/*!
+	 * @brief
+	 * Output pipe: add up the next NumberOfTransfers sizes, and take them if
+	 * Take is TRUE. Fails if fewer are queued.
+	 */
+	BOOL Get(ULONG NumberOfTransfers, BOOL Take, ULONG * OutTransferSizeInFrames)
+	{
+		ULONG ReadIndex = m_ReadIndex;
+
+		ULONG StartIndex = m_StartIndex;
+
+		if (LONG(StartIndex - ReadIndex) > 0)
+		{
+			// Drop the sizes queued before the pipes were paired again.
+			ReadIndex = StartIndex;
+
+			if (Take)
+			{
+				m_ReadIndex = ReadIndex;
+			}
+		}
+
+		if ((m_WriteIndex - ReadIndex) < NumberOfTransfers)
+		{
+			return FALSE;
+		}
+
+		KeMemoryBarrier();
+
+		ULONG TransferSizeInFrames = 0;
+
+		for (ULONG i = 0; i < NumberOfTransfers; i++)
+		{
+			TransferSizeInFrames += m_Queue[(ReadIndex + i) & (AUDIO_IMPLICIT_FEEDBACK_QUEUE_SIZE - 1)];
+		}
+
+		if (Take)
+		{
+			KeMemoryBarrier();
+
+			m_ReadIndex = ReadIndex + NumberOfTransfers;
+		}
+
+		*OutTransferSizeInFrames = TransferSizeInFrames;
+
+		return TRUE;
+	}
+};
+
+#endif // __IMPLICIT_FEEDBACK_H__
@@ -52,7 +52,7 @@
  */
 #define BLOCK_ALIGN 4
 
-#define GET_NUM_AVAIL() (BUFFER_SIZE - GetNumQueuedPackets())
+#define GET_NUM_AVAIL() (m_Ring.Size() - GetNumQueuedPackets())
 
 static 
 UCHAR SIZEOF_MIDI[] = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1 };
@@ -100,10 +100,7 @@ Init
 
 	m_CableNumber = Cable->CableNumber();
 
-	m_ReadPosition = 0;
-    m_WritePosition = 1;
-
-	BUFFER_SIZE = (m_Direction == MIDI_OUTPUT) ? OUTPUT_BUFFER_SIZE : INPUT_BUFFER_SIZE;
+	m_RequestedBufferSize = MIDI_CLIENT_DEFAULT_BUFFER_SIZE;
 
 	m_CallbackData = CallbackData;
     m_CallbackRoutine = CallbackRoutine;
@@ -122,6 +119,49 @@ Init
 	return MIDIERR_SUCCESS;
 }
 
+/*****************************************************************************
+ * CMidiClient::SetBufferSize()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Set the size of the client ring buffer.
+ * @details
+ * The size is rounded up to a power of 2, and clamped to the range
+ * MIDI_CLIENT_MINIMUM_BUFFER_SIZE..MIDI_CLIENT_MAXIMUM_BUFFER_SIZE. The ring
+ * buffer is allocated when the client is first started, so the size must be
+ * set before then.
+ * @param
+ * NumberOfPackets Number of USB-MIDI event packets the ring buffer holds.
+ * @return
+ * Returns MIDIERR_SUCCESS if successful. Otherwise, returns an appropriate
+ * error code.
+ */
+MIDISTATUS
+CMidiClient::
+SetBufferSize
+(
+	IN		ULONG	NumberOfPackets
+)
+{
+	PAGED_CODE();
+
+	if (m_Ring.Buffer())
+	{
+		return MIDIERR_BAD_REQUEST;
+	}
+
+	ULONG BufferSize = MIDI_CLIENT_MINIMUM_BUFFER_SIZE;
+
+	while ((BufferSize < NumberOfPackets) && (BufferSize < MIDI_CLIENT_MAXIMUM_BUFFER_SIZE))
+	{
+		BufferSize <<= 1;
+	}
+
+	m_RequestedBufferSize = BufferSize;
+
+	return MIDIERR_SUCCESS;
+}
+
 #pragma code_seg()
 
 /*****************************************************************************
@@ -144,6 +184,26 @@ Cable
 	return m_Cable;
 }
 
+/*****************************************************************************
+ * CMidiClient::GetMemoryFootprint()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Returns the nonpaged memory held by the client.
+ * @param
+ * <None>
+ * @return
+ * Returns the size of the client object and its ring buffer, in bytes.
+ */
+ULONG
+CMidiClient::
+GetMemoryFootprint
+(	void
+)
+{
+	return sizeof(CMidiClient) + m_Ring.Size() * sizeof(USB_MIDI_EVENT_PACKET_EX);
+}
+
 /*****************************************************************************
  * CMidiClient::Lock()
  *****************************************************************************
@@ -175,28 +235,11 @@ Unlock
 }
 
 /*
- * Important note: If you look at how m_ReadPosition and m_WritePosition are
- * handled, you'll notice that the ring buffer never gets completely full
- * (there always is one byte left open).
- *
- * To see this, consider the following case:
- *
- *
- *    0    1    2    3    4
- * +----+----+----+----+----+
- * |    |    |    |    |    |
- * +----+----+----+----+----+
- *
- * In the beginning, with nothing in the buffer, m_ReadPosition = 0,
- * m_WritePosition = 1. In this case, the ring buffer is 5 bytes in size
- * (BUFFER_SIZE == 4). If we call AddByte() four times, m_WritePosition
- * will be equal to 0 , while m_ReadPosition == 0.  At this point,
- * m_WritePosition == m_ReadPosition, so we consider the ring buffer to be
- * full.  Note, however, that we never wrote a byte to buffer[0], since
- * m_WritePosition started out being initialized to 1.
- *
- * This scheme is a little weird, but it has the advantage of making it
- * really easy to determine when the buffer is full or empty.
+ * The ring buffer is a single producer, single consumer queue (see
+ * CMidiRing). The producer is the bulk in completion DPC for an input
+ * client, and the client's writer for an output client. The consumer is the
+ * client's reader for an input client, and whoever flushes the client to the
+ * cable FIFO, under the client lock, for an output client.
  */
 /*****************************************************************************
  * CMidiClient::AddPacket()
@@ -219,22 +262,7 @@ AddPacket
 	IN		LONGLONG				TimeStampCounter
 )
 {
-    if (m_ReadPosition == m_WritePosition)
-	{
-        /* Buffer is completely FULL */
-        return FALSE;
-	}
-    else
-	{
-        /* There's at least one byte left */
-        m_DataBuffer[m_WritePosition].Packet = Packet;
-        m_DataBuffer[m_WritePosition].TimeStampCounter = TimeStampCounter;
-
-		m_WritePosition++;
-        m_WritePosition %= (BUFFER_SIZE+1);
-
-        return TRUE;
-    }
+	return m_Ring.AddPacket(Packet, TimeStampCounter);
 }
 
 /*****************************************************************************
@@ -260,27 +288,7 @@ RemovePacket
 	OUT		LONGLONG *				OutTimeStampCounter	OPTIONAL
 )
 {
-    USHORT NewReadPosition = (m_ReadPosition + 1) % (BUFFER_SIZE+1);
-
-    if (NewReadPosition == m_WritePosition)
-	{
-        /* Buffer empty */
-        return FALSE;
-    }
-	else
-	{
-        /* There's at least one character available */
-        *OutPacket = m_DataBuffer[NewReadPosition].Packet;
-
-		if (OutTimeStampCounter)
-		{
-			*OutTimeStampCounter = m_DataBuffer[NewReadPosition].TimeStampCounter;
-		}
-
-		m_ReadPosition = NewReadPosition;
-
-        return TRUE;
-    }
+	return m_Ring.RemovePacket(OutPacket, OutTimeStampCounter);
 }
 
 /*****************************************************************************
@@ -305,25 +313,7 @@ PeekPacket
 	OUT		LONGLONG *				OutTimeStampCounter	OPTIONAL
 )
 {
-    USHORT NewReadPosition = (m_ReadPosition + 1) % (BUFFER_SIZE+1);
-
-    if (NewReadPosition == m_WritePosition)
-	{
-        /* Buffer empty */
-        return FALSE;
-    }
-	else
-	{
-        /* There's at least one character available */
-        *OutPacket = m_DataBuffer[NewReadPosition].Packet;
-
-		if (OutTimeStampCounter)
-		{
-			*OutTimeStampCounter = m_DataBuffer[NewReadPosition].TimeStampCounter;
-		}
-
-        return TRUE;
-    }
+	return m_Ring.PeekPacket(OutPacket, OutTimeStampCounter);
 }
 
 #if DBG
@@ -778,6 +768,8 @@ DisassemblePacket
  *****************************************************************************
  * @ingroup MIDI_GROUP
  * @brief
+ * Parse the queued input bytes up to the next message (see
+ * ::PackageMidiEvent()).
  */
 ULONG
 CMidiClient::
@@ -790,163 +782,7 @@ PackageMidiEvent
 	OUT		BOOL *			OutStructured
 )
 {
-	// If the message is structured.
-	BOOL Structured = TRUE;
-
-	// Parse the MIDI bytes to form messages.
-	ULONG Success = 0;
-
-	for (ULONG i=0; BytesQueue->CanGetQueue(); i++)
-	{
-		UCHAR Byte;  BytesQueue->GetQueue(&Byte);
-
-		UCHAR Status = m_MidiParser.Parse(Byte);
-
-		switch (Status)
-		{
-			case NOTE_OFF:
-			case NOTE_ON:
-			case POLYKEY_PRESSURE:
-			case CONTROL_CHANGE:
-			case PITCH_WHEEL:
-			case SONG_POS_POINTER:
-			{
-				Buffer[0] = m_MidiParser.GetChannelStatus();
-				Buffer[1] = m_MidiParser.GetData0();
-				Buffer[2] = m_MidiParser.GetData1();
-
-				Success = 3;
-			}
-			break;
-
-			case PROGRAM_CHANGE:
-			case CHANNEL_PRESSURE:
-			case MTC_QUARTER_FRAME:
-			case SONG_SELECT:
-			{
-				Buffer[0] = m_MidiParser.GetChannelStatus();
-				Buffer[1] = m_MidiParser.GetData0();
-
-				Success = 2;
-			}
-			break;
-
-			case SYSEX:
-			{
-				// This status is returned at the end of the SysEx message.
-				ASSERT(m_MidiParser.GetChannelStatus() == SYSEX);
-
-				CMidiQueue * MidiQueue = m_MidiParser.GetMidiQueue();
-
-				USHORT BytesInQueue = MidiQueue->CanGetQueue(); // including EOX
-
-				ASSERT((BytesInQueue > 0) && BytesInQueue <=BufferLength);
-
-				for (ULONG j=0; j<BytesInQueue; j++)
-				{
-					MidiQueue->GetQueue(&Buffer[j]);
-				}
-
-				if (m_SysExTimeStampCounter)
-				{
-					*TimeStampCounter = m_SysExTimeStampCounter;
-				}
-
-				m_SysExTimeStampCounter = 0;
-
-				Success = BytesInQueue;
-
-				Structured = FALSE;
-			}
-			break;
-
-
-			case F4: /* ED-MIDI command. */
-			{
-				ULONG DataCount = m_MidiParser.GetDataCount();
-
-				if (DataCount == 2)
-				{
-					// 3 byte system common message.
-					Buffer[0] = m_MidiParser.GetChannelStatus();
-					Buffer[1] = m_MidiParser.GetData0();
-					Buffer[2] = m_MidiParser.GetData1();
-
-					Success = 3;
-				}
-				else if (DataCount > 2)
-				{
-					// 1 byte data only, no message.
-					Buffer[0] = m_MidiParser.GetData0();
-
-					Success = 1;
-				}
-			}
-			break;
-
-			//case 0xF5: /* Undefined data bytes. */
-			case TUNE_REQUEST:
-			case TIMING_CLOCK:
-			case 0xF9:
-			case START:
-			case CONTINUE:
-			case STOP:
-			case 0xFD:
-			case ACTIVE_SENSING:
-			case SYSTEM_RESET:
-			{
-				// Single byte system common message.
-				Buffer[0] = Status;
-
-				Success = 1;
-			}
-			break;
-
-			case NOOP:
-			{
-				if (m_MidiParser.GetChannelStatus() == SYSEX)
-				{
-					// Start or running SysEx message.
-					CMidiQueue * MidiQueue = m_MidiParser.GetMidiQueue();
-
-					USHORT BytesInQueue = MidiQueue->CanGetQueue();
-
-					if (m_SysExTimeStampCounter == 0)
-					{
-						m_SysExTimeStampCounter = *TimeStampCounter;
-					}
-
-					if (BytesInQueue >= BufferLength)
-					{
-						for (ULONG j=0; j<BufferLength; j++)
-						{
-							MidiQueue->GetQueue(&Buffer[j]);
-						}
-
-						LONGLONG NewSysExTimeStampCounter = *TimeStampCounter;
-
-						*TimeStampCounter = m_SysExTimeStampCounter;
-
-						m_SysExTimeStampCounter = NewSysExTimeStampCounter;
-
-						Success = BufferLength;
-					}
-
-					Structured = FALSE;
-				}
-			}
-			break;
-		}
-
-		if (Success) break;
-	}
-
-	if (OutStructured)
-	{
-		*OutStructured = Structured;
-	}
-
-	return Success;
+	return ::PackageMidiEvent(&m_MidiParser, &m_SysExTimeStampCounter, BytesQueue, Buffer, BufferLength, TimeStampCounter, OutStructured);
 }
 
 /*****************************************************************************
@@ -1000,11 +836,9 @@ ReceivePacket
 	IN		LONGLONG				TimeStampCounter
 )
 {
-	Lock();
-
+	/* The completion DPC is the only producer, so there is no need to take
+	   the client lock, which the reader holds. */
 	AddPacket(Packet, TimeStampCounter);
-
-	Unlock();
 }
 
 /*****************************************************************************
@@ -1024,14 +858,7 @@ GetNumQueuedPackets
 (	void
 )
 {
-    if (m_WritePosition > m_ReadPosition)
-	{
-        return m_WritePosition - m_ReadPosition - 1;
-	}
-    else
-	{
-        return (BUFFER_SIZE+1) - m_ReadPosition + m_WritePosition - 1;
-	}
+	return m_Ring.GetNumQueuedPackets();
 }
 
 /*****************************************************************************
@@ -1040,6 +867,11 @@ GetNumQueuedPackets
  * @ingroup MIDI_GROUP
  * @brief
  * Flush the MIDI packets queued to the FIFO.
+ * @details
+ * The packets are time stamped with when they are to be sent. Those that are
+ * not due yet stay in the ring buffer, and the cable is asked to service the
+ * client again when the first of them is. As the ring buffer is in time
+ * order, nothing behind that packet is due either.
  * @param
  * <None>
  * @return
@@ -1058,6 +890,8 @@ FlushBuffer
 
 	BOOL EndOfMessage = FALSE;
 
+	LONGLONG CurrentTimeStampCounter = KeQueryPerformanceCounter(NULL).QuadPart;
+
 	if (Synchronize) Lock();
 
 	if (SysExMode)
@@ -1066,8 +900,19 @@ FlushBuffer
 		{
 			USB_MIDI_EVENT_PACKET Packet;
 
-			if (RemovePacket(&Packet, NULL))
+			LONGLONG TimeStampCounter;
+
+			if (PeekPacket(&Packet, &TimeStampCounter))
 			{
+				if (!MidiIsDue(TimeStampCounter, CurrentTimeStampCounter))
+				{
+					/* Not due yet, the rest of the message goes out later. */
+					m_Cable->ScheduleService(TimeStampCounter, CurrentTimeStampCounter);
+					break;
+				}
+
+				RemovePacket(&Packet, NULL);
+
 				/* If this is a realtime message, flush it out immediately. */
 				BOOL Flush = (Packet.CodeIndexNumber == CODE_INDEX_NUMBER_1_BYTE) && 
 					         (Packet.MIDI[0] >= TIMING_CLOCK) && (Packet.MIDI[0] <= SYSTEM_RESET);
@@ -1097,8 +942,22 @@ FlushBuffer
 		{
 			USB_MIDI_EVENT_PACKET Packet;
 
-			if (RemovePacket(&Packet, NULL))
+			LONGLONG TimeStampCounter;
+
+			if (PeekPacket(&Packet, &TimeStampCounter))
 			{
+				if (!MidiIsDue(TimeStampCounter, CurrentTimeStampCounter))
+				{
+					/* Not due yet. Nothing more to send for now, so let
+					   the other clients have the FIFO. */
+					m_Cable->ScheduleService(TimeStampCounter, CurrentTimeStampCounter);
+
+					EndOfMessage = TRUE;
+					break;
+				}
+
+				RemovePacket(&Packet, NULL);
+
 				/* If this is a realtime message, flush it out immediately. */
 				BOOL Flush = (Packet.CodeIndexNumber == CODE_INDEX_NUMBER_1_BYTE) && 
 					         (Packet.MIDI[0] >= TIMING_CLOCK) && (Packet.MIDI[0] <= SYSTEM_RESET);
@@ -1133,9 +992,12 @@ FlushBuffer
  * @param
  * BytesLength Length in bytes of the MIDI data stream buffer at Buffer.
  * @param
+ * TimeStampCounter When the data is to be sent, in performance counter ticks.
+ * Data that is due, or has no time (0), is sent as soon as possible.
+ * @param
  * Synchronous Indicates whether the write needs to occur synchronously. If TRUE,
- * this routine will wait till all the data is sent out before returning to the
- * caller.
+ * this routine will wait till all the data that is due is sent out before
+ * returning to the caller.
  * @return
  * Returns the actual number of bytes successfully written to the FIFO.
  * This value must be either the same value as BufferLength or the next
@@ -1173,11 +1035,9 @@ WriteBuffer
 	}
 	else
 	{
-		m_Cable->LockFifo();
-
-		Lock();
-
-		/* Copy some bytes into the ring buffer */
+		/* Copy some bytes into the ring buffer. This is the only producer, so
+		   the ring buffer need not be locked, and the completion DPC may
+		   carry on flushing it meanwhile. */
 		if (BytesWritten < BufferLength)
 		{
 			while ( (BytesWritten < BufferLength) /* Write up to data length */ &&
@@ -1199,6 +1059,10 @@ WriteBuffer
 			}
 		}
 
+		m_Cable->LockFifo();
+
+		Lock();
+
 		/* Flush the ring buffer. */
 		if (FlushBuffer(SysExClient == this, FALSE))
 		{
@@ -1215,8 +1079,8 @@ WriteBuffer
 	{	
 		LARGE_INTEGER TimeOut; TimeOut.QuadPart = -1*10000; // 1ms
 
-		// Wait till all the data have been sent out...
-		while (!IsEmpty() || (m_NumberOfPacketsCompleted < m_NumberOfPacketsTransmitted))
+		// Wait till all the data that is due have been sent out...
+		while (IsDue() || (m_NumberOfPacketsCompleted < m_NumberOfPacketsTransmitted))
 		{
 			/* Take a time stamp to indicate when is the last time the client performed this operation. */
 			KeQuerySystemTime(&m_ActivityTimeStamp);
@@ -1351,7 +1215,7 @@ IsFull
 (	void
 )
 {
-    return (GetNumQueuedPackets() == BUFFER_SIZE);
+    return (GetNumQueuedPackets() == m_Ring.Size());
 }
 
 /*****************************************************************************
@@ -1374,6 +1238,35 @@ IsEmpty
     return (GetNumQueuedPackets() == 0);
 }
 
+/*****************************************************************************
+ * CMidiClient::IsDue()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Check to see whether the MIDI FIFO holds packets that are due to be sent.
+ * @param
+ * <None>
+ * @return
+ * Returns TRUE if the first packet in the MIDI FIFO is due, otherwise FALSE.
+ */
+BOOL
+CMidiClient::
+IsDue
+(	void
+)
+{
+	USB_MIDI_EVENT_PACKET Packet;
+
+	LONGLONG TimeStampCounter;
+
+	if (PeekPacket(&Packet, &TimeStampCounter))
+	{
+		return MidiIsDue(TimeStampCounter, KeQueryPerformanceCounter(NULL).QuadPart);
+	}
+
+	return FALSE;
+}
+
 #pragma code_seg("PAGE")
 
 /*****************************************************************************
@@ -1398,6 +1291,20 @@ Start
 {
 	PAGED_CODE();
 
+	if (!m_Ring.Buffer())
+	{
+		/* The ring buffer is not needed until the client runs, so that the
+		   clients which are opened but idle hold no nonpaged pool for it. */
+		PUSB_MIDI_EVENT_PACKET_EX DataBuffer = PUSB_MIDI_EVENT_PACKET_EX(ExAllocatePoolWithTag(NonPagedPool, m_RequestedBufferSize * sizeof(USB_MIDI_EVENT_PACKET_EX), 'mdW'));
+
+		if (!DataBuffer)
+		{
+			return MIDIERR_NO_MEMORY;
+		}
+
+		m_Ring.Attach(DataBuffer, m_RequestedBufferSize);
+	}
+
 	MIDISTATUS midiStatus = m_Cable->Start();
 
 	if (MIDI_SUCCESS(midiStatus))
@@ -1505,8 +1412,9 @@ Reset
 
 	m_EndOfSysEx = TRUE;
 
-	m_ReadPosition = 0;
-    m_WritePosition = 1;
+	/* Drop whatever is queued. Only the consumer index moves, so the producer
+	   may carry on. */
+	m_Ring.Flush();
 
 	m_NumberOfPacketsTransmitted = 0;
 	m_NumberOfPacketsCompleted = 0;
@@ -1724,13 +1632,13 @@ CMidiCable::
 {
     _DbgPrintF(DEBUGLVL_VERBOSE,("[CMidiCable::~CMidiCable]"));
 
-	if (m_Direction == MIDI_OUTPUT)
-	{
-		FreeResources();
-	}
-
 	if (m_UsbDevice)
 	{
+		KeCancelTimer(&m_ServiceTimer);
+
+		// The DPC may already be queued.
+		KeFlushQueuedDpcs();
+
 		m_UsbDevice->Release();
 	}
 }
@@ -1766,22 +1674,9 @@ Init
 
 	m_DataPipe = DataPipe;
 
-	m_PipeHandle = m_DataPipe->PipeHandle();
-
 	m_Direction = USB_ENDPOINT_DIRECTION_IN(m_EndpointAddress) ? MIDI_INPUT : MIDI_OUTPUT;
 
-	m_MaximumTransferSize = (m_DataPipe->MaximumTransferSize() < MIDI_FIFO_BUFFER_SIZE) ? m_DataPipe->MaximumTransferSize() : MIDI_FIFO_BUFFER_SIZE;
-
-	//BEGIN_HACK
-	// Due to internal double buffering in the HulaPod USB-MIDI implementation, it is necessary to limit
-	// the packet size to 32 to avoid data being sent out too "fast" for certain WHQL tests.
-	PUSB_DEVICE_DESCRIPTOR UsbDeviceDescriptor; m_UsbDevice->GetDeviceDescriptor(&UsbDeviceDescriptor);
-
-	if ((UsbDeviceDescriptor->idVendor == 0x41E/*Creative*/) && (UsbDeviceDescriptor->idProduct == 0x3F04/*HulaPod*/))
-	{
-		m_MaximumTransferSize = (m_MaximumTransferSize > 32) ? 32 : m_MaximumTransferSize;
-	}
-	//END_HACK
+	m_NumberOfPendingFifoWorkItems = 0;
 
 	m_PowerState = PowerDeviceD0;
 
@@ -1791,10 +1686,15 @@ Init
 
 	KeInitializeEvent(&m_NoPendingIrpEvent, NotificationEvent, FALSE);
 
-	if (m_Direction == MIDI_OUTPUT)
-	{
-		AcquireResources();
-	}
+	KeInitializeTimer(&m_ServiceTimer);
+
+	KeInitializeDpc(&m_ServiceDpc, ServiceDpcRoutine, this);
+
+	m_ServiceTimeStampCounter = 0;
+
+	LARGE_INTEGER PerformanceFrequency; KeQueryPerformanceCounter(&PerformanceFrequency);
+
+	m_PerformanceFrequency = PerformanceFrequency.QuadPart;
 
 	return MIDIERR_SUCCESS;
 }
@@ -2057,11 +1957,11 @@ AssociatedJackID
 #pragma code_seg("PAGE")
 
 /*****************************************************************************
- * CMidiCable::AcquireResources()
+ * CMidiCable::Start()
  *****************************************************************************
  * @ingroup MIDI_GROUP
  * @brief
- * Acquire the resouces used by the cable.
+ * Start the cable.
  * @param
  * <None>
  * @return
@@ -2070,118 +1970,27 @@ AssociatedJackID
  */
 MIDISTATUS
 CMidiCable::
-AcquireResources
+Start
 (	void
 )
 {
 	PAGED_CODE();
 
-	ASSERT(m_Direction == MIDI_OUTPUT);
+	_DbgPrintF(DEBUGLVL_VERBOSE,("[CMidiCable::Start]"));
 
 	MIDISTATUS midiStatus = MIDIERR_SUCCESS;
 
-	m_MaximumIrpCount = MAX_OUTPUT_IRP;
+	KeWaitForMutexObject(&m_CableStateLock, Executive, KernelMode, FALSE, NULL);
 
-	for (ULONG i=0; i<m_MaximumIrpCount; i++)
+	if (m_CableState != MIDI_CABLE_STATE_RUN)
 	{
-		if (m_UsbDevice->CreateIrp(&m_FifoWorkItem[i].Irp) != STATUS_SUCCESS)
+		if (m_CableState == MIDI_CABLE_STATE_PAUSE)
 		{
-			midiStatus = MIDIERR_INSUFFICIENT_RESOURCES;
-			break;
-		}
-	}
-
-	return midiStatus;
-}
-
-#pragma code_seg()
-
-/*****************************************************************************
- * CMidiCable::FreeResources()
- *****************************************************************************
- * @ingroup MIDI_GROUP
- * @brief
- * Free the resouces used by the cable.
- * @details
- * Runs at IRQL < DISPATCH_LEVEL.
- * @param
- * <None>
- * @return
- * Returns MIDIERR_SUCCESS if successful. Otherwise, returns an appropriate
- * error code.
- */
-MIDISTATUS
-CMidiCable::
-FreeResources
-(	void
-)
-{
-	ASSERT(m_Direction == MIDI_OUTPUT);
-
-	_DbgPrintF(DEBUGLVL_VERBOSE,("[CMidiCable::FreeResources]"));
-
-	MIDISTATUS midiStatus = MIDIERR_SUCCESS;
-
-	for (ULONG i=0; i<m_MaximumIrpCount; i++)
-	{
-		if (m_FifoWorkItem[i].Irp)
-		{
-			IoFreeIrp(m_FifoWorkItem[i].Irp);
-
-			m_FifoWorkItem[i].Irp = NULL;
-		}
-	}
-
-	return midiStatus;
-}
-
-#pragma code_seg("PAGE")
-
-/*****************************************************************************
- * CMidiCable::Start()
- *****************************************************************************
- * @ingroup MIDI_GROUP
- * @brief
- * Start the cable.
- * @param
- * <None>
- * @return
- * Returns MIDIERR_SUCCESS if successful. Otherwise, returns an appropriate
- * error code.
- */
-MIDISTATUS
-CMidiCable::
-Start
-(	void
-)
-{
-	PAGED_CODE();
-
-	_DbgPrintF(DEBUGLVL_VERBOSE,("[CMidiCable::Start]"));
-
-	MIDISTATUS midiStatus = MIDIERR_SUCCESS;
-
-	KeWaitForMutexObject(&m_CableStateLock, Executive, KernelMode, FALSE, NULL);
-
-	if (m_CableState != MIDI_CABLE_STATE_RUN)
-	{
-		if (m_CableState == MIDI_CABLE_STATE_PAUSE)
-		{
-			m_CableState = MIDI_CABLE_STATE_RUN;
-		}
-		else // MIDI_CABLE_STATE_STOP
-		{
-			m_CableState = MIDI_CABLE_STATE_RUN;
-
-			if (m_Direction == MIDI_OUTPUT)
-			{
-				for (ULONG i=0; i<m_MaximumIrpCount; i++)
-				{
-					m_FifoWorkItem[i].BytesInFifoBuffer = 0;
-
-					m_FifoWorkItemList.Put(&m_FifoWorkItem[i]);
-				}
-			}
+			m_CableState = MIDI_CABLE_STATE_RUN;
+		}
+		else // MIDI_CABLE_STATE_STOP
+		{
+			m_CableState = MIDI_CABLE_STATE_RUN;
 		}
 	}
 
@@ -2232,27 +2041,9 @@ Pause
 
 			if (m_Direction == MIDI_OUTPUT)
 			{
-				_DbgPrintF(DEBUGLVL_BLAB,("IRPs count [%d, %d]", m_FifoWorkItemList.Count(), m_MaximumIrpCount));
-
-				m_FifoWorkItemList.Lock();
-				
-				BOOL WaitForIrpToFinish = (m_FifoWorkItemList.Count() < m_MaximumIrpCount);
+				_CancelScheduledService();
 
-				if (WaitForIrpToFinish)
-				{
-					KeClearEvent(&m_NoPendingIrpEvent);
-				}
-
-				m_FifoWorkItemList.Unlock();
-
-				if (WaitForIrpToFinish)
-				{
-					_DbgPrintF(DEBUGLVL_BLAB,("Waiting for IRPs to finish... [%d, %d]", m_FifoWorkItemList.Count(), m_MaximumIrpCount));
-
-					KeWaitForSingleObject(&m_NoPendingIrpEvent, Executive, KernelMode, TRUE, NULL);
-
-					_DbgPrintF(DEBUGLVL_BLAB,("IRPs finished... [%d, %d]", m_FifoWorkItemList.Count(), m_MaximumIrpCount));
-				}
+				_WaitForPendingFifoWorkItems();
 			}
 		}
 	}
@@ -2302,38 +2093,89 @@ Stop
 
 			if (m_Direction == MIDI_OUTPUT)
 			{
-				_DbgPrintF(DEBUGLVL_BLAB,("IRPs count [%d, %d]", m_FifoWorkItemList.Count(), m_MaximumIrpCount));
+				_CancelScheduledService();
 
-				m_FifoWorkItemList.Lock();
-				
-				BOOL WaitForIrpToFinish = (m_FifoWorkItemList.Count() < m_MaximumIrpCount);
+				_WaitForPendingFifoWorkItems();
+			}
+		}
+	}
 
-				if (WaitForIrpToFinish)
-				{
-					KeClearEvent(&m_NoPendingIrpEvent);
-				}
+	KeReleaseMutex(&m_CableStateLock, FALSE);
 
-				m_FifoWorkItemList.Unlock();
+	return midiStatus;
+}
 
-				if (WaitForIrpToFinish)
-				{
-					_DbgPrintF(DEBUGLVL_BLAB,("Waiting for IRPs to finish... [%d, %d]", m_FifoWorkItemList.Count(), m_MaximumIrpCount));
+/*****************************************************************************
+ * CMidiCable::_WaitForPendingFifoWorkItems()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Wait until the data pipe has sent all the packets of this cable.
+ * @details
+ * The packets left in the FIFO work item being filled are sent first, so
+ * that the clients can go away once this returns without their packets
+ * still being tagged in the FIFO.
+ * @param
+ * <None>
+ * @return
+ * <None>
+ */
+VOID
+CMidiCable::
+_WaitForPendingFifoWorkItems
+(	void
+)
+{
+	LockFifo();
 
-					KeWaitForSingleObject(&m_NoPendingIrpEvent, Executive, KernelMode, TRUE, NULL);
+	FlushFifo();
 
-					_DbgPrintF(DEBUGLVL_BLAB,("IRPs finished... [%d, %d]", m_FifoWorkItemList.Count(), m_MaximumIrpCount));
-				}
+	_DbgPrintF(DEBUGLVL_BLAB,("Pending FIFO work items [%d]", m_NumberOfPendingFifoWorkItems));
 
-				ASSERT(m_FifoWorkItemList.Count() == m_MaximumIrpCount);
-				
-				while (m_FifoWorkItemList.Pop()) {} // Remove all items from list.
-			}
-		}
+	BOOL WaitForIrpToFinish = (m_NumberOfPendingFifoWorkItems > 0);
+
+	if (WaitForIrpToFinish)
+	{
+		KeClearEvent(&m_NoPendingIrpEvent);
 	}
 
-	KeReleaseMutex(&m_CableStateLock, FALSE);
+	UnlockFifo();
 
-	return midiStatus;
+	if (WaitForIrpToFinish)
+	{
+		_DbgPrintF(DEBUGLVL_BLAB,("Waiting for IRPs to finish... [%d]", m_NumberOfPendingFifoWorkItems));
+
+		KeWaitForSingleObject(&m_NoPendingIrpEvent, Executive, KernelMode, TRUE, NULL);
+
+		_DbgPrintF(DEBUGLVL_BLAB,("IRPs finished... [%d]", m_NumberOfPendingFifoWorkItems));
+	}
+}
+
+/*****************************************************************************
+ * CMidiCable::_CancelScheduledService()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Cancel the service that the clients asked for when the packets they hold
+ * back are due.
+ * @param
+ * <None>
+ * @return
+ * <None>
+ */
+VOID
+CMidiCable::
+_CancelScheduledService
+(	void
+)
+{
+	LockFifo();
+
+	KeCancelTimer(&m_ServiceTimer);
+
+	m_ServiceTimeStampCounter = 0;
+
+	UnlockFifo();
 }
 
 /*****************************************************************************
@@ -2455,7 +2297,7 @@ LockFifo
 (	void
 )
 {
-	m_FifoWorkItemList.Lock();
+	m_DataPipe->LockFifo();
 }
 
 /*****************************************************************************
@@ -2470,7 +2312,7 @@ UnlockFifo
 (	void
 )
 {
-	m_FifoWorkItemList.Unlock();
+	m_DataPipe->UnlockFifo();
 }
 
 /*****************************************************************************
@@ -2487,16 +2329,9 @@ IsFifoReady
 {
 	BOOL Ready = FALSE;
 
-	if (m_FifoWorkItemList.Count() > 0)
+	if ((m_CableState == MIDI_CABLE_STATE_RUN) || (m_CableState == MIDI_CABLE_STATE_RESET))
 	{
-	    PMIDI_FIFO_WORK_ITEM FifoWorkItem = m_FifoWorkItemList.First();
-
-		ASSERT(FifoWorkItem);
-
-		if ((m_CableState == MIDI_CABLE_STATE_RUN) || (m_CableState == MIDI_CABLE_STATE_RESET))
-		{
-			Ready = (FifoWorkItem->BytesInFifoBuffer <= (m_MaximumTransferSize - sizeof(USB_MIDI_EVENT_PACKET)));
-		}
+		Ready = m_DataPipe->IsFifoReady();
 	}
 
 	return Ready;
@@ -2555,32 +2390,9 @@ TransmitPacket
 	IN		PVOID					Tag
 )
 {
-    ASSERT(m_FifoWorkItemList.Count() > 0);
-
-	PMIDI_FIFO_WORK_ITEM FifoWorkItem = m_FifoWorkItemList.First();
-
-	ASSERT(FifoWorkItem);
-
-	ASSERT(FifoWorkItem->BytesInFifoBuffer <= (m_MaximumTransferSize - sizeof(USB_MIDI_EVENT_PACKET)));
-
-    RtlCopyMemory(&FifoWorkItem->FifoBuffer[FifoWorkItem->BytesInFifoBuffer], &Packet, sizeof(USB_MIDI_EVENT_PACKET));
-
-	FifoWorkItem->Tags[FifoWorkItem->BytesInFifoBuffer/sizeof(USB_MIDI_EVENT_PACKET)] = Tag; // Tag it for reference later.
-
-	FifoWorkItem->BytesInFifoBuffer += sizeof(USB_MIDI_EVENT_PACKET);
-
-	//_DbgPrintF(DEBUGLVL_BLAB,("TX Packet"));
-	//_DbgPrintF(DEBUGLVL_BLAB,("----------------------"));
-	//_DbgPrintF(DEBUGLVL_BLAB,("CodeIndexNumber: %x", Packet.CodeIndexNumber));
-	//_DbgPrintF(DEBUGLVL_BLAB,("CableNumber: %x", Packet.CableNumber));
-	//_DbgPrintF(DEBUGLVL_BLAB,("MIDI[0]: %x", Packet.MIDI[0]));
-	//_DbgPrintF(DEBUGLVL_BLAB,("MIDI[1]: %x", Packet.MIDI[1]));
-	//_DbgPrintF(DEBUGLVL_BLAB,("MIDI[2]: %x", Packet.MIDI[2]));
+	ASSERT(m_CableNumber == Packet.CableNumber);
 
-	if (FifoWorkItem->BytesInFifoBuffer == m_MaximumTransferSize)
-    {
-        FlushFifo();
-    }
+	m_DataPipe->TransmitPacket(Packet, Tag);
 }
 
 /*****************************************************************************
@@ -2595,68 +2407,130 @@ FlushFifo
 (	void
 )
 {
-	//_DbgPrintF(DEBUGLVL_VERBOSE,("[CMidiCable::Flush]"));
-
 	if (m_Direction == MIDI_OUTPUT)
 	{
-		if ((m_FifoWorkItemList.Count() > 0) && (m_FifoWorkItemList.First()->BytesInFifoBuffer > 0))
-		{
-			PMIDI_FIFO_WORK_ITEM FifoWorkItem = m_FifoWorkItemList.Pop();
+		m_DataPipe->FlushFifo();
+	}
+}
 
-			ASSERT(FifoWorkItem);
+/*****************************************************************************
+ * CMidiCable::FifoWorkItemQueued()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Called by the data pipe, with the FIFO locked, when the first packet of
+ * this cable goes into a FIFO work item.
+ * @param
+ * <None>
+ * @return
+ * <None>
+ */
+VOID
+CMidiCable::
+FifoWorkItemQueued
+(	void
+)
+{
+	m_NumberOfPendingFifoWorkItems++;
+}
 
-			FifoWorkItem->Context = this;
+/*****************************************************************************
+ * CMidiCable::FifoWorkItemCompleted()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Called by the data pipe, with the FIFO locked, when a FIFO work item that
+ * holds packets of this cable has been sent.
+ * @param
+ * <None>
+ * @return
+ * <None>
+ */
+VOID
+CMidiCable::
+FifoWorkItemCompleted
+(	void
+)
+{
+	ASSERT(m_NumberOfPendingFifoWorkItems > 0);
 
-			UsbBuildInterruptOrBulkTransferRequest
-			(
-				&FifoWorkItem->Urb,
-				sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
-				m_PipeHandle,
-				FifoWorkItem->FifoBuffer,
-				NULL,
-				FifoWorkItem->BytesInFifoBuffer,
-				USBD_TRANSFER_DIRECTION_OUT,
-				NULL
-			);
+	m_NumberOfPendingFifoWorkItems--;
 
-			m_UsbDevice->RecycleIrp(&FifoWorkItem->Urb, FifoWorkItem->Irp, IoCompletionRoutine, FifoWorkItem);
-		}
+	if (m_NumberOfPendingFifoWorkItems == 0)
+	{
+		KeSetEvent(&m_NoPendingIrpEvent, IO_SOUND_INCREMENT, FALSE);
 	}
 }
 
-#pragma code_seg()
-
 /*****************************************************************************
- * CMidiCable::ProcessFifoWorkItem()
+ * CMidiCable::ScheduleService()
  *****************************************************************************
  * @ingroup MIDI_GROUP
  * @brief
- * Process the FIFO work item.
+ * Called by a client, with the FIFO locked, when it holds back a packet that
+ * is due later.
+ * @details
+ * Each client sends its packets in time order, so the cable only needs to
+ * know about the first packet that each client holds back, and the timer is
+ * set to the earliest of them. When it fires, the cable is serviced as if a
+ * FIFO work item had completed, and the clients that are not due yet ask
+ * again.
  * @param
- * FifoWorkItem FIFO work item to process.
+ * TimeStampCounter When the packet is due, in performance counter ticks.
+ * @param
+ * CurrentTimeStampCounter The performance counter now.
  * @return
  * <None>
  */
 VOID
 CMidiCable::
-ProcessFifoWorkItem
+ScheduleService
 (
-	IN		PMIDI_FIFO_WORK_ITEM	FifoWorkItem
+	IN		LONGLONG	TimeStampCounter,
+	IN		LONGLONG	CurrentTimeStampCounter
 )
 {
-	PUSB_MIDI_EVENT_PACKET Packet = PUSB_MIDI_EVENT_PACKET(FifoWorkItem->FifoBuffer);
+	if (MidiScheduleService(&m_ServiceTimeStampCounter, TimeStampCounter))
+	{
+		LARGE_INTEGER DueTime; DueTime.QuadPart = MidiServiceDueTime(TimeStampCounter, CurrentTimeStampCounter, m_PerformanceFrequency);
 
-	ULONG PacketCount = (FifoWorkItem->BytesInFifoBuffer/sizeof(USB_MIDI_EVENT_PACKET));
+		KeSetTimer(&m_ServiceTimer, DueTime, &m_ServiceDpc);
+	}
+}
 
-	for (ULONG i=0; i<PacketCount; i++)
-	{
-		CMidiClient * Client = (CMidiClient*)FifoWorkItem->Tags[i];
+/*****************************************************************************
+ * CMidiCable::ServiceDpcRoutine()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Services the cable when the earliest packet that the clients hold back is
+ * due, and sends what went into the FIFO.
+ */
+VOID
+CMidiCable::
+ServiceDpcRoutine
+(
+	IN		PKDPC	Dpc,
+	IN		PVOID	DeferredContext,
+	IN		PVOID	SystemArgument1,
+	IN		PVOID	SystemArgument2
+)
+{
+	CMidiCable * that = (CMidiCable*)DeferredContext;
 
-		if (Client)
-		{
-			Client->RequestCallback(1);
-		}
-	}/**/
+	that->LockFifo();
+
+	that->m_ServiceTimeStampCounter = 0;
+
+	that->UnlockFifo();
+
+	that->Service();
+
+	that->LockFifo();
+
+	that->FlushFifo();
+
+	that->UnlockFifo();
 }
 
 /*****************************************************************************
@@ -2665,16 +2539,21 @@ ProcessFifoWorkItem
  * @ingroup MIDI_GROUP
  * @brief
  * Service the MIDI interrupts.
+ * @details
+ * On output, the data pipe calls this for each of its cables when a FIFO
+ * work item completes, and the cable's timer when a packet held back by a
+ * client is due. The packets that the clients have queued go into the
+ * FIFO, which is shared by the cables of the pipe; the pipe sends what is
+ * left in it once all the cables had their turn.
  * @param
- * FifoWorkItem FIFO work item to service.
+ * <None>
  * @return
  * <None>
  */
 VOID
 CMidiCable::
 Service
-(
-	IN		PMIDI_FIFO_WORK_ITEM	FifoWorkItem
+(	void
 )
 {
 	BOOL SkipCallbackProcessing = FALSE;
@@ -2683,23 +2562,6 @@ Service
 	{
 		if ((m_CableState == MIDI_CABLE_STATE_STOP) || (m_CableState == MIDI_CABLE_STATE_PAUSE))
 		{
-			m_FifoWorkItemList.Lock();
-
-			FifoWorkItem->BytesInFifoBuffer = 0; // Empty.
-
-			m_FifoWorkItemList.Put(FifoWorkItem);
-
-			_DbgPrintF(DEBUGLVL_BLAB,("Current IRPs count... [%d, %d]", m_FifoWorkItemList.Count(), m_MaximumIrpCount));
-
-			if (m_FifoWorkItemList.Count() == m_MaximumIrpCount)
-			{
-				_DbgPrintF(DEBUGLVL_BLAB,("Setting Event..."));
-
-				KeSetEvent(&m_NoPendingIrpEvent, IO_SOUND_INCREMENT, FALSE);
-			}
-
-			m_FifoWorkItemList.Unlock();
-
 			SkipCallbackProcessing = TRUE;
 		}
 		else
@@ -2712,13 +2574,7 @@ Service
 			// If there a SysEx Client, that client will be the first to handle.
 			if (SysExClient)
 			{
-				m_FifoWorkItemList.Lock();
-
-				ProcessFifoWorkItem(FifoWorkItem);
-
-				FifoWorkItem->BytesInFifoBuffer = 0; // Empty.
-
-				m_FifoWorkItemList.Put(FifoWorkItem);
+				LockFifo();
 
 				if (SysExClient->FlushBuffer(TRUE))
 				{
@@ -2737,21 +2593,13 @@ Service
 							m_ClientList.Put(SysExClient);
 						}
 					}
-
-					FlushFifo();
 				}
 
-				m_FifoWorkItemList.Unlock();
+				UnlockFifo();
 			}
 			else
 			{
-				m_FifoWorkItemList.Lock();
-
-				ProcessFifoWorkItem(FifoWorkItem);
-
-				FifoWorkItem->BytesInFifoBuffer = 0; // Empty.
-
-				m_FifoWorkItemList.Put(FifoWorkItem);
+				LockFifo();
 
 				CMidiClient * client = m_ClientList.First();
 
@@ -2770,8 +2618,7 @@ Service
 
 							if (client == NULL)
 							{
-								/* No more data to transmit; flush the FIFO */
-								FlushFifo();
+								/* No more data to transmit. */
 								break;
 							}
 						}
@@ -2791,7 +2638,7 @@ Service
 					}
 				}
 
-				m_FifoWorkItemList.Unlock();
+				UnlockFifo();
 			}
 
 			m_ClientList.Unlock();
@@ -2825,32 +2672,6 @@ Service
 	}
 }
 
-/*****************************************************************************
- * CMidiCable::IoCompletionRoutine()
- *****************************************************************************
- * @ingroup MIDI_GROUP
- * @brief
- */
-NTSTATUS
-CMidiCable::
-IoCompletionRoutine
-(
-    IN		PDEVICE_OBJECT	DeviceObject,
-    IN		PIRP			Irp,
-    IN		PVOID			Context
-)
-{
-    //_DbgPrintF(DEBUGLVL_BLAB,("[CMidiCable::IoCompletionRoutine]"));
-
-	PMIDI_FIFO_WORK_ITEM FifoWorkItem = (PMIDI_FIFO_WORK_ITEM)Context;
-
-	CMidiCable * that = (CMidiCable*)FifoWorkItem->Context;
-
-	that->Service(FifoWorkItem);
-
-    return STATUS_MORE_PROCESSING_REQUIRED;
-}
-
 #pragma code_seg("PAGE")
 
 /*****************************************************************************
@@ -2867,12 +2688,9 @@ CMidiDataPipe::
 {
     _DbgPrintF(DEBUGLVL_VERBOSE,("[CMidiDataPipe::~CMidiDataPipe]"));
 
-	if (m_Direction == MIDI_INPUT)
-	{
-		Stop();
+	Stop();
 
-		FreeResources();
-	}
+	FreeResources();
 
 	if (m_UsbDevice)
 	{
@@ -2907,7 +2725,41 @@ Init
 
 	m_Direction = USB_ENDPOINT_DIRECTION_IN(m_PipeInformation.EndpointAddress) ? MIDI_INPUT : MIDI_OUTPUT;
 
-	m_MaximumTransferSize = (m_PipeInformation.MaximumPacketSize < MIDI_FIFO_BUFFER_SIZE) ? m_PipeInformation.MaximumPacketSize : MIDI_FIFO_BUFFER_SIZE;
+	if (m_Direction == MIDI_INPUT)
+	{
+		// A whole packet, the device may send that much.
+		m_MaximumTransferSize = m_PipeInformation.MaximumPacketSize;
+	}
+	else
+	{
+		// Several packets on a high speed device, so that a SysEx dump or the
+		// packets of all the cables that queued up while the transfers were in
+		// flight go out in one.
+		m_MaximumTransferSize = m_PipeInformation.MaximumPacketSize;
+
+		if (m_UsbDevice->IsDeviceHighSpeed())
+		{
+			m_MaximumTransferSize *= MIDI_FIFO_HIGH_SPEED_PACKETS_PER_TRANSFER;
+		}
+
+		//BEGIN_HACK
+		// Due to internal double buffering in the HulaPod USB-MIDI implementation, it is necessary to limit
+		// the packet size to 32 to avoid data being sent out too "fast" for certain WHQL tests.
+		PUSB_DEVICE_DESCRIPTOR UsbDeviceDescriptor; m_UsbDevice->GetDeviceDescriptor(&UsbDeviceDescriptor);
+
+		if ((UsbDeviceDescriptor->idVendor == 0x41E/*Creative*/) && (UsbDeviceDescriptor->idProduct == 0x3F04/*HulaPod*/))
+		{
+			m_MaximumTransferSize = (m_MaximumTransferSize > 32) ? 32 : m_MaximumTransferSize;
+		}
+		//END_HACK
+	}
+
+	m_MaximumTransferSize = (m_MaximumTransferSize < MIDI_FIFO_MAXIMUM_TRANSFER_SIZE) ? m_MaximumTransferSize : MIDI_FIFO_MAXIMUM_TRANSFER_SIZE;
+
+	// Whole USB-MIDI event packets only, and at least one.
+	m_MaximumTransferSize &= ~(sizeof(USB_MIDI_EVENT_PACKET) - 1);
+
+	if (m_MaximumTransferSize == 0) m_MaximumTransferSize = sizeof(USB_MIDI_EVENT_PACKET);
 
 	m_NumberOfCables = CsMsEndpointDescriptor->bNumEmbMIDIJacks;
 
@@ -2924,12 +2776,9 @@ Init
 		m_CableList[i].Init(i, CsMsEndpointDescriptor->baAssocJackID[i], UsbDevice, this);
 	}
 
-	if (m_Direction == MIDI_INPUT)
-	{
-		AcquireResources();
+	AcquireResources();
 
-		Start();
-	}
+	Start();
 
 	return MIDIERR_SUCCESS;
 }
@@ -3107,15 +2956,27 @@ AcquireResources
 (	void
 )
 {
-	PAGED_CODE();
-
-	ASSERT(m_Direction == MIDI_INPUT);
+	PAGED_CODE();
 
 	MIDISTATUS midiStatus = MIDIERR_SUCCESS;
 
 	KeWaitForMutexObject(&m_PipeStateLock, Executive, KernelMode, FALSE, NULL);
 
-	m_MaximumIrpCount = MAX_INPUT_IRP;
+	if (m_Direction == MIDI_INPUT)
+	{
+		m_MaximumIrpCount = MAX_INPUT_IRP;
+	}
+	else
+	{
+		// The cables used to have MAX_OUTPUT_IRP FIFOs of MIDI_FIFO_BUFFER_SIZE
+		// each. Keep at least as many bytes in flight now that they share the
+		// pipe's FIFOs, else a full speed device with a lot of busy cables would
+		// transmit slower than before.
+		m_MaximumIrpCount = (MAX_OUTPUT_IRP * m_NumberOfCables * MIDI_FIFO_BUFFER_SIZE) / m_MaximumTransferSize;
+
+		if (m_MaximumIrpCount < MAX_OUTPUT_IRP) m_MaximumIrpCount = MAX_OUTPUT_IRP;
+		if (m_MaximumIrpCount > MAX_DATA_PIPE_OUTPUT_IRP) m_MaximumIrpCount = MAX_DATA_PIPE_OUTPUT_IRP;
+	}
 
     for (ULONG i=0; i<m_MaximumIrpCount; i++)
     {
@@ -3124,6 +2985,26 @@ AcquireResources
             midiStatus = MIDIERR_INSUFFICIENT_RESOURCES;
 			break;
 		}
+
+		m_FifoWorkItem[i].FifoBuffer = PUCHAR(ExAllocatePoolWithTag(NonPagedPool, m_MaximumTransferSize, 'mdW'));
+		m_FifoWorkItem[i].FifoBufferSize = m_MaximumTransferSize;
+
+		if (!m_FifoWorkItem[i].FifoBuffer)
+		{
+            midiStatus = MIDIERR_NO_MEMORY;
+			break;
+		}
+
+		if (m_Direction == MIDI_OUTPUT)
+		{
+			m_FifoWorkItem[i].Tags = (PVOID*)ExAllocatePoolWithTag(NonPagedPool, (m_MaximumTransferSize/sizeof(USB_MIDI_EVENT_PACKET)) * sizeof(PVOID), 'mdW');
+
+			if (!m_FifoWorkItem[i].Tags)
+			{
+				midiStatus = MIDIERR_NO_MEMORY;
+				break;
+			}
+		}
     }
 
 	if (!MIDI_SUCCESS(midiStatus))
@@ -3166,8 +3047,6 @@ FreeResources
 {
 	PAGED_CODE();
 
-	ASSERT(m_Direction == MIDI_INPUT);
-
 	_DbgPrintF(DEBUGLVL_VERBOSE,("[CMidiDataPipe::FreeResources]"));
 
 	MIDISTATUS midiStatus = MIDIERR_SUCCESS;
@@ -3211,8 +3090,6 @@ Start
 {
 	PAGED_CODE();
 
-	ASSERT(m_Direction == MIDI_INPUT);
-
 	_DbgPrintF(DEBUGLVL_VERBOSE,("[CMidiDataPipe::Start]"));
 
 	MIDISTATUS midiStatus = MIDIERR_SUCCESS;
@@ -3248,6 +3125,18 @@ Start
 				m_UsbDevice->RecycleIrp(&m_FifoWorkItem[i].Urb, m_FifoWorkItem[i].Irp, IoCompletionRoutine, (PVOID)&m_FifoWorkItem[i]);
 			}
 		}
+		else
+		{
+			// The cables fill the work items in turn, and send them off.
+			for (ULONG i=0; i<m_MaximumIrpCount; i++)
+			{
+				m_FifoWorkItem[i].BytesInFifoBuffer = 0;
+
+				m_FifoWorkItem[i].CableMask = 0;
+
+				m_FifoWorkItemList.Put(&m_FifoWorkItem[i]);
+			}
+		}
 	}
 
 	KeReleaseMutex(&m_PipeStateLock, FALSE);
@@ -3275,8 +3164,6 @@ Stop
 (	void
 )
 {
-	ASSERT(m_Direction == MIDI_INPUT);
-
 	_DbgPrintF(DEBUGLVL_VERBOSE,("[CMidiDataPipe::Stop]"));
 
 	MIDISTATUS midiStatus = MIDIERR_SUCCESS;
@@ -3331,6 +3218,258 @@ Stop
 
 #pragma code_seg()
 
+/*****************************************************************************
+ * CMidiDataPipe::LockFifo()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ */
+VOID
+CMidiDataPipe::
+LockFifo
+(	void
+)
+{
+	m_FifoWorkItemList.Lock();
+}
+
+/*****************************************************************************
+ * CMidiDataPipe::UnlockFifo()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ */
+VOID
+CMidiDataPipe::
+UnlockFifo
+(	void
+)
+{
+	m_FifoWorkItemList.Unlock();
+}
+
+/*****************************************************************************
+ * CMidiDataPipe::IsFifoReady()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ */
+BOOL
+CMidiDataPipe::
+IsFifoReady
+(	void
+)
+{
+	BOOL Ready = FALSE;
+
+	if (m_FifoWorkItemList.Count() > 0)
+	{
+	    PMIDI_FIFO_WORK_ITEM FifoWorkItem = m_FifoWorkItemList.First();
+
+		ASSERT(FifoWorkItem);
+
+		Ready = (FifoWorkItem->BytesInFifoBuffer <= (m_MaximumTransferSize - sizeof(USB_MIDI_EVENT_PACKET)));
+	}
+
+	return Ready;
+}
+
+/*****************************************************************************
+ * CMidiDataPipe::TransmitPacket()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Put an USB-MIDI event packet in the FIFO work item being filled, and send
+ * the work item if that fills it up.
+ * @param
+ * Packet USB-MIDI event packet to be sent.
+ * @param
+ * Tag The client that sent the packet, if any.
+ * @return
+ * <None>
+ */
+VOID
+CMidiDataPipe::
+TransmitPacket
+(
+	IN		USB_MIDI_EVENT_PACKET	Packet,
+	IN		PVOID					Tag
+)
+{
+    ASSERT(m_FifoWorkItemList.Count() > 0);
+	ASSERT(Packet.CableNumber < m_NumberOfCables);
+
+	PMIDI_FIFO_WORK_ITEM FifoWorkItem = m_FifoWorkItemList.First();
+
+	ASSERT(FifoWorkItem);
+
+	ASSERT(FifoWorkItem->BytesInFifoBuffer <= (m_MaximumTransferSize - sizeof(USB_MIDI_EVENT_PACKET)));
+
+    RtlCopyMemory(&FifoWorkItem->FifoBuffer[FifoWorkItem->BytesInFifoBuffer], &Packet, sizeof(USB_MIDI_EVENT_PACKET));
+
+	FifoWorkItem->Tags[FifoWorkItem->BytesInFifoBuffer/sizeof(USB_MIDI_EVENT_PACKET)] = Tag; // Tag it for reference later.
+
+	FifoWorkItem->BytesInFifoBuffer += sizeof(USB_MIDI_EVENT_PACKET);
+
+	if (!(FifoWorkItem->CableMask & (1 << Packet.CableNumber)))
+	{
+		// The cable cannot stop until this work item is sent.
+		FifoWorkItem->CableMask |= (1 << Packet.CableNumber);
+
+		m_CableList[Packet.CableNumber].FifoWorkItemQueued();
+	}
+
+	if (FifoWorkItem->BytesInFifoBuffer == m_MaximumTransferSize)
+    {
+        FlushFifo();
+    }
+}
+
+/*****************************************************************************
+ * CMidiDataPipe::FlushFifo()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Send the FIFO work item being filled, if there is anything in it.
+ * @param
+ * <None>
+ * @return
+ * <None>
+ */
+VOID
+CMidiDataPipe::
+FlushFifo
+(	void
+)
+{
+	ASSERT(m_Direction == MIDI_OUTPUT);
+
+	if ((m_FifoWorkItemList.Count() > 0) && (m_FifoWorkItemList.First()->BytesInFifoBuffer > 0))
+	{
+		PMIDI_FIFO_WORK_ITEM FifoWorkItem = m_FifoWorkItemList.Pop();
+
+		ASSERT(FifoWorkItem);
+
+		FifoWorkItem->Context = this;
+
+		UsbBuildInterruptOrBulkTransferRequest
+		(
+			&FifoWorkItem->Urb,
+			sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
+			m_PipeInformation.PipeHandle,
+			FifoWorkItem->FifoBuffer,
+			NULL,
+			FifoWorkItem->BytesInFifoBuffer,
+			USBD_TRANSFER_DIRECTION_OUT,
+			NULL
+		);
+
+		m_UsbDevice->RecycleIrp(&FifoWorkItem->Urb, FifoWorkItem->Irp, IoCompletionRoutine, FifoWorkItem);
+	}
+}
+
+/*****************************************************************************
+ * CMidiDataPipe::_ProcessFifoWorkItem()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Process the FIFO work item that has been sent.
+ * @param
+ * FifoWorkItem FIFO work item to process.
+ * @return
+ * <None>
+ */
+VOID
+CMidiDataPipe::
+_ProcessFifoWorkItem
+(
+	IN		PMIDI_FIFO_WORK_ITEM	FifoWorkItem
+)
+{
+	ULONG PacketCount = (FifoWorkItem->BytesInFifoBuffer/sizeof(USB_MIDI_EVENT_PACKET));
+
+	for (ULONG i=0; i<PacketCount; i++)
+	{
+		CMidiClient * Client = (CMidiClient*)FifoWorkItem->Tags[i];
+
+		if (Client)
+		{
+			Client->RequestCallback(1);
+		}
+	}
+
+	for (UCHAR CableNumber = 0; CableNumber < m_NumberOfCables; CableNumber++)
+	{
+		if (FifoWorkItem->CableMask & (1 << CableNumber))
+		{
+			m_CableList[CableNumber].FifoWorkItemCompleted();
+		}
+	}
+}
+
+/*****************************************************************************
+ * CMidiDataPipe::_ServiceOutput()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Service the completion of a bulk OUT transfer.
+ * @details
+ * Every cable of the pipe queues its pending packets in the same FIFO, so
+ * the packets of all the cables that are waiting for a work item go out
+ * together, in as few transfers as they fit in.
+ * @param
+ * FifoWorkItem FIFO work item to service.
+ * @return
+ * <None>
+ */
+VOID
+CMidiDataPipe::
+_ServiceOutput
+(
+	IN		PMIDI_FIFO_WORK_ITEM	FifoWorkItem
+)
+{
+	m_FifoWorkItemList.Lock();
+
+	_ProcessFifoWorkItem(FifoWorkItem);
+
+	FifoWorkItem->BytesInFifoBuffer = 0; // Empty.
+
+	FifoWorkItem->CableMask = 0;
+
+	m_FifoWorkItemList.Put(FifoWorkItem);
+
+	BOOL PipeStopped = (m_PipeState == MIDI_DATA_PIPE_STATE_STOP);
+
+	if (PipeStopped)
+	{
+		_DbgPrintF(DEBUGLVL_BLAB,("Current IRPs count... [%d, %d]", m_FifoWorkItemList.Count(), m_MaximumIrpCount));
+
+		if (m_FifoWorkItemList.Count() == m_MaximumIrpCount)
+		{
+			_DbgPrintF(DEBUGLVL_BLAB,("Setting Event..."));
+
+			KeSetEvent(&m_NoPendingIrpEvent, IO_SOUND_INCREMENT, FALSE);
+		}
+	}
+
+	m_FifoWorkItemList.Unlock();
+
+	if (!PipeStopped)
+	{
+		for (UCHAR i=0; i<m_NumberOfCables; i++)
+		{
+			m_CableList[i].Service();
+		}
+
+		m_FifoWorkItemList.Lock();
+
+		FlushFifo();
+
+		m_FifoWorkItemList.Unlock();
+	}
+}
+
 /*****************************************************************************
  * CMidiDataPipe::Service()
  *****************************************************************************
@@ -3349,7 +3488,12 @@ Service
 	IN		PMIDI_FIFO_WORK_ITEM	FifoWorkItem
 )
 {
-	ASSERT(m_Direction == MIDI_INPUT);
+	if (m_Direction == MIDI_OUTPUT)
+	{
+		_ServiceOutput(FifoWorkItem);
+
+		return;
+	}
 
 	BOOL SkipCallbackProcessing = FALSE;
 
@@ -3455,7 +3599,7 @@ Service
 	{
 		for (UCHAR i=0; i<m_NumberOfCables; i++)
 		{
-			m_CableList[i].Service(NULL);
+			m_CableList[i].Service();
 		}
 	}
 }
@@ -3676,6 +3820,18 @@ AcquireResources
             midiStatus = MIDIERR_INSUFFICIENT_RESOURCES;
 			break;
 		}
+
+		if (!m_FifoWorkItem[i].FifoBuffer)
+		{
+			m_FifoWorkItem[i].FifoBuffer = PUCHAR(ExAllocatePoolWithTag(NonPagedPool, m_MaximumTransferSize, 'mdW'));
+			m_FifoWorkItem[i].FifoBufferSize = m_MaximumTransferSize;
+
+			if (!m_FifoWorkItem[i].FifoBuffer)
+			{
+				midiStatus = MIDIERR_NO_MEMORY;
+				break;
+			}
+		}
     }
 
 	if (MIDI_SUCCESS(midiStatus))
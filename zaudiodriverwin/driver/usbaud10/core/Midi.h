@@ -46,6 +46,9 @@
 #include "Jack.h"
 
 #include "MidiParser.h"
+#include "MidiEvent.h"
+#include "MidiRing.h"
+#include "MidiSchedule.h"
 
 /*!
  * @defgroup MIDI_GROUP MIDI Module
@@ -54,10 +57,6 @@
 /*****************************************************************************
  * Defines
  */
-/*! @brief Size of the client data buffer. */
-#define INPUT_BUFFER_SIZE			4096
-#define OUTPUT_BUFFER_SIZE			4096
-
 /*! MIDI status type definition. */
 typedef LONG	MIDISTATUS;
 
@@ -97,22 +96,6 @@ typedef enum
    MIDI_INPUT
 } MIDI_DIRECTION;
 
-/*!
- * @brief
- * Extended USB MIDI event packet.
- */
-typedef struct
-{
-	USB_MIDI_EVENT_PACKET	Packet;
-	LONGLONG				TimeStampCounter;
-} USB_MIDI_EVENT_PACKET_EX, *PUSB_MIDI_EVENT_PACKET_EX;
-
-/*!
- * @brief
- * MIDI message status.
- */
-#define MESSAGE_STATUS_STRUCTURED	0x00000001
-
 /*****************************************************************************
  * Classes
  */
@@ -144,13 +127,8 @@ private:
 	KSPIN_LOCK					m_Lock;						/*!< @brief Lock to synchronize access to the client. */
 	KIRQL						m_LockIrql;				/*!< @brief Lock IRQL. */
 
-	USHORT						m_ReadPosition;			/*!< @brief Currrent read position in the ring buffer. */
-    USHORT						m_WritePosition;		/*!< @brief Current write position in the ring buffer. */
-    USB_MIDI_EVENT_PACKET_EX	m_DataBuffer[max(INPUT_BUFFER_SIZE, OUTPUT_BUFFER_SIZE)+1];
-														/*!< @brief Actual ring buffer array. Allocate one additional
-														 * byte to account for an eccentricity in the ring buffer
-														 * code which leads to one byte always being empty. */
-	USHORT						BUFFER_SIZE;
+	CMidiRing					m_Ring;					/*!< @brief Ring buffer, whose storage is allocated when the client is first started. */
+	ULONG						m_RequestedBufferSize;	/*!< @brief Number of packets to allocate the ring buffer storage with. */
 
 	BOOL						m_IsActive;				/*!< @brief Indicates the client state: TRUE for running, FALSE for stopped. */
 
@@ -233,7 +211,7 @@ public:
     /*! @brief Constructor. */
     CMidiClient()  { m_Next = m_Prev = NULL; m_Owner = NULL; }
     /*! @brief Destructor. */
-    ~CMidiClient() {}
+    ~CMidiClient() { if (m_Ring.Buffer()) ExFreePool(m_Ring.Buffer()); }
     /*! @brief Self-destructor. */
 	void Destruct() { delete this; }
 
@@ -255,6 +233,15 @@ public:
 	(	void
 	);
 
+	MIDISTATUS SetBufferSize
+	(
+		IN		ULONG	NumberOfPackets
+	);
+
+	ULONG GetMemoryFootprint
+	(	void
+	);
+
 	VOID Lock
 	(	void
 	);
@@ -305,6 +292,10 @@ public:
 	(	void
 	);
 
+	BOOL IsDue
+	(	void
+	);
+
 	MIDISTATUS Start
 	(	
 		OUT		LONGLONG *	OutStartTimeStampCounter	OPTIONAL,
@@ -367,6 +358,10 @@ typedef CMidiClient * PMIDI_CLIENT;
 /*! @brief Maximum number of output IRPs. */
 #define MAX_OUTPUT_IRP          8
 
+/*! @brief Maximum number of output IRPs of a data pipe, which are shared by
+ * all its cables (up to 16). */
+#define MAX_DATA_PIPE_OUTPUT_IRP	(MAX_OUTPUT_IRP * 16)
+
 #include "MidiFifo.h"
 
 #define MIDI_CABLE_STATE_STOP		0
@@ -403,13 +398,41 @@ private:
 	PUSB_DEVICE			m_UsbDevice;	/*!< @brief Pointer to the USB device object. */
 	CMidiDataPipe *		m_DataPipe;		/*!< @brief Pointer to the MIDI data pipe object. */
 
-    USBD_PIPE_HANDLE    m_PipeHandle;
-	ULONG				m_MaximumTransferSize;
+	ULONG				m_NumberOfPendingFifoWorkItems;	/*!< @brief Number of the data pipe's FIFO work items that
+														 * hold packets of this cable. */
+	KEVENT				m_NoPendingIrpEvent;
 
-	MIDI_FIFO_WORK_ITEM			m_FifoWorkItem[MAX_OUTPUT_IRP];
-    CList<MIDI_FIFO_WORK_ITEM>	m_FifoWorkItemList;
-	ULONG						m_MaximumIrpCount;
-	KEVENT						m_NoPendingIrpEvent;
+	KTIMER				m_ServiceTimer;					/*!< @brief Services the cable when the earliest packet that
+														 * the clients hold back is due. */
+	KDPC				m_ServiceDpc;
+	LONGLONG			m_ServiceTimeStampCounter;		/*!< @brief When m_ServiceTimer is set to, 0 if it is not set. */
+	LONGLONG			m_PerformanceFrequency;
+
+	/*************************************************************************
+     * CMidiCable private methods
+     *
+     * These are private member functions.  See MIDI.CPP for specific
+	 * descriptions.
+     */
+	VOID _WaitForPendingFifoWorkItems
+	(	void
+	);
+
+	VOID _CancelScheduledService
+	(	void
+	);
+
+    /*************************************************************************
+     * Static
+     */
+	static
+	VOID ServiceDpcRoutine
+	(
+		IN		PKDPC	Dpc,
+		IN		PVOID	DeferredContext,
+		IN		PVOID	SystemArgument1,
+		IN		PVOID	SystemArgument2
+	);
 
 public:
     /*************************************************************************
@@ -483,14 +506,6 @@ public:
 	(	void
 	);
 
-	MIDISTATUS AcquireResources
-	(	void
-	);
-
-	MIDISTATUS FreeResources
-	(	void
-	);
-
 	MIDISTATUS Start
 	(	void
 	);
@@ -539,25 +554,22 @@ public:
 	(	void
 	);
 
-	VOID ProcessFifoWorkItem
-	(
-		IN		PMIDI_FIFO_WORK_ITEM	FifoWorkItem
+	VOID FifoWorkItemQueued
+	(	void
 	);
 
-	VOID Service
-	(
-		IN		PMIDI_FIFO_WORK_ITEM	FifoWorkItem
+	VOID FifoWorkItemCompleted
+	(	void
 	);
 
-    /*************************************************************************
-     * Static
-     */
-	static
-	NTSTATUS IoCompletionRoutine
+	VOID ScheduleService
 	(
-		IN		PDEVICE_OBJECT	DeviceObject,
-		IN		PIRP			Irp,
-		IN		PVOID			Context
+		IN		LONGLONG	TimeStampCounter,
+		IN		LONGLONG	CurrentTimeStampCounter
+	);
+
+	VOID Service
+	(	void
 	);
 
     /*************************************************************************
@@ -600,8 +612,9 @@ private:
 
 	ULONG					m_MaximumTransferSize;
 
-	MIDI_FIFO_WORK_ITEM			m_FifoWorkItem[MAX_INPUT_IRP];
-    CList<MIDI_FIFO_WORK_ITEM>	m_FifoWorkItemList;
+	MIDI_FIFO_WORK_ITEM			m_FifoWorkItem[max(MAX_INPUT_IRP, MAX_DATA_PIPE_OUTPUT_IRP)];
+    CList<MIDI_FIFO_WORK_ITEM>	m_FifoWorkItemList;		/*!< @brief Work items not in flight. On output, shared by
+														 * all the cables, and the first one is being filled. */
 	ULONG						m_MaximumIrpCount;
 	KEVENT						m_NoPendingIrpEvent;
 
@@ -611,6 +624,15 @@ private:
      * These are private member functions.  See MIDI.CPP for specific
 	 * descriptions.
      */
+	VOID _ProcessFifoWorkItem
+	(
+		IN		PMIDI_FIFO_WORK_ITEM	FifoWorkItem
+	);
+
+	VOID _ServiceOutput
+	(
+		IN		PMIDI_FIFO_WORK_ITEM	FifoWorkItem
+	);
 
 public:
     /*************************************************************************
@@ -683,6 +705,28 @@ public:
 	(	void
 	);
 
+	VOID LockFifo
+	(	void
+	);
+
+	VOID UnlockFifo
+	(	void
+	);
+
+	BOOL IsFifoReady
+	(	void
+	);
+
+	VOID TransmitPacket
+	(
+		IN		USB_MIDI_EVENT_PACKET	Packet,
+		IN		PVOID					Tag
+	);
+
+	VOID FlushFifo
+	(	void
+	);
+
 	VOID Service
 	(
 		IN		PMIDI_FIFO_WORK_ITEM	FifoWorkItem
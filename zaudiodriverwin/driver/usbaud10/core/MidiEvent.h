@@ -0,0 +1,245 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd. 
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public 
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file	   MidiEvent.h
+ * @brief	   This file defines how the MIDI bytes received on a cable are
+ *			   put together into the MIDI messages that a client reads.
+ *//*
+ *****************************************************************************
+ */
+#ifndef __MIDI_EVENT_H__
+#define __MIDI_EVENT_H__
+
+#include "MidiParser.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*!
+ * @brief
+ * MIDI message status.
+ */
+#define MESSAGE_STATUS_STRUCTURED	0x00000001
+
+/*****************************************************************************
+ * PackageMidiEvent()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Parse the queued MIDI bytes up to the end of the next message, or of the
+ * next BufferLength bytes of a SysEx message.
+ * @details
+ * A SysEx message is returned in BufferLength pieces as its bytes come in,
+ * and the rest with the EOX. Each piece is time stamped with the arrival of
+ * its first byte, which is kept in SysExTimeStampCounter in between.
+ * @param
+ * MidiParser Parser of the cable's byte stream.
+ * @param
+ * SysExTimeStampCounter Time stamp of the pending SysEx bytes, 0 if none.
+ * @param
+ * BytesQueue MIDI bytes not parsed yet.
+ * @param
+ * Buffer Where to put the message.
+ * @param
+ * BufferLength Length of Buffer, in bytes. At least 3.
+ * @param
+ * TimeStampCounter In: the arrival of the queued bytes. Out: the time stamp
+ * of the message.
+ * @param
+ * OutStructured Set to FALSE for SysEx, TRUE for the other messages.
+ * @return
+ * Returns the number of bytes put in Buffer, 0 if the bytes queued do not
+ * make a message yet.
+ */
+static __inline
+ULONG
+PackageMidiEvent
+(
+	IN		CMidiParser *	MidiParser,
+	IN	OUT	LONGLONG *		SysExTimeStampCounter,
+	IN		CMidiQueue *	BytesQueue,
+	IN		PUCHAR			Buffer,
+	IN		ULONG			BufferLength,
+	IN	OUT	LONGLONG *		TimeStampCounter,
+	OUT		BOOL *			OutStructured	OPTIONAL
+)
+{
+	// If the message is structured.
+	BOOL Structured = TRUE;
+
+	// Parse the MIDI bytes to form messages.
+	ULONG Success = 0;
+
+	for (ULONG i=0; BytesQueue->CanGetQueue(); i++)
+	{
+		UCHAR Byte;  BytesQueue->GetQueue(&Byte);
+
+		UCHAR Status = MidiParser->Parse(Byte);
+
+		switch (Status)
+		{
+			case NOTE_OFF:
+			case NOTE_ON:
+			case POLYKEY_PRESSURE:
+			case CONTROL_CHANGE:
+			case PITCH_WHEEL:
+			case SONG_POS_POINTER:
+			{
+				Buffer[0] = MidiParser->GetChannelStatus();
+				Buffer[1] = MidiParser->GetData0();
+				Buffer[2] = MidiParser->GetData1();
+
+				Success = 3;
+			}
+			break;
+
+			case PROGRAM_CHANGE:
+			case CHANNEL_PRESSURE:
+			case MTC_QUARTER_FRAME:
+			case SONG_SELECT:
+			{
+				Buffer[0] = MidiParser->GetChannelStatus();
+				Buffer[1] = MidiParser->GetData0();
+
+				Success = 2;
+			}
+			break;
+
+			case SYSEX:
+			{
+				// This status is returned at the end of the SysEx message.
+				ASSERT(MidiParser->GetChannelStatus() == SYSEX);
+
+				CMidiQueue * MidiQueue = MidiParser->GetMidiQueue();
+
+				USHORT BytesInQueue = MidiQueue->CanGetQueue(); // including EOX
+
+				ASSERT((BytesInQueue > 0) && BytesInQueue <=BufferLength);
+
+				for (ULONG j=0; j<BytesInQueue; j++)
+				{
+					MidiQueue->GetQueue(&Buffer[j]);
+				}
+
+				if (*SysExTimeStampCounter)
+				{
+					*TimeStampCounter = *SysExTimeStampCounter;
+				}
+
+				*SysExTimeStampCounter = 0;
+
+				Success = BytesInQueue;
+
+				Structured = FALSE;
+			}
+			break;
+
+
+			case F4: /* ED-MIDI command. */
+			{
+				ULONG DataCount = MidiParser->GetDataCount();
+
+				if (DataCount == 2)
+				{
+					// 3 byte system common message.
+					Buffer[0] = MidiParser->GetChannelStatus();
+					Buffer[1] = MidiParser->GetData0();
+					Buffer[2] = MidiParser->GetData1();
+
+					Success = 3;
+				}
+				else if (DataCount > 2)
+				{
+					// 1 byte data only, no message.
+					Buffer[0] = MidiParser->GetData0();
+
+					Success = 1;
+				}
+			}
+			break;
+
+			//case 0xF5: /* Undefined data bytes. */
+			case TUNE_REQUEST:
+			case TIMING_CLOCK:
+			case 0xF9:
+			case START:
+			case CONTINUE:
+			case STOP:
+			case 0xFD:
+			case ACTIVE_SENSING:
+			case SYSTEM_RESET:
+			{
+				// Single byte system common message.
+				Buffer[0] = Status;
+
+				Success = 1;
+			}
+			break;
+
+			case NOOP:
+			{
+				if (MidiParser->GetChannelStatus() == SYSEX)
+				{
+					// Start or running SysEx message.
+					CMidiQueue * MidiQueue = MidiParser->GetMidiQueue();
+
+					USHORT BytesInQueue = MidiQueue->CanGetQueue();
+
+					if (*SysExTimeStampCounter == 0)
+					{
+						*SysExTimeStampCounter = *TimeStampCounter;
+					}
+
+					if (BytesInQueue >= BufferLength)
+					{
+						for (ULONG j=0; j<BufferLength; j++)
+						{
+							MidiQueue->GetQueue(&Buffer[j]);
+						}
+
+						LONGLONG NewSysExTimeStampCounter = *TimeStampCounter;
+
+						*TimeStampCounter = *SysExTimeStampCounter;
+
+						*SysExTimeStampCounter = NewSysExTimeStampCounter;
+
+						Success = BufferLength;
+					}
+
+					Structured = FALSE;
+				}
+			}
+			break;
+		}
+
+		if (Success) break;
+	}
+
+	if (OutStructured)
+	{
+		*OutStructured = Structured;
+	}
+
+	return Success;
+}
+
+#endif // __MIDI_EVENT_H__
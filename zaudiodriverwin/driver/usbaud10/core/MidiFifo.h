@@ -37,6 +37,13 @@
 /*! @brief Size of the hardware FIFO in bytes. */
 #define MIDI_FIFO_BUFFER_SIZE		64
 
+/*! @brief Largest bulk OUT transfer in bytes. */
+#define MIDI_FIFO_MAXIMUM_TRANSFER_SIZE				2048
+
+/*! @brief Number of wMaxPacketSize packets in a bulk OUT transfer on a high
+ * speed device. */
+#define MIDI_FIFO_HIGH_SPEED_PACKETS_PER_TRANSFER	4
+
 /*****************************************************************************
  *//*! @class MIDI_FIFO_WORK_ITEM
  *****************************************************************************
@@ -56,18 +63,20 @@ public:
      * Constructor/destructor.
      */
     /*! @brief Constructor. */
-    MIDI_FIFO_WORK_ITEM()  { m_Next = m_Prev = NULL; m_Owner = NULL; }
+    MIDI_FIFO_WORK_ITEM()  { m_Next = m_Prev = NULL; m_Owner = NULL; FifoBuffer = NULL; Tags = NULL; }
     /*! @brief Destructor. */
-    ~MIDI_FIFO_WORK_ITEM() {}
+    ~MIDI_FIFO_WORK_ITEM() { if (FifoBuffer) ExFreePool(FifoBuffer); if (Tags) ExFreePool(Tags); }
     /*! @brief Self-destructor. */
 	void Destruct() { /* Items are allocated & free elsewhere. */ }
 
     PVOID       Context;
     PIRP        Irp;
     URB         Urb;
+    PUCHAR      FifoBuffer;
+	ULONG		FifoBufferSize;
 	ULONG		BytesInFifoBuffer;
-    UCHAR       FifoBuffer[MIDI_FIFO_BUFFER_SIZE];
-	PVOID		Tags[MIDI_FIFO_BUFFER_SIZE/sizeof(USB_MIDI_EVENT_PACKET)];
+	PVOID *		Tags;			/*!< @brief The sender of each packet in FifoBuffer (output only). */
+	ULONG		CableMask;		/*!< @brief The cables with packets in FifoBuffer (output only). */
 
     /*************************************************************************
      * Friends
@@ -0,0 +1,200 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd. 
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public 
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file	   MidiRing.h
+ * @brief	   This file defines the lock-free ring buffer of USB-MIDI event
+ *			   packets that each MIDI client queues its data in.
+ *//*
+ *****************************************************************************
+ */
+#ifndef __MIDI_RING_H__
+#define __MIDI_RING_H__
+
+#include "usbaudio.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Size of the client data buffer, in packets. Powers of 2. */
+#define MIDI_CLIENT_DEFAULT_BUFFER_SIZE	1024
+#define MIDI_CLIENT_MINIMUM_BUFFER_SIZE	64
+#define MIDI_CLIENT_MAXIMUM_BUFFER_SIZE	4096
+
+/*!
+ * @brief
+ * Extended USB MIDI event packet.
+ */
+typedef struct
+{
+	USB_MIDI_EVENT_PACKET	Packet;
+	LONGLONG				TimeStampCounter;
+} USB_MIDI_EVENT_PACKET_EX, *PUSB_MIDI_EVENT_PACKET_EX;
+
+/*****************************************************************************
+ * Classes
+ */
+/*****************************************************************************
+ *//*! @class CMidiRing
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Single producer, single consumer ring buffer of USB-MIDI event packets.
+ * @details
+ * m_WriteIndex and m_ReadIndex count the packets added and removed since the
+ * ring was attached to its storage, and are only ever written by the
+ * producer and the consumer respectively. The ring holds
+ * m_WriteIndex - m_ReadIndex packets, and the slot of an index is the index
+ * modulo m_Size, which is a power of 2 so that the unsigned wrap around of
+ * the indices is harmless. The producer fills in a slot before it publishes
+ * the new m_WriteIndex, and the consumer copies out a slot before it gives
+ * it back with the new m_ReadIndex, so neither side needs a lock to talk to
+ * the other. There must only be one producer and one consumer at a time.
+ */
+class CMidiRing
+{
+private:
+	volatile ULONG				m_ReadIndex;	/*!< @brief Packets removed, free running. Written by the consumer only. */
+	volatile ULONG				m_WriteIndex;	/*!< @brief Packets added, free running. Written by the producer only. */
+	PUSB_MIDI_EVENT_PACKET_EX	m_Buffer;		/*!< @brief Storage, owned by the caller of Attach(). */
+	ULONG						m_Size;			/*!< @brief Number of packets in m_Buffer, a power of 2. Zero until attached. */
+
+public:
+    /*************************************************************************
+     * Constructor.
+     */
+	CMidiRing(void)
+	{
+		m_ReadIndex = m_WriteIndex = 0;
+		m_Buffer = NULL;
+		m_Size = 0;
+	}
+
+	/*! @brief Give the ring its storage, of Size packets. The ring is empty, with both indices at Index. */
+	void Attach(PUSB_MIDI_EVENT_PACKET_EX Buffer, ULONG Size, ULONG Index = 0)
+	{
+		m_ReadIndex = m_WriteIndex = Index;
+		m_Buffer = Buffer;
+
+		/* The producer must not see the new size with the old indices. */
+		KeMemoryBarrier();
+
+		m_Size = Size;
+	}
+
+	/*! @brief Storage given to Attach(), or NULL. */
+	PUSB_MIDI_EVENT_PACKET_EX Buffer(void)
+	{
+		return m_Buffer;
+	}
+
+	/*! @brief Number of packets the ring holds, 0 until attached. */
+	ULONG Size(void)
+	{
+		return m_Size;
+	}
+
+	/*! @brief Producer: add a packet. FALSE if the ring is full, or not attached. */
+	BOOL AddPacket(USB_MIDI_EVENT_PACKET Packet, LONGLONG TimeStampCounter)
+	{
+		ULONG WriteIndex = m_WriteIndex;
+
+		if ((WriteIndex - m_ReadIndex) >= m_Size)
+		{
+			return FALSE;
+		}
+
+		PUSB_MIDI_EVENT_PACKET_EX Entry = &m_Buffer[WriteIndex & (m_Size-1)];
+
+		Entry->Packet = Packet;
+		Entry->TimeStampCounter = TimeStampCounter;
+
+		/* The slot must be written before the consumer can see it. */
+		KeMemoryBarrier();
+
+		m_WriteIndex = WriteIndex + 1;
+
+		return TRUE;
+	}
+
+	/*! @brief Consumer: copy out the oldest packet, leaving it queued. FALSE if the ring is empty. */
+	BOOL PeekPacket(USB_MIDI_EVENT_PACKET * OutPacket, LONGLONG * OutTimeStampCounter)
+	{
+		ULONG ReadIndex = m_ReadIndex;
+
+		if (ReadIndex == m_WriteIndex)
+		{
+			return FALSE;
+		}
+
+		/* The slot must not be read before the index that published it. */
+		KeMemoryBarrier();
+
+		PUSB_MIDI_EVENT_PACKET_EX Entry = &m_Buffer[ReadIndex & (m_Size-1)];
+
+		*OutPacket = Entry->Packet;
+
+		if (OutTimeStampCounter)
+		{
+			*OutTimeStampCounter = Entry->TimeStampCounter;
+		}
+
+		return TRUE;
+	}
+
+	/*! @brief Consumer: copy out and remove the oldest packet. FALSE if the ring is empty. */
+	BOOL RemovePacket(USB_MIDI_EVENT_PACKET * OutPacket, LONGLONG * OutTimeStampCounter)
+	{
+		if (!PeekPacket(OutPacket, OutTimeStampCounter))
+		{
+			return FALSE;
+		}
+
+		/* The slot must be read before the producer can reuse it. */
+		KeMemoryBarrier();
+
+		m_ReadIndex = m_ReadIndex + 1;
+
+		return TRUE;
+	}
+
+	/*! @brief Consumer: drop whatever is queued. The producer may carry on meanwhile. */
+	void Flush(void)
+	{
+		m_ReadIndex = m_WriteIndex;
+	}
+
+	/*! @brief Number of packets queued. Either side may call it. */
+	ULONG GetNumQueuedPackets(void)
+	{
+		/* Read the consumer index first: if both sides move on in between, the
+		   count may run ahead of what is queued, so clamp it to the size. */
+		ULONG ReadIndex = m_ReadIndex;
+
+		KeMemoryBarrier();
+
+		ULONG NumQueuedPackets = m_WriteIndex - ReadIndex;
+
+		return (NumQueuedPackets < m_Size) ? NumQueuedPackets : m_Size;
+	}
+};
+
+#endif // __MIDI_RING_H__
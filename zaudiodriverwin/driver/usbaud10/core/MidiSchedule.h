@@ -0,0 +1,114 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd. 
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public 
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file	   MidiSchedule.h
+ * @brief	   This file defines when the MIDI output packets held back until
+ *			   their presentation time are due, and when the cable's service
+ *			   timer is set for them.
+ *//*
+ *****************************************************************************
+ */
+#ifndef __MIDI_SCHEDULE_H__
+#define __MIDI_SCHEDULE_H__
+
+/*****************************************************************************
+ * MidiIsDue()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Whether a packet time stamped TimeStampCounter is due at
+ * CurrentTimeStampCounter. A packet without a time (0) is always due.
+ */
+static __inline
+BOOL
+MidiIsDue
+(
+	IN		LONGLONG	TimeStampCounter,
+	IN		LONGLONG	CurrentTimeStampCounter
+)
+{
+	return (TimeStampCounter <= CurrentTimeStampCounter);
+}
+
+/*****************************************************************************
+ * MidiScheduleService()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * Account for a packet held back until TimeStampCounter.
+ * @details
+ * Each client sends its packets in time order, so a cable only needs to
+ * know about the first packet that each client holds back, and its timer is
+ * set to the earliest of them.
+ * @param
+ * ServiceTimeStampCounter When the cable is to be serviced, 0 if it is not.
+ * Updated.
+ * @param
+ * TimeStampCounter When the packet is due.
+ * @return
+ * Returns TRUE if the timer is to be set (again), to *ServiceTimeStampCounter.
+ */
+static __inline
+BOOL
+MidiScheduleService
+(
+	IN	OUT	LONGLONG *	ServiceTimeStampCounter,
+	IN		LONGLONG	TimeStampCounter
+)
+{
+	if ((*ServiceTimeStampCounter == 0) || (TimeStampCounter < *ServiceTimeStampCounter))
+	{
+		*ServiceTimeStampCounter = TimeStampCounter;
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*****************************************************************************
+ * MidiServiceDueTime()
+ *****************************************************************************
+ * @ingroup MIDI_GROUP
+ * @brief
+ * The relative due time to set the service timer with, in 100ns, for a
+ * packet due at TimeStampCounter. The timer fires on the first clock tick
+ * after it.
+ * @return
+ * Returns a negative due time, as KeSetTimer() takes it. Never 0, which
+ * would be an absolute time.
+ */
+static __inline
+LONGLONG
+MidiServiceDueTime
+(
+	IN		LONGLONG	TimeStampCounter,
+	IN		LONGLONG	CurrentTimeStampCounter,
+	IN		LONGLONG	PerformanceFrequency
+)
+{
+	LONGLONG DueTime = -(LONGLONG)((DOUBLE)(TimeStampCounter - CurrentTimeStampCounter) * 10000000 / (DOUBLE)PerformanceFrequency);
+
+	return DueTime ? DueTime : -1;
+}
+
+#endif // __MIDI_SCHEDULE_H__
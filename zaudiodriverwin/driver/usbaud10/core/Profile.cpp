@@ -1198,6 +1198,95 @@ AToD
     return IsDigit;
 }
 
+/*****************************************************************************
+ * CopyStringValue()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Copy an ASCII string value, without its quotes, to the caller's buffer.
+ */
+static
+VOID
+CopyStringValue
+(
+    IN      LPSTR	Value,
+    OUT     LPSTR	ReturnedString,
+    IN      DWORD	Size
+)
+{
+	PAGED_CODE();
+
+	// Remove quote if found.
+	ULONG Length = strlen(Value);
+
+	if (strchr(Value, '"'))
+	{
+		Value++;
+
+		CHAR * q = strrchr(Value, '"');
+
+		Length = q ? ULONG(q - Value) : strlen(Value);
+	}
+
+	if (Size > Length)
+	{
+		strncpy(ReturnedString, Value, Length);
+
+		ReturnedString[Length] = '\0';
+	}
+	else if (Size)
+	{
+		strncpy(ReturnedString, Value, Size-1);
+
+		ReturnedString[Size-1] = '\0';
+	}
+}
+
+/*****************************************************************************
+ * CopyUnicodeStringValue()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Convert a hex-byte string value (\xx\xx...) to a UNICODE string in the
+ * caller's buffer.
+ */
+static
+VOID
+CopyUnicodeStringValue
+(
+    IN      LPSTR	Value,
+    OUT     PWCHAR	ReturnedString,
+    IN      DWORD	Size
+)
+{
+	PAGED_CODE();
+
+	// Skip the quote if found.
+	LPSTR p = strchr(Value, '"') ? Value+1 : Value;
+
+	ULONG i=0;
+
+	while (p && (*p) && (*p=='\\') && (i<((Size-1)*2)))
+	{
+		p++;
+
+		// Skip anything AToX() leaves before the next backslash.
+		CHAR * q = strchr(p, '\\');
+
+		ULONG hex; AToX(&p, &hex);
+
+		UCHAR * value = (PUCHAR)ReturnedString; value[i] = UCHAR(hex);
+
+		p = q;
+
+		i++;
+	}
+
+	i = ((i+1)/2)*2; // round it up.
+
+	ReturnedString[(i/2)] = 0;
+}
+
 /*****************************************************************************
  * DrvProfileGetUlong()
  *****************************************************************************
@@ -1707,19 +1796,7 @@ DrvProfileGetString
 
 							if (_stricmp(KeyName, line) == 0)
 							{
-								// Remove quote if found.
-								CHAR * q = strchr(p, '"'); if (q) p++; q = strrchr(p, '"'); if (q) *q = 0;
-
-								if (Size >= (strlen(p)+1))
-								{
-									strcpy(ReturnedString, p);
-								}
-								else
-								{
-									strncpy(ReturnedString, p, Size-1);
-
-									ReturnedString[Size] = '\0';
-								}
+								CopyStringValue(p, ReturnedString, Size);
 
 								break;
 							}
@@ -1791,50 +1868,689 @@ DrvProfileGetUnicodeString
 
 							if (_stricmp(KeyName, line) == 0)
 							{
-								// Remove quote if found.
-								CHAR * q = strchr(p, '"'); if (q) p++; q = strrchr(p, '"'); if (q) *q = 0;
-								
-								ULONG i=0;
+								CopyUnicodeStringValue(p, ReturnedString, Size);
+
+								break;
+							}
+						}
 
-								while (p && (*p) && (*p=='\\') && (i<((Size-1)*2)))
-								{
-									p++;
+						line = Frb.ReadLine();
+					}
 
-									CHAR * q = strchr(p, '\\');
-									
-									if (q) *q = '\0';
+					// Done looking at the Section & Key.
+					break;
+				}
+			}
 
-									ULONG hex; AToX(&p, &hex);
+			line = Frb.ReadLine();
+		}
 
-									UCHAR * value = (PUCHAR)ReturnedString; value[i] = UCHAR(hex);
+		Frb.Close();
+	}
 
-									if(q) *q = '\\';
+	return wcslen(ReturnedString);
+}
 
-									p = q;
+/*****************************************************************************
+ * HashProfileName()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Case insensitive FNV-1a hash of a section name and a key name.
+ * @param
+ * KeyName Key name, or NULL for the section itself.
+ */
+static
+ULONG
+HashProfileName
+(
+    IN      LPSTR	SectionName,
+    IN      LPSTR	KeyName
+)
+{
+	PAGED_CODE();
 
-									i++;
-								}
+	ULONG Hash = 0x811C9DC5;
 
-								i = ((i+1)/2)*2; // round it up.
+	for (LPSTR p = SectionName; *p; p++)
+	{
+		CHAR ch = ((*p >= 'a') && (*p <= 'z')) ? (*p - 'a' + 'A') : *p;
 
-								ReturnedString[(i/2)] = 0;
+		Hash = (Hash ^ UCHAR(ch)) * 0x01000193;
+	}
 
-								break;
-							}
-						}
+	if (KeyName)
+	{
+		// Keep [a]bc= and [ab]c= apart.
+		Hash = (Hash ^ UCHAR(']')) * 0x01000193;
 
-						line = Frb.ReadLine();
+		for (LPSTR p = KeyName; *p; p++)
+		{
+			CHAR ch = ((*p >= 'a') && (*p <= 'z')) ? (*p - 'a' + 'A') : *p;
+
+			Hash = (Hash ^ UCHAR(ch)) * 0x01000193;
+		}
+	}
+
+	return Hash;
+}
+
+/*****************************************************************************
+ * CDrvProfile::CDrvProfile()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Constructor.
+ */
+CDrvProfile::
+CDrvProfile
+(	void
+)
+{
+	PAGED_CODE();
+
+	m_Memory = NULL;
+	m_Entry = NULL;
+	m_NumberOfEntries = 0;
+	m_MaximumEntries = 0;
+	m_Bucket = NULL;
+	m_BucketMask = 0;
+	m_Strings = NULL;
+	m_StringsSize = 0;
+	m_MaximumStrings = 0;
+}
+
+/*****************************************************************************
+ * CDrvProfile::~CDrvProfile()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Destructor.
+ */
+CDrvProfile::
+~CDrvProfile
+(	void
+)
+{
+	PAGED_CODE();
+
+	Close();
+}
+
+/*****************************************************************************
+ * CDrvProfile::Open()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Parse a profile into memory.
+ * @details
+ * The file is read twice: once to size the table, once to fill it. It is
+ * not kept open. A profile that is already open is closed first.
+ * @param
+ * FilePathName Path name of the file.
+ * @return
+ * Returns STATUS_SUCCESS if successful, STATUS_UNSUCCESSFUL if the file
+ * can't be read, or STATUS_INSUFFICIENT_RESOURCES.
+ */
+NTSTATUS
+CDrvProfile::
+Open
+(
+	IN		LPWSTR	FilePathName
+)
+{
+	PAGED_CODE();
+
+	Close();
+
+	if (!_Parse(FilePathName, TRUE))
+	{
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	// At least one bucket per entry keeps the chains short.
+	ULONG NumberOfBuckets = 16;
+
+	while ((NumberOfBuckets < m_MaximumEntries) && (NumberOfBuckets < 0x80000000))
+	{
+		NumberOfBuckets <<= 1;
+	}
+
+	ULONG EntrySize = m_MaximumEntries * sizeof(DRV_PROFILE_ENTRY);
+	ULONG BucketSize = NumberOfBuckets * sizeof(ULONG);
+
+	m_Memory = ExAllocatePoolWithTag(PagedPool, EntrySize + BucketSize + m_MaximumStrings, 'mdW');
+
+	if (!m_Memory)
+	{
+		Close();
+
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	m_Entry = PDRV_PROFILE_ENTRY(m_Memory);
+	m_Bucket = PULONG(PUCHAR(m_Memory) + EntrySize);
+	m_BucketMask = NumberOfBuckets - 1;
+	m_Strings = PCHAR(m_Memory) + EntrySize + BucketSize;
+
+	for (ULONG i=0; i<NumberOfBuckets; i++)
+	{
+		m_Bucket[i] = DRV_PROFILE_NO_ENTRY;
+	}
+
+	if (!_Parse(FilePathName, FALSE))
+	{
+		Close();
+
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	_DbgPrintF(DEBUGLVL_VERBOSE,("[CDrvProfile::Open] - %ws: %d entries, %d buckets, %d bytes of strings", FilePathName, m_NumberOfEntries, NumberOfBuckets, m_StringsSize));
+
+	return STATUS_SUCCESS;
+}
+
+/*****************************************************************************
+ * CDrvProfile::Close()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Free the parsed profile. The lookups return their defaults until the next
+ * Open().
+ */
+VOID
+CDrvProfile::
+Close
+(	void
+)
+{
+	PAGED_CODE();
+
+	if (m_Memory)
+	{
+		ExFreePool(m_Memory);
+
+		m_Memory = NULL;
+	}
+
+	m_Entry = NULL;
+	m_NumberOfEntries = 0;
+	m_MaximumEntries = 0;
+	m_Bucket = NULL;
+	m_BucketMask = 0;
+	m_Strings = NULL;
+	m_StringsSize = 0;
+	m_MaximumStrings = 0;
+}
+
+/*****************************************************************************
+ * CDrvProfile::_Parse()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Go through the lines of the file as the DrvProfileGetXxx() functions do.
+ * @param
+ * FilePathName Path name of the file.
+ * @param
+ * Count TRUE to only count the entries and string bytes the table needs,
+ * FALSE to fill the table.
+ * @return
+ * Returns TRUE if the file was read, otherwise FALSE.
+ */
+BOOL
+CDrvProfile::
+_Parse
+(
+	IN		LPWSTR	FilePathName,
+	IN		BOOL	Count
+)
+{
+	PAGED_CODE();
+
+	CFileReadBuffer Frb;
+
+	if (!Frb.Open(FilePathName, ";"))
+	{
+		return FALSE;
+	}
+
+	// Current section, or NULL if it is a duplicate (or there is none yet)
+	// and its keys are ignored.
+	LPSTR Section = NULL;
+
+	LPSTR line = Frb.ReadLine();
+
+	while (line)
+	{
+		// Begining of a section ?
+		if (line[0] == '[')
+		{
+			line++;
+
+			CHAR * t = strrchr(line, ']'); if (t) *t = '\0';
+
+			if (Count)
+			{
+				m_MaximumEntries++;
+				m_MaximumStrings += strlen(line) + 1;
+
+				// Can't tell the duplicates apart yet.
+				Section = line;
+			}
+			else
+			{
+				ULONG Hash = HashProfileName(line, NULL);
+
+				Section = NULL;
+
+				if (!_FindEntry(line, NULL, Hash) && (m_NumberOfEntries < m_MaximumEntries))
+				{
+					Section = _AddString(line, strlen(line));
+
+					if (Section)
+					{
+						PDRV_PROFILE_ENTRY Entry = &m_Entry[m_NumberOfEntries];
+
+						Entry->Hash = Hash;
+						Entry->SectionName = Section;
+						Entry->KeyName = NULL;
+						Entry->Value = NULL;
+						Entry->Next = m_Bucket[Hash & m_BucketMask];
+
+						m_Bucket[Hash & m_BucketMask] = m_NumberOfEntries++;
 					}
+				}
+			}
+		}
+		else if (Section)
+		{
+			CHAR * p = strchr(line, '=');
 
-					// Done looking at the Section & Key.
-					break;
+			if (p)
+			{
+				*p = 0; p++;
+
+				if (Count)
+				{
+					m_MaximumEntries++;
+					m_MaximumStrings += strlen(line) + 1 + strlen(p) + 1;
+				}
+				else
+				{
+					ULONG Hash = HashProfileName(Section, line);
+
+					if (!_FindEntry(Section, line, Hash) && (m_NumberOfEntries < m_MaximumEntries))
+					{
+						LPSTR KeyName = _AddString(line, strlen(line));
+						LPSTR Value = _AddString(p, strlen(p));
+
+						if (KeyName && Value)
+						{
+							PDRV_PROFILE_ENTRY Entry = &m_Entry[m_NumberOfEntries];
+
+							Entry->Hash = Hash;
+							Entry->SectionName = Section;
+							Entry->KeyName = KeyName;
+							Entry->Value = Value;
+							Entry->Next = m_Bucket[Hash & m_BucketMask];
+
+							m_Bucket[Hash & m_BucketMask] = m_NumberOfEntries++;
+						}
+					}
 				}
 			}
+		}
 
-			line = Frb.ReadLine();
+		line = Frb.ReadLine();
+	}
+
+	Frb.Close();
+
+	return TRUE;
+}
+
+/*****************************************************************************
+ * CDrvProfile::_AddString()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Copy a string into the string area.
+ * @return
+ * Returns the copy, or NULL if the area is full (the file grew since it was
+ * counted).
+ */
+LPSTR
+CDrvProfile::
+_AddString
+(
+	IN		LPSTR	String,
+	IN		ULONG	Length
+)
+{
+	PAGED_CODE();
+
+	if ((m_MaximumStrings - m_StringsSize) < (Length + 1))
+	{
+		return NULL;
+	}
+
+	LPSTR Copy = &m_Strings[m_StringsSize];
+
+	RtlCopyMemory(Copy, String, Length);
+
+	Copy[Length] = '\0';
+
+	m_StringsSize += Length + 1;
+
+	return Copy;
+}
+
+/*****************************************************************************
+ * CDrvProfile::_FindEntry()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Look up a section or a key.
+ * @param
+ * KeyName Key name, or NULL to look up the section itself.
+ * @param
+ * Hash HashProfileName(SectionName, KeyName).
+ */
+PDRV_PROFILE_ENTRY
+CDrvProfile::
+_FindEntry
+(
+	IN		LPSTR	SectionName,
+	IN		LPSTR	KeyName,
+	IN		ULONG	Hash
+)
+{
+	PAGED_CODE();
+
+	if (!m_Bucket)
+	{
+		return NULL;
+	}
+
+	for (ULONG i = m_Bucket[Hash & m_BucketMask]; i != DRV_PROFILE_NO_ENTRY; i = m_Entry[i].Next)
+	{
+		PDRV_PROFILE_ENTRY Entry = &m_Entry[i];
+
+		if ((Entry->Hash == Hash) &&
+			((Entry->KeyName == NULL) == (KeyName == NULL)) &&
+			(_stricmp(SectionName, Entry->SectionName) == 0) &&
+			(!KeyName || (_stricmp(KeyName, Entry->KeyName) == 0)))
+		{
+			return Entry;
 		}
+	}
 
-		Frb.Close();
+	return NULL;
+}
+
+/*****************************************************************************
+ * CDrvProfile::_FindValue()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Look up the value of a key.
+ * @return
+ * Returns the value, or NULL if the key is not found.
+ */
+LPSTR
+CDrvProfile::
+_FindValue
+(
+	IN		LPSTR	SectionName,
+	IN		LPSTR	KeyName
+)
+{
+	PAGED_CODE();
+
+	PDRV_PROFILE_ENTRY Entry = _FindEntry(SectionName, KeyName, HashProfileName(SectionName, KeyName));
+
+	return Entry ? Entry->Value : NULL;
+}
+
+/*****************************************************************************
+ * CDrvProfile::GetUlong()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Same as DrvProfileGetUlong().
+ */
+ULONG
+CDrvProfile::
+GetUlong
+(
+	IN		LPSTR	SectionName,
+	IN		LPSTR	KeyName,
+	IN		ULONG	Default
+)
+{
+	PAGED_CODE();
+
+	ULONG IntValue = Default;
+
+	LPSTR p = _FindValue(SectionName, KeyName);
+
+	if (p)
+	{
+		AToX(&p, &IntValue);
+	}
+
+	return IntValue;
+}
+
+/*****************************************************************************
+ * CDrvProfile::GetUshort()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Same as DrvProfileGetUshort().
+ */
+USHORT
+CDrvProfile::
+GetUshort
+(
+	IN		LPSTR	SectionName,
+	IN		LPSTR	KeyName,
+	IN		USHORT	Default
+)
+{
+	PAGED_CODE();
+
+	USHORT IntValue = Default;
+
+	LPSTR p = _FindValue(SectionName, KeyName);
+
+	if (p)
+	{
+		AToX(&p, &IntValue);
+	}
+
+	return IntValue;
+}
+
+/*****************************************************************************
+ * CDrvProfile::GetUchar()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Same as DrvProfileGetUchar().
+ */
+UCHAR
+CDrvProfile::
+GetUchar
+(
+	IN		LPSTR	SectionName,
+	IN		LPSTR	KeyName,
+	IN		UCHAR	Default
+)
+{
+	PAGED_CODE();
+
+	UCHAR IntValue = Default;
+
+	LPSTR p = _FindValue(SectionName, KeyName);
+
+	if (p)
+	{
+		AToX(&p, &IntValue);
+	}
+
+	return IntValue;
+}
+
+/*****************************************************************************
+ * CDrvProfile::GetLong()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Same as DrvProfileGetLong().
+ */
+LONG
+CDrvProfile::
+GetLong
+(
+	IN		LPSTR	SectionName,
+	IN		LPSTR	KeyName,
+	IN		LONG	Default
+)
+{
+	PAGED_CODE();
+
+	LONG IntValue = Default;
+
+	LPSTR p = _FindValue(SectionName, KeyName);
+
+	if (p)
+	{
+		AToD(&p, &IntValue);
+	}
+
+	return IntValue;
+}
+
+/*****************************************************************************
+ * CDrvProfile::GetShort()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Same as DrvProfileGetShort().
+ */
+SHORT
+CDrvProfile::
+GetShort
+(
+	IN		LPSTR	SectionName,
+	IN		LPSTR	KeyName,
+	IN		SHORT	Default
+)
+{
+	PAGED_CODE();
+
+	SHORT IntValue = Default;
+
+	LPSTR p = _FindValue(SectionName, KeyName);
+
+	if (p)
+	{
+		AToD(&p, &IntValue);
+	}
+
+	return IntValue;
+}
+
+/*****************************************************************************
+ * CDrvProfile::GetChar()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Same as DrvProfileGetChar().
+ */
+CHAR
+CDrvProfile::
+GetChar
+(
+	IN		LPSTR	SectionName,
+	IN		LPSTR	KeyName,
+	IN		CHAR	Default
+)
+{
+	PAGED_CODE();
+
+	CHAR IntValue = Default;
+
+	LPSTR p = _FindValue(SectionName, KeyName);
+
+	if (p)
+	{
+		AToD(&p, &IntValue);
+	}
+
+	return IntValue;
+}
+
+/*****************************************************************************
+ * CDrvProfile::GetString()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Same as DrvProfileGetString().
+ */
+ULONG
+CDrvProfile::
+GetString
+(
+	IN		LPSTR	SectionName,
+	IN		LPSTR	KeyName,
+	IN		LPSTR	Default,
+	IN		LPSTR	ReturnedString,
+	IN		DWORD	Size
+)
+{
+	PAGED_CODE();
+
+	strcpy(ReturnedString, Default);
+
+	LPSTR p = _FindValue(SectionName, KeyName);
+
+	if (p)
+	{
+		CopyStringValue(p, ReturnedString, Size);
+	}
+
+	return strlen(ReturnedString);
+}
+
+/*****************************************************************************
+ * CDrvProfile::GetUnicodeString()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Same as DrvProfileGetUnicodeString().
+ */
+ULONG
+CDrvProfile::
+GetUnicodeString
+(
+	IN		LPSTR	SectionName,
+	IN		LPSTR	KeyName,
+	IN		PWCHAR	Default,
+	IN		PWCHAR	ReturnedString,
+	IN		DWORD	Size
+)
+{
+	PAGED_CODE();
+
+	wcscpy(ReturnedString, Default);
+
+	LPSTR p = _FindValue(SectionName, KeyName);
+
+	if (p)
+	{
+		CopyUnicodeStringValue(p, ReturnedString, Size);
 	}
 
 	return wcslen(ReturnedString);
@@ -106,4 +106,156 @@ DrvProfileGetUnicodeString
     IN		LPWSTR	FilePathName	// address of initialization filename
 );
 
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief End of a hash chain. */
+#define DRV_PROFILE_NO_ENTRY	0xFFFFFFFF
+
+/*****************************************************************************
+ * Structures
+ */
+/*****************************************************************************
+ *//*! @struct DRV_PROFILE_ENTRY
+ *****************************************************************************
+ * @brief
+ * Section or key of an indexed profile.
+ */
+typedef struct
+{
+	ULONG	Hash;			/*!< @brief Hash of the section and key names. */
+	ULONG	Next;			/*!< @brief Next entry in the same bucket, or DRV_PROFILE_NO_ENTRY. */
+	LPSTR	SectionName;	/*!< @brief Section name. */
+	LPSTR	KeyName;		/*!< @brief Key name, or NULL for the section itself. */
+	LPSTR	Value;			/*!< @brief Value of the key. */
+} DRV_PROFILE_ENTRY, *PDRV_PROFILE_ENTRY;
+
+/*****************************************************************************
+ * Classes
+ */
+/*****************************************************************************
+ *//*! @class CDrvProfile
+ *****************************************************************************
+ * @brief
+ * Indexed profile.
+ * @details
+ * The file is parsed once by Open() into a hash table of its sections and
+ * keys, and the lookups are served from memory until Close(). The values are
+ * converted as the DrvProfileGetXxx() functions do, which are still there
+ * for one-off lookups.
+ *
+ * As with those, the first of duplicate sections or keys wins, and the
+ * section and key names are not case sensitive.
+ */
+class CDrvProfile
+{
+private:
+	PVOID				m_Memory;			/*!< @brief Entries, buckets and strings. */
+	PDRV_PROFILE_ENTRY	m_Entry;			/*!< @brief Entries. */
+	ULONG				m_NumberOfEntries;	/*!< @brief Number of entries used. */
+	ULONG				m_MaximumEntries;	/*!< @brief Number of entries allocated. */
+	PULONG				m_Bucket;			/*!< @brief First entry of each bucket. */
+	ULONG				m_BucketMask;		/*!< @brief Number of buckets - 1. */
+	PCHAR				m_Strings;			/*!< @brief Section names, key names and values. */
+	ULONG				m_StringsSize;		/*!< @brief Bytes used in the string area. */
+	ULONG				m_MaximumStrings;	/*!< @brief Size of the string area. */
+
+	BOOL _Parse
+	(
+		IN		LPWSTR	FilePathName,
+		IN		BOOL	Count
+	);
+	PDRV_PROFILE_ENTRY _FindEntry
+	(
+		IN		LPSTR	SectionName,
+		IN		LPSTR	KeyName,
+		IN		ULONG	Hash
+	);
+	LPSTR _AddString
+	(
+		IN		LPSTR	String,
+		IN		ULONG	Length
+	);
+	LPSTR _FindValue
+	(
+		IN		LPSTR	SectionName,
+		IN		LPSTR	KeyName
+	);
+
+public:
+    /*************************************************************************
+     * Constructor/destructor.
+     */
+	CDrvProfile();
+	~CDrvProfile();
+
+    /*************************************************************************
+     * CDrvProfile methods
+     */
+	NTSTATUS Open
+	(
+		IN		LPWSTR	FilePathName
+	);
+	VOID Close
+	(	void
+	);
+
+	// In hexadecimal...
+	ULONG GetUlong
+	(
+		IN		LPSTR	SectionName,
+		IN		LPSTR	KeyName,
+		IN		ULONG	Default
+	);
+	USHORT GetUshort
+	(
+		IN		LPSTR	SectionName,
+		IN		LPSTR	KeyName,
+		IN		USHORT	Default
+	);
+	UCHAR GetUchar
+	(
+		IN		LPSTR	SectionName,
+		IN		LPSTR	KeyName,
+		IN		UCHAR	Default
+	);
+	// In decimal...
+	LONG GetLong
+	(
+		IN		LPSTR	SectionName,
+		IN		LPSTR	KeyName,
+		IN		LONG	Default
+	);
+	SHORT GetShort
+	(
+		IN		LPSTR	SectionName,
+		IN		LPSTR	KeyName,
+		IN		SHORT	Default
+	);
+	CHAR GetChar
+	(
+		IN		LPSTR	SectionName,
+		IN		LPSTR	KeyName,
+		IN		CHAR	Default
+	);
+	// In ASCII string...
+	ULONG GetString
+	(
+		IN		LPSTR	SectionName,
+		IN		LPSTR	KeyName,
+		IN		LPSTR	Default,
+		IN		LPSTR	ReturnedString,
+		IN		DWORD	Size
+	);
+	// In hex-byte...
+	ULONG GetUnicodeString
+	(
+		IN		LPSTR	SectionName,
+		IN		LPSTR	KeyName,
+		IN		PWCHAR	Default,
+		IN		PWCHAR	ReturnedString,
+		IN		DWORD	Size
+	);
+};
+
 #endif // _PROFILE_H_
@@ -30,7 +30,6 @@
  *****************************************************************************
  */
 #include "UsbDev.h"
-#include "Profile.h"
 
 #define STR_MODULENAME "CUsbDevice: "
 
@@ -170,12 +169,14 @@ SetupLanguageSupport
 
 	m_NumberOfLanguageSupported = 0;
 
-	if (LanguageFile)
+	m_LanguageProfile.Close();
+
+	// Parse the file once, the string descriptor requests are served from
+	// the index for as long as the device is around.
+	if (LanguageFile && NT_SUCCESS(m_LanguageProfile.Open(LanguageFile)))
 	{
 		ULONG i;
 
-		wcscpy(m_LanguageFile, LanguageFile);
-
 		// First find the user-supplied localization file.
 		CHAR SectionName[64]; sprintf(SectionName, "USB\\VID_%04X&PID_%04X.LANGID", m_UsbDeviceDescriptor.idVendor, m_UsbDeviceDescriptor.idProduct);
 
@@ -185,7 +186,7 @@ SetupLanguageSupport
 
 			m_LanguageSupport[i].Location = LANGUAGE_SUPPORT_LOCATION_FILE;
 
-			m_LanguageSupport[i].wLANGID = DrvProfileGetUshort(SectionName, KeyName, 0, LanguageFile);
+			m_LanguageSupport[i].wLANGID = m_LanguageProfile.GetUshort(SectionName, KeyName, 0);
 
 			if (m_LanguageSupport[i].wLANGID)
 			{
@@ -200,21 +201,21 @@ SetupLanguageSupport
 		// Fixup the USB device descriptors, if it is asked to do so.
 		sprintf(SectionName, "USB\\VID_%04X&PID_%04X.FIXUP.%03X", m_UsbDeviceDescriptor.idVendor, m_UsbDeviceDescriptor.idProduct, m_UsbDeviceDescriptor.bcdDevice);
 
-		UCHAR iIndex = DrvProfileGetUchar(SectionName, "iManufacturer", 0, LanguageFile);
+		UCHAR iIndex = m_LanguageProfile.GetUchar(SectionName, "iManufacturer", 0);
 
 		if (iIndex)
 		{
 			m_UsbDeviceDescriptor.iManufacturer = iIndex;
 		}
 
-		iIndex = DrvProfileGetUchar(SectionName, "iProduct", 0, LanguageFile);
+		iIndex = m_LanguageProfile.GetUchar(SectionName, "iProduct", 0);
 
 		if (iIndex)
 		{
 			m_UsbDeviceDescriptor.iProduct = iIndex;
 		}
 
-		iIndex = DrvProfileGetUchar(SectionName, "iSerialNumber", 0, LanguageFile);
+		iIndex = m_LanguageProfile.GetUchar(SectionName, "iSerialNumber", 0);
 
 		if (iIndex)
 		{
@@ -226,7 +227,7 @@ SetupLanguageSupport
 		{
 			CHAR KeyName[8]; sprintf(KeyName, "%d", i+1);
 
-			ULONG Entry = DrvProfileGetUlong(SectionName, KeyName, 0xFFFFFFFF, LanguageFile);
+			ULONG Entry = m_LanguageProfile.GetUlong(SectionName, KeyName, 0xFFFFFFFF);
 
 			if (Entry != 0xFFFFFFFF)
 			{
@@ -1705,7 +1706,7 @@ GetStringDescriptor
 				CHAR SectionName[64]; sprintf(SectionName, "USB\\VID_%04X&PID_%04X.%04X", m_UsbDeviceDescriptor.idVendor, m_UsbDeviceDescriptor.idProduct, LanguageId);
 				CHAR KeyName[8]; sprintf(KeyName, "%d", Index);
 
-				StringDescriptor->bLength = (UCHAR)(DrvProfileGetUnicodeString(SectionName, KeyName, L"", StringDescriptor->bString, (SizeOfStringDescriptor-2)/sizeof(WCHAR), m_LanguageFile) * sizeof(WCHAR));
+				StringDescriptor->bLength = (UCHAR)(m_LanguageProfile.GetUnicodeString(SectionName, KeyName, L"", StringDescriptor->bString, (SizeOfStringDescriptor-2)/sizeof(WCHAR)) * sizeof(WCHAR));
 
 				if (StringDescriptor->bLength)
 				{
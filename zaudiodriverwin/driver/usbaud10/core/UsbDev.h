@@ -46,6 +46,8 @@ extern "C"
 
 #include "usbbusif.h"
 
+#include "Profile.h"
+
 typedef struct
 {
 	UCHAR				EndpointAddress;
@@ -112,7 +114,7 @@ private:
 	PVOID							m_CallbackData;
 
 	// Language support.
-	WCHAR							m_LanguageFile[MAX_PATH];
+	CDrvProfile						m_LanguageProfile;
 	LANGUAGE_SUPPORT				m_LanguageSupport[126];
 	ULONG							m_NumberOfLanguageSupported;
 
@@ -30,6 +30,7 @@
  */
 
 #include "Filter.h"
+#include "Pin.h"
 #include "Factory.h"
 #include "Profile.h"
 
@@ -1594,6 +1595,92 @@ _FindClockRateExtension
 	return ClockRateExtension;
 }
 
+/*****************************************************************************
+ * CAudioFilter::_UpdateTransferDepth()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Applies the transfer depth to the pins that are already streaming in the
+ * given direction. Pins opened later pick it up in _AcquireAudioInterface().
+ */
+VOID 
+CAudioFilter::
+_UpdateTransferDepth
+(
+	IN		BOOLEAN	Capture
+)
+{
+    PAGED_CODE();
+
+	KsFilterAcquireControl(m_KsFilter);
+
+	for (ULONG i=0; i<m_KsFilter->Descriptor->PinDescriptorsCount; i++)
+	{
+		PKSPIN KsPin = KsFilterGetFirstChildPin(m_KsFilter, i);
+
+		while (KsPin)
+		{
+			CAudioPin * Pin = (CAudioPin *)(KsPin->Context);
+
+			if (Pin)
+			{
+				Pin->UpdateTransferDepth(Capture);
+			}
+
+			KsPin = KsPinGetNextSiblingPin(KsPin);
+		}
+	}
+
+	KsFilterReleaseControl(m_KsFilter);
+}
+
+/*****************************************************************************
+ * CAudioFilter::_GetTransferDepth()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Gets the transfer depth of the first pin streaming in the given direction.
+ * @return
+ * Returns STATUS_SUCCESS if such a pin is found, otherwise STATUS_NOT_FOUND.
+ */
+NTSTATUS 
+CAudioFilter::
+_GetTransferDepth
+(
+	IN		BOOLEAN				Capture,
+	OUT		PPIN_TRANSFER_DEPTH	OutTransferDepth
+)
+{
+    PAGED_CODE();
+
+	NTSTATUS ntStatus = STATUS_NOT_FOUND;
+
+	KsFilterAcquireControl(m_KsFilter);
+
+	for (ULONG i=0; (i<m_KsFilter->Descriptor->PinDescriptorsCount) && !NT_SUCCESS(ntStatus); i++)
+	{
+		PKSPIN KsPin = KsFilterGetFirstChildPin(m_KsFilter, i);
+
+		while (KsPin)
+		{
+			CAudioPin * Pin = (CAudioPin *)(KsPin->Context);
+
+			if (Pin)
+			{
+				ntStatus = Pin->GetTransferDepth(Capture, OutTransferDepth);
+
+				if (NT_SUCCESS(ntStatus)) break;
+			}
+
+			KsPin = KsPinGetNextSiblingPin(KsPin);
+		}
+	}
+
+	KsFilterReleaseControl(m_KsFilter);
+
+	return ntStatus;
+}
+
 #pragma code_seg()
 
 /*****************************************************************************
@@ -1847,6 +1934,32 @@ DEFINE_KSPROPERTY_TABLE(CAudioFilter::ControlPropertyTable)
 		NULL,												// Relations
 		NULL,												// SupportHandler
 		0													// SerializedSize
+	),
+	DEFINE_KSPROPERTY_ITEM
+	(
+		KSPROPERTY_DEVICECONTROL_PIN_OUTPUT_TRANSFER_DEPTH,	// Id
+		CAudioFilter::GetDeviceControl,						// GetPropertyHandler or GetSupported
+		sizeof(KSPROPERTY),									// MinProperty
+		sizeof(PIN_TRANSFER_DEPTH),							// MinData
+		CAudioFilter::SetDeviceControl,						// SetPropertyHandler or SetSupported
+		NULL,												// Values
+		0,													// RelationsCount
+		NULL,												// Relations
+		NULL,												// SupportHandler
+		0													// SerializedSize
+	),
+	DEFINE_KSPROPERTY_ITEM
+	(
+		KSPROPERTY_DEVICECONTROL_PIN_INPUT_TRANSFER_DEPTH,		// Id
+		CAudioFilter::GetDeviceControl,						// GetPropertyHandler or GetSupported
+		sizeof(KSPROPERTY),									// MinProperty
+		sizeof(PIN_TRANSFER_DEPTH),							// MinData
+		CAudioFilter::SetDeviceControl,						// SetPropertyHandler or SetSupported
+		NULL,												// Values
+		0,													// RelationsCount
+		NULL,												// Relations
+		NULL,												// SupportHandler
+		0													// SerializedSize
 	)
 };	
 
@@ -2853,6 +2966,32 @@ GetDeviceControl
 			{
 				ntStatus = STATUS_INVALID_PARAMETER;
 			}
+        }
+		break;
+
+		case KSPROPERTY_DEVICECONTROL_PIN_OUTPUT_TRANSFER_DEPTH:
+		case KSPROPERTY_DEVICECONTROL_PIN_INPUT_TRANSFER_DEPTH:
+		{
+			if (ValueSize >= sizeof(PIN_TRANSFER_DEPTH))
+			{
+				BOOLEAN Capture = (Request->Id == KSPROPERTY_DEVICECONTROL_PIN_INPUT_TRANSFER_DEPTH);
+
+				PPIN_TRANSFER_DEPTH TransferDepth = PPIN_TRANSFER_DEPTH(Value);
+
+				// If nothing is streaming, report the settings the next pin will use.
+				if (!NT_SUCCESS(that->_GetTransferDepth(Capture, TransferDepth)))
+				{
+					*TransferDepth = Capture ? that->m_TransferDepth.Input : that->m_TransferDepth.Output;
+				}
+
+				ValueSize = sizeof(PIN_TRANSFER_DEPTH);
+
+				ntStatus = STATUS_SUCCESS;
+			}
+			else
+			{
+				ntStatus = STATUS_INVALID_PARAMETER;
+			}
         }
 		break;
 	}
@@ -2984,6 +3123,32 @@ SetDeviceControl
 			{
 				ntStatus = STATUS_INVALID_PARAMETER;
 			}
+        }
+		break;
+
+		case KSPROPERTY_DEVICECONTROL_PIN_OUTPUT_TRANSFER_DEPTH:
+		case KSPROPERTY_DEVICECONTROL_PIN_INPUT_TRANSFER_DEPTH:
+		{
+			if (ValueSize >= sizeof(PIN_TRANSFER_DEPTH))
+			{
+				BOOLEAN Capture = (Request->Id == KSPROPERTY_DEVICECONTROL_PIN_INPUT_TRANSFER_DEPTH);
+
+				PPIN_TRANSFER_DEPTH TransferDepth = Capture ? &that->m_TransferDepth.Input : &that->m_TransferDepth.Output;
+
+				RtlZeroMemory(TransferDepth, sizeof(PIN_TRANSFER_DEPTH));
+
+				TransferDepth->Adaptive = PPIN_TRANSFER_DEPTH(Value)->Adaptive;
+
+				TransferDepth->LatencyInMs = PPIN_TRANSFER_DEPTH(Value)->LatencyInMs;
+
+				that->_UpdateTransferDepth(Capture);
+
+				ntStatus = STATUS_SUCCESS;
+			}
+			else
+			{
+				ntStatus = STATUS_INVALID_PARAMETER;
+			}
         }
 		break;
 	}
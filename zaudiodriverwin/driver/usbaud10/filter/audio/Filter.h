@@ -85,6 +85,12 @@ private:
 		ULONG				Output;
 	}						m_NumberOfFifoBuffers;
 
+	struct 
+	{
+		PIN_TRANSFER_DEPTH	Input;
+		PIN_TRANSFER_DEPTH	Output;
+	}						m_TransferDepth;
+
 	BOOL					m_SynchronizeStart;
 	
 	ULONG					m_StartFrameNumber;
@@ -93,6 +99,17 @@ private:
 	(	void
 	);
 
+	VOID _UpdateTransferDepth
+	(
+		IN		BOOLEAN	Capture
+	);
+
+	NTSTATUS _GetTransferDepth
+	(
+		IN		BOOLEAN				Capture,
+		OUT		PPIN_TRANSFER_DEPTH	OutTransferDepth
+	);
+
 	ULONG _FindPreferredFormatChannels
 	(
 		IN      ULONG           PinId,
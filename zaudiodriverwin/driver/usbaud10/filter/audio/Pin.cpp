@@ -30,8 +30,6 @@
 
 #include "Pin.h"
 
-//#include "dbgbuffer.h"
-
 /*! @brief Debug module name. */
 #define STR_MODULENAME "AUDIO_PIN: "
 
@@ -577,6 +575,14 @@ CAudioPin::
         SetState(KSSTATE_STOP);
     }
 
+	// The client should have unmapped the ring before closing the pin. If it 
+	// did not, and the pin is closed in another process, the view stays in 
+	// the owner process until it goes away.
+	if (m_SharedRingMdl)
+	{
+		UnmapSharedRing();
+	}
+
 	ExSetTimerResolution(10000, FALSE);
 
 	if (m_AudioClient)
@@ -590,8 +596,6 @@ CAudioPin::
 
         m_AudioFilter->Release();
     }
-
-	//spewdbgbuffer();
 }
 
 /*****************************************************************************
@@ -623,8 +627,6 @@ Init
 {
     PAGED_CODE();
 
-	//resetdbgbuffer();
-
 	_DbgPrintF(DEBUGLVL_VERBOSE,("[CAudioPin::Init]"));
 
     ASSERT(KsPin);
@@ -1103,6 +1105,95 @@ SetAudioPosition
 
 #pragma code_seg("PAGE")
 
+/*****************************************************************************
+ * CAudioPin::UpdateTransferDepth()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Applies the transfer depth set on the filter for this pin's direction to
+ * the audio client.
+ * @param
+ * Capture Direction the transfer depth was set for.
+ * @return
+ * Returns STATUS_SUCCESS if the call was successful, or STATUS_NOT_FOUND
+ * if the pin streams in the other direction or has no audio interface yet.
+ */
+NTSTATUS
+CAudioPin::
+UpdateTransferDepth
+(
+	IN		BOOLEAN	Capture
+)
+{
+    PAGED_CODE();
+
+	NTSTATUS ntStatus = STATUS_NOT_FOUND;
+
+	if ((m_Capture == Capture) && m_AudioClient)
+	{
+		PPIN_TRANSFER_DEPTH TransferDepth = m_Capture ? &m_AudioFilter->m_TransferDepth.Input : &m_AudioFilter->m_TransferDepth.Output;
+
+		if (AUDIO_SUCCESS(m_AudioClient->SetTransferDepth(TransferDepth->Adaptive ? TRUE : FALSE, TransferDepth->LatencyInMs)))
+		{
+			ntStatus = STATUS_SUCCESS;
+		}
+	}
+
+	return ntStatus;
+}
+
+/*****************************************************************************
+ * CAudioPin::GetTransferDepth()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Gets the transfer depth of the data pipe streaming on this pin.
+ * @param
+ * Capture Direction the caller is interested in.
+ * @param
+ * OutTransferDepth Pointer to a location to which the method outputs the
+ * transfer depth.
+ * @return
+ * Returns STATUS_SUCCESS if the call was successful. Otherwise,
+ * the method returns an appropriate error code.
+ */
+NTSTATUS
+CAudioPin::
+GetTransferDepth
+(
+	IN		BOOLEAN				Capture,
+	OUT		PPIN_TRANSFER_DEPTH	OutTransferDepth
+)
+{
+    PAGED_CODE();
+
+	ASSERT(OutTransferDepth);
+
+	NTSTATUS ntStatus = STATUS_NOT_FOUND;
+
+	if ((m_Capture == Capture) && m_AudioClient)
+	{
+		AUDIO_TRANSFER_DEPTH TransferDepth;
+
+		if (AUDIO_SUCCESS(m_AudioClient->GetTransferDepth(&TransferDepth)))
+		{
+			OutTransferDepth->Adaptive = TransferDepth.Adaptive;
+			OutTransferDepth->LatencyInMs = TransferDepth.LatencyInMs;
+			OutTransferDepth->Depth = TransferDepth.Depth;
+			OutTransferDepth->MinimumDepth = TransferDepth.MinimumDepth;
+			OutTransferDepth->MaximumDepth = TransferDepth.MaximumDepth;
+			OutTransferDepth->PacketsPerIrp = TransferDepth.PacketsPerIrp;
+			OutTransferDepth->LateCompletions = TransferDepth.LateCompletions;
+			OutTransferDepth->DepthIncreases = TransferDepth.DepthIncreases;
+			OutTransferDepth->DepthDecreases = TransferDepth.DepthDecreases;
+
+			ntStatus = STATUS_SUCCESS;
+		}
+	}
+
+	return ntStatus;
+}
+
 /*****************************************************************************
  * CAudioPin::GetLatency()
  *****************************************************************************
@@ -1308,7 +1399,7 @@ SetState
 
 	_DbgPrintF(DEBUGLVL_VERBOSE,("[CAudioPin::SetState]"));
 
-	//dbgprintf("[CAudioPin::SetState] - %d\n", NewState);
+	DbgTrace(DBG_TRACE_PIN_STATE, m_Capture, NewState);
 
 	NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
 
@@ -1337,6 +1428,12 @@ SetState
 
                     if (NT_SUCCESS(ntStatus))
                     {
+						// Each stream starts with an empty ring.
+						if (m_SharedRing.Control)
+						{
+							SharedRingReset(&m_SharedRing);
+						}
+
                         m_State = NewState;
                     }
                 }
@@ -1916,6 +2013,14 @@ IoCompletion
 	IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
 )
 {
+	if (m_SharedRing.Control)
+	{
+		// The data goes through the mapped ring, there are no stream pointers.
+		_ProcessSharedRing();
+
+		return;
+	}
+
 	KIRQL OldIrql;
 
 	KeAcquireSpinLock(&m_ProcessingLock, &OldIrql);
@@ -1936,9 +2041,6 @@ IoCompletion
 		{
 			ULONG BytesTransfered = FifoWorkItem->BytesInFifoBuffer;
 
-			//dbgprintf("[IN] -  TS: %p\n", KeQueryInterruptTime());
-			//if (BytesTransfered != 192)
-			//dbgprintf("******************************[IN] -  BytesTransfered: %d\n", BytesTransfered);
 			//
 			// Walk through the clones list and delete clones whose time has come.
 			// The list is guaranteed to be kept in the order they were cloned.
@@ -1954,8 +2056,7 @@ IoCompletion
 				//
 				ULONG BytesRead = m_AudioClient->ReadBuffer(ClonePointer->Offset->Data, ClonePointer->Offset->Remaining);
 
-				//dbgprintf("[IN] -  Remaining: %d\n", ClonePointer->Offset->Remaining);
-				//dbgprintf("[IN] -  BytesRead: %d\n", BytesRead);
+				DbgTrace(DBG_TRACE_PIN_PROCESS, m_Capture, BytesRead, ClonePointer->Offset->Remaining);
 
 				//_DbgPrintF(DEBUGLVL_BLAB,("[CAudioPin::IoCompletion] - BytesRead: %d", BytesRead));
 				
@@ -2029,15 +2130,14 @@ IoCompletion
 			
 			//_DbgPrintF(DEBUGLVL_BLAB,("[CAudioPin::IoCompletion] - BytesTransfered : %d", BytesTransfered));
 
-			//dbgprintf("[OUT] - TS: %p\n", KeQueryInterruptTime());
-			//dbgprintf("[OUT] - BytesTransfered: %d\n", BytesTransfered);
-
 			//
 			// Walk through the clones list and delete clones whose time has come.
 			// The list is guaranteed to be kept in the order they were cloned.
 			//
 			PKSSTREAM_POINTER ClonePointer = KsPinGetFirstCloneStreamPointer(m_KsPin);
 
+			DbgTrace(DBG_TRACE_PIN_PROCESS, m_Capture, BytesTransfered, ClonePointer ? ClonePointer->Offset->Remaining : 0);
+
 			while (BytesTransfered && ClonePointer)
 			{
 				PKSSTREAM_POINTER NextClonePointer = KsStreamPointerGetNextClone(ClonePointer);
@@ -2092,6 +2192,140 @@ IoCompletion
     KsPinAttemptProcessing(m_KsPin, TRUE);
 }
 
+/*****************************************************************************
+ * CAudioPin::_AttachSharedRing()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Attach the pin to the ring mapped at SystemAddress, and empty it. A NULL
+ * SystemAddress detaches the pin from the ring.
+ * @return
+ * None
+ */
+VOID
+CAudioPin::
+_AttachSharedRing
+(
+	IN		PVOID	SystemAddress,
+	IN		ULONG	BufferSize,
+	IN		ULONG	PeriodSize
+)
+{
+	KIRQL OldIrql;
+
+	KeAcquireSpinLock(&m_ProcessingLock, &OldIrql);
+
+	if (SystemAddress)
+	{
+		SharedRingAttach(&m_SharedRing, SystemAddress, BufferSize, PeriodSize);
+
+		SharedRingReset(&m_SharedRing);
+	}
+	else
+	{
+		RtlZeroMemory(&m_SharedRing, sizeof(SHARED_RING));
+	}
+
+	KeReleaseSpinLock(&m_ProcessingLock, OldIrql);
+}
+
+/*****************************************************************************
+ * CAudioPin::_ProcessSharedRing()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Move the data between the mapped ring and the FIFO buffer, and signal the
+ * client if a period boundary was crossed. Called at DPC from IoCompletion(),
+ * and from _Run() to prime the FIFO buffer of a render pin.
+ * @return
+ * None
+ */
+VOID
+CAudioPin::
+_ProcessSharedRing
+(	void
+)
+{
+	KIRQL OldIrql;
+
+	KeAcquireSpinLock(&m_ProcessingLock, &OldIrql);
+
+	ULONG PeriodsCrossed = 0;
+
+	if (m_SharedRing.Control)
+	{
+		PUCHAR Data;
+
+		if (m_Capture)
+		{
+			// The pin is the producer.
+			for (;;)
+			{
+				ULONG Bytes = SharedRingGetWriteRegion(&m_SharedRing, &Data);
+
+				if (!Bytes)
+				{
+					// The client is a full ring behind, the frames stay in the
+					// FIFO buffer until it catches up (or the FIFO overflows).
+					SharedRingOverrun(&m_SharedRing);
+					break;
+				}
+
+				ULONG BytesRead = m_AudioClient->ReadBuffer(Data, Bytes);
+
+				if (!BytesRead)
+				{
+					break;
+				}
+
+				// Keep the queue position going as the stream pointers would.
+				m_AudioClient->QueueBuffer(Data, BytesRead);
+
+				PeriodsCrossed += SharedRingAdvanceWrite(&m_SharedRing, BytesRead);
+
+				if (BytesRead < Bytes)
+				{
+					break;
+				}
+			}
+		}
+		else
+		{
+			// The pin is the consumer.
+			for (;;)
+			{
+				ULONG Bytes = SharedRingGetReadRegion(&m_SharedRing, &Data);
+
+				if (!Bytes)
+				{
+					break;
+				}
+
+				ULONG BytesWritten = m_AudioClient->WriteBuffer(Data, Bytes);
+
+				if (!BytesWritten)
+				{
+					break;
+				}
+
+				PeriodsCrossed += SharedRingAdvanceRead(&m_SharedRing, BytesWritten);
+
+				if (BytesWritten < Bytes)
+				{
+					break;
+				}
+			}
+		}
+	}
+
+	KeReleaseSpinLock(&m_ProcessingLock, OldIrql);
+
+	if (PeriodsCrossed && m_SharedRingEvent)
+	{
+		KeSetEvent(m_SharedRingEvent, EVENT_INCREMENT, FALSE);
+	}
+}
+
 #pragma code_seg("PAGE")
 
 /*****************************************************************************
@@ -2604,6 +2838,11 @@ _AcquireAudioInterface
 		ntStatus = m_AudioClient->SetupBuffer(SampleRate, FormatChannels, SampleSize, m_Capture, m_Capture ? m_AudioFilter->m_NumberOfFifoBuffers.Input : m_AudioFilter->m_NumberOfFifoBuffers.Output);
 	}
 
+	if (NT_SUCCESS(ntStatus))
+	{
+		UpdateTransferDepth(m_Capture);
+	}
+
 	return ntStatus;
 }
 
@@ -2776,6 +3015,13 @@ _Run
 
 	if (m_AudioClient)
 	{
+		// Prime the FIFO buffer with what the client has put in the ring 
+		// while the pin was paused.
+		if (m_SharedRing.Control && !m_Capture)
+		{
+			_ProcessSharedRing();
+		}
+
 		ntStatus = m_AudioClient->Start(m_AudioFilter->m_SynchronizeStart, m_AudioFilter->m_StartFrameNumber);
 	}
     
@@ -2846,6 +3092,262 @@ _Stop
     return ntStatus;
 }
 
+/*****************************************************************************
+ * CAudioPin::MapSharedRing()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Allocate a ring and map it into the calling process.
+ * @details
+ * From then on the data of the pin goes through the ring. The pin must be
+ * in KSSTATE_STOP, and the caller should unmap the ring with UnmapSharedRing()
+ * before closing the pin.
+ *
+ * The ring is backed by a section. The process maps a view of it, which
+ * goes away with the process whatever happens to the pin, so no locked
+ * pages are ever left in a process that exits. The pin uses its own view
+ * in system space, whose pages are locked while the ring is mapped.
+ * @param
+ * Parameters Size of the ring and event to signal.
+ * @param
+ * OutMapping Pointer to the memory that receives the address of the ring in
+ * the calling process.
+ * @return
+ * Returns STATUS_SUCCESS if the call was successful. Otherwise, the method
+ * returns an appropriate error code.
+ */
+NTSTATUS
+CAudioPin::
+MapSharedRing
+(
+	IN		PSHARED_RING_PARAMETERS	Parameters,
+	OUT		PSHARED_RING_MAPPING	OutMapping
+)
+{
+    PAGED_CODE();
+
+    _DbgPrintF(DEBUGLVL_VERBOSE,("[CAudioPin::MapSharedRing]"));
+
+	if ((m_State != KSSTATE_STOP) || m_SharedRingMdl || m_NonPcmFormat)
+	{
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	ULONG FrameSize = m_FormatChannels * m_SampleSize / 8;
+
+	ULONG BufferSize = Parameters->BufferSize;
+
+	ULONG PeriodSize = Parameters->PeriodSize;
+
+	if (!FrameSize || !PeriodSize || (PeriodSize % FrameSize) || 
+		(BufferSize > SHARED_RING_MAXIMUM_SIZE) || (BufferSize % PeriodSize) || ((BufferSize / PeriodSize) < 2))
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	ULONG RingSize = SHARED_RING_CONTROL_SIZE + BufferSize;
+
+	PKEVENT Event = NULL;
+
+	NTSTATUS ntStatus = ObReferenceObjectByHandle(HANDLE(ULONG_PTR(Parameters->NotificationEvent)), EVENT_MODIFY_STATE, *ExEventObjectType, UserMode, (PVOID*)&Event, NULL);
+
+	// Committed pages of a section are zero filled.
+	HANDLE SectionHandle = NULL;
+
+	if (NT_SUCCESS(ntStatus))
+	{
+		OBJECT_ATTRIBUTES ObjectAttributes; InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+		LARGE_INTEGER MaximumSize; MaximumSize.QuadPart = RingSize;
+
+		ntStatus = ZwCreateSection(&SectionHandle, SECTION_ALL_ACCESS, &ObjectAttributes, &MaximumSize, PAGE_READWRITE, SEC_COMMIT, NULL);
+
+		if (!NT_SUCCESS(ntStatus))
+		{
+			SectionHandle = NULL;
+		}
+	}
+
+	PVOID Section = NULL;
+
+	if (NT_SUCCESS(ntStatus))
+	{
+		ntStatus = ObReferenceObjectByHandle(SectionHandle, SECTION_MAP_READ | SECTION_MAP_WRITE, NULL, KernelMode, &Section, NULL);
+	}
+
+	PVOID SystemAddress = NULL;
+
+	if (NT_SUCCESS(ntStatus))
+	{
+		SIZE_T ViewSize = RingSize;
+
+		ntStatus = MmMapViewInSystemSpace(Section, &SystemAddress, &ViewSize);
+
+		if (!NT_SUCCESS(ntStatus))
+		{
+			SystemAddress = NULL;
+		}
+	}
+
+	PMDL Mdl = NULL;
+
+	if (NT_SUCCESS(ntStatus))
+	{
+		// The pin touches the ring at DISPATCH_LEVEL.
+		Mdl = IoAllocateMdl(SystemAddress, RingSize, FALSE, FALSE, NULL);
+
+		if (Mdl)
+		{
+			__try
+			{
+				MmProbeAndLockPages(Mdl, KernelMode, IoWriteAccess);
+			}
+			__except (EXCEPTION_EXECUTE_HANDLER)
+			{
+				IoFreeMdl(Mdl);
+
+				Mdl = NULL;
+			}
+		}
+
+		if (!Mdl)
+		{
+			ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+		}
+	}
+
+	PVOID UserAddress = NULL;
+
+	if (NT_SUCCESS(ntStatus))
+	{
+		SIZE_T ViewSize = 0;
+
+		ntStatus = ZwMapViewOfSection(SectionHandle, NtCurrentProcess(), &UserAddress, 0, 0, NULL, &ViewSize, ViewUnmap, 0, PAGE_READWRITE);
+	}
+
+	if (SectionHandle)
+	{
+		// The views and the pin's reference keep the section.
+		ZwClose(SectionHandle);
+	}
+
+	if (NT_SUCCESS(ntStatus))
+	{
+		m_SharedRingSection = Section;
+
+		m_SharedRingMdl = Mdl;
+
+		m_SharedRingUserAddress = UserAddress;
+
+		m_SharedRingProcess = IoGetCurrentProcess();
+
+		ObReferenceObject(m_SharedRingProcess);
+
+		m_SharedRingEvent = Event;
+
+		_AttachSharedRing(SystemAddress, BufferSize, PeriodSize);
+
+		OutMapping->Address = ULONGLONG(ULONG_PTR(UserAddress));
+		OutMapping->Size = RingSize;
+		OutMapping->Reserved = 0;
+	}
+	else
+	{
+		// Clean up the mess
+		if (Mdl)
+		{
+			MmUnlockPages(Mdl);
+			IoFreeMdl(Mdl);
+		}
+
+		if (SystemAddress)
+		{
+			MmUnmapViewInSystemSpace(SystemAddress);
+		}
+
+		if (Section)
+		{
+			ObDereferenceObject(Section);
+		}
+
+		if (Event)
+		{
+			ObDereferenceObject(Event);
+		}
+	}
+
+	return ntStatus;
+}
+
+/*****************************************************************************
+ * CAudioPin::UnmapSharedRing()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Unmap and free the ring mapped by MapSharedRing().
+ * @details
+ * The pin must be in KSSTATE_STOP. The view in the process that mapped the
+ * ring is only removed if the caller is that process; otherwise it stays
+ * until that process goes away, and the section with it.
+ * @return
+ * Returns STATUS_SUCCESS if the call was successful. Otherwise, the method
+ * returns an appropriate error code.
+ */
+NTSTATUS
+CAudioPin::
+UnmapSharedRing
+(	void
+)
+{
+    PAGED_CODE();
+
+    _DbgPrintF(DEBUGLVL_VERBOSE,("[CAudioPin::UnmapSharedRing]"));
+
+	if (!m_SharedRingMdl)
+	{
+		return STATUS_SUCCESS;
+	}
+
+	if (m_State != KSSTATE_STOP)
+	{
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	PVOID SystemAddress = m_SharedRing.Control;
+
+	_AttachSharedRing(NULL, 0, 0);
+
+	// The user view is in the address space of the process that mapped it.
+	if (IoGetCurrentProcess() == m_SharedRingProcess)
+	{
+		ZwUnmapViewOfSection(NtCurrentProcess(), m_SharedRingUserAddress);
+	}
+
+	MmUnlockPages(m_SharedRingMdl);
+
+	IoFreeMdl(m_SharedRingMdl);
+
+	MmUnmapViewInSystemSpace(SystemAddress);
+
+	ObDereferenceObject(m_SharedRingSection);
+
+	ObDereferenceObject(m_SharedRingEvent);
+
+	ObDereferenceObject(m_SharedRingProcess);
+
+	m_SharedRingSection = NULL;
+
+	m_SharedRingMdl = NULL;
+
+	m_SharedRingUserAddress = NULL;
+
+	m_SharedRingProcess = NULL;
+
+	m_SharedRingEvent = NULL;
+
+	return STATUS_SUCCESS;
+}
+
 #pragma code_seg()
 
 /*****************************************************************************
@@ -3378,6 +3880,43 @@ DEFINE_KSPROPERTY_TABLE(CAudioPin::DrmPropertyTable)
 	)
 };
 
+/*****************************************************************************
+ * CAudioPin::SharedRingPropertyTable[]
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Shared ring property items.
+ */
+DEFINE_KSPROPERTY_TABLE(CAudioPin::SharedRingPropertyTable)
+{
+	DEFINE_KSPROPERTY_ITEM
+	(
+		KSPROPERTY_SHAREDRING_MAP,					// Id
+		CAudioPin::GetSharedRingControl,			// GetPropertyHandler or GetSupported
+		sizeof(SHAREDRING_MAP),						// MinProperty
+		sizeof(SHARED_RING_MAPPING),				// MinData
+		NULL,										// SetPropertyHandler or SetSupported
+		NULL,										// Values
+		0,											// RelationsCount
+		NULL,										// Relations
+		NULL,										// SupportHandler
+		0											// SerializedSize
+	),
+	DEFINE_KSPROPERTY_ITEM
+	(
+		KSPROPERTY_SHAREDRING_UNMAP,				// Id
+		NULL,										// GetPropertyHandler or GetSupported
+		sizeof(KSPROPERTY),							// MinProperty
+		sizeof(ULONG),								// MinData
+		CAudioPin::SetSharedRingControl,			// SetPropertyHandler or SetSupported
+		NULL,										// Values
+		0,											// RelationsCount
+		NULL,										// Relations
+		NULL,										// SupportHandler
+		0											// SerializedSize
+	)
+};
+
 /*****************************************************************************
  * CAudioPin::PropertySetTable[]
  *****************************************************************************
@@ -3402,6 +3941,14 @@ DEFINE_KSPROPERTY_SET_TABLE(CAudioPin::PropertySetTable)
 		CAudioPin::DrmPropertyTable,				// PropertyItem
 		0,											// FastIoCount
 		NULL										// FastIoTable
+	),
+	DEFINE_KSPROPERTY_SET
+	(
+		&KSPROPSETID_SharedRing,					// Set
+		SIZEOF_ARRAY(CAudioPin::SharedRingPropertyTable),// PropertiesCount
+		CAudioPin::SharedRingPropertyTable,			// PropertyItem
+		0,											// FastIoCount
+		NULL										// FastIoTable
 	)
 };
 
@@ -3873,4 +4420,110 @@ SetDrmControl
 	return ntStatus;
 }
 
+/*****************************************************************************
+ * CAudioPin::GetSharedRingControl()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Maps the shared ring into the calling process.
+ * @return
+ * Returns STATUS_SUCCESS if the call was successful. Otherwise,
+ * the method returns an appropriate error code.
+ */
+NTSTATUS
+CAudioPin::
+GetSharedRingControl
+(
+	IN		PIRP			Irp,
+	IN		PSHAREDRING_MAP	Request,
+	IN OUT	PVOID			Value
+)
+{
+    PAGED_CODE();
+
+    ASSERT(Request);
+
+    _DbgPrintF(DEBUGLVL_VERBOSE,("[CAudioPin::GetSharedRingControl]"));
+
+	PIO_STACK_LOCATION IrpStack = IoGetCurrentIrpStackLocation(Irp);
+
+	ULONG ValueSize = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
+
+	CAudioPin * AudioPin = KsGetPinFromIrp(Irp) ? (CAudioPin*)(KsGetPinFromIrp(Irp)->Context) : NULL;
+
+	NTSTATUS ntStatus = STATUS_INVALID_PARAMETER;
+
+	if (Irp->RequestorMode == UserMode)
+	{
+		if (AudioPin)
+		{
+			if (ValueSize >= sizeof(SHARED_RING_MAPPING))
+			{
+				SHARED_RING_PARAMETERS Parameters = Request->Parameters;
+
+				ntStatus = AudioPin->MapSharedRing(&Parameters, PSHARED_RING_MAPPING(Value));
+			}
+			else
+			{
+				ntStatus = STATUS_BUFFER_TOO_SMALL;
+			}
+
+			ValueSize = sizeof(SHARED_RING_MAPPING);
+		}
+	}
+	else
+	{
+		// The ring is mapped into the user mode address space, so fail
+		// requests from kernel mode.
+		ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	Irp->IoStatus.Information = ULONG_PTR(ValueSize);
+
+	return ntStatus;
+}
+
+/*****************************************************************************
+ * CAudioPin::SetSharedRingControl()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Unmaps the shared ring.
+ * @return
+ * Returns STATUS_SUCCESS if the call was successful. Otherwise,
+ * the method returns an appropriate error code.
+ */
+NTSTATUS
+CAudioPin::
+SetSharedRingControl
+(
+	IN		PIRP			Irp,
+	IN		PKSPROPERTY		Request,
+	IN OUT	PVOID			Value
+)
+{
+    PAGED_CODE();
+
+    ASSERT(Request);
+
+    _DbgPrintF(DEBUGLVL_VERBOSE,("[CAudioPin::SetSharedRingControl]"));
+
+	PIO_STACK_LOCATION IrpStack = IoGetCurrentIrpStackLocation(Irp);
+
+	ULONG ValueSize = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
+
+	CAudioPin * AudioPin = KsGetPinFromIrp(Irp) ? (CAudioPin*)(KsGetPinFromIrp(Irp)->Context) : NULL;
+
+	NTSTATUS ntStatus = STATUS_INVALID_PARAMETER;
+
+	if (AudioPin)
+	{
+		ntStatus = AudioPin->UnmapSharedRing();
+	}
+
+	Irp->IoStatus.Information = ULONG_PTR(ValueSize);
+
+	return ntStatus;
+}
+
 #pragma code_seg()
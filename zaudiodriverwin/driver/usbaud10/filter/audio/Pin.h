@@ -87,6 +87,13 @@ private:
 
 	DRMRIGHTS					m_DrmRights;
 
+	SHARED_RING					m_SharedRing;			/*!< @brief Pin's view of the mapped ring, Control is NULL if none. */
+	PVOID						m_SharedRingSection;	/*!< @brief Section object backing the mapped ring. */
+	PMDL						m_SharedRingMdl;		/*!< @brief Locks the pages of the pin's view of the ring. */
+	PVOID						m_SharedRingUserAddress;/*!< @brief Address of the view of the ring in the owner process. */
+	PEPROCESS					m_SharedRingProcess;	/*!< @brief Process that mapped the ring. */
+	PKEVENT						m_SharedRingEvent;		/*!< @brief Event set when a period boundary is crossed. */
+
     /*************************************************************************
      * CAudioPin methods
      *
@@ -184,6 +191,15 @@ private:
 		IN		BOOL					FoundMuteNode,
 		OUT		NTSTATUS *				OutStatus
 	);
+	VOID _AttachSharedRing
+	(
+		IN		PVOID	SystemAddress,
+		IN		ULONG	BufferSize,
+		IN		ULONG	PeriodSize
+	);
+	VOID _ProcessSharedRing
+	(	void
+	);
 
 public:
     /*************************************************************************
@@ -227,6 +243,17 @@ public:
 		OUT     KSAUDIO_POSITION	Position
 	);
 
+	NTSTATUS UpdateTransferDepth
+	(
+		IN		BOOLEAN	Capture
+	);
+
+	NTSTATUS GetTransferDepth
+	(
+		IN		BOOLEAN				Capture,
+		OUT		PPIN_TRANSFER_DEPTH	OutTransferDepth
+	);
+
 	NTSTATUS GetLatency
 	(
 	    OUT     PKSTIME	OutLatency
@@ -252,6 +279,16 @@ public:
 		IN		PAUDIO_FIFO_WORK_ITEM	FifoWorkItem
 	);
 
+	NTSTATUS MapSharedRing
+	(
+		IN		PSHARED_RING_PARAMETERS	Parameters,
+		OUT		PSHARED_RING_MAPPING	OutMapping
+	);
+
+	NTSTATUS UnmapSharedRing
+	(	void
+	);
+
 	NTSTATUS QueryControlSupport
 	(
 		IN		UCHAR	ControlSelector
@@ -366,6 +403,9 @@ public:
 	static const
 	KSPROPERTY_ITEM DrmPropertyTable[];
 
+	static const
+	KSPROPERTY_ITEM SharedRingPropertyTable[];
+
 	static const
 	KSPROPERTY_SET PropertySetTable[];
 
@@ -435,6 +475,22 @@ public:
 		IN		PKSP_DRMAUDIOSTREAM_CONTENTID	Request,
 		IN OUT	PVOID							Value
 	);
+
+	static
+	NTSTATUS GetSharedRingControl
+	(
+		IN		PIRP			Irp,
+		IN		PSHAREDRING_MAP	Request,
+		IN OUT	PVOID			Value
+	);
+
+	static
+	NTSTATUS SetSharedRingControl
+	(
+		IN		PIRP			Irp,
+		IN		PKSPROPERTY		Request,
+		IN OUT	PVOID			Value
+	);
 };
 
 #endif // _AUDIO_PIN_PRIVATE_H_
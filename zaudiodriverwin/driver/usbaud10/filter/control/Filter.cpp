@@ -692,6 +692,12 @@ GetPropertyHandler
 			}
 		}
 		break;
+
+		case KSPROPERTY_DEVICECONTROL_TRACE:
+		{
+			ntStatus = DbgTraceDrain(Value, ValueSize, &ValueSize);
+		}
+		break;
     }
 
 	Irp->IoStatus.Information = ULONG_PTR(ValueSize);
@@ -781,5 +787,170 @@ SetPropertyHandler
     return ntStatus;
 }
 
+/*****************************************************************************
+ * CControlFilter::GetPipeStatisticsHandler()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Pipe statistics property handler.
+ * @details
+ * This routine gets called whenever this filter gets a property request
+ * with KSPROPSETID_PipeStatistics. It returns the transfer histograms of
+ * the data or synch pipe of the specified interface.
+ * @return
+ * Returns STATUS_SUCCESS if the call was successful. Otherwise,
+ * the method returns an appropriate error code.
+ */
+NTSTATUS 
+CControlFilter::
+GetPipeStatisticsHandler
+(
+	IN		PIRP			Irp,
+	IN		PKSPROPERTY		Request,
+	IN OUT	PVOID			Value
+)
+{
+    PAGED_CODE();
+
+    ASSERT(Request);
+
+    //_DbgPrintF(DEBUGLVL_VERBOSE,("[CControlFilter::GetPipeStatisticsHandler]"));
+
+	PIO_STACK_LOCATION IrpStack = IoGetCurrentIrpStackLocation(Irp);
+
+	ULONG ValueSize = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
+
+	PVOID Instance = PVOID(Request+1);
+
+	ULONG InstanceSize = IrpStack->Parameters.DeviceIoControl.InputBufferLength - sizeof(KSPROPERTY);
+
+	CControlFilter * that = (CControlFilter*)(KsGetFilterFromIrp(Irp)->Context);
+
+    NTSTATUS ntStatus = STATUS_INVALID_PARAMETER;
+
+    switch (Request->Id)
+	{
+		case KSPROPERTY_PIPESTATISTICS_HISTOGRAMS:
+		{
+        	// validate and get the output parameter
+			if (ValueSize >= sizeof(PIPE_STATISTICS))
+			{
+				if (InstanceSize >= sizeof(PIPE_STATISTICS_PARAMETERS))
+				{
+					PPIPE_STATISTICS_PARAMETERS Parameters = PPIPE_STATISTICS_PARAMETERS(Instance);
+
+					AUDIO_PIPE_HISTOGRAMS Histograms;
+
+					PAUDIO_DEVICE AudioDevice = that->m_KsAdapter->GetAudioDevice();
+
+					if (AudioDevice && AUDIO_SUCCESS(AudioDevice->GetPipeHistograms(Parameters->InterfaceNumber, Parameters->SynchPipe ? TRUE : FALSE, &Histograms)))
+					{
+						C_ASSERT(PIPE_STATISTICS_BUCKETS == AUDIO_HISTOGRAM_BUCKETS);
+
+						PPIPE_STATISTICS Statistics = PPIPE_STATISTICS(Value);
+
+						Statistics->InterfaceNumber = Histograms.InterfaceNumber;
+						Statistics->AlternateSetting = Histograms.AlternateSetting;
+						Statistics->EndpointAddress = Histograms.EndpointAddress;
+
+						RtlCopyMemory(Statistics->CompletionInterval, Histograms.CompletionInterval, sizeof(Statistics->CompletionInterval));
+						RtlCopyMemory(Statistics->ResubmitLatency, Histograms.ResubmitLatency, sizeof(Statistics->ResubmitLatency));
+						RtlCopyMemory(Statistics->FifoFill, Histograms.FifoFill, sizeof(Statistics->FifoFill));
+						RtlCopyMemory(Statistics->PacketStatus, Histograms.PacketStatus, sizeof(Statistics->PacketStatus));
+
+						ntStatus = STATUS_SUCCESS;
+					}
+					else
+					{
+						ntStatus = STATUS_NOT_FOUND;
+					}
+				}
+				else
+				{
+					ntStatus = STATUS_INVALID_PARAMETER;
+				}
+			}
+			else
+			{
+				ntStatus = STATUS_BUFFER_TOO_SMALL;
+			}
+
+			ValueSize = sizeof(PIPE_STATISTICS);
+		}
+		break;
+    }
+
+	Irp->IoStatus.Information = ULONG_PTR(ValueSize);
+
+    return ntStatus;
+}
+
+/*****************************************************************************
+ * CControlFilter::SetPipeStatisticsHandler()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Pipe statistics property handler.
+ * @details
+ * This routine gets called whenever this filter gets a property request
+ * with KSPROPSETID_PipeStatistics. It clears the transfer histograms of
+ * the data or synch pipe of the specified interface.
+ * @return
+ * Returns STATUS_SUCCESS if the call was successful. Otherwise,
+ * the method returns an appropriate error code.
+ */
+NTSTATUS 
+CControlFilter::
+SetPipeStatisticsHandler
+(
+	IN		PIRP			Irp,
+	IN		PKSPROPERTY		Request,
+	IN OUT	PVOID			Value
+)
+{
+    PAGED_CODE();
+
+    //_DbgPrintF(DEBUGLVL_VERBOSE,("[CControlFilter::SetPipeStatisticsHandler]"));
+
+	PIO_STACK_LOCATION IrpStack = IoGetCurrentIrpStackLocation(Irp);
+
+	PVOID Instance = PVOID(Request+1);
+
+	ULONG InstanceSize = IrpStack->Parameters.DeviceIoControl.InputBufferLength - sizeof(KSPROPERTY);
+
+	CControlFilter * that = (CControlFilter*)(KsGetFilterFromIrp(Irp)->Context);
+
+    NTSTATUS ntStatus = STATUS_INVALID_PARAMETER;
+
+    switch (Request->Id)
+	{
+		case KSPROPERTY_PIPESTATISTICS_HISTOGRAMS:
+		{
+			if (InstanceSize >= sizeof(PIPE_STATISTICS_PARAMETERS))
+			{
+				PPIPE_STATISTICS_PARAMETERS Parameters = PPIPE_STATISTICS_PARAMETERS(Instance);
+
+				PAUDIO_DEVICE AudioDevice = that->m_KsAdapter->GetAudioDevice();
+
+				if (AudioDevice && AUDIO_SUCCESS(AudioDevice->ResetPipeHistograms(Parameters->InterfaceNumber, Parameters->SynchPipe ? TRUE : FALSE)))
+				{
+					ntStatus = STATUS_SUCCESS;
+				}
+				else
+				{
+					ntStatus = STATUS_NOT_FOUND;
+				}
+			}
+			else
+			{
+				ntStatus = STATUS_INVALID_PARAMETER;
+			}
+		}
+		break;
+	}
+
+    return ntStatus;
+}
+
 #pragma code_seg()
 
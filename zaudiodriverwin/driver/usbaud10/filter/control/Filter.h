@@ -121,6 +121,22 @@ public:
 		IN		PKSPROPERTY		Request,
 		IN OUT	PVOID			Value
 	);
+
+	static
+	NTSTATUS GetPipeStatisticsHandler
+	(
+		IN		PIRP			Irp,
+		IN		PKSPROPERTY		Request,
+		IN OUT	PVOID			Value
+	);
+
+	static
+	NTSTATUS SetPipeStatisticsHandler
+	(
+		IN		PIRP			Irp,
+		IN		PKSPROPERTY		Request,
+		IN OUT	PVOID			Value
+	);
 };
 
 #endif  //  _CONTROL_FILTER_PRIVATE_H_
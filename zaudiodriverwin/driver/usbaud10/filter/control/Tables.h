@@ -172,9 +172,46 @@ DEFINE_KSPROPERTY_TABLE(KsFilterPropertyTable)
 		NULL,												// Relations
 		NULL,												// SupportHandler
 		0													// SerializedSize
+	),
+	DEFINE_KSPROPERTY_ITEM
+	(
+		KSPROPERTY_DEVICECONTROL_TRACE,						// Id
+		CControlFilter::GetPropertyHandler,					// GetPropertyHandler or GetSupported
+		sizeof(KSPROPERTY),									// MinProperty
+		sizeof(DBG_TRACE_HEADER),							// MinData
+		NULL,												// SetPropertyHandler or SetSupported
+		NULL,												// Values
+		0,													// RelationsCount
+		NULL,												// Relations
+		NULL,												// SupportHandler
+		0													// SerializedSize
 	)
 };	
 
+/*****************************************************************************
+ * KsFilterPipeStatisticsPropertyTable
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Filter pipe statistics properties.
+ */
+DEFINE_KSPROPERTY_TABLE(KsFilterPipeStatisticsPropertyTable)
+{
+	DEFINE_KSPROPERTY_ITEM
+	(
+		KSPROPERTY_PIPESTATISTICS_HISTOGRAMS,				// Id
+		CControlFilter::GetPipeStatisticsHandler,			// GetPropertyHandler or GetSupported
+		sizeof(PIPESTATISTICS_HISTOGRAMS),					// MinProperty
+		0,													// MinData
+		CControlFilter::SetPipeStatisticsHandler,			// SetPropertyHandler or SetSupported
+		NULL,												// Values
+		0,													// RelationsCount
+		NULL,												// Relations
+		NULL,												// SupportHandler
+		0													// SerializedSize
+	)
+};
+
 /*****************************************************************************
  * KsFilterPropertySetTable
  *****************************************************************************
@@ -191,6 +228,14 @@ DEFINE_KSPROPERTY_SET_TABLE(KsFilterPropertySetTable)
 		KsFilterPropertyTable,					// PropertyItem
 		0,										// FastIoCount
 		NULL									// FastIoTable
+	),
+	DEFINE_KSPROPERTY_SET
+	(
+		&KSPROPSETID_PipeStatistics,						// Set
+		SIZEOF_ARRAY(KsFilterPipeStatisticsPropertyTable),	// PropertiesCount
+		KsFilterPipeStatisticsPropertyTable,				// PropertyItem
+		0,													// FastIoCount
+		NULL												// FastIoTable
 	)
 };
 
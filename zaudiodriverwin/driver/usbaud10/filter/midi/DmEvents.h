@@ -0,0 +1,124 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd. 
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public 
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       DmEvents.h
+ * @brief      DirectMusic capture event packaging of the MIDI pin.
+ *//*
+ *****************************************************************************
+ */
+#ifndef _MIDI_DMEVENTS_H_
+#define _MIDI_DMEVENTS_H_
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Largest SysEx segment in a DirectMusic capture event. */
+#define DMUS_SYSEX_SEGMENT_SIZE		44
+
+/*****************************************************************************
+ * PackageDirectMusicEvents()
+ *****************************************************************************
+ * @brief
+ * Fills a capture frame with the events queued up in a MIDI client.
+ * @details
+ * Each event gets its own DMUS_EVENTHEADER, QWORD aligned, with rtDelta
+ * the offset of the event from the first one in the frame. Nothing waits
+ * for more data: the frame is done as soon as the client has nothing more,
+ * or the next event might not fit.
+ *
+ * SysEx is read in DMUS_SYSEX_SEGMENT_SIZE segments (see
+ * http://earthvegaconnection.com/evc/products/miditest/developers.html),
+ * each in an event of its own, so the DirectMusic DLL does not repackage
+ * them. The segment size is the same for every read, as the client cuts the
+ * SysEx message in pieces of the buffer length it is given.
+ *
+ * MidiClient is anything with the ReadBuffer() of CMidiClient.
+ * @param
+ * MidiClient Client to read the events from.
+ * @param
+ * Data Frame data.
+ * @param
+ * DataLength Length in bytes of the frame data.
+ * @param
+ * TimeStampFrequency Frequency of the client time stamp counter.
+ * @param
+ * OutTimeStampCounter Time stamp of the first event.
+ * @return
+ * Returns the number of bytes used in the frame, 0 if no event is queued.
+ */
+template <class MidiClientType>
+static
+ULONG
+PackageDirectMusicEvents
+(
+	IN		MidiClientType *	MidiClient,
+	IN		PUCHAR				Data,
+	IN		ULONG				DataLength,
+	IN		LONGLONG			TimeStampFrequency,
+	OUT		LONGLONG *			OutTimeStampCounter
+)
+{
+	ULONG SegmentSize = DMUS_SYSEX_SEGMENT_SIZE;
+
+	// Frames that cannot take a whole segment get the largest that fits.
+	while (DMUS_EVENT_SIZE(SegmentSize) > DataLength)
+	{
+		SegmentSize -= sizeof(ULONG);
+	}
+
+	ULONG BytesUsed = 0;
+
+	while ((BytesUsed + DMUS_EVENT_SIZE(SegmentSize)) <= DataLength)
+	{
+		LPDMUS_EVENTHEADER EventHdr = LPDMUS_EVENTHEADER(Data + BytesUsed);
+
+		LONGLONG TimeStampCounter;
+
+		ULONG Status = 0;
+
+		//
+		// Read the buffer.
+		//
+		ULONG BytesRead = MidiClient->ReadBuffer(PUCHAR(EventHdr + 1), SegmentSize, &TimeStampCounter, &Status);
+
+		if (!BytesRead) break;
+
+		if (!BytesUsed)
+		{
+			*OutTimeStampCounter = TimeStampCounter;
+		}
+
+		EventHdr->cbEvent = BytesRead;
+
+		EventHdr->dwChannelGroup = 0;
+
+		EventHdr->rtDelta = LONGLONG(DOUBLE(TimeStampCounter - *OutTimeStampCounter) * 10000000 / DOUBLE(TimeStampFrequency)); // 100ns
+
+		EventHdr->dwFlags = (Status & MESSAGE_STATUS_STRUCTURED) ? DMUS_EVENT_STRUCTURED : 0;
+
+		BytesUsed += DMUS_EVENT_SIZE(BytesRead);
+	}
+
+	return BytesUsed;
+}
+
+#endif // _MIDI_DMEVENTS_H_
@@ -441,6 +441,11 @@ CMidiPin::
 		m_MidiDevice->Close(m_MidiClient);
 	}
 
+	if (m_MidiFilter && !m_Capture)
+	{
+		ExSetTimerResolution(10000, FALSE);
+	}
+
 	if (m_MidiFilter)
     {
 		m_MidiFilter->m_KsAdapter->DereferenceDevice();
@@ -510,6 +515,14 @@ Init
 
 		if (NT_SUCCESS(ntStatus))
 		{
+			ULONG MidiBufferSize = MIDI_CLIENT_DEFAULT_BUFFER_SIZE; // In packets.
+
+			// HKR,Settings,MidiBufferSize,0x00010001,1024
+			if (NT_SUCCESS(m_MidiFilter->m_KsAdapter->RegistryReadFromDriverSubKey(L"Settings", L"MidiBufferSize", &MidiBufferSize, sizeof(ULONG), NULL, NULL)))
+			{
+				m_MidiClient->SetBufferSize(MidiBufferSize);
+			}
+
 			if (!m_Capture)
 			{
 				ULONG SysExTimeOutPeriod = 1000; // Default 1s time out.
@@ -531,6 +544,13 @@ Init
 		ntStatus = SetFormat(KsPin->ConnectionFormat);
 	}
 
+	if (NT_SUCCESS(ntStatus) && !m_Capture)
+	{
+		// The events are held until they are due, and the cable's timer fires
+		// on the clock tick after that.
+		ExSetTimerResolution(10000, TRUE); // 1ms
+	}
+
     if (!NT_SUCCESS(ntStatus))
     {
         // Clean up the mess
@@ -1165,6 +1185,13 @@ _Run
 	if (m_MidiClient)
 	{
 		ntStatus = m_MidiClient->Start(&m_StartTimeStampCounter, &m_TimeStampFrequency);
+
+		if (NT_SUCCESS(ntStatus))
+		{
+			m_RenderTimeMs = 0;
+
+			_DbgPrintF(DEBUGLVL_VERBOSE,("[CMidiPin::_Run] - Pin %d, client footprint: %d bytes", m_PinId, m_MidiClient->GetMemoryFootprint()));
+		}
 	}
     
 	return ntStatus;
@@ -1431,6 +1458,9 @@ _ProcessKsMusicFormat
 						KsStreamPointerAdvanceOffsets(ClonePointer, sizeof(KSMUSICFORMAT), 0, FALSE);
 
 						*(PULONG(ClonePointer->Context)) = Format->ByteCount;
+
+						// The time delta is from the previous event, or from the start for the first one.
+						m_RenderTimeMs += Format->TimeDeltaMs;
 					}
 					else
 					{
@@ -1465,7 +1495,7 @@ _ProcessKsMusicFormat
 
 			ULONG BytesToWrite = *BytesAvailable;
 
-			LONGLONG TimeStampCounter = m_StartTimeStampCounter + LONGLONG(DOUBLE(Format->TimeDeltaMs) / 1000 * DOUBLE(m_TimeStampFrequency));
+			LONGLONG TimeStampCounter = m_StartTimeStampCounter + LONGLONG(DOUBLE(m_RenderTimeMs) / 1000 * DOUBLE(m_TimeStampFrequency));
 
 			//
 			// Write to the hardware buffer.  I would use ClonePointer->Offset.*, 
@@ -1601,64 +1631,26 @@ _ProcessDirectMusicFormat
 	{
 		while (NT_SUCCESS(ntStatus) && LeadingEdge) 
 		{
-			LPDMUS_EVENTHEADER EventHdr = (LPDMUS_EVENTHEADER)(LeadingEdge->StreamHeader->Data);
-
 			//
 			// Validate the data header.
 			//
-			if (LeadingEdge->Offset->Count <= sizeof(DMUS_EVENTHEADER))
+			if (LeadingEdge->Offset->Count < DMUS_EVENT_SIZE(sizeof(ULONG)))
 			{
 				ntStatus = KsStreamPointerAdvanceOffsets(LeadingEdge, 0, 0, TRUE);
 				continue;
 			}
 
-			PUCHAR Buffer = LeadingEdge->Offset->Data + sizeof(DMUS_EVENTHEADER);
-
-			ULONG BufferLength = LeadingEdge->Offset->Count - sizeof(DMUS_EVENTHEADER);
-
 			LONGLONG TimeStampCounter;
 
-			ULONG Status = 0;
-
 			//
-			// Read the buffer.
+			// Fill the frame with the events that are queued up.
 			//
-			ULONG BytesRead = m_MidiClient->ReadBuffer(Buffer, BufferLength, &TimeStampCounter,	&Status);
+			ULONG BytesUsed = _PackageDirectMusicEvents(LeadingEdge->Offset->Data, LeadingEdge->Offset->Count, &TimeStampCounter);
 
-			_DbgPrintF(DEBUGLVL_BLAB,("[CMidiPin::Process] - BytesRead: %d", BytesRead));
+			_DbgPrintF(DEBUGLVL_BLAB,("[CMidiPin::Process] - BytesUsed: %d", BytesUsed));
 			
-			if (BytesRead)
+			if (BytesUsed)
 			{
-				// You might wonder why there is a delay here for non-structured messages (ie SysEx).
-				// Normally, the SysEx messages is packaged in 44-bytes packet (why 44-bytes ? Go read
-				// the documentation at http://earthvegaconnection.com/evc/products/miditest/developers.html).
-				// This is to avoid the DirectMusic DLL repackaging the MIDI data as the time between 2 
-				// 44-bytes packets is usually sufficient enough for the packets to be delivered to application.
-				// If the time difference is insuffficient and 2 packets arrived in close proximity to one
-				// another, DirectMusic DLL will try to repackage them, leading to swapped packet order or 
-				// corrupted MIDI packets.
-				// What the code below do is to check if <= 3 bytes are received, it add an explicit delay of
-				// 1ms so that the current packet will not arrived together with the previous packet.
-				if ((Status & MESSAGE_STATUS_STRUCTURED) == 0)
-				{
-					if ((BufferLength > 3) && (BytesRead <= 3))
-					{
-						KEVENT Event; KeInitializeEvent(&Event, NotificationEvent, FALSE);
-
-						LARGE_INTEGER TimeOut; TimeOut.QuadPart = -1*10000; // 1ms
-						
-						KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, &TimeOut);
-					}
-				}
-
-				EventHdr->cbEvent = BytesRead;
-
-				EventHdr->dwChannelGroup = 0;
-
-				EventHdr->rtDelta = 0;
-				
-				EventHdr->dwFlags = (Status & MESSAGE_STATUS_STRUCTURED) ? DMUS_EVENT_STRUCTURED : 0;
-
 				LeadingEdge->StreamHeader->PresentationTime.Time = LONGLONG(DOUBLE(TimeStampCounter) * 10000000 / DOUBLE(m_TimeStampFrequency)); // 100ns;
 				LeadingEdge->StreamHeader->PresentationTime.Numerator = 1;
 				LeadingEdge->StreamHeader->PresentationTime.Denominator = 1;
@@ -1669,7 +1661,7 @@ _ProcessDirectMusicFormat
 				// ntStatus will be STATUS_DEVICE_NOT_READY.  Otherwise, the leading 
 				// edge will point to a new frame.
 				//
-				KsStreamPointerAdvanceOffsetsAndUnlock(LeadingEdge, 0, DMUS_EVENT_SIZE(EventHdr->cbEvent), TRUE);
+				KsStreamPointerAdvanceOffsetsAndUnlock(LeadingEdge, 0, BytesUsed, TRUE);
 
 				LeadingEdge = KsPinGetLeadingEdgeStreamPointer(m_KsPin, KSSTREAM_POINTER_STATE_LOCKED);
 			}
@@ -1765,7 +1757,14 @@ _ProcessDirectMusicFormat
 
 			ULONG BytesToWrite = *BytesAvailable;
 
-			LONGLONG TimeStampCounter = LeadingEdge->StreamHeader->PresentationTime.Time + LONGLONG(DOUBLE(EventHdr->rtDelta) / 10000000 * DOUBLE(m_TimeStampFrequency));
+			LONGLONG TimeStampCounter = 0; // As soon as possible.
+
+			if (LeadingEdge->StreamHeader->OptionsFlags & KSSTREAM_HEADER_OPTIONSF_TIMEVALID)
+			{
+				// The presentation time is on the master clock (CMidiFilter::GetSynthMasterClock()),
+				// in 100ns, and the event is rtDelta after it.
+				TimeStampCounter = LONGLONG(DOUBLE(LeadingEdge->StreamHeader->PresentationTime.Time + EventHdr->rtDelta) * DOUBLE(m_TimeStampFrequency) / 10000000);
+			}
 
 			//
 			// Write to the hardware buffer.  I would use ClonePointer->Offset.*, 
@@ -1877,6 +1876,34 @@ _ProcessDirectMusicFormat
 
 	return ntStatus;
 }
+/*****************************************************************************
+ * CMidiPin::_PackageDirectMusicEvents()
+ *****************************************************************************
+ *//*!
+ * @brief
+ * Fills a capture frame with the events queued up in the MIDI client.
+ * @details
+ * See ::PackageDirectMusicEvents().
+ * @param
+ * Data Frame data.
+ * @param
+ * DataLength Length in bytes of the frame data.
+ * @param
+ * OutTimeStampCounter Time stamp of the first event.
+ * @return
+ * Returns the number of bytes used in the frame, 0 if no event is queued.
+ */
+ULONG
+CMidiPin::
+_PackageDirectMusicEvents
+(
+	IN		PUCHAR		Data,
+	IN		ULONG		DataLength,
+	OUT		LONGLONG *	OutTimeStampCounter
+)
+{
+	return PackageDirectMusicEvents(m_MidiClient, Data, DataLength, m_TimeStampFrequency, OutTimeStampCounter);
+}
 #endif // ENABLE_DIRECTMUSIC_SUPPORT
 
 #pragma code_seg()
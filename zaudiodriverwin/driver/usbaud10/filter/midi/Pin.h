@@ -33,11 +33,12 @@
 
 #include "Filter.h"
 
+#ifdef ENABLE_DIRECTMUSIC_SUPPORT
+#include "DmEvents.h"
+#endif // ENABLE_DIRECTMUSIC_SUPPORT
+
 using namespace MIDI_TOPOLOGY;
 
-/*****************************************************************************
- * Defines
- */
 /*****************************************************************************
  * Classes
  */
@@ -77,6 +78,8 @@ private:
 
 	LONGLONG					m_StartTimeStampCounter;
 
+	ULONGLONG					m_RenderTimeMs;			/*!< @brief Sum of the KSMUSICFORMAT time deltas rendered since the pin started. */
+
 	LONGLONG					m_TimeStampFrequency;
 
 	PIKSREFERENCECLOCK			m_ReferenceClock;
@@ -122,6 +125,12 @@ private:
 	NTSTATUS _ProcessDirectMusicFormat
 	(	void
 	);
+	ULONG _PackageDirectMusicEvents
+	(
+		IN		PUCHAR		Data,
+		IN		ULONG		DataLength,
+		OUT		LONGLONG *	OutTimeStampCounter
+	);
 	#endif // ENABLE_DIRECTMUSIC_SUPPORT
 
 public:
@@ -33,6 +33,7 @@
 
 #include "KsAudio.h"
 #include "CList.h"
+#include "dbgtrace.h"
 
 #ifndef DEBUG_LEVEL
 /*! @brief Debug level ERROR. */
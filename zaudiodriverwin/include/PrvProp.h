@@ -35,6 +35,8 @@
 #ifndef _PRIVATE_PROPERTY_H_
 #define _PRIVATE_PROPERTY_H_
 
+#include "SharedRing.h"
+
 // {4B8F9AFB-EE9F-4890-94EC-636414BD3768}
 #define STATIC_KSCATEGORY_AUDIOCONTROL\
 	0x4b8f9afb, 0xee9f, 0x4890, 0x94, 0xec, 0x63, 0x64, 0x14, 0xbd, 0x37, 0x68
@@ -77,10 +79,15 @@ typedef enum
 	// Firmware upgrade support mechanism.
 	KSPROPERTY_DEVICECONTROL_FIRMWARE_UPGRADE_LOCK = 0x20,	// SET only
 	KSPROPERTY_DEVICECONTROL_FIRMWARE_UPGRADE_UNLOCK,		// SET only
+	// Debug trace. Returns the records recorded since the last call, in the
+	// format defined in driver/include/dbgtrace.h.
+	KSPROPERTY_DEVICECONTROL_TRACE = 0x30,					// GET only
 	// Pin properties...
 	KSPROPERTY_DEVICECONTROL_PIN_OUTPUT_CFIFO_BUFFERS = 0x10000,	// SET only
 	KSPROPERTY_DEVICECONTROL_PIN_INPUT_CFIFO_BUFFERS,				// SET only
-	KSPROPERTY_DEVICECONTROL_PIN_SYNCHRONIZE_START_FRAME			// SET only
+	KSPROPERTY_DEVICECONTROL_PIN_SYNCHRONIZE_START_FRAME,			// SET only
+	KSPROPERTY_DEVICECONTROL_PIN_OUTPUT_TRANSFER_DEPTH,			// GET & SET
+	KSPROPERTY_DEVICECONTROL_PIN_INPUT_TRANSFER_DEPTH				// GET & SET
 } KSPROPERTY_DEVICECONTROL;
 
 // Defines the structures used in the properties above.
@@ -179,5 +186,112 @@ typedef struct
 	CUSTOM_COMMAND_PARAMETERS	Parameters;
 } DEVICECONTROL_CUSTOM_COMMAND, *PDEVICECONTROL_CUSTOM_COMMAND;
 
+typedef struct
+{
+	ULONG	Adaptive;			// GET & SET: Non-zero to adjust the depth on late completions.
+	ULONG	LatencyInMs;		// GET & SET: Initial depth in ms, or 0 to use all the IRPs.
+	ULONG	Depth;				// GET only: Number of IRPs currently in flight.
+	ULONG	MinimumDepth;		// GET only
+	ULONG	MaximumDepth;		// GET only
+	ULONG	PacketsPerIrp;		// GET only
+	ULONG	LateCompletions;	// GET only
+	ULONG	DepthIncreases;		// GET only
+	ULONG	DepthDecreases;		// GET only
+} PIN_TRANSFER_DEPTH, *PPIN_TRANSFER_DEPTH;
+
+/*****************************************************************************
+ * Private property set {E03CA841-7DC0-49FC-8FE1-C09F0FFA7CBB}
+ */
+/*! @brief KSPROPSETID_PipeStatistics GUID. */
+DEFINE_GUID(KSPROPSETID_PipeStatistics, 0xe03ca841, 0x7dc0, 0x49fc, 0x8f, 0xe1, 0xc0, 0x9f, 0xf, 0xfa, 0x7c, 0xbb);
+
+/*!
+ * @brief
+ * Isochronous pipe statistics property set.
+ */
+typedef enum
+{
+	KSPROPERTY_PIPESTATISTICS_HISTOGRAMS = 0	// GET & SET (SET clears the histograms)
+} KSPROPERTY_PIPESTATISTICS;
+
+// Number of buckets in each histogram. Bucket 0 counts the value 0, bucket n
+// counts the values in [2^(n-1), 2^n), and the last bucket everything above.
+#define PIPE_STATISTICS_BUCKETS			32
+
+// Buckets of PIPE_STATISTICS.PacketStatus.
+#define PIPE_PACKET_STATUS_SUCCESS		0	// Transferred.
+#define PIPE_PACKET_STATUS_NOT_ACCESSED	1	// Scheduled too late for the host controller.
+#define PIPE_PACKET_STATUS_OVERRUN		2	// Data or buffer overrun/underrun, or babble.
+#define PIPE_PACKET_STATUS_BUS_ERROR	3	// CRC, bit stuffing or transaction error, or no response.
+#define PIPE_PACKET_STATUS_IRP_FAILED	4	// The whole IRP failed.
+#define PIPE_PACKET_STATUS_OTHER		5	// Any other error.
+
+// Defines the structures used in the properties above.
+typedef struct
+{
+	UCHAR	InterfaceNumber;
+	UCHAR	SynchPipe;		// Non-zero for the synch (feedback) pipe of the interface, zero for its data pipe.
+} PIPE_STATISTICS_PARAMETERS, *PPIPE_STATISTICS_PARAMETERS;
+
+typedef struct
+{
+	KSPROPERTY					Property;
+	PIPE_STATISTICS_PARAMETERS	Parameters;
+} PIPESTATISTICS_HISTOGRAMS, *PPIPESTATISTICS_HISTOGRAMS;
+
+typedef struct
+{
+	ULONG	InterfaceNumber;
+	ULONG	AlternateSetting;
+	ULONG	EndpointAddress;
+	ULONG	CompletionInterval[PIPE_STATISTICS_BUCKETS];	// Microseconds between two consecutive IRP completions.
+	ULONG	ResubmitLatency[PIPE_STATISTICS_BUCKETS];		// Microseconds from the completion of an IRP to its resubmission.
+	ULONG	FifoFill[PIPE_STATISTICS_BUCKETS];				// Frames in the client FIFO when an IRP is submitted (data pipes only).
+	ULONG	PacketStatus[PIPE_STATISTICS_BUCKETS];			// Packets completed in each PIPE_PACKET_STATUS_XXX class.
+} PIPE_STATISTICS, *PPIPE_STATISTICS;
+
+/*****************************************************************************
+ * Private property set {CF826478-B73E-45F6-A943-ECA994B60C79}
+ */
+/*! @brief KSPROPSETID_SharedRing GUID. */
+DEFINE_GUID(KSPROPSETID_SharedRing, 0xcf826478, 0xb73e, 0x45f6, 0xa9, 0x43, 0xec, 0xa9, 0x94, 0xb6, 0xc, 0x79);
+
+/*!
+ * @brief
+ * Shared ring property set (audio pins).
+ *
+ * The data of a pin with a mapped ring goes through the ring instead of
+ * IOCTL_KS_WRITE_STREAM/IOCTL_KS_READ_STREAM. The ring is mapped and unmapped
+ * in KSSTATE_STOP, by the process that uses it, and is emptied each time the
+ * pin goes to KSSTATE_ACQUIRE. See SharedRing.h for the protocol; the pin is
+ * the consumer of a render ring and the producer of a capture ring.
+ */
+typedef enum
+{
+	KSPROPERTY_SHAREDRING_MAP = 0,	// GET only
+	KSPROPERTY_SHAREDRING_UNMAP		// SET only, the ULONG value is ignored
+} KSPROPERTY_SHAREDRING;
+
+// Defines the structures used in the properties above.
+typedef struct
+{
+	ULONG		BufferSize;			// Bytes, a multiple of PeriodSize and at most SHARED_RING_MAXIMUM_SIZE.
+	ULONG		PeriodSize;			// Bytes, a multiple of the frame size.
+	ULONGLONG	NotificationEvent;	// Event handle, set each time the pin crosses a period boundary.
+} SHARED_RING_PARAMETERS, *PSHARED_RING_PARAMETERS;
+
+typedef struct
+{
+	KSPROPERTY				Property;
+	SHARED_RING_PARAMETERS	Parameters;
+} SHAREDRING_MAP, *PSHAREDRING_MAP;
+
+typedef struct
+{
+	ULONGLONG	Address;			// User mode address of the ring.
+	ULONG		Size;				// SHARED_RING_CONTROL_SIZE + BufferSize.
+	ULONG		Reserved;
+} SHARED_RING_MAPPING, *PSHARED_RING_MAPPING;
+
 #endif // _PRIVATE_PROPERTY_H_
 
@@ -0,0 +1,398 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       SharedRing.h
+ * @brief      Cyclic buffer shared between the audio pin and a user mode
+ *             client.
+ * @details
+ * The ring is one block of memory: a SHARED_RING_CONTROL followed by
+ * BufferSize bytes of data. The producer writes the data and advances
+ * WritePosition, the consumer reads it and advances ReadPosition. Each
+ * position has a single writer, so no lock is needed.
+ *
+ * The positions run from 0 to 2 * BufferSize - 1, so a full ring can be told
+ * from an empty one without a power of two size; the data offset of a
+ * position is the position modulo BufferSize. BufferSize is a multiple of
+ * PeriodSize, so a period never straddles the end of the data area.
+ *
+ * Each side keeps its own position in its SHARED_RING, and only reads the
+ * position of the other side from the control block. The position read from
+ * the other side is checked, so a corrupted control block stalls the ring
+ * instead of sending a side outside of the data area.
+ *
+ * The header only needs the base types (ULONG, PUCHAR...), which the
+ * includer provides.
+ *//*
+ *****************************************************************************
+ */
+#ifndef _SHARED_RING_H_
+#define _SHARED_RING_H_
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Size of the control block, which is also the offset of the data. */
+#define SHARED_RING_CONTROL_SIZE	64
+
+/*! @brief Largest data area. */
+#define SHARED_RING_MAXIMUM_SIZE	(1024 * 1024)
+
+/*! @brief Fill of a ring whose control block does not make sense. */
+#define SHARED_RING_CORRUPT			0xFFFFFFFF
+
+/*! @brief Full barrier between the data and the position accesses. */
+#if defined(_WDMDDK_)
+#define SharedRingMemoryBarrier()	KeMemoryBarrier()
+#elif defined(_WIN32)
+#define SharedRingMemoryBarrier()	MemoryBarrier()
+#else
+#define SharedRingMemoryBarrier()	__sync_synchronize()
+#endif
+
+/*****************************************************************************
+ * Structures
+ */
+/*****************************************************************************
+ *//*! @struct SHARED_RING_CONTROL
+ *****************************************************************************
+ * @brief
+ * Control block at the start of the ring, visible to both sides.
+ */
+typedef struct
+{
+	ULONG			BufferSize;		/*!< @brief Size of the data area, a multiple of PeriodSize. */
+	ULONG			PeriodSize;		/*!< @brief Size of a period. */
+	volatile ULONG	WritePosition;	/*!< @brief Producer position, in [0, 2 * BufferSize). */
+	volatile ULONG	ReadPosition;	/*!< @brief Consumer position, in [0, 2 * BufferSize). */
+	volatile ULONG	Overruns;		/*!< @brief Number of times the producer found no room. */
+	volatile ULONG	Underruns;		/*!< @brief Number of times the consumer found too little data. */
+	ULONG			Reserved[10];
+} SHARED_RING_CONTROL, *PSHARED_RING_CONTROL;
+
+/*****************************************************************************
+ *//*! @struct SHARED_RING
+ *****************************************************************************
+ * @brief
+ * One side's view of the ring. This is private to the side.
+ */
+typedef struct
+{
+	PSHARED_RING_CONTROL	Control;	/*!< @brief Control block. */
+	PUCHAR					Data;		/*!< @brief Data area. */
+	ULONG					BufferSize;	/*!< @brief Size of the data area. */
+	ULONG					PeriodSize;	/*!< @brief Size of a period. */
+	ULONG					Position;	/*!< @brief This side's position. */
+} SHARED_RING, *PSHARED_RING;
+
+/*****************************************************************************
+ * SharedRingAttach()
+ *****************************************************************************
+ * @brief
+ * Set up a side's view of the ring at Memory, which is
+ * SHARED_RING_CONTROL_SIZE + BufferSize bytes long.
+ */
+static __inline
+VOID
+SharedRingAttach
+(
+	IN		PSHARED_RING	Ring,
+	IN		PVOID			Memory,
+	IN		ULONG			BufferSize,
+	IN		ULONG			PeriodSize
+)
+{
+	Ring->Control = PSHARED_RING_CONTROL(Memory);
+	Ring->Data = PUCHAR(Memory) + SHARED_RING_CONTROL_SIZE;
+	Ring->BufferSize = BufferSize;
+	Ring->PeriodSize = PeriodSize;
+	Ring->Position = 0;
+}
+
+/*****************************************************************************
+ * SharedRingReset()
+ *****************************************************************************
+ * @brief
+ * Empty the ring. Only the owner of the memory does this, while the other
+ * side is not using the ring; the other side then rewinds its position.
+ */
+static __inline
+VOID
+SharedRingReset
+(
+	IN		PSHARED_RING	Ring
+)
+{
+	Ring->Control->BufferSize = Ring->BufferSize;
+	Ring->Control->PeriodSize = Ring->PeriodSize;
+	Ring->Control->WritePosition = 0;
+	Ring->Control->ReadPosition = 0;
+	Ring->Control->Overruns = 0;
+	Ring->Control->Underruns = 0;
+
+	Ring->Position = 0;
+
+	SharedRingMemoryBarrier();
+}
+
+/*****************************************************************************
+ * SharedRingRewind()
+ *****************************************************************************
+ * @brief
+ * Move this side back to the start of an emptied ring.
+ */
+static __inline
+VOID
+SharedRingRewind
+(
+	IN		PSHARED_RING	Ring
+)
+{
+	Ring->Position = 0;
+}
+
+/*****************************************************************************
+ * _SharedRingFill()
+ *****************************************************************************
+ * @brief
+ * Bytes between the two positions, or SHARED_RING_CORRUPT.
+ */
+static __inline
+ULONG
+_SharedRingFill
+(
+	IN		PSHARED_RING	Ring,
+	IN		ULONG			ReadPosition,
+	IN		ULONG			WritePosition
+)
+{
+	ULONG Limit = Ring->BufferSize * 2;
+
+	if ((ReadPosition >= Limit) || (WritePosition >= Limit))
+	{
+		return SHARED_RING_CORRUPT;
+	}
+
+	ULONG Fill = (WritePosition >= ReadPosition) ? (WritePosition - ReadPosition) : (WritePosition + Limit - ReadPosition);
+
+	return (Fill <= Ring->BufferSize) ? Fill : SHARED_RING_CORRUPT;
+}
+
+/*****************************************************************************
+ * _SharedRingAdvance()
+ *****************************************************************************
+ * @brief
+ * Move this side's position and publish it. Returns the number of period
+ * boundaries crossed.
+ */
+static __inline
+ULONG
+_SharedRingAdvance
+(
+	IN		PSHARED_RING	Ring,
+	IN		volatile ULONG *	Published,
+	IN		ULONG			Bytes
+)
+{
+	ULONG Limit = Ring->BufferSize * 2;
+
+	ULONG Periods = Limit / Ring->PeriodSize;
+
+	ULONG OldPosition = Ring->Position;
+
+	ULONG NewPosition = OldPosition + Bytes;
+
+	if (NewPosition >= Limit)
+	{
+		NewPosition -= Limit;
+	}
+
+	Ring->Position = NewPosition;
+
+	// The data accesses complete before the other side sees the position.
+	SharedRingMemoryBarrier();
+
+	*Published = NewPosition;
+
+	return (NewPosition / Ring->PeriodSize + Periods - OldPosition / Ring->PeriodSize) % Periods;
+}
+
+/*****************************************************************************
+ * SharedRingGetReadable()
+ *****************************************************************************
+ * @brief
+ * Consumer: bytes that can be read, 0 if the producer position is corrupt.
+ */
+static __inline
+ULONG
+SharedRingGetReadable
+(
+	IN		PSHARED_RING	Ring
+)
+{
+	ULONG WritePosition = Ring->Control->WritePosition;
+
+	// The data is read after the position that covers it.
+	SharedRingMemoryBarrier();
+
+	ULONG Fill = _SharedRingFill(Ring, Ring->Position, WritePosition);
+
+	return (Fill == SHARED_RING_CORRUPT) ? 0 : Fill;
+}
+
+/*****************************************************************************
+ * SharedRingGetWritable()
+ *****************************************************************************
+ * @brief
+ * Producer: bytes that can be written, 0 if the consumer position is corrupt.
+ */
+static __inline
+ULONG
+SharedRingGetWritable
+(
+	IN		PSHARED_RING	Ring
+)
+{
+	ULONG ReadPosition = Ring->Control->ReadPosition;
+
+	// The data is written after the position that frees it.
+	SharedRingMemoryBarrier();
+
+	ULONG Fill = _SharedRingFill(Ring, ReadPosition, Ring->Position);
+
+	return (Fill == SHARED_RING_CORRUPT) ? 0 : Ring->BufferSize - Fill;
+}
+
+/*****************************************************************************
+ * SharedRingGetReadRegion()
+ *****************************************************************************
+ * @brief
+ * Consumer: contiguous bytes that can be read at *OutData.
+ */
+static __inline
+ULONG
+SharedRingGetReadRegion
+(
+	IN		PSHARED_RING	Ring,
+	OUT		PUCHAR *		OutData
+)
+{
+	ULONG Bytes = SharedRingGetReadable(Ring);
+
+	ULONG Offset = (Ring->Position >= Ring->BufferSize) ? (Ring->Position - Ring->BufferSize) : Ring->Position;
+
+	*OutData = Ring->Data + Offset;
+
+	return (Bytes < Ring->BufferSize - Offset) ? Bytes : (Ring->BufferSize - Offset);
+}
+
+/*****************************************************************************
+ * SharedRingGetWriteRegion()
+ *****************************************************************************
+ * @brief
+ * Producer: contiguous bytes that can be written at *OutData.
+ */
+static __inline
+ULONG
+SharedRingGetWriteRegion
+(
+	IN		PSHARED_RING	Ring,
+	OUT		PUCHAR *		OutData
+)
+{
+	ULONG Bytes = SharedRingGetWritable(Ring);
+
+	ULONG Offset = (Ring->Position >= Ring->BufferSize) ? (Ring->Position - Ring->BufferSize) : Ring->Position;
+
+	*OutData = Ring->Data + Offset;
+
+	return (Bytes < Ring->BufferSize - Offset) ? Bytes : (Ring->BufferSize - Offset);
+}
+
+/*****************************************************************************
+ * SharedRingAdvanceRead()
+ *****************************************************************************
+ * @brief
+ * Consumer: release Bytes (at most what SharedRingGetReadRegion() returned).
+ * Returns the number of period boundaries crossed.
+ */
+static __inline
+ULONG
+SharedRingAdvanceRead
+(
+	IN		PSHARED_RING	Ring,
+	IN		ULONG			Bytes
+)
+{
+	return _SharedRingAdvance(Ring, &Ring->Control->ReadPosition, Bytes);
+}
+
+/*****************************************************************************
+ * SharedRingAdvanceWrite()
+ *****************************************************************************
+ * @brief
+ * Producer: publish Bytes (at most what SharedRingGetWriteRegion() returned).
+ * Returns the number of period boundaries crossed.
+ */
+static __inline
+ULONG
+SharedRingAdvanceWrite
+(
+	IN		PSHARED_RING	Ring,
+	IN		ULONG			Bytes
+)
+{
+	return _SharedRingAdvance(Ring, &Ring->Control->WritePosition, Bytes);
+}
+
+/*****************************************************************************
+ * SharedRingOverrun()
+ *****************************************************************************
+ * @brief
+ * Producer: count a write that did not fit.
+ */
+static __inline
+VOID
+SharedRingOverrun
+(
+	IN		PSHARED_RING	Ring
+)
+{
+	Ring->Control->Overruns = Ring->Control->Overruns + 1;
+}
+
+/*****************************************************************************
+ * SharedRingUnderrun()
+ *****************************************************************************
+ * @brief
+ * Consumer: count a read that found too little data.
+ */
+static __inline
+VOID
+SharedRingUnderrun
+(
+	IN		PSHARED_RING	Ring
+)
+{
+	Ring->Control->Underruns = Ring->Control->Underruns + 1;
+}
+
+#endif // _SHARED_RING_H_
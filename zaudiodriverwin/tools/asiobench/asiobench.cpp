@@ -0,0 +1,562 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       asiobench.cpp
+ * @brief      Measures the ASIO buffer switch copies, per sample as
+ *             CAsioDriver::_SyncWritePinData()/_SyncReadPinData() used to do
+ *             and with the routines of asiodll/interleave.cpp.
+ * @details
+ * For each pin format, channel count and buffer size, both ways are run on
+ * the same data and must give the same bytes; the times are per buffer
+ * switch of one pin.
+ *
+ * Then the float routines are checked against a double precision reference
+ * and timed against the integer ones, for a 16 channel pin: the cost of
+ * converting in the copy pass, with and without dither.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -mssse3 -I../include -I../../asiodll -o asiobench asiobench.cpp ../../asiodll/interleave.cpp
+ *     ./asiobench [iterations]
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "interleave.h"
+
+/*****************************************************************************
+ * Defines
+ */
+#define MAXIMUM_CHANNELS	32
+#define MAXIMUM_FRAMES		2048
+
+/*****************************************************************************
+ * Types
+ */
+typedef struct
+{
+	const char *	Name;
+	ULONG			SampleSize;		// bits per sample on the pin
+	BOOL			Padded;
+} FORMAT;
+
+/*! @brief Keeps the compiler from dropping the copies. */
+static volatile ULONG Sink;
+
+/*****************************************************************************
+ * Now()
+ *****************************************************************************
+ * @brief
+ * Monotonic time in ns.
+ */
+static double
+Now
+(	void
+)
+{
+	struct timespec Time;
+
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+
+	return (double)Time.tv_sec * 1e9 + (double)Time.tv_nsec;
+}
+
+/*****************************************************************************
+ * PerSampleWrite()
+ *****************************************************************************
+ * @brief
+ * The copy loop of the old _SyncWritePinData(), channel by channel.
+ */
+static __attribute__((noinline)) void
+PerSampleWrite
+(
+	PUCHAR		Frames,
+	PVOID *		Channels,
+	ULONG		NumberOfChannels,
+	ULONG		NumberOfFrames,
+	ULONG		SampleSize,
+	BOOL		Padded
+)
+{
+	for (ULONG i=0; i<NumberOfChannels; i++)
+	{
+		PUCHAR Source = PUCHAR(Channels[i]);
+
+		PUCHAR Destination = Frames + i * SampleSize;
+
+		ULONG FrameSize = NumberOfChannels * SampleSize;
+
+		if (Padded)
+		{
+			for (ULONG j=0; j<NumberOfFrames; j++)
+			{
+				memcpy(Destination, Source+1, 3);
+
+				Destination += FrameSize;
+
+				Source += 4;
+			}
+		}
+		else
+		{
+			for (ULONG j=0; j<NumberOfFrames; j++)
+			{
+				memcpy(Destination, Source, SampleSize);
+
+				Destination += FrameSize;
+
+				Source += SampleSize;
+			}
+		}
+	}
+}
+
+/*****************************************************************************
+ * PerSampleRead()
+ *****************************************************************************
+ * @brief
+ * The copy loop of the old _SyncReadPinData(), channel by channel.
+ */
+static __attribute__((noinline)) void
+PerSampleRead
+(
+	PUCHAR		Frames,
+	PVOID *		Channels,
+	ULONG		NumberOfChannels,
+	ULONG		NumberOfFrames,
+	ULONG		SampleSize,
+	BOOL		Padded
+)
+{
+	for (ULONG i=0; i<NumberOfChannels; i++)
+	{
+		PUCHAR Destination = PUCHAR(Channels[i]);
+
+		PUCHAR Source = Frames + i * SampleSize;
+
+		ULONG FrameSize = NumberOfChannels * SampleSize;
+
+		if (Padded)
+		{
+			for (ULONG j=0; j<NumberOfFrames; j++)
+			{
+				*Destination = 0;
+
+				memcpy(Destination+1, Source, 3);
+
+				Destination += 4;
+
+				Source += FrameSize;
+			}
+		}
+		else
+		{
+			for (ULONG j=0; j<NumberOfFrames; j++)
+			{
+				memcpy(Destination, Source, SampleSize);
+
+				Destination += SampleSize;
+
+				Source += FrameSize;
+			}
+		}
+	}
+}
+
+/*****************************************************************************
+ * Fill()
+ *****************************************************************************
+ */
+static void
+Fill
+(
+	PUCHAR	Buffer,
+	size_t	Size,
+	ULONG	Seed
+)
+{
+	for (size_t i=0; i<Size; i++)
+	{
+		Seed = Seed * 1664525 + 1013904223;
+
+		Buffer[i] = UCHAR(Seed >> 24);
+	}
+}
+
+/*****************************************************************************
+ * ReferenceFloatWrite()
+ *****************************************************************************
+ * @brief
+ * Float to pin samples in double precision, rounded to nearest even.
+ */
+static void
+ReferenceFloatWrite
+(
+	PUCHAR		Frames,
+	PVOID *		Channels,
+	ULONG		NumberOfChannels,
+	ULONG		NumberOfFrames,
+	ULONG		SampleSize
+)
+{
+	double Scale = (SampleSize == 2) ? 32768.0 : (SampleSize == 3) ? 8388608.0 : 2147483648.0;
+	double Limit = (SampleSize == 2) ? 32767.0 : (SampleSize == 3) ? 8388607.0 : 2147483520.0;
+
+	for (ULONG i=0; i<NumberOfChannels; i++)
+	{
+		for (ULONG j=0; j<NumberOfFrames; j++)
+		{
+			double Value = PFLOAT(Channels[i])[j] * Scale;
+
+			if (!(Value >= -Scale)) Value = -Scale;
+			if (Value > Limit) Value = Limit;
+
+			LONG Fixed = LONG(nearbyint(Value));
+
+			memcpy(Frames + (j * NumberOfChannels + i) * SampleSize, &Fixed, SampleSize);
+		}
+	}
+}
+
+/*****************************************************************************
+ * ReadFixed()
+ *****************************************************************************
+ * @brief
+ * A pin sample, sign extended.
+ */
+static LONG
+ReadFixed
+(
+	PUCHAR	Sample,
+	ULONG	SampleSize
+)
+{
+	LONG Fixed = 0;
+
+	memcpy(&Fixed, Sample, SampleSize);
+
+	return (Fixed << (32 - SampleSize * 8)) >> (32 - SampleSize * 8);
+}
+
+/*****************************************************************************
+ * BenchFloat()
+ *****************************************************************************
+ * @brief
+ * Check and time the float routines on a 16 channel pin.
+ */
+static int
+BenchFloat
+(
+	ULONG		Iterations,
+	PUCHAR *	Frames,
+	PVOID		(*Channels)[MAXIMUM_CHANNELS]
+)
+{
+	static const ULONG SampleSizes[] = { 16, 24, 32 };
+	static const ULONG NumberOfFrames[] = { 32, 64, 128, 256, 512, 1024, 2048 };
+
+	const ULONG Nc = 16;
+
+	printf("\nns per buffer switch of a %u channel pin, integer -> float ASIO samples\n", Nc);
+
+	for (ULONG s=0; s<sizeof(SampleSizes)/sizeof(SampleSizes[0]); s++)
+	{
+		ULONG SampleSize = SampleSizes[s] / 8;
+
+		ASIO_COPY_ROUTINE Interleave = FindAsioCopyRoutine(ASIO_COPY_INTERLEAVE, SampleSizes[s], FALSE);
+		ASIO_COPY_ROUTINE Deinterleave = FindAsioCopyRoutine(ASIO_COPY_DEINTERLEAVE, SampleSizes[s], FALSE);
+
+		ASIO_COPY_ROUTINE FloatInterleave = FindAsioFloatCopyRoutine(ASIO_COPY_INTERLEAVE, SampleSizes[s], FALSE);
+		ASIO_COPY_ROUTINE DitherInterleave = FindAsioFloatCopyRoutine(ASIO_COPY_INTERLEAVE, SampleSizes[s], TRUE);
+		ASIO_COPY_ROUTINE FloatDeinterleave = FindAsioFloatCopyRoutine(ASIO_COPY_DEINTERLEAVE, SampleSizes[s], FALSE);
+
+		printf("\n%u-bit pin\n", SampleSizes[s]);
+
+		for (ULONG n=0; n<sizeof(NumberOfFrames)/sizeof(NumberOfFrames[0]); n++)
+		{
+			ULONG Nf = NumberOfFrames[n];
+
+			size_t FramesSize = size_t(Nc) * Nf * SampleSize;
+
+			// Samples over the whole range, a bit past full scale, with
+			// exact halves of an LSB and a NaN.
+			for (ULONG i=0; i<Nc; i++)
+			{
+				PFLOAT Samples = PFLOAT(Channels[0][i]);
+
+				ULONG Seed = i + 1;
+
+				for (ULONG j=0; j<Nf; j++)
+				{
+					Seed = Seed * 1664525 + 1013904223;
+
+					Samples[j] = (j % 7) ? (LONG(Seed) / 2147483648.0f) * 1.01f : (LONG(Seed >> 8) - 0x800000 + 0.5f) / 8388608.0f;
+				}
+
+				Samples[Nf / 2] = nanf("");
+			}
+
+			memset(Frames[0], 0xCC, FramesSize + 16);
+			memset(Frames[1], 0xCC, FramesSize + 16);
+
+			ReferenceFloatWrite(Frames[0], Channels[0], Nc, Nf, SampleSize);
+			FloatInterleave(Frames[1], Channels[0], Nc, Nf);
+
+			if (memcmp(Frames[0], Frames[1], FramesSize + 16))
+			{
+				fprintf(stderr, "asiobench: %u-bit, %u frames: float interleave mismatch\n", SampleSizes[s], Nf);
+				return 1;
+			}
+
+			// The dither moves a sample by at most 1 LSB, or 2 at the top of
+			// the 24-bit range, where the float sum has half an LSB steps.
+			DitherInterleave(Frames[1], Channels[0], Nc, Nf);
+
+			for (size_t i=0; i<FramesSize; i+=SampleSize)
+			{
+				if (labs(long(ReadFixed(Frames[0]+i, SampleSize)) - long(ReadFixed(Frames[1]+i, SampleSize))) > ((SampleSize == 3) ? 2 : 1))
+				{
+					fprintf(stderr, "asiobench: %u-bit, %u frames: dither out of range\n", SampleSizes[s], Nf);
+					return 1;
+				}
+			}
+
+			Fill(Frames[0], FramesSize, Nf);
+
+			FloatDeinterleave(Frames[0], Channels[1], Nc, Nf);
+
+			for (ULONG i=0; i<Nc; i++)
+			{
+				for (ULONG j=0; j<Nf; j++)
+				{
+					float Expected = float(ReadFixed(Frames[0] + (j * Nc + i) * SampleSize, SampleSize)) / ((SampleSize == 2) ? 32768.0f : (SampleSize == 3) ? 8388608.0f : 2147483648.0f);
+
+					if (PFLOAT(Channels[1][i])[j] != Expected)
+					{
+						fprintf(stderr, "asiobench: %u-bit, %u frames: float deinterleave mismatch\n", SampleSizes[s], Nf);
+						return 1;
+					}
+				}
+			}
+
+			ULONG Count = ULONG(Iterations * 2048ull * 8 / ((unsigned long long)(Nc) * Nf));
+
+			if (Count < 10) Count = 10;
+
+			double Start = Now();
+			for (ULONG i=0; i<Count; i++) Interleave(Frames[0], Channels[0], Nc, Nf);
+			double IntWrite = (Now() - Start) / Count;
+
+			Start = Now();
+			for (ULONG i=0; i<Count; i++) FloatInterleave(Frames[0], Channels[0], Nc, Nf);
+			double FloatWrite = (Now() - Start) / Count;
+
+			Start = Now();
+			for (ULONG i=0; i<Count; i++) DitherInterleave(Frames[0], Channels[0], Nc, Nf);
+			double DitherWrite = (Now() - Start) / Count;
+
+			Start = Now();
+			for (ULONG i=0; i<Count; i++) Deinterleave(Frames[0], Channels[0], Nc, Nf);
+			double IntRead = (Now() - Start) / Count;
+
+			Start = Now();
+			for (ULONG i=0; i<Count; i++) FloatDeinterleave(Frames[0], Channels[1], Nc, Nf);
+			double FloatRead = (Now() - Start) / Count;
+
+			Sink += Frames[0][0] + PUCHAR(Channels[1][0])[0];
+
+			printf("  %4u frames  write %7.0f -> %7.0f (dither %7.0f)  read %7.0f -> %7.0f\n",
+				Nf, IntWrite, FloatWrite, DitherWrite, IntRead, FloatRead);
+		}
+	}
+
+	// Triangular dither is unbiased: a constant quarter of an LSB comes out
+	// as a quarter of an LSB on average, where rounding alone gives 0.
+	ASIO_COPY_ROUTINE DitherInterleave = FindAsioFloatCopyRoutine(ASIO_COPY_INTERLEAVE, 16, TRUE);
+
+	const ULONG Nf = MAXIMUM_FRAMES;
+
+	for (ULONG i=0; i<Nc; i++)
+	{
+		for (ULONG j=0; j<Nf; j++)
+		{
+			((PFLOAT)Channels[0][i])[j] = 0.25f / 32768.0f;
+		}
+	}
+
+	DitherInterleave(Frames[0], Channels[0], Nc, Nf);
+
+	double Sum = 0;
+
+	for (ULONG i=0; i<Nc*Nf; i++)
+	{
+		Sum += PSHORT(Frames[0])[i];
+	}
+
+	double Mean = Sum / (Nc * Nf);
+
+	printf("\nmean of a dithered 0.25 LSB: %.3f LSB\n", Mean);
+
+	if (fabs(Mean - 0.25) > 0.02)
+	{
+		fprintf(stderr, "asiobench: dither is biased\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(
+	int		argc,
+	char **	argv
+)
+{
+	ULONG Iterations = (argc > 1) ? ULONG(strtoul(argv[1], NULL, 0)) : 500;
+
+	static const FORMAT Formats[] =
+	{
+		{ "16-bit", 16, FALSE },
+		{ "24-bit", 24, FALSE },
+		{ "32-bit", 32, FALSE },
+		{ "24-bit in 32-bit ASIO samples (USE_24_BIT_PADDED)", 24, TRUE },
+	};
+
+	static const ULONG NumberOfChannels[] = { 2, 4, 6, 8, 10, 16, 32 };
+	static const ULONG NumberOfFrames[] = { 32, 64, 128, 256, 512, 1024, 2048 };
+
+	if (!Iterations)
+	{
+		fprintf(stderr, "usage: asiobench [iterations]\n");
+		return 1;
+	}
+
+	PUCHAR Frames[2] = { PUCHAR(malloc(MAXIMUM_CHANNELS * MAXIMUM_FRAMES * 4)), PUCHAR(malloc(MAXIMUM_CHANNELS * MAXIMUM_FRAMES * 4)) };
+
+	PVOID Channels[2][MAXIMUM_CHANNELS];
+
+	for (ULONG i=0; i<MAXIMUM_CHANNELS; i++)
+	{
+		Channels[0][i] = malloc(MAXIMUM_FRAMES * 4);
+		Channels[1][i] = malloc(MAXIMUM_FRAMES * 4);
+	}
+
+	printf("ns per buffer switch of one pin, per sample -> one pass (speedup)\n");
+
+	for (ULONG f=0; f<sizeof(Formats)/sizeof(Formats[0]); f++)
+	{
+		ULONG SampleSize = Formats[f].SampleSize / 8;
+		ULONG ChannelSize = Formats[f].Padded ? 4 : SampleSize;
+
+		ASIO_COPY_ROUTINE Interleave = FindAsioCopyRoutine(ASIO_COPY_INTERLEAVE, Formats[f].SampleSize, Formats[f].Padded);
+		ASIO_COPY_ROUTINE Deinterleave = FindAsioCopyRoutine(ASIO_COPY_DEINTERLEAVE, Formats[f].SampleSize, Formats[f].Padded);
+
+		printf("\n%s\n", Formats[f].Name);
+
+		for (ULONG c=0; c<sizeof(NumberOfChannels)/sizeof(NumberOfChannels[0]); c++)
+		{
+			for (ULONG n=0; n<sizeof(NumberOfFrames)/sizeof(NumberOfFrames[0]); n++)
+			{
+				ULONG Nc = NumberOfChannels[c], Nf = NumberOfFrames[n];
+
+				size_t FramesSize = size_t(Nc) * Nf * SampleSize;
+				size_t ChannelsSize = size_t(Nf) * ChannelSize;
+
+				// Both ways must give the same bytes.
+				for (ULONG i=0; i<Nc; i++)
+				{
+					Fill(PUCHAR(Channels[0][i]), ChannelsSize, i);
+				}
+
+				memset(Frames[0], 0xCC, FramesSize + 16);
+				memset(Frames[1], 0xCC, FramesSize + 16);
+
+				PerSampleWrite(Frames[0], Channels[0], Nc, Nf, SampleSize, Formats[f].Padded);
+				Interleave(Frames[1], Channels[0], Nc, Nf);
+
+				if (memcmp(Frames[0], Frames[1], FramesSize + 16))
+				{
+					fprintf(stderr, "asiobench: %s, %u channels, %u frames: interleave mismatch\n", Formats[f].Name, Nc, Nf);
+					return 1;
+				}
+
+				Fill(Frames[0], FramesSize, Nc);
+
+				for (ULONG i=0; i<Nc; i++)
+				{
+					memset(Channels[0][i], 0xCC, ChannelsSize);
+					memset(Channels[1][i], 0xCC, ChannelsSize);
+				}
+
+				PerSampleRead(Frames[0], Channels[0], Nc, Nf, SampleSize, Formats[f].Padded);
+				Deinterleave(Frames[0], Channels[1], Nc, Nf);
+
+				for (ULONG i=0; i<Nc; i++)
+				{
+					if (memcmp(Channels[0][i], Channels[1][i], ChannelsSize))
+					{
+						fprintf(stderr, "asiobench: %s, %u channels, %u frames: deinterleave mismatch\n", Formats[f].Name, Nc, Nf);
+						return 1;
+					}
+				}
+
+				// Scale the iterations to about the same amount of data.
+				ULONG Count = ULONG(Iterations * 2048ull * 8 / ((unsigned long long)(Nc) * Nf));
+
+				if (Count < 10) Count = 10;
+
+				double Start = Now();
+				for (ULONG i=0; i<Count; i++) PerSampleWrite(Frames[0], Channels[0], Nc, Nf, SampleSize, Formats[f].Padded);
+				double OldWrite = (Now() - Start) / Count;
+
+				Start = Now();
+				for (ULONG i=0; i<Count; i++) Interleave(Frames[0], Channels[0], Nc, Nf);
+				double NewWrite = (Now() - Start) / Count;
+
+				Start = Now();
+				for (ULONG i=0; i<Count; i++) PerSampleRead(Frames[0], Channels[0], Nc, Nf, SampleSize, Formats[f].Padded);
+				double OldRead = (Now() - Start) / Count;
+
+				Start = Now();
+				for (ULONG i=0; i<Count; i++) Deinterleave(Frames[0], Channels[0], Nc, Nf);
+				double NewRead = (Now() - Start) / Count;
+
+				Sink += Frames[0][0] + PUCHAR(Channels[0][0])[0];
+
+				printf("  %2u ch %4u frames  write %8.0f -> %7.0f (%4.1fx)  read %8.0f -> %7.0f (%4.1fx)\n",
+					Nc, Nf, OldWrite, NewWrite, OldWrite / NewWrite, OldRead, NewRead, OldRead / NewRead);
+			}
+		}
+	}
+
+	return BenchFloat(Iterations, Frames, Channels);
+}
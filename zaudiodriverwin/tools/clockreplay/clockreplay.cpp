@@ -0,0 +1,342 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       clockreplay.cpp
+ * @brief      Replays buffer switch times into the ASIO sample clock
+ *             estimator (asiodll/clock.cpp).
+ * @details
+ * With a file argument, each line of the file is a buffer switch:
+ *
+ *     <sample position> <raw time in ns>
+ *
+ * and the filtered time, the prediction error and the measured sample rate
+ * are printed after each one. Lines that start with '#' are comments.
+ *
+ * Without one, synthetic traces are replayed: a device clock that is off
+ * its nominal rate by some ppm, buffer switches seen late by a random wake
+ * up latency, and now and then a stall. The filtered times are checked
+ * against the true times of the switches: their jitter must be a fraction
+ * of the raw jitter, and the measured rate must follow the drift.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -I../include -I../../asiodll -o clockreplay clockreplay.cpp ../../asiodll/clock.cpp
+ *     ./clockreplay [file]
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "clock.h"
+
+/*****************************************************************************
+ * Replay()
+ *****************************************************************************
+ * @brief
+ * Replay the buffer switches in File.
+ */
+static int
+Replay
+(
+	FILE *	File,
+	ULONG	SampleRate
+)
+{
+	CAsioClock Clock;
+
+	Clock.Initialize(SampleRate);
+
+	char Line[256];
+
+	ULONG LineNumber = 0;
+
+	while (fgets(Line, sizeof(Line), File))
+	{
+		LineNumber++;
+
+		if ((Line[0] == '#') || (Line[0] == '\n') || (Line[0] == '\r'))
+		{
+			continue;
+		}
+
+		unsigned long long SamplePosition, RawTime;
+
+		if (sscanf(Line, "%llu %llu", &SamplePosition, &RawTime) != 2)
+		{
+			fprintf(stderr, "clockreplay: line %u: bad switch: %s", LineNumber, Line);
+			return 1;
+		}
+
+		ULONGLONG Time = Clock.Update(SamplePosition, RawTime);
+
+		printf("%12llu %16llu -> %16llu  error %10.0f ns  rate %10.3f Hz  relocks %u\n",
+			SamplePosition, RawTime, (unsigned long long)Time, Clock.GetError(), Clock.GetSampleRate(), Clock.GetRelocks());
+	}
+
+	return 0;
+}
+
+/*****************************************************************************
+ * Random()
+ *****************************************************************************
+ * @brief
+ * Uniform in [0, 1).
+ */
+static double
+Random
+(	void
+)
+{
+	return rand() / (RAND_MAX + 1.0);
+}
+
+/*****************************************************************************
+ * Check()
+ *****************************************************************************
+ * @brief
+ * Replay Seconds of buffer switches of BufferSize samples from a device
+ * clock Ppm off SampleRate. Each switch is seen up to Latency ns late, and
+ * one in StallInterval is seen Stall ns late. The first two seconds are
+ * left for the loop to lock.
+ */
+static int
+Check
+(
+	ULONG	SampleRate,
+	ULONG	BufferSize,
+	double	Ppm,
+	double	Latency,
+	ULONG	StallInterval,
+	double	Stall,
+	double	Seconds
+)
+{
+	CAsioClock Clock;
+
+	Clock.Initialize(SampleRate);
+
+	double TruePeriod = 1e9 / (SampleRate * (1.0 + Ppm / 1e6));
+
+	// An arbitrary system time for the start of the stream.
+	ULONGLONG StartTime = 123456789012345ULL;
+
+	ULONG Switches = ULONG(Seconds * SampleRate / BufferSize);
+
+	// Statistics of the raw and filtered times against the true times, after
+	// the lock. The mean is the average latency, which is not filtered out;
+	// what matters is the deviation around it.
+	double RawSum = 0, RawSquares = 0, FilteredSum = 0, FilteredSquares = 0, RateSum = 0;
+
+	double TimeSum = 0, TimeSquares = 0, Products = 0;
+
+	ULONG Samples = 0;
+
+	for (ULONG i = 0; i < Switches; i++)
+	{
+		ULONGLONG SamplePosition = ULONGLONG(i) * BufferSize;
+
+		double TrueTime = SamplePosition * TruePeriod;
+
+		double Late = Latency * Random();
+
+		BOOL Stalled = StallInterval && ((i % StallInterval) == StallInterval - 1);
+
+		if (Stalled)
+		{
+			Late += Stall;
+		}
+
+		ULONGLONG RawTime = StartTime + ULONGLONG(TrueTime + Late);
+
+		ULONGLONG Time = Clock.Update(SamplePosition, RawTime);
+
+		if ((TrueTime < 2e9) || Stalled)
+		{
+			continue;
+		}
+
+		double Raw = double(LONGLONG(RawTime - StartTime)) - TrueTime;
+
+		double Filtered = double(LONGLONG(Time - StartTime)) - TrueTime;
+
+		RawSum += Raw; RawSquares += Raw * Raw;
+
+		FilteredSum += Filtered; FilteredSquares += Filtered * Filtered;
+
+		RateSum += Clock.GetSampleRate();
+
+		TimeSum += TrueTime; TimeSquares += TrueTime * TrueTime; Products += TrueTime * Filtered;
+
+		Samples++;
+	}
+
+	double RawJitter = Samples ? sqrt(RawSquares / Samples - (RawSum / Samples) * (RawSum / Samples)) : 0;
+
+	double FilteredJitter = Samples ? sqrt(FilteredSquares / Samples - (FilteredSum / Samples) * (FilteredSum / Samples)) : 0;
+
+	double Rate = 1e9 / TruePeriod;
+
+	double RateError = Samples ? fabs(RateSum / Samples - Rate) / Rate * 1e6 : 0;
+
+	// The slope of the filtered errors, which is the drift the loop missed.
+	double Slope = Samples ? (Products - TimeSum * FilteredSum / Samples) / (TimeSquares - TimeSum * TimeSum / Samples) * 1e6 : 0;
+
+	// The loop must take out most of the jitter, follow the drift, and ride
+	// through a stall without restarting. The filtered times and the measured
+	// rate wander with the jitter, more so with few switches a second, so the
+	// drift left over the run is held to the filtered jitter.
+	double Span = (Seconds - 2.0) * 1e9;
+
+	int Result = 0;
+
+	if ((Samples == 0) || (FilteredJitter > RawJitter / 3) || (fabs(Slope) / 1e6 * Span > 2 * FilteredJitter) || (RateError > 25.0) || Clock.GetRelocks())
+	{
+		Result = 1;
+	}
+
+	printf("%s  %6u Hz %5u samples %+7.1f ppm  latency %5.2f ms stall %5.1f ms  jitter %7.1f -> %6.1f us  drift %+5.2f ppm  rate error %5.2f ppm  relocks %u\n",
+		Result ? "FAIL" : "ok  ", SampleRate, BufferSize, Ppm, Latency / 1e6, StallInterval ? Stall / 1e6 : 0.0,
+		RawJitter / 1e3, FilteredJitter / 1e3, Slope, RateError, Clock.GetRelocks());
+
+	return Result;
+}
+
+/*****************************************************************************
+ * CheckRelock()
+ *****************************************************************************
+ * @brief
+ * A lost half second restarts the loop, which locks again.
+ */
+static int
+CheckRelock
+(
+	ULONG	SampleRate,
+	ULONG	BufferSize
+)
+{
+	CAsioClock Clock;
+
+	Clock.Initialize(SampleRate);
+
+	double TruePeriod = 1e9 / (SampleRate * (1.0 + 50.0 / 1e6));
+
+	ULONG Switches = ULONG(8.0 * SampleRate / BufferSize);
+
+	double Worst = 0;
+
+	for (ULONG i = 0; i < Switches; i++)
+	{
+		ULONGLONG SamplePosition = ULONGLONG(i) * BufferSize;
+
+		double TrueTime = SamplePosition * TruePeriod;
+
+		// The device clock is lost for half a second after 3 s.
+		if (TrueTime > 3e9)
+		{
+			TrueTime += 5e8;
+		}
+
+		ULONGLONG RawTime = ULONGLONG(TrueTime + 1e6 * Random());
+
+		ULONGLONG Time = Clock.Update(SamplePosition, RawTime);
+
+		if (TrueTime > 6e9)
+		{
+			double Error = fabs(double(LONGLONG(Time)) - TrueTime - 5e5);
+
+			if (Error > Worst)
+			{
+				Worst = Error;
+			}
+		}
+	}
+
+	int Result = ((Clock.GetRelocks() != 1) || (Worst > 2e5)) ? 1 : 0;
+
+	printf("%s  %6u Hz %5u samples  relock after a 500 ms gap  relocks %u  worst error %7.1f us\n",
+		Result ? "FAIL" : "ok  ", SampleRate, BufferSize, Clock.GetRelocks(), Worst / 1e3);
+
+	return Result;
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(
+	int		argc,
+	char **	argv
+)
+{
+	if (argc > 1)
+	{
+		FILE * File = fopen(argv[1], "r");
+
+		if (!File)
+		{
+			fprintf(stderr, "clockreplay: cannot open %s\n", argv[1]);
+			return 1;
+		}
+
+		int Result = Replay(File, (argc > 2) ? atoi(argv[2]) : 48000);
+
+		fclose(File);
+
+		return Result;
+	}
+
+	static const struct
+	{
+		ULONG	SampleRate;
+		ULONG	BufferSize;
+		double	Ppm;
+		double	Latency;		// ns
+		ULONG	StallInterval;	// switches
+		double	Stall;			// ns
+	} Traces[] =
+	{
+		{ 48000,   32,    0.0, 0.5e6,    0, 0     },	// small buffers, scheduler jitter
+		{ 48000,  256,  +80.0, 1.0e6,    0, 0     },	// fast device clock
+		{ 44100,  512,  -60.0, 2.0e6,    0, 0     },	// slow device clock
+		{ 96000,  128, +200.0, 1.0e6,    0, 0     },	// far off
+		{ 44100, 2048, +100.0, 15.0e6,   0, 0     },	// big buffers, 15 ms timer granularity
+		{ 48000,  128,  -30.0, 1.0e6, 1000, 10e6  },	// a late wake up every 1000 switches
+		{ 48000,  480,  +40.0, 1.0e6,  300, 8e6   },	// a late wake up every 3 s
+	};
+
+	srand(1);
+
+	int Result = 0;
+
+	for (ULONG t = 0; t < sizeof(Traces) / sizeof(Traces[0]); t++)
+	{
+		Result |= Check(Traces[t].SampleRate, Traces[t].BufferSize, Traces[t].Ppm, Traces[t].Latency, Traces[t].StallInterval, Traces[t].Stall, 60.0);
+	}
+
+	Result |= CheckRelock(48000, 256);
+
+	return Result;
+}
@@ -0,0 +1,243 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       convbench.cpp
+ * @brief      Checks and times the sample format conversion routines
+ *             (core/Convert.h).
+ * @details
+ * Convert.h is built here as is for x64, with tools/include standing in for
+ * the DDK headers. For each conversion pair, the routine that
+ * FindConversionRoutine() picks on this CPU is checked against the scalar
+ * reference (Copy32_16() and so on) on random samples, for every length up
+ * to 100 samples and then for a long block, so that the SIMD body and the
+ * scalar tail both have to be bit-exact. Then both are timed on a block of
+ * 4096 samples, and the throughput is given in GB/s of source samples.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux x64:
+ *
+ *     g++ -O2 -mssse3 -I../include -I../../driver/usbaud10/core -o convbench convbench.cpp
+ *     ./convbench
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Common.h"
+
+// As the driver's x64 build, and core/Audio.h, have them.
+#define _AMD64_
+
+typedef VOID (*AUDIO_CONVERSION_ROUTINE)(PUCHAR Destination, PUCHAR Source, ULONG NumberOfFrames);
+
+#include "Convert.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Samples per timed block. */
+#define BLOCK_SAMPLES				4096
+
+/*! @brief Bytes converted per timing, and timings of which the best is kept. */
+#define BYTES_PER_TIMING			(256 * 1024 * 1024)
+#define NUMBER_OF_TIMINGS			5
+
+/*****************************************************************************
+ * Conversion pairs
+ */
+/*! @brief A conversion pair and its scalar reference. */
+typedef struct
+{
+	ULONG						From;
+	ULONG						To;
+	AUDIO_CONVERSION_ROUTINE	Reference;
+} CONVERSION;
+
+static const CONVERSION Conversions[] =
+{
+	{ 32, 16, (AUDIO_CONVERSION_ROUTINE)Copy32_16 },
+	{ 32, 24, (AUDIO_CONVERSION_ROUTINE)Copy32_24 },
+	{ 24, 16, (AUDIO_CONVERSION_ROUTINE)Copy24_16 },
+	{ 24, 32, (AUDIO_CONVERSION_ROUTINE)Copy24_32 },
+	{ 16, 24, (AUDIO_CONVERSION_ROUTINE)Copy16_24 },
+	{ 16, 32, (AUDIO_CONVERSION_ROUTINE)Copy16_32 },
+};
+
+/*****************************************************************************
+ * Check()
+ *****************************************************************************
+ * @brief
+ * Fail the program if Condition does not hold.
+ */
+static void
+Check
+(
+	IN		bool			Condition,
+	IN		const char *	What
+)
+{
+	if (!Condition)
+	{
+		fprintf(stderr, "FAILED: %s\n", What);
+		exit(1);
+	}
+}
+
+/*****************************************************************************
+ * Now()
+ *****************************************************************************
+ * @brief
+ * Monotonic time in seconds.
+ */
+static double
+Now
+(	void
+)
+{
+	struct timespec Time;
+
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+
+	return Time.tv_sec + Time.tv_nsec * 1e-9;
+}
+
+/*****************************************************************************
+ * CheckExact()
+ *****************************************************************************
+ * @brief
+ * Compare Routine with the reference on NumberOfSamples random samples, at
+ * an odd offset into the buffers.
+ */
+static void
+CheckExact
+(
+	IN		const CONVERSION *			Conversion,
+	IN		AUDIO_CONVERSION_ROUTINE	Routine,
+	IN		ULONG						NumberOfSamples,
+	IN		unsigned int *				Seed
+)
+{
+	static UCHAR Src[BLOCK_SAMPLES * 4 + 64], Expected[BLOCK_SAMPLES * 4 + 64], Actual[BLOCK_SAMPLES * 4 + 64];
+
+	for (ULONG i = 0; i < sizeof(Src); i++) Src[i] = UCHAR(rand_r(Seed));
+
+	// Guard bytes past the end must be left alone.
+	memset(Expected, 0xA5, sizeof(Expected));
+	memset(Actual, 0xA5, sizeof(Actual));
+
+	Conversion->Reference(Expected + 1, Src + 3, NumberOfSamples);
+
+	Routine(Actual + 1, Src + 3, NumberOfSamples);
+
+	Check(!memcmp(Expected, Actual, sizeof(Expected)), "bit-exact with the scalar reference");
+}
+
+/*****************************************************************************
+ * Throughput()
+ *****************************************************************************
+ * @brief
+ * GB/s of source samples converted by Routine.
+ */
+static double
+Throughput
+(
+	IN		const CONVERSION *			Conversion,
+	IN		AUDIO_CONVERSION_ROUTINE	Routine
+)
+{
+	static UCHAR Src[BLOCK_SAMPLES * 4], Dst[BLOCK_SAMPLES * 4];
+
+	for (ULONG i = 0; i < sizeof(Src); i++) Src[i] = UCHAR(i * 131);
+
+	ULONG BlockBytes = BLOCK_SAMPLES * Conversion->From / 8;
+
+	ULONG Blocks = BYTES_PER_TIMING / BlockBytes;
+
+	double Best = 1e30;
+
+	for (ULONG Timing = 0; Timing < NUMBER_OF_TIMINGS; Timing++)
+	{
+		double Start = Now();
+
+		for (ULONG Block = 0; Block < Blocks; Block++)
+		{
+			Routine(Dst, Src, BLOCK_SAMPLES);
+
+			// Keep the stores.
+			__asm__ __volatile__("" : : "r"(Dst) : "memory");
+		}
+
+		double Elapsed = Now() - Start;
+
+		if (Elapsed < Best) Best = Elapsed;
+	}
+
+	return double(Blocks) * BlockBytes / Best / 1e9;
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(	void
+)
+{
+	ULONG Features = GetConversionFeatures();
+
+	printf("CPU: SSE2 %s, SSSE3 %s\n\n", (Features & CONVERSION_FEATURE_SSE2) ? "yes" : "no",
+		   (Features & CONVERSION_FEATURE_SSSE3) ? "yes" : "no");
+
+	printf("  pair      routine    scalar GB/s  selected GB/s\n");
+
+	unsigned int Seed = 1;
+
+	for (ULONG c = 0; c < sizeof(Conversions) / sizeof(Conversions[0]); c++)
+	{
+		const CONVERSION * Conversion = &Conversions[c];
+
+		AUDIO_CONVERSION_ROUTINE Routine = FindConversionRoutine(Conversion->From, Conversion->To);
+
+		Check(Routine != NULL, "a routine for every pair");
+
+		for (ULONG NumberOfSamples = 0; NumberOfSamples <= 100; NumberOfSamples++)
+		{
+			CheckExact(Conversion, Routine, NumberOfSamples, &Seed);
+		}
+
+		CheckExact(Conversion, Routine, BLOCK_SAMPLES, &Seed);
+
+		double Scalar = Throughput(Conversion, Conversion->Reference);
+
+		double Selected = Throughput(Conversion, Routine);
+
+		printf("  %2u -> %2u  %-9s %11.2f  %13.2f  (%.2fx)\n", Conversion->From, Conversion->To,
+			   (Routine == Conversion->Reference) ? "scalar" : "SIMD", Scalar, Selected, Selected / Scalar);
+	}
+
+	printf("PASSED\n");
+
+	return 0;
+}
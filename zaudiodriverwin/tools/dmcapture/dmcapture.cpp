@@ -0,0 +1,828 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       dmcapture.cpp
+ * @brief      Checks the DirectMusic capture packaging of the MIDI pin
+ *             (filter/midi/Pin.cpp).
+ * @details
+ * The frames are filled by the pin's own PackageDirectMusicEvents()
+ * (filter/midi/DmEvents.h), and the client puts the messages together with
+ * the driver's PackageMidiEvent() (core/MidiEvent.h) and MIDI parser
+ * (core/MidiParser.cpp), all built as is with tools/include standing in for
+ * the DDK headers. CMidiClient is too bound up with the kernel to build
+ * here, so CCaptureClient below stands in for it: its ReadBuffer() follows
+ * CMidiClient::ReadBuffer(), with the packets of the stream for the ring.
+ *
+ * A byte stream is cut in USB-MIDI packets as a device sends them, and the
+ * packets arrive with the bulk IN transfers, once per millisecond, at the
+ * rate of a MIDI DIN port. The pin's Process routine is run each time a
+ * transfer arrives and fills the capture frames, of a given size, until
+ * there is nothing more to read. Each frame is then checked:
+ *  - the events are QWORD aligned, within the frame, and not empty;
+ *  - rtDelta is 0 for the first event and never goes back;
+ *  - an event is never time stamped after it arrived;
+ *  - the structured events are the channel and system messages of the
+ *    stream, in order, and the others put the SysEx messages back together;
+ *  - no SysEx segment is longer than DMUS_SYSEX_SEGMENT_SIZE, and all but
+ *    the last of a message are that long (when the frame takes one).
+ *
+ * The time an event waits in the driver after it could be read, until its
+ * frame is done, is the added latency; the program fails if there is any.
+ * The old packaging, one event per frame read with all of the frame and a
+ * 1 ms sleep after a SysEx tail of 3 bytes or less, is run alongside for
+ * comparison, and what it fails is only reported.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -I../include -I../../driver/usbaud10/core -I../../driver/usbaud10/filter/midi -o dmcapture dmcapture.cpp ../../driver/usbaud10/core/MidiParser.cpp
+ *     ./dmcapture
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Common.h"
+#include "MidiEvent.h"
+#include "DmEvents.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Time stamp counter frequency (the ACPI timer). */
+#define TIME_STAMP_FREQUENCY		3579545
+
+/*! @brief Bytes per second of a MIDI DIN port. */
+#define MIDI_DIN_BYTE_RATE			3125
+
+/*! @brief Largest stream, in bytes. */
+#define MAX_STREAM_SIZE				(256 * 1024)
+
+/*! @brief Largest message, in bytes. */
+#define MAX_MESSAGE_SIZE			4096
+
+/*****************************************************************************
+ * Types
+ */
+/*! @brief The MIDI bytes of an USB-MIDI event packet, and when it arrived. */
+typedef struct
+{
+	LONGLONG	Time;		// time stamp counter
+	UCHAR		Bytes[3];
+	ULONG		Size;
+} PACKET;
+
+/*! @brief A MIDI message of the stream. */
+typedef struct
+{
+	ULONG		Offset;		// in the stream bytes
+	ULONG		Size;
+} MESSAGE;
+
+/*! @brief Stream. */
+typedef struct
+{
+	const char *	Name;
+	UCHAR *			Bytes;
+	ULONG			NumberOfBytes;
+	MESSAGE *		Messages;
+	ULONG			NumberOfMessages;
+	PACKET *		Packets;
+	ULONG			NumberOfPackets;
+} STREAM;
+
+/*! @brief Results of a run. */
+typedef struct
+{
+	ULONG		Frames;
+	ULONG		Events;
+	ULONG		MaxSegment;
+	LONGLONG	WorstLatency;	// time stamp counter
+	const char *	Failed;		// the first check that failed
+} RESULTS;
+
+/*****************************************************************************
+ * Classes
+ */
+/*****************************************************************************
+ *//*! @class CCaptureClient
+ *****************************************************************************
+ * @brief
+ * The input side of CMidiClient.
+ */
+class CCaptureClient
+{
+private:
+	CMidiQueue			m_MidiBytesQueue;
+	CMidiParser			m_MidiParser;
+	LONGLONG			m_SysExTimeStampCounter;
+
+	const STREAM *		m_Stream;
+	ULONG				m_Received;		// packets in the ring
+	ULONG				m_Removed;		// packets taken out of it
+	LONGLONG			m_ReadyTime;	// earliest an event read since ResetReadyTime() could have been
+
+	BOOL RemovePacket
+	(
+		OUT		PACKET *	OutPacket
+	)
+	{
+		if (m_Removed == m_Received) return FALSE;
+
+		*OutPacket = m_Stream->Packets[m_Removed++];
+
+		return TRUE;
+	}
+
+public:
+	CCaptureClient(const STREAM * Stream)
+	{
+		m_Stream = Stream;
+		m_SysExTimeStampCounter = 0;
+		m_Received = m_Removed = 0;
+		m_ReadyTime = -1;
+		m_MidiParser.ResetParser();
+	}
+
+	void ResetReadyTime
+	(	void
+	)
+	{
+		m_ReadyTime = -1;
+	}
+
+	LONGLONG GetReadyTime
+	(	void
+	)
+	{
+		return m_ReadyTime;
+	}
+
+	/*! @brief The bulk IN transfers up to Time are in. */
+	void Receive
+	(
+		IN		LONGLONG	Time
+	)
+	{
+		while ((m_Received < m_Stream->NumberOfPackets) && (m_Stream->Packets[m_Received].Time <= Time))
+		{
+			m_Received++;
+		}
+	}
+
+	/*! @brief Arrival of the next transfer, -1 if none. */
+	LONGLONG NextArrival
+	(	void
+	)
+	{
+		return (m_Received < m_Stream->NumberOfPackets) ? m_Stream->Packets[m_Received].Time : -1;
+	}
+
+	ULONG ReadBuffer
+	(
+		IN		PUCHAR		Buffer,
+		IN		ULONG		BufferLength,
+		OUT		LONGLONG *	OutTimeStampCounter,
+		OUT		ULONG *		OutStatus
+	);
+};
+
+/*****************************************************************************
+ * CCaptureClient::ReadBuffer()
+ *****************************************************************************
+ * @brief
+ * As CMidiClient::ReadBuffer().
+ */
+ULONG
+CCaptureClient::
+ReadBuffer
+(
+	IN		PUCHAR		Buffer,
+	IN		ULONG		BufferLength,
+	OUT		LONGLONG *	OutTimeStampCounter,
+	OUT		ULONG *		OutStatus
+)
+{
+	ULONG BytesRead = 0;
+
+	ULONG Status = 0;
+
+	if ((BytesRead + 3) <= BufferLength)
+	{
+		BOOL Continue = TRUE;
+
+		if (m_MidiBytesQueue.CanGetQueue())
+		{
+			LONGLONG TimeStampCounter = m_SysExTimeStampCounter;
+
+			BOOL Structured = TRUE;
+
+			BytesRead = PackageMidiEvent(&m_MidiParser, &m_SysExTimeStampCounter, &m_MidiBytesQueue, Buffer, BufferLength, &TimeStampCounter, &Structured);
+
+			if (BytesRead)
+			{
+				*OutTimeStampCounter = TimeStampCounter;
+
+				Status |= (Structured) ? MESSAGE_STATUS_STRUCTURED : 0;
+
+				Continue = FALSE;
+			}
+		}
+
+		if (Continue)
+		{
+			PACKET Packet;
+
+			while (RemovePacket(&Packet))
+			{
+				for (ULONG j=0; j<Packet.Size; j++)
+				{
+					m_MidiBytesQueue.PutQueue(Packet.Bytes[j]);
+				}
+
+				LONGLONG TimeStampCounter = Packet.Time;
+
+				BOOL Structured = TRUE;
+
+				BytesRead = PackageMidiEvent(&m_MidiParser, &m_SysExTimeStampCounter, &m_MidiBytesQueue, Buffer, BufferLength, &TimeStampCounter, &Structured);
+
+				if (BytesRead)
+				{
+					*OutTimeStampCounter = TimeStampCounter;
+
+					Status |= (Structured) ? MESSAGE_STATUS_STRUCTURED : 0;
+
+					break;
+				}
+			}
+		}
+	}
+
+	*OutStatus = Status;
+
+	if (BytesRead)
+	{
+		// The event is in the last packet taken out, or before.
+		LONGLONG ReadyTime = m_Stream->Packets[m_Removed-1].Time;
+
+		if ((m_ReadyTime < 0) || (ReadyTime < m_ReadyTime)) m_ReadyTime = ReadyTime;
+	}
+
+	return BytesRead;
+}
+
+/*****************************************************************************
+ * ToReferenceTime()
+ *****************************************************************************
+ * @brief
+ * Time stamp counter to 100ns, as the pin does it.
+ */
+static LONGLONG
+ToReferenceTime
+(
+	LONGLONG	TimeStampCounter
+)
+{
+	return LONGLONG(DOUBLE(TimeStampCounter) * 10000000 / DOUBLE(TIME_STAMP_FREQUENCY));
+}
+
+/*****************************************************************************
+ * PackageDirectMusicEventOld()
+ *****************************************************************************
+ * @brief
+ * The capture path of CMidiPin::_ProcessDirectMusicFormat() before: one
+ * event per frame, read with all of the frame, and a 1 ms sleep after a
+ * SysEx tail of 3 bytes or less.
+ */
+static ULONG
+PackageDirectMusicEventOld
+(
+	CCaptureClient *	MidiClient,
+	PUCHAR				Data,
+	ULONG				DataLength,
+	LONGLONG *			OutTimeStampCounter,
+	BOOL *				OutSleep
+)
+{
+	LPDMUS_EVENTHEADER EventHdr = LPDMUS_EVENTHEADER(Data);
+
+	ULONG BufferLength = DataLength - sizeof(DMUS_EVENTHEADER);
+
+	ULONG Status = 0;
+
+	ULONG BytesRead = MidiClient->ReadBuffer(PUCHAR(EventHdr + 1), BufferLength, OutTimeStampCounter, &Status);
+
+	*OutSleep = FALSE;
+
+	if (!BytesRead) return 0;
+
+	if ((Status & MESSAGE_STATUS_STRUCTURED) == 0)
+	{
+		if ((BufferLength > 3) && (BytesRead <= 3))
+		{
+			*OutSleep = TRUE;
+		}
+	}
+
+	EventHdr->cbEvent = BytesRead;
+	EventHdr->dwChannelGroup = 0;
+	EventHdr->rtDelta = 0;
+	EventHdr->dwFlags = (Status & MESSAGE_STATUS_STRUCTURED) ? DMUS_EVENT_STRUCTURED : 0;
+
+	return DMUS_EVENT_SIZE(BytesRead);
+}
+
+/*****************************************************************************
+ * Check()
+ *****************************************************************************
+ */
+static void
+Check
+(
+	RESULTS *		Results,
+	int				Condition,
+	const char *	What
+)
+{
+	if (!Condition && !Results->Failed)
+	{
+		Results->Failed = What;
+	}
+}
+
+/*****************************************************************************
+ *//*! @class CChecker
+ *****************************************************************************
+ * @brief
+ * Walks the events of the frames against the messages of the stream.
+ */
+class CChecker
+{
+private:
+	const STREAM *	m_Stream;
+	RESULTS *		m_Results;
+	ULONG			m_SegmentSize;
+	ULONG			m_Message;						// next message of the stream
+	UCHAR			m_SysEx[MAX_MESSAGE_SIZE];		// SysEx put back together
+	ULONG			m_SysExSize;
+	ULONG			m_LastSegmentSize;
+	LONGLONG		m_LastEventTime;				// 100ns
+
+public:
+	CChecker(const STREAM * Stream, RESULTS * Results, ULONG SegmentSize)
+	{
+		m_Stream = Stream;
+		m_Results = Results;
+		m_SegmentSize = SegmentSize;
+		m_Message = 0;
+		m_SysExSize = 0;
+		m_LastSegmentSize = SegmentSize;
+		m_LastEventTime = 0;
+	}
+
+	/*! @brief A frame of BytesUsed out of FrameSize, filled at ReadTime and
+	 * done at Done. ReadyTime is when the first of its events could have
+	 * been read. */
+	void Frame
+	(
+		PUCHAR		Data,
+		ULONG		BytesUsed,
+		ULONG		FrameSize,
+		LONGLONG	PresentationTime,
+		LONGLONG	ReadyTime,
+		LONGLONG	ReadTime,
+		LONGLONG	Done
+	)
+	{
+		Check(m_Results, BytesUsed <= FrameSize, "events within the frame");
+
+		m_Results->Frames++;
+
+		LONGLONG Latency = Done - ReadyTime;
+
+		if (Latency > m_Results->WorstLatency) m_Results->WorstLatency = Latency;
+
+		LONGLONG LastDelta = 0;
+
+		for (ULONG Offset = 0; Offset < BytesUsed; )
+		{
+			LPDMUS_EVENTHEADER EventHdr = LPDMUS_EVENTHEADER(Data + Offset);
+
+			Check(m_Results, (Offset % 8) == 0, "QWORD aligned event");
+			Check(m_Results, EventHdr->cbEvent > 0, "event not empty");
+			Check(m_Results, (Offset + DMUS_EVENT_SIZE(EventHdr->cbEvent)) <= BytesUsed, "event within the frame");
+
+			if (m_Results->Failed) return;
+
+			Check(m_Results, (Offset > 0) || (EventHdr->rtDelta == 0), "rtDelta 0 for the first event");
+			Check(m_Results, EventHdr->rtDelta >= LastDelta, "rtDelta in order");
+
+			LONGLONG EventTime = PresentationTime + EventHdr->rtDelta;
+
+			// The frame time and the delta are rounded each.
+			Check(m_Results, EventTime + 1 >= m_LastEventTime, "event times in order");
+			Check(m_Results, EventTime <= ToReferenceTime(ReadTime) + 1, "event not stamped after it arrived");
+
+			LastDelta = EventHdr->rtDelta;
+			m_LastEventTime = EventTime;
+
+			Event(PUCHAR(EventHdr + 1), EventHdr->cbEvent, EventHdr->dwFlags);
+
+			m_Results->Events++;
+
+			Offset += DMUS_EVENT_SIZE(EventHdr->cbEvent);
+		}
+	}
+
+	void Event
+	(
+		PUCHAR		Bytes,
+		ULONG		Size,
+		ULONG		Flags
+	)
+	{
+		if (Flags & DMUS_EVENT_STRUCTURED)
+		{
+			Check(m_Results, m_SysExSize == 0, "no message inside a SysEx message");
+			Check(m_Results, m_Message < m_Stream->NumberOfMessages, "no more messages than sent");
+
+			if (m_Results->Failed) return;
+
+			const MESSAGE * Message = &m_Stream->Messages[m_Message++];
+
+			Check(m_Results, (Size == Message->Size) && !memcmp(Bytes, m_Stream->Bytes + Message->Offset, Size), "message as sent");
+		}
+		else
+		{
+			if (Size > m_Results->MaxSegment) m_Results->MaxSegment = Size;
+
+			Check(m_Results, Size <= m_SegmentSize, "SysEx segment within the segment size");
+			Check(m_Results, m_LastSegmentSize == m_SegmentSize, "only the last SysEx segment is short");
+			Check(m_Results, (m_SysExSize + Size) <= MAX_MESSAGE_SIZE, "SysEx message size");
+
+			if (m_Results->Failed) return;
+
+			memcpy(m_SysEx + m_SysExSize, Bytes, Size); m_SysExSize += Size;
+
+			m_LastSegmentSize = Size;
+
+			if (Bytes[Size-1] == EOX)
+			{
+				Check(m_Results, m_Message < m_Stream->NumberOfMessages, "no more messages than sent");
+
+				if (m_Results->Failed) return;
+
+				const MESSAGE * Message = &m_Stream->Messages[m_Message++];
+
+				Check(m_Results, (m_SysExSize == Message->Size) && !memcmp(m_SysEx, m_Stream->Bytes + Message->Offset, m_SysExSize), "SysEx message as sent");
+
+				m_SysExSize = 0;
+				m_LastSegmentSize = m_SegmentSize;
+			}
+		}
+	}
+
+	void Done
+	(	void
+	)
+	{
+		Check(m_Results, (m_Message == m_Stream->NumberOfMessages) && (m_SysExSize == 0), "every message received");
+	}
+};
+
+/*****************************************************************************
+ * RunCapture()
+ *****************************************************************************
+ * @brief
+ * Runs the stream through the capture path, new (Now) or old.
+ */
+static void
+RunCapture
+(
+	const STREAM *	Stream,
+	ULONG			FrameSize,
+	int				Now,
+	RESULTS *		Results
+)
+{
+	memset(Results, 0, sizeof(*Results));
+
+	CCaptureClient MidiClient(Stream);
+
+	ULONG SegmentSize = DMUS_SYSEX_SEGMENT_SIZE;
+
+	if (Now)
+	{
+		while (DMUS_EVENT_SIZE(SegmentSize) > FrameSize) SegmentSize -= sizeof(ULONG);
+	}
+	else
+	{
+		SegmentSize = FrameSize - sizeof(DMUS_EVENTHEADER);
+	}
+
+	CChecker Checker(Stream, Results, SegmentSize);
+
+	PUCHAR Frame = (PUCHAR)malloc(FrameSize);
+
+	LONGLONG Clock = 0;
+
+	// Each bulk IN transfer kicks the Process routine, which runs until
+	// there is nothing more to read.
+	for (LONGLONG Arrival = MidiClient.NextArrival(); Arrival >= 0; Arrival = MidiClient.NextArrival())
+	{
+		if (Clock < Arrival) Clock = Arrival;
+
+		MidiClient.Receive(Clock);
+
+		for (;;)
+		{
+			LONGLONG TimeStampCounter = 0;
+
+			BOOL Sleep = FALSE;
+
+			memset(Frame, 0xCD, FrameSize);
+
+			MidiClient.ResetReadyTime();
+
+			ULONG BytesUsed = Now ? PackageDirectMusicEvents(&MidiClient, Frame, FrameSize, TIME_STAMP_FREQUENCY, &TimeStampCounter) :
+									PackageDirectMusicEventOld(&MidiClient, Frame, FrameSize, &TimeStampCounter, &Sleep);
+
+			if (!BytesUsed) break;
+
+			// All that was read had arrived by now.
+			LONGLONG ReadTime = Clock;
+
+			if (Sleep)
+			{
+				// KeWaitForSingleObject() for 1ms; the transfers keep coming in.
+				Clock += TIME_STAMP_FREQUENCY / 1000;
+
+				MidiClient.Receive(Clock);
+			}
+
+			Checker.Frame(Frame, BytesUsed, FrameSize, ToReferenceTime(TimeStampCounter), MidiClient.GetReadyTime(), ReadTime, Clock);
+
+			if (Results->Failed) break;
+		}
+
+		if (Results->Failed) break;
+	}
+
+	if (!Results->Failed) Checker.Done();
+
+	free(Frame);
+}
+
+/*****************************************************************************
+ * CStreamBuilder
+ *****************************************************************************
+ * @brief
+ * Builds a stream of messages and cuts it in USB-MIDI packets, sent at a
+ * byte rate and received in 1 ms bulk IN transfers.
+ */
+class CStreamBuilder
+{
+private:
+	STREAM *	m_Stream;
+	double		m_ByteRate;		// bytes per second
+	double		m_ByteTime;		// seconds
+
+	void Packet
+	(
+		const UCHAR *	Bytes,
+		ULONG			Size
+	)
+	{
+		m_ByteTime += double(Size) / m_ByteRate;
+
+		PACKET * Packet = &m_Stream->Packets[m_Stream->NumberOfPackets++];
+
+		// The transfer it goes in completes at the end of the frame.
+		Packet->Time = (LONGLONG(m_ByteTime * 1000) + 1) * TIME_STAMP_FREQUENCY / 1000;
+		Packet->Size = Size;
+		memcpy(Packet->Bytes, Bytes, Size);
+	}
+
+public:
+	CStreamBuilder(STREAM * Stream, const char * Name, double ByteRate)
+	{
+		m_Stream = Stream;
+		m_ByteRate = ByteRate;
+		m_Stream->Name = Name;
+		m_Stream->Bytes = (UCHAR *)malloc(MAX_STREAM_SIZE);
+		m_Stream->Messages = (MESSAGE *)malloc(MAX_STREAM_SIZE * sizeof(MESSAGE));
+		m_Stream->Packets = (PACKET *)malloc(MAX_STREAM_SIZE * sizeof(PACKET));
+		m_Stream->NumberOfBytes = m_Stream->NumberOfMessages = m_Stream->NumberOfPackets = 0;
+		m_ByteTime = 0;
+	}
+
+	void Message
+	(
+		const UCHAR *	Bytes,
+		ULONG			Size
+	)
+	{
+		MESSAGE * Message = &m_Stream->Messages[m_Stream->NumberOfMessages++];
+
+		Message->Offset = m_Stream->NumberOfBytes;
+		Message->Size = Size;
+
+		memcpy(m_Stream->Bytes + m_Stream->NumberOfBytes, Bytes, Size); m_Stream->NumberOfBytes += Size;
+
+		if (Bytes[0] == SYSEX)
+		{
+			for (ULONG i = 0; i < Size; i += 3)
+			{
+				Packet(Bytes + i, ((Size - i) < 3) ? (Size - i) : 3);
+			}
+		}
+		else
+		{
+			Packet(Bytes, Size);
+		}
+	}
+
+	void Note
+	(
+		ULONG	i
+	)
+	{
+		UCHAR Bytes[3] = { UCHAR(((i & 1) ? 0x80 : 0x90) | (i % 16)), UCHAR(36 + (i % 48)), UCHAR(1 + (i % 127)) };
+
+		Message(Bytes, 3);
+	}
+
+	void Controller
+	(
+		ULONG	i
+	)
+	{
+		UCHAR Bytes[3] = { UCHAR(0xB0 | (i % 16)), UCHAR(i % 120), UCHAR(i % 128) };
+
+		Message(Bytes, 3);
+	}
+
+	void Program
+	(
+		ULONG	i
+	)
+	{
+		UCHAR Bytes[2] = { UCHAR(0xC0 | (i % 16)), UCHAR(i % 128) };
+
+		Message(Bytes, 2);
+	}
+
+	void Clock
+	(	void
+	)
+	{
+		UCHAR Bytes[1] = { TIMING_CLOCK };
+
+		Message(Bytes, 1);
+	}
+
+	void SysEx
+	(
+		ULONG	Size,
+		ULONG	Seed
+	)
+	{
+		UCHAR Bytes[MAX_MESSAGE_SIZE];
+
+		Bytes[0] = SYSEX;
+
+		for (ULONG i = 1; i < (Size - 1); i++)
+		{
+			Bytes[i] = UCHAR((Seed + i * 7) & 0x7F);
+		}
+
+		Bytes[Size-1] = EOX;
+
+		Message(Bytes, Size);
+	}
+};
+
+/*****************************************************************************
+ * FreeStream()
+ *****************************************************************************
+ */
+static void
+FreeStream
+(
+	STREAM *	Stream
+)
+{
+	free(Stream->Bytes);
+	free(Stream->Messages);
+	free(Stream->Packets);
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(	void
+)
+{
+	STREAM Streams[5];
+
+	// Notes, controllers and program changes, with the MIDI clock, from a
+	// DIN port and from an USB controller that sends as fast as it can.
+	CStreamBuilder Performance(&Streams[0], "performance, DIN", MIDI_DIN_BYTE_RATE);
+	CStreamBuilder Burst(&Streams[3], "performance, 100x DIN", MIDI_DIN_BYTE_RATE * 100);
+
+	for (ULONG i = 0; i < 4000; i++)
+	{
+		if ((i % 8) == 0) { Performance.Clock(); Burst.Clock(); }
+
+		if ((i % 5) == 0) { Performance.Controller(i); Burst.Controller(i); }
+		else if ((i % 97) == 0) { Performance.Program(i); Burst.Program(i); }
+		else { Performance.Note(i); Burst.Note(i); }
+	}
+
+	// A dump of SysEx messages, of every length around the segment size,
+	// so that the tail of each message is anything from 1 to 44 bytes.
+	CStreamBuilder Dump(&Streams[1], "SysEx dump, DIN", MIDI_DIN_BYTE_RATE);
+
+	for (ULONG i = 0; i < 200; i++)
+	{
+		Dump.SysEx(2 + (i * 7) % 400, i);
+	}
+
+	// Short SysEx (identity replies) between the notes and the clock.
+	CStreamBuilder Mixed(&Streams[2], "mixed, DIN", MIDI_DIN_BYTE_RATE);
+	CStreamBuilder MixedBurst(&Streams[4], "mixed, 100x DIN", MIDI_DIN_BYTE_RATE * 100);
+
+	for (ULONG i = 0; i < 3000; i++)
+	{
+		if ((i % 6) == 0) { Mixed.Clock(); MixedBurst.Clock(); }
+
+		if ((i % 10) == 0) { Mixed.SysEx(6 + (i % 11), i); MixedBurst.SysEx(6 + (i % 11), i); }
+		else { Mixed.Note(i); MixedBurst.Note(i); }
+	}
+
+	static const ULONG FrameSizes[] = { 24, 48, 64, 256, 4096 };
+
+	int Failed = 0;
+
+	for (ULONG s = 0; s < sizeof(Streams) / sizeof(Streams[0]); s++)
+	{
+		printf("%s: %u messages, %u bytes\n", Streams[s].Name, Streams[s].NumberOfMessages, Streams[s].NumberOfBytes);
+
+		for (ULONG f = 0; f < sizeof(FrameSizes) / sizeof(FrameSizes[0]); f++)
+		{
+			printf(" %4u byte frames\n", FrameSizes[f]);
+
+			for (int Now = 0; Now <= 1; Now++)
+			{
+				RESULTS Results;
+
+				RunCapture(&Streams[s], FrameSizes[f], Now, &Results);
+
+				printf("  %-6s %6u frames %6u events %5.2f events/frame, SysEx segments up to %4u B, worst added latency %6.3f ms\n",
+					   Now ? "now" : "before", Results.Frames, Results.Events, Results.Frames ? double(Results.Events) / Results.Frames : 0.0,
+					   Results.MaxSegment, double(Results.WorstLatency) * 1000 / TIME_STAMP_FREQUENCY);
+
+				if (Now)
+				{
+					Check(&Results, Results.WorstLatency == 0, "no added latency");
+
+					Failed |= (Results.Failed != NULL);
+				}
+
+				if (Results.Failed)
+				{
+					printf("         %s: %s\n", Now ? "FAILED" : "fails", Results.Failed);
+				}
+			}
+		}
+
+		FreeStream(&Streams[s]);
+	}
+
+	printf(Failed ? "FAILED\n" : "PASSED\n");
+
+	return Failed ? 1 : 0;
+}
@@ -0,0 +1,334 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       enginereplay.cpp
+ * @brief      Replays packet completions into the ASIO buffer switch state
+ *             machine (asiodll/engine.cpp).
+ * @details
+ * With a file argument, each line of the file is a step:
+ *
+ *     init <output pin mask> <input pin mask> <active signal mask>
+ *     start
+ *     stop
+ *     out <pin> <packet>
+ *     in <pin> <packet>
+ *
+ * and the actions and masks are printed after each completion. Lines that
+ * start with '#' are comments.
+ *
+ * Without one, random completion orders are replayed for a set of pin
+ * configurations, and the buffer switches and input reads are checked: one
+ * of each per period, whatever order the pins complete in, and none while
+ * stopped.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -I../include -I../../asiodll -o enginereplay enginereplay.cpp ../../asiodll/engine.cpp
+ *     ./enginereplay [file]
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief NUMBER_OF_DATA_PACKETS in asiodll/asiodrv.h. */
+#define NUMBER_OF_DATA_PACKETS	8
+
+/*! @brief MAXIMUM_NUMBER_OF_PIN_DESCRIPTORS in asiodll/asiodrv.h. */
+#define MAXIMUM_PINS			8
+
+/*****************************************************************************
+ * Types
+ */
+typedef struct
+{
+	ULONG	Direction;
+	ULONG	PinIndex;
+	ULONG	PacketIndex;
+} COMPLETION;
+
+/*****************************************************************************
+ * Replay()
+ *****************************************************************************
+ * @brief
+ * Run the steps of a file.
+ */
+static int
+Replay
+(
+	FILE *	File
+)
+{
+	CAsioEngine Engine;
+
+	char Line[256];
+
+	for (ULONG LineNumber = 1; fgets(Line, sizeof(Line), File); LineNumber++)
+	{
+		char Command[16]; unsigned long A = 0, B = 0, C = 0;
+
+		int Fields = sscanf(Line, "%15s %li %li %li", Command, &A, &B, &C);
+
+		if ((Fields < 1) || (Command[0] == '#'))
+		{
+			continue;
+		}
+
+		if (!strcmp(Command, "init") && (Fields == 4))
+		{
+			Engine.Initialize(A, B, C);
+		}
+		else if (!strcmp(Command, "start"))
+		{
+			Engine.Start();
+		}
+		else if (!strcmp(Command, "stop"))
+		{
+			Engine.Stop();
+		}
+		else if ((!strcmp(Command, "out") || !strcmp(Command, "in")) && (Fields == 3) && (A < MAXIMUM_PINS))
+		{
+			ULONG Direction = !strcmp(Command, "in") ? ASIO_ENGINE_INPUT : ASIO_ENGINE_OUTPUT;
+
+			ULONG BufferIndex;
+
+			ULONG Actions = Engine.PacketComplete(Direction, A, B, &BufferIndex);
+
+			printf("%-3s %lu %lu -> buffer %u%s%s  SignalMask %x/%x  SignalPinMask out %x/%x in %x/%x\n",
+				Command, A, B, BufferIndex,
+				(Actions & ASIO_ENGINE_ACTION_READ_INPUT) ? "  read" : "",
+				(Actions & ASIO_ENGINE_ACTION_SWITCH) ? "  switch" : "",
+				Engine.GetSignalMask(0), Engine.GetSignalMask(1),
+				Engine.GetSignalPinMask(ASIO_ENGINE_OUTPUT, 0), Engine.GetSignalPinMask(ASIO_ENGINE_OUTPUT, 1),
+				Engine.GetSignalPinMask(ASIO_ENGINE_INPUT, 0), Engine.GetSignalPinMask(ASIO_ENGINE_INPUT, 1));
+		}
+		else
+		{
+			fprintf(stderr, "enginereplay: line %u: bad step: %s", LineNumber, Line);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*****************************************************************************
+ * Check()
+ *****************************************************************************
+ * @brief
+ * Replay Periods periods of completions in random order and check the
+ * actions. A pin may run one packet ahead of the others, as they do when
+ * their completions are serviced in arrival order.
+ */
+static int
+Check
+(
+	ULONG	OutputPinMask,
+	ULONG	InputPinMask,
+	ULONG	ActiveSignalMask,
+	ULONG	Periods,
+	BOOL	Running
+)
+{
+	CAsioEngine Engine;
+
+	Engine.Initialize(OutputPinMask, InputPinMask, ActiveSignalMask);
+
+	if (Running)
+	{
+		Engine.Start();
+	}
+
+	// The completions of all the periods, in order.
+	ULONG PinMask[2] = { OutputPinMask, InputPinMask };
+
+	COMPLETION * Completions = (COMPLETION *)malloc(Periods * 2 * MAXIMUM_PINS * sizeof(COMPLETION));
+
+	ULONG NumberOfCompletions = 0;
+
+	for (ULONG Period = 0; Period < Periods; Period++)
+	{
+		for (ULONG Direction = 0; Direction < 2; Direction++)
+		{
+			for (ULONG PinIndex = 0; PinIndex < MAXIMUM_PINS; PinIndex++)
+			{
+				if (PinMask[Direction] & (1<<PinIndex))
+				{
+					COMPLETION Completion = { Direction, PinIndex, Period % NUMBER_OF_DATA_PACKETS };
+
+					Completions[NumberOfCompletions++] = Completion;
+				}
+			}
+		}
+	}
+
+	ULONG PerPeriod = NumberOfCompletions / Periods;
+
+	// Shuffle within a period, then let some completions run ahead into the
+	// next period. A pin never gets two packets ahead of the slowest one.
+	for (ULONG Period = 0; Period < Periods; Period++)
+	{
+		COMPLETION * First = &Completions[Period * PerPeriod];
+
+		for (ULONG i = PerPeriod - 1; i > 0; i--)
+		{
+			ULONG j = rand() % (i + 1);
+
+			COMPLETION Temp = First[i]; First[i] = First[j]; First[j] = Temp;
+		}
+	}
+
+	for (ULONG Period = 0; Period + 1 < Periods; Period++)
+	{
+		COMPLETION * Last = &Completions[Period * PerPeriod + PerPeriod - 1];
+
+		if (rand() % 2)
+		{
+			// Swap the last of this period with the first of the next one,
+			// unless it is the same pin.
+			COMPLETION * Next = Last + 1;
+
+			if ((Last->Direction != Next->Direction) || (Last->PinIndex != Next->PinIndex))
+			{
+				COMPLETION Temp = *Last; *Last = *Next; *Next = Temp;
+			}
+		}
+	}
+
+	ULONG Switches = 0, Reads = 0;
+
+	int Result = 0;
+
+	for (ULONG i = 0; i < NumberOfCompletions; i++)
+	{
+		ULONG BufferIndex;
+
+		ULONG Actions = Engine.PacketComplete(Completions[i].Direction, Completions[i].PinIndex, Completions[i].PacketIndex, &BufferIndex);
+
+		if (Actions & ASIO_ENGINE_ACTION_READ_INPUT)
+		{
+			Reads++;
+		}
+
+		if (Actions & ASIO_ENGINE_ACTION_SWITCH)
+		{
+			// The switches alternate between the halves of the buffer.
+			if (BufferIndex != (Switches % 2))
+			{
+				Result = 1;
+			}
+
+			Switches++;
+		}
+	}
+
+	free(Completions);
+
+	ULONG ExpectedSwitches = (Running && ActiveSignalMask) ? Periods : 0;
+	ULONG ExpectedReads = (Running && InputPinMask) ? Periods : 0;
+
+	if ((Switches != ExpectedSwitches) || (Reads != ExpectedReads))
+	{
+		Result = 1;
+	}
+
+	// Nothing is left over once every pin has completed every period. (A
+	// direction the switches do not wait on stays set until the next switch.)
+	for (ULONG BufferIndex = 0; BufferIndex < 2; BufferIndex++)
+	{
+		if ((Engine.GetSignalMask(BufferIndex) & ActiveSignalMask) || Engine.GetSignalPinMask(0, BufferIndex) || Engine.GetSignalPinMask(1, BufferIndex))
+		{
+			Result = 1;
+		}
+	}
+
+	printf("%s  out %02x in %02x signal %x %-7s  switches %5u/%5u  reads %5u/%5u\n",
+		Result ? "FAIL" : "ok  ", OutputPinMask, InputPinMask, ActiveSignalMask, Running ? "running" : "stopped",
+		Switches, ExpectedSwitches, Reads, ExpectedReads);
+
+	return Result;
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(
+	int		argc,
+	char **	argv
+)
+{
+	if (argc > 1)
+	{
+		FILE * File = fopen(argv[1], "r");
+
+		if (!File)
+		{
+			fprintf(stderr, "enginereplay: cannot open %s\n", argv[1]);
+			return 1;
+		}
+
+		int Result = Replay(File);
+
+		fclose(File);
+
+		return Result;
+	}
+
+	static const struct
+	{
+		ULONG	OutputPinMask;
+		ULONG	InputPinMask;
+		ULONG	ActiveSignalMask;
+	} Configurations[] =
+	{
+		{ 0x01, 0x00, 0x1 },	// playback only
+		{ 0x00, 0x01, 0x2 },	// record only
+		{ 0x01, 0x01, 0x3 },	// duplex
+		{ 0x01, 0x01, 0x2 },	// duplex, synchronized to record only
+		{ 0x03, 0x01, 0x3 },	// two output pins
+		{ 0xFF, 0xFF, 0x3 },	// all pins
+		{ 0xA5, 0x5A, 0x3 },	// sparse pins
+	};
+
+	srand(1);
+
+	int Result = 0;
+
+	for (ULONG c = 0; c < sizeof(Configurations) / sizeof(Configurations[0]); c++)
+	{
+		for (ULONG Running = 0; Running < 2; Running++)
+		{
+			Result |= Check(Configurations[c].OutputPinMask, Configurations[c].InputPinMask, Configurations[c].ActiveSignalMask, 10000, Running);
+		}
+	}
+
+	return Result;
+}
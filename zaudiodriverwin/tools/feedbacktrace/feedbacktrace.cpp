@@ -0,0 +1,554 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       feedbacktrace.cpp
+ * @brief      Replays feedback endpoint traces into the rate estimator
+ *             (core/Feedback.h) and compares the packet sizes it yields with
+ *             those of the raw feedback.
+ * @details
+ * Feedback.h is built here as is, with tools/include standing in for the
+ * DDK headers. Each feedback value is decoded as CAudioSynchPipe::Service()
+ * decodes it (10.14 at full speed, 16.16 at high speed) and handed to a
+ * model of CAudioDataPipe::OnSampleRateSynchronization(), which either
+ * filters it (now) or takes it as the rate as long as a packet fits the
+ * endpoint (before). Output packets are sized from the rate as
+ * GetTransferSizeInFrames() sizes them, with the fraction carried from
+ * packet to packet.
+ *
+ * With a file argument, each line of the file is a feedback value as read
+ * from the endpoint, in decimal or 0x hexadecimal:
+ *
+ *     ./feedbacktrace trace.txt <sample rate> [fs|hs]
+ *
+ * and both rates and packet sizes are printed after each one, then the
+ * packet size variance of both. Lines that start with '#' are comments.
+ *
+ * Without one, synthetic traces are replayed. The device counts its sample
+ * clock and reports the frames counted since the last report, so the
+ * quantization and the jitter of its count cancel out over time, as they do
+ * on a real device; on top of that it drifts, and some traces carry glitched
+ * values 10% off. Against the frames the device really plays, the
+ * filtered rate must give packets of lower variance than the raw one, keep
+ * the device buffer within a packet of where it started (no under or
+ * overrun), and measure the clock ratio to within a few ppm.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -I../include -I../../driver/usbaud10/core -o feedbacktrace feedbacktrace.cpp
+ *     ./feedbacktrace [trace sample-rate [fs|hs]]
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Common.h"
+#include "Feedback.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Length of a synthetic trace, in seconds. */
+#define RUN_TIME			60
+
+/*! @brief Time left for the estimator to lock before the statistics start, in seconds. */
+#define LOCK_TIME			2
+
+/*****************************************************************************
+ * Types
+ */
+/*! @brief The feedback state of a data pipe. */
+typedef struct
+{
+	BOOL					Filter;				// filter the feedback (now) or not (before)
+	ULONG					MaximumPacketFrames;// m_PipeInformation.MaximumPacketSize in frames
+	ULONG					FfWhole;			// m_FfPerPacketInterval
+	ULONG					FfFraction;
+	ULONG					RunningFfFraction;	// m_RunningFfFraction
+	AUDIO_RATE_ESTIMATOR	RateEstimator;		// m_RateEstimator
+	ULONG					Rejected;
+} PIPE;
+
+/*! @brief Packet size statistics. */
+typedef struct
+{
+	double		Sum;
+	double		Squares;
+	ULONGLONG	Count;
+} STATISTICS;
+
+/*! @brief Result of a synthetic run. */
+typedef struct
+{
+	double		Variance;		// of the packet sizes, in frames^2
+	double		LevelMinimum;	// device buffer level against the level at lock, in frames
+	double		LevelMaximum;
+	ULONG		Excursions;		// packets with the level more than a packet off
+	double		RatioError;		// mean error of the clock ratio, in ppm
+	ULONG		Rejected;
+} RESULT;
+
+/*****************************************************************************
+ * InitPipe()
+ *****************************************************************************
+ * @brief
+ * Set the nominal rate up as CAudioDataPipe::SetFormat() does.
+ */
+static void
+InitPipe
+(
+	PIPE *	Pipe,
+	BOOL	Filter,
+	ULONG	SampleRate,
+	ULONG	PacketsPerMs
+)
+{
+	ULONGLONG FfPerPacketInterval = (ULONGLONG(SampleRate) << 16) / PacketsPerMs;
+
+	Pipe->Filter = Filter;
+	Pipe->FfWhole = ULONG(FfPerPacketInterval / (1000 << 16));
+	Pipe->FfFraction = ULONG(FfPerPacketInterval % (1000 << 16));
+	Pipe->RunningFfFraction = 0;
+	Pipe->Rejected = 0;
+
+	// Room for 1/8 more than nominal, as a typical endpoint has.
+	Pipe->MaximumPacketFrames = Pipe->FfWhole + Pipe->FfWhole / 8 + 1;
+
+	RateEstimatorInit(&Pipe->RateEstimator, (LONGLONG(Pipe->FfWhole) * AUDIO_FF_UNIT) + Pipe->FfFraction);
+}
+
+/*****************************************************************************
+ * DecodeFeedback()
+ *****************************************************************************
+ * @brief
+ * Split a feedback value as CAudioSynchPipe::Service() does.
+ */
+static void
+DecodeFeedback
+(
+	ULONG	TransferRate,
+	BOOL	HighSpeed,
+	ULONG *	OutWhole,
+	ULONG *	OutFraction
+)
+{
+	if (HighSpeed)
+	{
+		*OutWhole = TransferRate>>16; *OutFraction = ((TransferRate & 0xFFFF) * 1000);
+	}
+	else
+	{
+		TransferRate &= 0xFFFFFF;
+
+		*OutWhole = TransferRate>>14; *OutFraction = ((TransferRate & 0x3FFF) * 1000) << 2;
+	}
+}
+
+/*****************************************************************************
+ * OnFeedback()
+ *****************************************************************************
+ * @brief
+ * CAudioDataPipe::OnSampleRateSynchronization(), now or before.
+ */
+static void
+OnFeedback
+(
+	PIPE *	Pipe,
+	ULONG	FfWhole,
+	ULONG	FfFraction
+)
+{
+	if (FfWhole > Pipe->MaximumPacketFrames)
+	{
+		Pipe->Rejected++;
+		return;
+	}
+
+	if (!Pipe->Filter)
+	{
+		Pipe->FfWhole = FfWhole;
+		Pipe->FfFraction = FfFraction;
+		return;
+	}
+
+	LONGLONG Measured = (LONGLONG(FfWhole) * AUDIO_FF_UNIT) + FfFraction;
+
+	if (RateEstimatorUpdate(&Pipe->RateEstimator, Measured))
+	{
+		LONGLONG Rate = RateEstimatorRate(&Pipe->RateEstimator);
+
+		Pipe->FfWhole = ULONG(Rate / AUDIO_FF_UNIT);
+		Pipe->FfFraction = ULONG(Rate % AUDIO_FF_UNIT);
+	}
+}
+
+/*****************************************************************************
+ * NextPacketSize()
+ *****************************************************************************
+ * @brief
+ * CAudioDataPipe::GetTransferSizeInFrames(1, TRUE) without implicit feedback.
+ */
+static ULONG
+NextPacketSize
+(
+	PIPE *	Pipe
+)
+{
+	ULONG RunningFfFraction = Pipe->RunningFfFraction + Pipe->FfFraction;
+
+	ULONG TransferSizeInFrames = Pipe->FfWhole + (RunningFfFraction / (1000 << 16));
+
+	Pipe->RunningFfFraction = RunningFfFraction % (1000 << 16);
+
+	return TransferSizeInFrames;
+}
+
+/*****************************************************************************
+ * AddSample()
+ *****************************************************************************
+ */
+static void
+AddSample
+(
+	STATISTICS *	Statistics,
+	double			Value
+)
+{
+	Statistics->Sum += Value;
+	Statistics->Squares += Value * Value;
+	Statistics->Count++;
+}
+
+/*****************************************************************************
+ * Variance()
+ *****************************************************************************
+ */
+static double
+Variance
+(
+	const STATISTICS *	Statistics
+)
+{
+	if (!Statistics->Count)
+	{
+		return 0;
+	}
+
+	double Mean = Statistics->Sum / Statistics->Count;
+
+	return Statistics->Squares / Statistics->Count - Mean * Mean;
+}
+
+/*****************************************************************************
+ * Replay()
+ *****************************************************************************
+ * @brief
+ * Replay the feedback values in File, one packet per value.
+ */
+static int
+Replay
+(
+	FILE *	File,
+	ULONG	SampleRate,
+	BOOL	HighSpeed
+)
+{
+	PIPE Pipes[2];
+
+	for (ULONG p = 0; p < 2; p++)
+	{
+		InitPipe(&Pipes[p], p, SampleRate, HighSpeed ? 8 : 1);
+	}
+
+	STATISTICS Statistics[2];
+
+	memset(Statistics, 0, sizeof(Statistics));
+
+	char Line[256];
+
+	ULONG LineNumber = 0;
+
+	printf("#      value       raw rate  filtered rate   raw size  filtered size\n");
+
+	while (fgets(Line, sizeof(Line), File))
+	{
+		LineNumber++;
+
+		if ((Line[0] == '#') || (Line[0] == '\n') || (Line[0] == '\r'))
+		{
+			continue;
+		}
+
+		char * End;
+
+		ULONG Value = strtoul(Line, &End, 0);
+
+		if (End == Line)
+		{
+			fprintf(stderr, "feedbacktrace: line %u: bad value: %s", LineNumber, Line);
+			return 1;
+		}
+
+		ULONG Whole, Fraction, Size[2];
+
+		DecodeFeedback(Value, HighSpeed, &Whole, &Fraction);
+
+		for (ULONG p = 0; p < 2; p++)
+		{
+			OnFeedback(&Pipes[p], Whole, Fraction);
+
+			Size[p] = NextPacketSize(&Pipes[p]);
+
+			AddSample(&Statistics[p], Size[p]);
+		}
+
+		printf("%12lu %14.6f %14.6f %10lu %14lu\n", (unsigned long)Value,
+			Pipes[0].FfWhole + Pipes[0].FfFraction / double(AUDIO_FF_UNIT),
+			Pipes[1].FfWhole + Pipes[1].FfFraction / double(AUDIO_FF_UNIT),
+			(unsigned long)Size[0], (unsigned long)Size[1]);
+	}
+
+	printf("# packet size variance: raw %.4f, filtered %.4f frames^2, %u rejected\n",
+		Variance(&Statistics[0]), Variance(&Statistics[1]), Pipes[1].RateEstimator.Rejected);
+
+	return 0;
+}
+
+/*****************************************************************************
+ * Random()
+ *****************************************************************************
+ * @brief
+ * Uniform in [0, 1).
+ */
+static double
+Random
+(	void
+)
+{
+	return rand() / (RAND_MAX + 1.0);
+}
+
+/*****************************************************************************
+ * Trace description
+ */
+typedef struct
+{
+	const char *	Name;
+	ULONG			SampleRate;
+	BOOL			HighSpeed;
+	ULONG			Refresh;			// packets per feedback value
+	ULONG			ResolutionBits;		// fraction bits the device counts
+	double			Ppm;				// device clock off nominal
+	double			WanderPpm;			// and wandering around it, over 20 s
+	double			StepPpm;			// and stepping at half time
+	double			Jitter;				// of the counted position, in frames
+	ULONG			OutlierInterval;	// feedback values per glitch, 0 for none
+} TRACE;
+
+/*****************************************************************************
+ * Run()
+ *****************************************************************************
+ * @brief
+ * Replay a synthetic trace into a pipe, and follow the device buffer.
+ * @details
+ * The device plays Rate(t) frames per packet interval. Every Refresh
+ * packets, it reports the frames it counted since the last report, to
+ * ResolutionBits fraction bits, with its count read Jitter frames off.
+ */
+static void
+Run
+(
+	const TRACE *	Trace,
+	BOOL			Filter,
+	RESULT *		Result
+)
+{
+	ULONG PacketsPerMs = Trace->HighSpeed ? 8 : 1;
+
+	ULONG ValueBits = Trace->HighSpeed ? 16 : 14;
+
+	ULONG Packets = RUN_TIME * 1000 * PacketsPerMs;
+
+	ULONG LockPackets = LOCK_TIME * 1000 * PacketsPerMs;
+
+	double Nominal = double(Trace->SampleRate) / (1000.0 * PacketsPerMs);
+
+	PIPE Pipe;
+
+	InitPipe(&Pipe, Filter, Trace->SampleRate, PacketsPerMs);
+
+	srand(1);
+
+	STATISTICS Sizes;
+
+	memset(&Sizes, 0, sizeof(Sizes));
+
+	memset(Result, 0, sizeof(RESULT));
+
+	double Played = 0, Sent = 0, LevelAtLock = 0, RatioErrorSum = 0;
+
+	LONGLONG LastCount = 0;
+
+	ULONG Reports = 0;
+
+	for (ULONG i = 0; i < Packets; i++)
+	{
+		double Time = double(i) / (1000.0 * PacketsPerMs);
+
+		double Ppm = Trace->Ppm + Trace->WanderPpm * sin(2 * M_PI * Time / 20.0) + ((Time >= RUN_TIME / 2) ? Trace->StepPpm : 0);
+
+		double Rate = Nominal * (1.0 + Ppm * 1e-6);
+
+		// The device plays this packet interval, and now and then reports.
+		Played += Rate;
+
+		if ((i % Trace->Refresh) == Trace->Refresh - 1)
+		{
+			double Read = Played + Trace->Jitter * (2 * Random() - 1);
+
+			LONGLONG Count = LONGLONG(floor(ldexp(Read, Trace->ResolutionBits)));
+
+			ULONG Value = ULONG(((Count - LastCount) << (ValueBits - Trace->ResolutionBits)) / Trace->Refresh);
+
+			// What the division drops is reported next time.
+			LastCount += (LONGLONG(Value) * Trace->Refresh) >> (ValueBits - Trace->ResolutionBits);
+
+			if (Trace->OutlierInterval && ((++Reports % Trace->OutlierInterval) == 0))
+			{
+				Value += Value / 10;
+			}
+
+			ULONG Whole, Fraction;
+
+			DecodeFeedback(Value, Trace->HighSpeed, &Whole, &Fraction);
+
+			OnFeedback(&Pipe, Whole, Fraction);
+		}
+
+		// The host sends the next packet.
+		ULONG Size = NextPacketSize(&Pipe);
+
+		Sent += Size;
+
+		if (i < LockPackets)
+		{
+			LevelAtLock = Sent - Played;
+			continue;
+		}
+
+		AddSample(&Sizes, Size);
+
+		double Level = Sent - Played - LevelAtLock;
+
+		if (Level < Result->LevelMinimum) Result->LevelMinimum = Level;
+		if (Level > Result->LevelMaximum) Result->LevelMaximum = Level;
+
+		if (fabs(Level) > Nominal)
+		{
+			Result->Excursions++;
+		}
+
+		double Ratio = ldexp(double(RateEstimatorRatio(&Pipe.RateEstimator)), -AUDIO_CLOCK_RATIO_SHIFT);
+
+		RatioErrorSum += (Ratio - (1.0 + Ppm * 1e-6)) * 1e6;
+	}
+
+	Result->Variance = Variance(&Sizes);
+	Result->RatioError = RatioErrorSum / Sizes.Count;
+	Result->Rejected = Pipe.Rejected + Pipe.RateEstimator.Rejected;
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(
+	int		argc,
+	char **	argv
+)
+{
+	if (argc > 1)
+	{
+		FILE * File = fopen(argv[1], "r");
+
+		if (!File)
+		{
+			fprintf(stderr, "feedbacktrace: cannot open %s\n", argv[1]);
+			return 1;
+		}
+
+		ULONG SampleRate = (argc > 2) ? strtoul(argv[2], NULL, 0) : 48000;
+
+		BOOL HighSpeed = (argc > 3) && !strcmp(argv[3], "hs");
+
+		int Result = Replay(File, SampleRate, HighSpeed);
+
+		fclose(File);
+
+		return Result;
+	}
+
+	static const TRACE Traces[] =
+	{
+		//  name                     rate   hs  refresh bits    ppm wander   step  jitter outliers
+		{ "fine counter",          48000, FALSE,  1, 14, +100.0,   0.0,    0.0, 0.02,    0 },
+		{ "1/8 frame counter",     44100, FALSE,  1,  3,  -60.0,  40.0,    0.0, 0.05,    0 },
+		{ "noisy PLL",             96000, FALSE,  1, 14, +200.0,   0.0,    0.0, 0.40,    0 },
+		{ "glitches",              48000, FALSE,  1, 14,  -30.0,  20.0,    0.0, 0.10,  500 },
+		{ "high speed, 1 ms",      48000,  TRUE,  8, 16,  +50.0,   0.0,    0.0, 0.05,    0 },
+		{ "high speed, noisy",    192000,  TRUE,  1, 16, -150.0,  50.0,    0.0, 0.25,  200 },
+		{ "high speed, step",      44100,  TRUE,  8, 16,  +20.0,   0.0, +500.0, 0.10,    0 },
+	};
+
+	printf("trace                    rate     variance (frames^2)   level (frames)               excursions   ratio    rejected\n");
+	printf("                                   raw   filtered       raw            filtered        raw filt  error\n");
+
+	int Result = 0;
+
+	for (ULONG t = 0; t < sizeof(Traces) / sizeof(Traces[0]); t++)
+	{
+		RESULT Raw, Filtered;
+
+		Run(&Traces[t], FALSE, &Raw);
+
+		Run(&Traces[t], TRUE, &Filtered);
+
+		// The filter must not make the packets vary more, must hold the device
+		// buffer within a packet all along, and must measure the clock.
+		int Failed = (Filtered.Variance > Raw.Variance) || Filtered.Excursions || (fabs(Filtered.RatioError) > 5.0);
+
+		printf("%s  %-20s %6lu %s %8.4f %8.4f  %+6.1f..%+6.1f  %+6.1f..%+6.1f  %6u %4u %+6.2f ppm %4u\n",
+			Failed ? "FAIL" : "ok  ", Traces[t].Name, (unsigned long)Traces[t].SampleRate, Traces[t].HighSpeed ? "hs" : "fs",
+			Raw.Variance, Filtered.Variance, Raw.LevelMinimum, Raw.LevelMaximum, Filtered.LevelMinimum, Filtered.LevelMaximum,
+			Raw.Excursions, Filtered.Excursions, Filtered.RatioError, Filtered.Rejected);
+
+		Result |= Failed;
+	}
+
+	printf("%s\n", Result ? "FAILED" : "PASSED");
+
+	return Result;
+}
@@ -0,0 +1,754 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       fifostress.cpp
+ * @brief      Stress test and throughput benchmark of the audio client FIFO
+ *             (core/AudioRing.h).
+ * @details
+ * The frame counters of the CAudioClient FIFO are CAudioRing, in
+ * core/AudioRing.h, which is built here as is, with tools/include standing
+ * in for the DDK headers. The copies around it are done the way
+ * CAudioClient::AddFramesToFifo() and RemoveFramesFromFifo() do them.
+ *
+ * Stress: a producer thread (WriteBuffer()) and a consumer thread (the data
+ * pipe) run with no lock between them, in bursts of random size. Every
+ * sample carries the number of its frame, so the consumer checks that each
+ * frame arrives once, in order and untorn, and both sides keep a checksum.
+ * In the map runs the consumer also maps regions out of the ring as
+ * CAudioDataPipe::FlushBuffer() does, keeps up to AUDIO_CLIENT_MAX_FIFO_MAPPINGS
+ * of them as IRPs in flight, checks them again just before it unmaps them
+ * out of order, and so catches the producer overwriting a mapped frame.
+ *
+ * Benchmark: the same two threads move 1 ms blocks of 48 kHz audio as fast
+ * as they can, through the ring and through a model of the FIFO before,
+ * which took the client lock and wrapped its positions with a modulo.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -pthread -I../include -I../../driver/usbaud10/core -o fifostress fifostress.cpp
+ *     ./fifostress [frames]
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "Common.h"
+#include "AudioRing.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Default number of frames per stress run. */
+#define NUMBER_OF_FRAMES			5000000
+
+/*! @brief Frames per 1 ms block at 48 kHz. */
+#define FRAMES_PER_BLOCK			48
+
+/*****************************************************************************
+ * Check()
+ *****************************************************************************
+ * @brief
+ * Fail the program if Condition does not hold.
+ */
+static void
+Check
+(
+	IN		bool			Condition,
+	IN		const char *	What
+)
+{
+	if (!Condition)
+	{
+		fprintf(stderr, "FAILED: %s\n", What);
+		exit(1);
+	}
+}
+
+/*****************************************************************************
+ * Now()
+ *****************************************************************************
+ * @brief
+ * Monotonic time in seconds.
+ */
+static double
+Now
+(	void
+)
+{
+	struct timespec Time;
+
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+
+	return Time.tv_sec + Time.tv_nsec * 1e-9;
+}
+
+/*****************************************************************************
+ * Run state
+ */
+/*! @brief One producer/consumer run. */
+typedef struct
+{
+	CAudioRing		Ring;
+	PULONG			Buffer;				// ring buffer storage, Channels samples per frame
+	ULONG			Channels;
+	ULONGLONG		NumberOfFrames;
+	BOOL			Map;				// consumer maps regions as well
+	ULONGLONG		ProducerSum;
+	ULONGLONG		ConsumerSum;
+	ULONG			Mapped;				// regions mapped
+	ULONG			Full;				// producer found the ring full
+} AUDIO_RING_RUN;
+
+/*****************************************************************************
+ * Sample()
+ *****************************************************************************
+ * @brief
+ * Sample of a channel of a frame.
+ */
+static __forceinline
+ULONG
+Sample
+(
+	IN		ULONGLONG	Frame,
+	IN		ULONG		Channel
+)
+{
+	return ULONG(Frame * 2654435761u) ^ (Channel << 24);
+}
+
+/*****************************************************************************
+ * CheckFrames()
+ *****************************************************************************
+ * @brief
+ * Check Frames frames of the ring buffer from Count on, and add them up.
+ */
+static ULONGLONG
+CheckFrames
+(
+	IN		AUDIO_RING_RUN *	Run,
+	IN		ULONGLONG			Count,
+	IN		ULONG				Frames
+)
+{
+	ULONGLONG Sum = 0;
+
+	for (ULONG i = 0; i < Frames; i++)
+	{
+		PULONG Frame = Run->Buffer + Run->Ring.Position(Count + i) * Run->Channels;
+
+		for (ULONG ch = 0; ch < Run->Channels; ch++)
+		{
+			Check(Frame[ch] == Sample(Count + i, ch), "frame intact, in order, read once");
+
+			Sum += Frame[ch];
+		}
+	}
+
+	return Sum;
+}
+
+/*****************************************************************************
+ * ProducerThread()
+ *****************************************************************************
+ * @brief
+ * Write every frame once, in bursts, as CAudioClient::AddFramesToFifo().
+ */
+static void *
+ProducerThread
+(
+	IN		void *	Context
+)
+{
+	AUDIO_RING_RUN * Run = (AUDIO_RING_RUN *)Context;
+
+	unsigned int Seed = 1;
+
+	for (ULONGLONG Written = 0; Written < Run->NumberOfFrames; )
+	{
+		ULONGLONG WriteCount;
+
+		ULONG FramesAvailable = Run->Ring.BeginWrite(&WriteCount);
+
+		Check(WriteCount == Written, "write count");
+		Check(FramesAvailable <= Run->Ring.Size(), "free frames within the capacity");
+
+		ULONG FramesToWrite = 1 + rand_r(&Seed) % (Run->Ring.Size() / 2);
+
+		if (FramesToWrite > FramesAvailable) FramesToWrite = FramesAvailable;
+		if (FramesToWrite > (Run->NumberOfFrames - Written)) FramesToWrite = ULONG(Run->NumberOfFrames - Written);
+
+		if (FramesToWrite == 0)
+		{
+			Run->Full++;
+
+			sched_yield();
+
+			continue;
+		}
+
+		for (ULONG FramesWritten = 0; FramesWritten < FramesToWrite; )
+		{
+			ULONG Position = Run->Ring.Position(WriteCount);
+
+			ULONG Frames = Run->Ring.Contiguous(WriteCount, FramesToWrite - FramesWritten);
+
+			for (ULONG i = 0; i < Frames; i++)
+			{
+				for (ULONG ch = 0; ch < Run->Channels; ch++)
+				{
+					ULONG Value = Sample(WriteCount + i, ch);
+
+					Run->Buffer[(Position + i) * Run->Channels + ch] = Value;
+
+					Run->ProducerSum += Value;
+				}
+			}
+
+			WriteCount += Frames;
+
+			FramesWritten += Frames;
+		}
+
+		Run->Ring.EndWrite(WriteCount);
+
+		Written += FramesToWrite;
+
+		if (rand_r(&Seed) % 4 == 0) sched_yield();
+	}
+
+	return NULL;
+}
+
+/*****************************************************************************
+ * ConsumerThread()
+ *****************************************************************************
+ * @brief
+ * Read every frame once, as CAudioClient::RemoveFramesFromFifo() or, in the
+ * map runs, MapFramesInFifo() and UnmapFramesInFifo().
+ */
+static void *
+ConsumerThread
+(
+	IN		void *	Context
+)
+{
+	AUDIO_RING_RUN * Run = (AUDIO_RING_RUN *)Context;
+
+	unsigned int Seed = 2;
+
+	AUDIO_FIFO_MAPPING Mappings[AUDIO_CLIENT_MAX_FIFO_MAPPINGS];
+	ULONG MappedFrames[AUDIO_CLIENT_MAX_FIFO_MAPPINGS];
+	ULONG NumberOfMappings = 0;
+
+	ULONGLONG Read = 0;
+
+	while ((Read < Run->NumberOfFrames) || NumberOfMappings)
+	{
+		Check(Run->Ring.GetNumQueuedFrames() <= Run->Ring.Size(), "queued frames within the capacity");
+
+		// An IRP completes: unmap one of the regions, not always the oldest.
+		if (NumberOfMappings && ((NumberOfMappings == AUDIO_CLIENT_MAX_FIFO_MAPPINGS) || (Read == Run->NumberOfFrames) || (rand_r(&Seed) % 2)))
+		{
+			ULONG i = rand_r(&Seed) % NumberOfMappings;
+
+			Run->ConsumerSum += CheckFrames(Run, Mappings[i].MapCount, MappedFrames[i]);
+
+			Run->Ring.Unmap(&Mappings[i]);
+
+			NumberOfMappings--;
+
+			Mappings[i] = Mappings[NumberOfMappings];
+			MappedFrames[i] = MappedFrames[NumberOfMappings];
+		}
+
+		ULONG FramesToRead = 1 + rand_r(&Seed) % (Run->Ring.Size() / 4);
+
+		if (FramesToRead > (Run->NumberOfFrames - Read)) FramesToRead = ULONG(Run->NumberOfFrames - Read);
+
+		if (FramesToRead == 0)
+		{
+			continue;
+		}
+
+		if (Run->Map && (rand_r(&Seed) % 2))
+		{
+			ULONG Position;
+
+			if (Run->Ring.Map(FramesToRead, &Mappings[NumberOfMappings], &Position))
+			{
+				Check(Mappings[NumberOfMappings].MapCount == Read, "region mapped at the consume count");
+				Check(Position == Run->Ring.Position(Read), "region position");
+
+				MappedFrames[NumberOfMappings++] = FramesToRead;
+
+				Run->Mapped++;
+
+				Read += FramesToRead;
+
+				continue;
+			}
+		}
+
+		ULONGLONG ReadCount;
+
+		ULONG FramesQueued = Run->Ring.BeginRead(&ReadCount);
+
+		Check(ReadCount == Read, "consume count");
+
+		if (FramesToRead > FramesQueued) FramesToRead = FramesQueued;
+
+		if (FramesToRead == 0)
+		{
+			sched_yield();
+
+			continue;
+		}
+
+		for (ULONG FramesRead = 0; FramesRead < FramesToRead; )
+		{
+			ULONG Frames = Run->Ring.Contiguous(ReadCount, FramesToRead - FramesRead);
+
+			Run->ConsumerSum += CheckFrames(Run, ReadCount, Frames);
+
+			ReadCount += Frames;
+
+			FramesRead += Frames;
+		}
+
+		Run->Ring.EndRead(ReadCount);
+
+		Read += FramesToRead;
+
+		if (rand_r(&Seed) % 4 == 0) sched_yield();
+	}
+
+	return NULL;
+}
+
+/*****************************************************************************
+ * RunStress()
+ *****************************************************************************
+ * @brief
+ * One producer/consumer run against a FIFO of Size frames.
+ */
+static void
+RunStress
+(
+	IN		ULONG		Size,
+	IN		ULONG		Channels,
+	IN		ULONGLONG	NumberOfFrames,
+	IN		BOOL		Map
+)
+{
+	// As CAudioClient::SetFormat() sizes the storage.
+	ULONG StorageSize = 1;
+
+	while (StorageSize < Size)
+	{
+		StorageSize <<= 1;
+	}
+
+	static AUDIO_RING_RUN Run;
+
+	memset((void*)&Run, 0, sizeof(Run));
+
+	Run.Ring.Init(Size, StorageSize);
+	Run.Buffer = (PULONG)calloc(StorageSize, Channels * sizeof(ULONG));
+	Run.Channels = Channels;
+	Run.NumberOfFrames = NumberOfFrames;
+	Run.Map = Map;
+
+	Check(Run.Buffer != NULL, "ring buffer allocated");
+
+	pthread_t Producer, Consumer;
+
+	double Start = Now();
+
+	pthread_create(&Consumer, NULL, ConsumerThread, &Run);
+	pthread_create(&Producer, NULL, ProducerThread, &Run);
+
+	pthread_join(Producer, NULL);
+	pthread_join(Consumer, NULL);
+
+	double Seconds = Now() - Start;
+
+	Check(Run.Ring.GetNumQueuedFrames() == 0, "FIFO empty at the end");
+	Check(Run.Ring.GetNumAvailableFrames() == Size, "all the space given back at the end");
+	Check(Run.ProducerSum == Run.ConsumerSum, "checksums match");
+
+	printf("%6u frames, %2u ch%s: %llu frames in %.2f s, checksum %016llx, %u regions mapped, full %u times\n",
+		   Size, Channels, Map ? ", map" : "     ", (unsigned long long)NumberOfFrames, Seconds,
+		   (unsigned long long)Run.ConsumerSum, Run.Mapped, Run.Full);
+
+	free(Run.Buffer);
+}
+
+/*****************************************************************************
+ * CheckReset()
+ *****************************************************************************
+ * @brief
+ * A region mapped before CAudioClient::Reset() must not release a region
+ * mapped after it at the same count.
+ */
+static void
+CheckReset
+(	void
+)
+{
+	CAudioRing Ring;
+
+	Ring.Init(100, 128);
+
+	ULONGLONG WriteCount;
+
+	Ring.BeginWrite(&WriteCount);
+	Ring.EndWrite(WriteCount + 40);
+
+	AUDIO_FIFO_MAPPING Stale, Mapping;
+
+	ULONG Position;
+
+	Check(Ring.Map(20, &Stale, &Position) == TRUE, "map before reset");
+
+	Ring.Reset();
+
+	Ring.BeginWrite(&WriteCount);
+	Ring.EndWrite(WriteCount + 40);
+
+	Check(Ring.Map(20, &Mapping, &Position) == TRUE, "map after reset");
+	Check(Mapping.MapCount == Stale.MapCount, "same map count after reset");
+
+	Ring.Unmap(&Stale);
+
+	Check(Ring.GetNumAvailableFrames() == 60, "stale region ignored, new one still held");
+
+	Ring.Unmap(&Mapping);
+
+	Check(Ring.GetNumAvailableFrames() == 80, "new region released");
+
+	printf("reset: a region mapped before it leaves the new ones mapped\n");
+}
+
+/*****************************************************************************
+ * Benchmark state
+ */
+/*! @brief The FIFO before: client lock, modulo positions, write position starting at 1. */
+typedef struct
+{
+	pthread_mutex_t		Lock;
+	ULONG				ReadPosition;
+	ULONG				WritePosition;
+	ULONG				Size;		// capacity in frames, the storage has one more
+} OLD_FIFO;
+
+/*! @brief One benchmark run. */
+typedef struct
+{
+	BOOL				Old;
+	CAudioRing			Ring;
+	OLD_FIFO			OldFifo;
+	PUCHAR				Buffer;
+	ULONG				FrameSize;
+	ULONG				NumberOfBlocks;
+	PUCHAR				Block[2];	// producer's and consumer's
+} BENCH_RUN;
+
+/*****************************************************************************
+ * OldAvailable()/OldQueued()
+ *****************************************************************************
+ */
+static ULONG
+OldAvailable
+(
+	IN		OLD_FIFO *	Fifo
+)
+{
+	return (Fifo->ReadPosition + Fifo->Size + 1 - Fifo->WritePosition) % (Fifo->Size + 1);
+}
+
+static ULONG
+OldQueued
+(
+	IN		OLD_FIFO *	Fifo
+)
+{
+	return (Fifo->WritePosition + Fifo->Size + 1 - Fifo->ReadPosition - 1) % (Fifo->Size + 1);
+}
+
+/*****************************************************************************
+ * BenchProducer()
+ *****************************************************************************
+ */
+static void *
+BenchProducer
+(
+	IN		void *	Context
+)
+{
+	BENCH_RUN * Run = (BENCH_RUN *)Context;
+
+	for (ULONG Block = 0; Block < Run->NumberOfBlocks; )
+	{
+		ULONG FramesToWrite = FRAMES_PER_BLOCK;
+
+		BOOL Blocked = FALSE;
+
+		if (Run->Old)
+		{
+			OLD_FIFO * Fifo = &Run->OldFifo;
+
+			pthread_mutex_lock(&Fifo->Lock);
+
+			if (OldAvailable(Fifo) >= FramesToWrite)
+			{
+				for (ULONG i = 0; i < FramesToWrite; i++)
+				{
+					memcpy(Run->Buffer + ((Fifo->WritePosition + i) % (Fifo->Size + 1)) * Run->FrameSize, Run->Block[0] + i * Run->FrameSize, Run->FrameSize);
+				}
+
+				Fifo->WritePosition = (Fifo->WritePosition + FramesToWrite) % (Fifo->Size + 1);
+
+				Block++;
+			}
+			else
+			{
+				Blocked = TRUE;
+			}
+
+			pthread_mutex_unlock(&Fifo->Lock);
+		}
+		else
+		{
+			ULONGLONG WriteCount;
+
+			if (Run->Ring.BeginWrite(&WriteCount) >= FramesToWrite)
+			{
+				for (ULONG FramesWritten = 0; FramesWritten < FramesToWrite; )
+				{
+					ULONG Frames = Run->Ring.Contiguous(WriteCount, FramesToWrite - FramesWritten);
+
+					memcpy(Run->Buffer + Run->Ring.Position(WriteCount) * Run->FrameSize, Run->Block[0] + FramesWritten * Run->FrameSize, Frames * Run->FrameSize);
+
+					WriteCount += Frames;
+
+					FramesWritten += Frames;
+				}
+
+				Run->Ring.EndWrite(WriteCount);
+
+				Block++;
+			}
+			else
+			{
+				Blocked = TRUE;
+			}
+		}
+
+		// Full: let the consumer run.
+		if (Blocked) sched_yield();
+	}
+
+	return NULL;
+}
+
+/*****************************************************************************
+ * BenchConsumer()
+ *****************************************************************************
+ */
+static void *
+BenchConsumer
+(
+	IN		void *	Context
+)
+{
+	BENCH_RUN * Run = (BENCH_RUN *)Context;
+
+	for (ULONG Block = 0; Block < Run->NumberOfBlocks; )
+	{
+		ULONG FramesToRead = FRAMES_PER_BLOCK;
+
+		BOOL Blocked = FALSE;
+
+		if (Run->Old)
+		{
+			OLD_FIFO * Fifo = &Run->OldFifo;
+
+			pthread_mutex_lock(&Fifo->Lock);
+
+			if (OldQueued(Fifo) >= FramesToRead)
+			{
+				for (ULONG i = 0; i < FramesToRead; i++)
+				{
+					memcpy(Run->Block[1] + i * Run->FrameSize, Run->Buffer + ((Fifo->ReadPosition + i) % (Fifo->Size + 1)) * Run->FrameSize, Run->FrameSize);
+				}
+
+				Fifo->ReadPosition = (Fifo->ReadPosition + FramesToRead) % (Fifo->Size + 1);
+
+				Block++;
+			}
+			else
+			{
+				Blocked = TRUE;
+			}
+
+			pthread_mutex_unlock(&Fifo->Lock);
+		}
+		else
+		{
+			ULONGLONG ReadCount;
+
+			if (Run->Ring.BeginRead(&ReadCount) >= FramesToRead)
+			{
+				for (ULONG FramesRead = 0; FramesRead < FramesToRead; )
+				{
+					ULONG Frames = Run->Ring.Contiguous(ReadCount, FramesToRead - FramesRead);
+
+					memcpy(Run->Block[1] + FramesRead * Run->FrameSize, Run->Buffer + Run->Ring.Position(ReadCount) * Run->FrameSize, Frames * Run->FrameSize);
+
+					ReadCount += Frames;
+
+					FramesRead += Frames;
+				}
+
+				Run->Ring.EndRead(ReadCount);
+
+				Block++;
+			}
+			else
+			{
+				Blocked = TRUE;
+			}
+		}
+
+		// Empty: let the producer run.
+		if (Blocked) sched_yield();
+	}
+
+	return NULL;
+}
+
+/*****************************************************************************
+ * RunBench()
+ *****************************************************************************
+ * @brief
+ * Move NumberOfBlocks 1 ms blocks through the FIFO, before or now, and
+ * return the throughput in blocks per second.
+ */
+static double
+RunBench
+(
+	IN		BOOL	Old,
+	IN		ULONG	FrameSize,
+	IN		ULONG	NumberOfBlocks
+)
+{
+	// 100 ms at 48 kHz, as AUDIO_CLIENT_OUTPUT_BUFFERSIZE.
+	ULONG Size = 4800;
+
+	static BENCH_RUN Run;
+
+	memset((void*)&Run, 0, sizeof(Run));
+
+	Run.Old = Old;
+	Run.Ring.Init(Size, 8192);
+	Run.OldFifo.Size = Size;
+	Run.OldFifo.WritePosition = 1;
+	pthread_mutex_init(&Run.OldFifo.Lock, NULL);
+	Run.Buffer = (PUCHAR)calloc(8192 + 1, FrameSize);
+	Run.FrameSize = FrameSize;
+	Run.NumberOfBlocks = NumberOfBlocks;
+	Run.Block[0] = (PUCHAR)calloc(FRAMES_PER_BLOCK, FrameSize);
+	Run.Block[1] = (PUCHAR)calloc(FRAMES_PER_BLOCK, FrameSize);
+
+	pthread_t Producer, Consumer;
+
+	double Start = Now();
+
+	pthread_create(&Consumer, NULL, BenchConsumer, &Run);
+	pthread_create(&Producer, NULL, BenchProducer, &Run);
+
+	pthread_join(Producer, NULL);
+	pthread_join(Consumer, NULL);
+
+	double Seconds = Now() - Start;
+
+	pthread_mutex_destroy(&Run.OldFifo.Lock);
+
+	free(Run.Buffer);
+	free(Run.Block[0]);
+	free(Run.Block[1]);
+
+	return NumberOfBlocks / Seconds;
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(
+	int		argc,
+	char *	argv[]
+)
+{
+	ULONGLONG NumberOfFrames = (argc > 1) ? ULONGLONG(atoll(argv[1])) : NUMBER_OF_FRAMES;
+
+	// 20 ms input and 100 ms output FIFOs at 48 kHz, and a tiny one that
+	// wraps all the time.
+	static const ULONG Sizes[] = { 100, 960, 4800 };
+
+	for (ULONG s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++)
+	{
+		RunStress(Sizes[s], 2, NumberOfFrames, FALSE);
+		RunStress(Sizes[s], 2, NumberOfFrames, TRUE);
+	}
+
+	RunStress(4800, 16, NumberOfFrames / 4, TRUE);
+
+	CheckReset();
+
+	printf("\nThroughput, 1 ms blocks of 48 kHz 24-bit audio:\n");
+
+	static const ULONG Channels[] = { 2, 16 };
+
+	for (ULONG c = 0; c < sizeof(Channels) / sizeof(Channels[0]); c++)
+	{
+		ULONG FrameSize = Channels[c] * 3;
+
+		double Before = RunBench(TRUE, FrameSize, 1000000);
+		double After = RunBench(FALSE, FrameSize, 1000000);
+
+		printf("  %2u ch  before %6.2f M blocks/s %6.2f GB/s   now %6.2f M blocks/s %6.2f GB/s  (%.2fx)\n", Channels[c],
+			   Before / 1e6, Before * FRAMES_PER_BLOCK * FrameSize / 1e9,
+			   After / 1e6, After * FRAMES_PER_BLOCK * FrameSize / 1e9, After / Before);
+	}
+
+	printf("PASSED\n");
+
+	return 0;
+}
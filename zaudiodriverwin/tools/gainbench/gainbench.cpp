@@ -0,0 +1,625 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       gainbench.cpp
+ * @brief      Checks and times the software master volume gain stage
+ *             (core/Gain.h).
+ * @details
+ * Gain.h is built here as is, with tools/include standing in for the DDK
+ * headers, and driven the way CAudioClient::_CopyToFifo() drives it: a
+ * volume change ramps the running gains to the new ones over
+ * AUDIO_GAIN_RAMP_FRAMES with ConvertGain() and a gain step, then lands them
+ * on the target, and later blocks apply the steady gains.
+ *
+ * Checks: DecibelToGain() against 10^(dB/20) from 0 to -96 dB, and a ramp
+ * from unity to -20 dB on a full scale signal: it must move by at most one
+ * step per frame, never overshoot, and end on the target.
+ *
+ * Timing, in ns per frame, for 16, 24 and 32-bit samples and 2, 4 and 16
+ * channels, in place in 1 ms blocks of 48 frames, at -1 dB, best of several
+ * runs:
+ *  - before: a model of CAudioClient::VolumeMuteAdjustment() as it was,
+ *    which allocated a float buffer, called pow() for each channel and
+ *    converted to float and back on every block (16 and 24-bit only, it
+ *    took 32-bit samples as 24-bit);
+ *  - ramp: the blocks of a gain ramp;
+ *  - steady: the blocks after it.
+ *
+ * Last, the FIFO write path, from client samples to the FIFO format with
+ * the gain, for each client depth and FIFO depth of 16 or 24 bits. The
+ * single ConvertGain() pass is checked to be bit-exact with the conversion
+ * routine of Convert.h followed by the gain, and is timed, in GB/s of client
+ * samples, against the three passes it replaced: the conversion routine
+ * into the FIFO, then the float volume adjustment above, which went over the
+ * FIFO to float and back.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux x64:
+ *
+ *     g++ -O2 -mssse3 -I../include -I../../driver/usbaud10/core -o gainbench gainbench.cpp
+ *     ./gainbench
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "Common.h"
+
+// As the driver's x64 build, and core/Audio.h, have them.
+#define _AMD64_
+
+typedef VOID (*AUDIO_CONVERSION_ROUTINE)(PUCHAR Destination, PUCHAR Source, ULONG NumberOfFrames);
+
+#include "Convert.h"
+#include "Gain.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Frames per 1 ms block at 48 kHz. */
+#define FRAMES_PER_BLOCK			48
+
+/*! @brief Blocks per timing, and timings of which the best is kept. */
+#define NUMBER_OF_BLOCKS			40000
+#define NUMBER_OF_TIMINGS			7
+
+/*! @brief -20 dB, in 1/65536 dB as the master volume. */
+#define MINUS_20_DB					(-20 * 65536)
+
+/*****************************************************************************
+ * Check()
+ *****************************************************************************
+ * @brief
+ * Fail the program if Condition does not hold.
+ */
+static void
+Check
+(
+	IN		bool			Condition,
+	IN		const char *	What
+)
+{
+	if (!Condition)
+	{
+		fprintf(stderr, "FAILED: %s\n", What);
+		exit(1);
+	}
+}
+
+/*****************************************************************************
+ * Now()
+ *****************************************************************************
+ * @brief
+ * Monotonic time in ns.
+ */
+static double
+Now
+(	void
+)
+{
+	struct timespec Time;
+
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+
+	return Time.tv_sec * 1e9 + Time.tv_nsec;
+}
+
+/*****************************************************************************
+ * OldVolumeMuteAdjustment()
+ *****************************************************************************
+ * @brief
+ * Model of CAudioClient::VolumeMuteAdjustment() before the gain stage: the
+ * float buffer from the pool, dB2Amp() for each channel, and the
+ * ConvertIntData2Float()/ConvertFloatData2Int() passes.
+ */
+static void
+OldVolumeMuteAdjustment
+(
+	IN		PUCHAR	Buffer,
+	IN		ULONG	NumberOfFrames,
+	IN		ULONG	Channels,
+	IN		ULONG	Bits,
+	IN		LONG	MasterVolume
+)
+{
+	ULONG TotalSamples = NumberOfFrames * Channels;
+
+	float * FloatBuffer = (float *)malloc(sizeof(float) * TotalSamples);
+
+	if (!FloatBuffer) return;
+
+	float VolumeAmp[16];
+
+	for (ULONG ch = 0; ch < Channels; ch++)
+	{
+		VolumeAmp[ch] = powf(10.0f, float(MasterVolume) / (20.0f * 65536.0f));
+	}
+
+	if (Bits == 16)
+	{
+		for (ULONG i = 0; i < TotalSamples; i++) FloatBuffer[i] = float(((PSHORT)Buffer)[i]);
+	}
+	else
+	{
+		for (ULONG i = 0; i < TotalSamples; i++) FloatBuffer[i] = float((LONG(Buffer[i*3+2])<<24) | (LONG(Buffer[i*3+1])<<16) | (LONG(Buffer[i*3])<<8));
+	}
+
+	for (ULONG i = 0; i < TotalSamples; i += Channels)
+	{
+		for (ULONG ch = 0; ch < Channels; ch++)
+		{
+			FloatBuffer[i + ch] *= VolumeAmp[ch];
+		}
+	}
+
+	if (Bits == 16)
+	{
+		for (ULONG i = 0; i < TotalSamples; i++) ((PSHORT)Buffer)[i] = SHORT(LONGLONG(FloatBuffer[i]));
+	}
+	else
+	{
+		for (ULONG i = 0; i < TotalSamples; i++)
+		{
+			LONG Sample = LONG(LONGLONG(FloatBuffer[i]));
+
+			Buffer[i*3] = UCHAR(Sample>>8); Buffer[i*3+1] = UCHAR(Sample>>16); Buffer[i*3+2] = UCHAR(Sample>>24);
+		}
+	}
+
+	free(FloatBuffer);
+}
+
+/*****************************************************************************
+ * CheckDecibelToGain()
+ *****************************************************************************
+ */
+static void
+CheckDecibelToGain
+(	void
+)
+{
+	double MaxError = 0;
+
+	for (LONG Decibel = 0; Decibel >= -96 * 65536; Decibel -= 1024)
+	{
+		double Expected = pow(10.0, Decibel / (20.0 * 65536.0));
+
+		double Actual = double(DecibelToGain(Decibel)) / AUDIO_GAIN_UNITY;
+
+		double Error = fabs(20 * log10(Actual / Expected));
+
+		if (Error > MaxError) MaxError = Error;
+	}
+
+	Check(MaxError < 0.01, "DecibelToGain() within 0.01 dB");
+
+	printf("DecibelToGain(): 0 to -96 dB, max error %.5f dB\n", MaxError);
+}
+
+/*****************************************************************************
+ * CheckRamp()
+ *****************************************************************************
+ * @brief
+ * Ramp 2 channels of full scale 24-bit samples from unity to -20 dB, as
+ * CAudioClient::_UpdateGains(TRUE) and _CopyToFifo() do.
+ */
+static void
+CheckRamp
+(	void
+)
+{
+	const ULONG Frames = AUDIO_GAIN_RAMP_FRAMES + FRAMES_PER_BLOCK;
+
+	static UCHAR Src[Frames * 2 * 3], Dst[Frames * 2 * 3];
+
+	for (ULONG i = 0; i < Frames * 2; i++)
+	{
+		Src[i*3] = 0xFF; Src[i*3+1] = 0xFF; Src[i*3+2] = 0x7F;
+	}
+
+	LONG Gain[2] = { AUDIO_GAIN_UNITY, AUDIO_GAIN_UNITY };
+	LONG GainTarget[2], GainStep[2];
+
+	for (ULONG ch = 0; ch < 2; ch++)
+	{
+		GainTarget[ch] = DecibelToGain(MINUS_20_DB);
+		GainStep[ch] = (GainTarget[ch] - Gain[ch]) / AUDIO_GAIN_RAMP_FRAMES;
+	}
+
+	AUDIO_CONVERT_GAIN_ROUTINE ConvertGainRoutine = FindConvertGainRoutine(24, 24, 2);
+
+	Check(ConvertGainRoutine != NULL, "routine for 24-bit stereo");
+
+	// The ramp, in blocks, then the steady gains.
+	ULONG RampFrames = AUDIO_GAIN_RAMP_FRAMES;
+
+	for (ULONG Frame = 0; Frame < Frames; Frame += FRAMES_PER_BLOCK)
+	{
+		ULONG BlockFrames = FRAMES_PER_BLOCK;
+
+		ULONG Offset = Frame * 2 * 3;
+
+		if (RampFrames)
+		{
+			ULONG Ramp = (BlockFrames > RampFrames) ? RampFrames : BlockFrames;
+
+			ConvertGainRoutine(Dst + Offset, Src + Offset, Ramp, 2, Gain, GainStep);
+
+			RampFrames -= Ramp;
+
+			if (RampFrames == 0) memcpy(Gain, GainTarget, sizeof(Gain));
+
+			Offset += Ramp * 2 * 3;
+
+			BlockFrames -= Ramp;
+		}
+
+		if (BlockFrames)
+		{
+			ConvertGainRoutine(Dst + Offset, Src + Offset, BlockFrames, 2, Gain, NULL);
+		}
+	}
+
+	LONG Full = 0x7FFFFF;
+	LONG Target = ScaleSample(Full, GainTarget[0]);
+	LONG MaxStep = LONG((LONGLONG(Full) * -GainStep[0]) >> AUDIO_GAIN_SHIFT) + 1;
+	LONG Previous = Full;
+
+	for (ULONG i = 0; i < Frames * 2; i++)
+	{
+		LONG Sample = (LONG(Dst[i*3+2])<<24 | LONG(Dst[i*3+1])<<16 | LONG(Dst[i*3])<<8) >> 8;
+
+		Check(Sample <= Previous, "ramp never goes back up");
+		Check((Previous - Sample) <= MaxStep, "ramp moves at most a step per frame");
+		Check(Sample >= Target, "ramp doesn't overshoot");
+
+		if ((i / 2) >= AUDIO_GAIN_RAMP_FRAMES)
+		{
+			Check(Sample == Target, "on the target after the ramp");
+		}
+
+		if (i & 1) Previous = Sample;
+	}
+
+	printf("Ramp: unity to -20 dB over %u frames, at most %d LSB per frame, lands on %d\n", AUDIO_GAIN_RAMP_FRAMES, MaxStep, Target);
+}
+
+/*****************************************************************************
+ * TimeGain()
+ *****************************************************************************
+ * @brief
+ * ns per frame of a block of ConvertGain(), with or without a gain step.
+ */
+static double
+TimeGain
+(
+	IN		ULONG	Bits,
+	IN		ULONG	Channels,
+	IN		BOOL	Ramp
+)
+{
+	ULONG FrameSize = Channels * Bits / 8;
+
+	PUCHAR Buffer = (PUCHAR)calloc(FRAMES_PER_BLOCK, FrameSize);
+
+	for (ULONG i = 0; i < FRAMES_PER_BLOCK * FrameSize; i++) Buffer[i] = UCHAR(i * 37);
+
+	AUDIO_CONVERT_GAIN_ROUTINE ConvertGainRoutine = FindConvertGainRoutine(Bits, Bits, Channels);
+
+	LONG Gain[16], GainStep[16];
+
+	double Best = 1e30;
+
+	for (ULONG Timing = 0; Timing < NUMBER_OF_TIMINGS; Timing++)
+	{
+		double Start = Now();
+
+		for (ULONG Block = 0; Block < NUMBER_OF_BLOCKS; Block++)
+		{
+			// Restart the ramp each time round so that the gains stay sane.
+			if ((Block % (AUDIO_GAIN_RAMP_FRAMES / FRAMES_PER_BLOCK)) == 0)
+			{
+				for (ULONG ch = 0; ch < Channels; ch++)
+				{
+					Gain[ch] = DecibelToGain(-65536);
+					GainStep[ch] = (DecibelToGain(MINUS_20_DB) - Gain[ch]) / AUDIO_GAIN_RAMP_FRAMES;
+				}
+			}
+
+			ConvertGainRoutine(Buffer, Buffer, FRAMES_PER_BLOCK, Channels, Gain, Ramp ? GainStep : NULL);
+		}
+
+		double Elapsed = Now() - Start;
+
+		if (Elapsed < Best) Best = Elapsed;
+	}
+
+	free(Buffer);
+
+	return Best / (double(NUMBER_OF_BLOCKS) * FRAMES_PER_BLOCK);
+}
+
+/*****************************************************************************
+ * TimeOld()
+ *****************************************************************************
+ * @brief
+ * ns per frame of a block of the model of the volume adjustment before.
+ */
+static double
+TimeOld
+(
+	IN		ULONG	Bits,
+	IN		ULONG	Channels
+)
+{
+	ULONG FrameSize = Channels * Bits / 8;
+
+	PUCHAR Buffer = (PUCHAR)calloc(FRAMES_PER_BLOCK, FrameSize);
+
+	for (ULONG i = 0; i < FRAMES_PER_BLOCK * FrameSize; i++) Buffer[i] = UCHAR(i * 37);
+
+	double Best = 1e30;
+
+	for (ULONG Timing = 0; Timing < NUMBER_OF_TIMINGS; Timing++)
+	{
+		double Start = Now();
+
+		for (ULONG Block = 0; Block < NUMBER_OF_BLOCKS; Block++)
+		{
+			OldVolumeMuteAdjustment(Buffer, FRAMES_PER_BLOCK, Channels, Bits, -65536);
+		}
+
+		double Elapsed = Now() - Start;
+
+		if (Elapsed < Best) Best = Elapsed;
+	}
+
+	free(Buffer);
+
+	return Best / (double(NUMBER_OF_BLOCKS) * FRAMES_PER_BLOCK);
+}
+
+/*****************************************************************************
+ * FIFO write paths
+ */
+/*! @brief How the client samples get into the FIFO. */
+typedef enum { COPY_FUSED, COPY_THREE_PASS, COPY_CONVERT_THEN_GAIN } COPY_PATH;
+
+/*! @brief Routines of a FIFO write path, found once, as CAudioClient::SetFormat() does. */
+typedef struct
+{
+	ULONG						ClientBits;
+	ULONG						FifoBits;
+	ULONG						Channels;
+	AUDIO_CONVERSION_ROUTINE	ConversionRoutine;	// NULL if the depths are the same
+	AUDIO_CONVERT_GAIN_ROUTINE	FusedRoutine;		// client depth to FIFO depth
+	AUDIO_CONVERT_GAIN_ROUTINE	GainRoutine;		// FIFO depth in place
+} FIFO_FORMAT;
+
+/*****************************************************************************
+ * SetFifoFormat()
+ *****************************************************************************
+ */
+static void
+SetFifoFormat
+(
+	OUT		FIFO_FORMAT *	Format,
+	IN		ULONG			ClientBits,
+	IN		ULONG			FifoBits,
+	IN		ULONG			Channels
+)
+{
+	Format->ClientBits = ClientBits;
+	Format->FifoBits = FifoBits;
+	Format->Channels = Channels;
+	Format->ConversionRoutine = (ClientBits != FifoBits) ? FindConversionRoutine(ClientBits, FifoBits) : NULL;
+	Format->FusedRoutine = FindConvertGainRoutine(ClientBits, FifoBits, Channels);
+	Format->GainRoutine = FindConvertGainRoutine(FifoBits, FifoBits, Channels);
+}
+
+/*****************************************************************************
+ * CopyToFifo()
+ *****************************************************************************
+ * @brief
+ * The FIFO write path, from client samples to the FIFO: one ConvertGain()
+ * pass, or the conversion routine and the float volume adjustment of
+ * before, or the conversion routine and ConvertGain() in place, which the
+ * fused pass must match.
+ */
+static void
+CopyToFifo
+(
+	IN		COPY_PATH		Path,
+	IN		FIFO_FORMAT *	Format,
+	IN		PUCHAR			Fifo,
+	IN		PUCHAR			Client,
+	IN		PLONG			Gain
+)
+{
+	if (Path == COPY_FUSED)
+	{
+		Format->FusedRoutine(Fifo, Client, FRAMES_PER_BLOCK, Format->Channels, Gain, NULL);
+
+		return;
+	}
+
+	if (Format->ConversionRoutine)
+	{
+		Format->ConversionRoutine(Fifo, Client, FRAMES_PER_BLOCK * Format->Channels);
+	}
+	else
+	{
+		memcpy(Fifo, Client, FRAMES_PER_BLOCK * Format->Channels * Format->FifoBits / 8);
+	}
+
+	if (Path == COPY_THREE_PASS)
+	{
+		OldVolumeMuteAdjustment(Fifo, FRAMES_PER_BLOCK, Format->Channels, Format->FifoBits, -65536);
+	}
+	else
+	{
+		Format->GainRoutine(Fifo, Fifo, FRAMES_PER_BLOCK, Format->Channels, Gain, NULL);
+	}
+}
+
+/*****************************************************************************
+ * TimeCopy()
+ *****************************************************************************
+ * @brief
+ * GB/s of client samples through a FIFO write path.
+ */
+static double
+TimeCopy
+(
+	IN		COPY_PATH		Path,
+	IN		FIFO_FORMAT *	Format
+)
+{
+	static UCHAR Client[FRAMES_PER_BLOCK * 16 * 4], Fifo[FRAMES_PER_BLOCK * 16 * 4];
+
+	for (ULONG i = 0; i < sizeof(Client); i++) Client[i] = UCHAR(i * 37);
+
+	LONG Gain[16];
+
+	for (ULONG ch = 0; ch < 16; ch++) Gain[ch] = DecibelToGain(-65536);
+
+	double Best = 1e30;
+
+	for (ULONG Timing = 0; Timing < NUMBER_OF_TIMINGS; Timing++)
+	{
+		double Start = Now();
+
+		for (ULONG Block = 0; Block < NUMBER_OF_BLOCKS; Block++)
+		{
+			CopyToFifo(Path, Format, Fifo, Client, Gain);
+		}
+
+		double Elapsed = Now() - Start;
+
+		if (Elapsed < Best) Best = Elapsed;
+	}
+
+	// Best is in ns, so this is bytes per ns.
+	return double(NUMBER_OF_BLOCKS) * FRAMES_PER_BLOCK * Format->Channels * Format->ClientBits / 8 / Best;
+}
+
+/*****************************************************************************
+ * CheckFused()
+ *****************************************************************************
+ * @brief
+ * The fused pass must give the same FIFO samples as the conversion routine
+ * followed by the gain.
+ */
+static void
+CheckFused
+(
+	IN		FIFO_FORMAT *	Format
+)
+{
+	static UCHAR Client[FRAMES_PER_BLOCK * 16 * 4], Expected[FRAMES_PER_BLOCK * 16 * 4], Actual[FRAMES_PER_BLOCK * 16 * 4];
+
+	unsigned int Seed = Format->ClientBits * 100 + Format->FifoBits + Format->Channels;
+
+	for (ULONG i = 0; i < sizeof(Client); i++) Client[i] = UCHAR(rand_r(&Seed));
+
+	LONG Gain[16];
+
+	for (ULONG ch = 0; ch < 16; ch++) Gain[ch] = DecibelToGain(-LONG(ch) * 3 * 65536 - 65536);
+
+	memset(Expected, 0, sizeof(Expected));
+	memset(Actual, 0, sizeof(Actual));
+
+	CopyToFifo(COPY_CONVERT_THEN_GAIN, Format, Expected, Client, Gain);
+
+	CopyToFifo(COPY_FUSED, Format, Actual, Client, Gain);
+
+	Check(!memcmp(Expected, Actual, sizeof(Expected)), "fused pass bit-exact with the conversion then the gain");
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(	void
+)
+{
+	CheckDecibelToGain();
+
+	CheckRamp();
+
+	printf("\nns per frame, 1 ms blocks of %u frames, in place:\n", FRAMES_PER_BLOCK);
+	printf("  bits  ch    before      ramp    steady\n");
+
+	static const ULONG Bits[] = { 16, 24, 32 };
+	static const ULONG Channels[] = { 2, 4, 16 };
+
+	for (ULONG b = 0; b < sizeof(Bits) / sizeof(Bits[0]); b++)
+	{
+		for (ULONG c = 0; c < sizeof(Channels) / sizeof(Channels[0]); c++)
+		{
+			char Before[16] = "        -";
+
+			if (Bits[b] != 32)
+			{
+				snprintf(Before, sizeof(Before), "%9.2f", TimeOld(Bits[b], Channels[c]));
+			}
+
+			printf("  %4u  %2u %s %9.2f %9.2f\n", Bits[b], Channels[c], Before,
+				   TimeGain(Bits[b], Channels[c], TRUE), TimeGain(Bits[b], Channels[c], FALSE));
+		}
+	}
+
+	printf("\nFIFO write path, GB/s of client samples, 1 ms blocks at -1 dB:\n");
+	printf("  client  FIFO  ch  three-pass     fused\n");
+
+	static const ULONG FifoBits[] = { 16, 24 };
+
+	for (ULONG f = 0; f < sizeof(FifoBits) / sizeof(FifoBits[0]); f++)
+	{
+		for (ULONG b = 0; b < sizeof(Bits) / sizeof(Bits[0]); b++)
+		{
+			for (ULONG c = 0; c < sizeof(Channels) / sizeof(Channels[0]); c++)
+			{
+				FIFO_FORMAT Format;
+
+				SetFifoFormat(&Format, Bits[b], FifoBits[f], Channels[c]);
+
+				CheckFused(&Format);
+
+				double ThreePass = TimeCopy(COPY_THREE_PASS, &Format);
+
+				double Fused = TimeCopy(COPY_FUSED, &Format);
+
+				printf("  %6u  %4u  %2u  %10.2f  %8.2f  (%.2fx)\n", Bits[b], FifoBits[f], Channels[c], ThreePass, Fused, Fused / ThreePass);
+			}
+		}
+	}
+
+	printf("PASSED\n");
+
+	return 0;
+}
@@ -0,0 +1,347 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       Common.h
+ * @brief      Stands in for the driver's Common.h so that kernel mode
+ *             sources build as user mode programs on Linux.
+ * @details
+ * Shared by the host tools, on top of windows.h. Only what those sources
+ * use is here. The Zw file functions are mapped to stdio, the pool to
+ * malloc(). WCHAR must be 16-bit as on Windows, so sources that use wide
+ * strings must be built with -fshort-wchar; the C library's wide string
+ * functions are then no use and are replaced below.
+ *
+ * Sources that talk to the USB stack (core/UsbDev.cpp, core/Audio.cpp) need
+ * the kernel as well: define TOOLS_KERNEL and add -I../../driver/include
+ * to get wdm.h, stdunk.h, ks.h, CList.h and dbgtrace.h as the driver's
+ * Common.h has them. See wdm.h for what that kernel is.
+ *//*
+ *****************************************************************************
+ */
+#ifndef _TOOLS_COMMON_H_
+#define _TOOLS_COMMON_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "windows.h"
+
+#define PLATFORM_UNIX	1
+
+/*****************************************************************************
+ * Types
+ */
+typedef LONG			NTSTATUS;
+typedef ULONG			ACCESS_MASK;
+typedef LONGLONG		REFERENCE_TIME;
+
+/*****************************************************************************
+ * Status
+ */
+#define STATUS_SUCCESS					((NTSTATUS)0x00000000)
+#define STATUS_UNSUCCESSFUL				((NTSTATUS)0xC0000001)
+#define STATUS_INSUFFICIENT_RESOURCES	((NTSTATUS)0xC000009A)
+
+#define NT_SUCCESS(Status)	((NTSTATUS)(Status) >= 0)
+
+/*****************************************************************************
+ * Synchronization
+ */
+#define KeMemoryBarrier()	MemoryBarrier()
+
+/*****************************************************************************
+ * Debug
+ */
+#define PAGED_CODE()
+#define ASSERT(x)
+#define _DbgPrintF(lvl, strings)
+
+#define _stricmp		strcasecmp
+
+/*****************************************************************************
+ * Wide strings
+ */
+static inline size_t
+ShimWcslen
+(
+	const wchar_t *	String
+)
+{
+	size_t Length = 0;
+
+	while (String[Length]) Length++;
+
+	return Length;
+}
+
+static inline wchar_t *
+ShimWcscpy
+(
+	wchar_t *		Destination,
+	const wchar_t *	Source
+)
+{
+	size_t i = 0;
+
+	do { Destination[i] = Source[i]; } while (Source[i++]);
+
+	return Destination;
+}
+
+static inline wchar_t *
+ShimWcscat
+(
+	wchar_t *		Destination,
+	const wchar_t *	Source
+)
+{
+	ShimWcscpy(Destination + ShimWcslen(Destination), Source);
+
+	return Destination;
+}
+
+#define wcslen		ShimWcslen
+#define wcscpy		ShimWcscpy
+#define wcscat		ShimWcscat
+
+/*****************************************************************************
+ * Pool
+ */
+typedef enum { NonPagedPool, PagedPool } POOL_TYPE;
+
+#define ExAllocatePoolWithTag(Type, Size, Tag)	malloc(Size)
+#define ExAllocatePool(Type, Size)				malloc(Size)
+#define ExFreePool(p)							free(p)
+#define RtlZeroMemory(p, n)						memset((p), 0, (n))
+#define RtlCopyMemory(d, s, n)					memcpy((d), (s), (n))
+
+/*****************************************************************************
+ * Files
+ */
+typedef struct
+{
+	USHORT	Length;
+	USHORT	MaximumLength;
+	PWSTR	Buffer;
+} UNICODE_STRING;
+
+typedef struct
+{
+	UNICODE_STRING *	ObjectName;
+} OBJECT_ATTRIBUTES;
+
+typedef struct
+{
+	NTSTATUS	Status;
+	ULONG_PTR	Information;
+} IO_STATUS_BLOCK;
+
+typedef struct
+{
+	LARGE_INTEGER	AllocationSize;
+	LARGE_INTEGER	EndOfFile;
+} FILE_STANDARD_INFORMATION;
+
+enum { FileStandardInformation = 5 };
+
+#define SYNCHRONIZE						0x00100000
+#define GENERIC_READ					0x80000000
+#define GENERIC_WRITE					0x40000000
+#define FILE_SHARE_READ					0x00000001
+#define FILE_SHARE_WRITE				0x00000002
+#define FILE_RANDOM_ACCESS				0x00000800
+#define FILE_SYNCHRONOUS_IO_NONALERT	0x00000020
+#define OBJ_CASE_INSENSITIVE			0x00000040
+
+#define InitializeObjectAttributes(p, n, a, r, s)	((p)->ObjectName = (n))
+
+static inline VOID
+RtlInitUnicodeString
+(
+	UNICODE_STRING *	String,
+	PCWSTR				Source
+)
+{
+	String->Buffer = (PWSTR)Source;
+	String->Length = (USHORT)(wcslen(Source) * sizeof(WCHAR));
+	String->MaximumLength = String->Length + sizeof(WCHAR);
+}
+
+static inline NTSTATUS
+ZwOpenFile
+(
+	HANDLE *			FileHandle,
+	ACCESS_MASK			DesiredAccess,
+	OBJECT_ATTRIBUTES *	ObjectAttributes,
+	IO_STATUS_BLOCK *	IoStatusBlock,
+	ULONG				ShareAccess,
+	ULONG				OpenOptions
+)
+{
+	UNREFERENCED_PARAMETER(IoStatusBlock);
+	UNREFERENCED_PARAMETER(ShareAccess);
+	UNREFERENCED_PARAMETER(OpenOptions);
+
+	PCWSTR Name = ObjectAttributes->ObjectName->Buffer;
+
+	// The path is used as is, less the "\DosDevices\" OpenFile() puts in.
+	static const char DosDevices[] = "\\DosDevices\\";
+
+	size_t i = 0;
+
+	while (DosDevices[i] && (Name[i] == (wchar_t)DosDevices[i])) i++;
+
+	if (!DosDevices[i])
+	{
+		Name += i;
+	}
+
+	char Path[1024];
+
+	for (i = 0; Name[i]; i++)
+	{
+		if ((i == sizeof(Path) - 1) || (Name[i] > 0x7F))
+		{
+			return STATUS_UNSUCCESSFUL;
+		}
+
+		Path[i] = (char)Name[i];
+	}
+
+	Path[i] = '\0';
+
+	FILE * File = fopen(Path, (DesiredAccess & GENERIC_WRITE) ? "r+b" : "rb");
+
+	*FileHandle = File;
+
+	return File ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL;
+}
+
+static inline NTSTATUS
+ZwClose
+(
+	HANDLE	FileHandle
+)
+{
+	fclose((FILE *)FileHandle);
+
+	return STATUS_SUCCESS;
+}
+
+static inline NTSTATUS
+ZwQueryInformationFile
+(
+	HANDLE				FileHandle,
+	IO_STATUS_BLOCK *	IoStatusBlock,
+	PVOID				FileInformation,
+	ULONG				Length,
+	int					FileInformationClass
+)
+{
+	UNREFERENCED_PARAMETER(IoStatusBlock);
+	UNREFERENCED_PARAMETER(Length);
+	UNREFERENCED_PARAMETER(FileInformationClass);
+
+	FILE * File = (FILE *)FileHandle;
+
+	FILE_STANDARD_INFORMATION * Info = (FILE_STANDARD_INFORMATION *)FileInformation;
+
+	if (fseek(File, 0, SEEK_END))
+	{
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	Info->EndOfFile.QuadPart = ftell(File);
+	Info->AllocationSize = Info->EndOfFile;
+
+	return STATUS_SUCCESS;
+}
+
+static inline NTSTATUS
+ZwReadFile
+(
+	HANDLE				FileHandle,
+	HANDLE				Event,
+	PVOID				ApcRoutine,
+	PVOID				ApcContext,
+	IO_STATUS_BLOCK *	IoStatusBlock,
+	PVOID				Buffer,
+	ULONG				Length,
+	LARGE_INTEGER *		ByteOffset,
+	PULONG				Key
+)
+{
+	UNREFERENCED_PARAMETER(Event);
+	UNREFERENCED_PARAMETER(ApcRoutine);
+	UNREFERENCED_PARAMETER(ApcContext);
+	UNREFERENCED_PARAMETER(Key);
+
+	FILE * File = (FILE *)FileHandle;
+
+	if (fseek(File, (long)ByteOffset->QuadPart, SEEK_SET))
+	{
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	IoStatusBlock->Information = fread(Buffer, 1, Length, File);
+	IoStatusBlock->Status = STATUS_SUCCESS;
+
+	return STATUS_SUCCESS;
+}
+
+/*****************************************************************************
+ * DirectMusic (dmusicks.h)
+ */
+#pragma pack(push, 4)
+typedef struct _DMUS_EVENTHEADER
+{
+	DWORD			cbEvent;
+	DWORD			dwChannelGroup;
+	REFERENCE_TIME	rtDelta;
+	DWORD			dwFlags;
+} DMUS_EVENTHEADER, *LPDMUS_EVENTHEADER;
+#pragma pack(pop)
+
+#define DMUS_EVENT_STRUCTURED	0x00000001
+
+#define QWORD_ALIGN(x)			(((x) + 7) & ~7)
+#define DMUS_EVENT_SIZE(cb)		QWORD_ALIGN(sizeof(DMUS_EVENTHEADER) + (cb))
+
+/*****************************************************************************
+ * Kernel
+ */
+#ifdef TOOLS_KERNEL
+#include "wdm.h"
+#include "stdunk.h"
+#include "ks.h"
+#include "CList.h"
+#include "dbgtrace.h"
+
+#define GTI_SECONDS(t)		(ULONGLONG(t)*10000000)
+#define GTI_MILLISECONDS(t)	(ULONGLONG(t)*10000)
+#define GTI_MICROSECONDS(t)	(ULONGLONG(t)*10)
+#endif // TOOLS_KERNEL
+
+#endif // _TOOLS_COMMON_H_
@@ -0,0 +1,39 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       ks.h
+ * @brief      Stands in for the DDK's ks.h and ksmedia.h: the few kernel
+ *             streaming types the core uses.
+ *//*
+ *****************************************************************************
+ */
+#ifndef _TOOLS_KS_H_
+#define _TOOLS_KS_H_
+
+typedef struct
+{
+	LONGLONG	Time;
+	ULONG		Numerator;
+	ULONG		Denominator;
+} KSTIME, *PKSTIME;
+
+#endif // _TOOLS_KS_H_
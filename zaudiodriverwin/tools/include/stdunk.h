@@ -0,0 +1,170 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       stdunk.h
+ * @brief      Stands in for the DDK's stdunk.h: IUnknown, CUnknown and the
+ *             pool operator new that portcls provides.
+ *//*
+ *****************************************************************************
+ */
+#ifndef _TOOLS_STDUNK_H_
+#define _TOOLS_STDUNK_H_
+
+#include <new>
+
+#define STDMETHODCALLTYPE
+#define STDMETHODIMP				NTSTATUS STDMETHODCALLTYPE
+#define STDMETHODIMP_(Type)			Type STDMETHODCALLTYPE
+#define STDMETHOD(Method)			virtual NTSTATUS STDMETHODCALLTYPE Method
+#define STDMETHOD_(Type, Method)	virtual Type STDMETHODCALLTYPE Method
+
+typedef const GUID &	REFIID;
+
+DEFINE_GUID(IID_IUnknown, 0x00000000, 0x0000, 0x0000, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46);
+
+/*****************************************************************************
+ * IUnknown
+ */
+struct IUnknown
+{
+	STDMETHOD(QueryInterface)(REFIID Interface, PVOID * Object) = 0;
+	STDMETHOD_(ULONG, AddRef)(void) = 0;
+	STDMETHOD_(ULONG, Release)(void) = 0;
+};
+
+typedef IUnknown *	PUNKNOWN;
+
+/*! @brief Same layout as IUnknown, so that one can be called as the other. */
+struct INonDelegatingUnknown
+{
+	STDMETHOD(NonDelegatingQueryInterface)(REFIID Interface, PVOID * Object) = 0;
+	STDMETHOD_(ULONG, NonDelegatingAddRef)(void) = 0;
+	STDMETHOD_(ULONG, NonDelegatingRelease)(void) = 0;
+};
+
+typedef INonDelegatingUnknown *	PNONDELEGATINGUNKNOWN;
+
+/*****************************************************************************
+ * CUnknown
+ */
+class CUnknown
+:	public INonDelegatingUnknown
+{
+private:
+	LONG		m_lRefCount;
+	PUNKNOWN	m_pUnknownOuter;
+
+public:
+	CUnknown(PUNKNOWN pUnknownOuter)
+	{
+		m_lRefCount = 0;
+		m_pUnknownOuter = pUnknownOuter ? pUnknownOuter : PUNKNOWN(PNONDELEGATINGUNKNOWN(this));
+	}
+
+	virtual ~CUnknown() {}
+
+	PUNKNOWN GetOuterUnknown() { return m_pUnknownOuter; }
+
+	STDMETHODIMP_(ULONG) NonDelegatingAddRef(void)
+	{
+		return InterlockedIncrement(&m_lRefCount);
+	}
+
+	STDMETHODIMP_(ULONG) NonDelegatingRelease(void)
+	{
+		if (InterlockedDecrement(&m_lRefCount) == 0)
+		{
+			m_lRefCount++;
+			delete this;
+			return 0;
+		}
+
+		return m_lRefCount;
+	}
+
+	STDMETHODIMP NonDelegatingQueryInterface(REFIID Interface, PVOID * Object)
+	{
+		if (IsEqualGUIDAligned(Interface, IID_IUnknown))
+		{
+			*Object = PVOID(PUNKNOWN(this));
+
+			PUNKNOWN(*Object)->AddRef();
+
+			return STATUS_SUCCESS;
+		}
+
+		*Object = NULL;
+
+		return STATUS_INVALID_PARAMETER;
+	}
+};
+
+#define DECLARE_STD_UNKNOWN() \
+	STDMETHODIMP NonDelegatingQueryInterface(REFIID Interface, PVOID * Object); \
+	STDMETHODIMP QueryInterface(REFIID Interface, PVOID * Object) { return GetOuterUnknown()->QueryInterface(Interface, Object); } \
+	STDMETHODIMP_(ULONG) AddRef() { return GetOuterUnknown()->AddRef(); } \
+	STDMETHODIMP_(ULONG) Release() { return GetOuterUnknown()->Release(); }
+
+#define DEFINE_STD_CONSTRUCTOR(Class) \
+	Class(PUNKNOWN pUnknownOuter) : CUnknown(pUnknownOuter) {}
+
+/*****************************************************************************
+ * Pool
+ */
+/*! @brief As portcls's: zeroed, and NULL rather than an exception if the pool is
+ * out. From the C++ heap, since the objects go back to it through delete.
+ * Not inlined: the core relies on the zeroing for the members its
+ * constructors leave alone, and g++ drops stores made to an object before
+ * its constructor runs when it can see them. */
+__attribute__((noinline)) inline PVOID
+operator new
+(
+	size_t		Size,
+	POOL_TYPE	PoolType
+) noexcept
+{
+	UNREFERENCED_PARAMETER(PoolType);
+
+	PVOID Memory = ::operator new(Size, std::nothrow);
+
+	if (Memory)
+	{
+		memset(Memory, 0, Size);
+	}
+
+	return Memory;
+}
+
+inline PVOID
+operator new
+(
+	size_t		Size,
+	POOL_TYPE	PoolType,
+	ULONG		Tag
+) noexcept
+{
+	UNREFERENCED_PARAMETER(Tag);
+
+	return operator new(Size, PoolType);
+}
+
+#endif // _TOOLS_STDUNK_H_
@@ -0,0 +1,75 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       usbbusif.h
+ * @brief      Stands in for the DDK's usbbusif.h: the USBDI bus interface.
+ *//*
+ *****************************************************************************
+ */
+#ifndef _TOOLS_USBBUSIF_H_
+#define _TOOLS_USBBUSIF_H_
+
+#define USB_BUSIF_USBDI_VERSION_0	0x0000
+#define USB_BUSIF_USBDI_VERSION_1	0x0001
+
+DEFINE_GUID(USB_BUS_INTERFACE_USBDI_GUID, 0xB1A96A13, 0x3DE0, 0x4574, 0x9B, 0x01, 0xC0, 0x8F, 0xEA, 0xB3, 0x18, 0xD6);
+
+typedef struct _USBD_VERSION_INFORMATION
+{
+	ULONG	USBDI_Version;
+	ULONG	Supported_USB_Version;
+} USBD_VERSION_INFORMATION, *PUSBD_VERSION_INFORMATION;
+
+typedef VOID (*PUSB_BUSIFFN_GETUSBDI_VERSION)(PVOID BusContext, PUSBD_VERSION_INFORMATION VersionInformation, PULONG HcdCapabilities);
+typedef NTSTATUS (*PUSB_BUSIFFN_QUERY_BUS_TIME)(PVOID BusContext, PULONG CurrentFrame);
+typedef NTSTATUS (*PUSB_BUSIFFN_SUBMIT_ISO_OUT_URB)(PVOID BusContext, PURB Urb);
+typedef NTSTATUS (*PUSB_BUSIFFN_QUERY_BUS_INFORMATION)(PVOID BusContext, ULONG Level, PVOID BusInformationBuffer, PULONG BusInformationBufferLength, PULONG BusInformationActualLength);
+typedef BOOLEAN (*PUSB_BUSIFFN_IS_DEVICE_HIGH_SPEED)(PVOID BusContext);
+
+typedef struct _USB_BUS_INTERFACE_USBDI_V0
+{
+	USHORT								Size;
+	USHORT								Version;
+	PVOID								BusContext;
+	PINTERFACE_REFERENCE				InterfaceReference;
+	PINTERFACE_DEREFERENCE				InterfaceDereference;
+	PUSB_BUSIFFN_GETUSBDI_VERSION		GetUSBDIVersion;
+	PUSB_BUSIFFN_QUERY_BUS_TIME			QueryBusTime;
+	PUSB_BUSIFFN_SUBMIT_ISO_OUT_URB		SubmitIsoOutUrb;
+	PUSB_BUSIFFN_QUERY_BUS_INFORMATION	QueryBusInformation;
+} USB_BUS_INTERFACE_USBDI_V0, *PUSB_BUS_INTERFACE_USBDI_V0;
+
+typedef struct _USB_BUS_INTERFACE_USBDI_V1
+{
+	USHORT								Size;
+	USHORT								Version;
+	PVOID								BusContext;
+	PINTERFACE_REFERENCE				InterfaceReference;
+	PINTERFACE_DEREFERENCE				InterfaceDereference;
+	PUSB_BUSIFFN_GETUSBDI_VERSION		GetUSBDIVersion;
+	PUSB_BUSIFFN_QUERY_BUS_TIME			QueryBusTime;
+	PUSB_BUSIFFN_SUBMIT_ISO_OUT_URB		SubmitIsoOutUrb;
+	PUSB_BUSIFFN_QUERY_BUS_INFORMATION	QueryBusInformation;
+	PUSB_BUSIFFN_IS_DEVICE_HIGH_SPEED	IsDeviceHighSpeed;
+} USB_BUS_INTERFACE_USBDI_V1, *PUSB_BUS_INTERFACE_USBDI_V1;
+
+#endif // _TOOLS_USBBUSIF_H_
@@ -0,0 +1,223 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       usbdlib.h
+ * @brief      Stands in for the DDK's usbdlib.h: the URB sizes, the
+ *             UsbBuildXxxRequest() macros and the descriptor parsers.
+ *//*
+ *****************************************************************************
+ */
+#ifndef _TOOLS_USBDLIB_H_
+#define _TOOLS_USBDLIB_H_
+
+typedef struct _USBD_INTERFACE_LIST_ENTRY
+{
+	PUSB_INTERFACE_DESCRIPTOR	InterfaceDescriptor;
+	PUSBD_INTERFACE_INFORMATION	Interface;
+} USBD_INTERFACE_LIST_ENTRY, *PUSBD_INTERFACE_LIST_ENTRY;
+
+/*****************************************************************************
+ * Sizes
+ */
+#define GET_SELECT_CONFIGURATION_REQUEST_SIZE(totalInterfaces, totalPipes) \
+	(sizeof(struct _URB_SELECT_CONFIGURATION) + \
+	 (((totalInterfaces) - 1) * sizeof(USBD_INTERFACE_INFORMATION)) + \
+	 (((totalPipes) - (totalInterfaces)) * sizeof(USBD_PIPE_INFORMATION)))
+
+#define GET_SELECT_INTERFACE_REQUEST_SIZE(totalPipes) \
+	(sizeof(struct _URB_SELECT_INTERFACE) + (((totalPipes) - 1) * sizeof(USBD_PIPE_INFORMATION)))
+
+#define GET_USBD_INTERFACE_SIZE(numEndpoints) \
+	(sizeof(USBD_INTERFACE_INFORMATION) + (sizeof(USBD_PIPE_INFORMATION) * (numEndpoints)) - sizeof(USBD_PIPE_INFORMATION))
+
+#define GET_ISO_URB_SIZE(n) \
+	(sizeof(struct _URB_ISOCH_TRANSFER) + (sizeof(USBD_ISO_PACKET_DESCRIPTOR) * (n)))
+
+/*****************************************************************************
+ * Requests
+ */
+#define UsbBuildGetDescriptorRequest(urb, length, descriptorType, descriptorIndex, languageId, transferBuffer, transferBufferMDL, transferBufferLength, link) { \
+	(urb)->UrbHeader.Function = URB_FUNCTION_GET_DESCRIPTOR_FROM_DEVICE; \
+	(urb)->UrbHeader.Length = (length); \
+	(urb)->UrbControlDescriptorRequest.TransferBufferLength = (transferBufferLength); \
+	(urb)->UrbControlDescriptorRequest.TransferBufferMDL = (transferBufferMDL); \
+	(urb)->UrbControlDescriptorRequest.TransferBuffer = (transferBuffer); \
+	(urb)->UrbControlDescriptorRequest.DescriptorType = (descriptorType); \
+	(urb)->UrbControlDescriptorRequest.Index = (descriptorIndex); \
+	(urb)->UrbControlDescriptorRequest.LanguageId = (languageId); \
+	(urb)->UrbControlDescriptorRequest.UrbLink = (link); }
+
+#define UsbBuildSelectConfigurationRequest(urb, length, configurationDescriptor) { \
+	(urb)->UrbHeader.Function = URB_FUNCTION_SELECT_CONFIGURATION; \
+	(urb)->UrbHeader.Length = (length); \
+	(urb)->UrbSelectConfiguration.ConfigurationDescriptor = (configurationDescriptor); }
+
+#define UsbBuildSelectInterfaceRequest(urb, length, configurationHandle, interfaceNumber, alternateSetting) { \
+	(urb)->UrbHeader.Function = URB_FUNCTION_SELECT_INTERFACE; \
+	(urb)->UrbHeader.Length = (length); \
+	(urb)->UrbSelectInterface.Interface.AlternateSetting = (alternateSetting); \
+	(urb)->UrbSelectInterface.Interface.InterfaceNumber = (interfaceNumber); \
+	(urb)->UrbSelectInterface.Interface.Length = (sizeof(USBD_INTERFACE_INFORMATION) - sizeof(USBD_PIPE_INFORMATION)); \
+	(urb)->UrbSelectInterface.ConfigurationHandle = (configurationHandle); }
+
+#define UsbBuildVendorRequest(urb, cmd, length, transferFlags, reservedBits, request, value, index, transferBuffer, transferBufferMDL, transferBufferLength, link) { \
+	(urb)->UrbHeader.Function = (cmd); \
+	(urb)->UrbHeader.Length = (length); \
+	(urb)->UrbControlVendorClassRequest.TransferBufferLength = (transferBufferLength); \
+	(urb)->UrbControlVendorClassRequest.TransferBufferMDL = (transferBufferMDL); \
+	(urb)->UrbControlVendorClassRequest.TransferBuffer = (transferBuffer); \
+	(urb)->UrbControlVendorClassRequest.RequestTypeReservedBits = (reservedBits); \
+	(urb)->UrbControlVendorClassRequest.Request = (request); \
+	(urb)->UrbControlVendorClassRequest.Value = (value); \
+	(urb)->UrbControlVendorClassRequest.Index = (index); \
+	(urb)->UrbControlVendorClassRequest.TransferFlags = (transferFlags); \
+	(urb)->UrbControlVendorClassRequest.UrbLink = (link); }
+
+#define UsbBuildFeatureRequest(urb, op, featureSelector, index, link) { \
+	(urb)->UrbHeader.Function = (op); \
+	(urb)->UrbHeader.Length = sizeof(struct _URB_CONTROL_FEATURE_REQUEST); \
+	(urb)->UrbControlFeatureRequest.FeatureSelector = (featureSelector); \
+	(urb)->UrbControlFeatureRequest.Index = (index); \
+	(urb)->UrbControlFeatureRequest.UrbLink = (link); }
+
+#define UsbBuildInterruptOrBulkTransferRequest(urb, length, pipeHandle, transferBuffer, transferBufferMDL, transferBufferLength, transferFlags, link) { \
+	(urb)->UrbHeader.Function = URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER; \
+	(urb)->UrbHeader.Length = (length); \
+	(urb)->UrbBulkOrInterruptTransfer.PipeHandle = (pipeHandle); \
+	(urb)->UrbBulkOrInterruptTransfer.TransferBufferLength = (transferBufferLength); \
+	(urb)->UrbBulkOrInterruptTransfer.TransferBufferMDL = (transferBufferMDL); \
+	(urb)->UrbBulkOrInterruptTransfer.TransferBuffer = (transferBuffer); \
+	(urb)->UrbBulkOrInterruptTransfer.TransferFlags = (transferFlags); \
+	(urb)->UrbBulkOrInterruptTransfer.UrbLink = (link); }
+
+/*****************************************************************************
+ * Parsers
+ */
+static inline PUSB_COMMON_DESCRIPTOR
+USBD_ParseDescriptors
+(
+	PVOID	DescriptorBuffer,
+	ULONG	TotalLength,
+	PVOID	StartPosition,
+	LONG	DescriptorType
+)
+{
+	PUCHAR End = PUCHAR(DescriptorBuffer) + TotalLength;
+
+	for (PUCHAR p = PUCHAR(StartPosition); (p + sizeof(USB_COMMON_DESCRIPTOR) <= End) && p[0]; p += p[0])
+	{
+		if (p[1] == DescriptorType)
+		{
+			return PUSB_COMMON_DESCRIPTOR(p);
+		}
+	}
+
+	return NULL;
+}
+
+static inline PUSB_INTERFACE_DESCRIPTOR
+USBD_ParseConfigurationDescriptorEx
+(
+	PUSB_CONFIGURATION_DESCRIPTOR	ConfigurationDescriptor,
+	PVOID							StartPosition,
+	LONG							InterfaceNumber,
+	LONG							AlternateSetting,
+	LONG							InterfaceClass,
+	LONG							InterfaceSubClass,
+	LONG							InterfaceProtocol
+)
+{
+	PUCHAR p = PUCHAR(StartPosition);
+
+	for (;;)
+	{
+		PUSB_INTERFACE_DESCRIPTOR Descriptor = PUSB_INTERFACE_DESCRIPTOR(USBD_ParseDescriptors(ConfigurationDescriptor, ConfigurationDescriptor->wTotalLength, p, USB_INTERFACE_DESCRIPTOR_TYPE));
+
+		if (!Descriptor)
+		{
+			return NULL;
+		}
+
+		if (((InterfaceNumber == -1) || (Descriptor->bInterfaceNumber == InterfaceNumber)) &&
+			((AlternateSetting == -1) || (Descriptor->bAlternateSetting == AlternateSetting)) &&
+			((InterfaceClass == -1) || (Descriptor->bInterfaceClass == InterfaceClass)) &&
+			((InterfaceSubClass == -1) || (Descriptor->bInterfaceSubClass == InterfaceSubClass)) &&
+			((InterfaceProtocol == -1) || (Descriptor->bInterfaceProtocol == InterfaceProtocol)))
+		{
+			return Descriptor;
+		}
+
+		p = PUCHAR(Descriptor) + Descriptor->bLength;
+	}
+}
+
+static inline PURB
+USBD_CreateConfigurationRequestEx
+(
+	PUSB_CONFIGURATION_DESCRIPTOR	ConfigurationDescriptor,
+	PUSBD_INTERFACE_LIST_ENTRY		InterfaceList
+)
+{
+	ULONG NumberOfInterfaces = 0, NumberOfPipes = 0;
+
+	for (PUSBD_INTERFACE_LIST_ENTRY Entry = InterfaceList; Entry->InterfaceDescriptor; Entry++)
+	{
+		NumberOfInterfaces++;
+
+		NumberOfPipes += Entry->InterfaceDescriptor->bNumEndpoints;
+	}
+
+	// Room for at least one pipe per interface, as the DDK's.
+	ULONG Size = ULONG(sizeof(struct _URB_SELECT_CONFIGURATION)) + (NumberOfInterfaces * ULONG(GET_USBD_INTERFACE_SIZE(1))) + (NumberOfPipes * ULONG(sizeof(USBD_PIPE_INFORMATION)));
+
+	PURB Urb = PURB(calloc(1, Size));
+
+	if (Urb)
+	{
+		PUSBD_INTERFACE_INFORMATION Interface = &Urb->UrbSelectConfiguration.Interface;
+
+		for (PUSBD_INTERFACE_LIST_ENTRY Entry = InterfaceList; Entry->InterfaceDescriptor; Entry++)
+		{
+			ULONG NumberOfEndpoints = Entry->InterfaceDescriptor->bNumEndpoints;
+
+			Interface->InterfaceNumber = Entry->InterfaceDescriptor->bInterfaceNumber;
+			Interface->AlternateSetting = Entry->InterfaceDescriptor->bAlternateSetting;
+			Interface->NumberOfPipes = NumberOfEndpoints;
+			Interface->Length = USHORT(GET_USBD_INTERFACE_SIZE(NumberOfEndpoints));
+
+			for (ULONG i = 0; i < NumberOfEndpoints; i++)
+			{
+				Interface->Pipes[i].MaximumTransferSize = USBD_DEFAULT_MAXIMUM_TRANSFER_SIZE;
+			}
+
+			Entry->Interface = Interface;
+
+			Interface = PUSBD_INTERFACE_INFORMATION(PUCHAR(Interface) + Interface->Length);
+		}
+
+		UsbBuildSelectConfigurationRequest(Urb, USHORT(Size), ConfigurationDescriptor);
+	}
+
+	return Urb;
+}
+
+#endif // _TOOLS_USBDLIB_H_
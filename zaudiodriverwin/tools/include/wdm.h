@@ -0,0 +1,1016 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       wdm.h
+ * @brief      Stands in for the DDK's wdm.h so that the core sources that
+ *             talk to the USB stack build and run as user mode programs on
+ *             Linux.
+ * @details
+ * Included by Common.h when TOOLS_KERNEL is defined. Everything runs on one
+ * thread, so the kernel below is a model rather than a port, and it checks
+ * the rules a driver has to keep on the real one:
+ *
+ *  - there is one current IRQL. Spin locks raise it to DISPATCH_LEVEL, and
+ *    whoever plays the host controller completes isochronous IRPs there;
+ *  - acquiring a spin lock that is already held would spin for ever, and
+ *    waiting at DISPATCH_LEVEL is not allowed: both fail the program;
+ *  - a wait that would block runs ShimIdleRoutine, which the program sets
+ *    to move the rest of the system (the bus) along, until the object is
+ *    signalled or the timeout expires. A wait nothing can end fails;
+ *  - an IRP belongs to the driver it was sent to until it is completed.
+ *    Freeing, reusing or reinitializing it before then fails.
+ *
+ * Failures print "FAILED: " and what went wrong, and abort. Time is
+ * simulated: ShimTime, in 100 ns units, only moves when the program moves
+ * it, and KeQueryPerformanceCounter() counts it at 10 MHz.
+ *//*
+ *****************************************************************************
+ */
+#ifndef _TOOLS_WDM_H_
+#define _TOOLS_WDM_H_
+
+#include <stddef.h>
+#include <stdarg.h>
+
+/*****************************************************************************
+ * Types
+ */
+typedef UCHAR					KIRQL, *PKIRQL;
+typedef CHAR					CCHAR, KPROCESSOR_MODE;
+typedef SHORT					CSHORT;
+typedef ULONG_PTR				KSPIN_LOCK, *PKSPIN_LOCK;
+typedef ULONG_PTR				KAFFINITY;
+typedef LONG					KPRIORITY;
+typedef ULONG_PTR				SIZE_T;
+typedef LARGE_INTEGER *			PLARGE_INTEGER;
+typedef IO_STATUS_BLOCK *		PIO_STATUS_BLOCK;
+typedef UNICODE_STRING *		PUNICODE_STRING;
+
+#define MAXLONGLONG				0x7FFFFFFFFFFFFFFFLL
+
+#ifndef max
+#define max(a, b)				(((a) > (b)) ? (a) : (b))
+#define min(a, b)				(((a) < (b)) ? (a) : (b))
+#endif
+
+#define LANG_NEUTRAL			0x00
+#define SUBLANG_NEUTRAL			0x00
+#define MAKELANGID(p, s)		((USHORT(s) << 10) | USHORT(p))
+
+#define PASSIVE_LEVEL			0
+#define APC_LEVEL				1
+#define DISPATCH_LEVEL			2
+
+typedef enum { KernelMode, UserMode } MODE;
+
+typedef enum { Executive, UserRequest = 6 } KWAIT_REASON;
+
+typedef enum { NotificationEvent, SynchronizationEvent } EVENT_TYPE;
+
+typedef enum
+{
+	PowerDeviceUnspecified,
+	PowerDeviceD0,
+	PowerDeviceD1,
+	PowerDeviceD2,
+	PowerDeviceD3,
+	PowerDeviceMaximum
+} DEVICE_POWER_STATE, *PDEVICE_POWER_STATE;
+
+typedef struct _GUID
+{
+	ULONG	Data1;
+	USHORT	Data2;
+	USHORT	Data3;
+	UCHAR	Data4[8];
+} GUID, *LPGUID;
+
+typedef const GUID *	LPCGUID;
+typedef const GUID &	REFGUID;
+
+#define IsEqualGUIDAligned(a, b)	(memcmp(&(a), &(b), sizeof(GUID)) == 0)
+
+/*! @brief Defines a GUID once however many sources include it. */
+#define DEFINE_GUID(Name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+	inline const GUID Name = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+
+/*****************************************************************************
+ * Status
+ */
+#define STATUS_TIMEOUT						((NTSTATUS)0x00000102)
+#define STATUS_PENDING						((NTSTATUS)0x00000103)
+#define STATUS_BUFFER_OVERFLOW				((NTSTATUS)0x80000005)
+#define STATUS_NOT_IMPLEMENTED				((NTSTATUS)0xC0000002)
+#define STATUS_INVALID_HANDLE				((NTSTATUS)0xC0000008)
+#define STATUS_INVALID_PARAMETER			((NTSTATUS)0xC000000D)
+#define STATUS_NO_SUCH_DEVICE				((NTSTATUS)0xC000000E)
+#define STATUS_INVALID_DEVICE_REQUEST		((NTSTATUS)0xC0000010)
+#define STATUS_MORE_PROCESSING_REQUIRED		((NTSTATUS)0xC0000016)
+#define STATUS_NO_MEMORY					((NTSTATUS)0xC0000017)
+#define STATUS_ACCESS_DENIED				((NTSTATUS)0xC0000022)
+#define STATUS_BUFFER_TOO_SMALL				((NTSTATUS)0xC0000023)
+#define STATUS_PIPE_BUSY					((NTSTATUS)0xC00000AE)
+#define STATUS_PIPE_EMPTY					((NTSTATUS)0xC00000D9)
+#define STATUS_DEVICE_NOT_CONNECTED			((NTSTATUS)0xC000009D)
+#define STATUS_NOT_SUPPORTED				((NTSTATUS)0xC00000BB)
+#define STATUS_IO_TIMEOUT					((NTSTATUS)0xC00000B5)
+#define STATUS_CANCELLED					((NTSTATUS)0xC0000120)
+#define STATUS_INVALID_DEVICE_STATE			((NTSTATUS)0xC0000184)
+#define STATUS_DEVICE_CONFIGURATION_ERROR	((NTSTATUS)0xC0000182)
+#define STATUS_NOT_FOUND					((NTSTATUS)0xC0000225)
+
+/*****************************************************************************
+ * Simulation
+ */
+/*! @brief Current IRQL. */
+inline KIRQL ShimIrql = PASSIVE_LEVEL;
+
+/*! @brief Simulated time, in 100 ns units. */
+inline LONGLONG ShimTime = 0;
+
+/*!
+ * @brief
+ * Called when a wait would block. Moves the rest of the system along (at
+ * least ShimTime) and returns TRUE, or FALSE if nothing is left to happen.
+ */
+inline BOOL (*ShimIdleRoutine)(void) = NULL;
+
+/*! @brief Fails the program: the driver broke a rule of the kernel. */
+static inline void
+ShimFail
+(
+	const char *	Format,
+	...
+)
+{
+	va_list Arguments;
+
+	va_start(Arguments, Format);
+
+	printf("FAILED: ");
+	vprintf(Format, Arguments);
+	printf("\n");
+
+	va_end(Arguments);
+
+	fflush(stdout);
+
+	abort();
+}
+
+/*****************************************************************************
+ * Debug
+ */
+static inline ULONG
+DbgPrint
+(
+	const char *	Format,
+	...
+)
+{
+	UNREFERENCED_PARAMETER(Format);
+
+	return 0;
+}
+
+#define DbgBreakPoint()
+
+/*****************************************************************************
+ * IRQL and spin locks
+ */
+#define KeGetCurrentIrql()				ShimIrql
+#define KeGetCurrentProcessorNumber()	0
+#define KeQueryActiveProcessors()		KAFFINITY(1)
+
+static inline VOID
+KeRaiseIrql
+(
+	KIRQL	NewIrql,
+	PKIRQL	OldIrql
+)
+{
+	if (NewIrql < ShimIrql)
+	{
+		ShimFail("KeRaiseIrql() to %u from %u", NewIrql, ShimIrql);
+	}
+
+	*OldIrql = ShimIrql;
+
+	ShimIrql = NewIrql;
+}
+
+static inline VOID
+KeLowerIrql
+(
+	KIRQL	NewIrql
+)
+{
+	if (NewIrql > ShimIrql)
+	{
+		ShimFail("KeLowerIrql() to %u from %u", NewIrql, ShimIrql);
+	}
+
+	ShimIrql = NewIrql;
+}
+
+static inline VOID
+KeInitializeSpinLock
+(
+	PKSPIN_LOCK	SpinLock
+)
+{
+	*SpinLock = 0;
+}
+
+static inline VOID
+KeAcquireSpinLockAtDpcLevel
+(
+	PKSPIN_LOCK	SpinLock
+)
+{
+	if (ShimIrql != DISPATCH_LEVEL)
+	{
+		ShimFail("spin lock %p acquired at IRQL %u", SpinLock, ShimIrql);
+	}
+
+	if (*SpinLock)
+	{
+		ShimFail("spin lock %p acquired again while held: deadlock", SpinLock);
+	}
+
+	*SpinLock = 1;
+}
+
+static inline VOID
+KeReleaseSpinLockFromDpcLevel
+(
+	PKSPIN_LOCK	SpinLock
+)
+{
+	if (!*SpinLock)
+	{
+		ShimFail("spin lock %p released while not held", SpinLock);
+	}
+
+	*SpinLock = 0;
+}
+
+static inline VOID
+KeAcquireSpinLock
+(
+	PKSPIN_LOCK	SpinLock,
+	PKIRQL		OldIrql
+)
+{
+	KeRaiseIrql(DISPATCH_LEVEL, OldIrql);
+
+	KeAcquireSpinLockAtDpcLevel(SpinLock);
+}
+
+static inline VOID
+KeReleaseSpinLock
+(
+	PKSPIN_LOCK	SpinLock,
+	KIRQL		NewIrql
+)
+{
+	KeReleaseSpinLockFromDpcLevel(SpinLock);
+
+	KeLowerIrql(NewIrql);
+}
+
+/*****************************************************************************
+ * Time
+ */
+static inline LARGE_INTEGER
+KeQueryPerformanceCounter
+(
+	PLARGE_INTEGER	PerformanceFrequency
+)
+{
+	if (PerformanceFrequency)
+	{
+		PerformanceFrequency->QuadPart = 10000000;
+	}
+
+	LARGE_INTEGER Counter;
+
+	Counter.QuadPart = ShimTime;
+
+	return Counter;
+}
+
+static inline VOID
+KeQuerySystemTime
+(
+	PLARGE_INTEGER	CurrentTime
+)
+{
+	CurrentTime->QuadPart = ShimTime;
+}
+
+#define KeQueryInterruptTime()	ULONGLONG(ShimTime)
+
+/*! @brief Runs the idle routine until ShimTime reaches Deadline or Done(Object) holds. */
+static inline BOOL
+ShimWait
+(
+	LONGLONG	Deadline,
+	BOOL		(*Done)(PVOID),
+	PVOID		Object
+)
+{
+	while (!Done || !Done(Object))
+	{
+		if (ShimTime >= Deadline)
+		{
+			return FALSE;
+		}
+
+		if (!ShimIdleRoutine || !ShimIdleRoutine())
+		{
+			if (Deadline == MAXLONGLONG)
+			{
+				ShimFail("wait for %p that nothing will end", Object);
+			}
+
+			ShimTime = Deadline;
+		}
+	}
+
+	return TRUE;
+}
+
+static inline NTSTATUS
+KeDelayExecutionThread
+(
+	KPROCESSOR_MODE	WaitMode,
+	BOOLEAN			Alertable,
+	PLARGE_INTEGER	Interval
+)
+{
+	UNREFERENCED_PARAMETER(WaitMode);
+	UNREFERENCED_PARAMETER(Alertable);
+
+	if (ShimIrql > APC_LEVEL)
+	{
+		ShimFail("KeDelayExecutionThread() at IRQL %u", ShimIrql);
+	}
+
+	ShimWait(ShimTime + ((Interval->QuadPart < 0) ? -Interval->QuadPart : Interval->QuadPart), NULL, NULL);
+
+	return STATUS_SUCCESS;
+}
+
+static inline VOID
+KeStallExecutionProcessor
+(
+	ULONG	MicroSeconds
+)
+{
+	ShimTime += LONGLONG(MicroSeconds) * 10;
+}
+
+/*****************************************************************************
+ * Dispatcher objects
+ */
+/*! @brief Object types in DISPATCHER_HEADER. */
+#define SHIM_NOTIFICATION_EVENT		0
+#define SHIM_SYNCHRONIZATION_EVENT	1
+#define SHIM_MUTEX					2
+
+typedef struct _DISPATCHER_HEADER
+{
+	UCHAR	Type;
+	LONG	SignalState;
+} DISPATCHER_HEADER;
+
+typedef struct _KEVENT
+{
+	DISPATCHER_HEADER	Header;
+} KEVENT, *PKEVENT, *PRKEVENT;
+
+typedef struct _KMUTEX
+{
+	DISPATCHER_HEADER	Header;
+} KMUTEX, *PKMUTEX, *PRKMUTEX;
+
+static inline VOID
+KeInitializeEvent
+(
+	PRKEVENT	Event,
+	EVENT_TYPE	Type,
+	BOOLEAN		State
+)
+{
+	Event->Header.Type = (Type == SynchronizationEvent) ? SHIM_SYNCHRONIZATION_EVENT : SHIM_NOTIFICATION_EVENT;
+	Event->Header.SignalState = State ? 1 : 0;
+}
+
+static inline LONG
+KeSetEvent
+(
+	PRKEVENT	Event,
+	KPRIORITY	Increment,
+	BOOLEAN		Wait
+)
+{
+	UNREFERENCED_PARAMETER(Increment);
+	UNREFERENCED_PARAMETER(Wait);
+
+	LONG PreviousState = Event->Header.SignalState;
+
+	Event->Header.SignalState = 1;
+
+	return PreviousState;
+}
+
+static inline VOID
+KeClearEvent
+(
+	PRKEVENT	Event
+)
+{
+	Event->Header.SignalState = 0;
+}
+
+static inline LONG
+KeResetEvent
+(
+	PRKEVENT	Event
+)
+{
+	LONG PreviousState = Event->Header.SignalState;
+
+	Event->Header.SignalState = 0;
+
+	return PreviousState;
+}
+
+#define KeReadStateEvent(Event)		((Event)->Header.SignalState)
+
+static inline VOID
+KeInitializeMutex
+(
+	PRKMUTEX	Mutex,
+	ULONG		Level
+)
+{
+	UNREFERENCED_PARAMETER(Level);
+
+	Mutex->Header.Type = SHIM_MUTEX;
+	Mutex->Header.SignalState = 1;
+}
+
+static inline LONG
+KeReleaseMutex
+(
+	PRKMUTEX	Mutex,
+	BOOLEAN		Wait
+)
+{
+	UNREFERENCED_PARAMETER(Wait);
+
+	if (Mutex->Header.SignalState > 0)
+	{
+		ShimFail("mutex %p released while not held", Mutex);
+	}
+
+	return Mutex->Header.SignalState++;
+}
+
+/*! @brief TRUE if the event is signalled. */
+static inline BOOL
+ShimSignalled
+(
+	PVOID	Object
+)
+{
+	return ((DISPATCHER_HEADER *)Object)->SignalState > 0;
+}
+
+static inline NTSTATUS
+KeWaitForSingleObject
+(
+	PVOID			Object,
+	KWAIT_REASON	WaitReason,
+	KPROCESSOR_MODE	WaitMode,
+	BOOLEAN			Alertable,
+	PLARGE_INTEGER	Timeout
+)
+{
+	UNREFERENCED_PARAMETER(WaitReason);
+	UNREFERENCED_PARAMETER(WaitMode);
+	UNREFERENCED_PARAMETER(Alertable);
+
+	DISPATCHER_HEADER * Header = (DISPATCHER_HEADER *)Object;
+
+	if ((ShimIrql > APC_LEVEL) && !(Timeout && (Timeout->QuadPart == 0)))
+	{
+		ShimFail("wait for %p at IRQL %u", Object, ShimIrql);
+	}
+
+	if (Header->Type == SHIM_MUTEX)
+	{
+		// The only thread always gets it; a mutex may be acquired recursively.
+		Header->SignalState--;
+
+		return STATUS_SUCCESS;
+	}
+
+	LONGLONG Deadline = MAXLONGLONG;
+
+	if (Timeout)
+	{
+		Deadline = ShimTime + ((Timeout->QuadPart < 0) ? -Timeout->QuadPart : Timeout->QuadPart);
+	}
+
+	if (!ShimWait(Deadline, ShimSignalled, Object))
+	{
+		return STATUS_TIMEOUT;
+	}
+
+	if (Header->Type == SHIM_SYNCHRONIZATION_EVENT)
+	{
+		Header->SignalState = 0;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+#define KeWaitForMutexObject	KeWaitForSingleObject
+
+/*****************************************************************************
+ * Fast mutexes
+ */
+typedef struct _FAST_MUTEX
+{
+	LONG	Count;
+	KIRQL	OldIrql;
+} FAST_MUTEX, *PFAST_MUTEX;
+
+static inline VOID
+ExInitializeFastMutex
+(
+	PFAST_MUTEX	FastMutex
+)
+{
+	FastMutex->Count = 1;
+}
+
+static inline VOID
+ExAcquireFastMutex
+(
+	PFAST_MUTEX	FastMutex
+)
+{
+	if (ShimIrql > APC_LEVEL)
+	{
+		ShimFail("fast mutex %p acquired at IRQL %u", FastMutex, ShimIrql);
+	}
+
+	if (FastMutex->Count <= 0)
+	{
+		ShimFail("fast mutex %p acquired again while held: deadlock", FastMutex);
+	}
+
+	FastMutex->Count--;
+
+	KeRaiseIrql(APC_LEVEL, &FastMutex->OldIrql);
+}
+
+static inline VOID
+ExReleaseFastMutex
+(
+	PFAST_MUTEX	FastMutex
+)
+{
+	FastMutex->Count++;
+
+	KeLowerIrql(FastMutex->OldIrql);
+}
+
+/*****************************************************************************
+ * Memory
+ */
+#define RtlCompareMemory(s1, s2, n)		ShimCompareMemory((s1), (s2), (n))
+#define RtlFillMemory(d, n, c)			memset((d), (c), (n))
+#define RtlMoveMemory(d, s, n)			memmove((d), (s), (n))
+
+static inline SIZE_T
+ShimCompareMemory
+(
+	const void *	Source1,
+	const void *	Source2,
+	SIZE_T			Length
+)
+{
+	SIZE_T i = 0;
+
+	while ((i < Length) && (PUCHAR(Source1)[i] == PUCHAR(Source2)[i])) i++;
+
+	return i;
+}
+
+/*****************************************************************************
+ * Devices and IRPs
+ */
+#define IRP_MJ_CREATE					0x00
+#define IRP_MJ_CLOSE					0x02
+#define IRP_MJ_DEVICE_CONTROL			0x0E
+#define IRP_MJ_INTERNAL_DEVICE_CONTROL	0x0F
+#define IRP_MJ_POWER					0x16
+#define IRP_MJ_PNP						0x1B
+#define IRP_MJ_MAXIMUM_FUNCTION			0x1B
+
+#define IRP_MN_QUERY_INTERFACE			0x08
+
+#define SL_PENDING_RETURNED				0x01
+#define SL_INVOKE_ON_CANCEL				0x20
+#define SL_INVOKE_ON_SUCCESS			0x40
+#define SL_INVOKE_ON_ERROR				0x80
+
+#define IO_NO_INCREMENT					0
+#define IO_SOUND_INCREMENT				8
+
+typedef struct _IRP IRP, *PIRP;
+typedef struct _DEVICE_OBJECT DEVICE_OBJECT, *PDEVICE_OBJECT;
+typedef struct _DRIVER_OBJECT DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+typedef NTSTATUS (*PDRIVER_DISPATCH)(PDEVICE_OBJECT DeviceObject, PIRP Irp);
+typedef VOID (*PDRIVER_CANCEL)(PDEVICE_OBJECT DeviceObject, PIRP Irp);
+typedef NTSTATUS (*PIO_COMPLETION_ROUTINE)(PDEVICE_OBJECT DeviceObject, PIRP Irp, PVOID Context);
+
+struct _DRIVER_OBJECT
+{
+	PDRIVER_DISPATCH	MajorFunction[IRP_MJ_MAXIMUM_FUNCTION + 1];
+};
+
+struct _DEVICE_OBJECT
+{
+	PDRIVER_OBJECT		DriverObject;
+	CCHAR				StackSize;
+	PVOID				DeviceExtension;
+};
+
+typedef VOID (*PINTERFACE_REFERENCE)(PVOID Context);
+typedef VOID (*PINTERFACE_DEREFERENCE)(PVOID Context);
+
+typedef struct _INTERFACE
+{
+	USHORT					Size;
+	USHORT					Version;
+	PVOID					Context;
+	PINTERFACE_REFERENCE	InterfaceReference;
+	PINTERFACE_DEREFERENCE	InterfaceDereference;
+} INTERFACE, *PINTERFACE;
+
+typedef struct _IO_STACK_LOCATION
+{
+	UCHAR	MajorFunction;
+	UCHAR	MinorFunction;
+	UCHAR	Flags;
+	UCHAR	Control;
+
+	union
+	{
+		struct
+		{
+			ULONG	OutputBufferLength;
+			ULONG	InputBufferLength;
+			ULONG	IoControlCode;
+			PVOID	Type3InputBuffer;
+		} DeviceIoControl;
+
+		struct
+		{
+			const GUID *	InterfaceType;
+			USHORT			Size;
+			USHORT			Version;
+			PINTERFACE		Interface;
+			PVOID			InterfaceSpecificData;
+		} QueryInterface;
+
+		struct
+		{
+			PVOID	Argument1;
+			PVOID	Argument2;
+			PVOID	Argument3;
+			PVOID	Argument4;
+		} Others;
+	} Parameters;
+
+	PDEVICE_OBJECT			DeviceObject;
+	PIO_COMPLETION_ROUTINE	CompletionRoutine;
+	PVOID					Context;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+struct _IRP
+{
+	USHORT				Size;
+	IO_STATUS_BLOCK		IoStatus;
+	CCHAR				StackCount;
+	CCHAR				CurrentLocation;
+	BOOLEAN				PendingReturned;
+	BOOLEAN				Cancel;
+	KIRQL				CancelIrql;
+	PDRIVER_CANCEL		CancelRoutine;
+	PIO_STATUS_BLOCK	UserIosb;
+	PKEVENT				UserEvent;
+	BOOLEAN				ShimSent;		/*!< @brief Sent to a lower driver, not completed yet. */
+	BOOLEAN				ShimBuilt;		/*!< @brief From IoBuildDeviceIoControlRequest(), freed on completion. */
+	IO_STACK_LOCATION	Stack[1];		/*!< @brief Stack location n is Stack[n - 1]. */
+};
+
+#define IoSizeOfIrp(StackSize)	USHORT(offsetof(IRP, Stack) + (StackSize) * sizeof(IO_STACK_LOCATION))
+
+#define IoGetCurrentIrpStackLocation(Irp)	(&(Irp)->Stack[(Irp)->CurrentLocation - 1])
+#define IoGetNextIrpStackLocation(Irp)		(&(Irp)->Stack[(Irp)->CurrentLocation - 2])
+
+#define IoMarkIrpPending(Irp)				(IoGetCurrentIrpStackLocation(Irp)->Control |= SL_PENDING_RETURNED)
+
+static inline PDRIVER_CANCEL
+IoSetCancelRoutine
+(
+	PIRP			Irp,
+	PDRIVER_CANCEL	CancelRoutine
+)
+{
+	return __atomic_exchange_n(&Irp->CancelRoutine, CancelRoutine, __ATOMIC_SEQ_CST);
+}
+
+/*! @brief Fails if the IRP is with a lower driver. */
+static inline VOID
+ShimCheckIrpOwner
+(
+	PIRP			Irp,
+	const char *	Routine
+)
+{
+	if (Irp->ShimSent)
+	{
+		ShimFail("%s() on IRP %p that a lower driver still has", Routine, Irp);
+	}
+}
+
+static inline VOID
+IoInitializeIrp
+(
+	PIRP	Irp,
+	USHORT	PacketSize,
+	CCHAR	StackSize
+)
+{
+	ShimCheckIrpOwner(Irp, "IoInitializeIrp");
+
+	memset(Irp, 0, PacketSize);
+
+	Irp->Size = PacketSize;
+	Irp->StackCount = StackSize;
+	Irp->CurrentLocation = CCHAR(StackSize + 1);
+}
+
+static inline PIRP
+IoAllocateIrp
+(
+	CCHAR	StackSize,
+	BOOLEAN	ChargeQuota
+)
+{
+	UNREFERENCED_PARAMETER(ChargeQuota);
+
+	PIRP Irp = PIRP(calloc(1, IoSizeOfIrp(StackSize)));
+
+	if (Irp)
+	{
+		IoInitializeIrp(Irp, IoSizeOfIrp(StackSize), StackSize);
+	}
+
+	return Irp;
+}
+
+static inline VOID
+IoFreeIrp
+(
+	PIRP	Irp
+)
+{
+	ShimCheckIrpOwner(Irp, "IoFreeIrp");
+
+	free(Irp);
+}
+
+static inline VOID
+IoReuseIrp
+(
+	PIRP		Irp,
+	NTSTATUS	Status
+)
+{
+	ShimCheckIrpOwner(Irp, "IoReuseIrp");
+
+	IoInitializeIrp(Irp, Irp->Size, Irp->StackCount);
+
+	Irp->IoStatus.Status = Status;
+}
+
+static inline VOID
+IoSetCompletionRoutine
+(
+	PIRP					Irp,
+	PIO_COMPLETION_ROUTINE	CompletionRoutine,
+	PVOID					Context,
+	BOOLEAN					InvokeOnSuccess,
+	BOOLEAN					InvokeOnError,
+	BOOLEAN					InvokeOnCancel
+)
+{
+	PIO_STACK_LOCATION Stack = IoGetNextIrpStackLocation(Irp);
+
+	Stack->CompletionRoutine = CompletionRoutine;
+	Stack->Context = Context;
+	Stack->Control = 0;
+
+	if (InvokeOnSuccess) Stack->Control |= SL_INVOKE_ON_SUCCESS;
+	if (InvokeOnError) Stack->Control |= SL_INVOKE_ON_ERROR;
+	if (InvokeOnCancel) Stack->Control |= SL_INVOKE_ON_CANCEL;
+}
+
+static inline NTSTATUS
+IoCallDriver
+(
+	PDEVICE_OBJECT	DeviceObject,
+	PIRP			Irp
+)
+{
+	if (Irp->CurrentLocation <= 1)
+	{
+		ShimFail("IoCallDriver() with IRP %p out of stack locations", Irp);
+	}
+
+	ShimCheckIrpOwner(Irp, "IoCallDriver");
+
+	Irp->ShimSent = TRUE;
+
+	Irp->CurrentLocation--;
+
+	PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+
+	Stack->DeviceObject = DeviceObject;
+
+	return DeviceObject->DriverObject->MajorFunction[Stack->MajorFunction](DeviceObject, Irp);
+}
+
+static inline VOID
+IoCompleteRequest
+(
+	PIRP	Irp,
+	CCHAR	PriorityBoost
+)
+{
+	UNREFERENCED_PARAMETER(PriorityBoost);
+
+	if (Irp->IoStatus.Status == STATUS_PENDING)
+	{
+		ShimFail("IoCompleteRequest() of IRP %p with STATUS_PENDING", Irp);
+	}
+
+	Irp->ShimSent = FALSE;
+
+	Irp->PendingReturned = FALSE;
+
+	while (Irp->CurrentLocation <= Irp->StackCount)
+	{
+		PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+
+		Irp->PendingReturned = (Stack->Control & SL_PENDING_RETURNED) ? TRUE : FALSE;
+
+		Irp->CurrentLocation++;
+
+		PDEVICE_OBJECT DeviceObject = (Irp->CurrentLocation <= Irp->StackCount) ? IoGetCurrentIrpStackLocation(Irp)->DeviceObject : NULL;
+
+		UCHAR Invoke = NT_SUCCESS(Irp->IoStatus.Status) ? SL_INVOKE_ON_SUCCESS : (Irp->Cancel ? SL_INVOKE_ON_CANCEL : SL_INVOKE_ON_ERROR);
+
+		if (Stack->CompletionRoutine && (Stack->Control & Invoke))
+		{
+			if (Stack->CompletionRoutine(DeviceObject, Irp, Stack->Context) == STATUS_MORE_PROCESSING_REQUIRED)
+			{
+				return;
+			}
+		}
+		else if (Irp->PendingReturned && (Irp->CurrentLocation <= Irp->StackCount))
+		{
+			IoMarkIrpPending(Irp);
+		}
+	}
+
+	// Past the top: what IoBuildDeviceIoControlRequest() set up.
+	if (Irp->UserIosb)
+	{
+		*Irp->UserIosb = Irp->IoStatus;
+	}
+
+	if (Irp->UserEvent)
+	{
+		KeSetEvent(Irp->UserEvent, IO_NO_INCREMENT, FALSE);
+	}
+
+	if (Irp->ShimBuilt)
+	{
+		IoFreeIrp(Irp);
+	}
+}
+
+/*! @brief The cancel spin lock. */
+inline KSPIN_LOCK ShimCancelSpinLock = 0;
+
+#define IoAcquireCancelSpinLock(Irql)	KeAcquireSpinLock(&ShimCancelSpinLock, (Irql))
+#define IoReleaseCancelSpinLock(Irql)	KeReleaseSpinLock(&ShimCancelSpinLock, (Irql))
+
+static inline BOOLEAN
+IoCancelIrp
+(
+	PIRP	Irp
+)
+{
+	KIRQL Irql;
+
+	IoAcquireCancelSpinLock(&Irql);
+
+	Irp->Cancel = TRUE;
+
+	PDRIVER_CANCEL CancelRoutine = IoSetCancelRoutine(Irp, NULL);
+
+	if (CancelRoutine)
+	{
+		// The cancel routine releases the cancel spin lock.
+		Irp->CancelIrql = Irql;
+
+		CancelRoutine(IoGetCurrentIrpStackLocation(Irp)->DeviceObject, Irp);
+
+		return TRUE;
+	}
+
+	IoReleaseCancelSpinLock(Irql);
+
+	return FALSE;
+}
+
+static inline PIRP
+IoBuildDeviceIoControlRequest
+(
+	ULONG				IoControlCode,
+	PDEVICE_OBJECT		DeviceObject,
+	PVOID				InputBuffer,
+	ULONG				InputBufferLength,
+	PVOID				OutputBuffer,
+	ULONG				OutputBufferLength,
+	BOOLEAN				InternalDeviceIoControl,
+	PKEVENT				Event,
+	PIO_STATUS_BLOCK	IoStatusBlock
+)
+{
+	UNREFERENCED_PARAMETER(OutputBuffer);
+
+	PIRP Irp = IoAllocateIrp(DeviceObject->StackSize, FALSE);
+
+	if (Irp)
+	{
+		Irp->ShimBuilt = TRUE;
+		Irp->UserEvent = Event;
+		Irp->UserIosb = IoStatusBlock;
+
+		PIO_STACK_LOCATION Stack = IoGetNextIrpStackLocation(Irp);
+
+		Stack->MajorFunction = InternalDeviceIoControl ? IRP_MJ_INTERNAL_DEVICE_CONTROL : IRP_MJ_DEVICE_CONTROL;
+		Stack->Parameters.DeviceIoControl.IoControlCode = IoControlCode;
+		Stack->Parameters.DeviceIoControl.InputBufferLength = InputBufferLength;
+		Stack->Parameters.DeviceIoControl.OutputBufferLength = OutputBufferLength;
+		Stack->Parameters.DeviceIoControl.Type3InputBuffer = InputBuffer;
+	}
+
+	return Irp;
+}
+
+#define IoIsWdmVersionAvailable(Major, Minor)	((Major) == 1 ? ((Minor) <= 0x30) : ((Major) < 1))
+
+#endif // _TOOLS_WDM_H_
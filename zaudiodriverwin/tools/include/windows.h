@@ -0,0 +1,162 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       windows.h
+ * @brief      Stands in for the Platform SDK's windows.h so that driver and
+ *             ASIO DLL sources build as user mode programs on Linux.
+ * @details
+ * Shared by the host tools: build them with -I../include. Only the types
+ * and routines those sources use are here. Common.h adds what the kernel
+ * mode sources need on top of this.
+ *//*
+ *****************************************************************************
+ */
+#ifndef _TOOLS_WINDOWS_H_
+#define _TOOLS_WINDOWS_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+
+/*****************************************************************************
+ * Types
+ */
+#define IN
+#define OUT
+#define OPTIONAL
+#define VOID			void
+
+#define __forceinline	inline __attribute__((always_inline))
+#define __inline		inline
+
+typedef void *			PVOID;
+typedef void *			HANDLE;
+typedef char			CHAR, *PCHAR, *LPSTR;
+typedef unsigned char	UCHAR, *PUCHAR, BOOLEAN;
+typedef int16_t			SHORT, *PSHORT;
+typedef uint16_t		USHORT, *PUSHORT;
+typedef int32_t			LONG, *PLONG;
+typedef uint32_t		ULONG, *PULONG, DWORD;
+typedef int64_t			LONGLONG, *PLONGLONG;
+typedef uint64_t		ULONGLONG, *PULONGLONG;
+typedef uintptr_t		ULONG_PTR;
+typedef float			FLOAT, *PFLOAT;
+typedef double			DOUBLE;
+typedef int				BOOL, *PBOOL;
+typedef wchar_t			WCHAR, *PWCHAR, *LPWSTR, *PWSTR;
+typedef const wchar_t *	PCWSTR;
+
+typedef union
+{
+	struct
+	{
+		ULONG	LowPart;
+		LONG	HighPart;
+	};
+	LONGLONG	QuadPart;
+} LARGE_INTEGER;
+
+#define TRUE			1
+#define FALSE			0
+
+#define MAXLONG			0x7FFFFFFF
+#define MAXULONG		0xFFFFFFFF
+
+#define UNREFERENCED_PARAMETER(P)	((void)(P))
+
+/*****************************************************************************
+ * Functions
+ */
+#define ZeroMemory(Destination, Length)				memset((Destination), 0, (Length))
+#define CopyMemory(Destination, Source, Length)		memcpy((Destination), (Source), (Length))
+#define MoveMemory(Destination, Source, Length)		memmove((Destination), (Source), (Length))
+
+#define MemoryBarrier()		__sync_synchronize()
+
+#ifdef __cplusplus
+/*! @brief The compiler barrier dbgtrace.h declares as an intrinsic. */
+extern "C" inline void
+_ReadWriteBarrier
+(	void
+)
+{
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+#endif
+
+#define Sleep(Milliseconds)	sched_yield()
+
+static inline LONG
+InterlockedIncrement
+(
+	volatile LONG *	Addend
+)
+{
+	return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG
+InterlockedDecrement
+(
+	volatile LONG *	Addend
+)
+{
+	return __atomic_sub_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG
+InterlockedExchange
+(
+	volatile LONG *	Target,
+	LONG			Value
+)
+{
+	return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG
+InterlockedCompareExchange
+(
+	volatile LONG *	Destination,
+	LONG			Exchange,
+	LONG			Comparand
+)
+{
+	__atomic_compare_exchange_n(Destination, &Comparand, Exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+	return Comparand;
+}
+
+static inline LONGLONG
+InterlockedCompareExchange64
+(
+	volatile LONGLONG *	Destination,
+	LONGLONG			Exchange,
+	LONGLONG			Comparand
+)
+{
+	__atomic_compare_exchange_n(Destination, &Comparand, Exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+	return Comparand;
+}
+
+#endif // _TOOLS_WINDOWS_H_
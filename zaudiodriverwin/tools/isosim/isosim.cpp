@@ -0,0 +1,1509 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       isosim.cpp
+ * @brief      Plays a stream through the core's audio client, data pipe and
+ *             synch pipe into a simulated host controller and device.
+ * @details
+ * The core is built as is (core/Audio.cpp, core/UsbDev.cpp and what they
+ * need), with tools/include standing in for the DDK: IRPs, URBs, spin locks,
+ * events and the USBDI bus interface. The program is the lower device
+ * object CUsbDevice sends its IRPs to. It brings the driver up the way the
+ * adapter and the KS pin do: CUsbDevice::Init()/StartDevice(),
+ * CAudioDevice::Init(), Open(), SetInterfaceParameter(), the sampling rate,
+ * SetupBuffer() and SetTransferDepth(), then Start(). Then, a ms at a time:
+ *
+ *  - the client tops the FIFO up every period through
+ *    CAudioClient::WriteBuffer(), which flushes the data pipe; the master
+ *    volume steps between 0 and -20 dB every few seconds;
+ *  - the host controller plays the isochronous URBs queued for the frame:
+ *    the OUT packets go to the device, the feedback endpoint answers with
+ *    the device's rate. URBs queued for a frame that has passed fail late.
+ *    It then completes them, at DISPATCH_LEVEL, into the driver's
+ *    completion routines, which resubmit through CUsbDevice::RecycleIrp().
+ *    Now and then it holds the completions for a few frames, as a late DPC
+ *    would. Control URBs complete on the next frame;
+ *  - the device clock is off nominal and wanders. The device buffers the
+ *    packets it gets, plays its clock's worth of frames per packet
+ *    interval, and reports its rate: the frames it counted since the last
+ *    report, read with some jitter, nudged to bring its buffer back to one
+ *    ms over about a second;
+ *  - data and feedback packets get lost on the bus now and then.
+ *
+ * At the end of each run, the device is unplugged for a while, and the
+ * client keeps writing: the host controller fails the URBs the completion
+ * routines and WriteBuffer() resubmit at once, from within RecycleIrp().
+ * The driver is then torn down as on a surprise removal, with the device
+ * still gone.
+ *
+ * Each device is run with its feedback endpoint and without (the driver
+ * then plays at the nominal rate). Reported: device underruns and overruns,
+ * lost packets, URBs that missed their frame, the latency from the client
+ * to the device's output, the transfer depth the pipe ended with, the
+ * clock ratio the driver estimated, and the time WriteBuffer() takes per ms
+ * and the completion routines per packet. The program fails unless, with
+ * the feedback endpoint, the device never overruns, only runs short while
+ * it refills its buffer after a lost packet or a late URB, and the latency
+ * holds; an adaptive pipe must also have deepened. Any device must have
+ * failed URBs while unplugged, and the driver must stop with none left
+ * with the host controller. The shim fails the program if the driver
+ * breaks a kernel rule, e.g. takes a spin lock it holds, waits at
+ * DISPATCH_LEVEL or waits for an IRP the host controller does not hold.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -fshort-wchar -Wno-write-strings -Wno-multichar -DTOOLS_KERNEL \
+ *         -I../include -I../../driver/usbaud10/core -I../../driver/usbaud10/include \
+ *         -I../../driver/include -I../../include -o isosim isosim.cpp \
+ *         ../../driver/usbaud10/core/{Audio,UsbDev,Entity,Terminal,Unit,FifoSlab,Profile,DbgTrace}.cpp
+ *     ./isosim [seconds]
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Unit.h has an INFINITY of its own, a level in dB.
+#undef INFINITY
+
+#include "Common.h"
+#include "Audio.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Default length of a run, in seconds. */
+#define NUMBER_OF_SECONDS				60
+
+/*! @brief Period of the client, in ms. It keeps two periods in the FIFO. */
+#define CLIENT_PERIOD					10
+
+/*! @brief The master volume steps every so many ms. */
+#define VOLUME_PERIOD					5000
+
+/*! @brief Time left for the stream to settle before the latency is measured, in ms. */
+#define SETTLE_TIME						2000
+
+/*! @brief The latency drift is the mean over the last so many ms less the mean over the first ones. */
+#define LATENCY_WINDOW					5000
+
+/*! @brief Time the device takes to refill its buffer after a lost packet or a late URB, in ms. */
+#define REFILL_TIME						1000
+
+/*! @brief Time the device is unplugged at the end of a run, in ms. */
+#define UNPLUG_TIME						100
+
+/*! @brief Longest the host controller holds the completions, in ms. */
+#define MAX_STALL						3
+
+/*! @brief Most URBs the host controller queues per endpoint. */
+#define MAX_QUEUED_URB					16
+
+/*! @brief Interface and endpoints of the simulated device. */
+#define STREAMING_INTERFACE				1
+#define DATA_ENDPOINT					0x01
+#define FEEDBACK_ENDPOINT				0x81
+
+/*! @brief Feedback modes. */
+#define FEEDBACK_ENDPOINT_PRESENT		0	/*!< @brief Through the synch pipe. */
+#define FEEDBACK_ENDPOINT_NONE			1	/*!< @brief Nominal rate. */
+
+/*****************************************************************************
+ * Types
+ */
+/*! @brief A simulated device. */
+typedef struct
+{
+	const char *	Name;
+	ULONG			SampleRate;
+	ULONG			Channels;
+	BOOL			HighSpeed;			// 8 packets per ms, 16.16 feedback
+	ULONG			TransferDepth;		// ms of IRPs in flight
+	BOOL			Adaptive;			// and raised on late completions
+	UCHAR			Refresh;			// bRefresh: 2^Refresh ms per feedback value
+	double			Ppm;				// device clock off nominal
+	double			WanderPpm;			// and wandering around it, over 20 s
+	double			Jitter;				// of the frame count behind the feedback, in frames
+	double			Loss;				// probability that a packet is lost on the bus
+	double			Stall;				// probability per ms that the completions are held
+} DEVICE;
+
+/*! @brief URBs queued on an endpoint of the host controller. */
+typedef struct
+{
+	PIRP			Irp[MAX_QUEUED_URB];
+	ULONG			Count;
+} URB_QUEUE;
+
+/*! @brief An isochronous endpoint of the host controller. */
+typedef struct
+{
+	UCHAR			EndpointAddress;
+	URB_QUEUE		Scheduled;			// waiting for their frame
+	URB_QUEUE		Done;				// played, not completed yet
+} ENDPOINT;
+
+/*! @brief Result of a run. */
+typedef struct
+{
+	ULONG		Underruns;			// packet intervals the device ran short
+	ULONG		Overruns;			// packet intervals the device had to drop frames
+	ULONG		LostPackets;
+	ULONG		LateUrbs;			// URBs queued for a frame that had passed
+	double		LatencyMean;		// ms
+	double		LatencyMinimum;
+	double		LatencyMaximum;
+	double		LatencyDrift;		// last window less the first one, ms, less the depth added
+	double		ClockPpm;			// the driver's estimate of the device clock
+	double		ClientTime;			// ns per ms
+	double		PipeTime;			// ns per packet
+	AUDIO_TRANSFER_DEPTH	TransferDepth;
+	ULONG		UnpluggedUrbs;		// URBs failed while the device was gone
+} RESULT;
+
+/*! @brief The host controller and the device behind it. */
+typedef struct
+{
+	DRIVER_OBJECT		DriverObject;
+	DEVICE_OBJECT		DeviceObject;
+
+	const DEVICE *		Device;
+	BOOL				FeedbackEndpoint;
+	ULONG				PacketsPerMs;
+	ULONG				FrameSize;
+	RESULT *			Result;
+
+	// Host controller
+	ULONG				Frame;
+	ULONG				Ms;					// of the run
+	ULONG				RunTime;			// ms before the device is unplugged
+	ULONG				StallFrames;
+	BOOL				Unplugged;
+	PIRP				Control[MAX_QUEUED_URB];
+	ULONG				ControlCount;
+	ENDPOINT			DataEndpoint;
+	ENDPOINT			SynchEndpoint;
+	double				CompletionTime;		// ns
+
+	// Descriptors
+	UCHAR				DeviceDescriptor[18];
+	UCHAR				ConfigurationDescriptor[256];
+	ULONG				ConfigurationLength;
+
+	// Device
+	ULONG				SampleRate;			// SET_CUR sampling frequency
+	double				Nominal;			// frames per packet interval
+	double				Played;				// frames its clock counted
+	ULONGLONG			PlayedFrames;
+	double				Buffered;			// frames in its buffer
+	double				TargetLevel;
+	double				Capacity;
+	BOOL				Playing;
+	double				LastCount;
+	ULONG				LastFeedbackFrame;
+	ULONG				LastDisturbance;	// ms of the last lost packet or late URB
+	BOOL				Disturbed;
+} HOST;
+
+static HOST Host;
+
+/*****************************************************************************
+ * Now()
+ *****************************************************************************
+ * @brief
+ * Monotonic time in ns.
+ */
+static double
+Now
+(	void
+)
+{
+	struct timespec Time;
+
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+
+	return Time.tv_sec * 1e9 + Time.tv_nsec;
+}
+
+/*****************************************************************************
+ * Random()
+ *****************************************************************************
+ * @brief
+ * Uniform in [0, 1).
+ */
+static double
+Random
+(	void
+)
+{
+	return rand() / (RAND_MAX + 1.0);
+}
+
+/*****************************************************************************
+ * Append()
+ *****************************************************************************
+ * @brief
+ * Append a descriptor, its length in its first byte, to the configuration.
+ */
+static void
+Append
+(
+	const UCHAR *	Descriptor
+)
+{
+	memcpy(Host.ConfigurationDescriptor + Host.ConfigurationLength, Descriptor, Descriptor[0]);
+
+	Host.ConfigurationLength += Descriptor[0];
+}
+
+/*****************************************************************************
+ * BuildDescriptors()
+ *****************************************************************************
+ * @brief
+ * A USB audio 1.0 speaker: an AC interface with an input terminal for the
+ * stream and an output terminal, and an AS interface whose alternate setting
+ * 1 has an asynchronous data endpoint with a sampling frequency control and,
+ * if FeedbackEndpoint, the feedback endpoint for it.
+ */
+static void
+BuildDescriptors
+(	void
+)
+{
+	const DEVICE * Device = Host.Device;
+
+	UCHAR Channels = UCHAR(Device->Channels);
+
+	USHORT MaxPacketSize = USHORT((ULONG(ceil(Host.Nominal)) + 2) * Host.FrameSize);
+
+	const UCHAR DeviceDescriptor[18] =
+	{
+		18, USB_DEVICE_DESCRIPTOR_TYPE, 0x00, UCHAR(Device->HighSpeed ? 0x02 : 0x01), 0, 0, 0, 64,
+		0x34, 0x12, 0x78, 0x56, 0x00, 0x01, 0, 0, 0, 1
+	};
+
+	memcpy(Host.DeviceDescriptor, DeviceDescriptor, sizeof(DeviceDescriptor));
+
+	Host.ConfigurationLength = 0;
+
+	const UCHAR Configuration[] = { 9, USB_CONFIGURATION_DESCRIPTOR_TYPE, 0, 0, 2, 1, 0, 0x80, 50 };
+	const UCHAR AcInterface[] = { 9, USB_INTERFACE_DESCRIPTOR_TYPE, 0, 0, 0, 1, 1, 0, 0 };
+	const UCHAR AcHeader[] = { 9, 0x24, 1, 0x00, 0x01, 30, 0, 1, STREAMING_INTERFACE };
+	const UCHAR InputTerminal[] = { 12, 0x24, 2, 1, 0x01, 0x01, 0, Channels, 0, 0, 0, 0 };
+	const UCHAR OutputTerminal[] = { 9, 0x24, 3, 2, 0x01, 0x03, 0, 1, 0 };
+	const UCHAR AsInterface0[] = { 9, USB_INTERFACE_DESCRIPTOR_TYPE, STREAMING_INTERFACE, 0, 0, 1, 2, 0, 0 };
+	const UCHAR AsInterface1[] = { 9, USB_INTERFACE_DESCRIPTOR_TYPE, STREAMING_INTERFACE, 1, UCHAR(Host.FeedbackEndpoint ? 2 : 1), 1, 2, 0, 0 };
+	const UCHAR AsGeneral[] = { 7, 0x24, 1, 1, 1, 0x01, 0x00 };
+	const UCHAR FormatType[] = { 11, 0x24, 2, 1, Channels, 3, 24, 1, UCHAR(Device->SampleRate), UCHAR(Device->SampleRate >> 8), UCHAR(Device->SampleRate >> 16) };
+	const UCHAR DataEndpoint[] = { 9, USB_ENDPOINT_DESCRIPTOR_TYPE, DATA_ENDPOINT, 0x05, UCHAR(MaxPacketSize), UCHAR(MaxPacketSize >> 8), 1, 0, UCHAR(Host.FeedbackEndpoint ? FEEDBACK_ENDPOINT : 0) };
+	const UCHAR CsEndpoint[] = { 7, 0x25, 1, 0x01, 0, 0, 0 };
+	const UCHAR SynchEndpoint[] = { 9, USB_ENDPOINT_DESCRIPTOR_TYPE, FEEDBACK_ENDPOINT, 0x01, UCHAR(Device->HighSpeed ? 4 : 3), 0, UCHAR(Device->HighSpeed ? 4 : 1), Device->Refresh, 0 };
+
+	Append(Configuration);
+	Append(AcInterface);
+	Append(AcHeader);
+	Append(InputTerminal);
+	Append(OutputTerminal);
+	Append(AsInterface0);
+	Append(AsInterface1);
+	Append(AsGeneral);
+	Append(FormatType);
+	Append(DataEndpoint);
+	Append(CsEndpoint);
+
+	if (Host.FeedbackEndpoint)
+	{
+		Append(SynchEndpoint);
+	}
+
+	Host.ConfigurationDescriptor[2] = UCHAR(Host.ConfigurationLength);
+	Host.ConfigurationDescriptor[3] = UCHAR(Host.ConfigurationLength >> 8);
+}
+
+/*****************************************************************************
+ * FindEndpoint()
+ *****************************************************************************
+ * @brief
+ * The endpoint a pipe handle stands for, if it is open.
+ */
+static ENDPOINT *
+FindEndpoint
+(
+	USBD_PIPE_HANDLE	PipeHandle
+)
+{
+	if (PipeHandle == &Host.DataEndpoint) return &Host.DataEndpoint;
+
+	if (Host.FeedbackEndpoint && (PipeHandle == &Host.SynchEndpoint)) return &Host.SynchEndpoint;
+
+	return NULL;
+}
+
+/*****************************************************************************
+ * SelectInterface()
+ *****************************************************************************
+ * @brief
+ * Fill in the interface information of a SELECT_CONFIGURATION or
+ * SELECT_INTERFACE URB from the descriptors, as USBD does.
+ */
+static BOOL
+SelectInterface
+(
+	PUSBD_INTERFACE_INFORMATION	Interface
+)
+{
+	PUCHAR End = Host.ConfigurationDescriptor + Host.ConfigurationLength;
+
+	for (PUCHAR p = Host.ConfigurationDescriptor; p < End; p += p[0])
+	{
+		if ((p[1] == USB_INTERFACE_DESCRIPTOR_TYPE) && (p[2] == Interface->InterfaceNumber) && (p[3] == Interface->AlternateSetting))
+		{
+			if (Interface->Length < GET_USBD_INTERFACE_SIZE(p[4]))
+			{
+				return FALSE;
+			}
+
+			Interface->Class = p[5];
+			Interface->SubClass = p[6];
+			Interface->Protocol = p[7];
+			Interface->InterfaceHandle = USBD_INTERFACE_HANDLE(p);
+			Interface->NumberOfPipes = p[4];
+
+			ULONG i = 0;
+
+			for (PUCHAR q = p + p[0]; (q < End) && (q[1] != USB_INTERFACE_DESCRIPTOR_TYPE) && (i < Interface->NumberOfPipes); q += q[0])
+			{
+				if (q[1] == USB_ENDPOINT_DESCRIPTOR_TYPE)
+				{
+					PUSBD_PIPE_INFORMATION Pipe = &Interface->Pipes[i++];
+
+					Pipe->EndpointAddress = q[2];
+					Pipe->PipeType = USBD_PIPE_TYPE(q[3] & 0x03);
+					Pipe->MaximumPacketSize = USHORT((q[4] | (q[5] << 8)) & 0x7FF);
+					Pipe->Interval = q[6];
+					Pipe->PipeHandle = (q[2] == DATA_ENDPOINT) ? USBD_PIPE_HANDLE(&Host.DataEndpoint) : USBD_PIPE_HANDLE(&Host.SynchEndpoint);
+				}
+			}
+
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/*****************************************************************************
+ * Put()/Remove()
+ *****************************************************************************
+ * @brief
+ * URB queue helpers.
+ */
+static void
+Put
+(
+	URB_QUEUE *	Queue,
+	PIRP		Irp
+)
+{
+	if (Queue->Count == MAX_QUEUED_URB)
+	{
+		ShimFail("more than %u URBs queued on an endpoint", MAX_QUEUED_URB);
+	}
+
+	Queue->Irp[Queue->Count++] = Irp;
+}
+
+static BOOL
+Remove
+(
+	URB_QUEUE *	Queue,
+	PIRP		Irp
+)
+{
+	for (ULONG i = 0; i < Queue->Count; i++)
+	{
+		if (Queue->Irp[i] == Irp)
+		{
+			memmove(&Queue->Irp[i], &Queue->Irp[i + 1], (Queue->Count - i - 1) * sizeof(PIRP));
+
+			Queue->Count--;
+
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static PIRP
+Pop
+(
+	URB_QUEUE *	Queue
+)
+{
+	PIRP Irp = Queue->Count ? Queue->Irp[0] : NULL;
+
+	if (Irp)
+	{
+		Remove(Queue, Irp);
+	}
+
+	return Irp;
+}
+
+/*****************************************************************************
+ * UrbOf()
+ *****************************************************************************
+ * @brief
+ * The URB an IRP_MJ_INTERNAL_DEVICE_CONTROL IRP carries.
+ */
+static PURB
+UrbOf
+(
+	PIRP	Irp
+)
+{
+	return PURB(IoGetCurrentIrpStackLocation(Irp)->Parameters.Others.Argument1);
+}
+
+/*****************************************************************************
+ * Complete()
+ *****************************************************************************
+ * @brief
+ * Complete an IRP at DISPATCH_LEVEL, as the host controller's DPC does.
+ */
+static NTSTATUS
+Complete
+(
+	PIRP		Irp,
+	NTSTATUS	Status
+)
+{
+	IoSetCancelRoutine(Irp, NULL);
+
+	Irp->IoStatus.Status = Status;
+
+	KIRQL OldIrql; KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+	IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+	KeLowerIrql(OldIrql);
+
+	return Status;
+}
+
+/*****************************************************************************
+ * FailIsochronous()
+ *****************************************************************************
+ * @brief
+ * Complete an isochronous URB that never got on the bus.
+ */
+static void
+FailIsochronous
+(
+	PIRP		Irp,
+	NTSTATUS	Status,
+	USBD_STATUS	UsbdStatus
+)
+{
+	PURB Urb = UrbOf(Irp);
+
+	for (ULONG i = 0; i < Urb->UrbIsochronousTransfer.NumberOfPackets; i++)
+	{
+		Urb->UrbIsochronousTransfer.IsoPacket[i].Status = UsbdStatus;
+	}
+
+	Urb->UrbIsochronousTransfer.ErrorCount = Urb->UrbIsochronousTransfer.NumberOfPackets;
+
+	Urb->UrbHeader.Status = UsbdStatus;
+
+	Complete(Irp, Status);
+}
+
+/*****************************************************************************
+ * CancelRoutine()
+ *****************************************************************************
+ * @brief
+ * Cancel a URB the host controller holds.
+ */
+static VOID
+CancelRoutine
+(
+	PDEVICE_OBJECT	DeviceObject,
+	PIRP			Irp
+)
+{
+	UNREFERENCED_PARAMETER(DeviceObject);
+
+	BOOL Found = FALSE;
+
+	for (ULONG i = 0; (i < Host.ControlCount) && !Found; i++)
+	{
+		if (Host.Control[i] == Irp)
+		{
+			memmove(&Host.Control[i], &Host.Control[i + 1], (Host.ControlCount - i - 1) * sizeof(PIRP));
+
+			Host.ControlCount--;
+
+			Found = TRUE;
+		}
+	}
+
+	ENDPOINT * Endpoint[] = { &Host.DataEndpoint, &Host.SynchEndpoint };
+
+	for (ULONG i = 0; (i < 2) && !Found; i++)
+	{
+		Found = Remove(&Endpoint[i]->Scheduled, Irp) || Remove(&Endpoint[i]->Done, Irp);
+	}
+
+	IoReleaseCancelSpinLock(Irp->CancelIrql);
+
+	if (!Found)
+	{
+		ShimFail("IRP %p cancelled that the host controller does not hold", Irp);
+	}
+
+	if (UrbOf(Irp)->UrbHeader.Function == URB_FUNCTION_ISOCH_TRANSFER)
+	{
+		FailIsochronous(Irp, STATUS_CANCELLED, USBD_STATUS_CANCELED);
+	}
+	else
+	{
+		UrbOf(Irp)->UrbHeader.Status = USBD_STATUS_CANCELED;
+
+		Complete(Irp, STATUS_CANCELLED);
+	}
+}
+
+/*****************************************************************************
+ * ControlTransfer()
+ *****************************************************************************
+ * @brief
+ * Carry out a non-isochronous URB and complete it.
+ */
+static void
+ControlTransfer
+(
+	PIRP	Irp
+)
+{
+	PURB Urb = UrbOf(Irp);
+
+	USBD_STATUS UsbdStatus = USBD_STATUS_SUCCESS;
+
+	switch (Urb->UrbHeader.Function)
+	{
+		case URB_FUNCTION_GET_DESCRIPTOR_FROM_DEVICE:
+		{
+			struct _URB_CONTROL_DESCRIPTOR_REQUEST * Request = &Urb->UrbControlDescriptorRequest;
+
+			PUCHAR Descriptor = NULL; ULONG Length = 0;
+
+			if (Request->DescriptorType == USB_DEVICE_DESCRIPTOR_TYPE)
+			{
+				Descriptor = Host.DeviceDescriptor; Length = sizeof(Host.DeviceDescriptor);
+			}
+			else if ((Request->DescriptorType == USB_CONFIGURATION_DESCRIPTOR_TYPE) && (Request->Index == 0))
+			{
+				Descriptor = Host.ConfigurationDescriptor; Length = Host.ConfigurationLength;
+			}
+
+			if (Descriptor)
+			{
+				Request->TransferBufferLength = min(Request->TransferBufferLength, Length);
+
+				memcpy(Request->TransferBuffer, Descriptor, Request->TransferBufferLength);
+			}
+			else
+			{
+				UsbdStatus = USBD_STATUS_STALL_PID;
+			}
+		}
+		break;
+
+		case URB_FUNCTION_SELECT_CONFIGURATION:
+		{
+			PUSB_CONFIGURATION_DESCRIPTOR ConfigurationDescriptor = Urb->UrbSelectConfiguration.ConfigurationDescriptor;
+
+			// A NULL configuration unconfigures the device.
+			if (ConfigurationDescriptor)
+			{
+				PUSBD_INTERFACE_INFORMATION Interface = &Urb->UrbSelectConfiguration.Interface;
+
+				for (ULONG i = 0; (i < ConfigurationDescriptor->bNumInterfaces) && USBD_SUCCESS(UsbdStatus); i++)
+				{
+					if (!SelectInterface(Interface))
+					{
+						UsbdStatus = USBD_STATUS_INVALID_PARAMETER;
+					}
+
+					Interface = PUSBD_INTERFACE_INFORMATION(PUCHAR(Interface) + Interface->Length);
+				}
+
+				Urb->UrbSelectConfiguration.ConfigurationHandle = USBD_CONFIGURATION_HANDLE(Host.ConfigurationDescriptor);
+			}
+		}
+		break;
+
+		case URB_FUNCTION_SELECT_INTERFACE:
+		{
+			if ((Urb->UrbSelectInterface.ConfigurationHandle != USBD_CONFIGURATION_HANDLE(Host.ConfigurationDescriptor)) ||
+				!SelectInterface(&Urb->UrbSelectInterface.Interface))
+			{
+				UsbdStatus = USBD_STATUS_INVALID_PARAMETER;
+			}
+		}
+		break;
+
+		case URB_FUNCTION_CLASS_ENDPOINT:
+		{
+			struct _URB_CONTROL_VENDOR_OR_CLASS_REQUEST * Request = &Urb->UrbControlVendorClassRequest;
+
+			// Only the sampling frequency control of the data endpoint.
+			if ((Request->Index != DATA_ENDPOINT) || (Request->Value != (USB_AUDIO_EP_CONTROL_SAMPLING_FREQUENCY << 8)) || (Request->TransferBufferLength < 3))
+			{
+				UsbdStatus = USBD_STATUS_STALL_PID;
+			}
+			else if (Request->TransferFlags & USBD_TRANSFER_DIRECTION_IN)
+			{
+				PUCHAR Buffer = PUCHAR(Request->TransferBuffer);
+
+				Buffer[0] = UCHAR(Host.SampleRate); Buffer[1] = UCHAR(Host.SampleRate >> 8); Buffer[2] = UCHAR(Host.SampleRate >> 16);
+
+				Request->TransferBufferLength = 3;
+			}
+			else
+			{
+				PUCHAR Buffer = PUCHAR(Request->TransferBuffer);
+
+				Host.SampleRate = Buffer[0] | (Buffer[1] << 8) | (Buffer[2] << 16);
+			}
+		}
+		break;
+
+		case URB_FUNCTION_RESET_PIPE:
+		{
+			if (!FindEndpoint(Urb->UrbPipeRequest.PipeHandle))
+			{
+				UsbdStatus = USBD_STATUS_INVALID_PIPE_HANDLE;
+			}
+		}
+		break;
+
+		case URB_FUNCTION_ABORT_PIPE:
+		{
+			ENDPOINT * Endpoint = FindEndpoint(Urb->UrbPipeRequest.PipeHandle);
+
+			if (Endpoint)
+			{
+				// What was played completes as it is, the rest is cancelled.
+				for (PIRP Done = Pop(&Endpoint->Done); Done; Done = Pop(&Endpoint->Done))
+				{
+					Complete(Done, NT_SUCCESS(UrbOf(Done)->UrbHeader.Status) ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL);
+				}
+
+				for (PIRP Scheduled = Pop(&Endpoint->Scheduled); Scheduled; Scheduled = Pop(&Endpoint->Scheduled))
+				{
+					FailIsochronous(Scheduled, STATUS_CANCELLED, USBD_STATUS_CANCELED);
+				}
+			}
+			else
+			{
+				UsbdStatus = USBD_STATUS_INVALID_PIPE_HANDLE;
+			}
+		}
+		break;
+
+		case URB_FUNCTION_GET_CURRENT_FRAME_NUMBER:
+		{
+			Urb->UrbGetCurrentFrameNumber.FrameNumber = Host.Frame;
+		}
+		break;
+
+		default:
+		{
+			UsbdStatus = USBD_STATUS_STALL_PID;
+		}
+		break;
+	}
+
+	Urb->UrbHeader.Status = UsbdStatus;
+
+	Complete(Irp, USBD_SUCCESS(UsbdStatus) ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL);
+}
+
+/*****************************************************************************
+ * InternalDeviceControl()
+ *****************************************************************************
+ * @brief
+ * IOCTL_INTERNAL_USB_SUBMIT_URB. Everything is queued: the isochronous URBs
+ * for their frame, the others for the next frame. While the device is
+ * unplugged, everything fails at once.
+ */
+static NTSTATUS
+InternalDeviceControl
+(
+	PDEVICE_OBJECT	DeviceObject,
+	PIRP			Irp
+)
+{
+	UNREFERENCED_PARAMETER(DeviceObject);
+
+	PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+
+	if (Stack->Parameters.DeviceIoControl.IoControlCode != IOCTL_INTERNAL_USB_SUBMIT_URB)
+	{
+		return Complete(Irp, STATUS_INVALID_DEVICE_REQUEST);
+	}
+
+	PURB Urb = UrbOf(Irp);
+
+	if (Host.Unplugged)
+	{
+		if (Urb->UrbHeader.Function == URB_FUNCTION_ISOCH_TRANSFER)
+		{
+			Host.Result->UnpluggedUrbs++;
+		}
+
+		Urb->UrbHeader.Status = USBD_STATUS_DEVICE_GONE;
+
+		return Complete(Irp, STATUS_DEVICE_NOT_CONNECTED);
+	}
+
+	if (Urb->UrbHeader.Function == URB_FUNCTION_ISOCH_TRANSFER)
+	{
+		ENDPOINT * Endpoint = FindEndpoint(Urb->UrbIsochronousTransfer.PipeHandle);
+
+		if (!Endpoint)
+		{
+			Urb->UrbHeader.Status = USBD_STATUS_INVALID_PIPE_HANDLE;
+
+			return Complete(Irp, STATUS_INVALID_PARAMETER);
+		}
+
+		if (Urb->UrbIsochronousTransfer.TransferFlags & USBD_START_ISO_TRANSFER_ASAP)
+		{
+			ShimFail("ASAP isochronous URB on endpoint 0x%02x, the pipes schedule their frames", Endpoint->EndpointAddress);
+		}
+
+		Put(&Endpoint->Scheduled, Irp);
+	}
+	else
+	{
+		if (Host.ControlCount == MAX_QUEUED_URB)
+		{
+			ShimFail("more than %u control URBs queued", MAX_QUEUED_URB);
+		}
+
+		Host.Control[Host.ControlCount++] = Irp;
+	}
+
+	IoMarkIrpPending(Irp);
+
+	IoSetCancelRoutine(Irp, CancelRoutine);
+
+	return STATUS_PENDING;
+}
+
+/*****************************************************************************
+ * QueryBusTime()/IsDeviceHighSpeed()
+ *****************************************************************************
+ * @brief
+ * The USBDI bus interface.
+ */
+static NTSTATUS
+QueryBusTime
+(
+	PVOID	BusContext,
+	PULONG	CurrentFrame
+)
+{
+	UNREFERENCED_PARAMETER(BusContext);
+
+	*CurrentFrame = Host.Frame;
+
+	return STATUS_SUCCESS;
+}
+
+static BOOLEAN
+IsDeviceHighSpeed
+(
+	PVOID	BusContext
+)
+{
+	UNREFERENCED_PARAMETER(BusContext);
+
+	return Host.Device->HighSpeed ? TRUE : FALSE;
+}
+
+static VOID
+InterfaceReference
+(
+	PVOID	Context
+)
+{
+	UNREFERENCED_PARAMETER(Context);
+}
+
+/*****************************************************************************
+ * Pnp()
+ *****************************************************************************
+ * @brief
+ * IRP_MN_QUERY_INTERFACE for the USBDI bus interface, versions 0 and 1.
+ */
+static NTSTATUS
+Pnp
+(
+	PDEVICE_OBJECT	DeviceObject,
+	PIRP			Irp
+)
+{
+	UNREFERENCED_PARAMETER(DeviceObject);
+
+	PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+
+	if ((Stack->MinorFunction == IRP_MN_QUERY_INTERFACE) &&
+		IsEqualGUIDAligned(*Stack->Parameters.QueryInterface.InterfaceType, USB_BUS_INTERFACE_USBDI_GUID) &&
+		(Stack->Parameters.QueryInterface.Version <= USB_BUSIF_USBDI_VERSION_1))
+	{
+		USB_BUS_INTERFACE_USBDI_V1 BusInterface;
+
+		RtlZeroMemory(&BusInterface, sizeof(BusInterface));
+
+		BusInterface.Size = Stack->Parameters.QueryInterface.Size;
+		BusInterface.Version = Stack->Parameters.QueryInterface.Version;
+		BusInterface.BusContext = &Host;
+		BusInterface.InterfaceReference = InterfaceReference;
+		BusInterface.InterfaceDereference = InterfaceReference;
+		BusInterface.QueryBusTime = QueryBusTime;
+		BusInterface.IsDeviceHighSpeed = IsDeviceHighSpeed;
+
+		RtlCopyMemory(Stack->Parameters.QueryInterface.Interface, &BusInterface, min(ULONG(Stack->Parameters.QueryInterface.Size), ULONG(sizeof(BusInterface))));
+
+		return Complete(Irp, STATUS_SUCCESS);
+	}
+
+	return Complete(Irp, Irp->IoStatus.Status);
+}
+
+/*****************************************************************************
+ * Play()
+ *****************************************************************************
+ * @brief
+ * The device plays one packet interval.
+ */
+static void
+Play
+(
+	double	Ppm
+)
+{
+	RESULT * Result = Host.Result;
+
+	if (!Host.Playing && (Host.Buffered >= Host.TargetLevel))
+	{
+		Host.Playing = TRUE;
+	}
+
+	if (Host.Playing)
+	{
+		Host.Played += Host.Nominal * (1.0 + Ppm * 1e-6);
+
+		ULONGLONG Frames = ULONGLONG(Host.Played) - Host.PlayedFrames;
+
+		Host.PlayedFrames += Frames;
+
+		if (Host.Buffered < Frames)
+		{
+			// A lost packet or a late URB may leave the device short until
+			// it has refilled its buffer. Unplugged, it has nothing to play.
+			if ((Host.Ms < Host.RunTime) && (!Host.Disturbed || (Host.Ms > Host.LastDisturbance + REFILL_TIME)))
+			{
+				Result->Underruns++;
+			}
+
+			Host.Buffered = 0;
+		}
+		else
+		{
+			Host.Buffered -= Frames;
+		}
+
+		if (Host.Buffered > Host.Capacity)
+		{
+			Result->Overruns++;
+
+			Host.Buffered = Host.Capacity;
+		}
+	}
+}
+
+/*****************************************************************************
+ * Disturb()
+ *****************************************************************************
+ * @brief
+ * Note that the device may run short for a while.
+ */
+static void
+Disturb
+(	void
+)
+{
+	Host.LastDisturbance = Host.Ms;
+
+	Host.Disturbed = TRUE;
+}
+
+/*****************************************************************************
+ * Frame()
+ *****************************************************************************
+ * @brief
+ * A bus frame: the control URBs queued before it complete, the isochronous
+ * URBs for it are played, then the host controller completes what was
+ * played unless it is stalled. Also the idle routine of the shim, so that
+ * the bus runs while the driver waits: FALSE if the host controller held
+ * no URB, as then the frame cannot end the wait.
+ */
+static BOOL
+Frame
+(	void
+)
+{
+	const DEVICE * Device = Host.Device;
+
+	RESULT * Result = Host.Result;
+
+	BOOL Busy = Host.ControlCount || Host.DataEndpoint.Scheduled.Count || Host.DataEndpoint.Done.Count || Host.SynchEndpoint.Scheduled.Count || Host.SynchEndpoint.Done.Count;
+
+	ShimTime += 10000;
+
+	ULONG FrameNumber = ++Host.Frame;
+
+	double Time = Host.Ms / 1000.0;
+
+	double Ppm = Device->Ppm + Device->WanderPpm * sin(2 * M_PI * Time / 20.0);
+
+	KIRQL OldIrql; KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+	// Control transfers.
+	for (ULONG n = Host.ControlCount; n; n--)
+	{
+		PIRP Irp = Host.Control[0];
+
+		memmove(&Host.Control[0], &Host.Control[1], (Host.ControlCount - 1) * sizeof(PIRP));
+
+		Host.ControlCount--;
+
+		ControlTransfer(Irp);
+	}
+
+	ENDPOINT * Endpoint[] = { &Host.DataEndpoint, &Host.SynchEndpoint };
+
+	// The device is gone: the URBs it holds fail.
+	if (Host.Unplugged)
+	{
+		for (ULONG i = 0; i < 2; i++)
+		{
+			for (PIRP Irp = Pop(&Endpoint[i]->Done); Irp; Irp = Pop(&Endpoint[i]->Done))
+			{
+				Complete(Irp, STATUS_SUCCESS);
+			}
+
+			for (PIRP Irp = Pop(&Endpoint[i]->Scheduled); Irp; Irp = Pop(&Endpoint[i]->Scheduled))
+			{
+				Result->UnpluggedUrbs++;
+
+				FailIsochronous(Irp, STATUS_DEVICE_NOT_CONNECTED, USBD_STATUS_DEVICE_GONE);
+			}
+		}
+	}
+
+	// URBs for frames that have passed never made it on the bus.
+	for (ULONG i = 0; i < 2; i++)
+	{
+		while (Endpoint[i]->Scheduled.Count && (LONG(UrbOf(Endpoint[i]->Scheduled.Irp[0])->UrbIsochronousTransfer.StartFrame - FrameNumber) < 0))
+		{
+			PIRP Irp = Pop(&Endpoint[i]->Scheduled);
+
+			PURB Urb = UrbOf(Irp);
+
+			for (ULONG j = 0; j < Urb->UrbIsochronousTransfer.NumberOfPackets; j++)
+			{
+				Urb->UrbIsochronousTransfer.IsoPacket[j].Status = USBD_STATUS_ISO_NOT_ACCESSED_LATE;
+
+				if (Urb->UrbIsochronousTransfer.TransferFlags & USBD_TRANSFER_DIRECTION_IN)
+				{
+					Urb->UrbIsochronousTransfer.IsoPacket[j].Length = 0;
+				}
+			}
+
+			Urb->UrbIsochronousTransfer.ErrorCount = Urb->UrbIsochronousTransfer.NumberOfPackets;
+
+			Urb->UrbHeader.Status = USBD_STATUS_ISOCH_REQUEST_FAILED;
+
+			Put(&Endpoint[i]->Done, Irp);
+
+			if (i == 0)
+			{
+				Result->LateUrbs++;
+
+				Disturb();
+			}
+		}
+	}
+
+	// The OUT endpoint: the packets of the URB for this frame, one per
+	// packet interval, while the device plays.
+	PIRP DataIrp = NULL;
+
+	if (Host.DataEndpoint.Scheduled.Count && (UrbOf(Host.DataEndpoint.Scheduled.Irp[0])->UrbIsochronousTransfer.StartFrame == FrameNumber))
+	{
+		DataIrp = Pop(&Host.DataEndpoint.Scheduled);
+	}
+
+	for (ULONG i = 0; i < Host.PacketsPerMs; i++)
+	{
+		if (DataIrp && (i < UrbOf(DataIrp)->UrbIsochronousTransfer.NumberOfPackets))
+		{
+			USBD_ISO_PACKET_DESCRIPTOR * Packet = &UrbOf(DataIrp)->UrbIsochronousTransfer.IsoPacket[i];
+
+			Packet->Status = USBD_STATUS_SUCCESS;
+
+			if (Random() < Device->Loss)
+			{
+				Result->LostPackets++;
+
+				Disturb();
+			}
+			else
+			{
+				Host.Buffered += Packet->Length / Host.FrameSize;
+
+			}
+		}
+
+		Play(Ppm);
+	}
+
+	if (DataIrp)
+	{
+		UrbOf(DataIrp)->UrbHeader.Status = USBD_STATUS_SUCCESS;
+
+		Put(&Host.DataEndpoint.Done, DataIrp);
+	}
+
+	// The feedback endpoint.
+	if (Host.SynchEndpoint.Scheduled.Count && (UrbOf(Host.SynchEndpoint.Scheduled.Irp[0])->UrbIsochronousTransfer.StartFrame == FrameNumber))
+	{
+		PIRP Irp = Pop(&Host.SynchEndpoint.Scheduled);
+
+		PURB Urb = UrbOf(Irp);
+
+		// The frames counted since the last value, read with some jitter.
+		double Count = Host.Played + Device->Jitter * (2 * Random() - 1);
+
+		ULONG Frames = FrameNumber - Host.LastFeedbackFrame;
+
+		double Rate = (Host.Playing && Frames) ? (Count - Host.LastCount) / (Frames * Host.PacketsPerMs) : Host.Nominal;
+
+		Host.LastCount = Count;
+
+		Host.LastFeedbackFrame = FrameNumber;
+
+		// Nudged to bring the buffer back to its level over about a second.
+		Rate += (Host.TargetLevel - Host.Buffered) / (1000.0 * Host.PacketsPerMs);
+
+		ULONG TransferRate = ULONG(llround(ldexp(Rate, Device->HighSpeed ? 16 : 14)));
+
+		ULONG Length = Device->HighSpeed ? 4 : 3;
+
+		USBD_ISO_PACKET_DESCRIPTOR * Packet = &Urb->UrbIsochronousTransfer.IsoPacket[0];
+
+		if ((Random() < Device->Loss) || (Packet->Offset + Length > Urb->UrbIsochronousTransfer.TransferBufferLength))
+		{
+			Packet->Length = 0;
+		}
+		else
+		{
+			memcpy(PUCHAR(Urb->UrbIsochronousTransfer.TransferBuffer) + Packet->Offset, &TransferRate, Length);
+
+			Packet->Length = Length;
+		}
+
+		Packet->Status = USBD_STATUS_SUCCESS;
+
+		Urb->UrbHeader.Status = USBD_STATUS_SUCCESS;
+
+		Put(&Host.SynchEndpoint.Done, Irp);
+	}
+
+	// The device goes between the packets of the frame and their
+	// completion: the completion routines resubmit into nothing.
+	if (Host.Ms == Host.RunTime)
+	{
+		Host.Unplugged = TRUE;
+	}
+
+	// A late DPC holds the completions for a few frames.
+	if (!Host.StallFrames && (Random() < Device->Stall))
+	{
+		Host.StallFrames = 1 + (rand() % MAX_STALL);
+
+		Disturb();
+	}
+
+	if (Host.StallFrames)
+	{
+		Host.StallFrames--;
+	}
+	else
+	{
+		double Start = Now();
+
+		// The completion routines resubmit to Scheduled, never to Done.
+		for (ULONG i = 0; i < 2; i++)
+		{
+			for (PIRP Irp = Pop(&Endpoint[i]->Done); Irp; Irp = Pop(&Endpoint[i]->Done))
+			{
+				Complete(Irp, USBD_SUCCESS(UrbOf(Irp)->UrbHeader.Status) ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL);
+			}
+		}
+
+		Host.CompletionTime += Now() - Start;
+	}
+
+	KeLowerIrql(OldIrql);
+
+	return Busy;
+}
+
+/*****************************************************************************
+ * QueuedFrames()
+ *****************************************************************************
+ * @brief
+ * Frames in the OUT URBs waiting for their frame.
+ */
+static ULONG
+QueuedFrames
+(	void
+)
+{
+	ULONG Bytes = 0;
+
+	for (ULONG i = 0; i < Host.DataEndpoint.Scheduled.Count; i++)
+	{
+		Bytes += UrbOf(Host.DataEndpoint.Scheduled.Irp[i])->UrbIsochronousTransfer.TransferBufferLength;
+	}
+
+	return Bytes / Host.FrameSize;
+}
+
+/*****************************************************************************
+ * Run()
+ *****************************************************************************
+ * @brief
+ * Bring the driver up on a device, play Seconds of audio into it, unplug
+ * it and plug it back, and tear the driver down.
+ */
+static BOOL
+Run
+(
+	const DEVICE *	Device,
+	ULONG			FeedbackMode,
+	ULONG			Seconds,
+	RESULT *		Result
+)
+{
+	memset(Result, 0, sizeof(RESULT));
+
+	memset(&Host, 0, sizeof(Host));
+
+	Host.Device = Device;
+	Host.FeedbackEndpoint = (FeedbackMode == FEEDBACK_ENDPOINT_PRESENT);
+	Host.PacketsPerMs = Device->HighSpeed ? 8 : 1;
+	Host.FrameSize = Device->Channels * 3;
+	Host.Result = Result;
+	Host.RunTime = Seconds * 1000;
+	Host.Frame = 1000;
+	Host.DataEndpoint.EndpointAddress = DATA_ENDPOINT;
+	Host.SynchEndpoint.EndpointAddress = FEEDBACK_ENDPOINT;
+
+	Host.DriverObject.MajorFunction[IRP_MJ_INTERNAL_DEVICE_CONTROL] = InternalDeviceControl;
+	Host.DriverObject.MajorFunction[IRP_MJ_PNP] = Pnp;
+	Host.DeviceObject.DriverObject = &Host.DriverObject;
+	Host.DeviceObject.StackSize = 1;
+
+	// The device starts playing once it holds a ms, and tries to keep there.
+	Host.Nominal = double(Device->SampleRate) / (1000.0 * Host.PacketsPerMs);
+	Host.TargetLevel = Host.Nominal * Host.PacketsPerMs;
+	Host.Capacity = 4 * Host.TargetLevel;
+
+	BuildDescriptors();
+
+	ShimIdleRoutine = Frame;
+
+	srand(1);
+
+	// The adapter: CUsbDevice, then CAudioDevice on it.
+	CUsbDevice * UsbDevice = new(NonPagedPool) CUsbDevice(NULL);
+
+	UsbDevice->AddRef();
+
+	UsbDevice->Init(&Host.DeviceObject, NULL, NULL);
+
+	if (!NT_SUCCESS(UsbDevice->StartDevice()))
+	{
+		printf("FAILED: CUsbDevice::StartDevice()\n");
+		return FALSE;
+	}
+
+	CAudioDevice * AudioDevice = new(NonPagedPool) CAudioDevice(NULL);
+
+	AudioDevice->AddRef();
+
+	if (!AUDIO_SUCCESS(AudioDevice->Init(UsbDevice)))
+	{
+		printf("FAILED: CAudioDevice::Init()\n");
+		return FALSE;
+	}
+
+	// The KS pin: open a client on the streaming interface and set it up.
+	PAUDIO_CLIENT Client = NULL;
+
+	if (!AUDIO_SUCCESS(AudioDevice->Open(NULL, NULL, &Client)) ||
+		!AUDIO_SUCCESS(Client->SetInterfaceParameter(STREAMING_INTERFACE, 1, AUDIO_PRIORITY_NORMAL, 0)))
+	{
+		printf("FAILED: opening the streaming interface\n");
+		return FALSE;
+	}
+
+	ULONG SampleRate = Device->SampleRate;
+
+	if (!AUDIO_SUCCESS(Client->QueryControlSupport(USB_AUDIO_EP_CONTROL_SAMPLING_FREQUENCY)) ||
+		!AUDIO_SUCCESS(Client->WriteControl(REQUEST_CUR, USB_AUDIO_EP_CONTROL_SAMPLING_FREQUENCY, 0, &SampleRate, sizeof(ULONG))) ||
+		(Host.SampleRate != Device->SampleRate))
+	{
+		printf("FAILED: setting the sampling frequency\n");
+		return FALSE;
+	}
+
+	if (!NT_SUCCESS(Client->SetupBuffer(Device->SampleRate, Device->Channels, 24, FALSE, MAX_AUDIO_OUTPUT_IRP)) ||
+		!AUDIO_SUCCESS(Client->SetTransferDepth(Device->Adaptive, Device->TransferDepth)))
+	{
+		printf("FAILED: setting up the buffer\n");
+		return FALSE;
+	}
+
+	ULONG Period = CLIENT_PERIOD * Device->SampleRate / 1000;
+
+	PUCHAR ClientBuffer = PUCHAR(malloc(size_t(2 * Period) * Host.FrameSize));
+
+	for (ULONG i = 0; i < 2 * Period * Host.FrameSize; i++)
+	{
+		ClientBuffer[i] = UCHAR(rand());
+	}
+
+	// Prime the pipe, and run.
+	Client->WriteBuffer(ClientBuffer, 2 * Period * Host.FrameSize);
+
+	if (!AUDIO_SUCCESS(Client->Start(FALSE, 0)))
+	{
+		printf("FAILED: CAudioClient::Start()\n");
+		return FALSE;
+	}
+
+	double LatencySum = 0, FirstWindow = 0, LastWindow = 0;
+
+	ULONG LatencySamples = 0;
+
+	Result->LatencyMinimum = 1e30;
+
+	ULONG RunTime = Host.RunTime;
+
+	for (Host.Ms = 0; Host.Ms < RunTime + UNPLUG_TIME; Host.Ms++)
+	{
+		ULONG Ms = Host.Ms;
+
+		if ((Ms % CLIENT_PERIOD) == 0)
+		{
+			if ((Ms % VOLUME_PERIOD) == 0)
+			{
+				for (ULONG ch = 0; ch < Device->Channels; ch++)
+				{
+					AudioDevice->SetMasterVolume(ch, ((Ms / VOLUME_PERIOD) & 1) ? -20 * 65536 : 0);
+				}
+			}
+
+			ULONG FramesQueued = Client->GetNumQueuedFrames();
+
+			ULONG NumberOfFrames = (FramesQueued < 2 * Period) ? (2 * Period - FramesQueued) : 0;
+
+			double Start = Now();
+
+			Client->WriteBuffer(ClientBuffer, NumberOfFrames * Host.FrameSize);
+
+			if (Ms < RunTime) Result->ClientTime += Now() - Start;
+		}
+
+		Frame();
+
+		// Latency of the frames the client wrote last.
+		if ((Ms >= SETTLE_TIME) && (Ms < RunTime))
+		{
+			double Latency = (Client->GetNumQueuedFrames() + QueuedFrames() + Host.Buffered) * 1000.0 / Device->SampleRate;
+
+			LatencySum += Latency;
+
+			LatencySamples++;
+
+			if (Latency < Result->LatencyMinimum) Result->LatencyMinimum = Latency;
+			if (Latency > Result->LatencyMaximum) Result->LatencyMaximum = Latency;
+
+			// The drift leaves out what the pipe added when it deepened.
+			if ((Ms < SETTLE_TIME + LATENCY_WINDOW) || (Ms >= RunTime - LATENCY_WINDOW))
+			{
+				AUDIO_TRANSFER_DEPTH TransferDepth; Client->GetTransferDepth(&TransferDepth);
+
+				if (Ms < SETTLE_TIME + LATENCY_WINDOW) FirstWindow += Latency - TransferDepth.Depth;
+				if (Ms >= RunTime - LATENCY_WINDOW) LastWindow += Latency - TransferDepth.Depth;
+			}
+		}
+
+		if (Ms == RunTime - 1)
+		{
+			ULONG ClockRatio = 1UL << 30; Client->GetClockRatio(&ClockRatio);
+
+			Result->ClockPpm = (ldexp(ClockRatio, -30) - 1.0) * 1e6;
+
+			Client->GetTransferDepth(&Result->TransferDepth);
+
+			Result->PipeTime = Host.CompletionTime;
+		}
+	}
+
+	Result->LatencyMean = LatencySum / LatencySamples;
+	Result->LatencyDrift = (LastWindow - FirstWindow) / LATENCY_WINDOW;
+	Result->ClientTime /= RunTime;
+	Result->PipeTime /= double(RunTime) * Host.PacketsPerMs;
+
+	// The KS pin and the adapter: stop, close, and let the device go.
+	Client->Stop();
+
+	Client->SetInterfaceParameter(STREAMING_INTERFACE, 0, AUDIO_PRIORITY_NONE, 0);
+
+	AudioDevice->Close(Client);
+
+	AudioDevice->Release();
+
+	UsbDevice->StopDevice();
+
+	UsbDevice->Release();
+
+	free(ClientBuffer);
+
+	ShimIdleRoutine = NULL;
+
+	if (Host.ControlCount || Host.DataEndpoint.Scheduled.Count || Host.DataEndpoint.Done.Count || Host.SynchEndpoint.Scheduled.Count || Host.SynchEndpoint.Done.Count)
+	{
+		printf("FAILED: URBs left with the host controller after the driver stopped\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(
+	int		argc,
+	char **	argv
+)
+{
+	ULONG Seconds = (argc > 1) ? strtoul(argv[1], NULL, 0) : NUMBER_OF_SECONDS;
+
+	if (Seconds * 1000 < SETTLE_TIME + 2 * LATENCY_WINDOW)
+	{
+		fprintf(stderr, "usage: isosim [seconds, at least %u]\n", (SETTLE_TIME + 2 * LATENCY_WINDOW) / 1000);
+		return 1;
+	}
+
+	static const DEVICE Devices[] =
+	{
+		//  name                   rate ch     hs depth adaptive refresh  ppm wander jitter    loss  stall
+		{ "full speed",           48000, 2, FALSE, 4, FALSE, 1,  +100.0,   0.0,  0.05, 0,     0    },
+		{ "full speed, lossy",    44100, 2, FALSE, 2, FALSE, 3,  -250.0,  50.0,  0.10, 1e-3,  0    },
+		{ "high speed, noisy",    96000, 8,  TRUE, 4, FALSE, 1,   +50.0, 100.0,  0.50, 0,     0    },
+		{ "high speed, lossy",   192000, 8,  TRUE, 8, FALSE, 1,   -80.0,  20.0,  0.20, 1e-4,  0    },
+		{ "high speed, stalls",   48000, 2,  TRUE, 2,  TRUE, 2,   +30.0,  10.0,  0.20, 0,     2e-3 },
+	};
+
+	printf("%lu s per run, master volume stepping every %u ms, unplugged for %u ms at the end\n", (unsigned long)Seconds, VOLUME_PERIOD, UNPLUG_TIME);
+	printf("device                 feedback   underruns overruns lost late  latency (ms)                drift  depth     clock   client    pipe\n");
+	printf("                                                                mean    min    max         ms     late      ppm     ns/ms     ns/packet\n");
+
+	static const char * ModeName[] = { "endpoint", "none" };
+
+	int Result = 0;
+
+	for (ULONG d = 0; d < sizeof(Devices) / sizeof(Devices[0]); d++)
+	{
+		for (ULONG Mode = FEEDBACK_ENDPOINT_PRESENT; Mode <= FEEDBACK_ENDPOINT_NONE; Mode++)
+		{
+			RESULT Run_;
+
+			if (!Run(&Devices[d], Mode, Seconds, &Run_))
+			{
+				return 1;
+			}
+
+			// With the feedback, the device must only run short while it
+			// refills after a lost packet or a late URB, and the latency
+			// must not creep. An adaptive pipe must have deepened on the
+			// late URBs. Either way, the pipe must have failed its URBs
+			// while the device was gone.
+			int Failed = (Mode == FEEDBACK_ENDPOINT_PRESENT) && (Run_.Underruns || Run_.Overruns || (fabs(Run_.LatencyDrift) > 0.5) ||
+						 (Devices[d].Adaptive && (Run_.TransferDepth.Depth <= Run_.TransferDepth.MinimumDepth)));
+
+			Failed |= !Run_.UnpluggedUrbs;
+
+			printf("%s  %-20s %-8s %8u %8u %5u %4u %7.2f %6.2f %6.2f %+10.2f %2u->%-2u %4u %+8.1f %9.0f %9.0f\n",
+				Failed ? "FAIL" : "ok  ", Devices[d].Name, ModeName[Mode],
+				Run_.Underruns, Run_.Overruns, Run_.LostPackets, Run_.LateUrbs,
+				Run_.LatencyMean, Run_.LatencyMinimum, Run_.LatencyMaximum, Run_.LatencyDrift,
+				Run_.TransferDepth.MinimumDepth, Run_.TransferDepth.Depth, Run_.TransferDepth.LateCompletions,
+				Run_.ClockPpm, Run_.ClientTime, Run_.PipeTime);
+
+			Result |= Failed;
+		}
+	}
+
+	printf("%s\n", Result ? "FAILED" : "PASSED");
+
+	return Result;
+}
@@ -0,0 +1,450 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       loadbench.cpp
+ * @brief      Exercises the DSP load meter of the ASIO engine
+ *             (asiodll/loadmeter.cpp).
+ * @details
+ * The writer feeds the meter stage times that are a known function of the
+ * switch index, as the main thread would with performance counter values,
+ * so the statistics and the records can be checked exactly: minimum,
+ * maximum, total, deadline misses, and which records the ring still holds.
+ *
+ * Then the section is put in shared memory between two processes, as
+ * between the ASIO driver and a monitor, and the monitor process checks
+ * every copy of the statistics and every record it gets while the writer
+ * runs flat out. A torn copy fails the program. The cost of a Record() is
+ * reported, as it is paid on every buffer switch.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -I../include -I../../asiodll -o loadbench loadbench.cpp ../../asiodll/loadmeter.cpp
+ *     ./loadbench [switches]
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "windows.h"
+#include "loadmeter.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Sample rate and buffer size of the runs: a 1 ms period. */
+#define SAMPLE_RATE		48000
+#define BUFFER_SIZE		48
+#define PERIOD			1000000
+
+/*! @brief Counter frequency of the runs: a tick is a ns. */
+#define FREQUENCY		1000000000
+
+/*! @brief Cycle of the stage times. 97 is prime, so it does not line up with the ring. */
+#define CYCLE			97
+
+/*****************************************************************************
+ * Check()
+ *****************************************************************************
+ * @brief
+ * Fail the program if Condition does not hold.
+ */
+static void
+Check
+(
+	IN		bool			Condition,
+	IN		const char *	What
+)
+{
+	if (!Condition)
+	{
+		fprintf(stderr, "FAILED: %s\n", What);
+		exit(1);
+	}
+}
+
+/*****************************************************************************
+ * StageTime()
+ *****************************************************************************
+ * @brief
+ * Time of a stage in switch i, in ns. The host takes most of it, and the
+ * last few switches of a cycle go past the period.
+ */
+static ULONG
+StageTime
+(
+	IN		ULONG	Stage,
+	IN		ULONG	i
+)
+{
+	return (i % CYCLE) * ((Stage == ASIO_LOAD_STAGE_HOST) ? 11000 : 100) + Stage * 10 + 1;
+}
+
+/*****************************************************************************
+ * SwitchTime()
+ *****************************************************************************
+ * @brief
+ * Time of switch i, in ns.
+ */
+static ULONG
+SwitchTime
+(
+	IN		ULONG	i
+)
+{
+	ULONG Time = 0;
+
+	for (ULONG Stage=0; Stage<ASIO_LOAD_STAGE_COUNT; Stage++)
+	{
+		Time += StageTime(Stage, i);
+	}
+
+	return Time;
+}
+
+/*****************************************************************************
+ * Feed()
+ *****************************************************************************
+ * @brief
+ * Write switch i as the main thread does, a stage at a time. The output is
+ * marked twice, as around the host's callback.
+ */
+static void
+Feed
+(
+	IN		CAsioLoadMeter *	Meter,
+	IN		ULONG				i
+)
+{
+	LONGLONG Counter = LONGLONG(i) * 10 * PERIOD;
+
+	Meter->Begin(Counter);
+
+	Counter += StageTime(ASIO_LOAD_STAGE_INPUT, i); Meter->Mark(ASIO_LOAD_STAGE_INPUT, Counter);
+
+	Counter += StageTime(ASIO_LOAD_STAGE_QUEUE, i) / 2; Meter->Mark(ASIO_LOAD_STAGE_QUEUE, Counter);
+
+	Counter += StageTime(ASIO_LOAD_STAGE_OUTPUT, i) / 2; Meter->Mark(ASIO_LOAD_STAGE_OUTPUT, Counter);
+
+	Counter += StageTime(ASIO_LOAD_STAGE_HOST, i); Meter->Mark(ASIO_LOAD_STAGE_HOST, Counter);
+
+	Counter += StageTime(ASIO_LOAD_STAGE_OUTPUT, i) - StageTime(ASIO_LOAD_STAGE_OUTPUT, i) / 2; Meter->Mark(ASIO_LOAD_STAGE_OUTPUT, Counter);
+
+	Counter += StageTime(ASIO_LOAD_STAGE_QUEUE, i) - StageTime(ASIO_LOAD_STAGE_QUEUE, i) / 2; Meter->Mark(ASIO_LOAD_STAGE_QUEUE, Counter);
+
+	Meter->Record(i);
+}
+
+/*****************************************************************************
+ * CheckStatistics()
+ *****************************************************************************
+ * @brief
+ * Compare statistics with what the first NumberOfSwitches switches give.
+ * Returns false on a difference.
+ */
+static bool
+CheckStatistics
+(
+	IN		PASIO_LOAD_STATISTICS	Statistics
+)
+{
+	ULONG n = Statistics->NumberOfSwitches;
+
+	if ((Statistics->SampleRate != SAMPLE_RATE) || (Statistics->BufferSize != BUFFER_SIZE) || (Statistics->Period != PERIOD))
+	{
+		return false;
+	}
+
+	ULONG Cycles = n / CYCLE, Rest = n % CYCLE;
+
+	ULONG Misses = 0;
+
+	for (ULONG k=0; k<CYCLE; k++)
+	{
+		if (SwitchTime(k) > PERIOD)
+		{
+			Misses += Cycles + ((k < Rest) ? 1 : 0);
+		}
+	}
+
+	if (Statistics->DeadlineMisses != Misses)
+	{
+		return false;
+	}
+
+	// Times are linear in i % CYCLE: a + b * k.
+	ULONGLONG SumK = ULONGLONG(Cycles) * (CYCLE * (CYCLE - 1) / 2) + ULONGLONG(Rest) * (Rest - 1) / 2;
+
+	ULONG LastK = (n < CYCLE) ? n - 1 : CYCLE - 1;
+
+	for (ULONG Stage=0; Stage<=ASIO_LOAD_STAGE_COUNT; Stage++)
+	{
+		PASIO_LOAD_TIME Time = (Stage < ASIO_LOAD_STAGE_COUNT) ? &Statistics->Stages[Stage] : &Statistics->Switch;
+
+		ULONG a = (Stage < ASIO_LOAD_STAGE_COUNT) ? StageTime(Stage, 0) : SwitchTime(0);
+
+		ULONG b = ((Stage < ASIO_LOAD_STAGE_COUNT) ? StageTime(Stage, 1) : SwitchTime(1)) - a;
+
+		if (n && ((Time->Minimum != a) || (Time->Maximum != a + b * LastK) || (Time->Total != ULONGLONG(a) * n + b * SumK)))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*****************************************************************************
+ * CheckRecord()
+ *****************************************************************************
+ * @brief
+ * Compare a record with its switch. Returns false on a difference.
+ */
+static bool
+CheckRecord
+(
+	IN		PASIO_LOAD_RECORD	Record
+)
+{
+	for (ULONG Stage=0; Stage<ASIO_LOAD_STAGE_COUNT; Stage++)
+	{
+		if (Record->Times[Stage] != StageTime(Stage, Record->SwitchIndex))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*****************************************************************************
+ * TestMeter()
+ *****************************************************************************
+ * @brief
+ * Writer and reader in one process.
+ */
+static void
+TestMeter
+(	void
+)
+{
+	static CAsioLoadMeter Meter;
+
+	ASIO_LOAD_STATISTICS Statistics;
+
+	static ASIO_LOAD_RECORD Records[ASIO_LOAD_RECORD_COUNT * 2];
+
+	// Off without a performance counter.
+	Meter.Start(SAMPLE_RATE, BUFFER_SIZE, 0);
+
+	Feed(&Meter, 0);
+
+	Check(Meter.GetStatistics(&Statistics) && (Statistics.NumberOfSwitches == 0), "meter off");
+
+	Meter.Start(SAMPLE_RATE, BUFFER_SIZE, FREQUENCY);
+
+	ULONG Index = 0;
+
+	for (ULONG i=0; i<1000; i++)
+	{
+		Feed(&Meter, i);
+
+		Check(Meter.GetStatistics(&Statistics) && (Statistics.NumberOfSwitches == i + 1), "statistics copy");
+
+		Check(CheckStatistics(&Statistics), "statistics");
+
+		if (i < 10)
+		{
+			// A reader that keeps up gets every record.
+			Check(Meter.GetRecords(&Index, Records, ASIO_LOAD_RECORD_COUNT) == 1, "record count");
+
+			Check((Records[0].SwitchIndex == i) && CheckRecord(&Records[0]), "record");
+		}
+	}
+
+	// A reader that fell behind gets the ring, less the slot the writer
+	// could be on.
+	ULONG Count = Meter.GetRecords(&Index, Records, sizeof(Records)/sizeof(Records[0]));
+
+	Check((Count == ASIO_LOAD_RECORD_COUNT - 1) && (Index == 1000), "late reader count");
+
+	for (ULONG i=0; i<Count; i++)
+	{
+		Check((Records[i].SwitchIndex == 1000 - Count + i) && CheckRecord(&Records[i]), "late reader records");
+	}
+
+	Check(Meter.GetRecords(&Index, Records, sizeof(Records)/sizeof(Records[0])) == 0, "no new records");
+
+	// A restart clears the statistics; the ring goes on.
+	Meter.Start(SAMPLE_RATE, BUFFER_SIZE, FREQUENCY);
+
+	Check(Meter.GetStatistics(&Statistics) && (Statistics.NumberOfSwitches == 0), "restart");
+
+	Feed(&Meter, 0);
+
+	Check((Meter.GetRecords(&Index, Records, sizeof(Records)/sizeof(Records[0])) == 1) && (Records[0].SwitchIndex == 0), "record after restart");
+
+	// A reader only opens a section of the same layout.
+	ASIO_LOAD_SECTION Foreign; memset(&Foreign, 0, sizeof(Foreign));
+
+	CAsioLoadMeter Reader;
+
+	Check(!Reader.Open(&Foreign), "foreign section");
+
+	printf("  meter: statistics, records and restart ok\n");
+}
+
+/*****************************************************************************
+ * TestProcesses()
+ *****************************************************************************
+ * @brief
+ * Writer and monitor in two processes, over shared memory.
+ */
+static void
+TestProcesses
+(
+	IN		ULONG	NumberOfSwitches
+)
+{
+	PVOID Memory = mmap(NULL, sizeof(ASIO_LOAD_SECTION), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	Check(Memory != MAP_FAILED, "mmap");
+
+	static CAsioLoadMeter Writer;
+
+	Writer.Attach(Memory);
+
+	Writer.Start(SAMPLE_RATE, BUFFER_SIZE, FREQUENCY);
+
+	fflush(stdout);
+
+	pid_t Child = fork();
+
+	Check(Child >= 0, "fork");
+
+	if (Child == 0)
+	{
+		static CAsioLoadMeter Monitor;
+
+		if (!Monitor.Open(Memory))
+		{
+			_exit(2);
+		}
+
+		static ASIO_LOAD_RECORD Records[ASIO_LOAD_RECORD_COUNT];
+
+		ASIO_LOAD_STATISTICS Statistics; Statistics.NumberOfSwitches = 0;
+
+		ULONG Index = 0, Copies = 0, Retries = 0, RecordsRead = 0, Next = 0;
+
+		do
+		{
+			if (Monitor.GetStatistics(&Statistics))
+			{
+				if (!CheckStatistics(&Statistics))
+				{
+					_exit(3);
+				}
+
+				Copies++;
+			}
+			else
+			{
+				Retries++;
+			}
+
+			ULONG Count = Monitor.GetRecords(&Index, Records, sizeof(Records)/sizeof(Records[0]));
+
+			for (ULONG i=0; i<Count; i++)
+			{
+				// In order, possibly with a gap where the writer lapped the monitor.
+				if (!CheckRecord(&Records[i]) || (Records[i].SwitchIndex < Next))
+				{
+					_exit(4);
+				}
+
+				Next = Records[i].SwitchIndex + 1;
+			}
+
+			RecordsRead += Count;
+		}
+		while (Statistics.NumberOfSwitches < NumberOfSwitches);
+
+		printf("  monitor: %u consistent copies (%u given up), %u records\n", Copies, Retries, RecordsRead);
+
+		fflush(stdout);
+
+		_exit(0);
+	}
+
+	struct timespec Start; clock_gettime(CLOCK_MONOTONIC, &Start);
+
+	for (ULONG i=0; i<NumberOfSwitches; i++)
+	{
+		Feed(&Writer, i);
+	}
+
+	struct timespec Stop; clock_gettime(CLOCK_MONOTONIC, &Stop);
+
+	int Status = 0;
+
+	waitpid(Child, &Status, 0);
+
+	double Nanoseconds = ((Stop.tv_sec - Start.tv_sec) * 1e9 + (Stop.tv_nsec - Start.tv_nsec)) / NumberOfSwitches;
+
+	Check(WIFEXITED(Status) && (WEXITSTATUS(Status) == 0), "monitor process");
+
+	printf("  writer: %u switches, %.0f ns a switch with a monitor reading\n", NumberOfSwitches, Nanoseconds);
+
+	munmap(Memory, sizeof(ASIO_LOAD_SECTION));
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ * @brief
+ * Entry point.
+ */
+int
+main
+(
+	int		argc,
+	char *	argv[]
+)
+{
+	ULONG NumberOfSwitches = (argc > 1) ? strtoul(argv[1], NULL, 0) : 2000000;
+
+	printf("load meter\n");
+
+	TestMeter();
+
+	TestProcesses(NumberOfSwitches);
+
+	printf("ok\n");
+
+	return 0;
+}
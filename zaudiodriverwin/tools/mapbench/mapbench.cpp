@@ -0,0 +1,568 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       mapbench.cpp
+ * @brief      Counts the bytes copied per second of audio on the output
+ *             data pipe, with and without mapping the client FIFO.
+ * @details
+ * The client FIFO counters are CAudioRing, in core/AudioRing.h, which is
+ * built here as is, with tools/include standing in for the DDK headers.
+ * Around it, a millisecond at a time:
+ *
+ *  - the client writes a 10 ms period into the FIFO, as WriteBuffer() does
+ *    through CAudioClient::AddFramesToFifo();
+ *  - the data pipe sizes a 1 ms transfer as CAudioDataPipe::FlushBuffer()
+ *    does, and either copies it out of the FIFO into the transfer buffer of
+ *    the work item (RemoveFramesFromFifo(), the only path before) or maps it
+ *    in place (MapFramesInFifo()), falling back to the copy when the region
+ *    wraps around the end of the storage;
+ *  - MAX_AUDIO_OUTPUT_IRP transfers are in flight, and the oldest completes
+ *    when a new one is submitted. On completion the transfer is checked
+ *    frame by frame, then its region is unmapped (ReleaseFifoWorkItem()).
+ *
+ * Both copies are counted: client to FIFO, which every run pays, and FIFO to
+ * transfer buffer, which mapping removes. The check also catches the client
+ * overwriting frames that are still mapped. The times are of the same runs
+ * without the check, best of a few.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -I../include -I../../driver/usbaud10/core -o mapbench mapbench.cpp
+ *     ./mapbench [seconds]
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Common.h"
+#include "AudioRing.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief MAX_AUDIO_OUTPUT_IRP in core/Audio.h. */
+#define MAX_AUDIO_OUTPUT_IRP			8
+
+/*! @brief AUDIO_CLIENT_OUTPUT_BUFFERSIZE in core/Audio.h, in ms. */
+#define AUDIO_CLIENT_OUTPUT_BUFFERSIZE	100
+
+/*! @brief Period of the client writes, in ms. */
+#define CLIENT_PERIOD					10
+
+/*! @brief Default length of each run, in seconds of audio. */
+#define NUMBER_OF_SECONDS				20
+
+/*! @brief Number of timed runs; the best one is reported. */
+#define NUMBER_OF_TIMINGS				5
+
+/*****************************************************************************
+ * Check()
+ *****************************************************************************
+ * @brief
+ * Fail the program if Condition does not hold.
+ */
+static void
+Check
+(
+	IN		bool			Condition,
+	IN		const char *	What
+)
+{
+	if (!Condition)
+	{
+		fprintf(stderr, "FAILED: %s\n", What);
+		exit(1);
+	}
+}
+
+/*****************************************************************************
+ * Now()
+ *****************************************************************************
+ * @brief
+ * Monotonic time in seconds.
+ */
+static double
+Now
+(	void
+)
+{
+	struct timespec Time;
+
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+
+	return Time.tv_sec + Time.tv_nsec * 1e-9;
+}
+
+/*****************************************************************************
+ * Pipe state
+ */
+/*! @brief One transfer, as AUDIO_FIFO_WORK_ITEM. */
+typedef struct
+{
+	PUCHAR				FifoBuffer;			// transfer buffer of the work item
+	PUCHAR				TransferBuffer;		// FifoBuffer, or the frames mapped in the FIFO
+	ULONG				NumberOfFrames;
+	ULONGLONG			FirstFrame;
+	BOOL				FifoMapped;
+	AUDIO_FIFO_MAPPING	FifoMapping;
+} WORK_ITEM;
+
+/*! @brief One client and its data pipe. */
+typedef struct
+{
+	CAudioRing			Ring;
+	PUCHAR				FifoBuffer;			// ring buffer storage
+	ULONG				FifoFrameSize;
+	ULONG				SampleRate;
+	BOOL				Map;				// map the transfers when possible
+	BOOL				CheckData;			// fill and check every frame
+
+	PUCHAR				ClientBuffer;		// one client period
+	ULONG				ClientPeriodInFrames;
+	ULONGLONG			ClientFrames;		// frames written by the client
+
+	WORK_ITEM			WorkItem[MAX_AUDIO_OUTPUT_IRP];
+	ULONG				Pending;			// transfers in flight
+	ULONG				Oldest;				// index of the oldest one
+	ULONG				FrameRemainder;		// fraction of a frame per ms, in 1/1000
+	ULONGLONG			PipeFrames;			// frames submitted by the pipe
+
+	ULONGLONG			BytesCopied;
+	ULONGLONG			BytesMapped;
+	ULONGLONG			FramesMissing;		// frames short of the nominal transfer size
+} PIPE;
+
+/*****************************************************************************
+ * FrameByte()
+ *****************************************************************************
+ * @brief
+ * Content of byte Offset of a frame, so that any misplaced frame shows.
+ */
+static UCHAR
+FrameByte
+(
+	IN		ULONGLONG	Frame,
+	IN		ULONG		Offset
+)
+{
+	return UCHAR((Frame * 0x9E3779B1) >> 13) ^ UCHAR(Frame) ^ UCHAR(Offset * 29);
+}
+
+/*****************************************************************************
+ * ClientWrite()
+ *****************************************************************************
+ * @brief
+ * Write a period into the FIFO, as CAudioClient::AddFramesToFifo() does.
+ */
+static void
+ClientWrite
+(
+	IN		PIPE *	Pipe
+)
+{
+	ULONG FrameSize = Pipe->FifoFrameSize;
+
+	if (Pipe->CheckData)
+	{
+		for (ULONG i = 0; i < Pipe->ClientPeriodInFrames; i++)
+		{
+			for (ULONG j = 0; j < FrameSize; j++)
+			{
+				Pipe->ClientBuffer[i * FrameSize + j] = FrameByte(Pipe->ClientFrames + i, j);
+			}
+		}
+	}
+
+	ULONGLONG WriteCount;
+
+	ULONG FramesAvailable = Pipe->Ring.BeginWrite(&WriteCount);
+
+	Check(FramesAvailable >= Pipe->ClientPeriodInFrames, "the client finds room for a period");
+
+	ULONG FramesWritten = 0;
+
+	while (FramesWritten < Pipe->ClientPeriodInFrames)
+	{
+		ULONG Position = Pipe->Ring.Position(WriteCount);
+
+		ULONG Frames = Pipe->Ring.Contiguous(WriteCount, Pipe->ClientPeriodInFrames - FramesWritten);
+
+		memcpy(Pipe->FifoBuffer + Position * FrameSize, Pipe->ClientBuffer + FramesWritten * FrameSize, Frames * FrameSize);
+
+		WriteCount += Frames;
+
+		FramesWritten += Frames;
+	}
+
+	Pipe->Ring.EndWrite(WriteCount);
+
+	Pipe->ClientFrames += FramesWritten;
+
+	Pipe->BytesCopied += ULONGLONG(FramesWritten) * FrameSize;
+}
+
+/*****************************************************************************
+ * RemoveFrames()
+ *****************************************************************************
+ * @brief
+ * Copy frames out of the FIFO, as CAudioClient::RemoveFramesFromFifo() does.
+ */
+static ULONG
+RemoveFrames
+(
+	IN		PIPE *	Pipe,
+	IN		PUCHAR	Buffer,
+	IN		ULONG	NumberOfFrames
+)
+{
+	ULONG FrameSize = Pipe->FifoFrameSize;
+
+	ULONGLONG ReadCount;
+
+	ULONG FramesQueued = Pipe->Ring.BeginRead(&ReadCount);
+
+	ULONG FramesToRead = (NumberOfFrames > FramesQueued) ? FramesQueued : NumberOfFrames;
+
+	ULONG FramesRead = 0;
+
+	while (FramesRead < FramesToRead)
+	{
+		ULONG Position = Pipe->Ring.Position(ReadCount);
+
+		ULONG Frames = Pipe->Ring.Contiguous(ReadCount, FramesToRead - FramesRead);
+
+		memcpy(Buffer + FramesRead * FrameSize, Pipe->FifoBuffer + Position * FrameSize, Frames * FrameSize);
+
+		ReadCount += Frames;
+
+		FramesRead += Frames;
+	}
+
+	if (FramesRead)
+	{
+		Pipe->Ring.EndRead(ReadCount);
+	}
+
+	return FramesRead;
+}
+
+/*****************************************************************************
+ * CompleteTransfer()
+ *****************************************************************************
+ * @brief
+ * Check the oldest transfer in flight and release it, as
+ * CAudioDataPipe::ReleaseFifoWorkItem() does.
+ */
+static void
+CompleteTransfer
+(
+	IN		PIPE *	Pipe
+)
+{
+	WORK_ITEM * WorkItem = &Pipe->WorkItem[Pipe->Oldest];
+
+	if (Pipe->CheckData)
+	{
+		for (ULONG i = 0; i < WorkItem->NumberOfFrames; i++)
+		{
+			for (ULONG j = 0; j < Pipe->FifoFrameSize; j++)
+			{
+				if (WorkItem->TransferBuffer[i * Pipe->FifoFrameSize + j] != FrameByte(WorkItem->FirstFrame + i, j))
+				{
+					fprintf(stderr, "frame %llu byte %lu\n", (unsigned long long)(WorkItem->FirstFrame + i), (unsigned long)j);
+
+					Check(false, "every frame reaches the device as written");
+				}
+			}
+		}
+	}
+
+	if (WorkItem->FifoMapped)
+	{
+		Pipe->Ring.Unmap(&WorkItem->FifoMapping);
+
+		WorkItem->FifoMapped = FALSE;
+	}
+
+	Pipe->Oldest = (Pipe->Oldest + 1) % MAX_AUDIO_OUTPUT_IRP;
+
+	Pipe->Pending--;
+}
+
+/*****************************************************************************
+ * SubmitTransfer()
+ *****************************************************************************
+ * @brief
+ * Fill a 1 ms transfer, as CAudioDataPipe::FlushBuffer() does.
+ */
+static void
+SubmitTransfer
+(
+	IN		PIPE *	Pipe
+)
+{
+	WORK_ITEM * WorkItem = &Pipe->WorkItem[(Pipe->Oldest + Pipe->Pending) % MAX_AUDIO_OUTPUT_IRP];
+
+	// Frames per ms, carrying the fraction over as GetTransferSizeInFrames() does.
+	ULONG NumberOfFrames = Pipe->SampleRate / 1000;
+
+	Pipe->FrameRemainder += Pipe->SampleRate % 1000;
+
+	if (Pipe->FrameRemainder >= 1000)
+	{
+		Pipe->FrameRemainder -= 1000;
+
+		NumberOfFrames++;
+	}
+
+	ULONG FramesQueued = Pipe->Ring.GetNumQueuedFrames();
+
+	if (NumberOfFrames > FramesQueued)
+	{
+		Pipe->FramesMissing += NumberOfFrames - FramesQueued;
+
+		NumberOfFrames = FramesQueued;
+	}
+
+	WorkItem->NumberOfFrames = NumberOfFrames;
+	WorkItem->FirstFrame = Pipe->PipeFrames;
+	WorkItem->FifoMapped = FALSE;
+
+	ULONG BytesInFifoBuffer = NumberOfFrames * Pipe->FifoFrameSize;
+
+	ULONG Position;
+
+	if (Pipe->Map && Pipe->Ring.Map(NumberOfFrames, &WorkItem->FifoMapping, &Position))
+	{
+		WorkItem->TransferBuffer = Pipe->FifoBuffer + Position * Pipe->FifoFrameSize;
+
+		WorkItem->FifoMapped = TRUE;
+
+		Pipe->BytesMapped += BytesInFifoBuffer;
+	}
+	else
+	{
+		RemoveFrames(Pipe, WorkItem->FifoBuffer, NumberOfFrames);
+
+		WorkItem->TransferBuffer = WorkItem->FifoBuffer;
+
+		Pipe->BytesCopied += BytesInFifoBuffer;
+	}
+
+	Pipe->PipeFrames += NumberOfFrames;
+
+	Pipe->Pending++;
+}
+
+/*****************************************************************************
+ * RunPipe()
+ *****************************************************************************
+ * @brief
+ * Play Seconds of audio through a client and its data pipe.
+ */
+static void
+RunPipe
+(
+	IN		PIPE *	Pipe,
+	IN		ULONG	Seconds
+)
+{
+	ULONG FifoBufferSizeInFrames = Pipe->SampleRate * AUDIO_CLIENT_OUTPUT_BUFFERSIZE / 1000;
+
+	ULONG FifoBufferStorageInFrames = 1;
+
+	while (FifoBufferStorageInFrames < FifoBufferSizeInFrames)
+	{
+		FifoBufferStorageInFrames <<= 1;
+	}
+
+	Pipe->Ring.Init(FifoBufferSizeInFrames, FifoBufferStorageInFrames);
+
+	Pipe->ClientFrames = 0;
+	Pipe->Pending = 0;
+	Pipe->Oldest = 0;
+	Pipe->FrameRemainder = 0;
+	Pipe->PipeFrames = 0;
+	Pipe->BytesCopied = 0;
+	Pipe->BytesMapped = 0;
+	Pipe->FramesMissing = 0;
+
+	// The client keeps two periods ahead of the device.
+	ClientWrite(Pipe);
+
+	for (ULONG Ms = 0; Ms < Seconds * 1000; Ms++)
+	{
+		if ((Ms % CLIENT_PERIOD) == 0)
+		{
+			ClientWrite(Pipe);
+		}
+
+		if (Pipe->Pending == MAX_AUDIO_OUTPUT_IRP)
+		{
+			CompleteTransfer(Pipe);
+		}
+
+		SubmitTransfer(Pipe);
+	}
+
+	while (Pipe->Pending)
+	{
+		CompleteTransfer(Pipe);
+	}
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(
+	int		argc,
+	char **	argv
+)
+{
+	ULONG Seconds = (argc > 1) ? strtoul(argv[1], NULL, 0) : NUMBER_OF_SECONDS;
+
+	static const struct
+	{
+		ULONG	SampleRate;
+		ULONG	Channels;
+		ULONG	BitResolution;
+	} Formats[] =
+	{
+		{ 44100, 2, 16 },
+		{ 48000, 2, 24 },
+		{ 96000, 2, 24 },
+		{ 192000, 2, 24 },
+		{ 48000, 16, 24 },
+		{ 96000, 16, 24 },
+		{ 192000, 16, 24 },
+	};
+
+	if (!Seconds)
+	{
+		fprintf(stderr, "usage: mapbench [seconds]\n");
+		return 1;
+	}
+
+	printf("%lu s of audio per run, %u transfers of 1 ms in flight\n", (unsigned long)Seconds, MAX_AUDIO_OUTPUT_IRP);
+	printf("format                 bytes copied per second of audio     mapped   us per second of audio\n");
+	printf("                             copy          map     ratio                  copy      map\n");
+
+	static PIPE Pipe;
+
+	for (ULONG f = 0; f < sizeof(Formats) / sizeof(Formats[0]); f++)
+	{
+		Pipe.SampleRate = Formats[f].SampleRate;
+		Pipe.FifoFrameSize = Formats[f].Channels * Formats[f].BitResolution / 8;
+		Pipe.ClientPeriodInFrames = Pipe.SampleRate * CLIENT_PERIOD / 1000;
+
+		Pipe.FifoBuffer = PUCHAR(malloc(size_t(Pipe.SampleRate) * Pipe.FifoFrameSize));
+		Pipe.ClientBuffer = PUCHAR(malloc(size_t(Pipe.ClientPeriodInFrames) * Pipe.FifoFrameSize));
+
+		Check(Pipe.FifoBuffer && Pipe.ClientBuffer, "out of memory");
+
+		for (ULONG i = 0; i < MAX_AUDIO_OUTPUT_IRP; i++)
+		{
+			Pipe.WorkItem[i].FifoBuffer = PUCHAR(malloc(size_t(Pipe.SampleRate / 1000 + 1) * Pipe.FifoFrameSize));
+
+			Check(Pipe.WorkItem[i].FifoBuffer != NULL, "out of memory");
+		}
+
+		ULONGLONG BytesPerSecond = ULONGLONG(Pipe.SampleRate) * Pipe.FifoFrameSize;
+
+		ULONGLONG BytesCopied[2];
+		double Time[2];
+
+		for (ULONG Map = 0; Map < 2; Map++)
+		{
+			Pipe.Map = Map;
+
+			// Checked run.
+			Pipe.CheckData = TRUE;
+
+			RunPipe(&Pipe, Seconds);
+
+			Check(Pipe.FramesMissing == 0, "the device never runs short of frames");
+			Check(Pipe.PipeFrames == ULONGLONG(Pipe.SampleRate) * Seconds, "the device gets every frame");
+
+			BytesCopied[Map] = Pipe.BytesCopied;
+
+			if (Map)
+			{
+				Check(Pipe.BytesMapped > Pipe.BytesCopied / 2, "most transfers are mapped");
+			}
+			else
+			{
+				Check(Pipe.BytesMapped == 0, "nothing is mapped with mapping off");
+			}
+
+			// Timed runs.
+			Pipe.CheckData = FALSE;
+
+			Time[Map] = 1e30;
+
+			for (ULONG t = 0; t < NUMBER_OF_TIMINGS; t++)
+			{
+				double Start = Now();
+
+				RunPipe(&Pipe, Seconds);
+
+				double Elapsed = Now() - Start;
+
+				if (Elapsed < Time[Map])
+				{
+					Time[Map] = Elapsed;
+				}
+			}
+		}
+
+		Check(BytesCopied[1] < BytesCopied[0], "mapping copies fewer bytes");
+		Check(BytesCopied[1] >= BytesPerSecond * Seconds, "the client copy is still counted");
+
+		char Name[48];
+
+		snprintf(Name, sizeof(Name), "%lu Hz %lu-bit %lu ch", (unsigned long)Formats[f].SampleRate, (unsigned long)Formats[f].BitResolution, (unsigned long)Formats[f].Channels);
+
+		printf("%-22s %12llu %12llu %8.2fx %8.1f%% %12.1f %8.1f\n", Name,
+			   (unsigned long long)(BytesCopied[0] / Seconds), (unsigned long long)(BytesCopied[1] / Seconds),
+			   double(BytesCopied[0]) / double(BytesCopied[1]),
+			   100.0 * double(Pipe.BytesMapped) / double(ULONGLONG(Pipe.SampleRate) * Seconds * Pipe.FifoFrameSize),
+			   Time[0] * 1e6 / Seconds, Time[1] * 1e6 / Seconds);
+
+		for (ULONG i = 0; i < MAX_AUDIO_OUTPUT_IRP; i++)
+		{
+			free(Pipe.WorkItem[i].FifoBuffer);
+		}
+
+		free(Pipe.ClientBuffer);
+		free(Pipe.FifoBuffer);
+	}
+
+	printf("PASSED\n");
+
+	return 0;
+}
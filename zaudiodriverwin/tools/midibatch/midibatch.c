@@ -0,0 +1,565 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       midibatch.c
+ * @brief      Models the bulk OUT transfers of a MIDI data pipe, and reports
+ *             the packets per URB and the time to send a SysEx dump.
+ * @details
+ * The model follows the output path of core/Midi.cpp:
+ *
+ *  - a client write (CMidiClient::WriteBuffer()) queues packets in the work
+ *    item being filled while there is one, and sends it at the end of the
+ *    message, or when it is full (CMidiDataPipe::TransmitPacket()). What
+ *    does not fit waits in the client ring.
+ *  - when a transfer completes, the work item is freed, the cables move
+ *    what waits in their clients' rings into the free work items, and the
+ *    one being filled is sent (CMidiDataPipe::_ServiceOutput()).
+ *
+ * In the "before" layout every cable has its own MAX_OUTPUT_IRP work items
+ * of up to 64 bytes; in the "now" layout the cables of a pipe share them,
+ * and they are sized from the pipe (MIDI_FIFO_HIGH_SPEED_PACKETS_PER_TRANSFER
+ * wMaxPacketSize packets at high speed), with as many of them as it takes to
+ * keep the bytes in flight of the "before" layout (CMidiDataPipe::
+ * AcquireResources()).
+ *
+ * The bus takes the transfers in the order they are sent, at the bulk
+ * bandwidth of the link, and completes a transfer at the end of the (micro)
+ * frame its last byte went out in. The completions are run one at a time,
+ * at a fixed cost each plus a cost per packet moved, which is what bounds
+ * the rate when the transfers are small.
+ *
+ * Two loads are run: a 1 MB SysEx dump on one cable, and dense controller
+ * streams on all 16 cables of a pipe. Last, the URBs and the time it takes
+ * to send the SysEx dump are summed up per link, before and now. The program
+ * fails if the work items ever hold more than they should, or if a packet
+ * is lost.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     cc -O2 -o midibatch midibatch.c
+ *     ./midibatch
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief As in core/Midi.h and core/MidiFifo.h. */
+#define MAX_OUTPUT_IRP								8
+#define MAX_DATA_PIPE_OUTPUT_IRP					(MAX_OUTPUT_IRP * 16)
+#define MIDI_FIFO_BUFFER_SIZE						64
+#define MIDI_FIFO_MAXIMUM_TRANSFER_SIZE				2048
+#define MIDI_FIFO_HIGH_SPEED_PACKETS_PER_TRANSFER	4
+
+/*! @brief Size of an USB-MIDI event packet. */
+#define PACKET_SIZE		4
+
+/*! @brief Maximum number of cables on a pipe. */
+#define MAX_CABLES		16
+
+/*! @brief Completion cost: the DPC, the service and the IRP recycle, in us. */
+#define COMPLETION_COST_US	10.0
+
+/*! @brief Cost of moving a packet from a client ring into a work item, in us. */
+#define PACKET_COST_US		0.05
+
+/*! @brief Size of the SysEx dump. */
+#define SYSEX_DUMP_SIZE		(1024 * 1024)
+
+/*****************************************************************************
+ * Types
+ */
+/*! @brief Link. */
+typedef struct
+{
+	const char *	Name;
+	double			FrameUs;			// (micro)frame
+	double			BytesPerFrame;		// bulk bandwidth
+	uint32_t		MaximumPacketSize;	// wMaxPacketSize of the endpoint
+	int				HighSpeed;
+} LINK;
+
+/*! @brief Work item. */
+typedef struct
+{
+	uint32_t	Packets;
+	int			Pending;
+} WORK_ITEM;
+
+/*! @brief Set of work items, as a pipe (now) or a cable (before) has. */
+typedef struct
+{
+	WORK_ITEM	Items[MAX_DATA_PIPE_OUTPUT_IRP];
+	int			NumberOfItems;
+	int			Filling;			// index of the item being filled, -1 if none is free
+	uint32_t	Capacity;			// packets per item
+} FIFO;
+
+/*! @brief Transfer on the bus. */
+typedef struct
+{
+	double		CompletionTime;
+	FIFO *		Fifo;
+	int			Item;
+} TRANSFER;
+
+/*! @brief Model state. */
+typedef struct
+{
+	const LINK *	Link;
+	int				Shared;						// one FIFO for all the cables
+	int				NumberOfCables;
+	FIFO			Fifos[MAX_CABLES];
+	uint64_t		Waiting[MAX_CABLES];		// packets in the client rings
+
+	TRANSFER *		Transfers;					// on the bus, in order
+	size_t			TransfersHead, TransfersTail, TransfersSize;
+
+	double			BusFreeTime;
+	double			CpuFreeTime;
+	double			CpuBusyTime;
+
+	uint64_t		Urbs;
+	uint64_t		PacketsSent;
+	uint32_t		MaxPacketsPerUrb;
+	double			LastCompletionTime;
+} MODEL;
+
+/*****************************************************************************
+ * Check()
+ *****************************************************************************
+ * @brief
+ * Fail the program if Condition does not hold.
+ */
+static void
+Check
+(
+	int				Condition,
+	const char *	What
+)
+{
+	if (!Condition)
+	{
+		fprintf(stderr, "FAILED: %s\n", What);
+		exit(1);
+	}
+}
+
+/*****************************************************************************
+ * TransferSize()
+ *****************************************************************************
+ * @brief
+ * The bytes per transfer: before, as CMidiCable::Init() had it, and now, as
+ * CMidiDataPipe::Init() has it.
+ */
+static uint32_t
+TransferSize
+(
+	const LINK *	Link,
+	int				Now
+)
+{
+	uint32_t Size = Link->MaximumPacketSize;
+
+	if (Now)
+	{
+		if (Link->HighSpeed) Size *= MIDI_FIFO_HIGH_SPEED_PACKETS_PER_TRANSFER;
+
+		if (Size > MIDI_FIFO_MAXIMUM_TRANSFER_SIZE) Size = MIDI_FIFO_MAXIMUM_TRANSFER_SIZE;
+	}
+	else
+	{
+		if (Size > MIDI_FIFO_BUFFER_SIZE) Size = MIDI_FIFO_BUFFER_SIZE;
+	}
+
+	return Size & ~(PACKET_SIZE - 1);
+}
+
+/*****************************************************************************
+ * FindFreeItem()
+ *****************************************************************************
+ * @brief
+ * The next work item to fill, as the head of m_FifoWorkItemList.
+ */
+static void
+FindFreeItem
+(
+	FIFO *	Fifo
+)
+{
+	Fifo->Filling = -1;
+
+	for (int i = 0; i < Fifo->NumberOfItems; i++)
+	{
+		if (!Fifo->Items[i].Pending)
+		{
+			Fifo->Filling = i;
+			break;
+		}
+	}
+}
+
+/*****************************************************************************
+ * Flush()
+ *****************************************************************************
+ * @brief
+ * Send the work item being filled, if there is anything in it
+ * (CMidiDataPipe::FlushFifo()).
+ */
+static void
+Flush
+(
+	MODEL *		Model,
+	FIFO *		Fifo,
+	double		Now
+)
+{
+	if ((Fifo->Filling < 0) || (Fifo->Items[Fifo->Filling].Packets == 0)) return;
+
+	WORK_ITEM * Item = &Fifo->Items[Fifo->Filling];
+
+	Check(Item->Packets <= Fifo->Capacity, "work item within its size");
+
+	double Start = (Now > Model->BusFreeTime) ? Now : Model->BusFreeTime;
+
+	double End = Start + (Item->Packets * PACKET_SIZE) * Model->Link->FrameUs / Model->Link->BytesPerFrame;
+
+	Model->BusFreeTime = End;
+
+	// Completes at the end of the (micro)frame of its last byte.
+	double CompletionTime = (double)((uint64_t)(End / Model->Link->FrameUs) + 1) * Model->Link->FrameUs;
+
+	if (Model->TransfersTail == Model->TransfersSize)
+	{
+		Model->TransfersSize = Model->TransfersSize ? Model->TransfersSize * 2 : 1024;
+		Model->Transfers = (TRANSFER *)realloc(Model->Transfers, Model->TransfersSize * sizeof(TRANSFER));
+	}
+
+	TRANSFER * Transfer = &Model->Transfers[Model->TransfersTail++];
+
+	Transfer->CompletionTime = CompletionTime;
+	Transfer->Fifo = Fifo;
+	Transfer->Item = Fifo->Filling;
+
+	Item->Pending = 1;
+
+	Model->Urbs++;
+	Model->PacketsSent += Item->Packets;
+
+	if (Item->Packets > Model->MaxPacketsPerUrb) Model->MaxPacketsPerUrb = Item->Packets;
+
+	FindFreeItem(Fifo);
+}
+
+/*****************************************************************************
+ * Drain()
+ *****************************************************************************
+ * @brief
+ * Move what waits for a cable into its FIFO, sending the work items that
+ * fill up. Returns the number of packets moved.
+ */
+static uint64_t
+Drain
+(
+	MODEL *		Model,
+	int			Cable,
+	double		Now
+)
+{
+	FIFO * Fifo = &Model->Fifos[Model->Shared ? 0 : Cable];
+
+	uint64_t Moved = 0;
+
+	while (Model->Waiting[Cable] && (Fifo->Filling >= 0))
+	{
+		WORK_ITEM * Item = &Fifo->Items[Fifo->Filling];
+
+		uint64_t Room = Fifo->Capacity - Item->Packets;
+
+		uint64_t Count = (Model->Waiting[Cable] < Room) ? Model->Waiting[Cable] : Room;
+
+		Item->Packets += (uint32_t)Count;
+		Model->Waiting[Cable] -= Count;
+		Moved += Count;
+
+		if (Item->Packets == Fifo->Capacity)
+		{
+			Flush(Model, Fifo, Now);
+		}
+	}
+
+	return Moved;
+}
+
+/*****************************************************************************
+ * Write()
+ *****************************************************************************
+ * @brief
+ * A client writes a message of Packets packets on Cable at Now
+ * (CMidiClient::WriteBuffer()).
+ */
+static void
+Write
+(
+	MODEL *		Model,
+	int			Cable,
+	uint64_t	Packets,
+	double		Now
+)
+{
+	FIFO * Fifo = &Model->Fifos[Model->Shared ? 0 : Cable];
+
+	int Queued = (Model->Waiting[Cable] == 0);
+
+	Model->Waiting[Cable] += Packets;
+
+	// Behind what already waits, the message waits for a completion.
+	if (Queued)
+	{
+		Drain(Model, Cable, Now);
+
+		if (Model->Waiting[Cable] == 0)
+		{
+			// End of the message.
+			Flush(Model, Fifo, Now);
+		}
+	}
+}
+
+/*****************************************************************************
+ * Complete()
+ *****************************************************************************
+ * @brief
+ * Run the next completion (CMidiDataPipe::_ServiceOutput(), or
+ * CMidiCable::Service() before).
+ */
+static void
+Complete
+(
+	MODEL *		Model
+)
+{
+	TRANSFER Transfer = Model->Transfers[Model->TransfersHead++];
+
+	double Now = (Transfer.CompletionTime > Model->CpuFreeTime) ? Transfer.CompletionTime : Model->CpuFreeTime;
+
+	FIFO * Fifo = Transfer.Fifo;
+
+	Fifo->Items[Transfer.Item].Pending = 0;
+	Fifo->Items[Transfer.Item].Packets = 0;
+
+	if (Fifo->Filling < 0) FindFreeItem(Fifo);
+
+	uint64_t Moved = 0;
+
+	if (Model->Shared)
+	{
+		for (int Cable = 0; Cable < Model->NumberOfCables; Cable++)
+		{
+			Moved += Drain(Model, Cable, Now);
+		}
+	}
+	else
+	{
+		Moved += Drain(Model, (int)(Fifo - Model->Fifos), Now);
+	}
+
+	double Cost = COMPLETION_COST_US + Moved * PACKET_COST_US;
+
+	Model->CpuBusyTime += Cost;
+	Model->CpuFreeTime = Now + Cost;
+
+	Flush(Model, Fifo, Model->CpuFreeTime);
+
+	Model->LastCompletionTime = Transfer.CompletionTime;
+}
+
+/*****************************************************************************
+ * InitModel()
+ *****************************************************************************
+ */
+static void
+InitModel
+(
+	MODEL *			Model,
+	const LINK *	Link,
+	int				Now,
+	int				NumberOfCables
+)
+{
+	memset(Model, 0, sizeof(*Model));
+
+	Model->Link = Link;
+	Model->Shared = Now;
+	Model->NumberOfCables = NumberOfCables;
+
+	int NumberOfItems = MAX_OUTPUT_IRP;
+
+	if (Now)
+	{
+		NumberOfItems = (MAX_OUTPUT_IRP * NumberOfCables * MIDI_FIFO_BUFFER_SIZE) / TransferSize(Link, Now);
+
+		if (NumberOfItems < MAX_OUTPUT_IRP) NumberOfItems = MAX_OUTPUT_IRP;
+		if (NumberOfItems > MAX_DATA_PIPE_OUTPUT_IRP) NumberOfItems = MAX_DATA_PIPE_OUTPUT_IRP;
+	}
+
+	for (int i = 0; i < MAX_CABLES; i++)
+	{
+		Model->Fifos[i].NumberOfItems = NumberOfItems;
+		Model->Fifos[i].Capacity = TransferSize(Link, Now) / PACKET_SIZE;
+		Model->Fifos[i].Filling = 0;
+	}
+}
+
+/*****************************************************************************
+ * Report()
+ *****************************************************************************
+ */
+static void
+Report
+(
+	MODEL *			Model,
+	const char *	Layout,
+	uint64_t		PacketsWritten
+)
+{
+	Check(Model->PacketsSent == PacketsWritten, "every packet sent");
+
+	printf("  %-6s %4u B/URB %9llu URBs %7.1f pkts/URB (max %4u) %9.1f ms, CPU %7.1f ms\n",
+		   Layout, TransferSize(Model->Link, Model->Shared), (unsigned long long)Model->Urbs,
+		   (double)Model->PacketsSent / Model->Urbs, Model->MaxPacketsPerUrb,
+		   Model->LastCompletionTime / 1000, Model->CpuBusyTime / 1000);
+
+	free(Model->Transfers);
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(	void
+)
+{
+	static const LINK Links[] =
+	{
+		{ "full speed, 64 byte endpoint",  1000.0, 19 * 64,   64,  0 },
+		{ "high speed, 64 byte endpoint",  125.0,  13 * 512,  64,  1 },
+		{ "high speed, 512 byte endpoint", 125.0,  13 * 512,  512, 1 },
+	};
+
+	// F0, 7-bit data, F7: 3 bytes per packet.
+	uint64_t SysExPackets = (SYSEX_DUMP_SIZE + 2) / 3;
+
+	// URBs and time to send it, per link, before and now.
+	uint64_t SysExUrbs[sizeof(Links) / sizeof(Links[0])][2];
+	double SysExMs[sizeof(Links) / sizeof(Links[0])][2];
+
+	printf("1 MB SysEx dump (%llu packets) on one cable:\n", (unsigned long long)SysExPackets);
+
+	for (size_t l = 0; l < sizeof(Links) / sizeof(Links[0]); l++)
+	{
+		printf(" %s\n", Links[l].Name);
+
+		for (int Now = 0; Now <= 1; Now++)
+		{
+			MODEL Model;
+
+			InitModel(&Model, &Links[l], Now, 1);
+
+			// The upper layer keeps the client ring topped up; model it as
+			// one write of the whole dump.
+			Write(&Model, 0, SysExPackets, 0);
+
+			while (Model.TransfersHead < Model.TransfersTail)
+			{
+				Complete(&Model);
+			}
+
+			SysExUrbs[l][Now] = Model.Urbs;
+			SysExMs[l][Now] = Model.LastCompletionTime / 1000;
+
+			Report(&Model, Now ? "now" : "before", SysExPackets);
+		}
+	}
+
+	// A controller message every 25 us on each of the 16 cables, for 100 ms.
+	const double StreamIntervalUs = 25.0, StreamLengthUs = 100000.0;
+
+	uint64_t StreamPackets = (uint64_t)(StreamLengthUs / StreamIntervalUs) * MAX_CABLES;
+
+	printf("\nController streams on %d cables (%llu packets in %.0f ms):\n",
+		   MAX_CABLES, (unsigned long long)StreamPackets, StreamLengthUs / 1000);
+
+	for (size_t l = 0; l < sizeof(Links) / sizeof(Links[0]); l++)
+	{
+		printf(" %s\n", Links[l].Name);
+
+		for (int Now = 0; Now <= 1; Now++)
+		{
+			MODEL Model;
+
+			InitModel(&Model, &Links[l], Now, MAX_CABLES);
+
+			for (double t = 0; t < StreamLengthUs; t += StreamIntervalUs)
+			{
+				// The completions due by then run first.
+				while ((Model.TransfersHead < Model.TransfersTail) &&
+					   (((Model.Transfers[Model.TransfersHead].CompletionTime > Model.CpuFreeTime) ?
+						 Model.Transfers[Model.TransfersHead].CompletionTime : Model.CpuFreeTime) <= t))
+				{
+					Complete(&Model);
+				}
+
+				for (int Cable = 0; Cable < MAX_CABLES; Cable++)
+				{
+					Write(&Model, Cable, 1, t);
+				}
+			}
+
+			while (Model.TransfersHead < Model.TransfersTail)
+			{
+				Complete(&Model);
+			}
+
+			Report(&Model, Now ? "now" : "before", StreamPackets);
+		}
+	}
+
+	printf("\n1 MB SysEx dump, before -> now:\n");
+
+	for (size_t l = 0; l < sizeof(Links) / sizeof(Links[0]); l++)
+	{
+		printf(" %-30s %6llu -> %6llu URBs %7.1f -> %7.1f ms\n", Links[l].Name,
+			   (unsigned long long)SysExUrbs[l][0], (unsigned long long)SysExUrbs[l][1], SysExMs[l][0], SysExMs[l][1]);
+	}
+
+	printf("PASSED\n");
+
+	return 0;
+}
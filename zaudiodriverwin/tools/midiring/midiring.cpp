@@ -0,0 +1,323 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       midiring.cpp
+ * @brief      Exercises the MIDI client ring buffer protocol (core/MidiRing.h).
+ * @details
+ * The ring buffer of CMidiClient is CMidiRing, in core/MidiRing.h, which is
+ * built here as is, with tools/include standing in for the DDK headers.
+ *
+ * A producer thread (the bulk in completion DPC) and a consumer thread (the
+ * pin's Process routine) run against each buffer size with no lock between
+ * them. Each packet carries a sequence number in its MIDI bytes and again in
+ * its time stamp; the consumer checks that the two agree (no torn slot), that
+ * the sequence only goes up, and that the fill is never out of range. Without
+ * resets, every packet must be either received or refused as full; with the
+ * consumer resetting now and then, packets may only be lost, never repeated
+ * or reordered.
+ *
+ * Last, the nonpaged pool that the ring buffer of a MIDI pin holds is listed
+ * for each buffer size, against the fixed array that each client used to
+ * carry.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -pthread -I../include -I../../driver/usbaud10/include -I../../driver/usbaud10/core -o midiring midiring.cpp
+ *     ./midiring [packets]
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "Common.h"
+#include "MidiRing.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Size of the fixed client data buffer before, in packets. */
+#define OLD_BUFFER_SIZE					4096
+
+/*! @brief Default number of packets per run. */
+#define NUMBER_OF_PACKETS				2000000
+
+/*****************************************************************************
+ * Check()
+ *****************************************************************************
+ * @brief
+ * Fail the program if Condition does not hold.
+ */
+static void
+Check
+(
+	IN		bool			Condition,
+	IN		const char *	What
+)
+{
+	if (!Condition)
+	{
+		fprintf(stderr, "FAILED: %s\n", What);
+		exit(1);
+	}
+}
+
+/*****************************************************************************
+ * Run state
+ */
+/*! @brief One producer/consumer run. */
+typedef struct
+{
+	CMidiRing *		Ring;
+	ULONG			NumberOfPackets;
+	ULONG			ResetInterval;		// consumer resets every so many packets, 0 for never
+	ULONG			Refused;			// producer: packets refused as full
+	ULONG			Received;			// consumer: packets received
+	ULONG			Resets;				// consumer: resets done
+	volatile BOOL	Done;				// producer: all packets offered
+} MIDI_RING_RUN;
+
+/*****************************************************************************
+ * MakePacket()
+ *****************************************************************************
+ * @brief
+ * A packet that carries 21 bits of the sequence number in its MIDI bytes.
+ */
+static USB_MIDI_EVENT_PACKET
+MakePacket
+(
+	IN		ULONG	Sequence
+)
+{
+	USB_MIDI_EVENT_PACKET Packet;
+
+	Packet.CodeIndexNumber = 0x9;
+	Packet.CableNumber = 0;
+	Packet.MIDI[0] = UCHAR(Sequence & 0x7F);
+	Packet.MIDI[1] = UCHAR((Sequence >> 7) & 0x7F);
+	Packet.MIDI[2] = UCHAR((Sequence >> 14) & 0x7F);
+
+	return Packet;
+}
+
+/*****************************************************************************
+ * ProducerThread()
+ *****************************************************************************
+ * @brief
+ * Offer every packet once, in bursts, as the completion DPC does.
+ */
+static void *
+ProducerThread
+(
+	IN		void *	Context
+)
+{
+	MIDI_RING_RUN * Run = (MIDI_RING_RUN *)Context;
+
+	unsigned int Seed = 1;
+
+	for (ULONG Sequence = 0; Sequence < Run->NumberOfPackets; )
+	{
+		ULONG Burst = 1 + rand_r(&Seed) % 64;
+
+		for (ULONG i = 0; (i < Burst) && (Sequence < Run->NumberOfPackets); i++, Sequence++)
+		{
+			if (!Run->Ring->AddPacket(MakePacket(Sequence), LONGLONG(Sequence) * 3 + 1))
+			{
+				Run->Refused++;
+			}
+		}
+
+		if (rand_r(&Seed) % 4 == 0) sched_yield();
+	}
+
+	__sync_synchronize();
+
+	Run->Done = TRUE;
+
+	return NULL;
+}
+
+/*****************************************************************************
+ * ConsumerThread()
+ *****************************************************************************
+ * @brief
+ * Take the packets out, as the pin's Process routine does, and check them.
+ */
+static void *
+ConsumerThread
+(
+	IN		void *	Context
+)
+{
+	MIDI_RING_RUN * Run = (MIDI_RING_RUN *)Context;
+
+	unsigned int Seed = 2;
+
+	LONGLONG LastSequence = -1;
+
+	for (;;)
+	{
+		BOOL Done = Run->Done;
+
+		ULONG Queued = Run->Ring->GetNumQueuedPackets();
+
+		Check(Queued <= Run->Ring->Size(), "fill within the buffer");
+
+		USB_MIDI_EVENT_PACKET Packet;
+
+		LONGLONG TimeStampCounter;
+
+		BOOL Removed = FALSE;
+
+		while (Run->Ring->RemovePacket(&Packet, &TimeStampCounter))
+		{
+			Removed = TRUE;
+
+			Check((TimeStampCounter % 3) == 1, "time stamp intact");
+
+			LONGLONG Sequence = TimeStampCounter / 3;
+
+			USB_MIDI_EVENT_PACKET Expected = MakePacket(ULONG(Sequence));
+
+			Check(!memcmp(&Packet, &Expected, sizeof(Packet)), "packet matches its time stamp");
+
+			Check(Sequence > LastSequence, "packets in order, none repeated");
+
+			LastSequence = Sequence;
+
+			Run->Received++;
+
+			if (Run->ResetInterval && (rand_r(&Seed) % Run->ResetInterval == 0))
+			{
+				Run->Ring->Flush();
+
+				Run->Resets++;
+			}
+		}
+
+		if (Done && !Removed)
+		{
+			/* The producer was done before this pass, so the ring is empty. */
+			break;
+		}
+
+		if (rand_r(&Seed) % 2 == 0) sched_yield();
+	}
+
+	return NULL;
+}
+
+/*****************************************************************************
+ * RunRing()
+ *****************************************************************************
+ * @brief
+ * One producer/consumer run against a ring of BufferSize packets.
+ */
+static void
+RunRing
+(
+	IN		ULONG	BufferSize,
+	IN		ULONG	NumberOfPackets,
+	IN		ULONG	ResetInterval
+)
+{
+	PUSB_MIDI_EVENT_PACKET_EX DataBuffer = (PUSB_MIDI_EVENT_PACKET_EX)calloc(BufferSize, sizeof(USB_MIDI_EVENT_PACKET_EX));
+
+	Check(DataBuffer != NULL, "ring buffer allocated");
+
+	CMidiRing Ring;
+
+	/* Start the indices near the wrap around, as after a long run. */
+	Ring.Attach(DataBuffer, BufferSize, ULONG(0) - BufferSize * 3 - 7);
+
+	MIDI_RING_RUN Run;
+
+	memset(&Run, 0, sizeof(Run));
+
+	Run.Ring = &Ring;
+	Run.NumberOfPackets = NumberOfPackets;
+	Run.ResetInterval = ResetInterval;
+
+	pthread_t Producer, Consumer;
+
+	pthread_create(&Consumer, NULL, ConsumerThread, &Run);
+	pthread_create(&Producer, NULL, ProducerThread, &Run);
+
+	pthread_join(Producer, NULL);
+	pthread_join(Consumer, NULL);
+
+	Check(Ring.GetNumQueuedPackets() == 0, "ring empty at the end");
+
+	if (!ResetInterval)
+	{
+		Check(Run.Received + Run.Refused == NumberOfPackets, "every packet received or refused");
+	}
+	else
+	{
+		Check(Run.Received + Run.Refused <= NumberOfPackets, "no packet received twice");
+	}
+
+	printf("%6u packets%s: %u received, %u refused as full, %u resets\n",
+		   BufferSize, ResetInterval ? ", resets" : "        ", Run.Received, Run.Refused, Run.Resets);
+
+	free(DataBuffer);
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(
+	int		argc,
+	char *	argv[]
+)
+{
+	ULONG NumberOfPackets = (argc > 1) ? ULONG(atol(argv[1])) : NUMBER_OF_PACKETS;
+
+	Check(NumberOfPackets < (1 << 21), "sequence fits in the MIDI bytes");
+
+	for (ULONG BufferSize = MIDI_CLIENT_MINIMUM_BUFFER_SIZE; BufferSize <= MIDI_CLIENT_MAXIMUM_BUFFER_SIZE; BufferSize <<= 1)
+	{
+		RunRing(BufferSize, NumberOfPackets, 0);
+		RunRing(BufferSize, NumberOfPackets, 5000);
+	}
+
+	printf("\nRing buffer nonpaged pool per open MIDI pin:\n");
+	printf("  before, any state      %7u bytes\n", ULONG((OLD_BUFFER_SIZE + 1) * sizeof(USB_MIDI_EVENT_PACKET_EX)));
+	printf("  now, opened but idle   %7u bytes\n", 0);
+
+	for (ULONG BufferSize = MIDI_CLIENT_MINIMUM_BUFFER_SIZE; BufferSize <= MIDI_CLIENT_MAXIMUM_BUFFER_SIZE; BufferSize <<= 1)
+	{
+		printf("  now, run, %4u packets %7u bytes%s\n", BufferSize, ULONG(BufferSize * sizeof(USB_MIDI_EVENT_PACKET_EX)),
+			   (BufferSize == MIDI_CLIENT_DEFAULT_BUFFER_SIZE) ? " (default)" : "");
+	}
+
+	printf("PASSED\n");
+
+	return 0;
+}
@@ -0,0 +1,504 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       midisched.cpp
+ * @brief      Measures how close to their presentation time the MIDI output
+ *             events go out (core/Midi.cpp).
+ * @details
+ * The decisions of when a packet goes out are the driver's own, from
+ * core/MidiSchedule.h, on a 10 MHz performance counter:
+ *  - CMidiClient::FlushBuffer() moves the packets that are due
+ *    (MidiIsDue()) from the client's ring buffer into the FIFO, and holds
+ *    back the rest;
+ *  - CMidiCable::ScheduleService() sets the cable's timer to the earliest
+ *    packet held back (MidiScheduleService(), MidiServiceDueTime()), and
+ *    CMidiCable::ServiceDpcRoutine() services the cable when it fires, on
+ *    the first clock tick after the due time;
+ *  - CMidiDataPipe sends the FIFO in a bulk OUT transfer, which goes on the
+ *    bus in the next frame and completes at its end, and then services all
+ *    the cables again.
+ *
+ * The host wakes up every few milliseconds, a little late now and then, and
+ * queues all the events due within its look ahead. Two clients play on the
+ * cable, and another cable of the pipe may be busy, which keeps transfers
+ * completing every frame. An event goes out when its transfer is on the bus;
+ * how long after its presentation time that is, is the deviation. Before,
+ * the events went out as soon as they were written, so ahead of time by up
+ * to the look ahead.
+ *
+ * The program fails if an event goes out before its time, out of order, or
+ * later than a clock tick plus two frames plus the DPC latency after it.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -I../include -I../../driver/usbaud10/core -o midisched midisched.cpp
+ *     ./midisched
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Common.h"
+#include "MidiSchedule.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief MAX_OUTPUT_IRP in core/Midi.h. */
+#define MAX_OUTPUT_IRP			8
+
+/*! @brief Packets in a bulk OUT transfer of a full speed, 64 byte endpoint. */
+#define PACKETS_PER_TRANSFER	16
+
+/*! @brief Full speed frame, in us. */
+#define FRAME_US				1000.0
+
+/*! @brief Worst DPC latency, in us. */
+#define DPC_LATENCY_US			100.0
+
+/*! @brief Clients on the cable. */
+#define NUMBER_OF_CLIENTS		2
+
+/*! @brief Events per client. */
+#define NUMBER_OF_EVENTS		20000
+
+/*! @brief Performance counter frequency, in Hz. */
+#define PERFORMANCE_FREQUENCY	10000000
+
+/*! @brief Size of a client's ring buffer, in packets (MIDI_CLIENT_DEFAULT_BUFFER_SIZE). */
+#define RING_SIZE				1024
+
+/*****************************************************************************
+ * Types
+ */
+/*! @brief Scenario. */
+typedef struct
+{
+	const char *	Name;
+	double			ClockTickUs;		// timer resolution
+	double			HostPeriodUs;		// how often the host wakes up
+	double			HostLateUs;			// how late it may wake up
+	double			LookAheadUs;		// how far ahead it queues
+	int				BusyPipe;			// another cable keeps the pipe busy
+} SCENARIO;
+
+/*! @brief Client. */
+typedef struct
+{
+	double			Time[NUMBER_OF_EVENTS];		// presentation time of each event, us
+	int				Written;					// events written by the host
+	int				Ring[RING_SIZE];			// events in the ring buffer
+	int				ReadIndex, WriteIndex;
+	int				Emitted;					// events on the bus
+} CLIENT;
+
+/*! @brief Model state. */
+typedef struct
+{
+	const SCENARIO *	Scenario;
+	int					Now;					// TRUE for the current driver, FALSE for before
+	double				Clock;					// us
+	CLIENT				Clients[NUMBER_OF_CLIENTS];
+	int					FifoPackets;			// in the work item being filled, this cable's
+	int					FifoOtherPackets;		// of the other cable
+	int					FreeItems;
+	LONGLONG			ServiceTimeStampCounter;	// 0 if not set
+	double				TimerFires;				// when the timer DPC runs, 0 if not set
+	int					InFlightEvents[MAX_OUTPUT_IRP][PACKETS_PER_TRANSFER * NUMBER_OF_CLIENTS];
+	double				InFlightCompletion[MAX_OUTPUT_IRP];
+	int					InFlightCount[MAX_OUTPUT_IRP];
+	double				BusFree;				// the frame after the last one taken
+	int					Pending[PACKETS_PER_TRANSFER];	// events in the work item being filled
+	double				DeviationSum, DeviationMin, DeviationMax;
+	double				Deviations[NUMBER_OF_EVENTS * NUMBER_OF_CLIENTS];
+	int					NumberOfDeviations;
+	int					Failed;
+} MODEL;
+
+/*****************************************************************************
+ * Random()
+ *****************************************************************************
+ */
+static double
+Random
+(
+	unsigned int *	Seed
+)
+{
+	*Seed = *Seed * 1103515245 + 12345;
+
+	return double((*Seed >> 8) & 0xFFFF) / 65536.0;
+}
+
+/*****************************************************************************
+ * TimeStamp()
+ *****************************************************************************
+ * @brief
+ * The performance counter at a presentation time, in us.
+ */
+static LONGLONG
+TimeStamp
+(
+	double	Us
+)
+{
+	return llround(Us * (PERFORMANCE_FREQUENCY / 1000000));
+}
+
+/*****************************************************************************
+ * Counter()
+ *****************************************************************************
+ * @brief
+ * What KeQueryPerformanceCounter() returns at Us, the ticks so far.
+ */
+static LONGLONG
+Counter
+(
+	double	Us
+)
+{
+	return (LONGLONG)floor(Us * (PERFORMANCE_FREQUENCY / 1000000));
+}
+
+/*****************************************************************************
+ * Check()
+ *****************************************************************************
+ */
+static void
+Check
+(
+	MODEL *			Model,
+	int				Condition,
+	const char *	What
+)
+{
+	if (!Condition && !Model->Failed)
+	{
+		printf("    FAILED: %s\n", What);
+
+		Model->Failed = 1;
+	}
+}
+
+/*****************************************************************************
+ * FlushFifo()
+ *****************************************************************************
+ * @brief
+ * Sends the work item being filled (CMidiDataPipe::FlushFifo()). It goes on
+ * the bus in the next frame, after those already taken.
+ */
+static void
+FlushFifo
+(
+	MODEL *		Model
+)
+{
+	if (((Model->FifoPackets + Model->FifoOtherPackets) == 0) || (Model->FreeItems == 0)) return;
+
+	int Item = MAX_OUTPUT_IRP - Model->FreeItems--;
+
+	double Frame = ceil(Model->Clock / FRAME_US) * FRAME_US;
+
+	if (Frame < Model->BusFree) Frame = Model->BusFree;
+
+	Model->BusFree = Frame + FRAME_US;
+
+	Model->InFlightCompletion[Item] = Frame + FRAME_US;
+	Model->InFlightCount[Item] = Model->FifoPackets;
+
+	for (int i = 0; i < Model->FifoPackets; i++)
+	{
+		int Event = Model->Pending[i];
+
+		Model->InFlightEvents[Item][i] = Event;
+
+		// On the bus at the start of the frame.
+		CLIENT * Client = &Model->Clients[Event / NUMBER_OF_EVENTS];
+
+		double Deviation = Frame - Client->Time[Event % NUMBER_OF_EVENTS];
+
+		Check(Model, (Event % NUMBER_OF_EVENTS) == Client->Emitted, "events of a client in order");
+
+		Client->Emitted++;
+
+		Model->Deviations[Model->NumberOfDeviations++] = Deviation;
+		Model->DeviationSum += Deviation;
+
+		if (Deviation < Model->DeviationMin) Model->DeviationMin = Deviation;
+		if (Deviation > Model->DeviationMax) Model->DeviationMax = Deviation;
+	}
+
+	Model->FifoPackets = 0;
+	Model->FifoOtherPackets = 0;
+}
+
+/*****************************************************************************
+ * FlushBuffer()
+ *****************************************************************************
+ * @brief
+ * As CMidiClient::FlushBuffer(), with CMidiCable::ScheduleService().
+ */
+static void
+FlushBuffer
+(
+	MODEL *		Model,
+	CLIENT *	Client,
+	int			ClientNumber
+)
+{
+	while (Model->FreeItems && (Client->ReadIndex != Client->WriteIndex))
+	{
+		int Event = Client->Ring[Client->ReadIndex % RING_SIZE];
+
+		LONGLONG TimeStampCounter = TimeStamp(Client->Time[Event]);
+
+		LONGLONG CurrentTimeStampCounter = Counter(Model->Clock);
+
+		if (Model->Now && !MidiIsDue(TimeStampCounter, CurrentTimeStampCounter))
+		{
+			// ScheduleService(): the timer fires on the first clock tick after
+			// the due time.
+			if (MidiScheduleService(&Model->ServiceTimeStampCounter, TimeStampCounter))
+			{
+				LONGLONG DueTime = MidiServiceDueTime(TimeStampCounter, CurrentTimeStampCounter, PERFORMANCE_FREQUENCY);
+
+				double Tick = Model->Scenario->ClockTickUs;
+
+				Model->TimerFires = ceil((Model->Clock - DueTime / 10.0) / Tick) * Tick;
+			}
+			break;
+		}
+
+		Client->ReadIndex++;
+
+		Model->Pending[Model->FifoPackets++] = ClientNumber * NUMBER_OF_EVENTS + Event;
+
+		if ((Model->FifoPackets + Model->FifoOtherPackets) == PACKETS_PER_TRANSFER)
+		{
+			FlushFifo(Model);
+		}
+	}
+}
+
+/*****************************************************************************
+ * Service()
+ *****************************************************************************
+ * @brief
+ * As CMidiCable::Service(), then the FIFO is sent.
+ */
+static void
+Service
+(
+	MODEL *		Model
+)
+{
+	for (int c = 0; c < NUMBER_OF_CLIENTS; c++)
+	{
+		FlushBuffer(Model, &Model->Clients[c], c);
+	}
+
+	if (Model->Scenario->BusyPipe && (Model->FreeItems == MAX_OUTPUT_IRP))
+	{
+		// The other cable plays on time too, so it keeps a transfer in
+		// flight, completing every frame, without queueing ahead.
+		Model->FifoOtherPackets++;
+	}
+
+	FlushFifo(Model);
+}
+
+/*****************************************************************************
+ * Run()
+ *****************************************************************************
+ */
+static void
+Run
+(
+	MODEL *				Model,
+	const SCENARIO *	Scenario,
+	int					Now
+)
+{
+	memset(Model, 0, sizeof(*Model));
+
+	Model->Scenario = Scenario;
+	Model->Now = Now;
+	Model->FreeItems = MAX_OUTPUT_IRP;
+	Model->DeviationMin = 1e30;
+	Model->DeviationMax = -1e30;
+
+	unsigned int Seed = 1;
+
+	// 16th notes at 120 BPM with a swing, and a denser part with some human
+	// timing, both starting a second in. On counter ticks, as they are time
+	// stamped.
+	for (int e = 0; e < NUMBER_OF_EVENTS; e++)
+	{
+		Model->Clients[0].Time[e] = 1e6 + e * 125000.0 / 2 + ((e & 1) ? 20833.0 : 0);
+		Model->Clients[1].Time[e] = TimeStamp(1e6 + e * 7000.0 + Random(&Seed) * 3000.0) / double(PERFORMANCE_FREQUENCY / 1000000);
+	}
+
+	double HostWakeUp = 0;
+
+	double End = Model->Clients[0].Time[NUMBER_OF_EVENTS-1] + 1e6;
+
+	for (Model->Clock = 0; Model->Clock < End; )
+	{
+		// The next thing to happen.
+		double Next = HostWakeUp;
+
+		for (int i = 0; i < (MAX_OUTPUT_IRP - Model->FreeItems); i++)
+		{
+			if (Model->InFlightCompletion[i] < Next) Next = Model->InFlightCompletion[i];
+		}
+
+		if (Model->TimerFires && (Model->TimerFires < Next)) Next = Model->TimerFires;
+
+		Model->Clock = Next;
+
+		// Completions, in order (the work items are used in turn).
+		while ((Model->FreeItems < MAX_OUTPUT_IRP) && (Model->InFlightCompletion[0] <= Model->Clock))
+		{
+			memmove(&Model->InFlightCompletion[0], &Model->InFlightCompletion[1], (MAX_OUTPUT_IRP - 1) * sizeof(double));
+			memmove(&Model->InFlightCount[0], &Model->InFlightCount[1], (MAX_OUTPUT_IRP - 1) * sizeof(int));
+			memmove(&Model->InFlightEvents[0], &Model->InFlightEvents[1], (MAX_OUTPUT_IRP - 1) * sizeof(Model->InFlightEvents[0]));
+
+			Model->FreeItems++;
+
+			Service(Model);
+		}
+
+		if (Model->TimerFires && (Model->TimerFires <= Model->Clock))
+		{
+			// ServiceDpcRoutine(), after the DPC latency.
+			Model->Clock += Random(&Seed) * DPC_LATENCY_US;
+
+			Model->TimerFires = 0;
+			Model->ServiceTimeStampCounter = 0;
+
+			Service(Model);
+		}
+
+		if (HostWakeUp <= Model->Clock)
+		{
+			// WriteBuffer() for everything within the look ahead, as far as
+			// the ring buffers take it, then the FIFO is flushed.
+			for (int c = 0; c < NUMBER_OF_CLIENTS; c++)
+			{
+				CLIENT * Client = &Model->Clients[c];
+
+				while ((Client->Written < NUMBER_OF_EVENTS) &&
+					   (Client->Time[Client->Written] < (Model->Clock + Scenario->LookAheadUs)) &&
+					   ((Client->WriteIndex - Client->ReadIndex) < RING_SIZE))
+				{
+					Client->Ring[Client->WriteIndex++ % RING_SIZE] = Client->Written++;
+				}
+
+				FlushBuffer(Model, Client, c);
+			}
+
+			FlushFifo(Model);
+
+			HostWakeUp += Scenario->HostPeriodUs + Random(&Seed) * Scenario->HostLateUs;
+		}
+	}
+
+	for (int c = 0; c < NUMBER_OF_CLIENTS; c++)
+	{
+		Check(Model, Model->Clients[c].Emitted == NUMBER_OF_EVENTS, "every event sent");
+	}
+}
+
+/*****************************************************************************
+ * CompareDouble()
+ *****************************************************************************
+ */
+static int
+CompareDouble
+(
+	const void *	A,
+	const void *	B
+)
+{
+	double a = *(const double *)A, b = *(const double *)B;
+
+	return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(	void
+)
+{
+	static const SCENARIO Scenarios[] =
+	{
+		{ "1 ms timer, idle pipe",       1000.0,  10000.0, 5000.0,  50000.0, 0 },
+		{ "1 ms timer, busy pipe",       1000.0,  10000.0, 5000.0,  50000.0, 1 },
+		{ "15.6 ms timer, idle pipe",   15625.0,  10000.0, 5000.0,  50000.0, 0 },
+		{ "15.6 ms timer, busy pipe",   15625.0,  10000.0, 5000.0,  50000.0, 1 },
+		{ "1 ms timer, 500 ms ahead",    1000.0, 100000.0, 20000.0, 500000.0, 0 },
+	};
+
+	static MODEL Model;
+
+	int Failed = 0;
+
+	for (unsigned int s = 0; s < sizeof(Scenarios) / sizeof(Scenarios[0]); s++)
+	{
+		const SCENARIO * Scenario = &Scenarios[s];
+
+		printf("%s, host every %.0f ms (up to %.0f ms late), %.0f ms ahead:\n", Scenario->Name,
+			   Scenario->HostPeriodUs / 1000, Scenario->HostLateUs / 1000, Scenario->LookAheadUs / 1000);
+
+		for (int Now = 0; Now <= 1; Now++)
+		{
+			Run(&Model, Scenario, Now);
+
+			qsort(Model.Deviations, Model.NumberOfDeviations, sizeof(double), CompareDouble);
+
+			printf("  %-6s deviation min %8.3f ms, mean %8.3f ms, 99%% %8.3f ms, max %8.3f ms\n", Now ? "now" : "before",
+				   Model.DeviationMin / 1000, Model.DeviationSum / Model.NumberOfDeviations / 1000,
+				   Model.Deviations[Model.NumberOfDeviations * 99 / 100] / 1000, Model.DeviationMax / 1000);
+
+			if (Now)
+			{
+				double Bound = Scenario->ClockTickUs + 2 * FRAME_US + DPC_LATENCY_US;
+
+				Check(&Model, Model.DeviationMin >= 0, "no event before its time");
+				Check(&Model, Model.DeviationMax <= Bound, "no event later than a clock tick, two frames and the DPC latency");
+
+				Failed |= Model.Failed;
+			}
+		}
+	}
+
+	printf(Failed ? "FAILED\n" : "PASSED\n");
+
+	return Failed ? 1 : 0;
+}
@@ -0,0 +1,632 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       outputmodel.cpp
+ * @brief      Models the output packet schedule of the ASIO engine
+ *             (asiodll/schedule.cpp) against a device and a host.
+ * @details
+ * The model runs the main thread's use of CAsioSchedule the way
+ * CAsioDriver::_MainThreadHandler() and ASIOOutputReady() do, with times in
+ * samples:
+ *
+ * - the device takes packet j at j * BufferSize, or when it is queued, and
+ *   plays it DeviceLatency later. A packet queued more than Slack after its
+ *   time comes too late (the pin FIFO ran dry).
+ * - packet j completes at (j + 1) * BufferSize, or when it is queued, and
+ *   its completion is buffer switch j.
+ * - the host writes the number of the switch into the buffer HostTime after
+ *   the switch, and then calls ASIOOutputReady(); in bufferSwitch, or on its
+ *   own thread after bufferSwitch returned at once.
+ *
+ * Each packet that plays is then checked: it must hold the output of the
+ * switch Lead packets before it, and the time from that switch to the
+ * packet sounding must be what ASIOGetLatencies() reports for the same
+ * configuration. Hosts that miss ASIOOutputReady() now and then must not
+ * stall the stream, and hosts that take too long must show up as late or
+ * stale packets (so the model does find them).
+ *
+ * Input is left out: it is queued at the same packet indices, and only
+ * moves the switch to the later of the two completions.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -I../include -I../../asiodll -o outputmodel outputmodel.cpp ../../asiodll/schedule.cpp
+ *     ./outputmodel
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "schedule.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief NUMBER_OF_DATA_PACKETS in asiodll/asiodrv.h. */
+#define NUMBER_OF_DATA_PACKETS	8
+
+/*! @brief Buffer switches per run. */
+#define NUMBER_OF_SWITCHES		2000
+
+/*! @brief Device latency (the pin's Latency.Time), in samples. */
+#define DEVICE_LATENCY			96
+
+/*! @brief How late a packet may be queued before the pin runs dry, in samples. */
+#define DEVICE_SLACK			24
+
+/*! @brief Host behaviours. */
+#define HOST_SYNC				0	/*!< @brief Processes in bufferSwitch, calls ASIOOutputReady() before it returns. */
+#define HOST_ASYNC				1	/*!< @brief bufferSwitch returns at once, ASIOOutputReady() comes from another thread. */
+#define HOST_PLAIN				2	/*!< @brief Processes in bufferSwitch, never calls ASIOOutputReady(). */
+#define HOST_MISS				3	/*!< @brief As HOST_SYNC, but skips a switch now and then. */
+
+/*! @brief Switches HOST_MISS skips. */
+#define HOST_MISSES(Switch)		(((Switch) % 7) == 3)
+
+/*! @brief Events. */
+#define EVENT_COMPLETE			0	/*!< @brief A packet completes (main thread). */
+#define EVENT_OUTPUT_READY		1	/*!< @brief ASIOOutputReady() (host thread). */
+#define EVENT_TIME_OUT			2	/*!< @brief The completion port wait times out (main thread). */
+
+#define MAXIMUM_EVENTS			64
+
+#define NOT_YET					(-1)
+
+/*****************************************************************************
+ * Types
+ */
+typedef struct
+{
+	LONGLONG	Time;
+	ULONG		Type;
+	ULONG		Index;
+} EVENT;
+
+typedef struct
+{
+	ULONG		BufferSize;
+	ULONG		NumberOfOutputBuffers;
+	BOOL		EarlyOutputOption;
+	ULONG		Host;
+	ULONG		HostTime;
+} CONFIGURATION;
+
+typedef struct
+{
+	ULONG		Lead;
+	LONG		Reported;		// ASIOGetLatencies() output latency.
+	LONG		Measured;		// Latency of the packets that played right, or NOT_YET.
+	ULONG		Switches;
+	ULONG		Misses;			// Switches the host skipped.
+	ULONG		Late;			// Packets queued too late.
+	ULONG		Stale;			// Packets that played the wrong output.
+	ULONG		Mismatches;		// Packets that played right with another latency.
+} RESULT;
+
+/*****************************************************************************
+ * Model state
+ */
+static CAsioSchedule	Schedule;
+static BOOL				EarlyOutput;
+static BOOL				OutputReadyCalled;
+static ULONG			Lead;
+static ULONG			BufferSize;
+
+static EVENT			Events[MAXIMUM_EVENTS];
+static ULONG			NumberOfEvents;
+
+static LONGLONG			SwitchTime[NUMBER_OF_SWITCHES + NUMBER_OF_DATA_PACKETS];
+static LONGLONG			HostWriteTime[NUMBER_OF_SWITCHES + NUMBER_OF_DATA_PACKETS];
+static LONGLONG			QueueTime[NUMBER_OF_SWITCHES + NUMBER_OF_DATA_PACKETS];
+static LONGLONG			FillTime[NUMBER_OF_SWITCHES + NUMBER_OF_DATA_PACKETS];
+static LONG				FillValue[NUMBER_OF_SWITCHES + NUMBER_OF_DATA_PACKETS];
+
+static ULONG			AbsolutePacket[NUMBER_OF_DATA_PACKETS];	// packet index -> packet number
+static LONG				CurrentSwitch;
+static LONGLONG			MainThreadFree;
+
+/*****************************************************************************
+ * Push()
+ *****************************************************************************
+ * @brief
+ * Add an event.
+ */
+static void
+Push
+(
+	LONGLONG	Time,
+	ULONG		Type,
+	ULONG		Index
+)
+{
+	if (NumberOfEvents < MAXIMUM_EVENTS)
+	{
+		Events[NumberOfEvents].Time = Time;
+		Events[NumberOfEvents].Type = Type;
+		Events[NumberOfEvents].Index = Index;
+
+		NumberOfEvents++;
+	}
+}
+
+/*****************************************************************************
+ * Pop()
+ *****************************************************************************
+ * @brief
+ * Take the earliest event, the first pushed of equal ones.
+ */
+static BOOL
+Pop
+(
+	EVENT *	Event
+)
+{
+	if (!NumberOfEvents)
+	{
+		return FALSE;
+	}
+
+	ULONG Earliest = 0;
+
+	for (ULONG i = 1; i < NumberOfEvents; i++)
+	{
+		if (Events[i].Time < Events[Earliest].Time)
+		{
+			Earliest = i;
+		}
+	}
+
+	*Event = Events[Earliest];
+
+	memmove(&Events[Earliest], &Events[Earliest + 1], (NumberOfEvents - Earliest - 1) * sizeof(EVENT));
+
+	NumberOfEvents--;
+
+	return TRUE;
+}
+
+/*****************************************************************************
+ * FillPacket()
+ *****************************************************************************
+ * @brief
+ * _SyncWritePinData(): copy what the host left in a buffer into a packet.
+ */
+static void
+FillPacket
+(
+	ULONG		Packet,
+	ULONG		BufferIndex,
+	LONGLONG	Time
+)
+{
+	LONG Value = NOT_YET;
+
+	for (LONG k = CurrentSwitch; k >= 0; k--)
+	{
+		if (((ULONG(k) & 1) == BufferIndex) && (HostWriteTime[k] != NOT_YET) && (HostWriteTime[k] <= Time))
+		{
+			Value = k;
+			break;
+		}
+	}
+
+	FillTime[Packet] = Time;
+
+	FillValue[Packet] = Value;
+}
+
+/*****************************************************************************
+ * QueuePacket()
+ *****************************************************************************
+ * @brief
+ * _SyncQueuePinBuffer(): hand a packet to the device.
+ */
+static void
+QueuePacket
+(
+	ULONG		Packet,
+	LONGLONG	Time
+)
+{
+	QueueTime[Packet] = Time;
+
+	LONGLONG Completion = LONGLONG(Packet + 1) * BufferSize;
+
+	Push((Completion > Time) ? Completion : Time, EVENT_COMPLETE, Packet);
+}
+
+/*****************************************************************************
+ * SendOutput()
+ *****************************************************************************
+ * @brief
+ * CAsioDriver::_SyncSendOutput().
+ */
+static void
+SendOutput
+(
+	LONGLONG	Time
+)
+{
+	ULONG PacketIndex, BufferIndex;
+
+	if (Schedule.IsEarlyOutput() && Schedule.TakeOutput(&PacketIndex, &BufferIndex))
+	{
+		FillPacket(AbsolutePacket[PacketIndex], BufferIndex, Time);
+
+		QueuePacket(AbsolutePacket[PacketIndex], Time);
+	}
+}
+
+/*****************************************************************************
+ * OutputReady()
+ *****************************************************************************
+ * @brief
+ * CAsioDriver::OutputReady() while running.
+ */
+static void
+OutputReady
+(
+	LONGLONG	Time
+)
+{
+	if (Schedule.IsEarlyOutput())
+	{
+		SendOutput(Time);
+	}
+	else
+	{
+		// Into the packet of the latest switch, queued or not.
+		ULONG PacketIndex = Schedule.GetPacketIndex(ULONG(CurrentSwitch));
+
+		FillPacket(AbsolutePacket[PacketIndex], ULONG(CurrentSwitch) & 1, Time);
+	}
+}
+
+/*****************************************************************************
+ * BufferSwitch()
+ *****************************************************************************
+ * @brief
+ * The ASIO_ENGINE_ACTION_SWITCH part of CAsioDriver::_MainThreadHandler(),
+ * with the host's bufferSwitch in the middle.
+ */
+static void
+BufferSwitch
+(
+	const CONFIGURATION *	Configuration,
+	RESULT *				Result,
+	ULONG					Switch,
+	LONGLONG				Time
+)
+{
+	CurrentSwitch = Switch;
+
+	SwitchTime[Switch] = Time;
+
+	ULONG QueuePacketIndex = Schedule.GetPacketIndex(Switch);
+
+	// The host missed ASIOOutputReady() of the last switch.
+	SendOutput(Time);
+
+	AbsolutePacket[QueuePacketIndex] = Switch + Lead;
+
+	Schedule.Switch(QueuePacketIndex, Switch & 1);
+
+	// bufferSwitch...
+	LONGLONG Return = Time;
+
+	LONGLONG Done = Time + Configuration->HostTime;
+
+	switch (Configuration->Host)
+	{
+		case HOST_MISS:
+			if (HOST_MISSES(Switch))
+			{
+				Result->Misses++;
+				break;
+			}
+			// fall through...
+		case HOST_SYNC:
+			HostWriteTime[Switch] = Done;
+			OutputReady(Done);
+			Return = Done;
+			break;
+
+		case HOST_ASYNC:
+			HostWriteTime[Switch] = Done;
+			Push(Done, EVENT_OUTPUT_READY, Switch);
+			break;
+
+		case HOST_PLAIN:
+			HostWriteTime[Switch] = Done;
+			Return = Done;
+			break;
+	}
+
+	MainThreadFree = Return;
+
+	if (!Schedule.IsEarlyOutput())
+	{
+		ULONG PacketIndex, OutputBufferIndex;
+
+		if (Schedule.TakeOutput(&PacketIndex, &OutputBufferIndex) && !OutputReadyCalled)
+		{
+			FillPacket(AbsolutePacket[PacketIndex], OutputBufferIndex, Return);
+		}
+
+		QueuePacket(Switch + Lead, Return);
+	}
+	else if (Schedule.IsOutputPending())
+	{
+		// The main thread waits a buffer for ASIOOutputReady().
+		Push(Return + BufferSize, EVENT_TIME_OUT, Switch);
+	}
+}
+
+/*****************************************************************************
+ * Run()
+ *****************************************************************************
+ * @brief
+ * Run a configuration from start to NUMBER_OF_SWITCHES switches, and check
+ * the packets that played.
+ */
+static void
+Run
+(
+	const CONFIGURATION *	Configuration,
+	RESULT *				Result
+)
+{
+	memset(Result, 0, sizeof(RESULT));
+
+	BufferSize = Configuration->BufferSize;
+
+	// The host calls ASIOOutputReady() once to see if it is there.
+	OutputReadyCalled = (Configuration->Host != HOST_PLAIN);
+
+	EarlyOutput = Configuration->EarlyOutputOption && OutputReadyCalled;
+
+	// What ASIOGetLatencies() reports...
+	CAsioSchedule Reported; Reported.Initialize(NUMBER_OF_DATA_PACKETS, Configuration->NumberOfOutputBuffers, EarlyOutput);
+
+	Result->Reported = LONG(Reported.GetOutputLatency(BufferSize) + DEVICE_LATENCY);
+
+	// ...and the start.
+	Schedule.Initialize(NUMBER_OF_DATA_PACKETS, Configuration->NumberOfOutputBuffers, EarlyOutput);
+
+	Lead = Schedule.GetLead();
+
+	Result->Lead = Lead;
+
+	Result->Measured = NOT_YET;
+
+	NumberOfEvents = 0;
+
+	CurrentSwitch = -1;
+
+	MainThreadFree = 0;
+
+	for (ULONG i = 0; i < NUMBER_OF_SWITCHES + NUMBER_OF_DATA_PACKETS; i++)
+	{
+		SwitchTime[i] = HostWriteTime[i] = QueueTime[i] = FillTime[i] = NOT_YET;
+
+		FillValue[i] = NOT_YET;
+	}
+
+	// Zero initialize the first N (N - 1) buffers.
+	for (ULONG i = 0; i < Lead; i++)
+	{
+		AbsolutePacket[i] = i;
+
+		FillPacket(i, 0, 0);
+
+		QueuePacket(i, 0);
+	}
+
+	EVENT Event;
+
+	while ((Result->Switches < NUMBER_OF_SWITCHES) && Pop(&Event))
+	{
+		if ((Event.Type != EVENT_OUTPUT_READY) && (Event.Time < MainThreadFree))
+		{
+			// The main thread is in bufferSwitch.
+			Push(MainThreadFree, Event.Type, Event.Index);
+			continue;
+		}
+
+		switch (Event.Type)
+		{
+			case EVENT_COMPLETE:
+				BufferSwitch(Configuration, Result, Event.Index, Event.Time);
+				Result->Switches++;
+				break;
+
+			case EVENT_OUTPUT_READY:
+				OutputReady(Event.Time);
+				break;
+
+			case EVENT_TIME_OUT:
+				// Any completion in the meantime restarted the wait.
+				if (LONG(Event.Index) == CurrentSwitch)
+				{
+					SendOutput(Event.Time);
+				}
+				break;
+		}
+	}
+
+	// Check the packets the switches filled, once the start is out of the way.
+	for (ULONG Packet = Lead + 2; Packet + 2 < Result->Switches + Lead; Packet++)
+	{
+		ULONG Switch = Packet - Lead;
+
+		if (QueueTime[Packet] == NOT_YET)
+		{
+			Result->Late++;
+			continue;
+		}
+
+		LONGLONG Due = LONGLONG(Packet) * BufferSize;
+
+		if (QueueTime[Packet] > Due + DEVICE_SLACK)
+		{
+			Result->Late++;
+			continue;
+		}
+
+		LONGLONG Taken = (QueueTime[Packet] > Due) ? QueueTime[Packet] : Due;
+
+		if ((FillTime[Packet] == NOT_YET) || (FillTime[Packet] > Taken) || (FillValue[Packet] != LONG(Switch)))
+		{
+			Result->Stale++;
+			continue;
+		}
+
+		LONG Measured = LONG(Due + DEVICE_LATENCY - SwitchTime[Switch]);
+
+		if (Result->Measured == NOT_YET)
+		{
+			Result->Measured = Measured;
+		}
+
+		if ((Measured != Result->Reported) || (Measured != Result->Measured))
+		{
+			Result->Mismatches++;
+		}
+	}
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(	void
+)
+{
+	static const char * HostNames[] = { "sync", "async", "plain", "miss" };
+
+	static const ULONG BufferSizes[] = { 32, 64, 128, 256, 512 };
+
+	int Failures = 0;
+
+	printf("buffer  N  early  host   lead  reported  measured  misses  late  stale  result\n");
+
+	for (ULONG b = 0; b < sizeof(BufferSizes) / sizeof(BufferSizes[0]); b++)
+	{
+		for (ULONG N = 2; N <= 4; N++)
+		{
+			for (ULONG Early = 0; Early < 2; Early++)
+			{
+				for (ULONG Host = HOST_SYNC; Host <= HOST_MISS; Host++)
+				{
+					for (ULONG Overloaded = 0; Overloaded < 2; Overloaded++)
+					{
+						CONFIGURATION Configuration;
+
+						Configuration.BufferSize = BufferSizes[b];
+						Configuration.NumberOfOutputBuffers = N;
+						Configuration.EarlyOutputOption = Early;
+						Configuration.Host = Host;
+
+						BOOL EarlyOutput = Early && (Host != HOST_PLAIN);
+
+						ULONG Lead = EarlyOutput ? N - 1 : N;
+
+						// The output must be in the packet when the device takes it. 
+						// Early output queues the packet with the data in it, so it 
+						// may be DEVICE_SLACK late; a packet queued before the host 
+						// filled it may not.
+						LONG Budget = LONG((Lead - 1) * BufferSizes[b]) + (((Host == HOST_ASYNC) && !EarlyOutput) ? 0 : DEVICE_SLACK);
+
+						if (Overloaded)
+						{
+							// Only hosts that return at once can overrun without 
+							// delaying the switches as well. Past the budget, or 
+							// past the next switch, the output is lost.
+							if (Host != HOST_ASYNC)
+							{
+								continue;
+							}
+
+							Configuration.HostTime = ULONG(Budget) + 1 + BufferSizes[b] / 4;
+						}
+						else
+						{
+							if (Budget <= 1)
+							{
+								continue;
+							}
+
+							// The host must also be done before the next switch, 
+							// which hands out the other buffer (and the packet of 
+							// a later switch).
+							LONG Limit = (Budget < LONG(BufferSizes[b])) ? Budget : LONG(BufferSizes[b]);
+
+							Configuration.HostTime = ULONG(Limit) / 2;
+						}
+
+						RESULT Result; Run(&Configuration, &Result);
+
+						BOOL Pass;
+
+						if (Result.Switches < NUMBER_OF_SWITCHES)
+						{
+							// Stalled.
+							Pass = FALSE;
+						}
+						else if (Overloaded)
+						{
+							Pass = (Result.Late + Result.Stale) > 0;
+						}
+						else if (Host == HOST_MISS)
+						{
+							// A miss costs the packet of that switch only.
+							Pass = (Result.Mismatches == 0) && ((Result.Late + Result.Stale) <= Result.Misses) && (Result.Measured == Result.Reported);
+						}
+						else
+						{
+							Pass = (Result.Mismatches == 0) && (Result.Late == 0) && (Result.Stale == 0) && (Result.Measured == Result.Reported);
+						}
+
+						printf("%6u  %u  %5s  %-5s  %4u  %8d  %8d  %6u  %4u  %5u  %s%s\n",
+							BufferSizes[b], N, Early ? "yes" : "no", HostNames[Host],
+							Result.Lead, Result.Reported, Result.Measured,
+							Result.Misses, Result.Late, Result.Stale,
+							Pass ? "ok" : "FAIL", Overloaded ? " (overloaded)" : "");
+
+						if (!Pass)
+						{
+							Failures++;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	printf("%d failure(s)\n", Failures);
+
+	return Failures ? 1 : 0;
+}
@@ -0,0 +1,316 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       periodjitter.c
+ * @brief      Models when the periods of an ASIO buffer size go out on the
+ *             USB bus and when their IRPs complete, and reports the jitter.
+ * @details
+ * The output packets of a data pipe are sized as CAudioDataPipe::Service()
+ * sizes them, from the nominal rate that CAudioDataPipe::SetFormat() sets
+ * up (no feedback): GetTransferSizeInFrames(1) per packet, with the
+ * fraction carried from packet to packet. An IRP carries a frame's worth of
+ * packets, one per packet interval (1 ms at full speed, 1/8 to 1/2 ms at
+ * high speed depending on bInterval).
+ *
+ * For each buffer size, period k ends with sample (k + 1) * B - 1. The
+ * model finds the packet that carries it, and reports:
+ *
+ *  - wire: the end of that packet's interval, i.e. when the period is on
+ *    the bus. Its distance to the ideal (k + 1) * B / rate must stay within
+ *    one packet interval, peak to peak.
+ *  - completion: the end of the frame of that IRP, i.e. when the pipe can
+ *    know. The USB stack takes whole frames only, so this is quantized to
+ *    1 ms whatever the packet interval; the figures show by how much.
+ *  - the number of periods that complete with the same IRP.
+ *
+ * Both the exact sizing and the one SetFormat() used before (which dropped
+ * (rate / 1000) % packets-per-ms frames a ms) are run. The exact one must
+ * add up to the sample rate in every configuration, and keep the wire
+ * times within one packet interval; the program fails otherwise.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     cc -O2 -o periodjitter periodjitter.c
+ *     ./periodjitter
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Fraction unit of the packet sizes, AUDIO_FF_UNIT in core/Feedback.h. */
+#define FF_UNIT				(1000u << 16)
+
+/*! @brief Length of a run, in ms. */
+#define RUN_TIME			4000
+
+/*! @brief Most packets in a run (8 per ms). */
+#define MAXIMUM_PACKETS		(RUN_TIME * 8)
+
+/*! @brief Sizings. */
+#define SIZING_EXACT		0	/*!< @brief SetFormat() now. */
+#define SIZING_TRUNCATED	1	/*!< @brief SetFormat() before. */
+
+/*****************************************************************************
+ * Types
+ */
+typedef struct
+{
+	uint32_t	Whole;
+	uint32_t	Fraction;
+} FF;
+
+typedef struct
+{
+	double		WireJitter;			/*!< @brief Peak to peak distance of the wire times to the ideal ones, in us. */
+	double		CompletionJitter;	/*!< @brief Peak to peak distance of the completion times to the ideal ones, in us. */
+	uint32_t	MinimumPerIrp;		/*!< @brief Fewest periods that complete with one IRP that completes any. */
+	uint32_t	MaximumPerIrp;		/*!< @brief Most periods that complete with one IRP. */
+} JITTER;
+
+/*****************************************************************************
+ * Model state
+ */
+static uint32_t	PacketEnd[MAXIMUM_PACKETS];	/*!< @brief Frames sent up to the end of each packet. */
+static uint32_t	NumberOfPackets;
+
+/*****************************************************************************
+ * SetFormat()
+ *****************************************************************************
+ * @brief
+ * The frames per packet interval, as CAudioDataPipe::SetFormat() sets them.
+ */
+static FF
+SetFormat
+(
+	uint32_t	SampleRate,
+	uint32_t	PacketsPerMs,
+	uint32_t	Sizing
+)
+{
+	FF Ff;
+
+	if (Sizing == SIZING_EXACT)
+	{
+		uint64_t FfPerPacketInterval = ((uint64_t)SampleRate << 16) / PacketsPerMs;
+
+		Ff.Whole = (uint32_t)(FfPerPacketInterval / FF_UNIT);
+
+		Ff.Fraction = (uint32_t)(FfPerPacketInterval % FF_UNIT);
+	}
+	else
+	{
+		Ff.Whole = SampleRate / 1000 / PacketsPerMs;
+
+		Ff.Fraction = ((SampleRate - ((SampleRate / 1000) * 1000)) / PacketsPerMs) << 16;
+	}
+
+	return Ff;
+}
+
+/*****************************************************************************
+ * SizePackets()
+ *****************************************************************************
+ * @brief
+ * Size the packets of a run as GetTransferSizeInFrames(1, TRUE) does, and
+ * return the number of frames sent in one second.
+ */
+static uint32_t
+SizePackets
+(
+	FF			Ff,
+	uint32_t	PacketsPerMs
+)
+{
+	uint32_t RunningFfFraction = 0, Frames = 0;
+
+	NumberOfPackets = RUN_TIME * PacketsPerMs;
+
+	for (uint32_t i = 0; i < NumberOfPackets; i++)
+	{
+		RunningFfFraction += Ff.Fraction;
+
+		Frames += Ff.Whole + RunningFfFraction / FF_UNIT;
+
+		RunningFfFraction %= FF_UNIT;
+
+		PacketEnd[i] = Frames;
+	}
+
+	return PacketEnd[1000 * PacketsPerMs - 1];
+}
+
+/*****************************************************************************
+ * Measure()
+ *****************************************************************************
+ * @brief
+ * Find the packet of the end of each period, and the jitter of the times.
+ */
+static void
+Measure
+(
+	uint32_t	SampleRate,
+	uint32_t	PacketsPerMs,
+	uint32_t	BufferSize,
+	JITTER *	Jitter
+)
+{
+	double PacketInterval = 1000.0 / PacketsPerMs;
+
+	double WireMinimum = 1e30, WireMaximum = -1e30, CompletionMinimum = 1e30, CompletionMaximum = -1e30;
+
+	uint32_t Irp = 0, PerIrp = 0, Packet = 0;
+
+	Jitter->MinimumPerIrp = 0xFFFFFFFF;
+	Jitter->MaximumPerIrp = 0;
+
+	// Leave the last IRPs out, the periods of the IRP are not all in.
+	for (uint32_t k = 0; ; k++)
+	{
+		uint32_t LastSample = (k + 1) * BufferSize - 1;
+
+		while ((Packet < NumberOfPackets) && (PacketEnd[Packet] <= LastSample))
+		{
+			Packet++;
+		}
+
+		if (Packet + 2 * PacketsPerMs >= NumberOfPackets)
+		{
+			break;
+		}
+
+		double Ideal = (double)(k + 1) * BufferSize * 1000000.0 / SampleRate;
+
+		double Wire = (Packet + 1) * PacketInterval - Ideal;
+
+		double Completion = (double)(Packet / PacketsPerMs + 1) * 1000.0 - Ideal;
+
+		if (Wire < WireMinimum) WireMinimum = Wire;
+		if (Wire > WireMaximum) WireMaximum = Wire;
+		if (Completion < CompletionMinimum) CompletionMinimum = Completion;
+		if (Completion > CompletionMaximum) CompletionMaximum = Completion;
+
+		uint32_t ThisIrp = Packet / PacketsPerMs;
+
+		if (ThisIrp != Irp)
+		{
+			if (PerIrp)
+			{
+				if (PerIrp < Jitter->MinimumPerIrp) Jitter->MinimumPerIrp = PerIrp;
+				if (PerIrp > Jitter->MaximumPerIrp) Jitter->MaximumPerIrp = PerIrp;
+			}
+
+			Irp = ThisIrp;
+
+			PerIrp = 0;
+		}
+
+		PerIrp++;
+	}
+
+	Jitter->WireJitter = WireMaximum - WireMinimum;
+
+	Jitter->CompletionJitter = CompletionMaximum - CompletionMinimum;
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(	void
+)
+{
+	static const uint32_t SampleRates[] = { 44100, 48000, 88200, 96000, 176400, 192000 };
+
+	// m_SupportedBufferSizes[] in asiodll/asiodrv.cpp, up to 2 ms.
+	static const double BufferSizes[] = { 0.1, 0.17, 0.25, 0.34, 0.5, 0.75, 1, 2 };
+
+	// Full speed, and high speed at bInterval 1 to 3 (bInterval 4 sizes as full speed).
+	static const struct
+	{
+		const char *	Name;
+		uint32_t		PacketsPerMs;
+	} Speeds[] = { { "full", 1 }, { "high/1", 8 }, { "high/2", 4 }, { "high/3", 2 } };
+
+	int Failures = 0;
+
+	printf("   rate  speed   sizing     frames/s  buffer  samples  period us  wire p-p us  completion p-p us  periods/irp\n");
+
+	for (uint32_t r = 0; r < sizeof(SampleRates) / sizeof(SampleRates[0]); r++)
+	{
+		for (uint32_t s = 0; s < sizeof(Speeds) / sizeof(Speeds[0]); s++)
+		{
+			for (uint32_t Sizing = SIZING_EXACT; Sizing <= SIZING_TRUNCATED; Sizing++)
+			{
+				uint32_t SampleRate = SampleRates[r], PacketsPerMs = Speeds[s].PacketsPerMs;
+
+				FF Ff = SetFormat(SampleRate, PacketsPerMs, Sizing);
+
+				uint32_t FramesPerSecond = SizePackets(Ff, PacketsPerMs);
+
+				// The truncated sizing is only shown where it differs.
+				if ((Sizing == SIZING_TRUNCATED) && (FramesPerSecond == SampleRate))
+				{
+					continue;
+				}
+
+				for (uint32_t b = 0; b < sizeof(BufferSizes) / sizeof(BufferSizes[0]); b++)
+				{
+					// As ASIOGetBufferSize() reports them.
+					uint32_t BufferSize = (uint32_t)(BufferSizes[b] * SampleRate / 1000);
+
+					JITTER Jitter; Measure(SampleRate, PacketsPerMs, BufferSize, &Jitter);
+
+					int Pass = 1;
+
+					if (Sizing == SIZING_EXACT)
+					{
+						// Exact to the frame, and on the bus within one packet interval.
+						Pass = (FramesPerSecond == SampleRate) && (Jitter.WireJitter <= 1000.0 / PacketsPerMs + 0.001);
+					}
+
+					printf("%7u  %-6s  %-9s  %8u  %6.2f  %7u  %9.1f  %11.1f  %17.1f  %5u..%u%s\n",
+						SampleRate, Speeds[s].Name, (Sizing == SIZING_EXACT) ? "exact" : "truncated", FramesPerSecond,
+						BufferSizes[b], BufferSize, BufferSize * 1000000.0 / SampleRate,
+						Jitter.WireJitter, Jitter.CompletionJitter, Jitter.MinimumPerIrp, Jitter.MaximumPerIrp,
+						Pass ? "" : "  FAIL");
+
+					if (!Pass)
+					{
+						Failures++;
+					}
+				}
+			}
+		}
+	}
+
+	printf("%d failure(s)\n", Failures);
+
+	return Failures ? 1 : 0;
+}
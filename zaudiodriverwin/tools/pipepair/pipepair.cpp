@@ -0,0 +1,414 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       pipepair.cpp
+ * @brief      Runs an input and an output data pipe paired for implicit
+ *             feedback (core/ImplicitFeedback.h) against a drifting device.
+ * @details
+ * The packet size queue between the pipes, CImplicitFeedbackQueue, is built
+ * here as is, with tools/include standing in for the DDK headers. Around it,
+ * a millisecond at a time:
+ *
+ *  - the device clock runs off nominal by some ppm, and each packet interval
+ *    the device records the frames its clock counted;
+ *  - the input pipe completes an IRP of one ms of packets and queues their
+ *    sizes as CAudioDataPipe::OnImplicitFeedback() does, at the nominal size
+ *    for a packet that failed;
+ *  - the output pipe, with a few IRPs in flight, gets one back (now and
+ *    then a ms late, along with the next) and sizes the packets of a new one
+ *    as FlushBuffer() does, from the queue through
+ *    GetTransferSizeInFrames(), or from the nominal rate when the queue is
+ *    empty, as it is at the start and after the pipes are paired again.
+ *
+ * The device plays as many frames per interval as it records, so the
+ * output is locked when the frames sent run a constant distance ahead of the
+ * frames played. Half way through, just after a late completion, the pipes
+ * are paired again (SetImplicitFeedbackPipe()), which drops what was
+ * queued. The same runs are made without the pairing, which is how the
+ * output was paced before: it drifts away from the input at the ppm of the
+ * device clock, and FlushBuffer() had to resynchronize the client.
+ *
+ * The program fails unless, once the queue has filled after the start and
+ * after the pairing, every output packet is sized from the queue and the
+ * distance moves by no more than a frame, plus a frame per failed packet.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -I../include -I../../driver/usbaud10/core -o pipepair pipepair.cpp
+ *     ./pipepair [seconds]
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Common.h"
+#include "ImplicitFeedback.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Default length of a run, in seconds. */
+#define NUMBER_OF_SECONDS		60
+
+/*! @brief Time after the start or a pairing before the output must be locked, in ms. */
+#define SETTLE_TIME				20
+
+/*****************************************************************************
+ * Types
+ */
+/*! @brief The pacing state of an output data pipe. */
+typedef struct
+{
+	BOOL					Paired;				// paced by the input pipe (now) or not (before)
+	ULONG					FfWhole;			// m_FfPerPacketInterval
+	ULONG					FfFraction;
+	ULONG					RunningFfFraction;	// m_RunningFfFraction
+	CImplicitFeedbackQueue	Queue;				// m_ImplicitFeedbackQueue
+	ULONG					Fallbacks;			// packets sized from the nominal rate
+} OUTPUT_PIPE;
+
+/*! @brief A device and its pipe pair. */
+typedef struct
+{
+	const char *	Name;
+	ULONG			SampleRate;
+	ULONG			PacketsPerMs;
+	ULONG			TransferDepth;		// output IRPs in flight
+	double			Ppm;				// device clock off nominal
+	ULONG			ErrorInterval;		// input packets per failed packet, 0 for none
+	ULONG			LateInterval;		// ms per output completion handled a ms late, 0 for none
+} DEVICE;
+
+/*! @brief Result of a run. */
+typedef struct
+{
+	double		Drift;				// distance at the end less the distance once settled, in frames
+	double		Wander;				// largest move of the distance once settled, in frames
+	ULONG		LateFallbacks;		// packets sized from the nominal rate once settled
+	ULONG		PairFallbacks;		// packets sized from the nominal rate for the sizes the pairing dropped
+	ULONG		Errors;				// failed input packets
+} RESULT;
+
+/*****************************************************************************
+ * InitOutputPipe()
+ *****************************************************************************
+ * @brief
+ * Set the nominal rate up as CAudioDataPipe::SetFormat() does.
+ */
+static void
+InitOutputPipe
+(
+	OUTPUT_PIPE *	Pipe,
+	BOOL			Paired,
+	ULONG			SampleRate,
+	ULONG			PacketsPerMs
+)
+{
+	ULONGLONG FfPerPacketInterval = (ULONGLONG(SampleRate) << 16) / PacketsPerMs;
+
+	Pipe->Paired = Paired;
+	Pipe->FfWhole = ULONG(FfPerPacketInterval / (1000 << 16));
+	Pipe->FfFraction = ULONG(FfPerPacketInterval % (1000 << 16));
+	Pipe->RunningFfFraction = 0;
+	Pipe->Fallbacks = 0;
+
+	Pipe->Queue.Init();
+}
+
+/*****************************************************************************
+ * GetTransferSizeInFrames()
+ *****************************************************************************
+ * @brief
+ * CAudioDataPipe::GetTransferSizeInFrames().
+ */
+static ULONG
+GetTransferSizeInFrames
+(
+	OUTPUT_PIPE *	Pipe,
+	ULONG			NumberOfTransfers,
+	BOOL			UpdateRunningFfFraction
+)
+{
+	ULONG TransferSizeInFrames;
+
+	if (Pipe->Queue.Get(NumberOfTransfers, UpdateRunningFfFraction, &TransferSizeInFrames))
+	{
+		return TransferSizeInFrames;
+	}
+
+	if (UpdateRunningFfFraction)
+	{
+		Pipe->Fallbacks++;
+	}
+
+	ULONG RunningFfFraction = Pipe->RunningFfFraction + (Pipe->FfFraction * NumberOfTransfers);
+
+	TransferSizeInFrames = (Pipe->FfWhole * NumberOfTransfers) + (RunningFfFraction / (1000 << 16));
+
+	if (UpdateRunningFfFraction)
+	{
+		Pipe->RunningFfFraction = RunningFfFraction % (1000 << 16);
+	}
+
+	return TransferSizeInFrames;
+}
+
+/*****************************************************************************
+ * OnImplicitFeedback()
+ *****************************************************************************
+ * @brief
+ * CAudioDataPipe::OnImplicitFeedback() for an IRP of NumberOfPackets.
+ */
+static void
+OnImplicitFeedback
+(
+	OUTPUT_PIPE *	Pipe,
+	const ULONG *	PacketSize,
+	const BOOL *	PacketFailed,
+	ULONG			NumberOfPackets
+)
+{
+	ULONG WriteIndex = Pipe->Queue.BeginPut();
+
+	for (ULONG i = 0; i < NumberOfPackets; i++)
+	{
+		ULONG NumberOfFrames = Pipe->FfWhole;
+
+		if (!PacketFailed[i])
+		{
+			NumberOfFrames = PacketSize[i];
+		}
+
+		if (!Pipe->Queue.Put(WriteIndex, NumberOfFrames))
+		{
+			break;
+		}
+
+		WriteIndex++;
+	}
+
+	Pipe->Queue.EndPut(WriteIndex);
+}
+
+/*****************************************************************************
+ * Run()
+ *****************************************************************************
+ * @brief
+ * Run a device for Seconds, with the pipes paired or not.
+ */
+static void
+Run
+(
+	const DEVICE *	Device,
+	BOOL			Paired,
+	ULONG			Seconds,
+	RESULT *		Result
+)
+{
+	OUTPUT_PIPE Pipe;
+
+	InitOutputPipe(&Pipe, Paired, Device->SampleRate, Device->PacketsPerMs);
+
+	memset(Result, 0, sizeof(RESULT));
+
+	double FramesPerPacket = Device->SampleRate * (1.0 + Device->Ppm * 1e-6) / (1000.0 * Device->PacketsPerMs);
+
+	ULONG RunTime = Seconds * 1000;
+
+	// Pair again just after a late completion, when the queue holds the most.
+	ULONG PairTime = Device->LateInterval ? ((RunTime / 2) / Device->LateInterval + 1) * Device->LateInterval : RunTime / 2;
+
+	ULONG Pending = 0;
+
+	ULONGLONG Recorded = 0;		// frames the device clock counted
+	ULONGLONG Sent = 0;			// frames the output pipe sent
+
+	ULONG InputPackets = 0;
+
+	double Distance = 0, SettledDistance = 0;
+
+	BOOL Settled = FALSE;
+
+	// Until then, the queue may run dry.
+	ULONG SettleTime = SETTLE_TIME;
+
+	// The output pipe starts with its IRPs in flight before any input
+	// completes, so the first ones are sized from the nominal rate.
+	for (ULONG i = 0; i < Device->TransferDepth * Device->PacketsPerMs; i++)
+	{
+		Sent += GetTransferSizeInFrames(&Pipe, 1, TRUE);
+	}
+
+	for (ULONG Ms = 0; Ms < RunTime; Ms++)
+	{
+		BOOL Late = Device->LateInterval && ((Ms % Device->LateInterval) == Device->LateInterval - 1);
+
+		if (Paired && (Ms == PairTime))
+		{
+			// SetImplicitFeedbackPipe() with a new output pipe.
+			Pipe.Queue.Restart();
+
+			SettleTime = Ms + SETTLE_TIME;
+
+			Result->PairFallbacks = Pipe.Fallbacks;
+		}
+
+		// The device counts a ms of packet intervals, and plays as many frames
+		// as it counts.
+		ULONG PacketSize[8];
+		BOOL PacketFailed[8];
+
+		for (ULONG i = 0; i < Device->PacketsPerMs; i++)
+		{
+			ULONGLONG Count = ULONGLONG(floor(FramesPerPacket * (ULONGLONG(Ms) * Device->PacketsPerMs + i + 1)));
+
+			PacketSize[i] = ULONG(Count - Recorded);
+
+			Recorded = Count;
+
+			PacketFailed[i] = Device->ErrorInterval && ((++InputPackets % Device->ErrorInterval) == 0);
+
+			if (PacketFailed[i])
+			{
+				Result->Errors++;
+			}
+		}
+
+		// The input IRP of that ms completes...
+		if (Paired)
+		{
+			OnImplicitFeedback(&Pipe, PacketSize, PacketFailed, Device->PacketsPerMs);
+		}
+
+		// ...and so does the oldest output IRP, which FlushBuffer() replaces,
+		// unless its completion is handled late, along with the next one.
+		Pending++;
+
+		if (Late)
+		{
+			continue;
+		}
+
+		for (; Pending && GetTransferSizeInFrames(&Pipe, Device->PacketsPerMs, FALSE); Pending--)
+		{
+			ULONG Fallbacks = Pipe.Fallbacks;
+
+			for (ULONG i = 0; i < Device->PacketsPerMs; i++)
+			{
+				Sent += GetTransferSizeInFrames(&Pipe, 1, TRUE);
+			}
+
+			if (Ms >= SettleTime)
+			{
+				Result->LateFallbacks += Pipe.Fallbacks - Fallbacks;
+			}
+		}
+
+		// How far the output runs ahead of what the device has played.
+		Distance = double(Sent) - double(Recorded);
+
+		if (Paired && (Ms == SettleTime) && (Ms > SETTLE_TIME))
+		{
+			Result->PairFallbacks = Pipe.Fallbacks - Result->PairFallbacks;
+		}
+
+		if (!Settled && (Ms >= SettleTime))
+		{
+			Settled = TRUE;
+
+			SettledDistance = Distance;
+		}
+
+		if (Settled && (fabs(Distance - SettledDistance) > Result->Wander))
+		{
+			Result->Wander = fabs(Distance - SettledDistance);
+		}
+
+		if (Settled)
+		{
+			Result->Drift = Distance - SettledDistance;
+		}
+	}
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(
+	int		argc,
+	char **	argv
+)
+{
+	ULONG Seconds = (argc > 1) ? strtoul(argv[1], NULL, 0) : NUMBER_OF_SECONDS;
+
+	if (!Seconds)
+	{
+		fprintf(stderr, "usage: pipepair [seconds]\n");
+		return 1;
+	}
+
+	static const DEVICE Devices[] =
+	{
+		//  name                    rate  packets depth     ppm  errors   late
+		{ "full speed",            48000,  1,  4,  +100.0,     0,     0 },
+		{ "full speed, 44.1k",     44100,  1,  8,   -80.0,     0,    97 },
+		{ "full speed, errors",    48000,  1,  2,  +250.0,  1000,    13 },
+		{ "high speed",            96000,  8,  4,   +50.0,     0,     0 },
+		{ "high speed, 44.1k",     44100,  8,  2,  -300.0,     0,    31 },
+		{ "high speed, errors",   192000,  8,  8,  -120.0,  5000,   250 },
+	};
+
+	printf("%lu s per run, paired again after %lu s\n", (unsigned long)Seconds, (unsigned long)Seconds / 2);
+	printf("device                  rate      ppm   drift (frames)     wander    fallbacks         errors\n");
+	printf("                                        before   paired    paired    pairing   late\n");
+
+	int Result = 0;
+
+	for (ULONG d = 0; d < sizeof(Devices) / sizeof(Devices[0]); d++)
+	{
+		RESULT Before, Paired;
+
+		Run(&Devices[d], FALSE, Seconds, &Before);
+
+		Run(&Devices[d], TRUE, Seconds, &Paired);
+
+		// Locked: the distance holds, but for what the sizes dropped by the
+		// pairing and the failed packets were off the nominal size by.
+		int Failed = Paired.LateFallbacks || (Paired.Wander > 1.0 + Paired.Errors) || (fabs(Paired.Drift) > 1.0 + Paired.Errors);
+
+		printf("%s  %-20s %6lu %+8.1f %8.1f %8.1f %9.1f %9u %6u %9u\n",
+			Failed ? "FAIL" : "ok  ", Devices[d].Name, (unsigned long)Devices[d].SampleRate, Devices[d].Ppm,
+			Before.Drift, Paired.Drift, Paired.Wander, Paired.PairFallbacks, Paired.LateFallbacks, Paired.Errors);
+
+		Result |= Failed;
+	}
+
+	printf("%s\n", Result ? "FAILED" : "PASSED");
+
+	return Result;
+}
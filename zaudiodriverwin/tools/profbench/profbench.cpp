@@ -0,0 +1,365 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       profbench.cpp
+ * @brief      Measures the language file lookups of CUsbDevice, with the
+ *             line scan of DrvProfileGetXxx() and with CDrvProfile.
+ * @details
+ * core/Profile.cpp is built as is, with tools/include/Common.h standing in
+ * for the driver's. A language file for a number of devices is generated,
+ * then for the last device in it:
+ *
+ *  - setup: what CUsbDevice::SetupLanguageSupport() looks up, i.e. the
+ *    LANGIDs, the descriptor indices and the configuration fixups.
+ *  - strings: one GetStringDescriptor() lookup per language and string.
+ *
+ * The CDrvProfile figures include parsing the file. Both ways must return
+ * the same values, or the program fails. This is a host tool, it is not part
+ * of the driver build. On Linux:
+ *
+ *     g++ -O2 -fshort-wchar -Wno-write-strings -I../include -o profbench profbench.cpp ../../driver/usbaud10/core/Profile.cpp
+ *     ./profbench [devices] [languages] [strings]
+ *//*
+ *****************************************************************************
+ */
+#include <time.h>
+#include <unistd.h>
+
+#include "../../driver/usbaud10/core/Profile.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Number of configuration fixups per device. */
+#define NUMBER_OF_FIXUPS	8
+
+/*! @brief Size of the string descriptor buffer, as in GetStringDescriptor(). */
+#define STRING_SIZE			127
+
+/*****************************************************************************
+ * Now()
+ *****************************************************************************
+ * @brief
+ * Monotonic time in ns.
+ */
+static double
+Now
+(	void
+)
+{
+	struct timespec Time;
+
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+
+	return (double)Time.tv_sec * 1e9 + (double)Time.tv_nsec;
+}
+
+/*****************************************************************************
+ * LanguageId()
+ *****************************************************************************
+ */
+static USHORT
+LanguageId
+(
+	unsigned	Language
+)
+{
+	return (USHORT)(0x0400 + Language + 1);
+}
+
+/*****************************************************************************
+ * WriteLanguageFile()
+ *****************************************************************************
+ * @brief
+ * Generate a language file in the layout SetupLanguageSupport() expects.
+ */
+static int
+WriteLanguageFile
+(
+	const char *	Path,
+	unsigned		NumberOfDevices,
+	unsigned		NumberOfLanguages,
+	unsigned		NumberOfStrings
+)
+{
+	FILE * File = fopen(Path, "wb");
+
+	if (!File)
+	{
+		return -1;
+	}
+
+	fprintf(File, "; Generated by profbench.\r\n");
+
+	for (unsigned d = 0; d < NumberOfDevices; d++)
+	{
+		unsigned ProductId = 0x3F00 + d;
+
+		fprintf(File, "\r\n[USB\\VID_041E&PID_%04X.LANGID]\r\n", ProductId);
+
+		for (unsigned l = 0; l < NumberOfLanguages; l++)
+		{
+			fprintf(File, "%u=%04X\r\n", l + 1, LanguageId(l));
+		}
+
+		fprintf(File, "\r\n[USB\\VID_041E&PID_%04X.FIXUP.100]\r\n", ProductId);
+		fprintf(File, "iManufacturer=01\r\niProduct=02\r\niSerialNumber=03\r\n");
+
+		for (unsigned f = 0; f < NUMBER_OF_FIXUPS; f++)
+		{
+			fprintf(File, "%u=%04X%02X%02X ; fixup %u\r\n", f + 1, 0x20 + f, f, f + 1, f);
+		}
+
+		for (unsigned l = 0; l < NumberOfLanguages; l++)
+		{
+			fprintf(File, "\r\n[USB\\VID_041E&PID_%04X.%04X]\r\n", ProductId, LanguageId(l));
+
+			for (unsigned s = 0; s < NumberOfStrings; s++)
+			{
+				char Text[64];
+
+				int Length = snprintf(Text, sizeof(Text), "E-MU device %04X string %u lang %u", ProductId, s + 1, l);
+
+				fprintf(File, "%u=\"", s + 1);
+
+				for (int i = 0; i < Length; i++)
+				{
+					fprintf(File, "\\%02X\\00", (unsigned char)Text[i]);
+				}
+
+				fprintf(File, "\"\r\n");
+			}
+		}
+	}
+
+	int Error = ferror(File);
+
+	fclose(File);
+
+	return Error ? -1 : 0;
+}
+
+/*****************************************************************************
+ * Lookups
+ *****************************************************************************
+ * The same lookups through either interface.
+ */
+typedef struct
+{
+	unsigned	Checksum;
+	unsigned	NumberOfLookups;
+} RESULT;
+
+template <class LOOKUP>
+static void
+Setup
+(
+	LOOKUP &	Lookup,
+	unsigned	ProductId,
+	RESULT *	Result
+)
+{
+	char SectionName[64]; sprintf(SectionName, "USB\\VID_041E&PID_%04X.LANGID", ProductId);
+
+	for (unsigned i = 0;; i++)
+	{
+		char KeyName[8]; sprintf(KeyName, "%d", i + 1);
+
+		USHORT wLANGID = Lookup.GetUshort(SectionName, KeyName, 0);
+
+		Result->Checksum = Result->Checksum * 31 + wLANGID;
+		Result->NumberOfLookups++;
+
+		if (!wLANGID) break;
+	}
+
+	sprintf(SectionName, "USB\\VID_041E&PID_%04X.FIXUP.%03X", ProductId, 0x100);
+
+	Result->Checksum = Result->Checksum * 31 + Lookup.GetUchar(SectionName, "iManufacturer", 0);
+	Result->Checksum = Result->Checksum * 31 + Lookup.GetUchar(SectionName, "iProduct", 0);
+	Result->Checksum = Result->Checksum * 31 + Lookup.GetUchar(SectionName, "iSerialNumber", 0);
+	Result->NumberOfLookups += 3;
+
+	for (unsigned i = 0;; i++)
+	{
+		char KeyName[8]; sprintf(KeyName, "%d", i + 1);
+
+		ULONG Entry = Lookup.GetUlong(SectionName, KeyName, 0xFFFFFFFF);
+
+		Result->Checksum = Result->Checksum * 31 + Entry;
+		Result->NumberOfLookups++;
+
+		if (Entry == 0xFFFFFFFF) break;
+	}
+}
+
+template <class LOOKUP>
+static void
+Strings
+(
+	LOOKUP &	Lookup,
+	unsigned	ProductId,
+	unsigned	NumberOfLanguages,
+	unsigned	NumberOfStrings,
+	RESULT *	Result
+)
+{
+	for (unsigned l = 0; l < NumberOfLanguages; l++)
+	{
+		char SectionName[64]; sprintf(SectionName, "USB\\VID_041E&PID_%04X.%04X", ProductId, LanguageId(l));
+
+		for (unsigned s = 0; s < NumberOfStrings; s++)
+		{
+			char KeyName[8]; sprintf(KeyName, "%d", s + 1);
+
+			WCHAR String[STRING_SIZE];
+
+			ULONG Length = Lookup.GetUnicodeString(SectionName, KeyName, (PWCHAR)L"", String, STRING_SIZE);
+
+			for (ULONG i = 0; i < Length; i++)
+			{
+				Result->Checksum = Result->Checksum * 31 + (unsigned)String[i];
+			}
+
+			Result->NumberOfLookups++;
+		}
+	}
+}
+
+/*! @brief The DrvProfileGetXxx() functions, which scan the file each time. */
+struct SCAN_LOOKUP
+{
+	LPWSTR	FilePathName;
+
+	USHORT GetUshort(LPSTR Section, LPSTR Key, USHORT Default) { return DrvProfileGetUshort(Section, Key, Default, FilePathName); }
+	UCHAR GetUchar(LPSTR Section, LPSTR Key, UCHAR Default) { return DrvProfileGetUchar(Section, Key, Default, FilePathName); }
+	ULONG GetUlong(LPSTR Section, LPSTR Key, ULONG Default) { return DrvProfileGetUlong(Section, Key, Default, FilePathName); }
+	ULONG GetUnicodeString(LPSTR Section, LPSTR Key, PWCHAR Default, PWCHAR String, DWORD Size) { return DrvProfileGetUnicodeString(Section, Key, Default, String, Size, FilePathName); }
+};
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(
+	int		argc,
+	char **	argv
+)
+{
+	unsigned NumberOfDevices = (argc > 1) ? (unsigned)strtoul(argv[1], NULL, 0) : 16;
+	unsigned NumberOfLanguages = (argc > 2) ? (unsigned)strtoul(argv[2], NULL, 0) : 16;
+	unsigned NumberOfStrings = (argc > 3) ? (unsigned)strtoul(argv[3], NULL, 0) : 24;
+
+	if (!NumberOfDevices || !NumberOfLanguages || !NumberOfStrings || (NumberOfLanguages > 126))
+	{
+		fprintf(stderr, "usage: profbench [devices] [languages (1-126)] [strings]\n");
+		return 1;
+	}
+
+	char Path[] = "/tmp/profbench.XXXXXX";
+
+	int Descriptor = mkstemp(Path);
+
+	if ((Descriptor < 0) || WriteLanguageFile(Path, NumberOfDevices, NumberOfLanguages, NumberOfStrings))
+	{
+		fprintf(stderr, "profbench: can't write the language file\n");
+		return 1;
+	}
+
+	WCHAR FilePathName[sizeof(Path)];
+
+	for (unsigned i = 0; i < sizeof(Path); i++)
+	{
+		FilePathName[i] = Path[i];
+	}
+
+	FILE * File = fopen(Path, "rb");
+	fseek(File, 0, SEEK_END);
+	long FileSize = ftell(File);
+	fclose(File);
+
+	printf("%u devices x %u languages x %u strings, %ld bytes\n", NumberOfDevices, NumberOfLanguages, NumberOfStrings, FileSize);
+
+	// The last device is the worst case for the scan.
+	unsigned ProductId = 0x3F00 + NumberOfDevices - 1;
+
+	RESULT ScanSetup = { 0, 0 }, ScanStrings = { 0, 0 };
+	RESULT IndexSetup = { 0, 0 }, IndexStrings = { 0, 0 };
+
+	SCAN_LOOKUP Scan = { FilePathName };
+
+	double Start = Now();
+
+	Setup(Scan, ProductId, &ScanSetup);
+
+	double ScanSetupTime = Now() - Start;
+
+	Start = Now();
+
+	Strings(Scan, ProductId, NumberOfLanguages, NumberOfStrings, &ScanStrings);
+
+	double ScanStringsTime = Now() - Start;
+
+	CDrvProfile Profile;
+
+	Start = Now();
+
+	if (!NT_SUCCESS(Profile.Open(FilePathName)))
+	{
+		fprintf(stderr, "profbench: can't parse the language file\n");
+		return 1;
+	}
+
+	double OpenTime = Now() - Start;
+
+	Start = Now();
+
+	Setup(Profile, ProductId, &IndexSetup);
+
+	double IndexSetupTime = Now() - Start;
+
+	Start = Now();
+
+	Strings(Profile, ProductId, NumberOfLanguages, NumberOfStrings, &IndexStrings);
+
+	double IndexStringsTime = Now() - Start;
+
+	Profile.Close();
+
+	unlink(Path);
+
+	if ((ScanSetup.Checksum != IndexSetup.Checksum) || (ScanStrings.Checksum != IndexStrings.Checksum))
+	{
+		fprintf(stderr, "profbench: the lookups differ\n");
+		return 1;
+	}
+
+	printf("         %8s %14s %14s\n", "lookups", "scan (us)", "index (us)");
+	printf("open     %8s %14s %14.1f\n", "", "", OpenTime / 1000);
+	printf("setup    %8u %14.1f %14.1f\n", ScanSetup.NumberOfLookups, ScanSetupTime / 1000, IndexSetupTime / 1000);
+	printf("strings  %8u %14.1f %14.1f\n", ScanStrings.NumberOfLookups, ScanStringsTime / 1000, IndexStringsTime / 1000);
+	printf("per string lookup: scan %.2f us, index %.3f us\n", ScanStringsTime / 1000 / ScanStrings.NumberOfLookups, IndexStringsTime / 1000 / IndexStrings.NumberOfLookups);
+
+	return 0;
+}
@@ -0,0 +1,443 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       ringtest.cpp
+ * @brief      Exercises the shared ring protocol (include/SharedRing.h).
+ * @details
+ * In one process, a producer and a consumer view of the same ring are run
+ * for many laps with random transfer sizes, checking the fill, the
+ * contiguous regions, the period boundaries crossed and the data. Then the
+ * control block is corrupted, and both sides must stall instead of going
+ * outside of the data area.
+ *
+ * Last, the ring is put in shared memory between two processes, as between
+ * the audio pin and the ASIO driver, and the consumer process checks every
+ * byte the producer process writes.
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     g++ -O2 -I../include -I../../include -o ringtest ringtest.cpp
+ *     ./ringtest [megabytes]
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "windows.h"
+#include "SharedRing.h"
+
+/*****************************************************************************
+ * Defines
+ */
+/*! @brief Number of single process laps. */
+#define NUMBER_OF_LAPS	1000
+
+/*****************************************************************************
+ * Check()
+ *****************************************************************************
+ * @brief
+ * Fail the program if Condition does not hold.
+ */
+static void
+Check
+(
+	IN		bool			Condition,
+	IN		const char *	What
+)
+{
+	if (!Condition)
+	{
+		fprintf(stderr, "FAILED: %s\n", What);
+		exit(1);
+	}
+}
+
+/*****************************************************************************
+ * Pattern()
+ *****************************************************************************
+ * @brief
+ * Byte at Offset in the stream. 251 is prime, so a misplaced chunk shows.
+ */
+static UCHAR
+Pattern
+(
+	IN		unsigned long long	Offset
+)
+{
+	return UCHAR(Offset % 251);
+}
+
+/*****************************************************************************
+ * Random()
+ *****************************************************************************
+ * @brief
+ * Transfer size in [1, Maximum].
+ */
+static ULONG
+Random
+(
+	IN		unsigned int *	Seed,
+	IN		ULONG			Maximum
+)
+{
+	return 1 + ULONG(rand_r(Seed)) % Maximum;
+}
+
+/*****************************************************************************
+ * Produce()
+ *****************************************************************************
+ * @brief
+ * Write up to Bytes of the stream at *Offset. Returns the periods crossed.
+ */
+static ULONG
+Produce
+(
+	IN		PSHARED_RING			Ring,
+	IN OUT	unsigned long long *	Offset,
+	IN		ULONG					Bytes
+)
+{
+	PUCHAR Data;
+
+	ULONG Region = SharedRingGetWriteRegion(Ring, &Data);
+
+	if (Bytes > Region)
+	{
+		Bytes = Region;
+	}
+
+	for (ULONG i=0; i<Bytes; i++)
+	{
+		Data[i] = Pattern(*Offset + i);
+	}
+
+	*Offset += Bytes;
+
+	return Bytes ? SharedRingAdvanceWrite(Ring, Bytes) : 0;
+}
+
+/*****************************************************************************
+ * Consume()
+ *****************************************************************************
+ * @brief
+ * Read and check up to Bytes of the stream at *Offset. Returns the periods
+ * crossed.
+ */
+static ULONG
+Consume
+(
+	IN		PSHARED_RING			Ring,
+	IN OUT	unsigned long long *	Offset,
+	IN		ULONG					Bytes
+)
+{
+	PUCHAR Data;
+
+	ULONG Region = SharedRingGetReadRegion(Ring, &Data);
+
+	if (Bytes > Region)
+	{
+		Bytes = Region;
+	}
+
+	for (ULONG i=0; i<Bytes; i++)
+	{
+		if (Data[i] != Pattern(*Offset + i))
+		{
+			fprintf(stderr, "FAILED: data at %llu\n", *Offset + i);
+			exit(1);
+		}
+	}
+
+	*Offset += Bytes;
+
+	return Bytes ? SharedRingAdvanceRead(Ring, Bytes) : 0;
+}
+
+/*****************************************************************************
+ * TestLaps()
+ *****************************************************************************
+ * @brief
+ * Both sides in one process, with random transfer sizes.
+ */
+static void
+TestLaps
+(
+	IN		ULONG	BufferSize,
+	IN		ULONG	PeriodSize
+)
+{
+	PVOID Memory = calloc(1, SHARED_RING_CONTROL_SIZE + BufferSize);
+
+	SHARED_RING Producer; SharedRingAttach(&Producer, Memory, BufferSize, PeriodSize);
+	SHARED_RING Consumer; SharedRingAttach(&Consumer, Memory, BufferSize, PeriodSize);
+
+	SharedRingReset(&Producer);
+
+	Check(SharedRingGetReadable(&Consumer) == 0, "new ring is empty");
+	Check(SharedRingGetWritable(&Producer) == BufferSize, "new ring has room");
+
+	unsigned int Seed = BufferSize ^ PeriodSize;
+
+	unsigned long long Written = 0, Read = 0;
+
+	ULONG WriteCrossed = 0, ReadCrossed = 0;
+
+	while (Read < (unsigned long long)(NUMBER_OF_LAPS) * BufferSize)
+	{
+		WriteCrossed += Produce(&Producer, &Written, Random(&Seed, BufferSize));
+
+		ULONG Readable = SharedRingGetReadable(&Consumer);
+		ULONG Writable = SharedRingGetWritable(&Producer);
+
+		Check(Readable == Written - Read, "fill follows the transfers");
+		Check(Readable + Writable == BufferSize, "fill and room add up");
+
+		ReadCrossed += Consume(&Consumer, &Read, Random(&Seed, BufferSize));
+
+		Check(WriteCrossed == Written / PeriodSize, "producer period boundaries");
+		Check(ReadCrossed == Read / PeriodSize, "consumer period boundaries");
+	}
+
+	// Whole periods never straddle the end of the data area.
+	SharedRingReset(&Producer);
+	SharedRingRewind(&Consumer);
+
+	for (ULONG i=0; i<3*BufferSize/PeriodSize; i++)
+	{
+		PUCHAR Data;
+
+		Check(SharedRingGetWriteRegion(&Producer, &Data) >= PeriodSize, "period fits in the write region");
+		Check(SharedRingAdvanceWrite(&Producer, PeriodSize) == 1, "a period crosses one boundary");
+
+		Check(SharedRingGetReadRegion(&Consumer, &Data) >= PeriodSize, "period fits in the read region");
+		Check(SharedRingAdvanceRead(&Consumer, PeriodSize) == 1, "a period crosses one boundary");
+	}
+
+	free(Memory);
+}
+
+/*****************************************************************************
+ * TestCorrupt()
+ *****************************************************************************
+ * @brief
+ * Positions written by the other side that make no sense stall the ring.
+ */
+static void
+TestCorrupt
+(
+	IN		ULONG	BufferSize,
+	IN		ULONG	PeriodSize
+)
+{
+	PVOID Memory = calloc(1, SHARED_RING_CONTROL_SIZE + BufferSize);
+
+	SHARED_RING Producer; SharedRingAttach(&Producer, Memory, BufferSize, PeriodSize);
+	SHARED_RING Consumer; SharedRingAttach(&Consumer, Memory, BufferSize, PeriodSize);
+
+	SharedRingReset(&Producer);
+
+	PUCHAR Data;
+
+	// Out of range.
+	Producer.Control->WritePosition = 2 * BufferSize;
+	Check(SharedRingGetReadable(&Consumer) == 0, "write position out of range");
+	Check(SharedRingGetReadRegion(&Consumer, &Data) == 0, "no read region");
+
+	Producer.Control->WritePosition = 0xFFFFFFFF;
+	Check(SharedRingGetReadable(&Consumer) == 0, "write position out of range");
+
+	Producer.Control->WritePosition = 0;
+	Consumer.Control->ReadPosition = 2 * BufferSize + 1;
+	Check(SharedRingGetWritable(&Producer) == 0, "read position out of range");
+	Check(SharedRingGetWriteRegion(&Producer, &Data) == 0, "no write region");
+
+	// More than a ring apart.
+	Producer.Control->WritePosition = BufferSize + 1;
+	Consumer.Control->ReadPosition = 0;
+	Check(SharedRingGetReadable(&Consumer) == 0, "fill over the buffer size");
+
+	Consumer.Control->ReadPosition = BufferSize - 1;
+	Check(SharedRingGetWritable(&Producer) == 0, "fill over the buffer size");
+
+	// Exactly a ring apart is full, not corrupt.
+	Producer.Control->WritePosition = BufferSize;
+	Consumer.Control->ReadPosition = 0;
+	Check(SharedRingGetReadable(&Consumer) == BufferSize, "full ring");
+
+	// The counters.
+	SharedRingReset(&Producer);
+	SharedRingOverrun(&Producer);
+	SharedRingOverrun(&Producer);
+	SharedRingUnderrun(&Consumer);
+	Check((Producer.Control->Overruns == 2) && (Producer.Control->Underruns == 1), "overrun and underrun counts");
+
+	free(Memory);
+}
+
+/*****************************************************************************
+ * TestProcesses()
+ *****************************************************************************
+ * @brief
+ * Producer and consumer in two processes, over shared memory.
+ */
+static void
+TestProcesses
+(
+	IN		ULONG				BufferSize,
+	IN		ULONG				PeriodSize,
+	IN		unsigned long long	TotalBytes
+)
+{
+	PVOID Memory = mmap(NULL, SHARED_RING_CONTROL_SIZE + BufferSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	Check(Memory != MAP_FAILED, "mmap");
+
+	SHARED_RING Producer; SharedRingAttach(&Producer, Memory, BufferSize, PeriodSize);
+
+	SharedRingReset(&Producer);
+
+	struct timespec Start; clock_gettime(CLOCK_MONOTONIC, &Start);
+
+	pid_t Child = fork();
+
+	Check(Child >= 0, "fork");
+
+	if (Child == 0)
+	{
+		SHARED_RING Consumer; SharedRingAttach(&Consumer, Memory, BufferSize, PeriodSize);
+
+		unsigned int Seed = 2;
+
+		unsigned long long Read = 0;
+
+		ULONG Crossed = 0;
+
+		while (Read < TotalBytes)
+		{
+			ULONG Bytes = Random(&Seed, BufferSize);
+
+			if (Bytes > TotalBytes - Read)
+			{
+				Bytes = ULONG(TotalBytes - Read);
+			}
+
+			if (!SharedRingGetReadable(&Consumer))
+			{
+				sched_yield();
+			}
+
+			Crossed += Consume(&Consumer, &Read, Bytes);
+		}
+
+		_exit((Crossed == TotalBytes / PeriodSize) ? 0 : 2);
+	}
+
+	unsigned int Seed = 1;
+
+	unsigned long long Written = 0;
+
+	ULONG Crossed = 0;
+
+	while (Written < TotalBytes)
+	{
+		ULONG Bytes = Random(&Seed, BufferSize);
+
+		if (Bytes > TotalBytes - Written)
+		{
+			Bytes = ULONG(TotalBytes - Written);
+		}
+
+		if (!SharedRingGetWritable(&Producer))
+		{
+			sched_yield();
+		}
+
+		Crossed += Produce(&Producer, &Written, Bytes);
+	}
+
+	int Status = 0;
+
+	waitpid(Child, &Status, 0);
+
+	struct timespec Stop; clock_gettime(CLOCK_MONOTONIC, &Stop);
+
+	double Seconds = (Stop.tv_sec - Start.tv_sec) + (Stop.tv_nsec - Start.tv_nsec) / 1e9;
+
+	Check(WIFEXITED(Status) && (WEXITSTATUS(Status) == 0), "consumer process");
+	Check(Crossed == TotalBytes / PeriodSize, "producer period boundaries");
+
+	printf("  %7u/%5u: %llu MB across processes, %.0f MB/s\n", BufferSize, PeriodSize, TotalBytes >> 20, (TotalBytes >> 20) / Seconds);
+
+	munmap(Memory, SHARED_RING_CONTROL_SIZE + BufferSize);
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ * @brief
+ * Entry point.
+ */
+int
+main
+(
+	int		argc,
+	char *	argv[]
+)
+{
+	unsigned long long Megabytes = (argc > 1) ? strtoull(argv[1], NULL, 0) : 64;
+
+	Check(sizeof(SHARED_RING_CONTROL) == SHARED_RING_CONTROL_SIZE, "control block size");
+
+	// Ring and period sizes as the ASIO driver asks for them: 8 periods of
+	// channels * samples * bytes per sample (and an odd one).
+	static const ULONG Sizes[][2] =
+	{
+		{ 8 * 2 * 32 * 3,		2 * 32 * 3 },
+		{ 8 * 2 * 256 * 2,		2 * 256 * 2 },
+		{ 8 * 6 * 441 * 3,		6 * 441 * 3 },
+		{ 8 * 8 * 2048 * 4,		8 * 2048 * 4 },
+		{ 3 * 7,				7 }
+	};
+
+	printf("shared ring\n");
+
+	for (ULONG i=0; i<sizeof(Sizes)/sizeof(Sizes[0]); i++)
+	{
+		TestLaps(Sizes[i][0], Sizes[i][1]);
+
+		TestCorrupt(Sizes[i][0], Sizes[i][1]);
+
+		TestProcesses(Sizes[i][0], Sizes[i][1], Megabytes << 20);
+	}
+
+	printf("passed\n");
+
+	return 0;
+}
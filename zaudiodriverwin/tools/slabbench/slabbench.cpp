@@ -0,0 +1,395 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       slabbench.cpp
+ * @brief      Measures the cost of setting up the FIFO work items of a data
+ *             pipe, with and without the slab (see core/FifoSlab.h).
+ * @details
+ * Each cycle is what CAudioDataPipe::SetTransferParameters() does when a
+ * stream is opened or its format changes: free the work items of the last
+ * stream, set up new ones, and touch each URB and transfer buffer once as
+ * the first transfer would.
+ *
+ *  - pool: every cycle allocates and frees the item, IRP, URB and buffer of
+ *    each work item, as the pipe used to: new(NonPagedPool)
+ *    AUDIO_FIFO_WORK_ITEM, CUsbDevice::CreateIrp(), ExAllocatePoolWithTag()
+ *    for the URB and the buffer, and AUDIO_FIFO_WORK_ITEM::Destruct().
+ *  - slab: CAudioFifoSlab::Allocate(), which only allocates the first time
+ *    through, then CAudioFifoSlab::GetItem() for each item, as
+ *    PrepareXxxSpeedFifoWorkItems() do. The slab is freed after the last
+ *    cycle.
+ *
+ * core/FifoSlab.cpp and core/UsbDev.cpp are built as they are, on the
+ * kernel in tools/include; the program is the lower device object the IRPs
+ * are created for. Before timing, the items are checked to be cleared, on
+ * their own cache lines and each with an IRP. The C library's heap stands
+ * in for the non-paged pool and is a lot cheaper than it, so the pool
+ * figures are a lower bound. This is a host tool, it is not part of the
+ * driver build. On Linux:
+ *
+ *     g++ -O2 -fshort-wchar -Wno-write-strings -Wno-multichar -DTOOLS_KERNEL \
+ *         -I../include -I../../driver/usbaud10/core -I../../driver/usbaud10/include \
+ *         -I../../driver/include -I../../include -o slabbench slabbench.cpp \
+ *         ../../driver/usbaud10/core/{FifoSlab,UsbDev,Profile,DbgTrace}.cpp
+ *     ./slabbench [cycles]
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Common.h"
+#include "Audio.h"
+
+/*****************************************************************************
+ * Variables
+ */
+/*! @brief The USB stack under CUsbDevice. */
+static DRIVER_OBJECT LowerDriverObject;
+static DEVICE_OBJECT LowerDeviceObject;
+
+/*! @brief Keeps the compiler from dropping the stores. */
+static volatile ULONG Sink;
+
+/*****************************************************************************
+ * Now()
+ *****************************************************************************
+ * @brief
+ * Monotonic time in ns.
+ */
+static double
+Now
+(	void
+)
+{
+	struct timespec Time;
+
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+
+	return double(Time.tv_sec) * 1e9 + double(Time.tv_nsec);
+}
+
+/*****************************************************************************
+ * CompleteRequest()
+ *****************************************************************************
+ * @brief
+ * The USB stack: CUsbDevice::Init() asks for the bus interface and the
+ * destructor unconfigures the device. Neither is supported.
+ */
+static NTSTATUS
+CompleteRequest
+(
+	PDEVICE_OBJECT	DeviceObject,
+	PIRP			Irp
+)
+{
+	UNREFERENCED_PARAMETER(DeviceObject);
+
+	NTSTATUS ntStatus = Irp->IoStatus.Status;
+
+	if (IoGetCurrentIrpStackLocation(Irp)->MajorFunction == IRP_MJ_INTERNAL_DEVICE_CONTROL)
+	{
+		ntStatus = Irp->IoStatus.Status = STATUS_UNSUCCESSFUL;
+	}
+
+	IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+	return ntStatus;
+}
+
+/*****************************************************************************
+ * SetUpItem()
+ *****************************************************************************
+ * @brief
+ * Fill in a work item as PrepareXxxSpeedFifoWorkItems() do, then touch the
+ * URB and buffer as the first transfer would.
+ */
+static void
+SetUpItem
+(
+	PAUDIO_FIFO_WORK_ITEM	FifoWorkItem,
+	ULONG					NumberOfPackets,
+	ULONG					PacketSize
+)
+{
+	FifoWorkItem->Context = FifoWorkItem;
+	FifoWorkItem->Read = FALSE;
+	FifoWorkItem->Tag = NULL;
+	FifoWorkItem->FifoMapped = FALSE;
+	FifoWorkItem->NumberOfPackets = NumberOfPackets;
+	FifoWorkItem->PacketSize = PacketSize;
+	FifoWorkItem->FifoBufferSize = NumberOfPackets * PacketSize;
+	FifoWorkItem->BytesInFifoBuffer = 0;
+	FifoWorkItem->TransferSize = 0;
+	FifoWorkItem->TransferAsap = FALSE;
+	FifoWorkItem->Flags = 0x1;
+
+	memset(FifoWorkItem->Urb, 0, GET_ISO_URB_SIZE(NumberOfPackets));
+	memset(FifoWorkItem->FifoBuffer, 0x5A, FifoWorkItem->FifoBufferSize);
+
+	Sink += FifoWorkItem->FifoBuffer[FifoWorkItem->FifoBufferSize - 1];
+}
+
+/*****************************************************************************
+ * PoolCycle()
+ *****************************************************************************
+ * @brief
+ * One start/stop cycle with an allocation per item, IRP, URB and buffer.
+ */
+static NTSTATUS
+PoolCycle
+(
+	CUsbDevice *	UsbDevice,
+	ULONG			NumberOfPackets,
+	ULONG			PacketSize
+)
+{
+	PAUDIO_FIFO_WORK_ITEM FifoWorkItems[MAX_AUDIO_IRP];
+
+	NTSTATUS ntStatus = STATUS_SUCCESS;
+
+	for (ULONG i = 0; i < MAX_AUDIO_IRP; i++)
+	{
+		PAUDIO_FIFO_WORK_ITEM FifoWorkItem = FifoWorkItems[i] = new(NonPagedPool) AUDIO_FIFO_WORK_ITEM();
+
+		if (!FifoWorkItem)
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		ntStatus = UsbDevice->CreateIrp(&FifoWorkItem->Irp);
+
+		if (!NT_SUCCESS(ntStatus))
+		{
+			return ntStatus;
+		}
+
+		FifoWorkItem->Urb = PURB(ExAllocatePoolWithTag(NonPagedPool, GET_ISO_URB_SIZE(NumberOfPackets), 'mdW'));
+		FifoWorkItem->FifoBuffer = PUCHAR(ExAllocatePoolWithTag(NonPagedPool, NumberOfPackets * PacketSize, 'mdW'));
+
+		if (!FifoWorkItem->Urb || !FifoWorkItem->FifoBuffer)
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		SetUpItem(FifoWorkItem, NumberOfPackets, PacketSize);
+	}
+
+	for (ULONG i = 0; i < MAX_AUDIO_IRP; i++)
+	{
+		FifoWorkItems[i]->Destruct();
+	}
+
+	return ntStatus;
+}
+
+/*****************************************************************************
+ * SlabCycle()
+ *****************************************************************************
+ * @brief
+ * One start/stop cycle out of the slab.
+ */
+static NTSTATUS
+SlabCycle
+(
+	CAudioFifoSlab *	FifoSlab,
+	CUsbDevice *		UsbDevice,
+	ULONG				NumberOfPackets,
+	ULONG				PacketSize
+)
+{
+	NTSTATUS ntStatus = FifoSlab->Allocate(UsbDevice, MAX_AUDIO_IRP, NumberOfPackets, NumberOfPackets * PacketSize);
+
+	for (ULONG i = 0; (i < MAX_AUDIO_IRP) && NT_SUCCESS(ntStatus); i++)
+	{
+		PAUDIO_FIFO_WORK_ITEM FifoWorkItem = FifoSlab->GetItem(i);
+
+		if (FifoWorkItem)
+		{
+			SetUpItem(FifoWorkItem, NumberOfPackets, PacketSize);
+		}
+		else
+		{
+			ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+		}
+	}
+
+	return ntStatus;
+}
+
+/*****************************************************************************
+ * CheckSlab()
+ *****************************************************************************
+ * @brief
+ * The items GetItem() hands out after a cycle are cleared but for their
+ * IRP, URB and buffer, which are distinct and on their own cache lines.
+ */
+static BOOL
+CheckSlab
+(
+	CAudioFifoSlab *	FifoSlab,
+	ULONG				NumberOfPackets,
+	ULONG				PacketSize
+)
+{
+	if (FifoSlab->GetNumberOfItems() != MAX_AUDIO_IRP)
+	{
+		return FALSE;
+	}
+
+	PUCHAR Previous = NULL;
+
+	for (ULONG i = 0; i < MAX_AUDIO_IRP; i++)
+	{
+		PAUDIO_FIFO_WORK_ITEM FifoWorkItem = FifoSlab->GetItem(i);
+
+		PUCHAR Item = PUCHAR(FifoWorkItem);
+		PUCHAR Urb = PUCHAR(FifoWorkItem->Urb);
+		PUCHAR Buffer = FifoWorkItem->FifoBuffer;
+
+		if (!FifoWorkItem->Irp || FifoWorkItem->Context || FifoWorkItem->Flags || FifoWorkItem->NumberOfPackets)
+		{
+			return FALSE;
+		}
+
+		if ((ULONG_PTR(Item) | ULONG_PTR(Urb) | ULONG_PTR(Buffer)) & (AUDIO_FIFO_SLAB_ALIGNMENT - 1))
+		{
+			return FALSE;
+		}
+
+		if ((Urb < Item + sizeof(AUDIO_FIFO_WORK_ITEM)) || (Buffer < Urb + GET_ISO_URB_SIZE(NumberOfPackets)) ||
+			(Previous && (Item < Previous + NumberOfPackets * PacketSize)))
+		{
+			return FALSE;
+		}
+
+		Previous = Buffer;
+	}
+
+	return (FifoSlab->GetItem(MAX_AUDIO_IRP) == NULL);
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(
+	int		argc,
+	char **	argv
+)
+{
+	ULONG Cycles = (argc > 1) ? strtoul(argv[1], NULL, 0) : 100000;
+
+	static const struct
+	{
+		const char *	Name;
+		ULONG			NumberOfPackets;
+		ULONG			PacketSize;
+	} Configurations[] =
+	{
+		{ "full speed, 96kHz 24-bit stereo", 1, 582 },
+		{ "high speed, 192kHz 24-bit 4ch", 8, 300 },
+	};
+
+	if (!Cycles)
+	{
+		fprintf(stderr, "usage: slabbench [cycles]\n");
+		return 1;
+	}
+
+	LowerDriverObject.MajorFunction[IRP_MJ_PNP] = CompleteRequest;
+	LowerDriverObject.MajorFunction[IRP_MJ_INTERNAL_DEVICE_CONTROL] = CompleteRequest;
+	LowerDeviceObject.DriverObject = &LowerDriverObject;
+	LowerDeviceObject.StackSize = 3;
+
+	CUsbDevice * UsbDevice = new(NonPagedPool) CUsbDevice(NULL);
+
+	if (!UsbDevice)
+	{
+		fprintf(stderr, "slabbench: out of memory\n");
+		return 1;
+	}
+
+	UsbDevice->AddRef();
+
+	UsbDevice->Init(&LowerDeviceObject, NULL, NULL);
+
+	printf("%lu cycles of %u work items\n", (unsigned long)Cycles, MAX_AUDIO_IRP);
+
+	for (ULONG c = 0; c < sizeof(Configurations) / sizeof(Configurations[0]); c++)
+	{
+		ULONG NumberOfPackets = Configurations[c].NumberOfPackets;
+		ULONG PacketSize = Configurations[c].PacketSize;
+
+		CAudioFifoSlab FifoSlab;
+
+		// Warm up both paths.
+		if (!NT_SUCCESS(PoolCycle(UsbDevice, NumberOfPackets, PacketSize)) ||
+			!NT_SUCCESS(SlabCycle(&FifoSlab, UsbDevice, NumberOfPackets, PacketSize)))
+		{
+			fprintf(stderr, "slabbench: out of memory\n");
+			return 1;
+		}
+
+		if (!CheckSlab(&FifoSlab, NumberOfPackets, PacketSize))
+		{
+			printf("FAILED: %s: the slab's items are not laid out as CAudioFifoSlab documents\n", Configurations[c].Name);
+			return 1;
+		}
+
+		double Start = Now();
+
+		for (ULONG i = 0; i < Cycles; i++)
+		{
+			if (!NT_SUCCESS(PoolCycle(UsbDevice, NumberOfPackets, PacketSize)))
+			{
+				fprintf(stderr, "slabbench: out of memory\n");
+				return 1;
+			}
+		}
+
+		double PoolTime = (Now() - Start) / Cycles;
+
+		Start = Now();
+
+		for (ULONG i = 0; i < Cycles; i++)
+		{
+			SlabCycle(&FifoSlab, UsbDevice, NumberOfPackets, PacketSize);
+		}
+
+		double SlabTime = (Now() - Start) / Cycles;
+
+		FifoSlab.Free();
+
+		printf("%s (%lu x %lu bytes per item)\n", Configurations[c].Name, (unsigned long)NumberOfPackets, (unsigned long)PacketSize);
+		printf("    pool: %9.1f ns per cycle\n", PoolTime);
+		printf("    slab: %9.1f ns per cycle (%.2fx)\n", SlabTime, PoolTime / SlabTime);
+	}
+
+	UsbDevice->Release();
+
+	return 0;
+}
@@ -0,0 +1,292 @@
+/*
+   This file is part of the EMU CA0189 USB Audio Driver.
+
+   Copyright (C) 2008 EMU Systems/Creative Technology Ltd.
+
+   This driver is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This driver is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library.   If not, a copy of the GNU Lesser General Public
+   License can be found at <http://www.gnu.org/licenses/>.
+*/
+/*
+ *****************************************************************************
+ *//*!
+ * @file       tracedec.c
+ * @brief      Decodes the binary trace of the driver into a timeline.
+ * @details
+ * The input is one or more KSPROPERTY_DEVICECONTROL_TRACE results written
+ * back to back (see driver/include/dbgtrace.h). The records of all the CPUs
+ * are merged by timestamp and printed one per line:
+ *
+ *     <time in us since the trace started> <delta in us> <cpu> <event> <arguments>
+ *
+ * This is a host tool, it is not part of the driver build. On Linux:
+ *
+ *     cc -O2 -I../include -I../../driver/include -o tracedec tracedec.c
+ *     ./tracedec dump.bin [more.bin ...]     (or read from stdin)
+ *
+ * The dumps are little-endian, so are the hosts this is used on.
+ *//*
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "windows.h"
+
+#define DBG_TRACE_FORMAT_ONLY
+#include "dbgtrace.h"
+
+/*****************************************************************************
+ * Event table
+ */
+typedef struct
+{
+	const char *	Name;
+	const char *	Arguments;
+} EVENT_INFO;
+
+#define DBG_TRACE_INFO(Id, Name, Arguments)	{ Name, Arguments },
+
+static const EVENT_INFO EventInfo[DBG_TRACE_MAX_EVENT] =
+{
+	{ "none", "" },
+	DBG_TRACE_EVENTS(DBG_TRACE_INFO)
+};
+
+/*****************************************************************************
+ * ReadInput()
+ *****************************************************************************
+ * @brief
+ * Append the content of a file to the buffer.
+ */
+static int
+ReadInput
+(
+	FILE *			File,
+	unsigned char **Buffer,
+	size_t *		Size
+)
+{
+	size_t Capacity = *Size;
+
+	for (;;)
+	{
+		if (Capacity - *Size < 65536)
+		{
+			Capacity = Capacity ? Capacity * 2 : 1048576;
+
+			unsigned char * NewBuffer = realloc(*Buffer, Capacity);
+
+			if (!NewBuffer)
+			{
+				return -1;
+			}
+
+			*Buffer = NewBuffer;
+		}
+
+		size_t BytesRead = fread(*Buffer + *Size, 1, Capacity - *Size, File);
+
+		if (!BytesRead)
+		{
+			break;
+		}
+
+		*Size += BytesRead;
+	}
+
+	return ferror(File) ? -1 : 0;
+}
+
+/*****************************************************************************
+ * CompareRecords()
+ *****************************************************************************
+ * @brief
+ * Order the records by timestamp, then by CPU and position in the ring.
+ */
+static int
+CompareRecords
+(
+	const void *	A,
+	const void *	B
+)
+{
+	const DBG_TRACE_RECORD * RecordA = (const DBG_TRACE_RECORD *)A;
+	const DBG_TRACE_RECORD * RecordB = (const DBG_TRACE_RECORD *)B;
+
+	if (RecordA->Timestamp != RecordB->Timestamp)
+	{
+		return (RecordA->Timestamp < RecordB->Timestamp) ? -1 : 1;
+	}
+
+	if (RecordA->Cpu != RecordB->Cpu)
+	{
+		return (RecordA->Cpu < RecordB->Cpu) ? -1 : 1;
+	}
+
+	return (RecordA->Sequence < RecordB->Sequence) ? -1 : (RecordA->Sequence > RecordB->Sequence);
+}
+
+/*****************************************************************************
+ * main()
+ *****************************************************************************
+ */
+int
+main
+(
+	int		argc,
+	char **	argv
+)
+{
+	unsigned char * Input = NULL;
+	size_t InputSize = 0;
+
+	if (argc < 2)
+	{
+		if (ReadInput(stdin, &Input, &InputSize))
+		{
+			fprintf(stderr, "tracedec: failed to read stdin\n");
+			return 1;
+		}
+	}
+	else
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			FILE * File = fopen(argv[i], "rb");
+
+			if (!File || ReadInput(File, &Input, &InputSize))
+			{
+				fprintf(stderr, "tracedec: failed to read %s\n", argv[i]);
+				return 1;
+			}
+
+			fclose(File);
+		}
+	}
+
+	// Collect the records of all the chunks. The calibration of the last
+	// chunk covers the longest interval, so it is the most accurate.
+	DBG_TRACE_HEADER Header;
+	DBG_TRACE_RECORD * Records = NULL;
+	size_t NumberOfRecords = 0;
+	unsigned long long LostRecords = 0;
+	int HaveHeader = 0;
+
+	for (size_t Offset = 0; Offset < InputSize; )
+	{
+		DBG_TRACE_HEADER Chunk;
+
+		if (InputSize - Offset < sizeof(Chunk))
+		{
+			fprintf(stderr, "tracedec: truncated header at offset %zu\n", Offset);
+			break;
+		}
+
+		memcpy(&Chunk, Input + Offset, sizeof(Chunk));
+
+		if ((Chunk.Signature != DBG_TRACE_SIGNATURE) || (Chunk.Version != DBG_TRACE_VERSION) ||
+			(Chunk.HeaderSize < sizeof(DBG_TRACE_HEADER)) || (Chunk.RecordSize < sizeof(DBG_TRACE_RECORD)))
+		{
+			fprintf(stderr, "tracedec: bad header at offset %zu\n", Offset);
+			break;
+		}
+
+		size_t ChunkSize = Chunk.HeaderSize + (size_t)Chunk.NumberOfRecords * Chunk.RecordSize;
+
+		if (InputSize - Offset < ChunkSize)
+		{
+			fprintf(stderr, "tracedec: truncated records at offset %zu\n", Offset);
+			break;
+		}
+
+		DBG_TRACE_RECORD * NewRecords = realloc(Records, (NumberOfRecords + Chunk.NumberOfRecords + 1) * sizeof(DBG_TRACE_RECORD));
+
+		if (!NewRecords)
+		{
+			fprintf(stderr, "tracedec: out of memory\n");
+			return 1;
+		}
+
+		Records = NewRecords;
+
+		for (ULONG i = 0; i < Chunk.NumberOfRecords; i++)
+		{
+			memcpy(&Records[NumberOfRecords++], Input + Offset + Chunk.HeaderSize + (size_t)i * Chunk.RecordSize, sizeof(DBG_TRACE_RECORD));
+		}
+
+		LostRecords += Chunk.LostRecords;
+
+		Header = Chunk;
+		HaveHeader = 1;
+
+		Offset += ChunkSize;
+	}
+
+	if (!HaveHeader)
+	{
+		fprintf(stderr, "tracedec: no trace found\n");
+		return 1;
+	}
+
+	// Timestamp ticks per second.
+	double TicksPerSecond = (double)Header.CounterFrequency;
+
+	if ((Header.CounterNow > Header.CounterStart) && (Header.TimestampNow > Header.TimestampStart))
+	{
+		TicksPerSecond = (double)(Header.TimestampNow - Header.TimestampStart) * (double)Header.CounterFrequency / (double)(Header.CounterNow - Header.CounterStart);
+	}
+
+	if (TicksPerSecond <= 0)
+	{
+		fprintf(stderr, "tracedec: bad calibration\n");
+		return 1;
+	}
+
+	qsort(Records, NumberOfRecords, sizeof(DBG_TRACE_RECORD), CompareRecords);
+
+	printf("# %zu records, %llu lost, %.0f ticks/s\n", NumberOfRecords, LostRecords, TicksPerSecond);
+	printf("#      time(us)    delta(us) cpu event            arguments\n");
+
+	ULONGLONG Previous = Header.TimestampStart;
+
+	for (size_t i = 0; i < NumberOfRecords; i++)
+	{
+		const DBG_TRACE_RECORD * Record = &Records[i];
+
+		double Time = (double)(long long)(Record->Timestamp - Header.TimestampStart) * 1000000.0 / TicksPerSecond;
+		double Delta = (double)(long long)(Record->Timestamp - Previous) * 1000000.0 / TicksPerSecond;
+
+		Previous = Record->Timestamp;
+
+		printf("%15.3f %12.3f %3u ", Time, Delta, Record->Cpu);
+
+		if ((Record->Event > DBG_TRACE_NONE) && (Record->Event < DBG_TRACE_MAX_EVENT))
+		{
+			printf("%-16s ", EventInfo[Record->Event].Name);
+			printf(EventInfo[Record->Event].Arguments, Record->Argument[0], Record->Argument[1], Record->Argument[2], Record->Argument[3]);
+		}
+		else
+		{
+			printf("event-%-10u %08x %08x %08x %08x", Record->Event, Record->Argument[0], Record->Argument[1], Record->Argument[2], Record->Argument[3]);
+		}
+
+		printf("\n");
+	}
+
+	free(Records);
+	free(Input);
+
+	return 0;
+}